@@ -0,0 +1,401 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fastdtoa.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace Akumuli {
+
+namespace {
+
+// Grisu2 implementation after Florian Loitsch, "Printing Floating-Point
+// Numbers Quickly and Accurately with Integers" (PLDI 2010).
+
+//! Hand-made floating point number - 64-bit significand and binary exponent.
+struct DiyFp {
+    uint64_t f;
+    int      e;
+};
+
+const int      DP_SIGNIFICAND_SIZE = 52;
+const int      DP_EXPONENT_BIAS    = 0x3FF + DP_SIGNIFICAND_SIZE;
+const uint64_t DP_EXPONENT_MASK    = 0x7FF0000000000000ull;
+const uint64_t DP_SIGNIFICAND_MASK = 0x000FFFFFFFFFFFFFull;
+const uint64_t DP_HIDDEN_BIT       = 0x0010000000000000ull;
+
+static DiyFp diy_fp_sub(DiyFp x, DiyFp y) {
+    return { x.f - y.f, x.e };
+}
+
+static DiyFp diy_fp_mul(DiyFp x, DiyFp y) {
+    unsigned __int128 p = static_cast<unsigned __int128>(x.f) * y.f;
+    uint64_t h = static_cast<uint64_t>(p >> 64);
+    if (static_cast<uint64_t>(p) & (1ull << 63)) {
+        h++;  // round
+    }
+    return { h, x.e + y.e + 64 };
+}
+
+static DiyFp double2diy_fp(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(d));
+    int biased_e = static_cast<int>((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+    if (biased_e != 0) {
+        return { significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS };
+    }
+    return { significand, 1 - DP_EXPONENT_BIAS };
+}
+
+static DiyFp normalize_boundary(DiyFp in) {
+    while (!(in.f & (DP_HIDDEN_BIT << 1))) {
+        in.f <<= 1;
+        in.e--;
+    }
+    in.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+    in.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+    return in;
+}
+
+//! Compute normalized boundaries of the rounding interval of `d`.
+static void normalized_boundaries(double d, DiyFp* minus, DiyFp* plus) {
+    DiyFp v = double2diy_fp(d);
+    bool lower_boundary_is_closer = v.f == DP_HIDDEN_BIT;
+    DiyFp pl = normalize_boundary({ (v.f << 1) + 1, v.e - 1 });
+    DiyFp mi = lower_boundary_is_closer ? DiyFp{ (v.f << 2) - 1, v.e - 2 }
+                                        : DiyFp{ (v.f << 1) - 1, v.e - 1 };
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *plus  = pl;
+    *minus = mi;
+}
+
+// Cached powers of ten - 10^-348, 10^-340, ..., 10^340 (step 8).
+static const uint64_t CACHED_POWERS_F[] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull, 0xcf42894a5dce35eaull,
+    0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull, 0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full,
+    0xbe5691ef416bd60cull, 0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull, 0xc21094364dfb5637ull,
+    0x9096ea6f3848984full, 0xd77485cb25823ac7ull, 0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull,
+    0xb23867fb2a35b28eull, 0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull, 0xb5b5ada8aaff80b8ull,
+    0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull, 0x964e858c91ba2655ull, 0xdff9772470297ebdull,
+    0xa6dfbd9fb8e5b88full, 0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull, 0xaa242499697392d3ull,
+    0xfd87b5f28300ca0eull, 0xbce5086492111aebull, 0x8cbccc096f5088ccull, 0xd1b71758e219652cull,
+    0x9c40000000000000ull, 0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull, 0x9f4f2726179a2245ull,
+    0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull, 0x83c7088e1aab65dbull, 0xc45d1df942711d9aull,
+    0x924d692ca61be758ull, 0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull, 0x952ab45cfa97a0b3ull,
+    0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull, 0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull,
+    0x88fcf317f22241e2ull, 0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull, 0x8bab8eefb6409c1aull,
+    0xd01fef10a657842cull, 0x9b10a4e5e9913129ull, 0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull,
+    0x80444b5e7aa7cf85ull, 0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const int16_t CACHED_POWERS_E[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007,  -980,
+     -954,  -927,  -901,  -874,  -847,  -821,  -794,  -768,  -741,  -715,
+     -688,  -661,  -635,  -608,  -582,  -555,  -529,  -502,  -475,  -449,
+     -422,  -396,  -369,  -343,  -316,  -289,  -263,  -236,  -210,  -183,
+     -157,  -130,  -103,   -77,   -50,   -24,     3,    30,    56,    83,
+      109,   136,   162,   189,   216,   242,   269,   295,   322,   348,
+      375,   402,   428,   455,   481,   508,   534,   561,   588,   614,
+      641,   667,   694,   720,   747,   774,   800,   827,   853,   880,
+      907,   933,   960,   986,  1013,  1039,  1066,
+};
+
+static DiyFp get_cached_power(int e, int* K) {
+    // k = ceil((-61 - e) * 1/log2(10)) + 347
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = static_cast<int>(dk);
+    if (dk - k > 0.0) {
+        k++;
+    }
+    unsigned index = static_cast<unsigned>((k >> 3) + 1);
+    *K = -(-348 + static_cast<int>(index << 3));
+    return { CACHED_POWERS_F[index], CACHED_POWERS_E[index] };
+}
+
+static int count_decimal_digits(uint32_t n) {
+    if (n < 10) return 1;
+    if (n < 100) return 2;
+    if (n < 1000) return 3;
+    if (n < 10000) return 4;
+    if (n < 100000) return 5;
+    if (n < 1000000) return 6;
+    if (n < 10000000) return 7;
+    if (n < 100000000) return 8;
+    if (n < 1000000000) return 9;
+    return 10;
+}
+
+static void grisu_round(char* buffer, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void digit_gen(DiyFp W, DiyFp Mp, uint64_t delta, char* buffer, int* len, int* K) {
+    static const uint32_t POW10[] = { 1, 10, 100, 1000, 10000, 100000,
+                                      1000000, 10000000, 100000000, 1000000000 };
+    DiyFp one = { 1ull << -Mp.e, Mp.e };
+    DiyFp wp_w = diy_fp_sub(Mp, W);
+    uint32_t p1 = static_cast<uint32_t>(Mp.f >> -one.e);
+    uint64_t p2 = Mp.f & (one.f - 1);
+    int kappa = count_decimal_digits(p1);
+    *len = 0;
+    while (kappa > 0) {
+        uint32_t d = p1 / POW10[kappa - 1];
+        p1 %= POW10[kappa - 1];
+        if (d || *len) {
+            buffer[(*len)++] = static_cast<char>('0' + d);
+        }
+        kappa--;
+        uint64_t tmp = (static_cast<uint64_t>(p1) << -one.e) + p2;
+        if (tmp <= delta) {
+            *K += kappa;
+            grisu_round(buffer, *len, delta, tmp,
+                        static_cast<uint64_t>(POW10[kappa]) << -one.e, wp_w.f);
+            return;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = static_cast<char>(p2 >> -one.e);
+        if (d || *len) {
+            buffer[(*len)++] = static_cast<char>('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            grisu_round(buffer, *len, delta, p2, one.f, wp_w.f * POW10[-kappa]);
+            return;
+        }
+    }
+}
+
+//! Convert positive finite double to decimal digits and exponent.
+static void grisu2(double value, char* digits, int* length, int* K) {
+    DiyFp w_m, w_p;
+    normalized_boundaries(value, &w_m, &w_p);
+    DiyFp c_mk = get_cached_power(w_p.e, K);
+    DiyFp v = double2diy_fp(value);
+    while (!(v.f & (1ull << 63))) {
+        v.f <<= 1;
+        v.e--;
+    }
+    DiyFp W  = diy_fp_mul(v, c_mk);
+    DiyFp Wp = diy_fp_mul(w_p, c_mk);
+    DiyFp Wm = diy_fp_mul(w_m, c_mk);
+    Wm.f++;
+    Wp.f--;
+    digit_gen(W, Wp, Wp.f - Wm.f, digits, length, K);
+}
+
+//! Layout digits the way "%g" does it - plain, fractional or scientific.
+static int emit_digits(const char* digits, int ndigits, int K, char* out) {
+    int kk = ndigits + K;  // 10^(kk-1) <= value < 10^kk
+    char* p = out;
+    if (0 <= kk && kk <= 21 && ndigits <= kk) {
+        // 1234e7 -> 12340000000
+        memcpy(p, digits, ndigits);
+        p += ndigits;
+        for (int i = ndigits; i < kk; i++) {
+            *p++ = '0';
+        }
+    } else if (0 < kk && kk <= 21) {
+        // 1234e-2 -> 12.34
+        memcpy(p, digits, kk);
+        p += kk;
+        *p++ = '.';
+        memcpy(p, digits + kk, ndigits - kk);
+        p += ndigits - kk;
+    } else if (-6 < kk && kk <= 0) {
+        // 1234e-8 -> 0.00001234
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = 0; i < -kk; i++) {
+            *p++ = '0';
+        }
+        memcpy(p, digits, ndigits);
+        p += ndigits;
+    } else {
+        // 1234e30 -> 1.234e+33
+        *p++ = digits[0];
+        if (ndigits > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, ndigits - 1);
+            p += ndigits - 1;
+        }
+        *p++ = 'e';
+        int e = kk - 1;
+        if (e < 0) {
+            *p++ = '-';
+            e = -e;
+        } else {
+            *p++ = '+';
+        }
+        char tmp[4];
+        int n = 0;
+        do {
+            tmp[n++] = static_cast<char>('0' + e % 10);
+            e /= 10;
+        } while (e);
+        while (n) {
+            *p++ = tmp[--n];
+        }
+    }
+    return static_cast<int>(p - out);
+}
+
+}  // anonymous namespace
+
+int format_double(double value, char* buffer, size_t size) {
+    if (!std::isfinite(value)) {
+        int len = snprintf(buffer, size, "%.17g", value);
+        if (len < 0 || static_cast<size_t>(len) >= size) {
+            return -1;
+        }
+        return len;
+    }
+    char work[32];
+    int pos = 0;
+    if (std::signbit(value)) {
+        work[pos++] = '-';
+        value = -value;
+    }
+    if (value == 0.0) {
+        work[pos++] = '0';
+    } else {
+        char digits[20];
+        int length, K;
+        grisu2(value, digits, &length, &K);
+        pos += emit_digits(digits, length, K, work + pos);
+    }
+    if (static_cast<size_t>(pos) >= size) {
+        return -1;
+    }
+    memcpy(buffer, work, pos);
+    buffer[pos] = '\0';
+    return pos;
+}
+
+// Powers of ten that can be represented exactly by a double
+static const double POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+int parse_double(const char* str, double* result) {
+    const char* p = str;
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int      ndigits  = 0;      // significant digits accumulated
+    int      exponent = 0;      // decimal exponent of the mantissa
+    bool     imprecise = false;  // digits were dropped
+    bool     seen      = false;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        seen = true;
+        if (mantissa == 0 && *p == '0') {
+            continue;  // leading zeroes
+        }
+        if (ndigits == 19) {
+            // Drop the digit but keep the magnitude
+            imprecise = true;
+            exponent++;
+            continue;
+        }
+        mantissa = mantissa*10 + (*p & 0x0F);
+        ndigits++;
+    }
+    if (*p == '.') {
+        p++;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            seen = true;
+            if (mantissa == 0 && *p == '0') {
+                exponent--;  // leading zeroes after the point
+                continue;
+            }
+            if (ndigits == 19) {
+                imprecise = true;
+                continue;
+            }
+            mantissa = mantissa*10 + (*p & 0x0F);
+            ndigits++;
+            exponent--;
+        }
+    }
+    if (!seen) {
+        // Not a simple number (inf, nan, hex) - delegate to strtod
+        char* end = nullptr;
+        *result = strtod(str, &end);
+        return end == str ? -1 : static_cast<int>(end - str);
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char* q = p + 1;
+        int esign = 1;
+        if (*q == '-' || *q == '+') {
+            esign = *q == '-' ? -1 : 1;
+            q++;
+        }
+        if (*q >= '0' && *q <= '9') {
+            int evalue = 0;
+            for (; *q >= '0' && *q <= '9'; q++) {
+                // Clamped, overly large values fall through to strtod
+                evalue = std::min(evalue*10 + (*q & 0x0F), 100000);
+            }
+            exponent += esign*evalue;
+            p = q;
+        }
+        // Dangling 'e' is not part of the number, same as strtod
+    }
+    if (!imprecise && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        // Both the mantissa and the scale are exact so a single multiply
+        // (or divide) produces a correctly rounded result
+        double value = static_cast<double>(mantissa);
+        if (exponent < 0) {
+            value /= POW10[-exponent];
+        } else {
+            value *= POW10[exponent];
+        }
+        *result = negative ? -value : value;
+        return static_cast<int>(p - str);
+    }
+    char* end = nullptr;
+    *result = strtod(str, &end);
+    return end == str ? -1 : static_cast<int>(end - str);
+}
+
+}  // namespace
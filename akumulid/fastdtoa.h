@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstddef>
+
+namespace Akumuli {
+
+/** Fast double to string conversion (Grisu2 algorithm).
+  * Produces a short decimal representation that reads back to the exact same
+  * double value (the output is also the shortest such representation for the
+  * vast majority of inputs). About an order of magnitude faster than snprintf
+  * with "%.17g". NaN and infinity are delegated to snprintf.
+  * @param value Value to format.
+  * @param buffer Output buffer.
+  * @param size Output buffer size.
+  * @return Number of characters written (terminating '\0' is written but not
+  *         counted) or -1 if the buffer is too small.
+  */
+int format_double(double value, char* buffer, size_t size);
+
+/** Fast string to double conversion.
+  * Parses the common case (optional sign, up to 19 significant digits,
+  * optional fractional part and decimal exponent) with integer arithmetic
+  * and a power-of-ten multiply, which is exact as long as the significand
+  * fits 53 bits and the exponent is small. Everything else (very long
+  * numbers, huge exponents, inf/nan) is delegated to strtod. Several times
+  * faster than strtod for typical metric values.
+  * @param str Zero-terminated input string.
+  * @param result Output parameter.
+  * @return Number of characters consumed or -1 if the input is not a number.
+  */
+int parse_double(const char* str, double* result);
+
+}  // namespace
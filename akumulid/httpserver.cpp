@@ -1,4 +1,5 @@
 #include "httpserver.h"
+#include "peer_stats.h"
 #include "utility.h"
 #include <cstring>
 #include <thread>
@@ -99,6 +100,12 @@ static int accept_connection(void           *cls,
         std::string path = url;
         if (path == "/stats") {
             std::string stats = queryproc->get_all_stats();
+            // Splice per-peer ingestion counters into the stats document
+            auto pos = stats.rfind('}');
+            if (pos != std::string::npos) {
+                stats = stats.substr(0, pos) + ",\"tcp_peers\":" +
+                        PeerStats::instance().to_json() + "}" + stats.substr(pos + 1);
+            }
             auto response = MHD_create_response_from_buffer(stats.size(), const_cast<char*>(stats.data()), MHD_RESPMEM_MUST_COPY);
             int ret = MHD_add_response_header(response, "content-type", "application/json");
             if (ret == MHD_NO) {
@@ -1,5 +1,7 @@
 #include "ingestion_pipeline.h"
+#include "akumuli_tracepoints.h"
 #include "logger.h"
+#include "topology.h"
 #include "utility.h"
 
 #include <thread>
@@ -75,6 +77,14 @@ aku_Status AkumuliConnection::write(aku_Sample const& sample) {
     return aku_write(db_, &sample);
 }
 
+u64 AkumuliConnection::get_write_sequence() {
+    return aku_get_write_sequence(db_);
+}
+
+u64 AkumuliConnection::get_durability_watermark() {
+    return aku_get_durability_watermark(db_);
+}
+
 std::shared_ptr<DbCursor> AkumuliConnection::search(std::string query) {
     aku_Cursor* cursor = aku_query(db_, query.c_str());
     return std::make_shared<AkumuliCursor>(cursor);
@@ -92,6 +102,11 @@ std::string AkumuliConnection::get_all_stats() {
     std::vector<char> buffer;
     buffer.resize(0x1000);
     int nbytes = aku_json_stats(db_, buffer.data(), buffer.size());
+    if (nbytes < -1) {
+        // Buffer is too small, `aku_json_stats` reports the required size
+        buffer.resize(static_cast<size_t>(-nbytes) + 1);
+        nbytes = aku_json_stats(db_, buffer.data(), buffer.size());
+    }
     if (nbytes > 0) {
         return std::string(buffer.data(), buffer.data() + nbytes);
     }
@@ -99,12 +114,22 @@ std::string AkumuliConnection::get_all_stats() {
 }
 
 // Pipeline spout
-PipelineSpout::PipelineSpout(std::shared_ptr<Queue> q, BackoffPolicy bp, std::shared_ptr<DbConnection> con)
+
+//! Fibonacci hash of the series id (ids are sequential, mod alone shards poorly)
+static u32 get_queue_ix(aku_ParamId id, size_t nqueues) {
+    return static_cast<u32>((id * 0x9E3779B97F4A7C15ull) >> 32) % nqueues;
+}
+
+PipelineSpout::PipelineSpout(std::vector<PQueue> queues, BackoffPolicy bp, SpoutPriority priority,
+                             std::shared_ptr<DbConnection> con)
     : created_{0}
     , deleted_{0}
+    , completed_wseq_{0}
     , pool_()
-    , queue_(q)
+    , queues_(std::move(queues))
     , backoff_(bp)
+    , priority_(priority)
+    , shed_{0}
     , logger_("pipeline-spout", 32)
     , db_(con)
 {
@@ -122,27 +147,46 @@ void PipelineSpout::set_error_cb(PipelineErrorCb cb) {
 }
 
 void PipelineSpout::write(const aku_Sample& sample) {
+    ProfilerStageGuard stage(AKU_STAGE_PIPELINE);
     int ix = get_index_of_empty_slot();
+    int spin_count = 0;
     while (AKU_UNLIKELY(ix < 0)) {
-        ix = get_index_of_empty_slot();
-        if (ix < 0 && backoff_ == AKU_LINEAR_BACKOFF) {
+        if (backoff_ == AKU_LINEAR_BACKOFF) {
             std::this_thread::yield();
-            continue;
-        } else if ( ix < 0 && backoff_ == AKU_THROTTLE) {
+        } else if (priority_ == AKU_PRIORITY_LOW) {
+            // AKU_THROTTLE with low priority - shed the sample after a
+            // short spin instead of stalling the receiver, the remaining
+            // pool slots are left for the high priority sessions
+            if (++spin_count >= SHED_SPIN_LIMIT) {
+                shed_++;
+                return;
+            }
+            std::this_thread::yield();
+        } else {
+            // AKU_THROTTLE - the session is expected to stop reading from
+            // the socket when `is_congested` returns true so the pool
+            // should drain shortly
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            return;
         }
+        ix = get_index_of_empty_slot();
     }
 
     auto pvalue = pool_.at(ix).get();
 
     pvalue->sample   =     sample;
     pvalue->cnt      =  &deleted_;
+    pvalue->wseq     = &completed_wseq_;
     pvalue->on_error = &on_error_;
+    pvalue->busy     =          1;
 
-    while (!queue_->push(pvalue)) {
+    // Route the value by the series hash so samples of one series always
+    // land in the same writer thread
+    auto qix = get_queue_ix(sample.paramid, queues_.size());
+    auto& queue = queues_.at(qix);
+    while (!queue->push(pvalue)) {
         std::this_thread::yield();
     }
+    AKU_PROBE2(sample_enqueued, sample.paramid, qix);
 }
 
 aku_Status PipelineSpout::series_to_param_id(const char *str, size_t strlen, aku_Sample *sample) {
@@ -158,6 +202,11 @@ int PipelineSpout::get_index_of_empty_slot() {
     if (created_ - deleted_ < POOL_SIZE) {
         // There is some space in the pool
         auto result = created_  % POOL_SIZE;
+        // Writer threads complete values out of order so this slot can
+        // still be in flight even when the pool has space
+        if (pool_.at(result)->busy) {
+            return -1;
+        }
         created_++;
         return result;
     }
@@ -168,14 +217,40 @@ bool PipelineSpout::is_empty() const {
     return created_ == deleted_;
 }
 
+bool PipelineSpout::is_congested() const {
+    // Leave some headroom in the pool so the samples that are already
+    // parsed can be written without blocking. Low priority sessions are
+    // paused at half the pool so the high priority ones always have
+    // slots to take.
+    u64 watermark = priority_ == AKU_PRIORITY_LOW ? POOL_SIZE/2
+                                                  : POOL_SIZE - POOL_SIZE/4;
+    return (created_ - deleted_) >= watermark;
+}
+
+u64 PipelineSpout::get_shed_count() const {
+    return shed_;
+}
+
+u64 PipelineSpout::get_completed_count() const {
+    return deleted_;
+}
+
+u64 PipelineSpout::get_completed_sequence() const {
+    return completed_wseq_;
+}
+
+u64 PipelineSpout::get_durability_watermark() const {
+    return db_->get_durability_watermark();
+}
+
 // Ingestion pipeline
 
-IngestionPipeline::IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffPolicy bp)
+IngestionPipeline::IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffPolicy bp, bool busy_poll)
     : con_(con)
-    , ixmake_{0}
-    , stopbar_(2)
-    , startbar_(2)
+    , stopbar_(N_WRITERS + 1)
+    , startbar_(N_WRITERS + 1)
     , backoff_(bp)
+    , busy_poll_(busy_poll)
     , logger_("ingestion-pipeline", 32)
 
 {
@@ -186,80 +261,115 @@ IngestionPipeline::IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffP
 
 void IngestionPipeline::start() {
     auto self = shared_from_this();
-    auto worker = [self]() {
-        try {
-            self->logger_.info() << "Starting pipeline worker";
-            self->startbar_.wait();
-            self->logger_.info() << "Pipeline worker started";
-
-            // Write loop (should be unique)
-            PipelineSpout::TVal *val;
-            int poison_cnt = 0;
-            std::vector<PipelineSpout::PQueue> queues = self->queues_;
-            const int IDLE_THRESHOLD = 0x10000;
-            int idle_count = 0;
-            for (int ix = 0; true; ix++) {
-                auto& qref = queues.at(ix % N_QUEUES);
-                if (qref->pop(val)) {
-                    idle_count = 0;
-                    // New write
-                    if (AKU_UNLIKELY(val->cnt == nullptr)) {  //poisoned
-                        poison_cnt++;
-                        if (poison_cnt == N_QUEUES) {
-                            // Check
-                            for (auto& x: self->queues_) {
-                                if (!x->empty()) {
-                                    self->logger_.error() << "Queue not empty, some data will be lost.";
+    // Every writer thread drains its own disjoint subset of the queues
+    const int QUEUES_PER_WRITER = N_QUEUES / N_WRITERS;
+    for (int wix = 0; wix < N_WRITERS; wix++) {
+        auto worker = [self, wix, QUEUES_PER_WRITER]() {
+            try {
+                // Keep the writer shard and its storage writes on one NUMA node
+                auto const& topo = Topology::instance();
+                if (!topo.bind_to_node(topo.node_for_worker(wix))) {
+                    self->logger_.info() << "can't set pipeline worker affinity";
+                }
+                self->logger_.info() << "Starting pipeline worker " << wix;
+                self->startbar_.wait();
+                self->logger_.info() << "Pipeline worker " << wix << " started";
+
+                // Write loop (one per writer shard)
+                PipelineSpout::TVal *vals[BATCH_SIZE];
+                int poison_cnt = 0;
+                std::vector<PipelineSpout::PQueue> queues(
+                        self->queues_.begin() +  wix      * QUEUES_PER_WRITER,
+                        self->queues_.begin() + (wix + 1) * QUEUES_PER_WRITER);
+                const int IDLE_THRESHOLD = 0x10000;
+                const int SPIN_LIMIT     = 0x400000;
+                // Adaptive spin budget (busy-poll mode) - grows while
+                // spinning pays off, decays back when it doesn't
+                int spin_budget = IDLE_THRESHOLD;
+                int idle_count = 0;
+                for (int ix = 0; true; ix++) {
+                    auto& qref = queues.at(ix % QUEUES_PER_WRITER);
+                    // Pop the whole batch at once to amortize the cost of the
+                    // queue rotation
+                    int nvals = 0;
+                    while (nvals < BATCH_SIZE && qref->pop(vals[nvals])) {
+                        nvals++;
+                    }
+                    if (nvals) {
+                        if (self->busy_poll_) {
+                            spin_budget = idle_count < spin_budget
+                                        ? std::min(spin_budget*2, SPIN_LIMIT)
+                                        : std::max(spin_budget/2, IDLE_THRESHOLD);
+                        }
+                        idle_count = 0;
+                        for (int i = 0; i < nvals; i++) {
+                            auto val = vals[i];
+                            // New write
+                            if (AKU_UNLIKELY(val->cnt == nullptr)) {  //poisoned
+                                poison_cnt++;
+                                if (poison_cnt == QUEUES_PER_WRITER) {
+                                    // Check
+                                    for (auto& x: queues) {
+                                        if (!x->empty()) {
+                                            self->logger_.error() << "Queue not empty, some data will be lost.";
+                                        }
+                                    }
+                                    // Stop
+                                    self->logger_.info() << "Stopping pipeline worker " << wix;
+                                    self->stopbar_.wait();
+                                    self->logger_.info() << "Pipeline worker " << wix << " stopped";
+                                    return;
+                                }
+                            } else {
+                                auto error = self->con_->write(val->sample);
+                                // Record the sequence that covers this
+                                // sample before the completion counter is
+                                // bumped - acks are issued against it
+                                u64 seq = self->con_->get_write_sequence();
+                                u64 cur = val->wseq->load();
+                                while (cur < seq && !val->wseq->compare_exchange_weak(cur, seq)) {
                                 }
+                                (*val->cnt)++;
+                                if (AKU_UNLIKELY(error != AKU_SUCCESS)) {
+                                    (*val->on_error)(error, *val->cnt);
+                                }
+                                val->busy = 0;  // release the pool slot
                             }
-                            self->logger_.info() << "Closing akumuli database";
-                            self->con_->close();
-                            // Stop
-                            self->logger_.info() << "Stopping pipeline worker";
-                            self->stopbar_.wait();
-                            self->logger_.info() << "Pipeline worker stopped";
-                            return;
                         }
                     } else {
-                        auto error = self->con_->write(val->sample);
-                        (*val->cnt)++;
-                        if (AKU_UNLIKELY(error != AKU_SUCCESS)) {
-                            (*val->on_error)(error, *val->cnt);
-                        }
-                    }
-                } else {
-                    idle_count++;
-                    if (idle_count > IDLE_THRESHOLD) {
-                        if (idle_count % N_QUEUES == 0) {
-                            // in idle state
-                            // check all queues and go idle again
-                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        idle_count++;
+                        auto threshold = self->busy_poll_ ? spin_budget : IDLE_THRESHOLD;
+                        if (idle_count > threshold) {
+                            if (idle_count % QUEUES_PER_WRITER == 0) {
+                                // in idle state
+                                // check all queues and go idle again
+                                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                            }
                         }
                     }
                 }
+            } catch (...) {
+                // Fatal error. Report. Die!
+                self->logger_.error() << "Fatal error in ingestion pipeline worker thread!";
+                self->logger_.error() << boost::current_exception_diagnostic_information();
+                throw;
             }
-        } catch (...) {
-            // Fatal error. Report. Die!
-            self->logger_.error() << "Fatal error in ingestion pipeline worker thread!";
-            self->logger_.error() << boost::current_exception_diagnostic_information();
-            throw;
-        }
-    };
+        };
 
-    std::thread th(worker);
-    th.detach();
+        std::thread th(worker);
+        th.detach();
+    }
 
     logger_.info() << "Starting pipeline";
     startbar_.wait();
     logger_.info() << "Pipeline started";
 }
 
-std::shared_ptr<PipelineSpout> IngestionPipeline::make_spout() {
-    ixmake_++;
-    return std::make_shared<PipelineSpout>(queues_.at(ixmake_ % N_QUEUES), backoff_, con_);
+std::shared_ptr<PipelineSpout> IngestionPipeline::make_spout(SpoutPriority priority) {
+    return std::make_shared<PipelineSpout>(queues_, backoff_, priority, con_);
 }
 
-PipelineSpout::TVal* IngestionPipeline::POISON = new PipelineSpout::TVal{{}, nullptr, nullptr};
+PipelineSpout::TVal* IngestionPipeline::POISON = new PipelineSpout::TVal{{}, nullptr, nullptr, nullptr};
 
 int IngestionPipeline::TIMEOUT = 15000;  // 15 seconds
 
@@ -270,8 +380,10 @@ void IngestionPipeline::stop() {
             std::this_thread::yield();
         }
     }
-    logger_.info() << "Trying to stop pipeline, waiting for worker to stop";
+    logger_.info() << "Trying to stop pipeline, waiting for workers to stop";
     stopbar_.wait();
+    logger_.info() << "Closing akumuli database";
+    con_->close();
     logger_.info() << "Pipeline stopped (IngestionPipeline::stop)";
 }
 
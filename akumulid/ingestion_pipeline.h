@@ -56,6 +56,12 @@ struct DbConnection {
     //! Write value to DB
     virtual aku_Status write(const aku_Sample& sample) = 0;
 
+    //! Get the sequence number of the last acknowledged write
+    virtual u64 get_write_sequence() = 0;
+
+    //! Get the durability watermark (writes at or below it are on disk)
+    virtual u64 get_durability_watermark() = 0;
+
     //! Execute search query
     virtual std::shared_ptr<DbCursor> search(std::string query) = 0;
 
@@ -89,6 +95,10 @@ public:
 
     virtual aku_Status write(const aku_Sample& sample);
 
+    virtual u64 get_write_sequence();
+
+    virtual u64 get_durability_watermark();
+
     virtual std::shared_ptr<DbCursor> search(std::string query);
 
     virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size);
@@ -107,6 +117,16 @@ enum BackoffPolicy {
     AKU_LINEAR_BACKOFF,
 };
 
+/** Ingestion priority class.
+  * Assigned per listener (and with it per session). When the pipeline is
+  * saturated low priority spouts are throttled earlier and their samples
+  * are shed first, so the high priority sessions keep their latency.
+  */
+enum SpoutPriority {
+    AKU_PRIORITY_HIGH,
+    AKU_PRIORITY_LOW,
+};
+
 
 //! Callback from pipeline to session
 typedef std::function<void(aku_Status, u64)> PipelineErrorCb;
@@ -115,7 +135,7 @@ typedef std::function<void(aku_Status, u64)> PipelineErrorCb;
 /** Pipeline's spout.
   * Object of this class can be used to ingest data to pipeline.
   * It should be connected with IngestionPipeline instance with
-  * the shared queue. Pooling is used to simplify allocator's
+  * the shared queues (entries are routed by the series id hash). Pooling is used to simplify allocator's
   * life. All TVals should be deleted in the same thread where
   * they was created. This shuld minimize contention inside
   * allocator and limit overall memory usage (no need to create
@@ -128,6 +148,8 @@ struct PipelineSpout : ProtocolConsumer {
         //! PVal pool size
         POOL_SIZE = 0x200,
         QCAP      = 0x10,
+        //! Spin budget of a low priority spout before the sample is shed
+        SHED_SPIN_LIMIT = 0x100,
     };
 
     // Typedefs
@@ -136,7 +158,9 @@ struct PipelineSpout : ProtocolConsumer {
     typedef struct {
         aku_Sample       sample;                      //< Value
         SpoutCounter*    cnt;                         //< Pointer to spout's shared counter
+        SpoutCounter*    wseq;                        //< Pointer to spout's completion sequence
         PipelineErrorCb* on_error;                    //< On error callback
+        std::atomic<int> busy;                        //< Slot is in flight (writers complete out of order)
     } TVal;                                           //< Value
     typedef std::shared_ptr<TVal>         PVal;       //< Pointer to value
     typedef queue<TVal*>                  Queue;      //< Queue class
@@ -147,16 +171,23 @@ struct PipelineSpout : ProtocolConsumer {
     SpoutCounter        created_;  //< Created elements counter
     Padding             pad0;
     SpoutCounter        deleted_;  //< Deleted elements counter
+    //! DB write sequence that covers every completed sample of this spout.
+    //! Updated by the writer thread before the completion counter is
+    //! bumped so the ack path never claims more than the sequence covers.
+    SpoutCounter        completed_wseq_;
     std::vector<PVal>   pool_;     //< TVal pool
     Padding             pad1;
-    PQueue              queue_;  //< Queue
+    std::vector<PQueue> queues_;  //< Pipeline queues (one per writer shard)
     const BackoffPolicy backoff_;
+    const SpoutPriority priority_;  //< Priority class of the session
+    SpoutCounter        shed_;      //< Samples shed under overload (low priority only)
     Logger              logger_;    //< Logger instance
     PipelineErrorCb     on_error_;  //< Session callback
     PDatabase           db_;
 
     // C-tor
-    PipelineSpout(std::shared_ptr<Queue> q, BackoffPolicy bp, std::shared_ptr<DbConnection> con);
+    PipelineSpout(std::vector<PQueue> queues, BackoffPolicy bp, SpoutPriority priority,
+                  std::shared_ptr<DbConnection> con);
     ~PipelineSpout();
 
     void set_error_cb(PipelineErrorCb cb);
@@ -178,33 +209,61 @@ struct PipelineSpout : ProtocolConsumer {
 
     /** Returns true if all TVal's is processed */
     bool is_empty() const;
+
+    /** Returns true if the pool is close to exhaustion and the session
+      * should pause reads from the socket until the pool drains.
+      * Low priority spouts report congestion at half the pool so their
+      * sessions back off while the high priority ones can still write.
+      */
+    bool is_congested() const;
+
+    //! Returns number of samples dropped because of overload
+    u64 get_shed_count() const;
+
+    //! Returns number of samples that completed the write
+    u64 get_completed_count() const;
+
+    //! Returns the DB write sequence that covers the completed samples
+    u64 get_completed_sequence() const;
+
+    //! Returns the durability watermark of the database
+    u64 get_durability_watermark() const;
 };
 
+/** Pipeline topology.
+  * Spouts route each sample to one of the queues by the series id hash,
+  * every writer thread drains a disjoint subset of the queues so samples
+  * of one series are always written by the same thread (per-series
+  * ordering is preserved) and the pipeline scales with cores.
+  */
 class IngestionPipeline : public std::enable_shared_from_this<IngestionPipeline> {
     enum {
-        N_QUEUES = 8,
+        N_QUEUES   = 8,      //< Number of queues (should be divisible by N_WRITERS)
+        N_WRITERS  = 4,      //< Number of writer threads
+        BATCH_SIZE = 0x100,  //< Number of TVals the worker pops from a queue at once
     };
     typedef boost::barrier             Barr;
     std::shared_ptr<DbConnection>      con_;       //< DB connection
     std::vector<PipelineSpout::PQueue> queues_;    //< Queues collection
-    std::atomic<int>                   ixmake_;    //< Index for the make_spout mehtod
     Barr                               stopbar_;   //< Stopping barrier
     Barr                               startbar_;  //< Stopping barrier
     static PipelineSpout::TVal*        POISON;     //< Poisoned object to stop worker thread
     static int                         TIMEOUT;    //< Close timeout
     const BackoffPolicy                backoff_;   //< Back-pressure policy
+    const bool                         busy_poll_; //< Spin adaptively instead of sleeping when idle
     Logger                             logger_;    //< Logger instance
 public:
     /** Create new pipeline topology.
       */
-    IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffPolicy bp = AKU_THROTTLE);
+    IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffPolicy bp = AKU_THROTTLE,
+                      bool busy_poll = false);
 
     /** Run pipeline topology.
       */
     void start();
 
     /** Add new pipeline spout. */
-    std::shared_ptr<PipelineSpout> make_spout();
+    std::shared_ptr<PipelineSpout> make_spout(SpoutPriority priority = AKU_PRIORITY_HIGH);
 
     void stop();
 };
@@ -17,6 +17,104 @@ CircularBuffer::CircularBuffer(CircularBuffer&& other)
 {
 }
 
+AsyncLogSink::Ring::Ring()
+    : records(RING_SIZE)
+    , head{0}
+    , tail{0}
+    , dropped{0}
+{
+}
+
+AsyncLogSink& AsyncLogSink::instance() {
+    static AsyncLogSink sink;
+    return sink;
+}
+
+AsyncLogSink::AsyncLogSink()
+    : stop_{0}
+{
+    flusher_ = std::thread([this]() {
+        while (stop_.load(std::memory_order_relaxed) == 0) {
+            if (flush_rings() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        // Drain what's left before shutdown
+        flush_rings();
+    });
+}
+
+AsyncLogSink::~AsyncLogSink() {
+    stop_.store(1, std::memory_order_relaxed);
+    flusher_.join();
+}
+
+AsyncLogSink::Ring* AsyncLogSink::get_ring() {
+    static thread_local Ring* ring = nullptr;
+    if (ring == nullptr) {
+        std::lock_guard<std::mutex> guard(rings_lock_);
+        rings_.emplace_back(new Ring());
+        ring = rings_.back().get();
+    }
+    return ring;
+}
+
+void AsyncLogSink::push(log4cxx::LoggerPtr logger, std::string message, Severity severity) {
+    auto ring = get_ring();
+    auto head = ring->head.load(std::memory_order_relaxed);
+    auto tail = ring->tail.load(std::memory_order_acquire);
+    if (head - tail == RING_SIZE) {
+        // Overload - dropping is cheaper than stalling the hot path
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& record    = ring->records[head & (RING_SIZE - 1)];
+    record.logger   = std::move(logger);
+    record.message  = std::move(message);
+    record.severity = severity;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+size_t AsyncLogSink::flush_rings() {
+    std::vector<Ring*> rings;
+    {
+        // The vector can be resized by a newly registered thread
+        std::lock_guard<std::mutex> guard(rings_lock_);
+        for (auto& ring: rings_) {
+            rings.push_back(ring.get());
+        }
+    }
+    size_t nflushed = 0;
+    for (auto ring: rings) {
+        auto tail = ring->tail.load(std::memory_order_relaxed);
+        auto head = ring->head.load(std::memory_order_acquire);
+        while (tail != head) {
+            auto& record = ring->records[tail & (RING_SIZE - 1)];
+            switch (record.severity) {
+            case SEV_TRACE:
+                LOG4CXX_TRACE(record.logger, record.message);
+                break;
+            case SEV_INFO:
+                LOG4CXX_INFO(record.logger, record.message);
+                break;
+            case SEV_ERROR:
+                LOG4CXX_ERROR(record.logger, record.message);
+                break;
+            };
+            record.logger  = nullptr;
+            record.message = std::string();
+            tail++;
+            ring->tail.store(tail, std::memory_order_release);
+            nflushed++;
+        }
+        auto ndropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (ndropped != 0) {
+            LOG4CXX_ERROR(s_common_logger_, std::to_string(ndropped) + " log records dropped");
+        }
+    }
+    return nflushed;
+}
+
 }
 
 Formatter::Formatter()
@@ -26,9 +124,10 @@ Formatter::Formatter()
 }
 
 Formatter::~Formatter() {
+    auto& sink = details::AsyncLogSink::instance();
     switch (sink_) {
     case LOGGER_INFO:
-        LOG4CXX_INFO(logger_, str_.str());
+        sink.push(logger_, str_.str(), details::AsyncLogSink::SEV_INFO);
         break;
     case LOGGER_ERROR: {
         std::vector<std::string> trace;
@@ -44,14 +143,17 @@ Formatter::~Formatter() {
                 }
             }
         }
+        // The records go into the same ring so the flusher keeps them in order
         if (!trace.empty()) {
-            LOG4CXX_TRACE(logger_, "=Begin=trace=======================================================");
-            for(auto msg: trace) {
-                LOG4CXX_TRACE(logger_, msg);
+            sink.push(logger_, "=Begin=trace=======================================================",
+                      details::AsyncLogSink::SEV_TRACE);
+            for(auto& msg: trace) {
+                sink.push(logger_, std::move(msg), details::AsyncLogSink::SEV_TRACE);
             }
-            LOG4CXX_TRACE(logger_, "==========================================================End=trace=");
+            sink.push(logger_, "==========================================================End=trace=",
+                      details::AsyncLogSink::SEV_TRACE);
         }
-        LOG4CXX_ERROR(logger_, str_.str());
+        sink.push(logger_, str_.str(), details::AsyncLogSink::SEV_ERROR);
         break;
     }
     case BUFFER: {
@@ -15,13 +15,19 @@
  */
 
 #pragma once
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #include <log4cxx/logger.h>
 
 #include <boost/circular_buffer.hpp>
 
+#include "akumuli_def.h"
+
 namespace Akumuli {
 
 namespace details {
@@ -33,6 +39,63 @@ struct CircularBuffer {
     CircularBuffer(size_t depth);
     CircularBuffer(CircularBuffer&& other);
 };
+
+/** Asynchronous backend of the `Logger`.
+  * Log4cxx does locking and appender i/o on the calling thread, which is
+  * too slow for production-rate logging on the ingestion path. Formatted
+  * records are pushed into a per-thread SPSC ring instead and a single
+  * flusher thread hands them to log4cxx. When a ring overflows the record
+  * is dropped and counted, the flusher reports the number of dropped
+  * records. Rings are never reclaimed - the daemon uses fixed thread
+  * pools so the number of rings is bounded.
+  */
+struct AsyncLogSink {
+    enum { RING_SIZE = 0x1000 };  //< Power of two
+
+    enum Severity {
+        SEV_TRACE,
+        SEV_INFO,
+        SEV_ERROR,
+    };
+
+    struct Record {
+        log4cxx::LoggerPtr logger;
+        std::string        message;
+        Severity           severity;
+    };
+
+    //! Single producer single consumer ring (one per logging thread)
+    struct Ring {
+        std::vector<Record> records;
+        std::atomic<u64>    head;     //< Written by the producer
+        std::atomic<u64>    tail;     //< Written by the flusher
+        std::atomic<u64>    dropped;  //< Overflow counter
+
+        Ring();
+    };
+
+    //! Process-wide instance (starts the flusher thread on first use)
+    static AsyncLogSink& instance();
+
+    //! Enqueue formatted record, drops (and counts) on overload
+    void push(log4cxx::LoggerPtr logger, std::string message, Severity severity);
+
+    ~AsyncLogSink();
+
+private:
+    AsyncLogSink();
+
+    //! Ring of the calling thread (registered lazily)
+    Ring* get_ring();
+
+    //! Drain all rings once, returns the number of records flushed
+    size_t flush_rings();
+
+    std::mutex                         rings_lock_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::atomic<int>                   stop_;
+    std::thread                        flusher_;
+};
 }
 
 class Formatter {
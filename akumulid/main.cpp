@@ -10,6 +10,7 @@
 #include <fstream>
 #include <regex>
 
+#include <boost/exception/all.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/program_options.hpp>
@@ -73,6 +74,12 @@ huge_tlb = 0
 # define size of this cache (default value: 512Mb).
 max_cache_size=536870912
 
+# Busy-poll budget in microseconds. When set, ingestion
+# worker threads spin before blocking and SO_BUSY_POLL is
+# enabled on client sockets. Trades cpu time for latency,
+# leave unset (or 0) unless the machine has cores to spare.
+#busy_poll=50
+
 
 # HTTP server config
 
@@ -88,6 +95,18 @@ port=8181
 port=8282
 # worker pool size
 pool_size=1
+# shared-nothing mode - each worker accepts on its own
+# SO_REUSEPORT socket and runs its own event loop
+#reuse_port=1
+# ingestion priority class - high or low. Data  from low
+# priority listeners is dropped first when the server is
+# saturated (default: high).
+#priority=high
+# send  "+DUR <count>"  acks  once  the  written samples
+# passed the durability watermark (reached the disk). One
+# ack covers the whole batch so ingestion  stays fast but
+# clients can tell when their data is safe.
+#durable_acks=1
 
 
 # UDP ingestion server config (delete to disable)
@@ -97,6 +116,10 @@ pool_size=1
 port=8383
 # worker pool size
 pool_size=1
+# ingestion priority class - high or low. UDP  can't ask
+# the senders to slow down so it  defaults to low and is
+# shed first when the server is saturated.
+#priority=low
 
 # Logging configuration
 # This is just a log4cxx configuration without any modifications
@@ -172,6 +195,20 @@ struct ConfigFile {
         return conf.get<u64>("max_cache_size");
     }
 
+    static int get_busy_poll(PTree conf) {
+        return conf.get<int>("busy_poll", 0);
+    }
+
+    static SpoutPriority get_priority(PTree conf, const char* key, SpoutPriority default_value) {
+        std::string name = conf.get<std::string>(key, default_value == AKU_PRIORITY_LOW ? "low" : "high");
+        if (name == "high") {
+            return AKU_PRIORITY_HIGH;
+        } else if (name == "low") {
+            return AKU_PRIORITY_LOW;
+        }
+        throw std::runtime_error(std::string("unknown priority class in `") + key + "`");
+    }
+
     static int get_window(PTree conf) {
         std::string window = conf.get<std::string>("window");
         int r = 0;
@@ -220,6 +257,7 @@ struct ConfigFile {
         settings.name = "UDP";
         settings.port = conf.get<int>("UDP.port");
         settings.nworkers = conf.get<int>("UDP.pool_size");
+        settings.priority = get_priority(conf, "UDP.priority", AKU_PRIORITY_LOW);
         return settings;
     }
 
@@ -228,6 +266,10 @@ struct ConfigFile {
         settings.name = "TCP";
         settings.port = conf.get<int>("TCP.port");
         settings.nworkers = conf.get<int>("TCP.pool_size");
+        settings.reuse_port = conf.get<bool>("TCP.reuse_port", false);
+        settings.busy_poll = get_busy_poll(conf);
+        settings.priority = get_priority(conf, "TCP.priority", AKU_PRIORITY_HIGH);
+        settings.durable_acks = conf.get<bool>("TCP.durable_acks", false);
         return settings;
     }
 
@@ -259,6 +301,10 @@ const char* CLI_HELP_MESSAGE = R"(`akumulid` - time-series database daemon
 
         akumuild --delete
 
+        akumulid --fsck
+
+        akumulid --profile
+
 **DESCRIPTION**
         **akumulid** is a time-series database daemon.
         All configuration can be done via `~/.akumulid` configuration
@@ -278,6 +324,15 @@ const char* CLI_HELP_MESSAGE = R"(`akumulid` - time-series database daemon
         **delete**
             delete database files in `~/.akumuli` folder
 
+        **fsck**
+            check database files for damage and exit (the daemon
+            shouldn't be running)
+
+        **profile**
+            run server with the built-in sampling profiler enabled,
+            per-stage CPU attribution is reported by the `/stats`
+            endpoint under the `profiler` key
+
         **(empty)**
             run server
 
@@ -402,8 +457,9 @@ void cmd_run_server() {
                                                           window,
                                                           cache_size);
 
-    auto pipeline = std::make_shared<IngestionPipeline>(connection, AKU_LINEAR_BACKOFF);
-    auto qproc = std::make_shared<QueryProcessor>(connection, 1000);
+    auto busy_poll = ConfigFile::get_busy_poll(config);
+    auto pipeline = std::make_shared<IngestionPipeline>(connection, AKU_LINEAR_BACKOFF, busy_poll != 0);
+    auto qproc = std::make_shared<QueryProcessor>(connection, 1000, window);
 
     SignalHandler sighandler;
     int srvid = 0;
@@ -468,6 +524,28 @@ void cmd_delete_database() {
   * Shouldn't be called directly, writes error message and
   * writes coredump (this depends on system configuration)
   */
+/** Check database files for damage.
+  */
+int cmd_fsck() {
+    auto config_path = ConfigFile::default_config_path();
+
+    auto config     = ConfigFile::read_config_file(config_path);
+    auto path       = ConfigFile::get_path(config);
+
+    auto full_path = boost::filesystem::path(path) / "db.akumuli";
+    if (!boost::filesystem::exists(full_path)) {
+        std::cout << cli_format("**ERROR** database file doesn't exists") << std::endl;
+        return EXIT_FAILURE;
+    }
+    auto status = aku_fsck(full_path.c_str(), &static_logger);
+    if (status == AKU_SUCCESS) {
+        std::cout << cli_format("**OK** no damage found") << std::endl;
+        return EXIT_SUCCESS;
+    }
+    std::cout << cli_format("**ERROR** database is damaged, see log for details") << std::endl;
+    return EXIT_FAILURE;
+}
+
 void panic_handler(const char * msg) {
     // write error message
     static_logger(AKU_LOG_ERROR, msg);
@@ -494,7 +572,9 @@ int main(int argc, char** argv) {
                 ("create", "Create database")
                 ("delete", "Delete database")
                 ("CI", "Create database for CI environment (for testing)")
-                ("init", "Create default configuration");
+                ("fsck", "Check database files for damage")
+                ("init", "Create default configuration")
+                ("profile", "Run server with the built-in sampling profiler");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, cli_only_options), vm);
@@ -529,6 +609,15 @@ int main(int argc, char** argv) {
             exit(EXIT_SUCCESS);
         }
 
+        if (vm.count("fsck")) {
+            exit(cmd_fsck());
+        }
+
+        if (vm.count("profile")) {
+            aku_profiler_start();
+            std::cout << cli_format("**OK** sampling profiler enabled") << std::endl;
+        }
+
         cmd_run_server();
 
     } catch(const std::exception& e) {
@@ -0,0 +1,52 @@
+#include "peer_stats.h"
+#include "utility.h"
+
+#include <sstream>
+
+namespace Akumuli {
+
+PeerStats::Counters::Counters()
+    : samples(0)
+    , bytes(0)
+    , parse_errors(0)
+    , throttle_events(0)
+{
+}
+
+PeerStats& PeerStats::instance() {
+    static PeerStats stats;
+    return stats;
+}
+
+PeerStats::Counters* PeerStats::get_peer(std::string const& address) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    auto it = peers_.find(address);
+    if (it == peers_.end()) {
+        it = peers_.emplace(address, std::unique_ptr<Counters>(new Counters())).first;
+    }
+    return it->second.get();
+}
+
+std::string PeerStats::to_json() const {
+    std::stringstream fmt;
+    fmt << "{";
+    bool first = true;
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    for (auto const& kv: peers_) {
+        if (!first) {
+            fmt << ",";
+        }
+        first = false;
+        auto const& cnt = *kv.second;
+        fmt << "\"" << kv.first << "\":{"
+            << "\"samples\":"         << cnt.samples.load(std::memory_order_relaxed)         << ","
+            << "\"bytes\":"           << cnt.bytes.load(std::memory_order_relaxed)           << ","
+            << "\"parse_errors\":"    << cnt.parse_errors.load(std::memory_order_relaxed)    << ","
+            << "\"throttle_events\":" << cnt.throttle_events.load(std::memory_order_relaxed)
+            << "}";
+    }
+    fmt << "}";
+    return fmt.str();
+}
+
+}  // namespace Akumuli
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2014 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "akumuli.h"
+
+namespace Akumuli {
+
+/** Per-peer ingestion counters.
+  * Counters are aggregated by source address - every session resolves
+  * its peer entry once on accept and updates the counters with relaxed
+  * atomic adds, so the receive path stays wait-free even when several
+  * sessions of the same agent land on different io threads. Entries are
+  * never removed, the registry is rendered into the `/stats` endpoint
+  * response.
+  */
+class PeerStats {
+public:
+    struct Counters {
+        std::atomic<u64> samples;          //< Samples parsed from the peer's streams
+        std::atomic<u64> bytes;            //< Bytes received from the peer
+        std::atomic<u64> parse_errors;     //< Protocol parse errors
+        std::atomic<u64> throttle_events;  //< Reads paused because the DB throttled
+
+        Counters();
+
+        //! Wait-free add, called from the session hot path
+        static void add(std::atomic<u64>& counter, u64 delta) {
+            counter.fetch_add(delta, std::memory_order_relaxed);
+        }
+    };
+
+    static PeerStats& instance();
+
+    /** Get the counters of the peer (created on first use).
+      * The pointer stays valid for the lifetime of the process.
+      */
+    Counters* get_peer(std::string const& address);
+
+    //! Render all the peers as a JSON object keyed by source address
+    std::string to_json() const;
+
+private:
+    mutable std::mutex lock_;
+    std::map<std::string, std::unique_ptr<Counters>> peers_;
+};
+
+}  // namespace Akumuli
@@ -1,5 +1,8 @@
 #include "protocolparser.h"
+#include "akumuli_tracepoints.h"
+#include "fastdtoa.h"
 #include "resp.h"
+#include "utility.h"
 #include <sstream>
 #include <boost/algorithm/string.hpp>
 
@@ -11,265 +14,459 @@ ProtocolParserError::ProtocolParserError(std::string line, int pos)
 {
 }
 
-const PDU ProtocolParser::POISON_ = {
-    std::shared_ptr<const Byte>(),
-    0u, 0u
-};
-
 ProtocolParser::ProtocolParser(std::shared_ptr<ProtocolConsumer> consumer)
-    : caller_(nullptr)
-    , done_(false)
-    , consumer_(consumer)
+    : consumer_(consumer)
+    , nsamples_(0)
+    , buf_begin_(nullptr)
+    , buf_end_(nullptr)
     , logger_("protocol-parser", 32)
 {
 }
 
+void ProtocolParser::set_query_cb(QueryFrameCb cb) {
+    query_cb_ = std::move(cb);
+}
+
 void ProtocolParser::start() {
     logger_.info() << "Starting protocol parser";
-    auto fn = std::bind(&ProtocolParser::worker, this, std::placeholders::_1);
-    coroutine_.reset(new Coroutine(fn));
 }
 
-void ProtocolParser::worker(Caller& caller) {
-    // Remember caller for use in ByteStreamReader's methods
-    set_caller(caller);
+bool ProtocolParser::scan_int_(const Byte** pp, const Byte* end, u64* value) const {
+    const int MAX_DIGITS = 84;  // Maximum number of decimal digits in u64
+    const Byte* p = *pp + 1;    // Skip the type prefix
+    u64 result  = 0;
+    int ndigits = 0;
+    while (p < end) {
+        Byte c = *p++;
+        if (c == '\n') {
+            // Note: both \r\n and \n line endings are supported for simplicity
+            *value = result;
+            *pp    = p;
+            return true;
+        } else if (c == '\r') {
+            if (p == end) {
+                return false;
+            }
+            if (*p != '\n') {
+                raise_resp_error_("invalid symbol inside stream - '\\r'", p + 1);
+            }
+            *value = result;
+            *pp    = p + 1;
+            return true;
+        }
+        // c must be in [0x30:0x39] range (the error position points one
+        // past the offending byte, same as the stream-based reader did)
+        if (c > 0x39 || c < 0x30) {
+            raise_resp_error_("can't parse integer (character value out of range)", p);
+        }
+        result = result*10 + static_cast<int>(c & 0x0F);
+        if (++ndigits > MAX_DIGITS) {
+            // Don't wait for the line break, the tail buffer shouldn't grow
+            // without a bound on broken input
+            raise_resp_error_("integer is too long", p);
+        }
+    }
+    return false;
+}
+
+int ProtocolParser::scan_string_(const Byte** pp, const Byte* end, Byte* buffer) const {
+    const Byte* p   = *pp + 1;  // Skip the type prefix
+    const Byte* eol = find_line_end(p, end);
+    if (eol - p > RESPStream::STRING_LENGTH_MAX) {
+        // Don't wait for the line break (see `scan_int_`)
+        raise_resp_error_("out of quota", p + RESPStream::STRING_LENGTH_MAX);
+    }
+    if (eol == end) {
+        return -1;
+    }
+    if (*eol == '\r') {
+        if (eol + 1 == end) {
+            return -1;
+        }
+        if (eol[1] != '\n') {
+            raise_resp_error_("bad end of sequence", eol + 2);
+        }
+    }
+    int len = static_cast<int>(eol - p);
+    memcpy(buffer, p, len);
+    *pp = eol + (*eol == '\n' ? 1 : 2);
+    return len;
+}
+
+void ProtocolParser::parse_next(PDU pdu) {
+    ProfilerStageGuard stage(AKU_STAGE_PARSER);
+    auto raw = pdu.buffer.get();
+    // Frames can be split between reads so undecoded bytes are carried
+    // over in `tail_`
+    if (!tail_.empty()) {
+        tail_.insert(tail_.end(), raw + pdu.pos, raw + pdu.size);
+        raw      = tail_.data();
+        pdu.pos  = 0;
+        pdu.size = tail_.size();
+    }
+    buf_begin_ = raw;
+    buf_end_   = raw + pdu.size;
+    const Byte* p   = raw + pdu.pos;
+    const Byte* end = raw + pdu.size;
     // Buffer to read strings from
-    const int     buffer_len         = RESPStream::STRING_LENGTH_MAX;
-    Byte          buffer[buffer_len] = {};
-    int           bytes_read         = 0;
-    // Data to read
-    std::string   sid;
-    aku_Sample    sample;
-    aku_Status    status = AKU_SUCCESS;
-    //
-    try {
-        RESPStream stream(this);
-        while(true) {
-            // read id
-            auto next = stream.next_type();
-            switch(next) {
-            case RESPStream::INTEGER:
-                sample.paramid = stream.read_int();
-                break;
-            case RESPStream::STRING:
-                bytes_read = stream.read_string(buffer, buffer_len);
+    Byte buffer[RESPStream::STRING_LENGTH_MAX + 1];
+    int  bytes_read = 0;
+    while (p < end) {
+        const Byte* frame = p;  // Frame begining, restored on partial decode
+        aku_Sample  sample;
+        aku_Status  status = AKU_SUCCESS;
+
+        // read id
+        switch (*p) {
+        case ':':
+            {
+                // Integer id is a session alias registered by the client
+                // or a raw parameter id (legacy behavior)
+                u64 id;
+                if (!scan_int_(&p, end, &id)) {
+                    p = frame;
+                    goto stash;
+                }
+                auto it = aliases_.find(id);
+                sample.paramid = it != aliases_.end() ? it->second : id;
+            }
+            break;
+        case '+':
+            bytes_read = scan_string_(&p, end, buffer);
+            if (bytes_read < 0) {
+                p = frame;
+                goto stash;
+            }
+            status = consumer_->series_to_param_id(buffer, bytes_read, &sample);
+            if (status != AKU_SUCCESS) {
+                raise_parser_error_(aku_error_message(status), frame);
+            }
+            break;
+        case '*':
+            {
+                // Series alias registration - "*2 :<alias> +<name>". The
+                // series string is sent and resolved once per connection,
+                // subsequent samples carry the integer alias instead
+                u64 array_size;
+                if (!scan_int_(&p, end, &array_size)) {
+                    p = frame;
+                    goto stash;
+                }
+                if (p == end) {
+                    p = frame;
+                    goto stash;
+                }
+                if (array_size != 2 || *p != ':') {
+                    raise_parser_error_("bad alias registration", p);
+                }
+                u64 alias;
+                if (!scan_int_(&p, end, &alias)) {
+                    p = frame;
+                    goto stash;
+                }
+                if (p == end) {
+                    p = frame;
+                    goto stash;
+                }
+                if (*p != '+') {
+                    raise_parser_error_("bad alias registration", p);
+                }
+                bytes_read = scan_string_(&p, end, buffer);
+                if (bytes_read < 0) {
+                    p = frame;
+                    goto stash;
+                }
                 status = consumer_->series_to_param_id(buffer, bytes_read, &sample);
-                if (status != AKU_SUCCESS){
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context(aku_error_message(status));
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+                if (status != AKU_SUCCESS) {
+                    raise_parser_error_(aku_error_message(status), frame);
                 }
-                break;
-            default:
-                // Bad frame
-                {
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context("unexpected parameter id format");
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+                aliases_[alias] = sample.paramid;
+            }
+            // Registration frame carries no timestamp or value
+            continue;
+        case '$':
+            {
+                // Query frame - a bulk string carrying a query request.
+                // The session keeps reading write frames while the query
+                // results are streamed back, queries and writes are
+                // multiplexed on one connection
+                u64 len;
+                if (!scan_int_(&p, end, &len)) {
+                    p = frame;
+                    goto stash;
                 }
-            };
-
-            // read ts
-            next = stream.next_type();
-            switch(next) {
-            case RESPStream::INTEGER:
-                sample.timestamp = stream.read_int();
-                break;
-            case RESPStream::STRING:
-                bytes_read = stream.read_string(buffer, buffer_len);
-                buffer[bytes_read] = '\0';
-                if (aku_parse_timestamp(buffer, &sample) == AKU_SUCCESS) {
-                    break;
+                if (len > RESPStream::BULK_LENGTH_MAX) {
+                    raise_resp_error_("bulk string is too long", p);
+                }
+                if (static_cast<u64>(end - p) < len + 1) {
+                    p = frame;
+                    goto stash;
                 }
-            default:
-                {
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context("Unexpected parameter timestamp format");
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+                const Byte* payload = p;
+                p += len;
+                if (*p == '\n') {
+                    p += 1;
+                } else if (*p == '\r') {
+                    if (p + 1 == end) {
+                        p = frame;
+                        goto stash;
+                    }
+                    if (p[1] != '\n') {
+                        raise_resp_error_("bad end of sequence", p + 2);
+                    }
+                    p += 2;
+                } else {
+                    raise_resp_error_("bad end of sequence", p + 1);
                 }
-            };
+                if (!query_cb_) {
+                    raise_parser_error_("query frames are not enabled", frame);
+                }
+                query_cb_(std::string(payload, payload + len));
+            }
+            // Query frame carries no timestamp or value
+            continue;
+        default:
+            // Bad frame
+            raise_parser_error_("unexpected parameter id format", p);
+        };
 
-            // read value
-            next = stream.next_type();
-            switch(next) {
-            case RESPStream::INTEGER:
-                sample.payload.type = AKU_PAYLOAD_FLOAT;
-                sample.payload.float64 = stream.read_int();
-                sample.payload.size = sizeof(aku_Sample);
+        // read ts
+        if (p == end) {
+            p = frame;
+            break;
+        }
+        switch (*p) {
+        case ':':
+            {
+                u64 ts;
+                if (!scan_int_(&p, end, &ts)) {
+                    p = frame;
+                    goto stash;
+                }
+                sample.timestamp = ts;
+            }
+            break;
+        case '+':
+            bytes_read = scan_string_(&p, end, buffer);
+            if (bytes_read < 0) {
+                p = frame;
+                goto stash;
+            }
+            buffer[bytes_read] = '\0';
+            if (aku_parse_timestamp(buffer, &sample) == AKU_SUCCESS) {
                 break;
-            case RESPStream::STRING:
-                bytes_read = stream.read_string(buffer, buffer_len);
-                buffer[bytes_read] = '\0';
+            }
+        default:
+            raise_parser_error_("Unexpected parameter timestamp format", p);
+        };
+
+        // read value
+        if (p == end) {
+            p = frame;
+            break;
+        }
+        switch (*p) {
+        case ':':
+            {
+                u64 value;
+                if (!scan_int_(&p, end, &value)) {
+                    p = frame;
+                    goto stash;
+                }
                 sample.payload.type = AKU_PAYLOAD_FLOAT;
-                sample.payload.float64 = strtod(buffer, nullptr);
+                sample.payload.float64 = value;
                 sample.payload.size = sizeof(aku_Sample);
-                memset(buffer, 0, bytes_read);
-                break;
-            default:
-                // Bad frame
-                {
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context("Unexpected parameter value format");
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
-                }
-            };
+            }
+            break;
+        case '+':
+            bytes_read = scan_string_(&p, end, buffer);
+            if (bytes_read < 0) {
+                p = frame;
+                goto stash;
+            }
+            buffer[bytes_read] = '\0';
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            if (parse_double(buffer, &sample.payload.float64) < 0) {
+                sample.payload.float64 = 0.;
+            }
+            sample.payload.size = sizeof(aku_Sample);
+            break;
+        default:
+            raise_parser_error_("Unexpected parameter value format", p);
+        };
 
-            consumer_->write(sample);
-        }
-    } catch(EStopIteration const&) {
-        logger_.info() << "EStopIteration";
-        done_ = true;
+        consumer_->write(sample);
+        nsamples_++;
     }
+stash:
+    // Stash the partial frame
+    {
+        std::vector<Byte> rest(p, end);
+        std::swap(tail_, rest);
+    }
+    AKU_PROBE1(pdu_parsed, pdu.size);
 }
 
-void ProtocolParser::set_caller(Caller& caller) {
-    caller_ = &caller;
+void ProtocolParser::close() {
+    if (!tail_.empty()) {
+        logger_.error() << "connection closed mid-frame, " << tail_.size() << " bytes lost";
+    }
 }
 
-void ProtocolParser::yield_to_worker() {
-    coroutine_->operator()();
+std::tuple<std::string, size_t> ProtocolParser::get_error_context_(const char* msg,
+                                                                  const Byte* at) const {
+    if (buf_begin_ == nullptr) {
+        return std::make_tuple(std::string("Can't generate error, no data"), 0u);
+    }
+    // Scan to the frame head (previous line break or the buffer begining)
+    auto origin = buf_begin_;
+    auto begin  = at;
+    while (begin > origin && begin[-1] != '\n') {
+        begin--;
+    }
+    size_t size = std::min(static_cast<size_t>(at - begin) + StreamError::MAX_LENGTH,
+                           static_cast<size_t>(buf_end_ - begin));
+    auto position = static_cast<size_t>(at - begin);
+    auto res = std::string(begin, begin + size);
+    boost::algorithm::replace_all(res, "\r", "\\r");
+    boost::algorithm::replace_all(res, "\n", "\\n");
+    std::stringstream message;
+    message << msg << " - ";
+    position += message.str().size();
+    message << res;
+    return std::make_tuple(message.str(), position);
 }
 
-void ProtocolParser::yield_to_client() const {
-    (*caller_)();
+void ProtocolParser::raise_resp_error_(const char* msg, const Byte* at) const {
+    std::string line;
+    size_t pos;
+    std::tie(line, pos) = get_error_context_(msg, at);
+    BOOST_THROW_EXCEPTION(RESPError(line, pos));
 }
 
-void ProtocolParser::throw_if_poisoned(PDU const& top) const {
-    if (top.size == 0 && top.pos == 0) {
-        throw EStopIteration();
-    }
+void ProtocolParser::raise_parser_error_(const char* msg, const Byte* at) const {
+    std::string line;
+    size_t pos;
+    std::tie(line, pos) = get_error_context_(msg, at);
+    BOOST_THROW_EXCEPTION(ProtocolParserError(line, pos));
 }
 
-void ProtocolParser::parse_next(PDU pdu) {
-    buffers_.push(pdu);
-    yield_to_worker();
-}
 
-Byte ProtocolParser::get() {
-    while(true) {
-        if (buffers_.empty()) {
-            yield_to_client();
-        }
-        auto& top = buffers_.front();
-        throw_if_poisoned(top);
-        if (top.pos < top.size) {
-            auto buf = top.buffer.get();
-            return buf[top.pos++];
-        }
-        buffers_.pop();
-        yield_to_client();
-    }
-    auto ctx = get_error_context("unexpected end of stream");
-    BOOST_THROW_EXCEPTION(ProtocolParserError(std::get<0>(ctx), std::get<1>(ctx)));
-}
+//                            //
+//    BinaryProtocolParser    //
+//                            //
 
-Byte ProtocolParser::pick() const {
-    while(true) {
-        if (buffers_.empty()) {
-            yield_to_client();
-        }
-        auto& top = buffers_.front();
-        throw_if_poisoned(top);
-        if (top.pos < top.size) {
-            auto buf = top.buffer.get();
-            return buf[top.pos];
-        }
-        buffers_.pop();
-        yield_to_client();
-    }
-    auto ctx = get_error_context("unexpected end of stream");
-    BOOST_THROW_EXCEPTION(ProtocolParserError(std::get<0>(ctx), std::get<1>(ctx)));
-}
+const Byte BinaryProtocolParser::MAGIC[MAGIC_SIZE + 1] = "#AKB1";
 
-bool ProtocolParser::is_eof() {
-    return done_;
+BinaryProtocolParser::BinaryProtocolParser(std::shared_ptr<ProtocolConsumer> consumer)
+    : consumer_(consumer)
+    , nsamples_(0)
+    , last_ts_(0)
+    , logger_("binary-protocol-parser", 32)
+{
 }
 
-int ProtocolParser::read(Byte *buffer, size_t buffer_len) {
-    int bytes_copied = 0;
-    while(true) {
-        if (buffers_.empty()) {
-            yield_to_client();
+//! Decode LEB128 varint, returns false if the buffer ends mid-value
+static bool read_varint(const u8** pp, const u8* end, u64* value) {
+    u64 result = 0;
+    int shift  = 0;
+    for (auto p = *pp; p < end; p++) {
+        if (shift > 63) {
+            BOOST_THROW_EXCEPTION(ProtocolParserError("bad varint", 0));
         }
-        auto& top = buffers_.front();
-        if (top.pos < top.size) {
-            size_t sz = top.size - top.pos;
-            size_t bytes_to_copy = std::min(sz, buffer_len);
-            memcpy(buffer, top.buffer.get() + top.pos, bytes_to_copy);
-            bytes_copied += (int)bytes_to_copy;
-            top.pos += bytes_to_copy;
-            if (bytes_to_copy == buffer_len) {
-                // everything is copied!
-                break;
-            } else {
-                // continue reading from the next buffer in the queue
-                buffer += bytes_to_copy;
-                buffer_len -= bytes_to_copy;
-            }
+        result |= static_cast<u64>(*p & 0x7F) << shift;
+        if ((*p & 0x80) == 0) {
+            *value = result;
+            *pp    = p + 1;
+            return true;
         }
-        buffers_.pop();
+        shift += 7;
     }
-    return bytes_copied;
+    return false;
 }
 
-void ProtocolParser::close() {
-    buffers_.push(POISON_);
-    // stop worker
-    yield_to_worker();
+static i64 zigzag_decode(u64 value) {
+    return static_cast<i64>(value >> 1) ^ -static_cast<i64>(value & 1);
 }
 
-std::tuple<std::string, size_t> ProtocolParser::get_error_from_pdu(PDU const& pdu) const {
-    const char* origin = pdu.buffer.get();
-    // Scan to PDU head
-    if (pdu.pos == 0) {
-        // Error in first symbol
-        size_t size = std::min(pdu.size, (size_t)StreamError::MAX_LENGTH);
-        auto res = std::string(origin, origin + size);
-        boost::algorithm::replace_all(res, "\r", "\\r");
-        boost::algorithm::replace_all(res, "\n", "\\n");
-        return std::make_pair(res, 0);
+void BinaryProtocolParser::parse_next(PDU pdu) {
+    auto raw = reinterpret_cast<const u8*>(pdu.buffer.get());
+    // Frames can be split between reads so undecoded bytes are carried
+    // over in `tail_`
+    if (!tail_.empty()) {
+        tail_.insert(tail_.end(), pdu.buffer.get() + pdu.pos, pdu.buffer.get() + pdu.size);
+        raw = reinterpret_cast<const u8*>(tail_.data());
+        pdu.pos  = 0;
+        pdu.size = tail_.size();
     }
-    auto pdu_pos = pdu.pos;
-    auto ipos = origin + pdu_pos;   // Iterator
-    auto begin = origin;            // PDU begining
-    while (ipos > origin) {
-        if (*ipos == '\n') {        // Stop when prev. PDU begining or origin was reached
+    const u8* p   = raw + pdu.pos;
+    const u8* end = raw + pdu.size;
+    while (p < end) {
+        const u8* frame = p;  // Frame begining, restored on partial decode
+        u64 tag = 0;
+        u64 sid = 0;
+        if (!read_varint(&p, end, &tag)) {
+            p = frame;
             break;
         }
-        begin = ipos;
-        ipos--;
-    }
-    auto delta = (begin - origin);       // PDU begining position from the origin
-    auto size = pdu.size - delta;
-    auto position = pdu_pos - delta;
-    if (position < StreamError::MAX_LENGTH) {
-        // Truncate string if it wouldn't hide error (most of the PDU's is small so
-        // this will be almost always the case).
-        size = std::min(size, (size_t)StreamError::MAX_LENGTH);
+        if (tag == 0) {
+            // Series definition
+            u64 length = 0;
+            if (!read_varint(&p, end, &sid) || !read_varint(&p, end, &length)) {
+                p = frame;
+                break;
+            }
+            if (sid == 0 || length > RESPStream::STRING_LENGTH_MAX) {
+                BOOST_THROW_EXCEPTION(ProtocolParserError("bad series definition", 0));
+            }
+            if (end - p < static_cast<ptrdiff_t>(length)) {
+                p = frame;
+                break;
+            }
+            aku_Sample sample;
+            auto name = reinterpret_cast<const char*>(p);
+            auto status = consumer_->series_to_param_id(name, length, &sample);
+            if (status != AKU_SUCCESS) {
+                BOOST_THROW_EXCEPTION(ProtocolParserError(aku_error_message(status), 0));
+            }
+            ids_[sid] = sample.paramid;
+            p += length;
+        } else {
+            // Sample
+            u64 delta = 0;
+            if (!read_varint(&p, end, &delta)) {
+                p = frame;
+                break;
+            }
+            if (end - p < static_cast<ptrdiff_t>(sizeof(double))) {
+                p = frame;
+                break;
+            }
+            auto it = ids_.find(tag);
+            if (it == ids_.end()) {
+                BOOST_THROW_EXCEPTION(ProtocolParserError("unknown stream id", 0));
+            }
+            last_ts_ += zigzag_decode(delta);
+            aku_Sample sample;
+            sample.paramid      = it->second;
+            sample.timestamp    = last_ts_;
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.size = sizeof(aku_Sample);
+            memcpy(&sample.payload.float64, p, sizeof(double));  // Raw little-endian double
+            p += sizeof(double);
+            consumer_->write(sample);
+            nsamples_++;
+        }
     }
-    auto res = std::string(begin, begin + size);
-    boost::algorithm::replace_all(res, "\r", "\\r");
-    boost::algorithm::replace_all(res, "\n", "\\n");
-    return std::make_pair(res, position);
+    // Stash the partial frame
+    std::vector<Byte> rest(reinterpret_cast<const Byte*>(p), reinterpret_cast<const Byte*>(end));
+    std::swap(tail_, rest);
 }
 
-std::tuple<std::string, size_t> ProtocolParser::get_error_context(const char* msg) const {
-    if (buffers_.empty()) {
-        return std::make_tuple(std::string("Can't generate error, no data"), 0u);
+void BinaryProtocolParser::close() {
+    if (!tail_.empty()) {
+        logger_.error() << "connection closed mid-frame, " << tail_.size() << " bytes lost";
     }
-    auto& top = buffers_.front();
-    std::string err;
-    size_t pos;
-    std::tie(err, pos) = get_error_from_pdu(top);
-    std::stringstream message;
-    message << msg << " - ";
-    pos += message.str().size();
-    message << err;
-    return std::make_tuple(message.str(), pos);
 }
 
 }
@@ -16,10 +16,10 @@
 
 #pragma once
 
-// Using old-style boost.coroutines
 #include <cstdint>
+#include <functional>
 #include <memory>
-#include <queue>
+#include <unordered_map>
 #include <vector>
 
 #include "logger.h"
@@ -27,33 +27,6 @@
 #include "resp.h"
 #include "stream.h"
 
-#include <boost/version.hpp>
-
-#if BOOST_VERSION <= 105500
-
-#define BOOST_COROUTINES_BIDIRECT
-#include <boost/coroutine/all.hpp>
-
-namespace Akumuli {
-
-typedef boost::coroutines::coroutine<void()> Coroutine;
-typedef typename Coroutine::caller_type Caller;
-
-}
-
-#else
-
-#include <boost/coroutine/asymmetric_coroutine.hpp>
-
-namespace Akumuli {
-
-typedef typename boost::coroutines::asymmetric_coroutine<void>::push_type Coroutine;
-typedef typename boost::coroutines::asymmetric_coroutine<void>::pull_type Caller;
-
-}
-
-#endif
-
 namespace Akumuli {
 
 /** Protocol Data Unit */
@@ -69,43 +42,111 @@ struct ProtocolParserError : StreamError {
 };
 
 
-//! Stop iteration exception
-struct EStopIteration {};
-
-
-class ProtocolParser : ByteStreamReader {
-    mutable std::shared_ptr<Coroutine> coroutine_;
-    mutable Caller*                    caller_;
-    mutable std::queue<PDU>            buffers_;
-    static const PDU                   POISON_;  //< This object marks end of the stream
-    bool                               done_;
+//! Callback invoked for every query frame of a multiplexed session
+typedef std::function<void(std::string)> QueryFrameCb;
+
+/** RESP protocol decoder.
+  * Resumable state machine - `parse_next` decodes every complete frame
+  * of the buffer and stashes the partial one in `tail_` instead of
+  * suspending mid-element, so a fragmented stream doesn't pay for a
+  * context switch or an unwind per read. Need-more-data is a return
+  * value of the element scanners, exceptions are thrown only for
+  * malformed input.
+  *
+  * Besides write frames the stream can carry query requests - a RESP
+  * bulk string ("$<len>\r\n<query>\r\n") is handed to the query frame
+  * callback so a session can interleave writes and queries on one
+  * connection (see `TcpSession`). Query frames are rejected when no
+  * callback is registered.
+  */
+class ProtocolParser {
     std::shared_ptr<ProtocolConsumer>  consumer_;
+    QueryFrameCb                       query_cb_;  //< Query frame handler (optional)
+    u64                                nsamples_;  //< Samples written to the consumer so far
+    //! Partial frame left from the previous buffer
+    std::vector<Byte>                  tail_;
+    //! Series aliases registered by the client ("*2 :<alias> +<name>" frame)
+    std::unordered_map<u64, aku_ParamId> aliases_;
+    //! Boundaries of the buffer being parsed (error context only)
+    const Byte*                        buf_begin_;
+    const Byte*                        buf_end_;
     Logger                             logger_;
 
-    void worker(Caller& yield);
-    void set_caller(Caller& caller);
-    //! Yield control to worker
-    void yield_to_worker();
-    //! Yield control to external code
-    void yield_to_client() const;
-    //! Throw exception if poisoned
-    void throw_if_poisoned(PDU const& top) const;
-    //! Generate error message
-    std::tuple<std::string, size_t> get_error_from_pdu(PDU const& pdu) const;
+    /** Scan RESP integer element (':' or '*' prefixed).
+      * Advances `*pp` past the closing line break on success.
+      * @return false if the buffer ends mid-element
+      * @throw RESPError on malformed input
+      */
+    bool scan_int_(const Byte** pp, const Byte* end, u64* value) const;
+
+    /** Scan RESP string element ('+' prefixed) into the buffer
+      * (should hold `RESPStream::STRING_LENGTH_MAX` bytes).
+      * @return string length or -1 if the buffer ends mid-element
+      * @throw RESPError on malformed input
+      */
+    int scan_string_(const Byte** pp, const Byte* end, Byte* buffer) const;
+
+    //! Generate error context for the position (scans back to the frame begining)
+    std::tuple<std::string, size_t> get_error_context_(const char* msg, const Byte* at) const;
+
+    //! Throw `RESPError` with context
+    void raise_resp_error_(const char* msg, const Byte* at) const;
+
+    //! Throw `ProtocolParserError` with context
+    void raise_parser_error_(const char* msg, const Byte* at) const;
 
 public:
     ProtocolParser(std::shared_ptr<ProtocolConsumer> consumer);
+    //! Enable query frames ('$' prefixed), `cb` receives the query text
+    void set_query_cb(QueryFrameCb cb);
     void start();
+    //! Decode all complete frames of the PDU (the rest is buffered)
     void parse_next(PDU pdu);
+    void close();
+    //! Total number of samples decoded so far
+    u64 nsamples() const { return nsamples_; }
+};
+
+
+/** Binary wire protocol decoder.
+  * Compact alternative to RESP for clients we control - no text parsing,
+  * samples go straight to the consumer. The session switches to this
+  * decoder when the client starts the stream with the handshake magic
+  * (see `TcpSession`).
+  *
+  * Frame format (all integers are LEB128 varints):
+  * - "0 <stream-id> <length> <name bytes>" defines a series: subsequent
+  *   samples refer to it by the client-chosen non-zero stream id, the
+  *   name is resolved through `series_to_param_id` once;
+  * - "<stream-id> <timestamp-delta> <value>" is a sample: the delta is
+  *   zigzag-encoded against the previous timestamp of the session and
+  *   the value is a raw little-endian double.
+  */
+class BinaryProtocolParser {
+    std::shared_ptr<ProtocolConsumer>    consumer_;
+    u64                                  nsamples_; //< Samples written to the consumer so far
+    std::unordered_map<u64, aku_ParamId> ids_;      //< Stream id to param id mapping
+    aku_Timestamp                        last_ts_;  //< Previous timestamp of the session
+    std::vector<Byte>                    tail_;     //< Partial frame left from the previous buffer
+    Logger                               logger_;
 
-    // ByteStreamReader interface
 public:
-    virtual Byte get();
-    virtual Byte pick() const;
-    virtual bool is_eof();
-    virtual int read(Byte* buffer, size_t buffer_len);
-    virtual void close();
-    virtual std::tuple<std::string, size_t> get_error_context(const char* msg) const;
+    enum {
+        MAGIC_SIZE = 5,
+    };
+
+    //! Handshake magic, sent by the client before the first frame
+    static const Byte MAGIC[MAGIC_SIZE + 1];
+
+    BinaryProtocolParser(std::shared_ptr<ProtocolConsumer> consumer);
+
+    //! Decode all complete frames of the PDU (the rest is buffered)
+    void parse_next(PDU pdu);
+
+    void close();
+
+    //! Total number of samples decoded so far
+    u64 nsamples() const { return nsamples_; }
 };
 
 
@@ -1,6 +1,12 @@
 #include "query_results_pooler.h"
+#include "fastdtoa.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/exception/all.hpp>
@@ -118,8 +124,8 @@ struct CSVOutputFormatter : OutputFormatter {
                 size  -= 1;
             }
             // Floating-point
-            len = snprintf(begin, size, "%.17g", sample.payload.float64);
-            if (len == size || len < 0) {
+            len = format_double(sample.payload.float64, begin, size);
+            if (len < 0) {
                 return nullptr;
             }
             begin += len;
@@ -127,7 +133,7 @@ struct CSVOutputFormatter : OutputFormatter {
             newline_required = true;
         }
 
-        if (sample.payload.type & aku_PData::SAX_WORD) {
+        if (sample.payload.type & (aku_PData::SAX_WORD | aku_PData::STRING_PAYLOAD)) {
             if (newline_required) {
                 // Add trailing ',' to the end
                 if (size < 1) {
@@ -162,18 +168,57 @@ struct CSVOutputFormatter : OutputFormatter {
         return begin;
     }
 };
-//! RESP output implementation
+/** RESP output implementation.
+  * Row format is "+series name\r\n+timestamp\r\n+value\r\n". In dictionary
+  * mode the name string is sent only once - the first row of a series is
+  * preceded by a "*2\r\n:<index>\r\n+<name>\r\n" dictionary entry (the same
+  * frame shape the ingest side uses for alias registration) and every row
+  * carries ":<index>\r\n" instead of the name. Wide queries spend more
+  * bytes on repeated names than on data so this is a big win on the wire.
+  */
 struct RESPOutputFormatter : OutputFormatter {
 
     std::shared_ptr<DbConnection> connection_;
     const bool iso_timestamps_;
+    const bool use_dictionary_;
+    //! Series id to dictionary index mapping (ids the client has seen)
+    std::unordered_map<aku_ParamId, u64> dict_;
 
-    RESPOutputFormatter(std::shared_ptr<DbConnection> con, bool iso_timestamps)
+    RESPOutputFormatter(std::shared_ptr<DbConnection> con, bool iso_timestamps,
+                        bool use_dictionary = false)
         : connection_(con)
         , iso_timestamps_(iso_timestamps)
+        , use_dictionary_(use_dictionary)
     {
     }
 
+    //! Write the series name to [begin, end), null if it doesn't fit
+    char* write_series_name_(char* begin, char* end, aku_ParamId id) {
+        int size = end - begin;
+        int len = connection_->param_id_to_series(id, begin, size);
+        // '\0' character is counted in len
+        if (len == 0) { // Error, no such Id
+            len = snprintf(begin, size, "id=%lu", id);
+            if (len < 0 || len == size) {
+                // Not enough space inside the buffer
+                return nullptr;
+            }
+            len += 1;  // for terminating '\0' character
+        } else if (len < 0) {
+            // Not enough space
+            return nullptr;
+        }
+        len--;  // terminating '\0' character should be rewritten
+        begin += len;
+        // Add trailing \r\n to the end
+        if (end - begin < 2) {
+            return nullptr;
+        }
+        begin[0] = '\r';
+        begin[1] = '\n';
+        return begin + 2;
+    }
+
     virtual char* format(char* begin, char* end, const aku_Sample& sample) {
         // RESP formatted output: +series name\r\n+timestamp\r\n+value\r\n (for double or $value for blob)
 
@@ -182,40 +227,53 @@ struct RESPOutputFormatter : OutputFormatter {
         }
         int size = end - begin;
 
-        begin[0] = '+';
-        begin++;
-        size--;
-
-        // sz can't be zero here because of precondition
-
         int len = 0;
 
+        // First occurrence of the series in dictionary mode - the mapping
+        // is stored only after the whole sample was formatted because the
+        // caller retries a failed sample in a fresh chunk from scratch
+        bool new_dict_entry = false;
+        u64  dict_index     = 0;
+
         if (sample.payload.type & aku_PData::PARAMID_BIT) {
-            // Series name
-            len = connection_->param_id_to_series(sample.paramid, begin, size);
-            // '\0' character is counted in len
-            if (len == 0) { // Error, no such Id
-                len = snprintf(begin, size, "id=%lu", sample.paramid);
-                if (len < 0 || len == size) {
-                    // Not enough space inside the buffer
+            if (use_dictionary_) {
+                auto it = dict_.find(sample.paramid);
+                if (it == dict_.end()) {
+                    new_dict_entry = true;
+                    dict_index     = dict_.size();
+                    // Dictionary entry: *2\r\n:<index>\r\n+<name>\r\n
+                    len = snprintf(begin, size, "*2\r\n:%lu\r\n+", dict_index);
+                    if (len < 0 || len >= size) {
+                        return nullptr;
+                    }
+                    begin += len;
+                    char* next = write_series_name_(begin, end, sample.paramid);
+                    if (next == nullptr) {
+                        return nullptr;
+                    }
+                    begin = next;
+                    size  = end - begin;
+                } else {
+                    dict_index = it->second;
+                }
+                // The row references the dictionary index
+                len = snprintf(begin, size, ":%lu\r\n", dict_index);
+                if (len < 0 || len >= size) {
                     return nullptr;
                 }
-                len += 1;  // for terminating '\0' character
-            } else if (len < 0) {
-                // Not enough space
-                return nullptr;
-            }
-            len--;  // terminating '\0' character should be rewritten
-            begin += len;
-            size  -= len;
-            // Add trailing \r\n to the end
-            if (size < 2) {
-                return nullptr;
+                begin += len;
+                size  -= len;
+            } else {
+                // Series name
+                begin[0] = '+';
+                begin++;
+                char* next = write_series_name_(begin, end, sample.paramid);
+                if (next == nullptr) {
+                    return nullptr;
+                }
+                begin = next;
+                size  = end - begin;
             }
-            begin[0] = '\r';
-            begin[1] = '\n';
-            begin += 2;
-            size  -= 2;
         }
 
         if (sample.payload.type & aku_PData::TIMESTAMP_BIT) {
@@ -260,15 +318,28 @@ struct RESPOutputFormatter : OutputFormatter {
 
         if (sample.payload.type & aku_PData::FLOAT_BIT) {
             // Floating-point
-            len = snprintf(begin, size, "+%.17g\r\n", sample.payload.float64);
-            if (len == size || len < 0) {
+            if (size < 1) {
+                return nullptr;
+            }
+            begin[0] = '+';
+            begin++;
+            size--;
+            len = format_double(sample.payload.float64, begin, size);
+            if (len < 0) {
                 return nullptr;
             }
             begin += len;
             size  -= len;
+            if (size < 2) {
+                return nullptr;
+            }
+            begin[0] = '\r';
+            begin[1] = '\n';
+            begin += 2;
+            size  -= 2;
         }
 
-        if (sample.payload.type & aku_PData::SAX_WORD) {
+        if (sample.payload.type & (aku_PData::SAX_WORD | aku_PData::STRING_PAYLOAD)) {
             size_t sample_size = std::max(sizeof(aku_Sample), (size_t)sample.payload.size);
             int sax_word_sz = static_cast<int>(sample_size - sizeof(aku_Sample));
             if (size < (sax_word_sz + 3)) {
@@ -284,14 +355,151 @@ struct RESPOutputFormatter : OutputFormatter {
             begin += 2;
             size  -= 2;
         }
+        if (new_dict_entry) {
+            dict_[sample.paramid] = dict_index;
+        }
         return begin;
     }
 };
 
-QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize)
+/** Columnar binary output implementation.
+  * Rows are accumulated into fixed size blocks, every block is written
+  * as a small header followed by three column arrays so analytics jobs
+  * can memcpy the data straight into their own arrays instead of
+  * parsing text. Block layout (everything is little-endian):
+  * - 4 byte magic "AKC1";
+  * - u32 number of rows in the block (the last block can be short);
+  * - u64 series ids, one per row;
+  * - u64 timestamps, one per row;
+  * - double values, one per row.
+  */
+struct BinaryOutputFormatter : OutputFormatter {
+
+    enum {
+        BLOCK_LEN = 0x400,  //< Number of rows per block
+    };
+
+    std::vector<u64>    ids_;
+    std::vector<u64>    timestamps_;
+    std::vector<double> values_;
+
+    BinaryOutputFormatter() {
+        ids_.reserve(BLOCK_LEN);
+        timestamps_.reserve(BLOCK_LEN);
+        values_.reserve(BLOCK_LEN);
+    }
+
+    //! Write the accumulated block to [begin, end), null if it doesn't fit
+    char* write_block(char* begin, char* end) {
+        u32 count = static_cast<u32>(ids_.size());
+        size_t block_size = 4 + sizeof(u32) + count*(sizeof(u64) + sizeof(u64) + sizeof(double));
+        if (static_cast<size_t>(end - begin) < block_size) {
+            return nullptr;
+        }
+        memcpy(begin, "AKC1", 4);
+        begin += 4;
+        memcpy(begin, &count, sizeof(count));
+        begin += sizeof(count);
+        memcpy(begin, ids_.data(), count*sizeof(u64));
+        begin += count*sizeof(u64);
+        memcpy(begin, timestamps_.data(), count*sizeof(u64));
+        begin += count*sizeof(u64);
+        memcpy(begin, values_.data(), count*sizeof(double));
+        begin += count*sizeof(double);
+        ids_.clear();
+        timestamps_.clear();
+        values_.clear();
+        return begin;
+    }
+
+    virtual char* format(char* begin, char* end, const aku_Sample& sample) {
+        if (ids_.size() == BLOCK_LEN) {
+            // Block is full, write it out before consuming the sample
+            begin = write_block(begin, end);
+            if (begin == nullptr) {
+                return nullptr;
+            }
+        }
+        ids_.push_back(sample.paramid);
+        timestamps_.push_back(sample.timestamp);
+        values_.push_back(sample.payload.type & aku_PData::FLOAT_BIT ? sample.payload.float64 : 0.);
+        return begin;
+    }
+
+    virtual char* flush(char* begin, char* end) {
+        if (ids_.empty()) {
+            return begin;
+        }
+        return write_block(begin, end);
+    }
+};
+
+QueryResultsCache::QueryResultsCache()
+    : total_size_(0)
+    , access_cnt_(0)
+{
+}
+
+QueryResultsCache::Entry QueryResultsCache::get(std::string const& key, aku_Timestamp split) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end() || it->second.hi > split) {
+        // Miss or the entry was materialized with a more recent boundary
+        // than this query can use
+        return { std::shared_ptr<const std::vector<char>>(), 0u, 0u };
+    }
+    it->second.access = ++access_cnt_;
+    return it->second;
+}
+
+void QueryResultsCache::put(std::string const& key, std::shared_ptr<const std::vector<char>> data,
+                            aku_Timestamp hi) {
+    if (data->size() > SIZE_LIMIT) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        if (it->second.hi >= hi) {
+            // Concurrent query already materialized a longer prefix
+            return;
+        }
+        total_size_ -= it->second.data->size();
+        entries_.erase(it);
+    }
+    total_size_ += data->size();
+    entries_[key] = { data, hi, ++access_cnt_ };
+    while (total_size_ > SIZE_LIMIT) {
+        // Evict the least recently used entry
+        auto lru = entries_.begin();
+        for (auto i = entries_.begin(); i != entries_.end(); i++) {
+            if (i->second.access < lru->second.access) {
+                lru = i;
+            }
+        }
+        total_size_ -= lru->second.data->size();
+        entries_.erase(lru);
+    }
+}
+
+QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize,
+                                       std::shared_ptr<QueryResultsCache> cache,
+                                       u64 window)
     : connection_(con)
-    , rdbuf_pos_(0)
     , rdbuf_top_(0)
+    , wchunk_(nullptr)
+    , chunk_wr_(0)
+    , chunk_rd_(0)
+    , chunk_pos_(0)
+    , stream_done_(false)
+    , cursor_done_(false)
+    , closing_(false)
+    , error_(AKU_SUCCESS)
+    , cache_(cache)
+    , window_(window)
+    , cacheable_(false)
+    , cache_split_(0)
+    , cached_hi_(0)
 {
     try {
         rdbuf_.resize(readbufsize);
@@ -299,6 +507,21 @@ QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbConnection> con, int re
         // readbufsize is too large (bad config probably), use default value
         rdbuf_.resize(DEFAULT_RDBUF_SIZE_);
     }
+    for (auto& chunk: chunks_) {
+        chunk.data.resize(CHUNK_SIZE);
+        chunk.size = 0;
+    }
+}
+
+QueryResultsPooler::~QueryResultsPooler() {
+    if (worker_.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            closing_ = true;
+            cvar_.notify_all();
+        }
+        worker_.join();
+    }
 }
 
 void QueryResultsPooler::throw_if_started() const {
@@ -315,8 +538,9 @@ void QueryResultsPooler::throw_if_not_started() const {
 
 void QueryResultsPooler::start() {
     throw_if_started();
-    enum Format { RESP, CSV };  // TODO: add protobuf support
+    enum Format { RESP, CSV, BINARY };
     bool use_iso_timestamps = true;
+    bool use_dictionary = false;
     Format output_format = RESP;
     boost::property_tree::ptree tree = from_json(query_text_);
     auto output = tree.get_child_optional("output");
@@ -338,90 +562,322 @@ void QueryResultsPooler::start() {
                     output_format = RESP;
                 } else if (fmt == "csv" || fmt == "CSV") {
                     output_format = CSV;
+                } else if (fmt == "bin" || fmt == "BIN") {
+                    output_format = BINARY;
                 } else {
                     std::runtime_error err("invalid output statement (format)");
                     BOOST_THROW_EXCEPTION(err);
                 }
+            } else if (kv.first == "dictionary") {
+                std::string dict = kv.second.get_value<std::string>();
+                if (dict == "true") {
+                    use_dictionary = true;
+                } else if (dict == "false") {
+                    use_dictionary = false;
+                } else {
+                    std::runtime_error err("invalid output statement (dictionary)");
+                    BOOST_THROW_EXCEPTION(err);
+                }
             }
         }
     }
     switch(output_format) {
     case RESP:
-        formatter_.reset(new RESPOutputFormatter(connection_, use_iso_timestamps));
+        // Dictionary mode is RESP only - the binary format already sends
+        // ids instead of names and CSV consumers expect self-contained rows
+        formatter_.reset(new RESPOutputFormatter(connection_, use_iso_timestamps, use_dictionary));
         break;
     case CSV:
         formatter_.reset(new CSVOutputFormatter(connection_, use_iso_timestamps));
         break;
+    case BINARY:
+        formatter_.reset(new BinaryOutputFormatter());
+        break;
     };
 
-    cursor_ = connection_->search(query_text_);
+    std::string query = query_text_;
+    if (cache_ && window_ != 0) {
+        // Try to serve the immutable prefix of the range from the results
+        // cache. Only plain forward scans can be split into two queries,
+        // sampling, group-by and limit/offset would observe partial data.
+        auto range = tree.get_child_optional("range");
+        bool plain_scan = range &&
+                          !tree.get_child_optional("select") &&
+                          !tree.get_child_optional("sample") &&
+                          !tree.get_child_optional("group-by") &&
+                          !tree.get_child_optional("limit") &&
+                          !tree.get_child_optional("offset");
+        if (plain_scan) {
+            auto strfrom = range->get_optional<std::string>("from");
+            auto strto   = range->get_optional<std::string>("to");
+            aku_Sample tsfrom, tsto;
+            aku_Timestamp now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            if (strfrom && strto &&
+                aku_parse_timestamp(strfrom->c_str(), &tsfrom) == AKU_SUCCESS &&
+                aku_parse_timestamp(strto->c_str(), &tsto) == AKU_SUCCESS &&
+                tsfrom.timestamp < tsto.timestamp &&
+                now > static_cast<aku_Timestamp>(window_))
+            {
+                // Everything older than the sliding window is immutable
+                cache_split_ = std::min(tsto.timestamp, now - window_);
+                if (tsfrom.timestamp < cache_split_) {
+                    // Key doesn't include the range (the right edge moves with
+                    // every dashboard refresh) and the output statement (the
+                    // cache stores raw samples, not formatted output)
+                    boost::property_tree::ptree keytree = tree;
+                    keytree.erase("range");
+                    keytree.erase("output");
+                    std::stringstream keystream;
+                    boost::property_tree::json_parser::write_json(keystream, keytree, false);
+                    char tsbuf[0x40];
+                    aku_timestamp_to_string(tsfrom.timestamp, tsbuf, sizeof(tsbuf));
+                    cache_key_ = keystream.str() + tsbuf;
+                    cacheable_ = true;
+                    auto entry = cache_->get(cache_key_, cache_split_);
+                    if (entry.data && aku_timestamp_to_string(entry.hi, tsbuf, sizeof(tsbuf)) > 0) {
+                        // Replay the materialized prefix and scan only the tail
+                        cached_     = entry.data;
+                        cached_hi_  = entry.hi;
+                        boost::property_tree::ptree tailtree = tree;
+                        tailtree.put("range.from", tsbuf);
+                        std::stringstream tailstream;
+                        boost::property_tree::json_parser::write_json(tailstream, tailtree, false);
+                        query = tailstream.str();
+                    }
+                }
+            }
+        }
+    }
+
+    cursor_ = connection_->search(query);
+
+    // Fill the first buffer synchronously so errors in the query are
+    // reported right away, formatting and all subsequent reads are done
+    // by the prefetch thread while the sealed chunks are on the wire
+    rdbuf_top_ = static_cast<int>(cursor_->read(rdbuf_.data(), rdbuf_.size()));
+    aku_Status status = AKU_SUCCESS;
+    if (cursor_->is_error(&status)) {
+        error_ = status;
+    }
+    cursor_done_ = cursor_->is_done() != 0;
+    worker_ = std::thread(std::bind(&QueryResultsPooler::prefetch_loop, this));
 }
 
-void QueryResultsPooler::append(const char *data, size_t data_size) {
-    throw_if_started();
-    query_text_ += std::string(data, data + data_size);
+QueryResultsPooler::Chunk* QueryResultsPooler::acquire_chunk_() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cvar_.wait(lock, [this]() { return chunk_wr_ - chunk_rd_ < NCHUNKS || closing_; });
+    if (closing_) {
+        return nullptr;
+    }
+    Chunk* chunk = &chunks_[chunk_wr_ % NCHUNKS];
+    chunk->size = 0;
+    return chunk;
 }
 
-aku_Status QueryResultsPooler::get_error() {
-    aku_Status err = AKU_SUCCESS;
-    if (cursor_->is_error(&err)) {
-        return err;
+void QueryResultsPooler::seal_chunk_() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    chunk_wr_++;
+    cvar_.notify_all();
+}
+
+bool QueryResultsPooler::format_samples_(const char* buf, int top) {
+    int pos = 0;
+    while (pos < top) {
+        const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(buf + pos);
+        assert(sample->payload.size);
+        if (sample->payload.type != aku_PData::EMPTY) {
+            while (true) {
+                char* begin = wchunk_->data.data() + wchunk_->size;
+                char* end   = wchunk_->data.data() + CHUNK_SIZE;
+                char* next  = formatter_->format(begin, end, *sample);
+                if (next != nullptr) {
+                    wchunk_->size = next - wchunk_->data.data();
+                    break;
+                }
+                // Chunk is full, seal it and continue in the next one (a
+                // single formatted sample always fits an empty chunk)
+                seal_chunk_();
+                wchunk_ = acquire_chunk_();
+                if (wchunk_ == nullptr) {
+                    return false;
+                }
+            }
+        }
+        pos += sample->payload.size;
     }
-    return AKU_SUCCESS;
+    return true;
 }
 
-std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_size) {
-    throw_if_not_started();
-    if (rdbuf_pos_ == rdbuf_top_) {
-        if (cursor_->is_done()) {
-            return std::make_tuple(0u, true);
+void QueryResultsPooler::prefetch_loop() {
+    wchunk_ = acquire_chunk_();
+    if (wchunk_ == nullptr) {
+        return;
+    }
+    // Replay the materialized prefix before the cursor data
+    if (cached_) {
+        if (!format_samples_(cached_->data(), static_cast<int>(cached_->size()))) {
+            return;
         }
-        // read new data from DB
-        rdbuf_top_ = cursor_->read(rdbuf_.data(), rdbuf_.size());
-        rdbuf_pos_ = 0u;
+    }
+    // The first buffer was filled synchronously by `start`
+    bool done = cursor_done_;
+    int  top  = rdbuf_top_;
+    while (true) {
+        if (top != 0) {
+            if (cacheable_) {
+                collect_immutable_(rdbuf_.data(), top);
+            }
+            if (!format_samples_(rdbuf_.data(), top)) {
+                return;
+            }
+        }
+        if (done || error_ != AKU_SUCCESS) {
+            break;
+        }
+        top = static_cast<int>(cursor_->read(rdbuf_.data(), rdbuf_.size()));
         aku_Status status = AKU_SUCCESS;
         if (cursor_->is_error(&status)) {
-            // Some error occured, put error message to the outgoing buffer and return
-            int len = snprintf(buf, buf_size, "-%s\r\n", aku_error_message(status));
-            if (len > 0) {
-                return std::make_tuple((size_t)len, true);
-            }
-            return std::make_tuple(0u, true);
+            error_ = status;
         }
+        done = cursor_->is_done() != 0;
     }
-
-    // format output
-    char* begin = buf;
-    char* end = begin + buf_size;
-    while(rdbuf_pos_ < rdbuf_top_) {
-        const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(rdbuf_.data() + rdbuf_pos_);
-        if (sample->payload.type != aku_PData::EMPTY) {
-            char* next = formatter_->format(begin, end, *sample);
-            if (next == nullptr) {
-                // done
+    // Give the formatter a chance to write out whatever it has buffered
+    // (binary format is blockwise)
+    while (true) {
+        char* begin = wchunk_->data.data() + wchunk_->size;
+        char* end   = wchunk_->data.data() + CHUNK_SIZE;
+        char* next  = formatter_->flush(begin, end);
+        if (next != nullptr) {
+            wchunk_->size = next - wchunk_->data.data();
+            break;
+        }
+        seal_chunk_();
+        wchunk_ = acquire_chunk_();
+        if (wchunk_ == nullptr) {
+            return;
+        }
+    }
+    aku_Status status = error_;
+    if (status != AKU_SUCCESS) {
+        // Some error occured, put error message to the outgoing stream
+        while (true) {
+            char* begin = wchunk_->data.data() + wchunk_->size;
+            char* end   = wchunk_->data.data() + CHUNK_SIZE;
+            int len = snprintf(begin, end - begin, "-%s\r\n", aku_error_message(status));
+            if (len > 0 && len < end - begin) {
+                wchunk_->size += len;
                 break;
             }
-            begin = next;
+            seal_chunk_();
+            wchunk_ = acquire_chunk_();
+            if (wchunk_ == nullptr) {
+                return;
+            }
         }
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (wchunk_->size != 0) {
+        chunk_wr_++;
+    }
+    cursor_done_ = done;
+    stream_done_ = true;
+    cvar_.notify_all();
+}
+
+void QueryResultsPooler::collect_immutable_(const char* buf, int top) {
+    // Samples older than the split point are immutable, they are copied
+    // aside and published to the cache when the cursor completes
+    int pos = 0;
+    while (pos < top) {
+        const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(buf + pos);
         assert(sample->payload.size);
-        rdbuf_pos_ += sample->payload.size;
+        if (sample->payload.type != aku_PData::EMPTY && sample->timestamp < cache_split_) {
+            pending_.insert(pending_.end(), buf + pos, buf + pos + sample->payload.size);
+        }
+        pos += sample->payload.size;
+    }
+}
+
+void QueryResultsPooler::append(const char *data, size_t data_size) {
+    throw_if_started();
+    query_text_ += std::string(data, data + data_size);
+}
+
+aku_Status QueryResultsPooler::get_error() {
+    // The prefetch thread owns the cursor, the error is cached
+    return error_;
+}
+
+std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_size) {
+    throw_if_not_started();
+    u64 ix;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cvar_.wait(lock, [this]() { return chunk_rd_ < chunk_wr_ || stream_done_; });
+        if (chunk_rd_ == chunk_wr_) {
+            // The stream is sealed and fully drained
+            return std::make_tuple(0u, true);
+        }
+        ix = chunk_rd_;
+    }
+    // The chunk is owned by this thread until `chunk_rd_` is advanced so
+    // the copy doesn't need the lock
+    Chunk& chunk = chunks_[ix % NCHUNKS];
+    size_t bytes = std::min(buf_size, chunk.size - chunk_pos_);
+    memcpy(buf, chunk.data.data() + chunk_pos_, bytes);
+    chunk_pos_ += bytes;
+    if (chunk_pos_ == chunk.size) {
+        // Chunk is drained, give it back to the formatter
+        std::lock_guard<std::mutex> guard(mutex_);
+        chunk_rd_++;
+        chunk_pos_ = 0;
+        cvar_.notify_all();
     }
-    return std::make_tuple(begin - buf, false);
+    return std::make_tuple(bytes, false);
 }
 
 void QueryResultsPooler::close() {
     throw_if_not_started();
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        closing_ = true;
+        cvar_.notify_all();
+    }
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    if (cacheable_ && cursor_done_ && error_ == AKU_SUCCESS) {
+        // The whole immutable prefix was seen, publish it to the cache
+        if (pending_.empty() && cached_) {
+            if (cached_hi_ < cache_split_) {
+                // No new immutable samples, just advance the right edge so
+                // the gap isn't rescanned by the next query
+                cache_->put(cache_key_, cached_, cache_split_);
+            }
+        } else {
+            auto blob = std::make_shared<std::vector<char>>();
+            blob->reserve((cached_ ? cached_->size() : 0u) + pending_.size());
+            if (cached_) {
+                blob->insert(blob->end(), cached_->begin(), cached_->end());
+            }
+            blob->insert(blob->end(), pending_.begin(), pending_.end());
+            cache_->put(cache_key_, blob, cache_split_);
+        }
+    }
     cursor_->close();
 }
 
-QueryProcessor::QueryProcessor(std::shared_ptr<DbConnection> con, int rdbuf)
+QueryProcessor::QueryProcessor(std::shared_ptr<DbConnection> con, int rdbuf, u64 window)
     : con_(con)
     , rdbufsize_(rdbuf)
+    , cache_(std::make_shared<QueryResultsCache>())
+    , window_(window)
 {
 }
 
 ReadOperation *QueryProcessor::create() {
-    return new QueryResultsPooler(con_, rdbufsize_);
+    return new QueryResultsPooler(con_, rdbufsize_, cache_, window_);
 }
 
 std::string QueryProcessor::get_all_stats() {
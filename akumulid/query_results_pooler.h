@@ -2,7 +2,14 @@
 #include "httpserver.h"
 #include "ingestion_pipeline.h"
 #include "server.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace Akumuli {
 
@@ -10,6 +17,52 @@ namespace Akumuli {
 struct OutputFormatter {
     virtual ~OutputFormatter() = default;
     virtual char* format(char* begin, char* end, const aku_Sample& sample) = 0;
+    /** Write out data buffered by the formatter (if any) at the end of
+      * the stream. Returns null if the buffer is too small.
+      */
+    virtual char* flush(char* begin, char* end) { return begin; }
+};
+
+
+/** Cache of materialized query results.
+  * Dashboards re-issue the same query every few seconds moving only the
+  * right edge of the time range, but everything older than the sliding
+  * window is immutable. The cache stores the raw sample stream of the
+  * immutable prefix of the range so only the mutable tail has to be
+  * scanned, the two parts are stitched together by `QueryResultsPooler`.
+  * Only plain forward scans are cached - sampling, group-by and
+  * limit/offset don't decompose into two independent scans.
+  */
+struct QueryResultsCache {
+
+    //! Materialized immutable prefix of the query results
+    struct Entry {
+        std::shared_ptr<const std::vector<char>> data;    //! Raw sample stream
+        aku_Timestamp                            hi;      //! Right edge of the range (exclusive)
+        u64                                      access;  //! Last access (used for eviction)
+    };
+
+    enum {
+        SIZE_LIMIT = 0x4000000,  //< Max total size of the cached sample streams
+    };
+
+    std::mutex                   mutex_;
+    std::map<std::string, Entry> entries_;
+    size_t                       total_size_;
+    u64                          access_cnt_;
+
+    QueryResultsCache();
+
+    /** Find materialized results for the key.
+      * @param key cache key (query text with the range and output stripped)
+      * @param split immutable range boundary, entries that extend beyond it can't be used
+      * @returns entry with null `data` on miss
+      */
+    Entry get(std::string const& key, aku_Timestamp split);
+
+    //! Store materialized immutable prefix `[from, hi)` of the query results
+    void put(std::string const& key, std::shared_ptr<const std::vector<char>> data,
+             aku_Timestamp hi);
 };
 
 
@@ -20,13 +73,71 @@ struct QueryResultsPooler : ReadOperation {
     std::shared_ptr<DbCursor>        cursor_;
     std::unique_ptr<OutputFormatter> formatter_;
 
-    std::vector<char>   rdbuf_;      //! Read buffer
-    int                 rdbuf_pos_;  //! Read position in buffer
-    int                 rdbuf_top_;  //! Last initialized item _index_ in `rdbuf_`
+    std::vector<char>   rdbuf_;      //! Sample read buffer (used by the prefetch thread only)
+    int                 rdbuf_top_;  //! Number of initialized bytes in `rdbuf_`
     static const size_t DEFAULT_RDBUF_SIZE_ = 1000u;
     static const size_t DEFAULT_ITEM_SIZE_  = sizeof(aku_Sample);
 
-    QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize);
+    enum {
+        CHUNK_SIZE = 0x10000,  //< Size of a single formatted output chunk
+        NCHUNKS    = 4,        //< Number of chunks in the output ring
+    };
+
+    //! Fixed-size chunk of formatted output
+    struct Chunk {
+        std::vector<char> data;
+        size_t            size;  //! Number of formatted bytes
+    };
+
+    // Formatted output ring - the prefetch thread reads the cursor and
+    // formats the samples into the chunks while the transport drains the
+    // sealed ones, the same fixed set of chunks is reused for the whole
+    // result stream
+    std::array<Chunk, NCHUNKS> chunks_;
+    Chunk*                  wchunk_;       //! Chunk the formatter writes to (prefetch thread only)
+    u64                     chunk_wr_;     //! Number of chunks sealed by the prefetch thread
+    u64                     chunk_rd_;     //! Number of chunks drained by the transport
+    size_t                  chunk_pos_;    //! Read position in the head chunk
+    bool                    stream_done_;  //! All output was formatted and sealed
+    bool                    cursor_done_;  //! Cursor is exhausted
+    bool                    closing_;      //! Prefetch thread should stop
+    std::atomic<aku_Status> error_;        //! Last cursor error (set by the prefetch thread)
+    std::mutex              mutex_;
+    std::condition_variable cvar_;
+    std::thread             worker_;
+
+    // Result cache state
+    std::shared_ptr<QueryResultsCache> cache_;  //! Shared results cache (can be null)
+    u64               window_;       //! Sliding window width (0 - caching disabled)
+    bool              cacheable_;    //! Results of the query can be cached
+    std::string       cache_key_;    //! Cache key (query text with the range stripped)
+    aku_Timestamp     cache_split_;  //! Immutable range boundary
+    std::shared_ptr<const std::vector<char>>
+                      cached_;       //! Materialized prefix (replayed before the cursor data)
+    aku_Timestamp     cached_hi_;    //! Right edge of `cached_`
+    std::vector<char> pending_;      //! Immutable samples collected for the cache
+
+    QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize,
+                       std::shared_ptr<QueryResultsCache> cache = std::shared_ptr<QueryResultsCache>(),
+                       u64 window = 0);
+
+    //! Stop the prefetch thread if `close` wasn't called
+    ~QueryResultsPooler();
+
+    //! Prefetch thread entry point (the only cursor reader and formatter after `start`)
+    void prefetch_loop();
+
+    //! Get the chunk the formatter writes to (waits for a free slot, null if closing)
+    Chunk* acquire_chunk_();
+
+    //! Make the current chunk visible to the transport thread
+    void seal_chunk_();
+
+    //! Format samples from the buffer into the output ring, false if closing
+    bool format_samples_(const char* buf, int top);
+
+    //! Copy samples that fall into the immutable part of the range to `pending_`
+    void collect_immutable_(const char* buf, int top);
 
     void throw_if_started() const;
 
@@ -44,10 +155,12 @@ struct QueryResultsPooler : ReadOperation {
 };
 
 struct QueryProcessor : ReadOperationBuilder {
-    std::shared_ptr<DbConnection> con_;
-    int                           rdbufsize_;
+    std::shared_ptr<DbConnection>      con_;
+    int                                rdbufsize_;
+    std::shared_ptr<QueryResultsCache> cache_;   //! Results cache shared by all read operations
+    u64                                window_;  //! Sliding window width (0 - caching disabled)
 
-    QueryProcessor(std::shared_ptr<DbConnection> con, int rdbuf);
+    QueryProcessor(std::shared_ptr<DbConnection> con, int rdbuf, u64 window = 0);
 
     virtual ReadOperation* create();
 
@@ -1,6 +1,7 @@
 #include "resp.h"
 #include <boost/exception/all.hpp>
 #include <cassert>
+#include <cstring>
 
 namespace Akumuli {
 
@@ -42,6 +43,42 @@ RESPStream::Type RESPStream::next_type() const {
 u64 RESPStream::_read_int_body() {
     u64 result = 0;
     const int MAX_DIGITS = 84;  // Maximum number of decimal digits in u64
+
+    // Fast path - the whole value is already buffered and can be
+    // parsed in place without going through `get` for every byte.
+    size_t avail = 0;
+    const Byte* buf = stream_->pick_buffer(&avail);
+    if (buf != nullptr) {
+        const Byte* end = buf + avail;
+        const Byte* eol = find_line_end(buf, end);
+        // The '\r' at the buffer boundary is handled by the slow path
+        if (eol != end && (*eol == '\n' || eol + 1 != end)) {
+            if (eol - buf > MAX_DIGITS) {
+                auto ctx = stream_->get_error_context("integer is too long");
+                BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+            }
+            for (auto it = buf; it != eol; it++) {
+                Byte c = *it;
+                if (c > 0x39 || c < 0x30) {
+                    auto ctx = stream_->get_error_context("can't parse integer (character value out of range)");
+                    BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+                }
+                result = result*10 + static_cast<int>(c & 0x0F);
+            }
+            if (*eol == '\n') {
+                stream_->discard(eol - buf + 1);
+                return result;
+            }
+            if (eol[1] != '\n') {
+                auto ctx = stream_->get_error_context("invalid symbol inside stream - '\\r'");
+                BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+            }
+            stream_->discard(eol - buf + 2);
+            return result;
+        }
+        result = 0;
+    }
+
     int quota = MAX_DIGITS;
     while(quota) {
         Byte c = stream_->get();
@@ -81,6 +118,31 @@ u64 RESPStream::read_int() {
 int RESPStream::_read_string_body(Byte *buffer, size_t byte_buffer_size) {
     auto p = buffer;
     int quota = std::min(byte_buffer_size, (size_t)RESPStream::STRING_LENGTH_MAX);
+
+    // Fast path - find the line end with a vectorized scan and copy
+    // the whole string at once.
+    size_t avail = 0;
+    const Byte* buf = stream_->pick_buffer(&avail);
+    if (buf != nullptr) {
+        const Byte* end = buf + avail;
+        const Byte* eol = find_line_end(buf, end);
+        // The '\r' at the buffer boundary is handled by the slow path
+        if (eol != end && (*eol == '\n' || eol + 1 != end)) {
+            int len = static_cast<int>(eol - buf);
+            if (len > quota) {
+                auto ctx = stream_->get_error_context("out of quota");
+                BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+            }
+            if (*eol == '\r' && eol[1] != '\n') {
+                auto ctx = stream_->get_error_context("bad end of sequence");
+                BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+            }
+            memcpy(buffer, buf, len);
+            stream_->discard(len + (*eol == '\n' ? 1 : 2));
+            return len;
+        }
+    }
+
     while(quota) {
         Byte c = stream_->get();
         if (c == '\n') {
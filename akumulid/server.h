@@ -14,6 +14,15 @@ struct ServerSettings {
     std::string name;
     int         port;
     int         nworkers;
+    //! One SO_REUSEPORT listening socket per worker (TCP only)
+    bool        reuse_port = false;
+    //! Busy-poll budget in microseconds, 0 - disabled (TCP only)
+    int         busy_poll = 0;
+    //! Priority class of the sessions, low priority data is shed first
+    //! when the ingestion pipeline is saturated
+    SpoutPriority priority = AKU_PRIORITY_HIGH;
+    //! Sessions ack writes that passed the durability watermark (TCP only)
+    bool        durable_acks = false;
 };
 
 
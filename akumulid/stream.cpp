@@ -5,6 +5,10 @@
 #include <sstream>
 #include <boost/exception/all.hpp>
 
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace Akumuli {
 
 StreamError::StreamError(std::string line, int pos)
@@ -28,6 +32,14 @@ std::string StreamError::get_bottom_line() const {
 
 ByteStreamReader::~ByteStreamReader() {}
 
+const Byte* ByteStreamReader::pick_buffer(size_t* size) {
+    // Fast path is not supported by default
+    *size = 0;
+    return nullptr;
+}
+
+void ByteStreamReader::discard(size_t) {}
+
 // MemStreamReader implementation
 
 MemStreamReader::MemStreamReader(const Byte *buffer, size_t buffer_len)
@@ -63,6 +75,20 @@ int MemStreamReader::read(Byte *buffer, size_t buffer_len) {
     return nbytes;
 }
 
+const Byte* MemStreamReader::pick_buffer(size_t* size) {
+    if (pos_ == size_) {
+        *size = 0;
+        return nullptr;
+    }
+    *size = size_ - pos_;
+    return buf_ + pos_;
+}
+
+void MemStreamReader::discard(size_t n) {
+    assert(n <= size_ - pos_);
+    pos_ += n;
+}
+
 void MemStreamReader::close() {
     pos_ = size_;
 }
@@ -71,4 +97,25 @@ std::tuple<std::string, size_t> MemStreamReader::get_error_context(const char* e
     return std::make_tuple(error_message, 0u);
 }
 
+const Byte* find_line_end(const Byte* begin, const Byte* end) {
+    auto it = begin;
+#if defined __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i match = _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf));
+        int mask = _mm_movemask_epi8(match);
+        if (mask != 0) {
+            return it + __builtin_ctz(mask);
+        }
+        it += 16;
+    }
+#endif
+    while (it < end && *it != '\r' && *it != '\n') {
+        it++;
+    }
+    return it;
+}
+
 }
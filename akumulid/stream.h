@@ -73,6 +73,22 @@ struct ByteStreamReader {
       */
     virtual int read(Byte* buffer, size_t buffer_len) = 0;
 
+    /** Access bytes that are already buffered without copying.
+      * This is an optional fast path - readers that can't provide a
+      * contiguous view return null and the caller should fall back to
+      * byte-by-byte access. The view stays valid until the next call
+      * to any method of the stream.
+      * @param size output parameter, number of contiguous bytes available
+      * @return pointer to the buffered bytes or null
+      */
+    virtual const Byte* pick_buffer(size_t* size);
+
+    /** Skip `n` buffered bytes.
+      * Should only be called after successful `pick_buffer` with n less
+      * then or equal to the returned size.
+      */
+    virtual void discard(size_t n);
+
     /** Close stream.
      **/
     virtual void close() = 0;
@@ -97,8 +113,16 @@ public:
     virtual Byte pick() const;
     virtual bool is_eof();
     virtual int read(Byte* buffer, size_t buffer_len);
+    virtual const Byte* pick_buffer(size_t* size);
+    virtual void discard(size_t n);
     virtual void close();
     virtual std::tuple<std::string, size_t> get_error_context(const char* error_message) const;
 };
 
+/** Find the first line break ('\r' or '\n') in the buffer.
+  * Scans 16-byte chunks at a time using SSE2 when available.
+  * @return pointer to the first line break or `end` if there is none
+  */
+const Byte* find_line_end(const Byte* begin, const Byte* end);
+
 }  // namespace
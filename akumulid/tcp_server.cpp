@@ -1,23 +1,89 @@
 #include "tcp_server.h"
+#include "topology.h"
 #include "utility.h"
 #include <thread>
+#include <sys/socket.h>
+#include <boost/exception/all.hpp>
 #include <boost/function.hpp>
 
 namespace Akumuli {
 
+/** Per-thread pool of session read buffers.
+  * Buffers are allocated from the io thread that runs the session and
+  * released back to the pool of whatever thread drops the last PDU
+  * reference (normally the same io thread), so the receive path doesn't
+  * touch the global heap and io threads don't contend on the allocator.
+  */
+struct BufferPool {
+    enum {
+        MAX_CACHED = 0x40,  //< Free-list depth (256KB per io thread)
+    };
+    std::vector<Byte*> free_;
+
+    ~BufferPool() {
+        for (auto p: free_) {
+            free((void*)p);
+        }
+    }
+
+    static BufferPool& instance() {
+        static thread_local BufferPool pool;
+        return pool;
+    }
+
+    Byte* get() {
+        if (free_.empty()) {
+            return (Byte*)malloc(TcpSession::BUFFER_SIZE);
+        }
+        auto p = free_.back();
+        free_.pop_back();
+        return p;
+    }
+
+    void put(Byte* p) {
+        if (free_.size() >= MAX_CACHED) {
+            free((void*)p);
+            return;
+        }
+        free_.push_back(p);
+    }
+};
+
 //                     //
 //     Tcp Session     //
 //                     //
 
-TcpSession::TcpSession(IOServiceT *io, std::shared_ptr<PipelineSpout> spout)
+TcpSession::TcpSession(IOServiceT *io, std::shared_ptr<PipelineSpout> spout,
+                       std::shared_ptr<ReadOperationBuilder> qproc, bool durable_acks)
     : io_(io)
     , socket_(*io)
     , strand_(*io)
+    , retry_timer_(*io)
     , spout_(spout)
+    , qproc_(qproc)
     , parser_(spout)
+    , binparser_(spout)
+    , protocol_selected_(false)
+    , binary_mode_(false)
+    , parse_error_cnt_(0)
+    , parse_error_flush_(boost::posix_time::microsec_clock::universal_time())
+    , peer_(nullptr)
+    , peer_samples_(0)
+    , durable_acks_(durable_acks)
+    , acked_count_(0)
+    , ack_pending_(false)
+    , ack_timer_(*io)
+    , write_in_flight_(false)
     , logger_("tcp-session", 10)
 {
     logger_.info() << "Session created";
+    if (qproc_) {
+        // Query frames are only dispatched while `parse_next` runs inside
+        // `handle_read`, the session is alive at that point
+        parser_.set_query_cb([this](std::string text) {
+            handle_query(std::move(text));
+        });
+    }
     parser_.start();
 }
 
@@ -30,15 +96,58 @@ std::tuple<TcpSession::BufferT, size_t, size_t> TcpSession::get_next_buffer(Buff
                                                                             size_t pos,
                                                                             size_t bytes_read)
 {
-    Byte *buffer = (Byte*)malloc(BUFFER_SIZE);
+    auto write_pos = pos + bytes_read;
+    if (prev_buf != NO_BUFFER && size - write_pos >= BUFFER_SIZE_THRESHOLD) {
+        // Reuse the segment - bytes that are already received stay in place
+        // (PDUs in flight share ownership of the buffer), new data is
+        // appended after them so the parser reads straight from the
+        // receive buffer and only tokens that span segments get stitched.
+        return std::make_tuple(prev_buf, size, write_pos);
+    }
+    Byte *buffer = BufferPool::instance().get();
     auto deleter = [](Byte* p) {
-        free((void*)p);
+        BufferPool::instance().put(p);
     };
     std::shared_ptr<Byte> bufptr(buffer, deleter);
     return std::make_tuple(bufptr, BUFFER_SIZE, 0u);
 }
 
+PeerStats::Counters* TcpSession::get_peer_counters() {
+    if (AKU_UNLIKELY(peer_ == nullptr)) {
+        boost::system::error_code ec;
+        auto endpoint = socket_.remote_endpoint(ec);
+        if (ec) {
+            // Disconnected before the first read completed
+            return nullptr;
+        }
+        peer_ = PeerStats::instance().get_peer(endpoint.address().to_string());
+    }
+    return peer_;
+}
+
+void TcpSession::account_peer_samples() {
+    u64 total = binary_mode_ ? binparser_.nsamples() : parser_.nsamples();
+    if (peer_ != nullptr && total != peer_samples_) {
+        PeerStats::Counters::add(peer_->samples, total - peer_samples_);
+    }
+    peer_samples_ = total;
+}
+
 void TcpSession::start(BufferT buf, size_t buf_size, size_t pos, size_t bytes_read) {
+    if (AKU_UNLIKELY(spout_->is_congested())) {
+        auto peer = get_peer_counters();
+        if (peer != nullptr) {
+            PeerStats::Counters::add(peer->throttle_events, 1);
+        }
+        // The database throttles the spout - pause reads instead of
+        // spinning, TCP flow control will push back on the client
+        retry_timer_.expires_from_now(boost::posix_time::milliseconds((int)RETRY_TIMEOUT));
+        retry_timer_.async_wait(strand_.wrap(
+                    boost::bind(&TcpSession::start,
+                                shared_from_this(),
+                                buf, buf_size, pos, bytes_read)));
+        return;
+    }
     std::tie(buf, buf_size, pos) = get_next_buffer(buf, buf_size, pos, bytes_read);
     socket_.async_read_some(
                 boost::asio::buffer(buf.get() + pos, buf_size - pos),
@@ -62,19 +171,47 @@ PipelineErrorCb TcpSession::get_error_cb() {
         if (session) {
             const char* msg = aku_error_message(status);
             session->logger_.trace() << msg;
-            boost::asio::streambuf stream;
-            std::ostream os(&stream);
-            os << "-DB " << msg << "\r\n";
-            boost::asio::async_write(session->socket_,
-                                     stream,
-                                     boost::bind(&TcpSession::handle_write_error,
-                                                 session,
-                                                 boost::asio::placeholders::error));
+            auto frame = std::make_shared<std::string>();
+            *frame += "-DB ";
+            *frame += msg;
+            *frame += "\r\n";
+            // The callback fires on a pipeline writer thread - hop onto
+            // the session's strand before touching the outbound queue
+            session->strand_.post([session, frame]() {
+                session->queue_write(frame, boost::bind(&TcpSession::handle_write_error,
+                                                        session, _1));
+            });
         }
     };
     return PipelineErrorCb(fn);
 }
 
+void TcpSession::queue_write(std::shared_ptr<std::string> frame, WriteCompletionCb cb) {
+    outbox_.push_back(OutboundFrame{std::move(frame), std::move(cb)});
+    start_next_write_();
+}
+
+void TcpSession::start_next_write_() {
+    if (write_in_flight_ || outbox_.empty()) {
+        return;
+    }
+    write_in_flight_ = true;
+    boost::asio::async_write(socket_, boost::asio::buffer(*outbox_.front().frame),
+                             strand_.wrap(boost::bind(&TcpSession::handle_outbound_write,
+                                                      shared_from_this(),
+                                                      boost::asio::placeholders::error)));
+}
+
+void TcpSession::handle_outbound_write(boost::system::error_code error) {
+    OutboundFrame done = std::move(outbox_.front());
+    outbox_.pop_front();
+    write_in_flight_ = false;
+    if (done.on_complete) {
+        done.on_complete(error);
+    }
+    start_next_write_();
+}
+
 std::shared_ptr<Byte> TcpSession::NO_BUFFER = std::shared_ptr<Byte>();
 
 void TcpSession::handle_read(BufferT buffer,
@@ -84,43 +221,237 @@ void TcpSession::handle_read(BufferT buffer,
                              size_t nbytes) {
     if (error) {
         logger_.error() << error.message();
-        parser_.close();
+        flush_parse_errors();
+        if (binary_mode_) {
+            binparser_.close();
+        } else {
+            parser_.close();
+        }
         drain_pipeline_spout();
     } else {
+        auto peer = get_peer_counters();
+        if (peer != nullptr) {
+            PeerStats::Counters::add(peer->bytes, nbytes);
+        }
         try {
             PDU pdu = {
                 buffer,
-                nbytes,
+                pos + nbytes,  // size of the segment including previous reads
                 pos
             };
-            parser_.parse_next(pdu);
+            if (!protocol_selected_) {
+                // The binary protocol is negotiated by the handshake magic at
+                // the start of the stream (our clients send it in the first
+                // packet), everything else is treated as RESP
+                if (nbytes - pos >= BinaryProtocolParser::MAGIC_SIZE &&
+                    memcmp(buffer.get() + pos, BinaryProtocolParser::MAGIC,
+                           BinaryProtocolParser::MAGIC_SIZE) == 0)
+                {
+                    binary_mode_ = true;
+                    pdu.pos += BinaryProtocolParser::MAGIC_SIZE;
+                }
+                protocol_selected_ = true;
+            }
+            if (binary_mode_) {
+                binparser_.parse_next(pdu);
+            } else {
+                parser_.parse_next(pdu);
+            }
+            account_peer_samples();
+            send_durability_acks();
             start(buffer, buf_size, pos, nbytes);
         } catch (RESPError const& resp_err) {
             // This error is related to client so we need to send it back
-            logger_.error() << resp_err.what();
-            logger_.error() << resp_err.get_bottom_line();
-            boost::asio::streambuf stream;
-            std::ostream os(&stream);
-            os << "-PARSER " << resp_err.what() << "\r\n";
-            os << "-PARSER " << resp_err.get_bottom_line() << "\r\n";
-            boost::asio::async_write(socket_, stream,
-                                     boost::bind(&TcpSession::handle_write_error,
-                                                 shared_from_this(),
-                                                 boost::asio::placeholders::error)
-                                     );
+            bool detailed = parse_error_cnt_ == 0;
+            on_parse_error(resp_err);
+            auto frame = std::make_shared<std::string>();
+            if (detailed) {
+                // First error of the interval gets the full context
+                *frame += "-PARSER ";
+                *frame += resp_err.what();
+                *frame += "\r\n";
+                *frame += "-PARSER ";
+                *frame += resp_err.get_bottom_line();
+                *frame += "\r\n";
+            } else {
+                // Error storm - respond with a preformatted message instead
+                // of formatting one per event
+                *frame += "-PARSER parse error\r\n";
+            }
+            queue_write(frame, boost::bind(&TcpSession::handle_write_error,
+                                           shared_from_this(), _1));
         } catch (...) {
             // Unexpected error
             logger_.error() << boost::current_exception_diagnostic_information();
-            boost::asio::streambuf stream;
-            std::ostream os(&stream);
-            os << "-ERR " << boost::current_exception_diagnostic_information() << "\r\n";
-            boost::asio::async_write(socket_, stream,
-                                     boost::bind(&TcpSession::handle_write_error,
-                                                 shared_from_this(),
-                                                 boost::asio::placeholders::error)
-                                     );
+            auto frame = std::make_shared<std::string>();
+            *frame += "-ERR ";
+            *frame += boost::current_exception_diagnostic_information();
+            *frame += "\r\n";
+            queue_write(frame, boost::bind(&TcpSession::handle_write_error,
+                                           shared_from_this(), _1));
+        }
+    }
+}
+
+void TcpSession::on_parse_error(RESPError const& err) {
+    parse_error_cnt_++;
+    if (peer_ != nullptr) {
+        PeerStats::Counters::add(peer_->parse_errors, 1);
+    }
+    if (parse_error_example_.empty()) {
+        parse_error_example_ = err.what();
+    }
+    auto now = boost::posix_time::microsec_clock::universal_time();
+    if (parse_error_cnt_ == 1) {
+        // First error of the interval is logged with full context
+        logger_.error() << err.what();
+        logger_.error() << err.get_bottom_line();
+        parse_error_flush_ = now;
+    } else if ((now - parse_error_flush_).total_seconds() >= ERROR_FLUSH_TIMEOUT) {
+        flush_parse_errors();
+        parse_error_flush_ = now;
+    }
+}
+
+void TcpSession::flush_parse_errors() {
+    if (parse_error_cnt_ > 1) {
+        logger_.error() << parse_error_cnt_ << " parse errors since last report, first: "
+                        << parse_error_example_;
+    }
+    parse_error_cnt_ = 0;
+    parse_error_example_.clear();
+}
+
+void TcpSession::handle_query(std::string text) {
+    std::shared_ptr<ReadOperation> op(qproc_->create());
+    op->append(text.data(), text.size());
+    op->start();
+    auto status = op->get_error();
+    if (status != AKU_SUCCESS) {
+        op->close();
+        send_query_error(aku_error_message(status));
+        return;
+    }
+    send_query_results(op);
+}
+
+void TcpSession::send_query_results(std::shared_ptr<ReadOperation> op) {
+    Byte chunk[QUERY_CHUNK_SIZE];
+    size_t size;
+    bool done;
+    try {
+        std::tie(size, done) = op->read_some(chunk, sizeof(chunk));
+    } catch (std::exception const& e) {
+        logger_.error() << "Query execution error: " << e.what();
+        op->close();
+        send_query_error(e.what());
+        return;
+    }
+    if (size == 0 && !done) {
+        // No data yet - reschedule instead of spinning so the read loop
+        // and the other sessions of this io thread keep making progress
+        io_->post(strand_.wrap(boost::bind(&TcpSession::send_query_results,
+                                           shared_from_this(), op)));
+        return;
+    }
+    // One bulk string frame per chunk, RESP nil terminates the stream
+    auto frame = std::make_shared<std::string>();
+    if (size != 0) {
+        *frame += '$';
+        *frame += std::to_string(size);
+        *frame += "\r\n";
+        frame->append(chunk, chunk + size);
+        *frame += "\r\n";
+    }
+    if (done) {
+        *frame += "$-1\r\n";
+        op->close();
+        op.reset();
+    }
+    queue_write(frame, boost::bind(&TcpSession::handle_query_write,
+                                   shared_from_this(), op, frame, _1));
+}
+
+void TcpSession::handle_query_write(std::shared_ptr<ReadOperation> op,
+                                    std::shared_ptr<std::string> frame,
+                                    boost::system::error_code error) {
+    AKU_UNUSED(frame);  // Kept the buffer alive while the write was in flight
+    if (error) {
+        logger_.error() << "Error sending query results to client";
+        logger_.error() << error.message();
+        if (op) {
+            op->close();
+        }
+        return;
+    }
+    if (op) {
+        // Previous chunk is on the wire - read the next one
+        send_query_results(op);
+    }
+}
+
+void TcpSession::send_query_error(const char* msg) {
+    auto frame = std::make_shared<std::string>();
+    *frame += "-QUERY ";
+    *frame += msg;
+    *frame += "\r\n";
+    queue_write(frame, boost::bind(&TcpSession::handle_query_write,
+                                   shared_from_this(),
+                                   std::shared_ptr<ReadOperation>(), frame, _1));
+}
+
+void TcpSession::send_durability_acks() {
+    if (!durable_acks_) {
+        return;
+    }
+    u64 completed = spout_->get_completed_count();
+    bool caught_up = spout_->is_empty();
+    if (completed != acked_count_) {
+        // The sequence is recorded before the completion counter is bumped
+        // so a watermark that covers it covers all `completed` samples
+        u64 seqno = spout_->get_completed_sequence();
+        if (spout_->get_durability_watermark() >= seqno) {
+            acked_count_ = completed;
+            // One ack covers everything the client sent so far. The frame
+            // goes through the outbound queue so it can't be spliced into
+            // a query response that is streaming on this session.
+            auto frame = std::make_shared<std::string>();
+            *frame += "+DUR ";
+            *frame += std::to_string(completed);
+            *frame += "\r\n";
+            queue_write(frame, boost::bind(&TcpSession::handle_ack_write,
+                                           shared_from_this(), frame, _1));
+        } else {
+            // The samples are written but the covering fsync hasn't
+            // completed yet
+            caught_up = false;
         }
     }
+    if (!caught_up && !ack_pending_) {
+        // Samples are still in flight and the client can go quiet - poll
+        // the watermark instead of waiting for the next read to complete
+        ack_pending_ = true;
+        ack_timer_.expires_from_now(boost::posix_time::milliseconds((int)DURABLE_ACK_TIMEOUT));
+        ack_timer_.async_wait(strand_.wrap(boost::bind(&TcpSession::handle_ack_timer,
+                                                       shared_from_this(),
+                                                       boost::asio::placeholders::error)));
+    }
+}
+
+void TcpSession::handle_ack_timer(boost::system::error_code error) {
+    ack_pending_ = false;
+    if (!error) {
+        send_durability_acks();
+    }
+}
+
+void TcpSession::handle_ack_write(std::shared_ptr<std::string> frame,
+                                  boost::system::error_code error) {
+    AKU_UNUSED(frame);  // Kept the buffer alive while the write was in flight
+    if (error) {
+        logger_.error() << "Error sending durability ack to client";
+        logger_.error() << error.message();
+    }
 }
 
 void TcpSession::drain_pipeline_spout() {
@@ -146,15 +477,40 @@ void TcpSession::handle_write_error(boost::system::error_code error) {
 TcpAcceptor::TcpAcceptor(// Server parameters
                         std::vector<IOServiceT *> io, int port,
                         // Storage & pipeline
-                        std::shared_ptr<IngestionPipeline> pipeline )
-    : acceptor_(own_io_, EndpointT(boost::asio::ip::tcp::v4(), port))
+                        std::shared_ptr<IngestionPipeline> pipeline,
+                        bool reuse_port,
+                        int busy_poll,
+                        SpoutPriority priority,
+                        std::shared_ptr<ReadOperationBuilder> qproc,
+                        bool durable_acks )
+    : acceptor_(own_io_)
     , sessions_io_(io)
     , pipeline_(pipeline)
+    , qproc_(qproc)
     , io_index_{0}
     , start_barrier_(2)
     , stop_barrier_(2)
+    , busy_poll_(busy_poll)
+    , priority_(priority)
+    , durable_acks_(durable_acks)
     , logger_("tcp-acceptor", 10)
 {
+    EndpointT endpoint(boost::asio::ip::tcp::v4(), port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(AcceptorT::reuse_address(true));
+    if (reuse_port) {
+#if defined SO_REUSEPORT
+        // Several acceptors share the port, the kernel spreads incoming
+        // connections between their sockets
+        typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePortT;
+        acceptor_.set_option(ReusePortT(true));
+#else
+        logger_.error() << "SO_REUSEPORT is not supported on this platform";
+#endif
+    }
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+
     logger_.info() << "Server created!";
     logger_.info() << "Port: " << port;
 
@@ -200,8 +556,9 @@ void TcpAcceptor::_run_one() {
 
 void TcpAcceptor::_start() {
     std::shared_ptr<TcpSession> session;
-    auto spout = pipeline_->make_spout();
-    session.reset(new TcpSession(sessions_io_.at(io_index_++ % sessions_io_.size()), spout));
+    auto spout = pipeline_->make_spout(priority_);
+    session.reset(new TcpSession(sessions_io_.at(io_index_++ % sessions_io_.size()), spout, qproc_,
+                                 durable_acks_));
     // attach session to spout
     spout->set_error_cb(session->get_error_cb());
     // run session
@@ -233,6 +590,19 @@ void TcpAcceptor::_stop() {
 
 void TcpAcceptor::handle_accept(std::shared_ptr<TcpSession> session, boost::system::error_code err) {
     if (AKU_LIKELY(!err)) {
+        if (busy_poll_) {
+#if defined SO_BUSY_POLL
+            // The kernel polls the device queue for this long (usec) before
+            // blocking the read, trading cpu time for latency
+            int usec = busy_poll_;
+            if (setsockopt(session->socket().native_handle(), SOL_SOCKET, SO_BUSY_POLL,
+                           &usec, sizeof(usec)) != 0) {
+                logger_.info() << "can't set SO_BUSY_POLL on client socket";
+            }
+#else
+            logger_.error() << "SO_BUSY_POLL is not supported on this platform";
+#endif
+        }
         session->start(TcpSession::NO_BUFFER, 0u, 0u, 0u);
         _start();
     } else {
@@ -244,18 +614,41 @@ void TcpAcceptor::handle_accept(std::shared_ptr<TcpSession> session, boost::syst
 //     Tcp Server     //
 //                    //
 
-TcpServer::TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port)
+TcpServer::TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port, Mode mode,
+                     int busy_poll, SpoutPriority priority,
+                     std::shared_ptr<ReadOperationBuilder> qproc, bool durable_acks)
     : pline(pipeline)
     , barrier(concurrency)
     , stopped{0}
+    , busy_poll(busy_poll)
     , logger_("tcp-server", 32)
 {
-    for(;concurrency --> 0;) {
-        iovec.push_back(&io);
+    if (mode == SHARED_NOTHING) {
+        // Shared-nothing network layer - every worker runs its own
+        // io-service and accepts on its own SO_REUSEPORT socket, so the
+        // accept path and the asio structures are never contended
+        for (int i = 0; i < concurrency; i++) {
+            ioown.push_back(std::unique_ptr<IOServiceT>(new IOServiceT()));
+            iovec.push_back(ioown.back().get());
+        }
+        pline->start();
+        for (auto io: iovec) {
+            std::vector<IOServiceT*> single = { io };
+            auto serv = std::make_shared<TcpAcceptor>(single, port, pline, true, busy_poll, priority,
+                                                      qproc, durable_acks);
+            acceptors.push_back(serv);
+            serv->start();
+        }
+    } else {
+        for(;concurrency --> 0;) {
+            iovec.push_back(&io);
+        }
+        auto serv = std::make_shared<TcpAcceptor>(iovec, port, pline, false, busy_poll, priority,
+                                                  qproc, durable_acks);
+        acceptors.push_back(serv);
+        pline->start();
+        serv->start();
     }
-    serv = std::make_shared<TcpAcceptor>(iovec, port, pline);
-    pline->start();
-    serv->start();
 }
 
 void TcpServer::start(SignalHandler* sig, int id) {
@@ -264,10 +657,36 @@ void TcpServer::start(SignalHandler* sig, int id) {
     sig->add_handler(boost::bind(&TcpServer::stop, std::move(self)), id);
 
     auto logger = &logger_;
-    auto iorun = [logger](IOServiceT& io, boost::barrier& bar) {
-        auto fn = [&]() {
+    bool busy = busy_poll != 0;
+    auto iorun = [logger, busy](IOServiceT& io, boost::barrier& bar, int worker) {
+        auto fn = [&, worker, busy]() {
+            // Keep the worker and its first-touch allocations (session
+            // buffers) on one NUMA node
+            auto const& topo = Topology::instance();
+            if (!topo.bind_to_node(topo.node_for_worker(worker))) {
+                logger->info() << "can't set i/o thread affinity";
+            }
             try {
-                io.run();
+                if (busy) {
+                    // Busy-poll mode - spin on the ready queue for a while
+                    // before falling back to a blocking wait so a socket
+                    // that becomes readable is picked up without a reschedule
+                    const int SPIN_LIMIT = 0x10000;
+                    int idle = 0;
+                    while (!io.stopped()) {
+                        if (io.poll() != 0) {
+                            idle = 0;
+                            continue;
+                        }
+                        if (++idle < SPIN_LIMIT) {
+                            continue;
+                        }
+                        io.run_one();
+                        idle = 0;
+                    }
+                } else {
+                    io.run();
+                }
                 bar.wait();
             } catch (RESPError const& e) {
                 logger->error() << e.what();
@@ -278,15 +697,18 @@ void TcpServer::start(SignalHandler* sig, int id) {
         return fn;
     };
 
+    int wix = 0;
     for (auto io: iovec) {
-        std::thread iothread(iorun(*io, barrier));
+        std::thread iothread(iorun(*io, barrier, wix++));
         iothread.detach();
     }
 }
 
 void TcpServer::stop() {
     if (stopped++ == 0) {
-        serv->stop();
+        for (auto& serv: acceptors) {
+            serv->stop();
+        }
         logger_.info() << "TcpServer stopped";
 
         // No need to joint I/O threads, just wait until they completes.
@@ -310,9 +732,12 @@ struct TcpServerBuilder {
     }
 
     std::shared_ptr<Server> operator () (std::shared_ptr<IngestionPipeline> pipeline,
-                                         std::shared_ptr<ReadOperationBuilder>,
+                                         std::shared_ptr<ReadOperationBuilder> qproc,
                                          const ServerSettings& settings) {
-        return std::make_shared<TcpServer>(pipeline, settings.nworkers, settings.port);
+        auto mode = settings.reuse_port ? TcpServer::SHARED_NOTHING : TcpServer::SHARED_IO;
+        return std::make_shared<TcpServer>(pipeline, settings.nworkers, settings.port, mode,
+                                           settings.busy_poll, settings.priority, qproc,
+                                           settings.durable_acks);
     }
 };
 
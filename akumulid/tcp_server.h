@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <memory>
 
 #include <boost/asio.hpp>
@@ -23,6 +25,7 @@
 #include <boost/thread/barrier.hpp>
 
 #include "logger.h"
+#include "peer_stats.h"
 #include "protocolparser.h"
 #include "server.h"
 
@@ -41,23 +44,73 @@ typedef boost::asio::io_service::work  WorkT;
 
 /** Server session. Reads data from socket.
  *  Must be created in the heap.
+ *
+ *  Write and query streams are multiplexed on the session - a RESP bulk
+ *  string frame carries a query request which is dispatched to the
+ *  `ReadOperationBuilder`, the results are streamed back as bulk string
+ *  chunks terminated by a RESP nil ("$-1"). Flow control of the two
+ *  directions is independent: the read loop keeps decoding write frames
+ *  while results are in flight, and the next result chunk is read from
+ *  the cursor only when the previous write completes, so a slow client
+ *  applies backpressure to its own query without stalling ingestion.
   */
 class TcpSession : public std::enable_shared_from_this<TcpSession> {
+public:
     // TODO: Unique session ID
     enum {
         BUFFER_SIZE           = 0x1000,  //< Buffer size
         BUFFER_SIZE_THRESHOLD = 0x0200,  //< Min free buffer space
+        RETRY_TIMEOUT         = 10,      //< Read retry timeout in milliseconds (backpressure)
+        ERROR_FLUSH_TIMEOUT   = 10,      //< Parse error report interval in seconds
+        QUERY_CHUNK_SIZE      = 0x1000,  //< Query result chunk size
+        DURABLE_ACK_TIMEOUT   = 10,      //< Watermark recheck interval in milliseconds
     };
+private:
     IOServiceT*                    io_;
     SocketT                        socket_;
     StrandT                        strand_;
+    boost::asio::deadline_timer    retry_timer_;  //< Timer to resume reads when the DB throttles
     std::shared_ptr<PipelineSpout> spout_;
+    std::shared_ptr<ReadOperationBuilder> qproc_;  //< Query processor (queries are disabled if null)
     ProtocolParser                 parser_;
+    BinaryProtocolParser           binparser_;
+    bool                           protocol_selected_;  //< First bytes were examined
+    bool                           binary_mode_;        //< Session uses the binary protocol
+    // Parse errors are aggregated per session - count and first example,
+    // reported at most once per ERROR_FLUSH_TIMEOUT so a misbehaving
+    // client can't drown the daemon in logging work
+    u64                            parse_error_cnt_;    //< Errors since the last report
+    std::string                    parse_error_example_;//< First error of the interval
+    boost::posix_time::ptime       parse_error_flush_;  //< Time of the last report
+    PeerStats::Counters*           peer_;               //< Source address counters (null until the first read)
+    u64                            peer_samples_;       //< Parser sample count already credited to the peer
+    // Durable ack state. When enabled the session sends a "+DUR <count>"
+    // line once the durability watermark covers the completed writes, one
+    // ack covers the whole batch so no per-write fsync is needed
+    bool                           durable_acks_;       //< Send durability acks to the client
+    u64                            acked_count_;        //< Number of samples already acked
+    bool                           ack_pending_;        //< Watermark recheck timer is armed
+    boost::asio::deadline_timer    ack_timer_;          //< Timer to recheck the watermark
+    //! Outbound write completion callback
+    typedef std::function<void(boost::system::error_code)> WriteCompletionCb;
+    //! Outbound frame with its completion callback (can be empty)
+    struct OutboundFrame {
+        std::shared_ptr<std::string> frame;
+        WriteCompletionCb            on_complete;
+    };
+    // All socket writes go through one queue drained by a single in-flight
+    // `async_write`. The strand only serializes completion handlers - two
+    // overlapping composed writes interleave their intermediate write_some
+    // operations and the bytes of the two RESP frames mix on the wire.
+    std::deque<OutboundFrame>      outbox_;             //< Pending outbound frames
+    bool                           write_in_flight_;    //< An async_write is in progress
     Logger                         logger_;
 
 public:
     typedef std::shared_ptr<Byte> BufferT;
-    TcpSession(IOServiceT* io, std::shared_ptr<PipelineSpout> spout);
+    TcpSession(IOServiceT* io, std::shared_ptr<PipelineSpout> spout,
+               std::shared_ptr<ReadOperationBuilder> qproc = std::shared_ptr<ReadOperationBuilder>(),
+               bool durable_acks = false);
 
     SocketT& socket();
 
@@ -83,7 +136,56 @@ private:
 
     void handle_write_error(boost::system::error_code error);
 
+    /** Queue an outbound frame (should be called on the strand).
+      * The frame is written when the writes queued before it complete,
+      * then `cb` is invoked with the write status.
+      */
+    void queue_write(std::shared_ptr<std::string> frame, WriteCompletionCb cb = WriteCompletionCb());
+
+    //! Start the next outbound write if none is in flight
+    void start_next_write_();
+
+    //! Outbound write completion, runs the frame's callback
+    void handle_outbound_write(boost::system::error_code error);
+
     void drain_pipeline_spout();
+
+    //! Account parse error, logs at most once per ERROR_FLUSH_TIMEOUT
+    void on_parse_error(RESPError const& err);
+
+    //! Report aggregated parse errors (if any)
+    void flush_parse_errors();
+
+    //! Resolve the peer's counters (no DNS, source address only)
+    PeerStats::Counters* get_peer_counters();
+
+    //! Credit newly parsed samples to the peer's counters
+    void account_peer_samples();
+
+    //! Dispatch a query frame to the query processor
+    void handle_query(std::string text);
+
+    //! Read the next chunk of the results and send it to the client
+    void send_query_results(std::shared_ptr<ReadOperation> op);
+
+    //! Query chunk write completion, `op` is null when the stream is done
+    void handle_query_write(std::shared_ptr<ReadOperation> op,
+                            std::shared_ptr<std::string> frame,
+                            boost::system::error_code error);
+
+    //! Send a "-QUERY <msg>" error line to the client
+    void send_query_error(const char* msg);
+
+    /** Ack the completed writes if the durability watermark covers them,
+      * arm the recheck timer otherwise (the covering fsync is in flight)
+      */
+    void send_durability_acks();
+
+    //! Watermark recheck timer handler
+    void handle_ack_timer(boost::system::error_code error);
+
+    //! Durability ack write completion, `frame` held the buffer alive
+    void handle_ack_write(std::shared_ptr<std::string> frame, boost::system::error_code error);
 };
 
 
@@ -96,11 +198,15 @@ class TcpAcceptor : public std::enable_shared_from_this<TcpAcceptor> {
     std::vector<IOServiceT*> sessions_io_;  //< List of io-services for sessions
     std::vector<WorkT> sessions_work_;      //< Work to block io-services from completing too early
     std::shared_ptr<IngestionPipeline> pipeline_;  //< Pipeline instance
+    std::shared_ptr<ReadOperationBuilder> qproc_;  //< Query processor for multiplexed sessions
     std::atomic<int>                   io_index_;  //< I/O service index
 
     boost::barrier start_barrier_;  //< Barrier to start worker thread
     boost::barrier stop_barrier_;   //< Barrier to stop worker thread
 
+    int           busy_poll_;  //< SO_BUSY_POLL budget for client sockets (usec)
+    SpoutPriority priority_;   //< Priority class of the sessions
+    bool          durable_acks_;  //< Sessions send durability acks
     Logger logger_;
 
 public:
@@ -108,11 +214,25 @@ public:
       * @param io io-service instance
       * @param port port to listen for new connections
       * @param pipeline ingestion pipeline
+      * @param reuse_port bind with SO_REUSEPORT so several acceptors can
+      *        share the port (the kernel spreads connections between them)
+      * @param busy_poll SO_BUSY_POLL budget for client sockets in
+      *        microseconds, 0 - disabled
+      * @param priority priority class assigned to the sessions
+      * @param qproc query processor for multiplexed sessions (queries
+      *        are disabled when null)
+      * @param durable_acks sessions ack the writes that passed the
+      *        durability watermark (batched acks)
       */
     TcpAcceptor(  // Server parameters
         std::vector<IOServiceT*> io, int port,
         // Storage & pipeline
-        std::shared_ptr<IngestionPipeline> pipeline);
+        std::shared_ptr<IngestionPipeline> pipeline,
+        bool reuse_port = false,
+        int busy_poll = 0,
+        SpoutPriority priority = AKU_PRIORITY_HIGH,
+        std::shared_ptr<ReadOperationBuilder> qproc = std::shared_ptr<ReadOperationBuilder>(),
+        bool durable_acks = false);
 
     //! Start listening on socket
     void start();
@@ -136,15 +256,26 @@ private:
 
 
 struct TcpServer : std::enable_shared_from_this<TcpServer>, Server {
-    std::shared_ptr<IngestionPipeline> pline;
-    std::shared_ptr<TcpAcceptor>       serv;
-    boost::asio::io_service            io;
-    std::vector<IOServiceT*>           iovec;
-    boost::barrier                     barrier;
-    std::atomic<int>                   stopped;
-    Logger                             logger_;
-
-    TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port);
+    //! Server mode
+    enum Mode {
+        SHARED_IO,       //< One acceptor, workers share one io-service
+        SHARED_NOTHING,  //< SO_REUSEPORT acceptor and io-service per worker
+    };
+    std::shared_ptr<IngestionPipeline>        pline;
+    std::vector<std::shared_ptr<TcpAcceptor>> acceptors;
+    boost::asio::io_service                   io;
+    std::vector<std::unique_ptr<IOServiceT>>  ioown;  //< Per-worker io-services (SHARED_NOTHING)
+    std::vector<IOServiceT*>                  iovec;
+    boost::barrier                            barrier;
+    std::atomic<int>                          stopped;
+    int                                       busy_poll;  //< Spin budget in usec, 0 - block
+    Logger                                    logger_;
+
+    TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port,
+              Mode mode = SHARED_IO, int busy_poll = 0,
+              SpoutPriority priority = AKU_PRIORITY_HIGH,
+              std::shared_ptr<ReadOperationBuilder> qproc = std::shared_ptr<ReadOperationBuilder>(),
+              bool durable_acks = false);
 
     //! Run IO service
     virtual void start(SignalHandler* sig_handler, int id);
@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "topology.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace Akumuli {
+
+//! Parse cpulist format - comma separated list of ranges ("0-7,16-23")
+static std::vector<int> parse_cpulist(std::string const& list) {
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        int first, last;
+        auto dash = item.find('-');
+        if (dash == std::string::npos) {
+            first = last = atoi(item.c_str());
+        } else {
+            first = atoi(item.substr(0, dash).c_str());
+            last  = atoi(item.substr(dash + 1).c_str());
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+Topology::Topology() {
+    for (int node = 0; true; node++) {
+        std::stringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        std::ifstream file(path.str());
+        if (!file) {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        auto cpus = parse_cpulist(list);
+        if (!cpus.empty()) {
+            nodes_.push_back(std::move(cpus));
+        }
+    }
+    if (nodes_.empty()) {
+        // Non-NUMA box or sysfs is unavailable - one node with all cpus
+        int ncpus = static_cast<int>(std::thread::hardware_concurrency());
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < std::max(ncpus, 1); cpu++) {
+            cpus.push_back(cpu);
+        }
+        nodes_.push_back(std::move(cpus));
+    }
+}
+
+const Topology& Topology::instance() {
+    static Topology topology;
+    return topology;
+}
+
+int Topology::nnodes() const {
+    return static_cast<int>(nodes_.size());
+}
+
+int Topology::node_for_worker(int ix) const {
+    return ix % nnodes();
+}
+
+int Topology::cpu_for_worker(int ix) const {
+    auto const& cpus = nodes_.at(static_cast<size_t>(node_for_worker(ix)));
+    return cpus.at(static_cast<size_t>(ix / nnodes()) % cpus.size());
+}
+
+bool Topology::bind_to_node(int node) const {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (auto cpu: nodes_.at(static_cast<size_t>(node % nnodes()))) {
+        CPU_SET(static_cast<size_t>(cpu), &mask);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+}
+
+bool Topology::bind_to_cpu(int cpu) {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(static_cast<size_t>(cpu), &mask);
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+}
+
+}  // namespace
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace Akumuli {
+
+/** CPU/NUMA topology reader.
+  * Node to cpu mapping is parsed from /sys/devices/system/node on startup.
+  * Worker threads of the servers and the ingestion pipeline are spread
+  * across the nodes round-robin and bound to all cpus of their node, so a
+  * worker and the memory it touches first (session buffers, queue slots,
+  * decoded blocks) stay on the same socket. On single-node boxes (or when
+  * the sysfs tree is missing) binding to the only node is a no-op.
+  */
+struct Topology {
+    //! Cpus of each node
+    std::vector<std::vector<int>> nodes_;
+
+    //! Read topology from sysfs (falls back to one node with all cpus)
+    Topology();
+
+    //! Process-wide instance
+    static const Topology& instance();
+
+    //! Number of NUMA nodes
+    int nnodes() const;
+
+    //! Node that worker `ix` should run on (round-robin across nodes)
+    int node_for_worker(int ix) const;
+
+    //! Cpu that worker `ix` should be pinned to (round-robin across
+    //! nodes first, then across cpus of the node)
+    int cpu_for_worker(int ix) const;
+
+    /** Bind the calling thread to all cpus of the node.
+      * First-touch allocations made by the thread stay node-local but the
+      * scheduler can still balance across the node's cores.
+      * @return false if the affinity can't be set
+      */
+    bool bind_to_node(int node) const;
+
+    //! Pin the calling thread to a single cpu
+    static bool bind_to_cpu(int cpu);
+};
+
+}  // namespace
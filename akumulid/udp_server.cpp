@@ -1,8 +1,14 @@
 #include "udp_server.h"
+#include "topology.h"
 
+#include <algorithm>
+#include <array>
 #include <thread>
 
 #include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,17 +16,20 @@
 #include <time.h>
 
 #include <boost/bind.hpp>
+#include <boost/exception/all.hpp>
 #include <boost/scope_exit.hpp>
 
 namespace Akumuli {
 
-UdpServer::UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port)
+UdpServer::UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port,
+                     SpoutPriority priority)
     : pipeline_(pipeline)
     , start_barrier_(nworkers + 1)
     , stop_barrier_(nworkers + 1)
     , stop_{0}
     , port_(port)
     , nworkers_(nworkers)
+    , priority_(priority)
     , logger_("UdpServer", 128)
 {
 }
@@ -37,9 +46,9 @@ void UdpServer::start(SignalHandler *sig, int id) {
     };
     // Create workers
     for (int i = 0; i < nworkers_; i++) {
-        auto spout = pipeline_->make_spout();
+        auto spout = pipeline_->make_spout(priority_);
         spout->set_error_cb(error_cb);
-        std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), spout));
+        std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), spout, i));
         thread.detach();
     }
     start_barrier_.wait();
@@ -53,12 +62,19 @@ void UdpServer::stop() {
 }
 
 
-void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
+void UdpServer::worker(std::shared_ptr<PipelineSpout> spout, int cpu) {
     start_barrier_.wait();
 
     int sockfd, retval;
     sockaddr_in sa{};
 
+    // Pin the worker so SO_INCOMING_CPU steering stays stable and the
+    // receive path stays node-local (workers are spread across NUMA nodes)
+    cpu = Topology::instance().cpu_for_worker(cpu);
+    if (!Topology::bind_to_cpu(cpu)) {
+        logger_.info() << "can't set worker thread affinity";
+    }
+
     ProtocolParser parser(spout);
     try {
 
@@ -88,6 +104,29 @@ void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
             BOOST_THROW_EXCEPTION(err);
         }
 
+#if defined SO_INCOMING_CPU
+        // Steer flows that arrive on this cpu to this worker's socket
+        if (setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+            logger_.info() << "can't set SO_INCOMING_CPU: " << strerror(errno);
+        }
+#endif
+
+        // Large receive buffer smooths out ingestion bursts
+        int rcvbuf = 1 << 23;  // 8MB
+        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1) {
+            logger_.info() << "can't set SO_RCVBUF: " << strerror(errno);
+        }
+
+#if defined UDP_GRO
+        // Receive coalesced super-datagrams - one buffer crosses the socket
+        // boundary instead of dozens of MTU-sized ones. The payload is a
+        // plain concatenation of the datagrams so the parser can consume it
+        // as a single PDU.
+        if (setsockopt(sockfd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval)) == -1) {
+            logger_.info() << "can't set UDP_GRO: " << strerror(errno);
+        }
+#endif
+
         timeval tval;
         tval.tv_sec = 0;
         tval.tv_usec = 1000;  // 1ms
@@ -112,7 +151,29 @@ void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
             BOOST_THROW_EXCEPTION(err);
         }
 
-        auto iobuf = std::make_shared<IOBuf>();
+        // Recycling ring. A buffer is reusable when the parser released
+        // all PDUs aliasing it, otherwise a fresh one is allocated into
+        // the evicted slot.
+        std::array<std::shared_ptr<IOBuf>, RING_SIZE> ring;
+        u32 ring_pos = 0;
+        u32 desired_mss = MIN_MSS;
+        u32 shrink_lag = 0;
+
+        auto acquire = [&]() {
+            for (u32 i = 0; i < RING_SIZE; i++) {
+                auto& slot = ring[(ring_pos + i) % RING_SIZE];
+                if (slot && slot.use_count() == 1 && slot->mss == desired_mss) {
+                    ring_pos = (ring_pos + i + 1) % RING_SIZE;
+                    return slot;
+                }
+            }
+            auto nbuf = std::make_shared<IOBuf>(desired_mss);
+            ring[ring_pos % RING_SIZE] = nbuf;
+            ring_pos = (ring_pos + 1) % RING_SIZE;
+            return nbuf;
+        };
+
+        auto iobuf = acquire();
 
         while(!stop_.load(std::memory_order_relaxed)) {
             retval = recvmmsg(sockfd, iobuf->msgs, NPACKETS, MSG_WAITFORONE, nullptr);
@@ -129,15 +190,17 @@ void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
 
             iobuf->pps++;
 
+            u32 max_len = 0;
             for (int i = 0; i < retval; i++) {
                 // reset buffer to receive new message
                 iobuf->bps += iobuf->msgs[i].msg_len;
                 size_t mlen = iobuf->msgs[i].msg_len;
                 iobuf->msgs[i].msg_len = 0;
+                max_len = std::max(max_len, static_cast<u32>(mlen));
 
                 // parse message content
                 PDU pdu = {
-                    std::shared_ptr<Byte>(iobuf, iobuf->bufs[i]),
+                    std::shared_ptr<Byte>(iobuf, iobuf->buf(i)),
                     mlen,
                     0u,
                 };
@@ -145,7 +208,24 @@ void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
                 parser.parse_next(pdu);
             }
             if (retval != 0) {
-                iobuf = std::make_shared<IOBuf>();
+                // Adapt the packet buffer size to the observed datagrams.
+                // A full buffer means the datagram was likely truncated
+                // (or GRO coalesced up to the limit) - grow right away.
+                // Shrinking waits out SHRINK_LAG underutilized batches so
+                // a single quiet period doesn't cause resize churn.
+                if (max_len >= iobuf->mss) {
+                    desired_mss = std::min<u32>(desired_mss*2, MAX_MSS);
+                    shrink_lag = 0;
+                } else if (max_len*4 < iobuf->mss && desired_mss > MIN_MSS) {
+                    shrink_lag++;
+                    if (shrink_lag >= SHRINK_LAG) {
+                        desired_mss = std::max<u32>(desired_mss/2, MIN_MSS);
+                        shrink_lag = 0;
+                    }
+                } else {
+                    shrink_lag = 0;
+                }
+                iobuf = acquire();
             }
         }
     } catch(...) {
@@ -167,7 +247,8 @@ struct UdpServerBuilder {
     std::shared_ptr<Server> operator () (std::shared_ptr<IngestionPipeline> pipeline,
                                          std::shared_ptr<ReadOperationBuilder>,
                                          const ServerSettings& settings) {
-        return std::make_shared<UdpServer>(pipeline, settings.nworkers, settings.port);
+        return std::make_shared<UdpServer>(pipeline, settings.nworkers, settings.port,
+                                           settings.priority);
     }
 };
 
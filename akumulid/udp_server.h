@@ -39,42 +39,76 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
     std::atomic<int>                   stop_;
     const int                          port_;
     const int                          nworkers_;
+    const SpoutPriority                priority_;  //< Priority class of the workers' spouts
 
     Logger logger_;
 
-    static const int MSS      = 2048 - 128;
     static const int NPACKETS = 512;
 
+    enum {
+        //! Number of IOBufs kept for reuse by each worker
+        RING_SIZE  = 8,
+        //! Lower bound of the adaptive buffer size
+        MIN_MSS    = 2048 - 128,
+        //! Upper bound of the adaptive buffer size (GRO super-datagram)
+        MAX_MSS    = 64*1024 - 128,
+        //! Number of underutilized batches before the buffers shrink
+        SHRINK_LAG = 16,
+    };
+
+    /** Receive buffer for one `recvmmsg` batch.
+      * Packet memory is allocated on the heap so the per-packet size can
+      * follow the observed datagram sizes (see the worker loop). The
+      * buffer stays alive until the parser releases the last PDU aliasing
+      * it, recycled buffers are picked up from the worker's ring.
+      */
     struct IOBuf {
         // Counters
         std::atomic<u64> pps;
         std::atomic<u64> bps;
 
+        //! Size of a single packet buffer
+        const u32 mss;
+
         // Packet recv structs
         mmsghdr msgs[NPACKETS];
         iovec   iovecs[NPACKETS];
-        char    bufs[NPACKETS][MSS];
-
-        IOBuf() {
-            memset(this, 0, sizeof(IOBuf));
+        std::unique_ptr<char[]> bufs;
+
+        IOBuf(u32 mss)
+            : mss(mss)
+            , bufs(new char[NPACKETS*static_cast<size_t>(mss)])
+        {
+            // Buffers are overwritten by recvmmsg, zeroing them out is a
+            // waste of time
+            memset(msgs, 0, sizeof(msgs));
+            memset(iovecs, 0, sizeof(iovecs));
+            pps = 0;
+            bps = 0;
             for (int i = 0; i < NPACKETS; i++) {
-                iovecs[i].iov_base         = bufs[i];
-                iovecs[i].iov_len          = MSS;
+                iovecs[i].iov_base         = buf(i);
+                iovecs[i].iov_len          = mss;
                 msgs[i].msg_hdr.msg_iov    = &iovecs[i];
                 msgs[i].msg_hdr.msg_iovlen = 1;
             }
         }
 
-    } __attribute__((aligned(
-        64)));  // Otherwise struct will be aligned by sizeof(bufs) and this is crazy expensive
+        //! Get pointer to the i-th packet buffer
+        char* buf(int i) { return bufs.get() + i*static_cast<size_t>(mss); }
+
+    } __attribute__((aligned(64)));
 
 public:
     /** C-tor.
       * @param nworker number of workers
       * @param port port number
       * @param pipeline pointer to ingestion pipeline
+      * @param priority priority class of the workers' spouts (UDP can't
+      *        push back on the senders so it defaults to low priority
+      *        and gets shed first under overload)
       */
-    UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port);
+    UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port,
+              SpoutPriority priority = AKU_PRIORITY_LOW);
 
     //! Start processing packets
     virtual void start(SignalHandler* sig, int id);
@@ -83,7 +117,12 @@ private:
     //! Stop processing packets
     void stop();
 
-    void worker(std::shared_ptr<PipelineSpout> spout);
+    /** Worker thread body.
+      * Each worker owns a SO_REUSEPORT socket pinned to its cpu with
+      * SO_INCOMING_CPU, so the kernel spreads flows across the cores
+      * without bouncing packets between them.
+      */
+    void worker(std::shared_ptr<PipelineSpout> spout, int cpu);
 };
 
 }  // namespace
@@ -20,6 +20,8 @@
  */
 #pragma once
 
+#include "akumuli.h"
+
 #ifdef __GNUC__
 #define AKU_LIKELY(x) __builtin_expect((x), 1)
 #define AKU_UNLIKELY(x) __builtin_expect((x), 0)
@@ -30,3 +32,24 @@
 
 //! Macro to supress `variable unused` warnings for variables that is unused for a reason.
 #define AKU_UNUSED(x) (void)(x)
+
+namespace Akumuli {
+
+/** RAII marker for the built-in sampling profiler.
+  * Tags the calling thread with the pipeline stage it's in for the
+  * lifetime of the guard (see `aku_profiler_start`).
+  */
+struct ProfilerStageGuard {
+    int prev_;
+
+    ProfilerStageGuard(aku_ProfilerStage stage)
+        : prev_(aku_profiler_enter(stage))
+    {
+    }
+
+    ~ProfilerStageGuard() {
+        aku_profiler_leave(prev_);
+    }
+};
+
+}  // namespace Akumuli
@@ -74,6 +74,11 @@ typedef struct {
         u64 fwd_bytes;  //< Number of scanned bytes in forward direction
         u64 bwd_bytes;  //< Number of scanned bytes in backward direction
     } scan;
+    struct {
+        u64 n_pages_tracked;        //< Number of pages with a search profile
+        u64 n_pages_degraded;       //< Pages where interpolation search is switched off
+        u64 n_interpolation_skips;  //< Searches that went straight to binary search
+    } adaptive;
 } aku_SearchStats;
 
 
@@ -153,6 +158,15 @@ AKU_EXPORT apr_status_t aku_create_database_ex(const char* file_name, const char
   */
 AKU_EXPORT apr_status_t aku_remove_database(const char* file_name, aku_logger_cb_t logger);
 
+/** Check all volumes for damage (parallel, one scanner thread per volume).
+  * Verifies the checksum of every chunk and logs a per-volume summary.
+  * Can be used on a closed database only.
+  * @param file_name path to metadata file
+  * @param logger logging function
+  * @returns AKU_SUCCESS if no damage was found, AKU_EBAD_DATA otherwise
+  */
+AKU_EXPORT aku_Status aku_fsck(const char* file_name, aku_logger_cb_t logger);
+
 
 /** Open recenlty create storage.
   * @param path path to storage metadata file
@@ -192,6 +206,22 @@ AKU_EXPORT aku_Status aku_parse_timestamp(const char* iso_str, aku_Sample* sampl
 AKU_EXPORT aku_Status aku_series_to_param_id(aku_Database* db, const char* begin, const char* end,
                                              aku_Sample* sample);
 
+/** Convert batch of series names to ids. Assign new ids on first encounter.
+  * Names are deduplicated and new series are added to the matcher with a
+  * single lock acquisition, so bulk clients (e.g. backfill jobs that
+  * resolve many series at startup) should prefer this over per-name
+  * `aku_series_to_param_id` calls.
+  * @param db opened database instance
+  * @param begins array of pointers to the begining of each name
+  * @param ends array of pointers to the next after end character of each name
+  * @param out_ids is an output parameter, receives one id per name
+  * @param n number of names
+  * @returns AKU_SUCCESS on success, error code otherwise
+  */
+AKU_EXPORT aku_Status aku_series_to_param_id_batch(aku_Database* db, const char* const* begins,
+                                                   const char* const* ends, aku_ParamId* out_ids,
+                                                   u32 n);
+
 /** Try to parse duration.
   * @param str should point to the begining of the string
   * @param value is an output parameter
@@ -221,6 +251,40 @@ AKU_EXPORT aku_Status aku_write_double_raw(aku_Database* db, aku_ParamId param_i
   */
 AKU_EXPORT aku_Status aku_write(aku_Database* db, const aku_Sample* sample);
 
+/** Write batch of measurements to DB (columnar layout).
+  * Batch is dispatched to the write cache once so per-sample locking
+  * overhead is amortized across the batch.
+  * @param db opened database instance
+  * @param param_ids array of storage parameter ids
+  * @param timestamps array of timestamps
+  * @param values array of parameter values
+  * @param n number of measurements in the batch
+  * @returns AKU_SUCCESS if all measurements are stored, AKU_ELATE_WRITE
+  *          if some of them were discarded as late writes
+  */
+AKU_EXPORT aku_Status aku_write_batch(aku_Database* db, const aku_ParamId* param_ids,
+                                      const aku_Timestamp* timestamps, const double* values, uint32_t n);
+
+/** Get the sequence number of the last acknowledged write.
+  * Every successful write is tagged with a monotonically growing sequence
+  * number. A client that needs durability can sample the sequence after a
+  * batch of writes and compare it against the durability watermark later
+  * instead of forcing an fsync per write.
+  * @param db opened database instance
+  * @returns sequence number of the last acknowledged write
+  */
+AKU_EXPORT u64 aku_get_write_sequence(aku_Database* db);
+
+/** Get the durability watermark.
+  * The watermark is advanced by completed volume flushes - all writes
+  * with sequence numbers at or below the watermark are flushed to disk.
+  * Writes above the watermark reside in the in-memory window and are
+  * protected by the write-ahead log only (if it is enabled).
+  * @param db opened database instance
+  * @returns current durability watermark
+  */
+AKU_EXPORT u64 aku_get_durability_watermark(aku_Database* db);
+
 
 //---------
 // Queries
@@ -230,6 +294,12 @@ AKU_EXPORT aku_Status aku_write(aku_Database* db, const aku_Sample* sample);
   * @param db should point to opened database instance
   * @param query should contain valid query
   * @return cursor instance
+  *
+  * Query is a JSON object. In addition to raw scans (`range` + optional
+  * `where`/`group-by`/`sample` statements) the query can contain an
+  * `aggregate` statement - "count", "sum", "min", "max" or "mean" - in
+  * which case the cursor returns one value per series computed over the
+  * whole range instead of the raw samples.
   */
 AKU_EXPORT aku_Cursor* aku_query(aku_Database* db, const char* query);
 
@@ -289,3 +359,31 @@ AKU_EXPORT void aku_global_storage_stats(aku_Database* db, aku_StorageStats* rcv
 AKU_EXPORT void aku_debug_print(aku_Database* db);
 
 AKU_EXPORT int aku_json_stats(aku_Database* db, char* buffer, size_t size);
+
+//! Pipeline stages recognized by the built-in sampling profiler
+typedef enum {
+    AKU_STAGE_IDLE      = 0,
+    AKU_STAGE_PARSER    = 1,
+    AKU_STAGE_PIPELINE  = 2,
+    AKU_STAGE_SEQUENCER = 3,
+    AKU_STAGE_NBTREE    = 4,
+    AKU_STAGE_VOLUME    = 5,
+} aku_ProfilerStage;
+
+/** Start the built-in sampling profiler. Worker threads tag the pipeline
+  * stage they're in, the profiler periodically samples the tags and the
+  * per-stage breakdown is reported by `aku_json_stats`.
+  */
+AKU_EXPORT void aku_profiler_start();
+
+//! Stop the built-in sampling profiler (collected counts are kept).
+AKU_EXPORT void aku_profiler_stop();
+
+/** Tag the calling thread with the pipeline stage it enters.
+  * Cheap enough to be called unconditionally (one thread-local store).
+  * @return previous stage, should be passed to `aku_profiler_leave`
+  */
+AKU_EXPORT int aku_profiler_enter(aku_ProfilerStage stage);
+
+//! Restore the stage returned by `aku_profiler_enter`.
+AKU_EXPORT void aku_profiler_leave(int prev);
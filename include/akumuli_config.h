@@ -28,6 +28,11 @@
 #define AKU_DURABILITY_SPEED_TRADEOFF 2
 #define AKU_MAX_WRITE_SPEED 4
 
+// Values for metadata_sync parameter
+#define AKU_METADATA_SYNC_NORMAL 0  // default value, sync on checkpoint
+#define AKU_METADATA_SYNC_OFF    1  // leave syncing to the OS
+#define AKU_METADATA_SYNC_FULL   2  // sync after each commit
+
 
 // Log levels
 typedef enum {
@@ -69,4 +74,54 @@ typedef struct {
     //! Cache size limit
     u64 max_cache_size;
 
+    //! 0 - write-ahead log disabled (default), other value - enabled
+    u32 enable_wal;
+
+    //! Metadata fsync policy, 0 - sync on checkpoint (default), 1 - no sync, 2 - sync on commit
+    u32 metadata_sync;
+
+    //! 0 - continuous rollups disabled (default), other value - enabled
+    u32 enable_rollups;
+
+    /** Memory budget shared by all databases of the process, 0 - each
+      * database uses its own `max_cache_size` budget (default). When set,
+      * `max_cache_size` becomes the guaranteed per-database quota and a
+      * database can use cache memory above its quota as long as the shared
+      * budget isn't exhausted. The budget is sized by the first database
+      * opened with a non-zero value.
+      */
+    u64 shared_cache_size;
+
+    /** Bounded lateness reorder window in nanoseconds, 0 - disabled
+      * (default). When set, writes go through a small per-series reorder
+      * buffer so mildly out-of-order samples don't trigger late write
+      * drops or early checkpoints. Buffered samples reach the WAL only
+      * when they leave the buffer.
+      */
+    u64 reorder_lateness;
+
+    /** Group commit fsync interval in nanoseconds, 0 - fsync inline on
+      * every checkpoint (default). When set, checkpoint flushes are
+      * accumulated and a background thread performs a single fsync per
+      * interval (or earlier when enough checkpoints are pending),
+      * releasing all waiting writers together.
+      */
+    u64 fsync_interval;
+
+    /** 0 - cursors pull data synchronously on the caller's thread
+      * (default). When set, each query runs on a background worker that
+      * fills a bounded ring and `aku_cursor_read` only drains it, so the
+      * caller can overlap storage latency with its own work.
+      */
+    u32 concurrent_cursors;
+
+    /** 0 - the writer that triggers a checkpoint merges the closed window
+      * to disk inline (default). When set, the merge runs on a background
+      * worker: the windows are swapped immediately and ingestion proceeds
+      * into the new window while the old one is sorted, compressed and
+      * committed. At most one checkpoint is in flight - the writer that
+      * triggers the next one waits for the previous merge to finish first.
+      */
+    u32 pipeline_checkpoints;
+
 } aku_FineTuneParams;
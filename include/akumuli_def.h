@@ -69,6 +69,7 @@ typedef struct {
         ERROR_CLIPPING = 1 << 9,  /** indicates that some data was lost due to clipping
                                             (extra payload stored in `data` was lost) */
         SAX_WORD       = 1 << 10, /** indicates that SAX word is stored in extra payload */
+        STRING_PAYLOAD = 1 << 11, /** indicates that character data is stored in extra payload */
 
         MARGIN    = 1 << 13, /** shuld be used to detect margin (if (payload.type > MARGIN) ...) */
         LO_MARGIN = 1 << 14, /** backward direction margin */
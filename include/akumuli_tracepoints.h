@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* USDT (SystemTap/dtrace style) static tracepoints with `akumuli` as the
+ * provider name. The probes mark the stage boundaries of the ingestion and
+ * query paths so tools like bpftrace and perf can attach to stable names
+ * instead of mangled private symbols. Compiled out by default - configure
+ * with `-DENABLE_TRACEPOINTS=ON` to emit them (the nop instructions they
+ * leave behind are free until a tracer arms them).
+ */
+
+#if defined AKU_ENABLE_TRACEPOINTS
+
+#include <sys/sdt.h>
+
+#define AKU_PROBE(name)             DTRACE_PROBE(akumuli, name)
+#define AKU_PROBE1(name, a)         DTRACE_PROBE1(akumuli, name, a)
+#define AKU_PROBE2(name, a, b)      DTRACE_PROBE2(akumuli, name, a, b)
+#define AKU_PROBE3(name, a, b, c)   DTRACE_PROBE3(akumuli, name, a, b, c)
+
+#else
+
+#define AKU_PROBE(name)
+#define AKU_PROBE1(name, a)
+#define AKU_PROBE2(name, a, b)
+#define AKU_PROBE3(name, a, b, c)
+
+#endif
@@ -25,8 +25,11 @@
 
 #include "akumuli.h"
 #include "storage.h"
+#include "alloc_audit.h"
 #include "datetime.h"
+#include "latency_histogram.h"
 #include "log_iface.h"
+#include "stage_profiler.h"
 #include "status_util.h"
 
 #include <boost/property_tree/ptree.hpp>
@@ -82,11 +85,16 @@ struct CursorImpl : aku_Cursor {
     aku_Status status_;
     std::string query_;
 
-    CursorImpl(Storage& storage, const char* query)
+    CursorImpl(Storage& storage, const char* query, bool concurrent)
         : query_(query)
     {
         status_ = AKU_SUCCESS;
         cursor_ = CoroCursor::make(&Storage::search, &storage, query_.data());
+        if (concurrent) {
+            // Run the query pipeline on a background worker, reads will
+            // only drain the ring
+            cursor_.reset(new ConcurrentCursor(std::move(cursor_)));
+        }
     }
 
     ~CursorImpl() {
@@ -120,10 +128,12 @@ struct CursorImpl : aku_Cursor {
 struct DatabaseImpl : public aku_Database
 {
     Storage storage_;
+    bool concurrent_cursors_;
 
     // private fields
     DatabaseImpl(const char* path, const aku_FineTuneParams& config)
         : storage_(path, config)
+        , concurrent_cursors_(config.concurrent_cursors != 0)
     {
     }
 
@@ -135,6 +145,11 @@ struct DatabaseImpl : public aku_Database
         return storage_.series_to_param_id(begin, end, &out_sample->paramid);
     }
 
+    aku_Status series_to_param_id_batch(const char* const* begins, const char* const* ends,
+                                        aku_ParamId* out_ids, u32 n) {
+        return storage_.series_to_param_id_batch(begins, ends, out_ids, n);
+    }
+
     int param_id_to_series(aku_ParamId id, char* buffer, size_t size) const {
         return storage_.param_id_to_series(id, buffer, size);
     }
@@ -148,7 +163,7 @@ struct DatabaseImpl : public aku_Database
     }
 
     CursorImpl* query(const char* query) {
-        auto pcur = new CursorImpl(storage_, std::move(query));
+        auto pcur = new CursorImpl(storage_, std::move(query), concurrent_cursors_);
         return pcur;
     }
 
@@ -161,6 +176,18 @@ struct DatabaseImpl : public aku_Database
         return status;
     }
 
+    aku_Status add_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 n) {
+        return storage_.write_batch(ids, tss, xss, n);
+    }
+
+    u64 get_write_sequence() const {
+        return storage_.get_write_sequence();
+    }
+
+    u64 get_durability_watermark() const {
+        return storage_.get_durability_watermark();
+    }
+
     // Stats
     void get_storage_stats(aku_StorageStats* recv_stats) {
         storage_.get_stats(recv_stats);
@@ -201,6 +228,11 @@ apr_status_t aku_remove_database(const char* file_name, aku_logger_cb_t logger)
     return Storage::remove_storage(file_name, logger);
 }
 
+aku_Status aku_fsck(const char* file_name, aku_logger_cb_t logger) {
+
+    return Storage::fsck(file_name, logger);
+}
+
 aku_Status aku_write_double_raw(aku_Database* db, aku_ParamId param_id, aku_Timestamp timestamp, double value) {
     auto dbi = reinterpret_cast<DatabaseImpl*>(db);
     return dbi->add_double(param_id, timestamp, value);
@@ -211,6 +243,21 @@ aku_Status aku_write(aku_Database* db, const aku_Sample* sample) {
     return dbi->add_sample(sample);
 }
 
+aku_Status aku_write_batch(aku_Database* db, const aku_ParamId* param_ids, const aku_Timestamp* timestamps, const double* values, u32 n) {
+    auto dbi = reinterpret_cast<DatabaseImpl*>(db);
+    return dbi->add_batch(param_ids, timestamps, values, n);
+}
+
+u64 aku_get_write_sequence(aku_Database* db) {
+    auto dbi = reinterpret_cast<DatabaseImpl*>(db);
+    return dbi->get_write_sequence();
+}
+
+u64 aku_get_durability_watermark(aku_Database* db) {
+    auto dbi = reinterpret_cast<DatabaseImpl*>(db);
+    return dbi->get_durability_watermark();
+}
+
 
 aku_Status aku_parse_duration(const char* str, int* value) {
     try {
@@ -235,6 +282,12 @@ aku_Status aku_series_to_param_id(aku_Database* db, const char* begin, const cha
     return dbi->series_to_param_id(begin, end, sample);
 }
 
+aku_Status aku_series_to_param_id_batch(aku_Database* db, const char* const* begins,
+                                        const char* const* ends, aku_ParamId* out_ids, u32 n) {
+    auto dbi = reinterpret_cast<DatabaseImpl*>(db);
+    return dbi->series_to_param_id_batch(begins, ends, out_ids, n);
+}
+
 aku_Database* aku_open_database(const char* path, aku_FineTuneParams config)
 {
     if (config.logger == nullptr) {
@@ -357,6 +410,10 @@ int aku_json_stats(aku_Database *db, char* buffer, size_t size) {
         ptree.put("search_stats.interpolation_search.reduced_to_one_page", sstats.istats.n_reduced_to_one_page);
         ptree.put("search_stats.interpolation_search.steps", sstats.istats.n_steps);
         ptree.put("search_stats.interpolation_search.times", sstats.istats.n_times);
+        // Adaptive search controller
+        ptree.put("search_stats.adaptive.pages_tracked", sstats.adaptive.n_pages_tracked);
+        ptree.put("search_stats.adaptive.pages_degraded", sstats.adaptive.n_pages_degraded);
+        ptree.put("search_stats.adaptive.interpolation_skips", sstats.adaptive.n_interpolation_skips);
 
         // Get per-volume stats
         auto volumes = dbi->iter_volumes();
@@ -377,6 +434,46 @@ int aku_json_stats(aku_Database *db, char* buffer, size_t size) {
             iter++;
         }
 
+        // Ingestion stats
+        ptree.put("ingestion_stats.late_writes", ReorderBuffer::late_count());
+        ptree.put("ingestion_stats.duplicates", ReorderBuffer::duplicate_count());
+
+        // Self-profiler stage attribution (sample counts per pipeline stage)
+        auto& profiler = StageProfiler::instance();
+        if (profiler.is_enabled()) {
+            auto counts = profiler.get_counts();
+            for (int i = 0; i < StageProfiler::NUM_STAGES; i++) {
+                std::string path = std::string("profiler.") + StageProfiler::stage_name(i);
+                ptree.put(path, counts[i]);
+            }
+        }
+
+        // Per-stage heap allocation counts (non-zero hot-path entries mean
+        // the allocation-free fast path regressed), ENABLE_ALLOC_AUDIT builds only
+        if (AllocAudit::is_enabled()) {
+            auto acounts = AllocAudit::get_counts();
+            auto abytes  = AllocAudit::get_bytes();
+            for (int i = 0; i < StageProfiler::NUM_STAGES; i++) {
+                std::string path = std::string("alloc_audit.") + StageProfiler::stage_name(i);
+                ptree.put(path + ".count", acounts[i]);
+                ptree.put(path + ".bytes", abytes[i]);
+            }
+        }
+
+        // Hot path latency histograms (values are in nanoseconds)
+        for (auto hist: LatencyHistogram::registry()) {
+            auto counts = hist->merge();
+            u64 total = 0;
+            for (auto count: counts) {
+                total += count;
+            }
+            std::string path = std::string("latency.") + hist->name_ + ".";
+            ptree.put(path + "count", total);
+            ptree.put(path + "p50_ns",  LatencyHistogram::percentile(counts, 0.5));
+            ptree.put(path + "p90_ns",  LatencyHistogram::percentile(counts, 0.9));
+            ptree.put(path + "p99_ns",  LatencyHistogram::percentile(counts, 0.99));
+            ptree.put(path + "p999_ns", LatencyHistogram::percentile(counts, 0.999));
+        }
 
         // encode json
         std::stringstream out;
@@ -400,3 +497,19 @@ void aku_debug_print(aku_Database *db) {
     dbi->debug_print();
 }
 
+void aku_profiler_start() {
+    StageProfiler::instance().start();
+}
+
+void aku_profiler_stop() {
+    StageProfiler::instance().stop();
+}
+
+int aku_profiler_enter(aku_ProfilerStage stage) {
+    return StageProfiler::enter(static_cast<StageProfiler::Stage>(stage));
+}
+
+void aku_profiler_leave(int prev) {
+    StageProfiler::leave(prev);
+}
+
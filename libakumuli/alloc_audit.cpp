@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "alloc_audit.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace Akumuli {
+
+//! Allocations per pipeline stage
+static std::atomic<u64> g_alloc_counts[StageProfiler::NUM_STAGES];
+
+//! Allocated bytes per pipeline stage
+static std::atomic<u64> g_alloc_bytes[StageProfiler::NUM_STAGES];
+
+bool AllocAudit::is_enabled() {
+#ifdef AKU_ENABLE_ALLOC_AUDIT
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AllocAudit::record(size_t bytes) {
+    // Looking up the stage tag can't recurse into the interposed allocator -
+    // slot registration in `StageProfiler` is allocation-free by design.
+    auto stage = StageProfiler::current_stage();
+    if (stage < 0 || stage >= StageProfiler::NUM_STAGES) {
+        stage = StageProfiler::STAGE_IDLE;
+    }
+    g_alloc_counts[stage].fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes[stage].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+std::array<u64, StageProfiler::NUM_STAGES> AllocAudit::get_counts() {
+    std::array<u64, StageProfiler::NUM_STAGES> result;
+    for (int i = 0; i < StageProfiler::NUM_STAGES; i++) {
+        result[i] = g_alloc_counts[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+std::array<u64, StageProfiler::NUM_STAGES> AllocAudit::get_bytes() {
+    std::array<u64, StageProfiler::NUM_STAGES> result;
+    for (int i = 0; i < StageProfiler::NUM_STAGES; i++) {
+        result[i] = g_alloc_bytes[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+}  // namespace Akumuli
+
+#ifdef AKU_ENABLE_ALLOC_AUDIT
+
+// Interposed global allocator. Every operator new in the process is counted
+// against the pipeline stage of the calling thread, `malloc` stays the
+// backing allocator. The guard keeps the accounting itself (thread_local
+// registration, atexit bookkeeping) from being counted recursively.
+
+// The library is built with -fvisibility=hidden; the operators have to be
+// exported explicitly so allocations made by the daemon resolve to them too.
+#define ALLOC_AUDIT_EXPORT __attribute__((visibility("default")))
+
+static thread_local bool g_in_audit = false;
+
+static void* audited_alloc(size_t size) {
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    if (!g_in_audit) {
+        g_in_audit = true;
+        Akumuli::AllocAudit::record(size);
+        g_in_audit = false;
+    }
+    return ptr;
+}
+
+ALLOC_AUDIT_EXPORT void* operator new(size_t size) {
+    return audited_alloc(size);
+}
+
+ALLOC_AUDIT_EXPORT void* operator new[](size_t size) {
+    return audited_alloc(size);
+}
+
+ALLOC_AUDIT_EXPORT void* operator new(size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return audited_alloc(size);
+    } catch (std::bad_alloc const&) {
+        return nullptr;
+    }
+}
+
+ALLOC_AUDIT_EXPORT void* operator new[](size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return audited_alloc(size);
+    } catch (std::bad_alloc const&) {
+        return nullptr;
+    }
+}
+
+ALLOC_AUDIT_EXPORT void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+ALLOC_AUDIT_EXPORT void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+ALLOC_AUDIT_EXPORT void operator delete(void* ptr, std::nothrow_t const&) noexcept {
+    free(ptr);
+}
+
+ALLOC_AUDIT_EXPORT void operator delete[](void* ptr, std::nothrow_t const&) noexcept {
+    free(ptr);
+}
+
+#endif  // AKU_ENABLE_ALLOC_AUDIT
@@ -0,0 +1,58 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Heap allocation audit for the ingestion fast path.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#pragma once
+#include "akumuli.h"
+#include "stage_profiler.h"
+
+#include <array>
+
+namespace Akumuli {
+
+/** Allocation audit for the ingestion fast path.
+  * The fast path (parser -> pipeline spout -> sequencer -> leaf append) is
+  * supposed to run allocation-free at steady state, everything it needs is
+  * pooled up front. This audit verifies that: in `ENABLE_ALLOC_AUDIT` builds
+  * the global allocator is interposed and every allocation is attributed to
+  * the pipeline stage the calling thread is tagged with (the same
+  * `StageProfiler` markers the sampling profiler reads), so a malloc that
+  * sneaks into a hot section shows up as a non-zero per-stage counter in the
+  * stats endpoint instead of as a silent throughput regression.
+  *
+  * In regular builds the allocator is left alone and the audit reports
+  * itself disabled.
+  */
+struct AllocAudit {
+    //! True in builds compiled with `ENABLE_ALLOC_AUDIT`
+    static bool is_enabled();
+
+    //! Attribute one allocation to the calling thread's current stage
+    static void record(size_t bytes);
+
+    //! Snapshot of allocation counts per pipeline stage
+    static std::array<u64, StageProfiler::NUM_STAGES> get_counts();
+
+    //! Snapshot of allocated bytes per pipeline stage
+    static std::array<u64, StageProfiler::NUM_STAGES> get_bytes();
+};
+
+}  // namespace Akumuli
@@ -3,8 +3,11 @@
 #include "hashfnfamily.h"
 #include "queryprocessor_framework.h"
 
+#include <algorithm>
+#include <future>
 #include <random>
 #include <stdexcept>
+#include <thread>
 
 #include <boost/exception/all.hpp>
 
@@ -15,6 +18,38 @@ namespace QP {
 //      CountingSketch      //
 //                          //
 
+/** Apply `fn` to every row index in [0, N). Sketch rows are fully
+  * independent so large sketches are processed by a pool of workers
+  * (rows are dealt round-robin to keep the per-task load even). Small
+  * sketches are processed inline because the scheduling overhead would
+  * dwarf the actual work.
+  */
+template<class Fn>
+static void for_each_row(u32 N, u32 K, Fn const& fn) {
+    enum { PARALLEL_THRESHOLD = 0x10000 };  // min number of cells
+    u32 nthreads = std::min(std::thread::hardware_concurrency(), N);
+    if (nthreads < 2u || static_cast<u64>(N)*K < PARALLEL_THRESHOLD) {
+        for (u32 i = 0u; i < N; i++) {
+            fn(i);
+        }
+        return;
+    }
+    std::vector<std::future<void>> tasks;
+    for (u32 t = 1u; t < nthreads; t++) {
+        tasks.push_back(std::async(std::launch::async, [&fn, t, N, nthreads]() {
+            for (u32 i = t; i < N; i += nthreads) {
+                fn(i);
+            }
+        }));
+    }
+    for (u32 i = 0u; i < N; i += nthreads) {
+        fn(i);
+    }
+    for (auto& task: tasks) {
+        task.get();
+    }
+}
+
 struct CountingSketch {
     HashFnFamily const& hashes_;
     const u32 N;
@@ -68,17 +103,36 @@ struct CountingSketch {
         }
     }
 
+    enum { HASH_BLOCK = 0x100 };
+
+    //! Batched update, each row is updated for the whole block while it's hot in cache
+    void add(const u64* ids, const double* values, size_t n) {
+        u32 hashes[HASH_BLOCK];
+        for (size_t base = 0; base < n; base += HASH_BLOCK) {
+            size_t size = std::min(n - base, static_cast<size_t>(HASH_BLOCK));
+            for (u32 i = 0; i < N; i++) {
+                hashes_.hash(i, ids + base, hashes, size);
+                std::vector<double>& row = tables_[i];
+                for (size_t j = 0; j < size; j++) {
+                    row[hashes[j]] += values[base + j];
+                }
+            }
+            for (size_t j = 0; j < size; j++) {
+                sum_ += values[base + j];
+            }
+        }
+    }
+
     //! Second moment estimator
     double estimateF2() const {
-        std::vector<double> results;
+        std::vector<double> results(N);
         auto f = 1./(K - 1);
-        for (u32 i = 0u; i < N; i++) {
+        for_each_row(N, K, [&](u32 i) {
             double rowsum = std::accumulate(tables_[i].begin(), tables_[i].end(), 0.0, [](double acc, double val) {
                 return acc + val*val;
             });
-            double res = K*f*sqrt(rowsum) - f*sum_*sum_;
-            results.push_back(res);
-        }
+            results[i] = K*f*sqrt(rowsum) - f*sum_*sum_;
+        });
         std::sort(results.begin(), results.end());
         return results[N/2];
     }
@@ -98,73 +152,73 @@ struct CountingSketch {
 
     //! current sketch <- absolute difference between two arguments
     void diff(CountingSketch const& lhs, CountingSketch const& rhs) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
+        for_each_row(N, K, [&](u32 ixrow) {
             std::vector<double>& row = tables_[ixrow];
             std::vector<double> const& lrow = lhs.tables_[ixrow];
             std::vector<double> const& rrow = rhs.tables_[ixrow];
             for (auto col = 0u; col < K; col++) {
                 row[col] = std::fabs(lrow[col] - rrow[col]);
             }
-        }
+        });
         _update_sum();
     }
 
     //! Add sketch
     void add(CountingSketch const& val) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
+        for_each_row(N, K, [&](u32 ixrow) {
             std::vector<double>& row = tables_[ixrow];
             std::vector<double> const& rval = val.tables_[ixrow];
             for (auto col = 0u; col < K; col++) {
                 row[col] = row[col] + rval[col];
             }
-        }
+        });
         _update_sum();
     }
 
     //! Substract sketch
     void sub(CountingSketch const& val) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
+        for_each_row(N, K, [&](u32 ixrow) {
             std::vector<double>& row = tables_[ixrow];
             std::vector<double> const& rval = val.tables_[ixrow];
             for (auto col = 0u; col < K; col++) {
                 row[col] = row[col] - rval[col];
             }
-        }
+        });
         _update_sum();
     }
 
     //! Multiply sketch by value
     void mul(double value) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
+        for_each_row(N, K, [&](u32 ixrow) {
             std::vector<double>& row = tables_[ixrow];
             for (auto col = 0u; col < K; col++) {
                 row[col] *= value;
             }
-        }
+        });
         _update_sum();
     }
 
     //! Multiply by another sketch
     void mul(CountingSketch const& value) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
+        for_each_row(N, K, [&](u32 ixrow) {
             std::vector<double>& row = tables_[ixrow];
             std::vector<double> const& rval = value.tables_[ixrow];
             for (auto col = 0u; col < K; col++) {
                 row[col] = row[col] * rval[col];
             }
-        }
+        });
         _update_sum();
     }
 
     //! Divide by another sketch
     void div(CountingSketch const& value) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
+        for_each_row(N, K, [&](u32 ixrow) {
             std::vector<double>& row = tables_[ixrow];
             std::vector<double> const& rval = value.tables_[ixrow];
             for (auto col = 0u; col < K; col++) {
                 row[col] = row[col] / rval[col];
             }
-        }
+        });
         _update_sum();
     }
 };
@@ -190,6 +244,13 @@ struct PreciseCounter {
         table_[id] += value;
     }
 
+    //! Batched update
+    void add(const u64* ids, const double* values, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            table_[ids[i]] += values[i];
+        }
+    }
+
     //! Unbiased value estimator
     double estimate(u64 id) const {
         auto it = table_.find(id);
@@ -572,6 +633,10 @@ struct AnomalyDetectorPipeline : AnomalyDetectorIface {
         current_->add(id, value);
     }
 
+    void add(const u64* ids, const double* values, size_t n) {
+        current_->add(ids, values, n);
+    }
+
     //! Returns true if series is anomalous (approx)
     bool is_anomaly_candidate(u64 id) const {
         if (error_) {
@@ -16,6 +16,7 @@ namespace QP {
 struct AnomalyDetectorIface {
     virtual ~AnomalyDetectorIface() = default;
     virtual void add(u64 id, double value) = 0;
+    virtual void add(const u64* ids, const double* values, size_t n) = 0;
     virtual bool is_anomaly_candidate(u64 id) const = 0;
     virtual void move_sliding_window()              = 0;
 };
@@ -1,5 +1,13 @@
 #pragma once
 
+#include <cstddef>
+
+#include "akumuli.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace Akumuli {
 
 /** Static struct to organaize differnet bit-hacks.
@@ -16,5 +24,97 @@ struct BitHacks {
         return (((bitmap + (bitmap >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
 #endif
     }
+
+    //! Return number of leading zero bits (64 for zero input).
+    static inline int leading_zeroes(u64 value) {
+#if __GNUC__
+        return value == 0 ? 64 : __builtin_clzll(value);
+#else
+        if (value == 0) {
+            return 64;
+        }
+        int n = 0;
+        for (u64 mask = 1ull << 63; (value & mask) == 0; mask >>= 1) {
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    //! Return number of 1-bits in 64-bit word.
+    static inline int count_bits64(u64 value) {
+#if __GNUC__
+        return __builtin_popcountll(value);
+#else
+        return count_bits(static_cast<u32>(value)) + count_bits(static_cast<u32>(value >> 32));
+#endif
+    }
+
+    /** Leading zero count of every element of the block.
+      * There is no AVX2 counterpart of `lzcnt`, the scalar instruction
+      * pipelines well enough that the unrolled loop saturates the load ports.
+      */
+    static inline void block_clz(const u64* input, u8* output, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            output[i + 0] = static_cast<u8>(leading_zeroes(input[i + 0]));
+            output[i + 1] = static_cast<u8>(leading_zeroes(input[i + 1]));
+            output[i + 2] = static_cast<u8>(leading_zeroes(input[i + 2]));
+            output[i + 3] = static_cast<u8>(leading_zeroes(input[i + 3]));
+        }
+        for (; i < n; i++) {
+            output[i] = static_cast<u8>(leading_zeroes(input[i]));
+        }
+    }
+
+    //! Population count of every element of the block.
+    static inline void block_popcount(const u64* input, u8* output, size_t n) {
+        size_t i = 0;
+#ifdef __AVX2__
+        // Nibble-lookup popcount (pshufb), four words per step
+        const __m256i lut  = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                              0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i mask = _mm256_set1_epi8(0x0F);
+        for (; i + 4 <= n; i += 4) {
+            __m256i x    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+            __m256i lo   = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, mask));
+            __m256i hi   = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), mask));
+            // Horizontal byte sums per 64-bit lane
+            __m256i cnt  = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+            u64 buf[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(buf), cnt);
+            for (int j = 0; j < 4; j++) {
+                output[i + j] = static_cast<u8>(buf[j]);
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            output[i] = static_cast<u8>(count_bits64(input[i]));
+        }
+    }
+
+    /** Number of bits needed to store the largest element of the block
+      * (0 for an all-zero block). The highest set bit of the bitwise OR of
+      * the block is the highest set bit of the maximum, so one OR-reduction
+      * replaces a horizontal unsigned max AVX2 doesn't have.
+      */
+    static inline int block_bit_width(const u64* input, size_t n) {
+        u64 bits = 0;
+        size_t i = 0;
+#ifdef __AVX2__
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+            acc = _mm256_or_si256(acc, x);
+        }
+        u64 buf[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(buf), acc);
+        bits = buf[0] | buf[1] | buf[2] | buf[3];
+#endif
+        for (; i < n; i++) {
+            bits |= input[i];
+        }
+        return 64 - leading_zeroes(bits);
+    }
 };
 }
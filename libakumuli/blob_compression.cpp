@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "blob_compression.h"
+
+#include <cstring>
+
+namespace Akumuli {
+
+/* Token stream format:
+ * - control byte < 0x80: literal run, (control + 1) bytes follow;
+ * - control byte >= 0x80: back-reference, match length is
+ *   MIN_MATCH + (control & 0x7F), followed by a u16 distance counted
+ *   backwards from the current output position. Distances larger than
+ *   the decoded prefix reach into the dictionary.
+ */
+
+const u32 BlobDictionary::NO_POS;
+
+static u32 hash_bytes(const u8* ptr) {
+    u32 value;
+    memcpy(&value, ptr, sizeof(value));
+    return (value * 2654435761u) >> (32 - BlobDictionary::HASH_BITS);
+}
+
+//! Length of the common prefix (bounded by `max`)
+static u32 match_length(const u8* lhs, const u8* rhs, u32 max) {
+    u32 len = 0;
+    while (len < max && lhs[len] == rhs[len]) {
+        len++;
+    }
+    return len;
+}
+
+BlobDictionary::BlobDictionary() {
+    dict_.reserve(DICT_SIZE);
+    heads_.fill(NO_POS);
+}
+
+void BlobDictionary::append(const u8* begin, const u8* end) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto room = DICT_SIZE - dict_.size();
+    auto size = std::min(room, static_cast<size_t>(end - begin));
+    if (size == 0) {
+        return;
+    }
+    auto old_size = dict_.size();
+    dict_.insert(dict_.end(), begin, begin + size);
+    // Index the new positions (and the ones that now have enough bytes
+    // after them to form a full sequence).
+    size_t from = old_size > (MIN_MATCH - 1) ? old_size - (MIN_MATCH - 1) : 0;
+    for (size_t pos = from; pos + MIN_MATCH <= dict_.size(); pos++) {
+        heads_[hash_bytes(dict_.data() + pos)] = static_cast<u32>(pos);
+    }
+}
+
+bool BlobDictionary::encode(const u8* input, u32 size, std::vector<u8>* output) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (size < 0x20) {
+        // Too small to pay for the header
+        return false;
+    }
+    output->clear();
+    output->reserve(size);
+    u8 header[sizeof(u32)];
+    memcpy(header, &size, sizeof(u32));
+    output->insert(output->end(), header, header + sizeof(u32));
+
+    // Positions of the sequences seen in the input so far
+    std::vector<u32> local(HASH_SIZE, NO_POS);
+    auto dict_size = static_cast<u32>(dict_.size());
+
+    auto flush_literals = [&](u32 begin, u32 end) {
+        while (begin != end) {
+            u32 run = std::min(end - begin, 0x80u);
+            output->push_back(static_cast<u8>(run - 1));
+            output->insert(output->end(), input + begin, input + begin + run);
+            begin += run;
+        }
+    };
+
+    u32 pos = 0;
+    u32 lit_begin = 0;
+    while (pos + MIN_MATCH <= size) {
+        u32 hash = hash_bytes(input + pos);
+        u32 best_len = 0;
+        u32 best_dist = 0;
+        // Candidate inside the input
+        u32 cand = local[hash];
+        if (cand != NO_POS) {
+            u32 dist = pos - cand;
+            if (dist <= 0xFFFF) {
+                u32 len = match_length(input + cand, input + pos,
+                                       std::min(size - pos, static_cast<u32>(MAX_MATCH)));
+                if (len >= MIN_MATCH) {
+                    best_len = len;
+                    best_dist = dist;
+                }
+            }
+        }
+        // Candidate inside the dictionary
+        cand = heads_[hash];
+        if (cand != NO_POS) {
+            u32 dist = pos + (dict_size - cand);
+            if (dist <= 0xFFFF) {
+                u32 bound = std::min(dict_size - cand,
+                                     std::min(size - pos, static_cast<u32>(MAX_MATCH)));
+                u32 len = match_length(dict_.data() + cand, input + pos, bound);
+                if (len >= MIN_MATCH && len > best_len) {
+                    best_len = len;
+                    best_dist = dist;
+                }
+            }
+        }
+        if (best_len >= MIN_MATCH) {
+            flush_literals(lit_begin, pos);
+            output->push_back(static_cast<u8>(0x80 | (best_len - MIN_MATCH)));
+            u8 distbuf[sizeof(u16)];
+            u16 dist16 = static_cast<u16>(best_dist);
+            memcpy(distbuf, &dist16, sizeof(u16));
+            output->insert(output->end(), distbuf, distbuf + sizeof(u16));
+            for (u32 i = pos; i < pos + best_len && i + MIN_MATCH <= size; i++) {
+                local[hash_bytes(input + i)] = i;
+            }
+            pos += best_len;
+            lit_begin = pos;
+        } else {
+            local[hash] = pos;
+            pos++;
+        }
+        if (output->size() + (pos - lit_begin) >= size) {
+            // Already larger than the raw payload
+            return false;
+        }
+    }
+    flush_literals(lit_begin, size);
+    return output->size() < size;
+}
+
+aku_Status BlobDictionary::decode(const u8* input, u32 size, std::vector<u8>* output) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (size < sizeof(u32)) {
+        return AKU_EBAD_DATA;
+    }
+    u32 orig_size;
+    memcpy(&orig_size, input, sizeof(u32));
+    output->clear();
+    output->reserve(orig_size);
+    u32 pos = sizeof(u32);
+    while (pos < size) {
+        u8 control = input[pos++];
+        if (control < 0x80) {
+            u32 run = control + 1u;
+            if (pos + run > size) {
+                return AKU_EBAD_DATA;
+            }
+            output->insert(output->end(), input + pos, input + pos + run);
+            pos += run;
+        } else {
+            u32 len = MIN_MATCH + (control & 0x7F);
+            if (pos + sizeof(u16) > size) {
+                return AKU_EBAD_DATA;
+            }
+            u16 dist;
+            memcpy(&dist, input + pos, sizeof(u16));
+            pos += sizeof(u16);
+            if (dist == 0) {
+                return AKU_EBAD_DATA;
+            }
+            for (u32 i = 0; i < len; i++) {
+                u8 byte;
+                auto out_size = static_cast<u32>(output->size());
+                if (dist <= out_size) {
+                    byte = output->at(out_size - dist);
+                } else {
+                    u32 back = dist - out_size;
+                    if (back > dict_.size()) {
+                        return AKU_EBAD_DATA;
+                    }
+                    byte = dict_.at(dict_.size() - back);
+                }
+                output->push_back(byte);
+            }
+        }
+        if (output->size() > orig_size) {
+            return AKU_EBAD_DATA;
+        }
+    }
+    if (output->size() != orig_size) {
+        return AKU_EBAD_DATA;
+    }
+    return AKU_SUCCESS;
+}
+
+BlobDictCache& BlobDictCache::instance() {
+    static BlobDictCache cache;
+    return cache;
+}
+
+std::shared_ptr<BlobDictionary> BlobDictCache::get(u32 page_id,
+                                                   std::function<void(BlobDictionary*)> const& init)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = table_.find(page_id);
+    if (it != table_.end()) {
+        return it->second;
+    }
+    auto dict = std::make_shared<BlobDictionary>();
+    init(dict.get());
+    table_[page_id] = dict;
+    return dict;
+}
+
+void BlobDictCache::remove(u32 page_id) {
+    std::lock_guard<std::mutex> guard(lock_);
+    table_.erase(page_id);
+}
+
+}  // namespace Akumuli
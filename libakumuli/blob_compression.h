@@ -0,0 +1,104 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Dictionary compression for blob payloads.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#pragma once
+#include "akumuli.h"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Akumuli {
+
+/** Shared per-page compression dictionary for blob entries.
+  * Blob payloads (string events) tend to repeat the same fragments across
+  * entries, so every page keeps a small dictionary fed with the raw bytes
+  * of the payloads stored in it. Entries are compressed with a simple
+  * byte-oriented LZ codec whose back-references can reach both the already
+  * decoded part of the entry and the dictionary. The dictionary content is
+  * a deterministic function of the page content (payloads in index order)
+  * so it can be rebuilt from a page read from disk.
+  */
+struct BlobDictionary {
+    enum {
+        //! Dictionary capacity (bytes)
+        DICT_SIZE = 0x1000,
+        //! Shortest encodable match
+        MIN_MATCH = 4,
+        //! Longest encodable match
+        MAX_MATCH = MIN_MATCH + 0x7F,
+        //! log2 of the match-candidate table size
+        HASH_BITS = 12,
+        HASH_SIZE = 1 << HASH_BITS,
+    };
+
+    //! Empty match-candidate slot
+    static const u32 NO_POS = 0xFFFFFFFF;
+
+    mutable std::mutex lock_;
+    std::vector<u8>    dict_;   //< Dictionary bytes
+    std::array<u32, HASH_SIZE> heads_;  //< Dictionary position of the last MIN_MATCH-byte sequence
+
+    BlobDictionary();
+
+    //! Feed raw payload bytes into the dictionary (no-op when it's full)
+    void append(const u8* begin, const u8* end);
+
+    /** Compress the payload. Output format: u32 original length followed
+      * by a token stream (literal runs and back-references).
+      * @return true on success, false if the payload is incompressible
+      */
+    bool encode(const u8* input, u32 size, std::vector<u8>* output) const;
+
+    /** Decompress payload produced by `encode`.
+      * @return AKU_SUCCESS or AKU_EBAD_DATA if the payload is corrupted
+      */
+    aku_Status decode(const u8* input, u32 size, std::vector<u8>* output) const;
+};
+
+
+/** Process wide page-id to dictionary mapping.
+  * The dictionary of a page is rebuilt from the page content on first
+  * access (pages mapped from disk) and cached here so the readers don't
+  * pay the rebuild cost on every entry.
+  */
+struct BlobDictCache {
+    std::mutex lock_;
+    std::unordered_map<u32, std::shared_ptr<BlobDictionary>> table_;
+
+    static BlobDictCache& instance();
+
+    /** Get the dictionary of the page. If the dictionary is not cached
+      * yet it's created and `init` is called to fill it (under the cache
+      * lock so the rebuild runs at most once per page).
+      */
+    std::shared_ptr<BlobDictionary> get(u32 page_id,
+                                        std::function<void(BlobDictionary*)> const& init);
+
+    //! Forget the dictionary of the page (page is cleared for reuse)
+    void remove(u32 page_id);
+};
+
+}  // namespace Akumuli
@@ -2,12 +2,30 @@
 
 namespace Akumuli {
 
+CacheBudget::CacheBudget(size_t limit)
+    : used_{0ul}
+    , limit_(limit)
+{
+}
+
+std::shared_ptr<CacheBudget> CacheBudget::process_budget(size_t limit) {
+    static std::shared_ptr<CacheBudget> budget = std::make_shared<CacheBudget>(limit);
+    return budget;
+}
+
 ChunkCache::ChunkCache(size_t limit)
     : total_size_(0ul)
     , size_limit_(limit)
 {
 }
 
+ChunkCache::ChunkCache(size_t quota, std::shared_ptr<CacheBudget> budget)
+    : total_size_(0ul)
+    , size_limit_(quota)
+    , budget_(budget)
+{
+}
+
 bool ChunkCache::contains(KeyT key) const {
     std::lock_guard<std::mutex> lock(mutex_);
     return cache_.count(key) > 0;
@@ -31,7 +49,16 @@ static size_t get_size(const std::shared_ptr<UncompressedChunk>& header) {
 void ChunkCache::put(KeyT key, const std::shared_ptr<UncompressedChunk>& header) {
     auto szdelta = get_size(header);
     std::lock_guard<std::mutex> lock(mutex_);
-    if (total_size_ + szdelta > size_limit_) {
+    bool overflow;
+    if (budget_) {
+        // The quota is guaranteed, memory above it is borrowed from the
+        // shared budget and given back under global pressure
+        overflow = total_size_ + szdelta > size_limit_
+                && budget_->used_.load() + szdelta > budget_->limit_;
+    } else {
+        overflow = total_size_ + szdelta > size_limit_;
+    }
+    if (overflow) {
         if (!fifo_.empty()) {
             // Eviction
             KeyT ekey;
@@ -45,11 +72,17 @@ void ChunkCache::put(KeyT key, const std::shared_ptr<UncompressedChunk>& header)
                 // TODO: report error (inconsistent cache)
             }
             total_size_ -= esz;
+            if (budget_) {
+                budget_->used_ -= esz;
+            }
         }
     }
     fifo_.push_front(std::make_tuple(key, szdelta));
     cache_[key] = header;
     total_size_ += szdelta;
+    if (budget_) {
+        budget_->used_ += szdelta;
+    }
 }
 
 }
@@ -2,6 +2,7 @@
 
 #include "storage_engine/compression.h"
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <memory>
@@ -9,6 +10,20 @@
 
 namespace Akumuli {
 
+/** Memory budget shared by the caches of all databases of the process.
+  * Every cache tracks its usage here in addition to its own counter so
+  * a database can grow above its quota while the others stay idle.
+  */
+struct CacheBudget {
+    std::atomic<size_t> used_;
+    const size_t        limit_;
+
+    CacheBudget(size_t limit);
+
+    //! Process-wide budget, sized by the first caller
+    static std::shared_ptr<CacheBudget> process_budget(size_t limit);
+};
+
 struct ChunkCache {
     //! Volume id + entry index
     typedef std::tuple<int, int>     KeyT;
@@ -20,9 +35,17 @@ struct ChunkCache {
     size_t                total_size_;
     mutable std::mutex    mutex_;
     const size_t          size_limit_;
+    std::shared_ptr<CacheBudget> budget_;  //< Shared budget (can be null)
 
     ChunkCache(size_t limit);
 
+    /** C-tor for a cache that draws from a shared budget.
+      * @param quota guaranteed size, the cache can grow above it while
+      *        the shared budget isn't exhausted
+      * @param budget budget shared with the other databases
+      */
+    ChunkCache(size_t quota, std::shared_ptr<CacheBudget> budget);
+
     bool contains(KeyT key) const;
 
     ItemT get(KeyT key);
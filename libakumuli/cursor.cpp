@@ -16,6 +16,7 @@
  */
 
 #include "cursor.h"
+#include "latency_histogram.h"
 #include "search.h"
 
 #include <iostream>
@@ -74,6 +75,20 @@ void CursorFSM::put(const aku_Sample &result) {
     write_offset_ += len;
 }
 
+size_t CursorFSM::put_batch(const aku_Sample* samples, size_t n) {
+    if (usr_buffer_ == nullptr || usr_buffer_len_ <= write_offset_) {
+        return 0;
+    }
+    // Mirrors `can_put` - last byte of the buffer is left unused
+    size_t nfit = (usr_buffer_len_ - write_offset_ - 1) / sizeof(aku_Sample);
+    size_t count = std::min(nfit, n);
+    if (count != 0) {
+        memcpy((char*)usr_buffer_ + write_offset_, samples, count*sizeof(aku_Sample));
+        write_offset_ += count*sizeof(aku_Sample);
+    }
+    return count;
+}
+
 bool CursorFSM::close() {
     bool old = closed_;
     closed_ = true;
@@ -121,9 +136,13 @@ void CoroCursorStackAllocator::deallocate(boost::coroutines::stack_context& ctx)
     free(reinterpret_cast<char*>(ctx.sp) - ctx.size);
 }
 
+//! Time it takes to fill the caller's buffer (all cursor kinds)
+static LatencyHistogram g_fill_latency("cursor_fill");
+
 // External cursor implementation
 
 size_t CoroCursor::read_ex(void* buffer, size_t buffer_size) {
+    LatencyTimer timer(g_fill_latency);
     cursor_fsm_.update_buffer(buffer, buffer_size);
     coroutine_->operator()(this);
     return cursor_fsm_.get_data_len();
@@ -172,9 +191,212 @@ bool CoroCursor::put(Caller& caller, aku_Sample const& result) {
     return true;
 }
 
+bool CoroCursor::put_batch(Caller& caller, const aku_Sample* samples, size_t n) {
+    if (cursor_fsm_.is_done()) {
+        return false;
+    }
+    size_t total = 0;
+    while (total < n) {
+        total += cursor_fsm_.put_batch(samples + total, n - total);
+        if (total < n) {
+            // Buffer is full, yield to the consumer
+            caller();
+            if (cursor_fsm_.is_done()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 void CoroCursor::complete(Caller& caller) {
     cursor_fsm_.complete();
     caller();
 }
 
+// IteratorCursor
+
+IteratorCursor::IteratorCursor(std::vector<aku_ParamId>&& ids, std::vector<PIterator>&& iters)
+    : ids_(std::move(ids))
+    , iters_(std::move(iters))
+    , pos_(0)
+    , done_(iters_.empty())
+    , error_(false)
+    , error_code_(AKU_SUCCESS)
+{
+    assert(ids_.size() == iters_.size());
+}
+
+size_t IteratorCursor::read_ex(void* buffer, size_t buffer_size) {
+    LatencyTimer timer(g_fill_latency);
+    static const size_t CHUNK_SIZE = 0x400;
+    aku_Timestamp tss[CHUNK_SIZE];
+    double        xss[CHUNK_SIZE];
+    auto   out      = static_cast<aku_Sample*>(buffer);
+    size_t capacity = buffer_size / sizeof(aku_Sample);
+    size_t outsz    = 0;
+    while (outsz < capacity && pos_ < iters_.size()) {
+        size_t toread = std::min(CHUNK_SIZE, capacity - outsz);
+        aku_Status status;
+        size_t n;
+        std::tie(status, n) = iters_[pos_]->read(tss, xss, toread);
+        for (size_t i = 0; i < n; i++) {
+            aku_Sample sample       = {};
+            sample.timestamp        = tss[i];
+            sample.paramid          = ids_[pos_];
+            sample.payload.type     = AKU_PAYLOAD_FLOAT;
+            sample.payload.size     = sizeof(aku_Sample);
+            sample.payload.float64  = xss[i];
+            out[outsz++] = sample;
+        }
+        if (status == AKU_ENO_DATA) {
+            // Iterator is exhausted, continue with the next one
+            pos_++;
+        } else if (status != AKU_SUCCESS) {
+            error_      = true;
+            error_code_ = status;
+            done_       = true;
+            return outsz * sizeof(aku_Sample);
+        }
+    }
+    if (pos_ == iters_.size()) {
+        done_ = true;
+    }
+    return outsz * sizeof(aku_Sample);
+}
+
+bool IteratorCursor::is_done() const {
+    return done_;
+}
+
+bool IteratorCursor::is_error(aku_Status* out_error_code_or_null) const {
+    if (error_ && out_error_code_or_null) {
+        *out_error_code_or_null = error_code_;
+    }
+    return error_;
+}
+
+void IteratorCursor::close() {
+    iters_.clear();
+    done_ = true;
+}
+
+// ConcurrentCursor
+
+ConcurrentCursor::ConcurrentCursor(std::unique_ptr<ExternalCursor> inner)
+    : inner_(std::move(inner))
+    , head_(0)
+    , tail_(0)
+    , count_(0)
+    , finished_(false)
+    , closed_(false)
+    , error_(false)
+    , error_code_(AKU_SUCCESS)
+{
+    worker_thread_ = std::thread([this]() { worker_(); });
+}
+
+ConcurrentCursor::~ConcurrentCursor() {
+    close();
+}
+
+void ConcurrentCursor::worker_() {
+    bool done = false;
+    while (!done) {
+        std::unique_lock<std::mutex> guard(lock_);
+        not_full_.wait(guard, [this]() { return count_ != RING_SIZE || closed_; });
+        if (closed_) {
+            break;
+        }
+        Chunk& chunk = ring_[head_];
+        // Single producer - the slot at head_ is owned by the worker
+        // until count_ gets incremented, the inner cursor can be pulled
+        // without the lock held
+        guard.unlock();
+        size_t size = inner_->read_ex(chunk.data, CHUNK_SIZE);
+        chunk.size  = size;
+        chunk.pos   = 0;
+        done        = inner_->is_done();
+        aku_Status status = AKU_SUCCESS;
+        bool iserror      = inner_->is_error(&status);
+        guard.lock();
+        if (size != 0) {
+            head_ = (head_ + 1) % RING_SIZE;
+            count_++;
+        }
+        if (iserror) {
+            error_      = true;
+            error_code_ = status;
+            done        = true;
+        }
+        not_empty_.notify_one();
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    finished_ = true;
+    not_empty_.notify_one();
+}
+
+size_t ConcurrentCursor::read_ex(void* buffer, size_t buffer_size) {
+    LatencyTimer timer(g_fill_latency);
+    char*  out   = static_cast<char*>(buffer);
+    size_t bytes = 0;
+    std::unique_lock<std::mutex> guard(lock_);
+    while (true) {
+        not_empty_.wait(guard, [this]() { return count_ != 0 || finished_ || closed_; });
+        while (count_ != 0) {
+            Chunk& chunk = ring_[tail_];
+            while (chunk.pos < chunk.size) {
+                auto sample = reinterpret_cast<const aku_Sample*>(chunk.data + chunk.pos);
+                size_t len  = std::max((size_t)sample->payload.size, sizeof(aku_Sample));
+                if (bytes + len > buffer_size) {
+                    break;
+                }
+                memcpy(out + bytes, chunk.data + chunk.pos, len);
+                bytes     += len;
+                chunk.pos += len;
+            }
+            if (chunk.pos != chunk.size) {
+                // Caller's buffer is full (or too small for the next sample)
+                break;
+            }
+            tail_ = (tail_ + 1) % RING_SIZE;
+            count_--;
+            not_full_.notify_one();
+        }
+        if (bytes != 0 || count_ != 0 || finished_ || closed_) {
+            break;
+        }
+    }
+    return bytes;
+}
+
+bool ConcurrentCursor::is_done() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return (finished_ || closed_) && count_ == 0;
+}
+
+bool ConcurrentCursor::is_error(aku_Status* out_error_code_or_null) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (error_ && out_error_code_or_null) {
+        *out_error_code_or_null = error_code_;
+    }
+    return error_;
+}
+
+void ConcurrentCursor::close() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        closed_ = true;
+        not_full_.notify_one();
+        not_empty_.notify_one();
+    }
+    if (worker_thread_.joinable()) {
+        worker_thread_.join();
+    }
+    if (inner_) {
+        inner_->close();
+        inner_.reset();
+    }
+}
+
 }
@@ -22,12 +22,17 @@
 
 #pragma once
 
+#include <array>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "akumuli.h"
 #include "internal_cursor.h"
 #include "page.h"
+#include "storage_engine/nbtree.h"
 
 namespace Akumuli {
 
@@ -48,6 +53,8 @@ public:
     ~CursorFSM();
     // modifiers
     void put(aku_Sample const& result);
+    //! Copy batch of fixed size samples, return number of samples that fit
+    size_t put_batch(const aku_Sample* samples, size_t n);
     void complete();
     void set_error(aku_Status error_code);
     void update_buffer(void* buf, size_t buf_len);
@@ -120,6 +127,8 @@ struct CoroCursor : Cursor {
 
     bool put(Caller& caller, aku_Sample const& result);
 
+    virtual bool put_batch(Caller& caller, const aku_Sample* samples, size_t n);
+
     void complete(Caller& caller);
 
     template <class Fn_1arg_caller> void start(Fn_1arg_caller const& fn) {
@@ -159,4 +168,93 @@ struct CoroCursor : Cursor {
     }
 };
 
+
+/** Stackless cursor for the new storage engine.
+  * Pulls data from `NBTreeIterator` instances instead of resuming a
+  * coroutine, so a concurrent query costs iterator state instead of a
+  * full stack (`CoroCursor` is kept for the legacy `PageHeader` search).
+  * Iterators are drained in order, each produced sample gets the paramid
+  * of its source iterator.
+  */
+struct IteratorCursor : ExternalCursor {
+    typedef std::unique_ptr<StorageEngine::NBTreeIterator> PIterator;
+
+    /** C-tor.
+      * @param ids series ids (one per iterator)
+      * @param iters source iterators
+      */
+    IteratorCursor(std::vector<aku_ParamId>&& ids, std::vector<PIterator>&& iters);
+
+    virtual size_t read_ex(void* buffer, size_t buffer_size);
+
+    virtual bool is_done() const;
+
+    virtual bool is_error(aku_Status* out_error_code_or_null = nullptr) const;
+
+    virtual void close();
+
+private:
+    std::vector<aku_ParamId> ids_;    //! Source series ids
+    std::vector<PIterator>   iters_;  //! Source iterators
+    size_t                   pos_;    //! Current iterator
+    bool                     done_;
+    bool                     error_;
+    aku_Status               error_code_;
+};
+
+
+/** Cursor that runs the query pipeline on a background worker.
+  * The worker drains an inner cursor into a bounded ring of fixed size
+  * chunks and `read_ex` only copies whole samples out of the ring, so the
+  * caller can overlap storage latency with its own work (e.g. network
+  * sends). Single producer (the worker) - single consumer (the caller),
+  * concurrent `read_ex` calls are not supported.
+  */
+struct ConcurrentCursor : ExternalCursor {
+    enum {
+        //! Chunk payload size (bytes)
+        CHUNK_SIZE = 0x1000,
+        //! Ring capacity (chunks)
+        RING_SIZE = 8,
+    };
+
+    //! Ring slot filled by one `read_ex` call on the inner cursor
+    struct Chunk {
+        char   data[CHUNK_SIZE];
+        size_t size;  //! Number of bytes filled by the worker
+        size_t pos;   //! Consumer read offset
+    };
+
+    //! C-tor, takes cursor ownership and starts the worker
+    ConcurrentCursor(std::unique_ptr<ExternalCursor> inner);
+
+    ~ConcurrentCursor();
+
+    virtual size_t read_ex(void* buffer, size_t buffer_size);
+
+    virtual bool is_done() const;
+
+    virtual bool is_error(aku_Status* out_error_code_or_null = nullptr) const;
+
+    virtual void close();
+
+private:
+    //! Worker thread body
+    void worker_();
+
+    std::unique_ptr<ExternalCursor> inner_;
+    std::array<Chunk, RING_SIZE>    ring_;
+    size_t                          head_;      //! Next slot to fill
+    size_t                          tail_;      //! Next slot to drain
+    size_t                          count_;     //! Number of filled slots
+    bool                            finished_;  //! Worker exited
+    bool                            closed_;
+    bool                            error_;
+    aku_Status                      error_code_;
+    mutable std::mutex              lock_;
+    std::condition_variable         not_full_;
+    std::condition_variable         not_empty_;
+    std::thread                     worker_thread_;
+};
+
 }  // namespace
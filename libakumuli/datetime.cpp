@@ -16,6 +16,7 @@
 
 #include "datetime.h"
 #include <cstdio>
+#include <cstring>
 #include <boost/regex.hpp>
 
 namespace Akumuli {
@@ -61,24 +62,63 @@ static int parse_n_digits(const char* p, int n, const char* error_message = "can
     return value;
 }
 
+// parse the "\.f+" fractional part of the timestamp (`p` points to the
+// separator, `pend` to the zero-terminator)
+static int parse_fractional_part(const char* p, const char* pend) {
+    int nanoseconds = 0;
+    if (p != pend) {
+        // here should go '.' or ',' according to ISO 8601
+        if (*p != '.' && *p != ',') {
+            BadDateTimeFormat error("bad timestamp format, ',' or '.' was expected");
+            BOOST_THROW_EXCEPTION(error);
+        }
+        p++;
+
+        // we should have at most 9 digits of nanosecond precision representation
+        int n = pend - p;
+        nanoseconds = parse_n_digits(p, n, "can't parse fractional part");
+        for(int i = 9; i --> n;) {
+            nanoseconds *= 10;
+        }
+    }
+    return nanoseconds;
+}
+
 aku_Timestamp DateTimeUtil::from_iso_string(const char* iso_str) {
     size_t len = std::strlen(iso_str);
     if (len < 15 || iso_str[8] != 'T') {
-        // Raw timestamp
-        aku_Timestamp ts;
-        char* end;
-        ts = strtoull(iso_str, &end, 10);
-        if (errno) {
+        // Raw timestamp, parsed with a simple digit loop (strtoull with
+        // its locale and errno bookkeeping is much slower)
+        aku_Timestamp ts = 0;
+        if (len == 0) {
             BadDateTimeFormat error("bad timestamp format (less then 15 digits)");
             BOOST_THROW_EXCEPTION(error);
         }
+        for (size_t i = 0; i < len; i++) {
+            char c = iso_str[i];
+            if (c > 0x39 || c < 0x30) {
+                BadDateTimeFormat error("bad timestamp format (less then 15 digits)");
+                BOOST_THROW_EXCEPTION(error);
+            }
+            ts = ts*10 + static_cast<int>(c & 0x0F);
+        }
         return ts;
     }
-    if (len < 15) {
-        BadDateTimeFormat error("bad timestamp format (less then 15 digits)");
-        BOOST_THROW_EXCEPTION(error);
-    }
     const char* pend = iso_str + len; // should point to zero-terminator
+
+    // Memoized prefix - writers send monotonic timestamps so consecutive
+    // values usually fall into the same second and only the fractional
+    // part has to be parsed.
+    struct PrefixCache {
+        char          prefix[15];
+        aku_Timestamp base;
+        bool          valid;
+    };
+    static thread_local PrefixCache cache = {};
+    if (cache.valid && std::memcmp(cache.prefix, iso_str, 15) == 0) {
+        return cache.base + parse_fractional_part(iso_str + 15, pend);
+    }
+
     // first four digits - year
     const char* p = iso_str;
     int year = parse_n_digits(p, 4, "can't parse year from timestamp");
@@ -106,27 +146,19 @@ aku_Timestamp DateTimeUtil::from_iso_string(const char* iso_str) {
     p += 2;
 
     // optional
-    int nanoseconds = 0;
-    if (p != pend) {
-        // here should go '.' or ',' according to ISO 8601
-        if (*p != '.' && *p != ',') {
-            BadDateTimeFormat error("bad timestamp format, ',' or '.' was expected");
-            BOOST_THROW_EXCEPTION(error);
-        }
-        p++;
-
-        // we should have at most 9 digits of nanosecond precision representation
-        int n = pend - p;
-        nanoseconds = parse_n_digits(p, n, "can't parse fractional part");
-        for(int i = 9; i --> n;) {
-            nanoseconds *= 10;
-        }
-    }
+    int nanoseconds = parse_fractional_part(p, pend);
 
     auto gregorian_date = boost::gregorian::date(year, month, date);
-    auto time = boost::posix_time::time_duration(hour, minute, second, nanoseconds);
+    auto time = boost::posix_time::time_duration(hour, minute, second, 0);
     auto pt = boost::posix_time::ptime(gregorian_date, time);
-    return DateTimeUtil::from_boost_ptime(pt);
+    auto base = DateTimeUtil::from_boost_ptime(pt);
+
+    // Remember the second for subsequent calls
+    std::memcpy(cache.prefix, iso_str, 15);
+    cache.base = base;
+    cache.valid = true;
+
+    return base + nanoseconds;
 }
 
 int DateTimeUtil::to_iso_string(aku_Timestamp ts, char* buffer, size_t buffer_size) {
@@ -3,6 +3,10 @@
 #include <stdexcept>
 #include <boost/exception/all.hpp>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace Akumuli {
 
 static u32 combine(u32 hi, u32 lo) {
@@ -51,6 +55,24 @@ u32 HashFnFamily::hash(int ix, u64 key) const {
     return hi32hash ^ lo32hash ^ hilohash;
 }
 
+void HashFnFamily::hash(int ix, const u64* keys, u32* results, size_t n) const {
+    // Tabulation tables for the row are reused across the whole batch
+    std::vector<unsigned short> const& table = table_[ix];
+    for (size_t i = 0; i < n; i++) {
+        u32 hi32 = static_cast<u32>(keys[i] >> 32);
+        u32 lo32 = static_cast<u32>(keys[i] & 0xFFFFFFFF);
+        u32 hilo = combine(hi32, lo32);
+        u32 acc  = 0;
+        u32 words[] = { hi32, lo32, hilo };
+        for (auto word : words) {
+            u32 hi16 = word >> 16;
+            u32 lo16 = word & 0xFFFF;
+            acc ^= table[lo16] ^ table[hi16] ^ table[combine(hi16, lo16)];
+        }
+        results[i] = acc;
+    }
+}
+
 u32 HashFnFamily::hash32(int ix, u32 key) const {
     auto hi16 = key >> 16;
     auto lo16 = key & 0xFFFF;
@@ -58,4 +80,64 @@ u32 HashFnFamily::hash32(int ix, u32 key) const {
     return table_[ix][lo16] ^ table_[ix][hi16] ^ table_[ix][hilo];
 }
 
+static u32 multiply_shift_amount(u32 K) {
+    // K should be a power of two (and leave room for the shift)
+    auto mask = K-1;
+    if (K < 2 || (mask&K) != 0) {
+        std::runtime_error err("invalid argument K (should be a power of two)");
+        BOOST_THROW_EXCEPTION(err);
+    }
+    u32 bits = 0;
+    while ((1ull << bits) < K) {
+        bits++;
+    }
+    return 64 - bits;
+}
+
+MultiplyShiftHashFnFamily::MultiplyShiftHashFnFamily(u32 N, u32 K)
+    : N(N)
+    , K(K)
+    , shift_(multiply_shift_amount(K))
+{
+    std::random_device randdev;
+    std::mt19937_64 generator(randdev());
+    std::uniform_int_distribution<u64> distribution;
+    for (u32 i = 0; i < N; i++) {
+        // Multiplier should be odd
+        multipliers_.push_back(distribution(generator) | 1ull);
+    }
+}
+
+u32 MultiplyShiftHashFnFamily::hash(int ix, u64 key) const {
+    return static_cast<u32>((multipliers_[ix] * key) >> shift_);
+}
+
+void MultiplyShiftHashFnFamily::hash(int ix, const u64* keys, u32* results, size_t n) const {
+    const u64 a = multipliers_[ix];
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i va   = _mm256_set1_epi64x(static_cast<long long>(a));
+    const __m256i vahi = _mm256_srli_epi64(va, 32);
+    for (; i + 8 <= n; i += 8) {
+        u64 buf[8];
+        for (int j = 0; j < 2; j++) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i + 4*j));
+            // Low 64 bits of a*x out of 32-bit multiplies (AVX2 has no 64-bit mullo)
+            __m256i lo    = _mm256_mul_epu32(va, x);
+            __m256i xhi   = _mm256_srli_epi64(x, 32);
+            __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(vahi, x), _mm256_mul_epu32(va, xhi));
+            __m256i prod  = _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+            __m256i hashv = _mm256_srli_epi64(prod, static_cast<int>(shift_));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(buf + 4*j), hashv);
+        }
+        for (int j = 0; j < 8; j++) {
+            results[i + j] = static_cast<u32>(buf[j]);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        results[i] = static_cast<u32>((a * keys[i]) >> shift_);
+    }
+}
+
 }  // namespace
@@ -21,8 +21,38 @@ struct HashFnFamily {
     //! Calculate hash value in range [0, K)
     u32 hash(int ix, u64 key) const;
 
+    //! Calculate hash values for a batch of keys (table stays hot in cache)
+    void hash(int ix, const u64* keys, u32* results, size_t n) const;
+
 private:
     u32 hash32(int ix, u32 key) const;
 };
 
+/** Family of 2-universal multiply-shift hash functions.
+  * Each function is one 64-bit multiply by a random odd constant followed
+  * by a shift, so a batch of keys boils down to a handful of arithmetic
+  * instructions (the AVX2 path hashes 8 keys per iteration). Use it where
+  * hashing is the bottleneck and 2-universality is enough, `HashFnFamily`
+  * stays the choice when 4-universal guarantees are required.
+  */
+struct MultiplyShiftHashFnFamily {
+    const u32 N;
+    const u32 K;
+    const u32 shift_;  //< 64 - log2(K)
+    //! Random odd multipliers, one per function
+    std::vector<u64> multipliers_;
+
+    //! C-tor. N - number of different hash functions, K - number of values (should be a power of two)
+    MultiplyShiftHashFnFamily(u32 N, u32 K);
+
+    //! Calculate hash value in range [0, K)
+    u32 hash(int ix, u64 key) const;
+
+    /** Calculate hash values for a batch of keys.
+      * Vectorized with AVX2 when available, plain multiply-shift loop
+      * otherwise.
+      */
+    void hash(int ix, const u64* keys, u32* results, size_t n) const;
+};
+
 }  // namespace
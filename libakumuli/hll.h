@@ -0,0 +1,104 @@
+/**
+ * PRIVATE HEADER
+ *
+ * HyperLogLog distinct value counter.
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include "akumuli_def.h"
+#include "bit_twiddling.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace Akumuli {
+
+/** HyperLogLog cardinality sketch.
+  * Keeps one byte per register - the largest number of leading zero bits
+  * observed in the hashes that map to the register. Adding a value is a
+  * handful of bit operations and the estimate is computed from the
+  * registers alone, so the sketch answers count-distinct queries in O(1)
+  * regardless of how many values it has seen. With 2^12 registers the
+  * typical error is about 1.6% and the sketch occupies 4KB.
+  */
+struct HyperLogLog {
+    enum {
+        PRECISION  = 12,
+        NREGISTERS = 1 << PRECISION,
+    };
+
+    std::vector<u8> registers_;
+
+    HyperLogLog()
+        : registers_(NREGISTERS, 0)
+    {
+    }
+
+    //! FNV-1a hash of the value (sketch quality depends on hash uniformity)
+    static u64 hash(const char* begin, u32 len) {
+        u64 h = 0xcbf29ce484222325ull;
+        for (u32 i = 0; i < len; i++) {
+            h ^= static_cast<u8>(begin[i]);
+            h *= 0x100000001b3ull;
+        }
+        // FNV-1a barely mixes the high bits for short inputs (short values
+        // share the same prefix), but the register index is taken from the
+        // top of the hash - pass it through the murmur3 finalizer so every
+        // input bit affects every output bit
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    //! Add hashed value to the sketch
+    void add(u64 h) {
+        u32 ix = static_cast<u32>(h >> (64 - PRECISION));
+        u64 rest = h << PRECISION;
+        // Rank of the hash - number of leading zeroes in the remaining
+        // bits plus one (all-zero rest gets the maximal rank)
+        u8 rank = rest == 0 ? 64 - PRECISION + 1
+                            : static_cast<u8>(BitHacks::leading_zeroes(rest)) + 1;
+        if (registers_[ix] < rank) {
+            registers_[ix] = rank;
+        }
+    }
+
+    //! Estimate the number of distinct values added to the sketch
+    double estimate() const {
+        const double m = NREGISTERS;
+        const double alpha = 0.7213 / (1.0 + 1.079 / m);
+        double sum = 0;
+        int zeroes = 0;
+        for (auto rank: registers_) {
+            sum += std::ldexp(1.0, -rank);
+            zeroes += rank == 0;
+        }
+        double raw = alpha * m * m / sum;
+        if (raw <= 2.5 * m && zeroes != 0) {
+            // Small range correction - linear counting is more accurate
+            // while most of the registers are still empty
+            return m * std::log(m / zeroes);
+        }
+        return raw;
+    }
+};
+
+}  // namespace Akumuli
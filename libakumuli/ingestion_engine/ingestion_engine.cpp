@@ -9,6 +9,69 @@ using namespace StorageEngine;
 /*  Tree data      Id -> NBTree        Series name parsing    */
 /*                 Global state        Connection local state */
 
+// /////////////// //
+// Sparse presence //
+// /////////////// //
+
+void SparsePresence::mark(aku_Timestamp ts) {
+    u64 epoch = ts >> EPOCH_BITS;
+    words_[epoch >> 6] |= 1ull << (epoch & 63);
+}
+
+void SparsePresence::mark_range(aku_Timestamp begin, aku_Timestamp end) {
+    u64 first = begin >> EPOCH_BITS;
+    u64 last  = end   >> EPOCH_BITS;
+    for (u64 word = first >> 6; word <= last >> 6; word++) {
+        u64 mask = ~0ull;
+        if (word == first >> 6) {
+            mask &= ~0ull << (first & 63);
+        }
+        if (word == last >> 6) {
+            mask &= ~0ull >> (63 - (last & 63));
+        }
+        words_[word] |= mask;
+    }
+}
+
+bool SparsePresence::maybe_present(aku_Timestamp begin, aku_Timestamp end) const {
+    if (begin > end) {
+        std::swap(begin, end);
+    }
+    u64 first = begin >> EPOCH_BITS;
+    u64 last  = end   >> EPOCH_BITS;
+    // Iterate over the summary instead of the range - the range can be
+    // arbitrarily wide (e.g. the whole time axis) but the summary is small.
+    auto it = words_.lower_bound(first >> 6);
+    for (; it != words_.end() && it->first <= (last >> 6); it++) {
+        u64 mask = ~0ull;
+        if (it->first == first >> 6) {
+            mask &= ~0ull << (first & 63);
+        }
+        if (it->first == last >> 6) {
+            mask &= ~0ull >> (63 - (last & 63));
+        }
+        if (it->second & mask) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SparsePresence::trim(aku_Timestamp boundary) {
+    u64 epoch = boundary >> EPOCH_BITS;
+    auto it = words_.begin();
+    while (it != words_.end() && it->first < epoch >> 6) {
+        it = words_.erase(it);
+    }
+    if (it != words_.end() && it->first == epoch >> 6) {
+        // The boundary epoch itself can still hold data at or above the boundary
+        it->second &= ~0ull << (epoch & 63);
+        if (it->second == 0) {
+            words_.erase(it);
+        }
+    }
+}
+
 // ////////////// //
 // Registry entry //
 // ////////////// //
@@ -31,15 +94,113 @@ std::shared_ptr<NBTreeExtentsList> RegistryEntry::try_acquire() {
     return std::shared_ptr<NBTreeExtentsList>();
 }
 
+void RegistryEntry::replace(std::unique_ptr<NBTreeExtentsList>&& nbtree) {
+    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+    roots_ = std::move(nbtree);
+}
+
+void RegistryEntry::mark_presence(aku_Timestamp ts) {
+    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+    presence_.mark(ts);
+}
+
+void RegistryEntry::seed_presence(aku_Timestamp begin, aku_Timestamp end) {
+    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+    presence_.mark_range(begin, end);
+}
+
+bool RegistryEntry::maybe_has_data(aku_Timestamp begin, aku_Timestamp end) const {
+    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+    return presence_.maybe_present(begin, end);
+}
+
+void RegistryEntry::trim_presence(aku_Timestamp boundary) {
+    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+    presence_.trim(boundary);
+}
+
 // ///////////// //
 // Tree registry //
 // ///////////// //
 
 TreeRegistry::TreeRegistry(std::unique_ptr<MetadataStorage>&& meta)
     : metadata_(std::move(meta))
+    , generation_(0)
+    , compactor_shutdown_(false)
 {
 }
 
+TreeRegistry::~TreeRegistry() {
+    if (compactor_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lg(compactor_lock_); AKU_UNUSED(lg);
+            compactor_shutdown_ = true;
+        }
+        compactor_cv_.notify_one();
+        compactor_thread_.join();
+    }
+}
+
+void TreeRegistry::compactor_loop_() {
+    std::unique_lock<std::mutex> lock(compactor_lock_);
+    while (!compactor_shutdown_) {
+        compactor_cv_.wait_for(lock, std::chrono::seconds(COMPACTION_INTERVAL_SEC),
+                               [this]() { return compactor_shutdown_; });
+        if (compactor_shutdown_) {
+            break;
+        }
+        lock.unlock();
+        for (auto& shard: shards_) {
+            std::vector<std::shared_ptr<RegistryEntry>> entries;
+            {
+                std::lock_guard<std::mutex> lg(shard.lock); AKU_UNUSED(lg);
+                for (auto& kv: shard.table) {
+                    entries.push_back(kv.second);
+                }
+            }
+            for (auto& entry: entries) {
+                // Holding the tree keeps the entry busy so the writers
+                // can't ingest into it mid-rewrite
+                auto tree = entry->try_acquire();
+                if (!tree) {
+                    // Tree is in use - skip, better luck on the next pass
+                    continue;
+                }
+                auto stats = tree->get_fragmentation();
+                if (stats.nleaves < COMPACTION_MIN_LEAVES ||
+                    stats.nfragmented * 4 < stats.nleaves) {
+                    continue;
+                }
+                // Commit pending data first so the rewrite covers it
+                auto id = tree->get_id();
+                auto roots = tree->close();
+                aku_Status status;
+                std::vector<LogicAddr> new_roots;
+                std::tie(status, new_roots) = NBTreeExtentsList::compact(bstore_, id, roots,
+                                                                         COMPACTION_THROTTLE_US);
+                if (status != AKU_SUCCESS) {
+                    // Old blocks are still intact - reopen from the old roots
+                    new_roots = std::move(roots);
+                }
+                std::unique_ptr<NBTreeExtentsList> subst;
+                subst.reset(new NBTreeExtentsList(id, new_roots, bstore_));
+                entry->replace(std::move(subst));
+            }
+        }
+        // Invalidate series to extents mappings cached by the dispatchers.
+        generation_.fetch_add(1, std::memory_order_release);
+        lock.lock();
+    }
+}
+
+u64 TreeRegistry::get_generation() const {
+    return generation_.load(std::memory_order_acquire);
+}
+
+TreeRegistry::TableShard& TreeRegistry::get_shard_(aku_ParamId id) {
+    return shards_.at(std::hash<aku_ParamId>()(id) % TABLE_NSHARDS);
+}
+
 aku_Status TreeRegistry::init_series_id(const char* begin, const char* end, aku_Sample *sample) {
     std::lock_guard<std::mutex> ml(this->metadata_lock_); AKU_UNUSED(ml);
     u64 id = global_matcher_.match(begin, end);
@@ -51,6 +212,44 @@ aku_Status TreeRegistry::init_series_id(const char* begin, const char* end, aku_
     return AKU_SUCCESS;
 }
 
+void TreeRegistry::open_trees(std::shared_ptr<StorageEngine::BlockStore> bstore,
+                              std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> const& mapping)
+{
+    std::vector<std::shared_ptr<NBTreeExtentsList>> trees;
+    std::vector<std::shared_ptr<RegistryEntry>> entries;
+    for (auto const& kv: mapping) {
+        std::unique_ptr<NBTreeExtentsList> tree;
+        tree.reset(new NBTreeExtentsList(kv.first, kv.second, bstore));
+        auto entry = std::make_shared<RegistryEntry>(std::move(tree));
+        auto& shard = get_shard_(kv.first);
+        {
+            std::lock_guard<std::mutex> lg(shard.lock); AKU_UNUSED(lg);
+            shard.table[kv.first] = entry;
+        }
+        // Entry was just created so acquisition can't fail.
+        trees.push_back(entry->try_acquire());
+        entries.push_back(entry);
+    }
+    // Invalidate series to extents mappings cached by the dispatchers.
+    generation_.fetch_add(1, std::memory_order_release);
+    // Opening a tree is dominated by `read_block` calls, do it in parallel.
+    NBTreeExtentsList::force_init_all(trees);
+    // Seed the presence summaries. Reopened trees are marked with their full
+    // timestamp range - coarse but one-sided, new writes refine the summary.
+    for (size_t i = 0; i < trees.size(); i++) {
+        aku_Timestamp begin, end;
+        std::tie(begin, end) = trees.at(i)->get_timestamps();
+        if (begin <= end) {
+            entries.at(i)->seed_presence(begin, end);
+        }
+    }
+    // Start the leaf compactor.
+    bstore_ = bstore;
+    if (!compactor_thread_.joinable()) {
+        compactor_thread_ = std::thread(&TreeRegistry::compactor_loop_, this);
+    }
+}
+
 std::shared_ptr<StreamDispatcher> TreeRegistry::create_dispatcher() {
     auto deleter = [](StreamDispatcher* p) {
         p->close();
@@ -88,20 +287,77 @@ void TreeRegistry::broadcast_sample(aku_Sample const* sample) {
 }
 
 std::shared_ptr<NBTreeExtentsList> TreeRegistry::try_acquire(aku_ParamId id) {
-    std::lock_guard<std::mutex> lg(table_lock_); AKU_UNUSED(lg);
-    auto it = table_.find(id);
-    if (it == table_.end() && it->second->is_available()) {
+    auto& shard = get_shard_(id);
+    std::lock_guard<std::mutex> lg(shard.lock); AKU_UNUSED(lg);
+    auto it = shard.table.find(id);
+    if (it != shard.table.end() && it->second->is_available()) {
         return it->second->try_acquire();
     }
     return std::shared_ptr<NBTreeExtentsList>();
 }
 
+void TreeRegistry::mark_presence(aku_ParamId id, aku_Timestamp ts) {
+    auto& shard = get_shard_(id);
+    std::shared_ptr<RegistryEntry> entry;
+    {
+        std::lock_guard<std::mutex> lg(shard.lock); AKU_UNUSED(lg);
+        auto it = shard.table.find(id);
+        if (it == shard.table.end()) {
+            return;
+        }
+        entry = it->second;
+    }
+    entry->mark_presence(ts);
+}
+
+bool TreeRegistry::maybe_has_data(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) {
+    auto& shard = get_shard_(id);
+    std::shared_ptr<RegistryEntry> entry;
+    {
+        std::lock_guard<std::mutex> lg(shard.lock); AKU_UNUSED(lg);
+        auto it = shard.table.find(id);
+        if (it == shard.table.end()) {
+            // Unknown series - certainly no data.
+            return false;
+        }
+        entry = it->second;
+    }
+    return entry->maybe_has_data(begin, end);
+}
+
+u32 TreeRegistry::enforce_retention(aku_Timestamp boundary) {
+    u32 dropped = 0;
+    auto fstore = std::dynamic_pointer_cast<FixedSizeFileStorage>(bstore_);
+    if (fstore) {
+        aku_Status status;
+        std::tie(status, dropped) = fstore->drop_partition(boundary);
+        if (status != AKU_SUCCESS) {
+            return 0;
+        }
+    }
+    if (dropped == 0) {
+        return 0;
+    }
+    // The dropped blocks are gone, trim the presence summaries so the
+    // query path stops routing scans into the expired range.
+    for (auto& shard: shards_) {
+        std::lock_guard<std::mutex> lg(shard.lock); AKU_UNUSED(lg);
+        for (auto& kv: shard.table) {
+            kv.second->trim_presence(boundary);
+        }
+    }
+    return dropped;
+}
+
 // //////////////// //
 // StreamDispatcher //
 // //////////////// //
 
 StreamDispatcher::StreamDispatcher(std::shared_ptr<TreeRegistry> registry)
     : registry_(registry)
+    , mru_()
+    , mru_pos_(0)
+    , generation_(registry->get_generation())
 {
     // At this point this `StreamDispatcher` should be already registered.
     // This should be done by `TreeRegistry::create_dispatcher` function
@@ -109,6 +365,30 @@ StreamDispatcher::StreamDispatcher(std::shared_ptr<TreeRegistry> registry)
 }
 
 void StreamDispatcher::close() {
+    {
+        // Release samples still sitting in the reorder buffer.
+        std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+        if (reorder_) {
+            outbuf_.clear();
+            reorder_->flush(&outbuf_);
+            for (auto const& out: outbuf_) {
+                auto it = cache_.find(out.id);
+                if (it == cache_.end()) {
+                    continue;
+                }
+                auto& state = states_[out.id];
+                if (out.ts < state.last_ts) {
+                    ReorderBuffer::count_late();
+                    continue;
+                }
+                state.last_ts = out.ts;
+                mark_presence_(out.id, out.ts, state);
+                auto flush = it->second->append(out.ts, out.value);
+                AKU_UNUSED(flush);
+                // FIXME: perform flush if needed
+            }
+        }
+    }
     auto reg = registry_.lock();
     if (reg) {
         reg->remove_dispatcher(*this);
@@ -116,6 +396,14 @@ void StreamDispatcher::close() {
 }
 
 aku_Status StreamDispatcher::init_series_id(const char* begin, const char* end, aku_Sample *sample) {
+    // Fast path - writers tend to send byte-identical series strings, the
+    // raw bytes usually map to an already known id so the normalization
+    // pass can be skipped.
+    u64 cached = raw_cache_.match(begin, end);
+    if (cached != 0ul) {
+        sample->paramid = cached;
+        return AKU_SUCCESS;
+    }
     // Series name normalization procedure. Most likeley a bottleneck but
     // can be easily parallelized.
     const char* ksbegin = nullptr;
@@ -145,6 +433,81 @@ aku_Status StreamDispatcher::init_series_id(const char* begin, const char* end,
         // initialize using local info
         sample->paramid = id;
     }
+    if (status == AKU_SUCCESS) {
+        raw_cache_._add(std::string(begin, end), sample->paramid);
+    }
+    return status;
+}
+
+void StreamDispatcher::mark_presence_(aku_ParamId id, aku_Timestamp ts, SeriesState& state) {
+    if (AKU_UNLIKELY(state.marked_ts == 0 ||
+                     (ts >> SparsePresence::EPOCH_BITS) != (state.marked_ts >> SparsePresence::EPOCH_BITS)))
+    {
+        auto reg = registry_.lock();
+        if (reg) {
+            reg->mark_presence(id, ts);
+        }
+        state.marked_ts = ts;
+    }
+}
+
+void StreamDispatcher::cache_mru_(aku_ParamId id, std::shared_ptr<NBTreeExtentsList> const& extents) {
+    auto& slot = mru_.at(mru_pos_ % MRU_SIZE);
+    slot.id = id;
+    slot.extents = extents;
+    slot.generation = generation_;
+    mru_pos_++;
+}
+
+aku_Status StreamDispatcher::append_(NBTreeExtentsList* extents, aku_Sample const* sample) {
+    aku_ParamId id = sample->paramid;
+    aku_Timestamp ts = sample->timestamp;
+    auto& state = states_[id];
+    if (AKU_LIKELY(!state.buffered)) {
+        if (AKU_LIKELY(ts >= state.last_ts)) {
+            // Fast path - series arrives in order, append directly.
+            state.last_ts = ts;
+            mark_presence_(id, ts, state);
+            auto flush = extents->append(ts, sample->payload.float64);
+            AKU_UNUSED(flush);
+            // FIXME: perform flush if needed
+            return AKU_SUCCESS;
+        }
+        // First out-of-order sample - route the series through the
+        // reorder buffer from now on.
+        state.buffered = true;
+        if (!reorder_) {
+            reorder_.reset(new ReorderBuffer(REORDER_LATENESS));
+        }
+    }
+    outbuf_.clear();
+    if (!reorder_->put(id, ts, sample->payload.float64, &outbuf_)) {
+        // Duplicate timestamp, sample was dropped.
+        return AKU_SUCCESS;
+    }
+    aku_Status status = AKU_SUCCESS;
+    for (auto const& out: outbuf_) {
+        NBTreeExtentsList* dest = extents;
+        if (out.id != id) {
+            auto it = cache_.find(out.id);
+            if (it == cache_.end()) {
+                continue;
+            }
+            dest = it->second.get();
+        }
+        auto& dstate = states_[out.id];
+        if (out.ts < dstate.last_ts) {
+            // Sample is too late even for the reorder buffer.
+            ReorderBuffer::count_late();
+            status = AKU_ELATE_WRITE;
+            continue;
+        }
+        dstate.last_ts = out.ts;
+        mark_presence_(out.id, out.ts, dstate);
+        auto flush = dest->append(out.ts, out.value);
+        AKU_UNUSED(flush);
+        // FIXME: perform flush if needed
+    }
     return status;
 }
 
@@ -153,29 +516,39 @@ aku_Status StreamDispatcher::write(aku_Sample const* sample) {
         return AKU_EBAD_ARG;
     }
     aku_ParamId id = sample->paramid;
+    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
+    // Fast path - check MRU cache first (traffic is bursty per series so
+    // consecutive samples tend to hit the same slot).
+    for (auto& slot: mru_) {
+        if (slot.extents && slot.id == id) {
+            if (slot.generation == generation_) {
+                return append_(slot.extents.get(), sample);
+            }
+            // Stale mapping
+            slot.extents.reset();
+        }
+    }
     // Locate registery entry in cache, if no such entry - try to acquire
     // registery entry, if registery entry is already acquired by the other
     // `StreamDispatcher` - broadcast value to all other dispatchers.
-    std::lock_guard<std::mutex> m(lock_); AKU_UNUSED(m);
     auto it = cache_.find(id);
     if (it == cache_.end()) {
         // try to acquire entry
         auto reg = registry_.lock();
         if (reg) {
+            generation_ = reg->get_generation();
             auto entry = reg->try_acquire(id);
             if (entry) {
                 cache_[id] = entry;
-                auto flush = entry->append(sample->timestamp, sample->payload.float64);
-                AKU_UNUSED(flush);
-                // FIXME: perform flush if needed
+                cache_mru_(id, entry);
+                return append_(entry.get(), sample);
             }
         } else {
             return AKU_ECLOSED;
         }
     } else {
-        auto flush = it->second->append(sample->timestamp, sample->payload.float64);
-        AKU_UNUSED(flush);
-        // FIXME: perform flush if needed
+        cache_mru_(id, it->second);
+        return append_(it->second.get(), sample);
     }
     return AKU_SUCCESS;
 }
@@ -186,9 +559,7 @@ bool StreamDispatcher::_receive_broadcast(aku_Sample const* sample) {
     auto it = cache_.find(id);
     if (it != cache_.end()) {
         // perform write
-        auto should_flush = it->second->append(sample->timestamp, sample->payload.float64);
-        AKU_UNUSED(should_flush);
-        // FIXME: perform flush if needed
+        append_(it->second.get(), sample);
         return true;
     }
     return false;
@@ -27,12 +27,18 @@
  */
 
 // Stdlib
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <thread>
 #include <unordered_map>
 #include <mutex>
 
 // Project
 #include "akumuli_def.h"
 #include "metadatastorage.h"
+#include "reorder_buffer.h"
 #include "seriesparser.h"
 // Project.storage_engine
 #include "storage_engine/nbtree.h"
@@ -40,9 +46,40 @@
 namespace Akumuli {
 namespace Ingress {
 
+/** Coarse per-series time-presence summary.
+  * The time axis is split into epochs (~20h each) and populated epochs are
+  * tracked in a sparse bitmap. The summary is a few words per series so the
+  * query path can reject ranges that contain no data without any block I/O.
+  * The answer is one-sided: `maybe_present` can return true for an empty
+  * range but never false for a populated one.
+  */
+struct SparsePresence {
+    enum {
+        //! log2 of the epoch length in nanoseconds (~20 hours)
+        EPOCH_BITS = 46,
+    };
+
+    //! Word index to bitmap of 64 epochs mapping
+    std::map<u64, u64> words_;
+
+    //! Mark epoch of the timestamp as populated
+    void mark(aku_Timestamp ts);
+
+    //! Mark all epochs in the [begin, end] range as populated
+    void mark_range(aku_Timestamp begin, aku_Timestamp end);
+
+    //! Return false if no epoch in the [begin, end] range is populated
+    bool maybe_present(aku_Timestamp begin, aku_Timestamp end) const;
+
+    //! Clear all epochs that end before the timestamp (retention path)
+    void trim(aku_Timestamp boundary);
+};
+
+
 class RegistryEntry {
     mutable std::mutex lock_;
     std::shared_ptr<StorageEngine::NBTreeExtentsList> roots_;
+    SparsePresence presence_;
 public:
 
     RegistryEntry(std::unique_ptr<StorageEngine::NBTreeExtentsList>&& nbtree);
@@ -52,6 +89,21 @@ public:
 
     //! Acquire NBTreeExtentsList
     std::shared_ptr<StorageEngine::NBTreeExtentsList> try_acquire();
+
+    //! Replace the tree (compaction path). Caller should hold the old tree acquired.
+    void replace(std::unique_ptr<StorageEngine::NBTreeExtentsList>&& nbtree);
+
+    //! Mark epoch of the timestamp as populated (write path).
+    void mark_presence(aku_Timestamp ts);
+
+    //! Mark the [begin, end] range as populated (startup path, reopened trees).
+    void seed_presence(aku_Timestamp begin, aku_Timestamp end);
+
+    //! Return false if the series has no data in the [begin, end] range.
+    bool maybe_has_data(aku_Timestamp begin, aku_Timestamp end) const;
+
+    //! Clear presence of epochs that end before the timestamp (retention path).
+    void trim_presence(aku_Timestamp boundary);
 };
 
 
@@ -66,17 +118,59 @@ class StreamDispatcher;
   * Instances of this class is thread-safe.
   */
 class TreeRegistry : public std::enable_shared_from_this<TreeRegistry> {
+    enum {
+        //! Number of series table shards
+        TABLE_NSHARDS = 16,
+    };
+
+    /** Series table shard.
+      * Table is sharded by series id so dispatchers that ingest disjoint
+      * sets of time-series don't contend on a single lock.
+      */
+    struct TableShard {
+        mutable std::mutex lock;
+        std::unordered_map<aku_ParamId, std::shared_ptr<RegistryEntry>> table;
+    };
+
     std::unique_ptr<MetadataStorage> metadata_;
-    std::unordered_map<aku_ParamId, std::shared_ptr<RegistryEntry>> table_;
+    std::array<TableShard, TABLE_NSHARDS> shards_;
     SeriesMatcher global_matcher_;
     //! List of acitve dispatchers
     std::unordered_map<size_t, std::weak_ptr<StreamDispatcher>> active_;
     std::mutex metadata_lock_;
-    std::mutex table_lock_;
+
+    //! Map series id to table shard
+    TableShard& get_shard_(aku_ParamId id);
+
+    //! Series table generation (updated when table content changes)
+    std::atomic<u64> generation_;
+
+    enum {
+        //! Pause between compactor passes (seconds)
+        COMPACTION_INTERVAL_SEC = 60,
+        //! Pause between compaction batches (microseconds, foreground I/O throttling)
+        COMPACTION_THROTTLE_US = 1000,
+        //! Trees with fewer committed leaves are left alone
+        COMPACTION_MIN_LEAVES = 32,
+    };
+
+    // Leaf compactor state. The compactor periodically rewrites idle trees
+    // whose committed leaves are mostly under-filled (restart churn), see
+    // `NBTreeExtentsList::compact`.
+    std::shared_ptr<StorageEngine::BlockStore> bstore_;  //< Block storage (set by `open_trees`)
+    std::thread             compactor_thread_;
+    std::mutex              compactor_lock_;
+    std::condition_variable compactor_cv_;
+    bool                    compactor_shutdown_;
+
+    //! Compactor thread body
+    void compactor_loop_();
 
 public:
     TreeRegistry(std::unique_ptr<MetadataStorage>&& meta);
 
+    ~TreeRegistry();
+
     // No value semantics allowed.
     TreeRegistry(TreeRegistry const&) = delete;
     TreeRegistry(TreeRegistry &&) = delete;
@@ -85,6 +179,14 @@ public:
     //! Match series name. If series with such name doesn't exists - create it.
     aku_Status init_series_id(const char* begin, const char* end, aku_Sample *sample);
 
+    /** Create registry entries for the series and open them (startup path).
+      * Trees are initialized in parallel, see `NBTreeExtentsList::force_init_all`.
+      * @param bstore block storage of the database
+      * @param mapping series id to rescue points list mapping
+      */
+    void open_trees(std::shared_ptr<StorageEngine::BlockStore> bstore,
+                    std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> const& mapping);
+
     // Dispatchers handling
 
     //! Create and register new `StreamDispatcher`.
@@ -100,6 +202,32 @@ public:
 
     //! Acquire nbtree extents list (release should be automatic)
     std::shared_ptr<StorageEngine::NBTreeExtentsList> try_acquire(aku_ParamId id);
+
+    //! Mark epoch of the timestamp as populated (called by the dispatchers).
+    void mark_presence(aku_ParamId id, aku_Timestamp ts);
+
+    /** Return false if the series has no data in the [begin, end] range.
+      * Answered from the per-series presence summary without any block I/O,
+      * the query layer should consult this before building iterators so
+      * scans over empty ranges are rejected upfront. The check is
+      * one-sided - a true result still requires a real scan.
+      */
+    bool maybe_has_data(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end);
+
+    /** Get current series table generation.
+      * Dispatchers use this value to invalidate locally cached series to
+      * extents mappings when the table content changes.
+      */
+    u64 get_generation() const;
+
+    /** Drop all data older then the timestamp (retention enforcement).
+      * Metadata-only operation - volumes that lie entirely before the
+      * boundary are recycled in place by the block store and the
+      * per-series presence summaries are trimmed to match, no data is
+      * read or rewritten.
+      * @return number of dropped volumes
+      */
+    u32 enforce_retention(aku_Timestamp boundary);
 };
 
 
@@ -108,14 +236,74 @@ public:
   */
 class StreamDispatcher : public std::enable_shared_from_this<StreamDispatcher>
 {
+    enum {
+        //! Number of MRU cache slots
+        MRU_SIZE = 4,
+        //! Reorder buffer lateness bound (1s in nanoseconds)
+        REORDER_LATENESS = 1000000000,
+    };
+
+    /** MRU cache slot (resolved series to extents mapping).
+      * Protocol traffic is bursty per series so the last few mappings are
+      * kept in a small array that can be scanned with pointer compares,
+      * the hash table lookup is reserved for misses.
+      */
+    struct MRUSlot {
+        aku_ParamId id;
+        std::shared_ptr<StorageEngine::NBTreeExtentsList> extents;
+        u64 generation;
+    };
+
     //! Link to global registry.
     std::weak_ptr<TreeRegistry> registry_;
     //! Local registry cache.
     std::unordered_map<aku_ParamId, std::shared_ptr<StorageEngine::NBTreeExtentsList>> cache_;
+    //! MRU cache of recently written series.
+    std::array<MRUSlot, MRU_SIZE> mru_;
+    //! Next MRU slot to evict.
+    u32 mru_pos_;
+    //! Registry generation observed by this dispatcher.
+    u64 generation_;
     //! Local series matcher (with cached global data).
     SeriesMatcher local_matcher_;
+    //! Raw (un-normalized) series name to id cache.
+    SeriesMatcher raw_cache_;
     //! This mutex shouldn't be contended during normal operation.
     std::mutex lock_;
+
+    /** Per-series write-order state.
+      * Series that always arrive in order (the common case) stay on the
+      * direct append path, the first out-of-order sample switches the
+      * series to the reorder buffer for the rest of the connection.
+      */
+    struct SeriesState {
+        aku_Timestamp last_ts;    //< Largest timestamp appended to the tree
+        aku_Timestamp marked_ts;  //< Last timestamp reported to the presence summary (0 - none)
+        bool          buffered;   //< Series goes through the reorder buffer
+    };
+
+    //! Write-order state of the ingested series.
+    std::unordered_map<aku_ParamId, SeriesState> states_;
+    //! Reorder buffer (created lazily on the first out-of-order sample).
+    std::unique_ptr<ReorderBuffer> reorder_;
+    //! Scratch buffer for samples released by `reorder_`.
+    std::vector<ReorderBuffer::OutSample> outbuf_;
+
+    //! Store mapping in MRU cache (lock_ should be held by the caller)
+    void cache_mru_(aku_ParamId id, std::shared_ptr<StorageEngine::NBTreeExtentsList> const& extents);
+
+    /** Report the timestamp to the per-series presence summary in the
+      * registry (lock_ should be held by the caller). The registry is
+      * bothered only when the sample lands in a new epoch so the common
+      * path is a single shift and compare.
+      */
+    void mark_presence_(aku_ParamId id, aku_Timestamp ts, SeriesState& state);
+
+    /** Append sample to the extents list keeping the series ordered
+      * (lock_ should be held by the caller). In-order samples go straight
+      * to the tree, out-of-order ones are routed through the reorder buffer.
+      */
+    aku_Status append_(StorageEngine::NBTreeExtentsList* extents, aku_Sample const* sample);
 public:
     //! C-tor. Shouldn't be called directly.
     StreamDispatcher(std::shared_ptr<TreeRegistry> registry);
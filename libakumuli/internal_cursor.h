@@ -64,5 +64,20 @@ struct InternalCursor {
     virtual void complete(Caller&) = 0;
     //! Set error and stop execution
     virtual void set_error(Caller&, aku_Status error_code) = 0;
+
+    /** Send batch of fixed size samples to caller.
+      * Default implementation loops over `put`, cursors that support
+      * batching override it to copy the whole batch at once (this cuts
+      * down context switch frequency by the batch factor).
+      * @note samples with variably sized payload can't be batched
+      */
+    virtual bool put_batch(Caller& caller, const aku_Sample* samples, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            if (!put(caller, samples[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
 };
 }
@@ -19,6 +19,10 @@
 #include <random>
 #include <memory>
 #include <algorithm>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
 
 namespace Akumuli {
 
@@ -44,6 +48,14 @@ u64 TwoUnivHashFnFamily::hash(int ix, u64 value) const {
     return ((a[ix]*value + b[ix]) % prime) % modulo;
 }
 
+void TwoUnivHashFnFamily::hash(int ix, const u64* values, u64* results, size_t n) const {
+    u64 av = a[ix];
+    u64 bv = b[ix];
+    for (size_t i = 0; i < n; i++) {
+        results[i] = ((av*values[i] + bv) % prime) % modulo;
+    }
+}
+
 void Postings::append(aku_ParamId id) {
     auto it = counters_.find(id);
     if (it != counters_.end()) {
@@ -138,4 +150,389 @@ std::vector<std::pair<aku_ParamId, size_t>> InvertedIndex::get_count(const char
     return results;
 }
 
+//! Split id into container key and low 16-bit value
+static std::pair<u64, u16> split_id(aku_ParamId id) {
+    return std::make_pair(id >> 16, static_cast<u16>(id & 0xFFFF));
+}
+
+//! Convert array container to bitset representation
+static void convert_to_bitset(IdBitmap::Container* cont) {
+    cont->words.resize(IdBitmap::BITSET_WORDS);
+    for (auto low: cont->array) {
+        cont->words[low >> 6] |= 1ull << (low & 0x3F);
+    }
+    cont->array.clear();
+    cont->array.shrink_to_fit();
+}
+
+//! Check whether value is present in the container
+static bool container_test(IdBitmap::Container const& cont, u16 low) {
+    if (cont.is_bitset()) {
+        return (cont.words[low >> 6] & (1ull << (low & 0x3F))) != 0;
+    }
+    return std::binary_search(cont.array.begin(), cont.array.end(), low);
+}
+
+//! Number of values stored in the container
+static size_t container_cardinality(IdBitmap::Container const& cont) {
+    if (cont.is_bitset()) {
+        size_t total = 0;
+        for (auto word: cont.words) {
+            total += __builtin_popcountll(word);
+        }
+        return total;
+    }
+    return cont.array.size();
+}
+
+void IdBitmap::add(aku_ParamId id) {
+    u64 key;
+    u16 low;
+    std::tie(key, low) = split_id(id);
+    auto& cont = containers_[key];
+    if (cont.is_bitset()) {
+        cont.words[low >> 6] |= 1ull << (low & 0x3F);
+        return;
+    }
+    auto it = std::lower_bound(cont.array.begin(), cont.array.end(), low);
+    if (it != cont.array.end() && *it == low) {
+        return;
+    }
+    cont.array.insert(it, low);
+    if (cont.array.size() > ARRAY_CAP) {
+        convert_to_bitset(&cont);
+    }
+}
+
+size_t IdBitmap::cardinality() const {
+    size_t total = 0;
+    for (auto const& kv: containers_) {
+        total += container_cardinality(kv.second);
+    }
+    return total;
+}
+
+std::vector<aku_ParamId> IdBitmap::to_vector() const {
+    std::vector<aku_ParamId> results;
+    results.reserve(cardinality());
+    for (auto const& kv: containers_) {
+        auto base = kv.first << 16;
+        auto const& cont = kv.second;
+        if (cont.is_bitset()) {
+            for (size_t i = 0; i < cont.words.size(); i++) {
+                u64 word = cont.words[i];
+                while (word) {
+                    int bit = __builtin_ctzll(word);
+                    results.push_back(base + (i << 6) + bit);
+                    word &= word - 1;
+                }
+            }
+        } else {
+            for (auto low: cont.array) {
+                results.push_back(base + low);
+            }
+        }
+    }
+    return results;
+}
+
+IdBitmap IdBitmap::intersect(IdBitmap const& lhs, IdBitmap const& rhs) {
+    IdBitmap result;
+    auto lit = lhs.containers_.begin();
+    auto rit = rhs.containers_.begin();
+    while (lit != lhs.containers_.end() && rit != rhs.containers_.end()) {
+        if (lit->first < rit->first) {
+            lit++;
+            continue;
+        }
+        if (rit->first < lit->first) {
+            rit++;
+            continue;
+        }
+        auto const& lc = lit->second;
+        auto const& rc = rit->second;
+        Container out;
+        if (lc.is_bitset() && rc.is_bitset()) {
+            // Word-wide loop, gets vectorized
+            std::vector<u64> words(BITSET_WORDS);
+            bool nonzero = false;
+            for (size_t i = 0; i < BITSET_WORDS; i++) {
+                words[i] = lc.words[i] & rc.words[i];
+                nonzero |= words[i] != 0;
+            }
+            if (nonzero) {
+                out.words = std::move(words);
+            }
+        } else if (!lc.is_bitset() && !rc.is_bitset()) {
+            std::set_intersection(lc.array.begin(), lc.array.end(),
+                                  rc.array.begin(), rc.array.end(),
+                                  std::back_inserter(out.array));
+        } else {
+            // Probe the bitset with the array values
+            auto const& arr = lc.is_bitset() ? rc : lc;
+            auto const& bits = lc.is_bitset() ? lc : rc;
+            for (auto low: arr.array) {
+                if (container_test(bits, low)) {
+                    out.array.push_back(low);
+                }
+            }
+        }
+        if (!out.array.empty() || !out.words.empty()) {
+            result.containers_[lit->first] = std::move(out);
+        }
+        lit++;
+        rit++;
+    }
+    return result;
+}
+
+IdBitmap IdBitmap::unite(IdBitmap const& lhs, IdBitmap const& rhs) {
+    IdBitmap result;
+    auto lit = lhs.containers_.begin();
+    auto rit = rhs.containers_.begin();
+    while (lit != lhs.containers_.end() || rit != rhs.containers_.end()) {
+        if (rit == rhs.containers_.end() ||
+           (lit != lhs.containers_.end() && lit->first < rit->first)) {
+            result.containers_[lit->first] = lit->second;
+            lit++;
+            continue;
+        }
+        if (lit == lhs.containers_.end() || rit->first < lit->first) {
+            result.containers_[rit->first] = rit->second;
+            rit++;
+            continue;
+        }
+        auto const& lc = lit->second;
+        auto const& rc = rit->second;
+        Container out;
+        if (lc.is_bitset() || rc.is_bitset()) {
+            if (lc.is_bitset() && rc.is_bitset()) {
+                // Word-wide loop, gets vectorized
+                out.words.resize(BITSET_WORDS);
+                for (size_t i = 0; i < BITSET_WORDS; i++) {
+                    out.words[i] = lc.words[i] | rc.words[i];
+                }
+            } else {
+                auto const& arr = lc.is_bitset() ? rc : lc;
+                auto const& bits = lc.is_bitset() ? lc : rc;
+                out.words = bits.words;
+                for (auto low: arr.array) {
+                    out.words[low >> 6] |= 1ull << (low & 0x3F);
+                }
+            }
+        } else {
+            std::set_union(lc.array.begin(), lc.array.end(),
+                           rc.array.begin(), rc.array.end(),
+                           std::back_inserter(out.array));
+            if (out.array.size() > ARRAY_CAP) {
+                convert_to_bitset(&out);
+            }
+        }
+        result.containers_[lit->first] = std::move(out);
+        lit++;
+        rit++;
+    }
+    return result;
+}
+
+void TagValueIndex::append(aku_ParamId id, const char* begin, const char* end) {
+    // Series name should be in normal form - metric name followed by
+    // space separated tag=value pairs.
+    auto it = begin;
+    while (it < end) {
+        auto tok_begin = it;
+        while (it < end && *it != ' ') {
+            it++;
+        }
+        if (std::find(tok_begin, it, '=') != it) {
+            table_[std::string(tok_begin, it)].add(id);
+        }
+        while (it < end && *it == ' ') {
+            it++;
+        }
+    }
+}
+
+std::vector<aku_ParamId> TagValueIndex::query(std::vector<std::string> const& tagvalues) const {
+    std::vector<aku_ParamId> results;
+    if (tagvalues.empty()) {
+        return results;
+    }
+    std::vector<const IdBitmap*> bitmaps;
+    for (auto const& tagvalue: tagvalues) {
+        auto it = table_.find(tagvalue);
+        if (it == table_.end()) {
+            // Unknown predicate - nothing can match
+            return results;
+        }
+        bitmaps.push_back(&it->second);
+    }
+    // Start intersection from the smallest bitmap
+    std::sort(bitmaps.begin(), bitmaps.end(), [](const IdBitmap* lhs, const IdBitmap* rhs) {
+        return lhs->cardinality() < rhs->cardinality();
+    });
+    IdBitmap merged = *bitmaps.front();
+    for (size_t i = 1; i < bitmaps.size(); i++) {
+        merged = IdBitmap::intersect(merged, *bitmaps.at(i));
+    }
+    return merged.to_vector();
+}
+
+std::tuple<aku_Status, std::shared_ptr<TagIndexSegment>> TagIndexSegment::open(const char* path) {
+    std::shared_ptr<TagIndexSegment> nullseg;
+    std::unique_ptr<MemoryMappedFile> mmap(new MemoryMappedFile(path, false));
+    if (mmap->is_bad()) {
+        return std::make_tuple(AKU_ENOT_FOUND, nullseg);
+    }
+    if (mmap->get_size() < sizeof(SegmentHeader)) {
+        return std::make_tuple(AKU_EBAD_DATA, nullseg);
+    }
+    auto header = static_cast<const SegmentHeader*>(mmap->get_pointer());
+    if (header->magic != AKU_TAGIX_MAGIC || header->version != AKU_TAGIX_VERSION) {
+        return std::make_tuple(AKU_EBAD_DATA, nullseg);
+    }
+    if (mmap->get_size() < sizeof(SegmentHeader) + header->nkeys*sizeof(DirEntry)) {
+        return std::make_tuple(AKU_EBAD_DATA, nullseg);
+    }
+    auto segment = std::make_shared<TagIndexSegment>();
+    segment->header_ = header;
+    segment->dir_ = reinterpret_cast<const DirEntry*>(
+        static_cast<const char*>(mmap->get_pointer()) + sizeof(SegmentHeader));
+    segment->mmap_ = std::move(mmap);
+    return std::make_tuple(AKU_SUCCESS, segment);
+}
+
+aku_Status TagIndexSegment::write(const char* path, TagValueIndex const& index,
+                                  std::shared_ptr<TagIndexSegment> prev) {
+    // Merge posting lists of the in-memory index with the previous
+    // segment (std::map keeps the directory sorted by key)
+    std::map<std::string, std::vector<u64>> merged;
+    for (auto const& kv: index.table_) {
+        merged[kv.first] = kv.second.to_vector();
+    }
+    if (prev) {
+        auto base = static_cast<const char*>(prev->mmap_->get_pointer());
+        for (u64 i = 0; i < prev->header_->nkeys; i++) {
+            const DirEntry& entry = prev->dir_[i];
+            std::string key(base + entry.key_off, base + entry.key_off + entry.key_len);
+            auto ids = reinterpret_cast<const u64*>(base + entry.post_off);
+            auto& dest = merged[key];
+            std::vector<u64> u;
+            u.reserve(dest.size() + entry.post_len);
+            std::set_union(dest.begin(), dest.end(), ids, ids + entry.post_len,
+                           std::back_inserter(u));
+            dest = std::move(u);
+        }
+    }
+    // Compute the layout - directory, posting lists, then key strings
+    // (both regions that hold u64 values stay 8-byte aligned)
+    u64 nkeys = merged.size();
+    u64 post_off = sizeof(SegmentHeader) + nkeys*sizeof(DirEntry);
+    u64 key_off = post_off;
+    for (auto const& kv: merged) {
+        key_off += kv.second.size()*sizeof(u64);
+    }
+    std::vector<DirEntry> dir;
+    dir.reserve(nkeys);
+    for (auto const& kv: merged) {
+        DirEntry entry;
+        entry.key_off  = key_off;
+        entry.key_len  = kv.first.size();
+        entry.post_off = post_off;
+        entry.post_len = kv.second.size();
+        dir.push_back(entry);
+        post_off += kv.second.size()*sizeof(u64);
+        key_off  += kv.first.size();
+    }
+    SegmentHeader header = {};
+    header.magic   = AKU_TAGIX_MAGIC;
+    header.version = AKU_TAGIX_VERSION;
+    header.nkeys   = nkeys;
+    for (auto const& kv: merged) {
+        if (!kv.second.empty()) {
+            header.max_id = std::max(header.max_id, kv.second.back());
+        }
+    }
+    // Write to a temporary file first so a crash can't leave a half
+    // written segment behind
+    std::string tmppath = std::string(path) + ".tmp";
+    std::FILE* file = std::fopen(tmppath.c_str(), "wb");
+    if (file == nullptr) {
+        return AKU_EGENERAL;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!dir.empty()) {
+        ok = ok && std::fwrite(dir.data(), sizeof(DirEntry), dir.size(), file) == dir.size();
+    }
+    for (auto const& kv: merged) {
+        if (!kv.second.empty()) {
+            ok = ok && std::fwrite(kv.second.data(), sizeof(u64), kv.second.size(), file)
+                       == kv.second.size();
+        }
+    }
+    for (auto const& kv: merged) {
+        if (!kv.first.empty()) {
+            ok = ok && std::fwrite(kv.first.data(), 1, kv.first.size(), file) == kv.first.size();
+        }
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmppath.c_str(), path) != 0) {
+        std::remove(tmppath.c_str());
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+std::tuple<const u64*, size_t> TagIndexSegment::find(std::string const& key) const {
+    auto base = static_cast<const char*>(mmap_->get_pointer());
+    u64 begin = 0;
+    u64 end = header_->nkeys;
+    while (begin < end) {
+        u64 mid = begin + (end - begin)/2;
+        const DirEntry& entry = dir_[mid];
+        size_t n = std::min(static_cast<size_t>(entry.key_len), key.size());
+        int cmp = std::memcmp(base + entry.key_off, key.data(), n);
+        if (cmp == 0 && entry.key_len != key.size()) {
+            cmp = entry.key_len < key.size() ? -1 : 1;
+        }
+        if (cmp < 0) {
+            begin = mid + 1;
+        } else if (cmp > 0) {
+            end = mid;
+        } else {
+            auto ids = reinterpret_cast<const u64*>(base + entry.post_off);
+            return std::make_tuple(ids, static_cast<size_t>(entry.post_len));
+        }
+    }
+    return std::make_tuple(nullptr, 0ul);
+}
+
+std::vector<aku_ParamId> TagIndexSegment::query(std::vector<std::string> const& tagvalues) const {
+    std::vector<aku_ParamId> results;
+    if (tagvalues.empty()) {
+        return results;
+    }
+    bool first = true;
+    for (auto const& tagvalue: tagvalues) {
+        const u64* ids;
+        size_t n;
+        std::tie(ids, n) = find(tagvalue);
+        if (ids == nullptr) {
+            // Unknown predicate - nothing can match
+            results.clear();
+            return results;
+        }
+        if (first) {
+            results.assign(ids, ids + n);
+            first = false;
+        } else {
+            std::vector<aku_ParamId> tmp;
+            std::set_intersection(results.begin(), results.end(), ids, ids + n,
+                                  std::back_inserter(tmp));
+            results = std::move(tmp);
+        }
+    }
+    return results;
+}
+
 }  // namespace
@@ -17,8 +17,12 @@
 #pragma once
 #include "akumuli.h"
 #include "hashfnfamily.h"
+#include "util.h"
 
+#include <map>
 #include <memory>
+#include <string>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
@@ -34,6 +38,9 @@ struct TwoUnivHashFnFamily {
     TwoUnivHashFnFamily(int cardinality, size_t modulo);
 
     u64 hash(int ix, u64 value) const;
+
+    //! Calculate hashes for a batch of values (coefficients stay in registers)
+    void hash(int ix, const u64* values, u64* results, size_t n) const;
 };
 
 /** Posting list.
@@ -74,4 +81,133 @@ struct InvertedIndex {
     std::vector<std::pair<aku_ParamId, size_t>> get_count(const char* begin, const char* end);
 };
 
+
+/** Roaring-style compressed bitmap of series ids.
+  * Ids are split into 64K-id containers keyed by the upper bits of the id.
+  * Sparse containers store sorted arrays of the lower 16 bits and get
+  * converted to plain bitsets when they become dense, so the footprint is
+  * two bytes per id in the worst case and one bit per id in dense ranges.
+  * Intersection and union work directly on the container representation -
+  * the bitset paths are word-wide loops that the compiler vectorizes.
+  */
+struct IdBitmap {
+    enum {
+        //! Array container is converted to a bitset when it outgrows this
+        ARRAY_CAP    = 0x1000,
+        //! Number of 64-bit words in a bitset container
+        BITSET_WORDS = 0x400,
+    };
+
+    //! Single 64K-id container
+    struct Container {
+        //! Sorted unique low 16-bit values (emptied on bitset conversion)
+        std::vector<u16> array;
+        //! Bitset representation (empty until the array outgrows ARRAY_CAP)
+        std::vector<u64> words;
+
+        bool is_bitset() const { return !words.empty(); }
+    };
+
+    //! Containers keyed by the upper bits of the id
+    std::map<u64, Container> containers_;
+
+    //! Add id to the set (idempotent)
+    void add(aku_ParamId id);
+
+    //! Number of ids in the set
+    size_t cardinality() const;
+
+    //! Return all ids in ascending order
+    std::vector<aku_ParamId> to_vector() const;
+
+    //! Compute intersection of two sets
+    static IdBitmap intersect(IdBitmap const& lhs, IdBitmap const& rhs);
+
+    //! Compute union of two sets
+    static IdBitmap unite(IdBitmap const& lhs, IdBitmap const& rhs);
+};
+
+
+/** Inverted index from tag=value pairs to series ids.
+  * Unlike `InvertedIndex` the results are exact - every tag=value pair gets
+  * its own posting list stored as a compressed bitmap, so conjunctions of
+  * predicates are computed with bitmap intersections.
+  */
+struct TagValueIndex {
+    //! Tag=value pair to posting list mapping.
+    std::unordered_map<std::string, IdBitmap> table_;
+
+    /** Index all tag=value pairs of the series name.
+      * @param id series id
+      * @param begin normalized series name (metric followed by tag=value pairs)
+      * @param end end of the series name
+      */
+    void append(aku_ParamId id, const char* begin, const char* end);
+
+    /** Find ids of series that have all the specified tag=value pairs.
+      * @param tagvalues list of tag=value predicates
+      * @return sorted list of matched series ids (empty if any predicate is unknown)
+      */
+    std::vector<aku_ParamId> query(std::vector<std::string> const& tagvalues) const;
+};
+
+
+/** Immutable on-disk segment of the tag=value index.
+  * The segment is a single memory-mapped file: a header, a directory of
+  * keys sorted lexicographically and a blob region with posting lists
+  * (sorted series ids) followed by the key strings. `open` only maps the
+  * file - the directory is binary-searched per predicate and posting
+  * lists fault in on demand, so the daemon can answer metadata queries
+  * right after restart instead of rebuilding the whole index from sqlite.
+  * Segments are merged LSM-style: the in-memory index accumulates the
+  * series created since the last save and `write` folds it together with
+  * the previous segment into a new file.
+  */
+struct TagIndexSegment {
+    enum {
+        AKU_TAGIX_MAGIC   = 0x58494741,  // "AGIX"
+        AKU_TAGIX_VERSION = 1,
+    };
+
+    //! File header
+    struct SegmentHeader {
+        u32 magic;
+        u32 version;
+        u64 nkeys;
+        //! Largest series id in the segment. Ids grow monotonically so the
+        //! loader only re-indexes the series created after the last save.
+        u64 max_id;
+    };
+
+    //! Directory entry (offsets are relative to the start of the file)
+    struct DirEntry {
+        u64 key_off;   //< Offset of the key string
+        u64 key_len;   //< Length of the key string
+        u64 post_off;  //< Offset of the posting list (8-byte aligned)
+        u64 post_len;  //< Number of ids in the posting list
+    };
+
+    std::unique_ptr<MemoryMappedFile> mmap_;
+    const SegmentHeader*              header_;
+    const DirEntry*                   dir_;
+
+    /** Open existing segment. Only the mapping is created here, the
+      * content is faulted in lazily by the OS.
+      * @return status and segment (null on error)
+      */
+    static std::tuple<aku_Status, std::shared_ptr<TagIndexSegment>> open(const char* path);
+
+    /** Write new segment to disk. Posting lists of the in-memory index
+      * are merged with the content of the previous segment (can be null).
+      */
+    static aku_Status write(const char* path, TagValueIndex const& index,
+                            std::shared_ptr<TagIndexSegment> prev);
+
+    //! Find posting list of the key (null and zero if the key is unknown)
+    std::tuple<const u64*, size_t> find(std::string const& key) const;
+
+    //! Same query semantics as `TagValueIndex::query`
+    std::vector<aku_ParamId> query(std::vector<std::string> const& tagvalues) const;
+};
+
 }  // namespace
@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latency_histogram.h"
+
+namespace Akumuli {
+
+//! Index of the bucket that holds `value`
+static u32 bucket_ix(u64 value) {
+    if (value < LatencyHistogram::NSUB) {
+        // Small values are mapped one to one
+        return static_cast<u32>(value);
+    }
+    u32 exp = 63u - static_cast<u32>(__builtin_clzll(value));
+    u32 sub = static_cast<u32>(value >> (exp - LatencyHistogram::SUB_BITS)) & (LatencyHistogram::NSUB - 1);
+    return (exp - LatencyHistogram::SUB_BITS + 1)*LatencyHistogram::NSUB + sub;
+}
+
+//! Smallest value that falls into the bucket (inverse of `bucket_ix`)
+static u64 bucket_lower_bound(u32 ix) {
+    if (ix < LatencyHistogram::NSUB) {
+        return ix;
+    }
+    u32 exp = ix/LatencyHistogram::NSUB + LatencyHistogram::SUB_BITS - 1;
+    u64 sub = ix % LatencyHistogram::NSUB;
+    return (1ull << exp) | (sub << (exp - LatencyHistogram::SUB_BITS));
+}
+
+//! Stripe of the calling thread (threads are spread round-robin)
+static u32 stripe_ix() {
+    static std::atomic<u32> counter {0};
+    static thread_local u32 ix = counter.fetch_add(1u) & (LatencyHistogram::NSTRIPES - 1);
+    return ix;
+}
+
+static std::vector<LatencyHistogram*>& mutable_registry() {
+    static std::vector<LatencyHistogram*> registry;
+    return registry;
+}
+
+LatencyHistogram::LatencyHistogram(const char* name)
+    : name_(name)
+{
+    for (auto& stripe: stripes_) {
+        for (auto& count: stripe.counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+    // Histograms are global statics so the constructors run before `main`
+    // and the registry doesn't need to be synchronized
+    mutable_registry().push_back(this);
+}
+
+void LatencyHistogram::add(u64 nanoseconds) {
+    auto& stripe = stripes_[stripe_ix()];
+    stripe.counts[bucket_ix(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<u64> LatencyHistogram::merge() const {
+    std::vector<u64> counts(NBUCKETS, 0ull);
+    for (auto const& stripe: stripes_) {
+        for (u32 ix = 0; ix < NBUCKETS; ix++) {
+            counts[ix] += stripe.counts[ix].load(std::memory_order_relaxed);
+        }
+    }
+    return counts;
+}
+
+u64 LatencyHistogram::percentile(std::vector<u64> const& counts, double p) {
+    u64 total = 0;
+    for (auto count: counts) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    u64 rank = static_cast<u64>(static_cast<double>(total - 1)*p);
+    u64 seen = 0;
+    for (u32 ix = 0; ix < counts.size(); ix++) {
+        seen += counts[ix];
+        if (seen > rank) {
+            return bucket_lower_bound(ix);
+        }
+    }
+    return bucket_lower_bound(static_cast<u32>(counts.size()) - 1);
+}
+
+std::vector<LatencyHistogram*> const& LatencyHistogram::registry() {
+    return mutable_registry();
+}
+
+}  // namespace
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+/** Low overhead HDR-style latency histogram for the hot paths.
+  * Durations (in nanoseconds) are mapped to log-scale buckets with three
+  * mantissa bits so the relative error is bounded by 12.5%. Writers only
+  * do a relaxed increment of an atomic counter in one of the per-thread
+  * stripes - no locks and no shared cache lines on the write side. The
+  * stripes are merged when the histogram is read (through the `/stats`
+  * endpoint), the merge is weakly consistent under concurrent writes.
+  * Histograms are expected to be static and register themselves on
+  * construction so the stats exporter can enumerate them.
+  */
+struct LatencyHistogram {
+    enum {
+        SUB_BITS = 3,             //< Mantissa bits per power of two
+        NSUB     = 1 << SUB_BITS,
+        NBUCKETS = 64 * NSUB,
+        NSTRIPES = 8,             //< Power of two
+    };
+
+    //! Cache-line aligned bucket counters (one stripe per group of threads)
+    struct alignas(64) Stripe { std::atomic<u64> counts[NBUCKETS]; };
+
+    const char* name_;
+    Stripe      stripes_[NSTRIPES];
+
+    LatencyHistogram(const char* name);
+
+    //! Record one duration (in nanoseconds)
+    void add(u64 nanoseconds);
+
+    //! Merge the stripes into a single array of bucket counters
+    std::vector<u64> merge() const;
+
+    //! Lower bound (in nanoseconds) of the bucket that holds the p-th
+    //! percentile of the merged counters, 0 if the histogram is empty
+    static u64 percentile(std::vector<u64> const& counts, double p);
+
+    //! All histograms created by the process
+    static std::vector<LatencyHistogram*> const& registry();
+};
+
+//! Records the time between construction and destruction
+struct LatencyTimer {
+    LatencyHistogram&                     hist_;
+    std::chrono::steady_clock::time_point begin_;
+
+    LatencyTimer(LatencyHistogram& hist)
+        : hist_(hist)
+        , begin_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~LatencyTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - begin_;
+        hist_.add(static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+};
+
+}  // namespace
@@ -19,6 +19,10 @@
 #include "util.h"
 #include "log_iface.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
 #include <sstream>
 
 #include <boost/lexical_cast.hpp>
@@ -52,10 +56,12 @@ static void callback_adapter(void*, const char* msg) {
     Logger::msg(AKU_LOG_TRACE, msg);
 }
 
-MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t)
+MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t, u32 sync_policy)
     : pool_(nullptr, &delete_apr_pool)
     , driver_(nullptr)
     , handle_(nullptr, AprHandleDeleter(nullptr))
+    , writing_(false)
+    , done_(false)
 {
     apr_pool_t *pool = nullptr;
     auto status = apr_pool_create(&pool, NULL);
@@ -82,6 +88,21 @@ MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t)
     auto sqlite_handle = apr_dbd_native_handle(driver_, handle);
     sqlite3_trace(static_cast<sqlite3*>(sqlite_handle), callback_adapter, nullptr);
 
+    // Switch to WAL mode, checkpoints are driven by the dedicated thread
+    select_query("PRAGMA journal_mode=WAL;");
+    switch (sync_policy) {
+    case AKU_METADATA_SYNC_OFF:
+        execute_query("PRAGMA synchronous=OFF;");
+        break;
+    case AKU_METADATA_SYNC_FULL:
+        execute_query("PRAGMA synchronous=FULL;");
+        break;
+    default:
+        execute_query("PRAGMA synchronous=NORMAL;");
+        break;
+    }
+    execute_query("PRAGMA wal_autocheckpoint=0;");
+
     create_tables();
 
     // Create prepared statement
@@ -91,6 +112,45 @@ MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t)
         Logger::msg(AKU_LOG_ERROR, "Error creating prepared statement");
         AKU_PANIC(apr_dbd_error(driver_, handle_.get(), status));
     }
+
+    // Open the tag index segment saved on the previous shutdown, the
+    // content faults in on demand (not used for in-memory databases)
+    if (std::strcmp(db, ":memory:") != 0) {
+        segment_path_ = std::string(db) + ".tagix";
+        aku_Status segstatus;
+        std::tie(segstatus, tag_segment_) = TagIndexSegment::open(segment_path_.c_str());
+        if (segstatus != AKU_SUCCESS && segstatus != AKU_ENOT_FOUND) {
+            Logger::msg(AKU_LOG_ERROR, "Tag index segment is damaged, the index will be rebuilt");
+        }
+    }
+
+    // Start background writer and checkpointer
+    worker_ = std::thread(&MetadataStorage::worker_loop, this);
+    checkpointer_ = std::thread(&MetadataStorage::checkpoint_loop, this);
+}
+
+MetadataStorage::~MetadataStorage() {
+    {
+        std::lock_guard<std::mutex> guard(sync_lock_);
+        done_ = true;
+    }
+    sync_cvar_.notify_all();
+    worker_.join();
+    checkpointer_.join();
+    try {
+        // Final checkpoint, moves everything from the WAL to the db file
+        select_query("PRAGMA wal_checkpoint(TRUNCATE);");
+    } catch (...) {
+        Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
+    }
+    if (!segment_path_.empty()) {
+        // Fold the series created since the last save together with the
+        // old segment into a new one
+        auto status = TagIndexSegment::write(segment_path_.c_str(), tag_index_, tag_segment_);
+        if (status != AKU_SUCCESS) {
+            Logger::msg(AKU_LOG_ERROR, "Can't save tag index segment");
+        }
+    }
 }
 
 int MetadataStorage::execute_query(std::string query) {
@@ -132,6 +192,14 @@ void MetadataStorage::create_tables() {
             "storage_id INTEGER UNIQUE"
             ");";
     execute_query(query);
+
+    // Per-series hints, only the series with non-default settings have a row
+    query =
+            "CREATE TABLE IF NOT EXISTS akumuli_series_hints("
+            "storage_id INTEGER PRIMARY KEY UNIQUE,"
+            "value_type INTEGER"
+            ");";
+    execute_query(query);
 }
 
 void MetadataStorage::init_config(const char* creation_datetime)
@@ -181,6 +249,8 @@ void MetadataStorage::init_volumes(std::vector<VolumeDesc> volumes) {
 
 
 std::vector<MetadataStorage::UntypedTuple> MetadataStorage::select_query(const char* query) const {
+    std::lock_guard<std::mutex> guard(db_lock_);
+    AKU_UNUSED(guard);
     std::vector<UntypedTuple> tuples;
     apr_dbd_results_t *results = nullptr;
     int status = apr_dbd_select(driver_, pool_.get(), handle_.get(), &results, query, 0);
@@ -271,40 +341,124 @@ void MetadataStorage::insert_new_names(std::vector<MetadataStorage::SeriesT> ite
         return;
     }
 
-    execute_query("BEGIN TRANSACTION;");
+    // Maintain the inverted index
+    for (auto item: items) {
+        auto name = std::get<0>(item);
+        tag_index_.append(std::get<2>(item), name, name + std::get<1>(item));
+    }
 
-    // Write all data
-    while(!items.empty()) {
-        const size_t batchsize = 100;
-        const size_t newsize = items.size() > batchsize ? items.size() - batchsize : 0;
-        std::vector<MetadataStorage::SeriesT> batch(items.begin() + newsize, items.end());
-        items.resize(newsize);
-        std::stringstream query;
-        query << "INSERT INTO akumuli_series (series_id, keyslist, storage_id)" << std::endl;
-        bool first = true;
-        for (auto item: batch) {
+    // Names are copied to the queue because the caller owns the pointers,
+    // sqlite write is performed by the background thread.
+    {
+        std::lock_guard<std::mutex> guard(sync_lock_);
+        AKU_UNUSED(guard);
+        for (auto item: items) {
             LightweightString name, keys;
-            auto stid = std::get<2>(item);
             if (split_series(std::get<0>(item), std::get<1>(item), &name, &keys)) {
-                if (first) {
-                    query << "\tSELECT '" << name << "' as series_id, '"
-                                          << keys << "' as keyslist, "
-                                          << stid << "  as storage_id"
-                                          << std::endl;
-                    first = false;
-                } else {
-                    query << "\tUNION "
-                          <<   "SELECT '" << name << "', '"
-                                          << keys << "', "
-                                          << stid
-                                          << std::endl;
-                }
+                pending_.emplace_back(std::string(name.str, name.str + name.len),
+                                      std::string(keys.str, keys.str + keys.len),
+                                      std::get<2>(item));
             }
         }
-        std::string full_query = query.str();
-        execute_query(full_query);
     }
+    sync_cvar_.notify_all();
+}
 
+void MetadataStorage::set_value_type_hint(u64 storage_id, int value_type) {
+    std::stringstream query;
+    query << "INSERT OR REPLACE INTO akumuli_series_hints (storage_id, value_type) "
+          << "VALUES (" << storage_id << ", " << value_type << ");";
+    std::lock_guard<std::mutex> guard(db_lock_);
+    AKU_UNUSED(guard);
+    execute_query(query.str());
+}
+
+std::unordered_map<u64, int> MetadataStorage::get_value_type_hints() const {
+    const char* query =
+            "SELECT storage_id, value_type FROM akumuli_series_hints;";
+    std::unordered_map<u64, int> result;
+    std::vector<UntypedTuple> untyped = select_query(query);
+    for (auto const& tup: untyped) {
+        auto id = boost::lexical_cast<u64>(tup.at(0));
+        auto vt = boost::lexical_cast<int>(tup.at(1));
+        result[id] = vt;
+    }
+    return result;
+}
+
+void MetadataStorage::force_sync() {
+    std::unique_lock<std::mutex> lock(sync_lock_);
+    sync_cvar_.wait(lock, [this]() { return pending_.empty() && !writing_; });
+}
+
+void MetadataStorage::worker_loop() {
+    while (true) {
+        std::vector<PendingT> batch;
+        {
+            std::unique_lock<std::mutex> lock(sync_lock_);
+            sync_cvar_.wait(lock, [this]() { return !pending_.empty() || done_; });
+            if (pending_.empty() && done_) {
+                return;
+            }
+            std::swap(batch, pending_);
+            writing_ = true;
+        }
+        try {
+            run_insert(batch);
+        } catch (...) {
+            // Can't rethrow from the background thread
+            Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
+        }
+        {
+            std::lock_guard<std::mutex> guard(sync_lock_);
+            AKU_UNUSED(guard);
+            writing_ = false;
+        }
+        // Wake up `force_sync` callers
+        sync_cvar_.notify_all();
+    }
+}
+
+void MetadataStorage::checkpoint_loop() {
+    std::unique_lock<std::mutex> lock(sync_lock_);
+    while (!done_) {
+        // Checkpoint at most once a second, off the data path
+        sync_cvar_.wait_for(lock, std::chrono::seconds(1));
+        if (done_) {
+            break;
+        }
+        lock.unlock();
+        try {
+            select_query("PRAGMA wal_checkpoint(PASSIVE);");
+        } catch (...) {
+            Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
+        }
+        lock.lock();
+    }
+}
+
+void MetadataStorage::run_insert(std::vector<MetadataStorage::PendingT> const& batch) {
+    std::lock_guard<std::mutex> guard(db_lock_);
+    AKU_UNUSED(guard);
+    execute_query("BEGIN TRANSACTION;");
+    try {
+        for (auto const& item: batch) {
+            auto stid = boost::lexical_cast<std::string>(std::get<2>(item));
+            int nrows = -1;
+            int status = apr_dbd_pvquery(driver_, pool_.get(), handle_.get(), &nrows, insert_,
+                                         std::get<0>(item).c_str(),
+                                         std::get<1>(item).c_str(),
+                                         stid.c_str(),
+                                         nullptr);
+            if (status != 0) {
+                Logger::msg(AKU_LOG_ERROR, "Error executing prepared statement");
+                AKU_PANIC(apr_dbd_error(driver_, handle_.get(), status));
+            }
+        }
+    } catch (...) {
+        execute_query("ROLLBACK;");
+        throw;
+    }
     execute_query("END TRANSACTION;");
 }
 
@@ -340,6 +494,10 @@ aku_Status MetadataStorage::load_matcher_data(SeriesMatcher& matcher) {
             auto series = row.at(0);
             auto id = boost::lexical_cast<u64>(row.at(1));
             matcher._add(series, id);
+            if (!tag_segment_ || id > tag_segment_->header_->max_id) {
+                // Series covered by the on-disk segment aren't re-indexed
+                tag_index_.append(id, series.data(), series.data() + series.size());
+            }
         }
     } catch(...) {
         Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
@@ -348,4 +506,21 @@ aku_Status MetadataStorage::load_matcher_data(SeriesMatcher& matcher) {
     return AKU_SUCCESS;
 }
 
+std::vector<aku_ParamId> MetadataStorage::get_series_by_tags(std::vector<std::string> const& tagvalues) const {
+    auto results = tag_index_.query(tagvalues);
+    if (tag_segment_) {
+        // Every series lives in exactly one of the indexes so the results
+        // can be simply combined
+        auto saved = tag_segment_->query(tagvalues);
+        if (!saved.empty()) {
+            std::vector<aku_ParamId> combined;
+            combined.reserve(results.size() + saved.size());
+            std::set_union(results.begin(), results.end(), saved.begin(), saved.end(),
+                           std::back_inserter(combined));
+            results = std::move(combined);
+        }
+    }
+    return results;
+}
+
 }
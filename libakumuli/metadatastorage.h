@@ -15,8 +15,12 @@
  */
 
 #pragma once
+#include <condition_variable>
 #include <cstddef>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <apr.h>
@@ -24,6 +28,7 @@
 
 #include "akumuli.h"
 #include "akumuli_def.h"
+#include "invertedindex.h"
 #include "seriesparser.h"
 
 namespace Akumuli {
@@ -44,6 +49,11 @@ struct AprHandleDeleter {
   * - Volumes list
   * - Conviguration data
   * - Key to id mapping
+  *
+  * New series names are written by a background thread so ingestion is
+  * never blocked by sqlite. Writes are acknowledged as soon as they're
+  * enqueued (the in-memory `SeriesMatcher` is updated by the caller
+  * beforehand), the queue is drained on destruction.
   */
 struct MetadataStorage {
     // Typedefs
@@ -52,17 +62,40 @@ struct MetadataStorage {
     typedef std::unique_ptr<apr_dbd_t, AprHandleDeleter> HandleT;
     typedef std::pair<int, std::string>                  VolumeDesc;
     typedef apr_dbd_prepared_t* PreparedT;
+    //! Queued series name (series id, keys list, storage id)
+    typedef std::tuple<std::string, std::string, u64> PendingT;
 
     // Members
     PoolT           pool_;
     DriverT         driver_;
     HandleT         handle_;
     PreparedT       insert_;
+    TagValueIndex   tag_index_;  //! In-memory tag=value to series id index
+    std::shared_ptr<TagIndexSegment> tag_segment_;  //! Last saved index segment (null if none)
+    std::string     segment_path_;  //! Path of the segment file (empty for in-memory db)
+
+    // Background writer
+    mutable std::mutex      db_lock_;    //! Protects the dbd handle
+    std::mutex              sync_lock_;  //! Protects the write queue
+    std::condition_variable sync_cvar_;
+    std::vector<PendingT>   pending_;
+    bool                    writing_;    //! Batch is being written right now
+    bool                    done_;
+    std::thread             worker_;
+    std::thread             checkpointer_;
 
     /** Create new or open existing db.
+      * Database is opened in WAL mode, checkpoints are performed by a
+      * dedicated thread so sqlite fsyncs never interleave with volume
+      * fsyncs on the data path.
+      * @param sync_policy one of the AKU_METADATA_SYNC_* values
       * @throw std::runtime_error in a case of error
       */
-    MetadataStorage(const char* db, aku_logger_cb_t logger=nullptr);
+    MetadataStorage(const char* db, aku_logger_cb_t logger=nullptr,
+                    u32 sync_policy=AKU_METADATA_SYNC_NORMAL);
+
+    //! D-tor, drains the write queue and stops the background thread.
+    ~MetadataStorage();
 
     // Creation //
 
@@ -92,15 +125,49 @@ struct MetadataStorage {
 
     aku_Status load_matcher_data(SeriesMatcher& matcher);
 
+    /** Find ids of series that have all the specified tag=value pairs.
+      * Served from the in-memory inverted index and the memory-mapped
+      * index segment, doesn't touch sqlite. After restart the segment
+      * covers all the series saved on the previous shutdown so only the
+      * ones created since then are re-indexed in memory.
+      */
+    std::vector<aku_ParamId> get_series_by_tags(std::vector<std::string> const& tagvalues) const;
+
     // Writing //
 
     typedef std::tuple<const char*, int, u64> SeriesT;
 
     /** Add new series to the metadata storage.
+      * Names are copied into the write queue, the sqlite insert is
+      * performed by the background thread.
       */
     void insert_new_names(std::vector<SeriesT> items);
 
+    /** Register per-series value-type hint. `value_type` is one of the
+      * `DataBlockValCodec` values - series that store integers (latency
+      * in microseconds etc) should be registered with VAL_CODEC_FIXED so
+      * the storage engine uses the integer codec path for their blocks.
+      */
+    void set_value_type_hint(u64 storage_id, int value_type);
+
+    //! Read all value-type hints (storage id -> `DataBlockValCodec` value).
+    std::unordered_map<u64, int> get_value_type_hints() const;
+
+    //! Wait until the write queue is empty.
+    void force_sync();
+
 private:
+    //! Background thread main loop.
+    void worker_loop();
+
+    //! Checkpoint thread main loop, moves WAL content to the main db file.
+    void checkpoint_loop();
+
+    /** Insert batch using the prepared statement (single transaction).
+      * Called from the background thread only.
+      */
+    void run_insert(std::vector<PendingT> const& batch);
+
     /** Execute query that doesn't return anything.
       * @throw std::runtime_error in a case of error
       * @return number of rows changed
@@ -18,10 +18,14 @@
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <future>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <apr_time.h>
 #include "timsort.hpp"
 #include "page.h"
+#include "blob_compression.h"
 #include "storage_engine/compression.h"
 #include "akumuli_def.h"
 #include "search.h"
@@ -31,6 +35,10 @@
 #include <iostream>
 #include <boost/crc.hpp>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 
 namespace Akumuli {
 
@@ -130,6 +138,8 @@ void PageHeader::reuse() {
     count = 0;
     open_count++;
     next_offset = 0;
+    // Page content is gone so the cached dictionary is stale
+    BlobDictCache::instance().remove(page_id);
 }
 
 void PageHeader::close() {
@@ -151,23 +161,47 @@ aku_Status PageHeader::add_entry( const aku_ParamId param
                               + range.length                   // data size (in bytes)
                               + sizeof(aku_EntryIndexRecord);  // offset inside page_index
 
-    const auto ENTRY_SIZE = sizeof(aku_Entry) + range.length;
-
     if (!range.length) {
         return AKU_EBAD_DATA;
     }
     if (SPACE_REQUIRED > get_free_space()) {
         return AKU_EOVERFLOW;
     }
+
+    // Blob payloads (everything except the chunk descriptors) go through
+    // the page dictionary - string events repeat the same fragments so
+    // they pack well against the payloads stored earlier.
+    const void* data = range.address;
+    u32 stored_length = range.length;
+    u32 length_field = range.length;
+    std::vector<u8> packed;
+    std::shared_ptr<BlobDictionary> dict;
+    if (param != AKU_CHUNK_FWD_ID && param != AKU_CHUNK_BWD_ID) {
+        dict = get_blob_dict_();
+        if (dict->encode(static_cast<const u8*>(range.address), range.length, &packed)) {
+            data = packed.data();
+            stored_length = static_cast<u32>(packed.size());
+            length_field = stored_length | AKU_ENTRY_DICT_FLAG;
+        }
+    }
+
+    const auto ENTRY_SIZE = sizeof(aku_Entry) + stored_length;
     char* free_slot = payload + next_offset;
     aku_Entry* entry = reinterpret_cast<aku_Entry*>(free_slot);
     entry->param_id = param;
-    entry->length = range.length;
-    memcpy((void*)&entry->value, range.address, range.length);
+    entry->length = length_field;
+    memcpy((void*)&entry->value, data, stored_length);
     page_index(count)->offset = next_offset;
     page_index(count)->timestamp = timestamp;
     next_offset += ENTRY_SIZE;
     count++;
+    if (dict) {
+        // Feed the raw payload to the dictionary so the next entries can
+        // reference it. This happens after the entry is stored - decoding
+        // uses the dictionary state the entry was encoded with.
+        auto begin = static_cast<const u8*>(range.address);
+        dict->append(begin, begin + range.length);
+    }
     return AKU_SUCCESS;
 }
 
@@ -268,9 +302,19 @@ const void* PageHeader::read_entry_data(u32 offset) const {
     return payload + offset;
 }
 
+//! Logical (decompressed) length of a dictionary-compressed entry
+static u32 blob_entry_orig_length(const aku_Entry* entry) {
+    u32 length;
+    memcpy(&length, entry->value, sizeof(length));
+    return length;
+}
+
 int PageHeader::get_entry_length_at(int entry_index) const {
     auto entry_ptr = read_entry_at(entry_index);
     if (entry_ptr) {
+        if (entry_ptr->length & AKU_ENTRY_DICT_FLAG) {
+            return blob_entry_orig_length(entry_ptr);
+        }
         return entry_ptr->length;
     }
     return 0;
@@ -279,14 +323,69 @@ int PageHeader::get_entry_length_at(int entry_index) const {
 int PageHeader::get_entry_length(u32 offset) const {
     auto entry_ptr = read_entry(offset);
     if (entry_ptr) {
+        if (entry_ptr->length & AKU_ENTRY_DICT_FLAG) {
+            return blob_entry_orig_length(entry_ptr);
+        }
         return entry_ptr->length;
     }
     return 0;
 }
 
+std::shared_ptr<BlobDictionary> PageHeader::get_blob_dict_() const {
+    auto rebuild = [this](BlobDictionary* dict) {
+        // The dictionary is a function of the page content - replay the
+        // payloads in index order (the order they were stored in).
+        for (u32 i = 0; i < count; i++) {
+            auto entry = read_entry_at(i);
+            if (entry == nullptr ||
+                entry->param_id == AKU_CHUNK_FWD_ID ||
+                entry->param_id == AKU_CHUNK_BWD_ID)
+            {
+                continue;
+            }
+            if (entry->length & AKU_ENTRY_DICT_FLAG) {
+                std::vector<u8> raw;
+                auto size = entry->length & ~AKU_ENTRY_DICT_FLAG;
+                auto status = dict->decode(reinterpret_cast<const u8*>(entry->value), size, &raw);
+                if (status != AKU_SUCCESS) {
+                    // Entry is corrupted, dictionary state is unusable
+                    // beyond this point
+                    break;
+                }
+                dict->append(raw.data(), raw.data() + raw.size());
+            } else {
+                auto begin = reinterpret_cast<const u8*>(entry->value);
+                dict->append(begin, begin + entry->length);
+            }
+        }
+    };
+    return BlobDictCache::instance().get(page_id, rebuild);
+}
+
+int PageHeader::copy_blob_entry_(const aku_Entry* entry, aku_Entry* receiver) const {
+    auto orig_length = blob_entry_orig_length(entry);
+    if (orig_length > receiver->length) {
+        return -1*static_cast<int>(orig_length);
+    }
+    auto dict = get_blob_dict_();
+    std::vector<u8> raw;
+    auto size = entry->length & ~AKU_ENTRY_DICT_FLAG;
+    auto status = dict->decode(reinterpret_cast<const u8*>(entry->value), size, &raw);
+    if (status != AKU_SUCCESS) {
+        return 0;
+    }
+    receiver->param_id = entry->param_id;
+    receiver->length = orig_length;
+    memcpy((void*)&receiver->value, raw.data(), raw.size());
+    return static_cast<int>(orig_length);
+}
+
 int PageHeader::copy_entry_at(int index, aku_Entry *receiver) const {
     auto entry_ptr = read_entry_at(index);
     if (entry_ptr) {
+        if (entry_ptr->length & AKU_ENTRY_DICT_FLAG) {
+            return copy_blob_entry_(entry_ptr, receiver);
+        }
         size_t size = entry_ptr->length + sizeof(aku_Entry);
         if (entry_ptr->length > receiver->length) {
             return -1*entry_ptr->length;
@@ -300,6 +399,9 @@ int PageHeader::copy_entry_at(int index, aku_Entry *receiver) const {
 int PageHeader::copy_entry(u32 offset, aku_Entry *receiver) const {
     auto entry_ptr = read_entry(offset);
     if (entry_ptr) {
+        if (entry_ptr->length & AKU_ENTRY_DICT_FLAG) {
+            return copy_blob_entry_(entry_ptr, receiver);
+        }
         if (entry_ptr->length > receiver->length) {
             return -1*entry_ptr->length;
         }
@@ -314,6 +416,79 @@ SearchStats& get_global_search_stats() {
     return stats;
 }
 
+void SearchStats::copy_to(aku_SearchStats* dest, bool reset) {
+    memset(reinterpret_cast<void*>(dest), 0, sizeof(aku_SearchStats));
+    auto fold = [reset](StripedCounter& counter, u64* out) {
+        *out = counter.sum();
+        if (reset) {
+            counter.reset();
+        }
+    };
+    fold(istats.n_times,               &dest->istats.n_times);
+    fold(istats.n_steps,               &dest->istats.n_steps);
+    fold(istats.n_overshoots,          &dest->istats.n_overshoots);
+    fold(istats.n_undershoots,         &dest->istats.n_undershoots);
+    fold(istats.n_matches,             &dest->istats.n_matches);
+    fold(istats.n_reduced_to_one_page, &dest->istats.n_reduced_to_one_page);
+    fold(istats.n_page_in_core_checks, &dest->istats.n_page_in_core_checks);
+    fold(istats.n_page_in_core_errors, &dest->istats.n_page_in_core_errors);
+    fold(istats.n_pages_in_core_found, &dest->istats.n_pages_in_core_found);
+    fold(istats.n_pages_in_core_miss,  &dest->istats.n_pages_in_core_miss);
+    fold(bstats.n_times,               &dest->bstats.n_times);
+    fold(bstats.n_steps,               &dest->bstats.n_steps);
+    fold(scan.fwd_bytes,               &dest->scan.fwd_bytes);
+    fold(scan.bwd_bytes,               &dest->scan.bwd_bytes);
+    fold(adaptive.n_interpolation_skips, &dest->adaptive.n_interpolation_skips);
+}
+
+/** Accumulated per-page interpolation search outcomes.
+  * Pages with irregular timestamps defeat interpolation - probes barely
+  * shrink the range and binary search has to do the work anyway. The
+  * profile tracks how often interpolation pays off on a page so the
+  * searcher can skip it.
+  */
+struct PageSearchProfile {
+    enum {
+        //! Minimal number of measured runs before the profile is trusted
+        MIN_ATTEMPTS = 8,
+        //! Counters are halved at this size so old outcomes decay
+        MAX_ATTEMPTS = 0x100,
+        //! Every n-th search on a degraded page retries interpolation
+        RETRY_PERIOD = 0x40,
+        //! Run pays off if it shrinks the range this many times
+        MIN_REDUCTION = 8,
+    };
+
+    u32 attempts = 0;  //< Interpolation runs measured on this page
+    u32 wasted   = 0;  //< Runs that didn't reduce the range enough
+    u32 skipped  = 0;  //< Searches since the last retry (degraded pages)
+
+    bool is_degraded() const {
+        return attempts >= MIN_ATTEMPTS && wasted * 2 > attempts;
+    }
+
+    void record(u32 initial_range, u32 final_range) {
+        if (attempts == MAX_ATTEMPTS) {
+            attempts /= 2;
+            wasted   /= 2;
+        }
+        attempts++;
+        if (final_range > initial_range / MIN_REDUCTION) {
+            wasted++;
+        }
+    }
+};
+
+struct SearchProfileRegistry {
+    std::mutex mutex;
+    std::unordered_map<u64, PageSearchProfile> profiles;
+};
+
+static SearchProfileRegistry& get_search_profile_registry() {
+    static SearchProfileRegistry registry;
+    return registry;
+}
+
 namespace {
     struct ChunkHeaderSearcher : InterpolationSearch<ChunkHeaderSearcher> {
         UncompressedChunk const& header;
@@ -349,6 +524,9 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 
     SearchRange search_range_;
 
+    //! Snapshot of the query id filter (empty - prefiltering disabled)
+    std::unordered_set<aku_ParamId> filter_ids_;
+
     SearchAlgorithm(PageHeader const* page, std::shared_ptr<QP::IQueryProcessor> query, std::shared_ptr<ChunkCache> cache)
         : page_(page)
         , query_(query)
@@ -356,6 +534,9 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         , key_(query->range().begin())
         , query_range_(query->range())
     {
+        for (auto id: query->filter().get_ids()) {
+            filter_ids_.insert(id);
+        }
         if (max_index()) {
             search_range_.begin = 0u;
             search_range_.end = max_index() - 1;
@@ -428,14 +609,106 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         return get_global_search_stats();
     }
 
+    //! Profile key (mirrors the chunk cache key so recycled pages start fresh)
+    u64 profile_key_() const {
+        return page_->get_numpages() * page_->get_open_count() + page_->get_page_id();
+    }
+
+    /** Consult the page profile. Returns false if the search should go
+      * straight to binary search. Degraded pages retry interpolation
+      * periodically so the profile can recover.
+      */
+    bool use_interpolation_() const {
+        auto& registry = get_search_profile_registry();
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        auto& profile = registry.profiles[profile_key_()];
+        if (!profile.is_degraded()) {
+            return true;
+        }
+        profile.skipped++;
+        if (profile.skipped >= PageSearchProfile::RETRY_PERIOD) {
+            profile.skipped = 0;
+            return true;
+        }
+        return false;
+    }
+
+    void record_interpolation_(u32 initial_range, u32 final_range) const {
+        auto& registry = get_search_profile_registry();
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        registry.profiles[profile_key_()].record(initial_range, final_range);
+    }
+
     bool interpolation() {
+        if (!use_interpolation_()) {
+            get_global_search_stats().adaptive.n_interpolation_skips.add(1);
+            return true;
+        }
+        u32 initial_range = search_range_.end - search_range_.begin;
         if (!run(key_, &search_range_)) {
             query_->set_error(AKU_ENOT_FOUND);
             return false;
         }
+        record_interpolation_(initial_range, search_range_.end - search_range_.begin);
         return true;
     }
 
+    enum {
+        //! Bisection stops at this range size, the tail is probed eight entries at a time
+        BLOCK_SCAN_SIZE = 0x40,
+    };
+
+    /** Count records in [ix, ix+8) with timestamp less then the key.
+      * Probes eight index records at once (with AVX2 gathers when available).
+      */
+    u32 count_less_in_block_(u32 ix, aku_Timestamp key) const {
+#ifdef __AVX2__
+        // Index records are packed 12 byte structs stored backwards from
+        // the end of the page so timestamps sit at a -12 byte stride.
+        const int STRIDE = static_cast<int>(sizeof(aku_EntryIndexRecord));
+        auto base = reinterpret_cast<const long long*>(page_->page_index(ix));
+        __m128i vix_lo = _mm_set_epi32(-3*STRIDE, -2*STRIDE,   -STRIDE,         0);
+        __m128i vix_hi = _mm_set_epi32(-7*STRIDE, -6*STRIDE, -5*STRIDE, -4*STRIDE);
+        __m256i lo = _mm256_i32gather_epi64(base, vix_lo, 1);
+        __m256i hi = _mm256_i32gather_epi64(base, vix_hi, 1);
+        // There is no unsigned 64-bit compare, flip the sign bits of both sides
+        __m256i sign = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+        __m256i vkey = _mm256_set1_epi64x(static_cast<long long>(key ^ 0x8000000000000000ull));
+        lo = _mm256_xor_si256(lo, sign);
+        hi = _mm256_xor_si256(hi, sign);
+        u32 mask = (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vkey, lo))) & 0xF)
+                 | ((_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vkey, hi))) & 0xF) << 4);
+        // Timestamps are sorted so the mask is a run of ones
+        return static_cast<u32>(__builtin_popcount(mask));
+#else
+        u32 cnt = 0;
+        for (u32 i = 0; i < 8; i++) {
+            if (page_->page_index(ix + i)->timestamp < key) {
+                cnt++;
+            }
+        }
+        return cnt;
+#endif
+    }
+
+    //! Finish the lookup with a blocked probe over the remaining range
+    u32 block_scan_(aku_Timestamp key) const {
+        u32 ix   = search_range_.begin;
+        u32 last = search_range_.end;
+        while (ix + 7 <= last) {
+            u32 cnt = count_less_in_block_(ix, key);
+            if (cnt != 8) {
+                // Block holds the first record that is not less then the key
+                return ix + cnt;
+            }
+            ix += 8;
+        }
+        while (ix <= last && page_->page_index(ix)->timestamp < key) {
+            ix++;
+        }
+        return ix > last ? last : ix;
+    }
+
     void binary_search() {
         u64 steps = 0ul;
         if (search_range_.begin == search_range_.end) {
@@ -444,6 +717,12 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         u32 probe_index = 0u;
         while (search_range_.end >= search_range_.begin) {
             steps++;
+            if (search_range_.end - search_range_.begin >= 8u &&
+                search_range_.end - search_range_.begin <= BLOCK_SCAN_SIZE)
+            {
+                probe_index = block_scan_(key_);
+                break;
+            }
             probe_index = search_range_.begin + ((search_range_.end - search_range_.begin) / 2u);
             if (probe_index >= max_index()) {
                 query_->set_error(AKU_EOVERFLOW);
@@ -471,10 +750,8 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         search_range_.end = probe_index;
 
         auto& stats = get_global_search_stats();
-        std::lock_guard<std::mutex> guard(stats.mutex);
-        auto& bst = stats.stats.bstats;
-        bst.n_times += 1;
-        bst.n_steps += steps;
+        stats.bstats.n_times.add(1);
+        stats.bstats.n_steps.add(steps);
     }
 
     enum ScanResultT {
@@ -484,12 +761,9 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         INTERRUPTED,
     };
 
-    ScanResultT scan_compressed_entries(u32 current_index,
-                                        aku_Entry const* probe_entry,
-                                        bool binary_search=false)
-    {
+    //! Decode (or take from the cache) the chunk at `current_index`
+    std::shared_ptr<UncompressedChunk> decode_chunk_at(u32 current_index) {
         aku_Status status = AKU_SUCCESS;
-        ScanResultT result = UNDERSHOOT;
         std::shared_ptr<UncompressedChunk> chunk_header, header;
 
         auto npages = page_->get_numpages();    // This needed to prevent key collision
@@ -502,6 +776,8 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
             // Fast path
             header = cache_->get(key);
         } else {
+            auto probe_offset = page_->page_index(current_index)->offset;
+            auto probe_entry  = page_->read_entry(probe_offset);
             chunk_header.reset(new UncompressedChunk());
             header.reset(new UncompressedChunk());
             auto pdesc  = reinterpret_cast<CompressedChunkDesc const*>(&probe_entry->value[0]);
@@ -515,6 +791,41 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
                 AKU_PANIC("File damaged!");
             }
 
+            if (!filter_ids_.empty()) {
+                // The where clause selects a fixed set of series: probe the
+                // cheap id stream first and skip value decompression for
+                // chunks that contain none of them
+                UncompressedChunk idsonly;
+                status = CompressionUtil::decode_chunk_paramids(&idsonly, pbegin, pend, probe_length);
+                if (status != AKU_SUCCESS) {
+                    AKU_PANIC("Can't decode chunk");
+                }
+                bool hit = false;
+                aku_ParamId prev = 0;
+                bool first = true;
+                for (auto id: idsonly.paramids) {
+                    if (!first && id == prev) {
+                        // ids are sorted in chunk order
+                        continue;
+                    }
+                    first = false;
+                    prev = id;
+                    if (filter_ids_.count(id) != 0) {
+                        hit = true;
+                        break;
+                    }
+                }
+                if (!hit) {
+                    // Skeleton header: only the time bounds are needed to
+                    // drive the scan forward, don't pollute the cache with it
+                    status = CompressionUtil::decode_chunk_timestamps(header.get(), pbegin, pend, probe_length);
+                    if (status != AKU_SUCCESS) {
+                        AKU_PANIC("Can't decode chunk");
+                    }
+                    return header;
+                }
+            }
+
             status = CompressionUtil::decode_chunk(chunk_header.get(), pbegin, pend, probe_length);
             if (status != AKU_SUCCESS) {
                 AKU_PANIC("Can't decode chunk");
@@ -534,6 +845,19 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
                 cache_->put(key, header);
             }
         }
+        return header;
+    }
+
+    ScanResultT scan_compressed_entries(std::shared_ptr<UncompressedChunk> header)
+    {
+        ScanResultT result = UNDERSHOOT;
+
+        if (AKU_UNLIKELY(header->values.empty() && !header->timestamps.empty())) {
+            // Chunk was skipped by the id prefilter, only its time bounds
+            // matter for the scan progress (timestamps are in chunk order)
+            auto mm = std::minmax_element(header->timestamps.begin(), header->timestamps.end());
+            return check_timestamp(query_range_.is_backward() ? *mm.first : *mm.second);
+        }
 
         int start_pos = 0;
         if (query_range_.is_backward()) {
@@ -575,19 +899,27 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
                 }
             }
         } else {
-            auto end_pos = static_cast<int>(header->timestamps.size());
-            for (auto i = start_pos; i != end_pos; i++) {
-                result = check_timestamp(header->timestamps[static_cast<size_t>(i)]);
-                if (result == OVERSHOOT) {
-                    break;
-                }
-                if (result == IN_RANGE) {
-                    if (!put_entry(static_cast<u32>(i))) {
-                        result = INTERRUPTED;
-                        break;
-                    }
+            // Forward scan - timestamps are sorted so the in-range run can
+            // be located with binary search and handed to the query
+            // processor as one batch (the processor applies the filter)
+            auto tdata = header->timestamps.data();
+            auto tsize = header->timestamps.size();
+            auto lo = ts_lower_bound(tdata, tsize, query_range_.lowerbound);
+            auto hi = ts_upper_bound(tdata, tsize, query_range_.upperbound);
+            if (lo != hi) {
+                if (!queryproc->put_batch(hi - lo,
+                                          header->paramids.data()   + lo,
+                                          header->timestamps.data() + lo,
+                                          header->values.data()     + lo)) {
+                    // Scaning process interrupted by the user (connection closed)
+                    return INTERRUPTED;
                 }
             }
+            if (hi != header->timestamps.size()) {
+                result = OVERSHOOT;
+            } else if (lo != hi) {
+                result = IN_RANGE;
+            }
         }
         return result;
     }
@@ -615,6 +947,26 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         return proceed;
     }
 
+    enum : u32 {
+        NO_INDEX = ~0u,  //< Invalid page index
+    };
+
+    /** Find the index of the next chunk entry in the scan direction
+      * starting from `from` or NO_INDEX if there is none in range.
+      */
+    u32 next_chunk_index(u32 from) const {
+        int increment = query_range_.is_backward() ? -1 : 1;
+        auto target = query_range_.is_backward() ? AKU_CHUNK_BWD_ID : AKU_CHUNK_FWD_ID;
+        for (u32 ix = from; ix < max_index(); ix += increment) {
+            auto probe_offset = page_->page_index(ix)->offset;
+            auto probe_entry  = page_->read_entry(probe_offset);
+            if (probe_entry->param_id == target) {
+                return ix;
+            }
+        }
+        return NO_INDEX;
+    }
+
     /**
      * @brief scan_impl is a scan procedure impelementation
      * @param probe_index is an index to start with
@@ -625,6 +977,9 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         ScanResultT proceed = IN_RANGE;
         aku_Timestamp last_valid_timestamp = 0ul;
         bool should_busy_wait = query_range_.type == QP::QueryRange::CONTINUOUS;
+        // Chunk decoded ahead of time on a worker thread
+        std::future<std::shared_ptr<UncompressedChunk>> prefetched;
+        u32 prefetched_index = NO_INDEX;
         while (proceed != INTERRUPTED) {
             if (probe_index < max_index()) {
                 auto probe_offset = page_->page_index(probe_index)->offset;
@@ -633,10 +988,24 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
                 auto probe = probe_entry->param_id;
                 last_valid_timestamp = probe_time;
 
-                if (probe == AKU_CHUNK_FWD_ID && !query_range_.is_backward()) {
-                    proceed = scan_compressed_entries(probe_index, probe_entry, false);
-                } else if (probe == AKU_CHUNK_BWD_ID && query_range_.is_backward()) {
-                    proceed = scan_compressed_entries(probe_index, probe_entry, false);
+                bool is_chunk = ( probe == AKU_CHUNK_FWD_ID && !query_range_.is_backward()) ||
+                                ( probe == AKU_CHUNK_BWD_ID &&  query_range_.is_backward());
+                if (is_chunk) {
+                    std::shared_ptr<UncompressedChunk> header;
+                    if (prefetched_index == probe_index && prefetched.valid()) {
+                        header = prefetched.get();
+                    } else {
+                        header = decode_chunk_at(probe_index);
+                    }
+                    // Decode the next chunk on a worker thread while the
+                    // samples of this one go through the node chain
+                    auto next = next_chunk_index(probe_index + index_increment);
+                    if (next != NO_INDEX) {
+                        prefetched_index = next;
+                        prefetched = std::async(std::launch::async,
+                                                &SearchAlgorithm::decode_chunk_at, this, next);
+                    }
+                    proceed = scan_compressed_entries(std::move(header));
                 } else {
                     proceed = check_timestamp(probe_time);
                 }
@@ -681,11 +1050,8 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         auto sums = scan_impl(search_range_.begin);
 
         auto& stats = get_global_search_stats();
-        {
-            std::lock_guard<std::mutex> guard(stats.mutex);
-            stats.stats.scan.fwd_bytes += std::get<0>(sums);
-            stats.stats.scan.bwd_bytes += std::get<1>(sums);
-        }
+        stats.scan.fwd_bytes.add(std::get<0>(sums));
+        stats.scan.bwd_bytes.add(std::get<1>(sums));
     }
 };
 
@@ -718,15 +1084,20 @@ void PageHeader::get_stats(aku_StorageStats* rcv_stats) {
 }
 
 void PageHeader::get_search_stats(aku_SearchStats* stats, bool reset) {
-    auto& gstats = get_global_search_stats();
-    std::lock_guard<std::mutex> guard(gstats.mutex);
-
-    memcpy( reinterpret_cast<void*>(stats)
-          , reinterpret_cast<void*>(&gstats.stats)
-          , sizeof(aku_SearchStats));
-
+    get_global_search_stats().copy_to(stats, reset);
+
+    auto& registry = get_search_profile_registry();
+    std::lock_guard<std::mutex> reg_guard(registry.mutex);
+    stats->adaptive.n_pages_tracked = registry.profiles.size();
+    u64 degraded = 0;
+    for (auto const& kv: registry.profiles) {
+        if (kv.second.is_degraded()) {
+            degraded++;
+        }
+    }
+    stats->adaptive.n_pages_degraded = degraded;
     if (reset) {
-        memset(reinterpret_cast<void*>(&gstats.stats), 0, sizeof(aku_SearchStats));
+        registry.profiles.clear();
     }
 }
 
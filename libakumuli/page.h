@@ -29,6 +29,7 @@
 #include "util.h"
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -59,18 +60,51 @@ struct aku_Entry {
     u32         value[];   //< Data begining
 } __attribute__((packed));
 
+//! High bit of `aku_Entry::length`, marks a dictionary-compressed payload
+const u32 AKU_ENTRY_DICT_FLAG = 0x80000000u;
+
 //! PageHeader forward declaration
 class PageHeader;
 
+//! BlobDictionary forward declaration
+struct BlobDictionary;
+
 /** Page bounding box.
  *  All data is two dimentional: param-timestamp.
  */
 
+/** Global search statistics.
+  * Every counter is striped per thread (see `StripedCounter`) so the
+  * bookkeeping in the search hot path doesn't cost coherence traffic,
+  * `copy_to` sums the stripes into the flat `aku_SearchStats` form.
+  */
 struct SearchStats {
-    aku_SearchStats stats;
-    std::mutex      mutex;
-
-    SearchStats() { memset(&stats, 0, sizeof(stats)); }
+    struct {
+        StripedCounter n_times;
+        StripedCounter n_steps;
+        StripedCounter n_overshoots;
+        StripedCounter n_undershoots;
+        StripedCounter n_matches;
+        StripedCounter n_reduced_to_one_page;
+        StripedCounter n_page_in_core_checks;
+        StripedCounter n_page_in_core_errors;
+        StripedCounter n_pages_in_core_found;
+        StripedCounter n_pages_in_core_miss;
+    } istats;
+    struct {
+        StripedCounter n_times;
+        StripedCounter n_steps;
+    } bstats;
+    struct {
+        StripedCounter fwd_bytes;
+        StripedCounter bwd_bytes;
+    } scan;
+    struct {
+        StripedCounter n_interpolation_skips;
+    } adaptive;
+
+    //! Sum the stripes into the flat representation (optionally resetting them)
+    void copy_to(aku_SearchStats* dest, bool reset = false);
 };
 
 SearchStats& get_global_search_stats();
@@ -247,6 +281,15 @@ public:
 
     //! Get page status
     void get_stats(aku_StorageStats* rcv_stats);
+
+private:
+    /** Get the blob dictionary of the page (rebuilt from the page
+      * content on first use, cached by page id afterwards).
+      */
+    std::shared_ptr<BlobDictionary> get_blob_dict_() const;
+
+    //! Copy dictionary-compressed entry into the receiving buffer
+    int copy_blob_entry_(const aku_Entry* entry, aku_Entry* receiver) const;
 };
 
 }  // namespaces
@@ -0,0 +1,126 @@
+#include "aggregate.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace Akumuli {
+namespace QP {
+
+Aggregate::Aggregate(Function fn, std::shared_ptr<Node> next)
+    : fn_(fn)
+    , next_(next)
+{
+}
+
+Aggregate::Aggregate(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
+    : next_(next)
+{
+    fn_ = parse_function(ptree.get<std::string>("function"));
+}
+
+Aggregate::Function Aggregate::parse_function(std::string const& name) {
+    if (name == "count") {
+        return COUNT;
+    } else if (name == "sum") {
+        return SUM;
+    } else if (name == "min") {
+        return MIN;
+    } else if (name == "max") {
+        return MAX;
+    } else if (name == "mean") {
+        return MEAN;
+    }
+    QueryParserError err("unknown aggregate function (expected count, sum, min, max or mean)");
+    BOOST_THROW_EXCEPTION(err);
+}
+
+void Aggregate::AggregationState::add(aku_Timestamp ts, double value) {
+    cnt += 1;
+    sum += value;
+    min  = std::min(min, value);
+    max  = std::max(max, value);
+    last = ts;
+}
+
+void Aggregate::complete() {
+    // One output sample per series, ids are sorted so the output
+    // order doesn't depend on the hash table layout
+    std::vector<aku_ParamId> ids;
+    for (auto const& kv: table_) {
+        ids.push_back(kv.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (auto id: ids) {
+        AggregationState const& state = table_[id];
+        double value = 0.0;
+        switch (fn_) {
+        case COUNT:
+            value = static_cast<double>(state.cnt);
+            break;
+        case SUM:
+            value = state.sum;
+            break;
+        case MIN:
+            value = state.min;
+            break;
+        case MAX:
+            value = state.max;
+            break;
+        case MEAN:
+            value = state.sum / state.cnt;
+            break;
+        }
+        aku_Sample sample;
+        sample.paramid         = id;
+        sample.timestamp       = state.last;
+        sample.payload.type    = AKU_PAYLOAD_FLOAT;
+        sample.payload.size    = sizeof(aku_Sample);
+        sample.payload.float64 = value;
+        if (!next_->put(sample)) {
+            break;
+        }
+    }
+    next_->complete();
+}
+
+bool Aggregate::put(const aku_Sample& sample) {
+    if (sample.payload.type > aku_PData::MARGIN || sample.payload.type == aku_PData::EMPTY) {
+        return next_->put(sample);
+    }
+    table_[sample.paramid].add(sample.timestamp, sample.payload.float64);
+    return true;
+}
+
+bool Aggregate::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                          const double* xss) {
+    // Batches carry plain float samples only - reduce runs of one
+    // series without the hash table lookup per value
+    size_t begin = 0;
+    for (size_t i = 1; i <= n; i++) {
+        if (i == n || ids[i] != ids[begin]) {
+            auto& state = table_[ids[begin]];
+            for (size_t j = begin; j < i; j++) {
+                state.add(tss[j], xss[j]);
+            }
+            begin = i;
+        }
+    }
+    return true;
+}
+
+void Aggregate::set_error(aku_Status status) {
+    next_->set_error(status);
+}
+
+size_t Aggregate::get_used_memory() const {
+    typedef std::unordered_map<aku_ParamId, AggregationState>::value_type EntryT;
+    return table_.size() * (sizeof(EntryT) + 2 * sizeof(void*));
+}
+
+int Aggregate::get_requirements() const {
+    return EMPTY;
+}
+
+static QueryParserToken<Aggregate> aggregate_token("aggregate");
+
+}}  // namespace
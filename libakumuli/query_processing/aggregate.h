@@ -0,0 +1,66 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <unordered_map>
+
+#include "../queryprocessor_framework.h"
+
+namespace Akumuli {
+namespace QP {
+
+/** Whole-range aggregation node.
+  * Folds the query range into a single count/sum/min/max/mean value per
+  * series and emits the results when the scan completes. This is the
+  * query-pipeline face of the SubtreeRef pushdown: the NB+tree can answer
+  * the same aggregates from precomputed subtree refs without touching the
+  * leaves (see `NBTreeExtentsList::aggregate`), on the page-based engine
+  * the fold happens here while the range is scanned.
+  */
+struct Aggregate : Node {
+
+    enum Function {
+        COUNT,
+        SUM,
+        MIN,
+        MAX,
+        MEAN,
+    };
+
+    //! Per-series accumulator
+    struct AggregationState {
+        u64           cnt  = 0;
+        double        sum  = 0.0;
+        double        min  = std::numeric_limits<double>::max();
+        double        max  = std::numeric_limits<double>::lowest();
+        aku_Timestamp last = 0;  //! Timestamp of the last sample in scan order
+
+        void add(aku_Timestamp ts, double value);
+    };
+
+    Function                                          fn_;
+    std::unordered_map<aku_ParamId, AggregationState> table_;
+    std::shared_ptr<Node>                             next_;
+
+    Aggregate(Function fn, std::shared_ptr<Node> next);
+
+    Aggregate(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next);
+
+    //! Map function name used by the query language to enum value
+    static Function parse_function(std::string const& name);
+
+    virtual void complete();
+
+    virtual bool put(const aku_Sample& sample);
+
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
+    virtual void set_error(aku_Status status);
+
+    virtual size_t get_used_memory() const;
+
+    virtual int get_requirements() const;
+};
+}
+}  // namespace
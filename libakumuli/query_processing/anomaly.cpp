@@ -205,6 +205,28 @@ bool AnomalyDetector::put(const aku_Sample &sample) {
     return true;
 }
 
+bool AnomalyDetector::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                                const double* xss) {
+    // Margins never arrive in batches so the sliding window doesn't move here.
+    // Candidate checks can be done after the bulk update because the error
+    // frame only changes when the window moves.
+    detector_->add(ids, xss, n);
+    for (size_t i = 0; i < n; i++) {
+        if (detector_->is_anomaly_candidate(ids[i])) {
+            aku_Sample anomaly;
+            anomaly.paramid         = ids[i];
+            anomaly.timestamp       = tss[i];
+            anomaly.payload.float64 = xss[i];
+            anomaly.payload.size    = sizeof(aku_Sample);
+            anomaly.payload.type    = AKU_PAYLOAD_FLOAT | aku_PData::URGENT;
+            if (!next_->put(anomaly)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 void AnomalyDetector::set_error(aku_Status status) {
     next_->set_error(status);
 }
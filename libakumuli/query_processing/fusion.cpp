@@ -0,0 +1,25 @@
+#include "fusion.h"
+
+namespace Akumuli {
+namespace QP {
+
+std::shared_ptr<Node> create_fused_node(std::string tag, u64 limit, u64 offset,
+                                        std::shared_ptr<Node> next)
+{
+    if (tag == "paa") {
+        return std::make_shared<FusedPAALimiter<MeanCounter>>(limit, offset, next);
+    } else if (tag == "median-paa") {
+        return std::make_shared<FusedPAALimiter<MedianCounter>>(limit, offset, next);
+    } else if (tag == "max-paa") {
+        return std::make_shared<FusedPAALimiter<ValueSelector<SelectMax>>>(limit, offset, next);
+    } else if (tag == "min-paa") {
+        return std::make_shared<FusedPAALimiter<ValueSelector<SelectMin>>>(limit, offset, next);
+    } else if (tag == "first-paa") {
+        return std::make_shared<FusedPAALimiter<ValueSelector<SelectFirst>>>(limit, offset, next);
+    } else if (tag == "last-paa") {
+        return std::make_shared<FusedPAALimiter<ValueSelector<SelectLast>>>(limit, offset, next);
+    }
+    return std::shared_ptr<Node>();
+}
+
+}}  // namespace
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../queryprocessor_framework.h"
+#include "paa.h"
+
+namespace Akumuli {
+namespace QP {
+
+/** PAA sampler fused with a limiter.
+  * Dashboards build the same short `sampler -> limiter` chain for
+  * virtually every panel and run it millions of times per second.
+  * Fusing the pair into one node removes the intermediate virtual
+  * `put` call per emitted sample and keeps the accumulation loop
+  * free of dispatch. Behavior matches `PAA<State>` followed by
+  * `Limiter` exactly.
+  */
+template <class State> struct FusedPAALimiter : Node {
+    std::shared_ptr<Node> next_;
+    std::unordered_map<aku_ParamId, State> counters_;
+    u64 limit_;
+    u64 offset_;
+    u64 counter_;
+
+    FusedPAALimiter(u64 limit, u64 offset, std::shared_ptr<Node> next)
+        : next_(next)
+        , limit_(limit)
+        , offset_(offset)
+        , counter_(0)
+    {}
+
+    //! Inlined limiter step, returns false when the limit is reached
+    bool put_limited(aku_Sample const& sample) {
+        if (counter_ < offset_) {
+            counter_++;
+            return true;
+        } else if (limit_ != 0 && counter_ >= offset_ + limit_) {
+            return false;
+        }
+        counter_++;
+        return next_->put(sample);
+    }
+
+    bool average_samples(aku_Sample const& margin) {
+        std::vector<aku_ParamId> ids;
+        for (auto& pair : counters_) {
+            ids.push_back(pair.first);
+        }
+        if (margin.payload.type == aku_PData::LO_MARGIN) {
+            // Moving in backward direction
+            std::sort(ids.begin(), ids.end(), std::greater<aku_ParamId>());
+        } else {
+            // Moving forward
+            std::sort(ids.begin(), ids.end(), std::less<aku_ParamId>());
+        }
+        for (auto id : ids) {
+            State& state = counters_[id];
+            if (state.ready()) {
+                aku_Sample sample;
+                sample.paramid         = id;
+                sample.payload.float64 = state.value();
+                sample.payload.type    = AKU_PAYLOAD_FLOAT;
+                sample.payload.size    = sizeof(aku_Sample);
+                sample.timestamp       = margin.timestamp;
+                state.reset();
+                if (!put_limited(sample)) {
+                    return false;
+                }
+            }
+        }
+        // Margins pass the limiter untouched
+        if (!next_->put(margin)) {
+            return false;
+        }
+        return true;
+    }
+
+    virtual void complete() { next_->complete(); }
+
+    virtual bool put(const aku_Sample& sample) {
+        if (sample.payload.type > aku_PData::MARGIN) {
+            if (!average_samples(sample)) {
+                return false;
+            }
+        } else {
+            auto& state = counters_[sample.paramid];
+            state.add(sample);
+        }
+        return true;
+    }
+
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss) {
+        // Margins never arrive in batches so this is pure accumulation,
+        // runs of one series are reduced with tight loops
+        size_t begin = 0;
+        for (size_t i = 1; i <= n; i++) {
+            if (i == n || ids[i] != ids[begin]) {
+                counters_[ids[begin]].add_batch(xss + begin, i - begin);
+                begin = i;
+            }
+        }
+        return true;
+    }
+
+    virtual void set_error(aku_Status status) { next_->set_error(status); }
+
+    virtual size_t get_used_memory() const {
+        typedef typename std::unordered_map<aku_ParamId, State>::value_type EntryT;
+        return counters_.size() * (sizeof(EntryT) + 2 * sizeof(void*));
+    }
+
+    virtual int get_requirements() const { return GROUP_BY_REQUIRED | TERMINAL; }
+};
+
+/** Try to fuse sampler `tag` with a limiter at plan time.
+  * Returns an empty pointer if the combination is not fusible, the
+  * caller should then fall back to the regular two node chain.
+  */
+std::shared_ptr<Node> create_fused_node(std::string tag, u64 limit, u64 offset,
+                                        std::shared_ptr<Node> next);
+}
+}  // namespace
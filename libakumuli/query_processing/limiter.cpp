@@ -1,5 +1,7 @@
 #include "limiter.h"
 
+#include <algorithm>
+
 namespace Akumuli {
 namespace QP {
 
@@ -22,8 +24,9 @@ bool Limiter::put(const aku_Sample& sample) {
     }
     if (counter_ < offset_) {
         // continue iteration
+        counter_++;
         return true;
-    } else if (counter_ >= limit_) {
+    } else if (limit_ != 0 && counter_ >= offset_ + limit_) {
         // stop iteration
         return false;
     }
@@ -31,6 +34,35 @@ bool Limiter::put(const aku_Sample& sample) {
     return next_->put(sample);
 }
 
+bool Limiter::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                        const double* xss) {
+    // Batches carry plain float samples only so the offset can be skipped
+    // in bulk and the run truncated at the limit
+    size_t begin = 0;
+    if (counter_ < offset_) {
+        begin = static_cast<size_t>(std::min(static_cast<u64>(n), offset_ - counter_));
+        counter_ += begin;
+        if (begin == n) {
+            return true;
+        }
+    }
+    size_t end = n;
+    bool saturated = false;
+    if (limit_ != 0) {
+        u64 room = offset_ + limit_ - counter_;
+        if (room <= end - begin) {
+            end = begin + static_cast<size_t>(room);
+            saturated = true;
+        }
+    }
+    counter_ += end - begin;
+    if (end != begin && !next_->put_batch(end - begin, ids + begin, tss + begin, xss + begin)) {
+        return false;
+    }
+    // Interrupt the scan as soon as the limit is reached
+    return !saturated;
+}
+
 void Limiter::set_error(aku_Status status) {
     next_->set_error(status);
 }
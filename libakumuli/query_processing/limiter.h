@@ -20,6 +20,9 @@ struct Limiter : Node {
 
     virtual bool put(const aku_Sample& sample);
 
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
@@ -23,6 +23,16 @@ void MeanCounter::add(aku_Sample const& value) {
     num++;
 }
 
+void MeanCounter::add_batch(const double* xss, size_t n) {
+    // Plain reduction loop, the compiler can vectorize it
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += xss[i];
+    }
+    acc += sum;
+    num += n;
+}
+
 MeanPAA::MeanPAA(std::shared_ptr<Node> next)
     : PAA<MeanCounter>(next)
 {
@@ -61,6 +71,10 @@ void MedianCounter::add(aku_Sample const& value) {
     acc.push_back(value.payload.float64);
 }
 
+void MedianCounter::add_batch(const double* xss, size_t n) {
+    acc.insert(acc.end(), xss, xss + n);
+}
+
 MedianPAA::MedianPAA(std::shared_ptr<Node> next)
     : PAA<MedianCounter>(next)
 {
@@ -71,36 +85,6 @@ MedianPAA::MedianPAA(const boost::property_tree::ptree &, std::shared_ptr<Node>
 {
 }
 
-struct SelectMin {
-   double operator () (double lhs, double rhs) {
-       if (lhs < rhs) {
-           return lhs;
-       }
-       return rhs;
-   }
-};
-
-struct SelectMax {
-   double operator () (double lhs, double rhs) {
-       if (lhs > rhs) {
-           return lhs;
-       }
-       return rhs;
-   }
-};
-
-struct SelectFirst {
-   double operator () (double lhs, double) {
-       return lhs;
-   }
-};
-
-struct SelectLast {
-   double operator () (double, double rhs) {
-       return rhs;
-   }
-};
-
 typedef GenericPAA<SelectMax> MaxPAA;
 typedef GenericPAA<SelectMin> MinPAA;
 typedef GenericPAA<SelectFirst> FirstPAA;
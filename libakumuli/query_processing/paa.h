@@ -65,8 +65,28 @@ template <class State> struct PAA : Node {
         return true;
     }
 
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss) {
+        // Margins never arrive in batches so this is pure accumulation,
+        // runs of one series are reduced with tight loops
+        size_t begin = 0;
+        for (size_t i = 1; i <= n; i++) {
+            if (i == n || ids[i] != ids[begin]) {
+                counters_[ids[begin]].add_batch(xss + begin, i - begin);
+                begin = i;
+            }
+        }
+        return true;
+    }
+
     virtual void set_error(aku_Status status) { next_->set_error(status); }
 
+    virtual size_t get_used_memory() const {
+        // Hash table entry plus per-node bucket overhead (approximation)
+        typedef typename std::unordered_map<aku_ParamId, State>::value_type EntryT;
+        return counters_.size() * (sizeof(EntryT) + 2 * sizeof(void*));
+    }
+
     virtual int get_requirements() const { return GROUP_BY_REQUIRED; }
 };
 
@@ -82,6 +102,8 @@ struct MeanCounter {
     bool ready() const;
 
     void add(aku_Sample const& value);
+
+    void add_batch(const double* xss, size_t n);
 };
 
 struct MeanPAA : PAA<MeanCounter> {
@@ -101,6 +123,8 @@ struct MedianCounter {
     bool ready() const;
 
     void add(aku_Sample const& value);
+
+    void add_batch(const double* xss, size_t n);
 };
 
 struct MedianPAA : PAA<MedianCounter> {
@@ -110,6 +134,36 @@ struct MedianPAA : PAA<MedianCounter> {
     MedianPAA(boost::property_tree::ptree const&, std::shared_ptr<Node> next);
 };
 
+struct SelectMin {
+   double operator () (double lhs, double rhs) {
+       if (lhs < rhs) {
+           return lhs;
+       }
+       return rhs;
+   }
+};
+
+struct SelectMax {
+   double operator () (double lhs, double rhs) {
+       if (lhs > rhs) {
+           return lhs;
+       }
+       return rhs;
+   }
+};
+
+struct SelectFirst {
+   double operator () (double lhs, double) {
+       return lhs;
+   }
+};
+
+struct SelectLast {
+   double operator () (double, double rhs) {
+       return rhs;
+   }
+};
+
 template <class SelectFn> struct ValueSelector {
     double acc;
     size_t num;
@@ -132,6 +186,25 @@ template <class SelectFn> struct ValueSelector {
         }
         num++;
     }
+
+    void add_batch(const double* xss, size_t n) {
+        if (n == 0) {
+            return;
+        }
+        size_t i = 0;
+        if (!num) {
+            acc = xss[0];
+            i = 1;
+        }
+        // Plain reduction loop, the compiler can vectorize min/max
+        SelectFn fn;
+        double a = acc;
+        for (; i < n; i++) {
+            a = fn(a, xss[i]);
+        }
+        acc = a;
+        num += n;
+    }
 };
 
 template <class SelectFn> struct GenericPAA : PAA<ValueSelector<SelectFn>> {
@@ -0,0 +1,246 @@
+#include "quantile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Akumuli {
+namespace QP {
+
+// ///////// //
+// T-digest  //
+// ///////// //
+
+TDigest::TDigest(double compression)
+    : compression_(compression)
+    , count_(0)
+{
+    buffer_.reserve(BUFFER_SIZE);
+}
+
+void TDigest::add(double value) {
+    buffer_.push_back(value);
+    if (buffer_.size() >= BUFFER_SIZE) {
+        flush_buffer_();
+    }
+}
+
+void TDigest::add(const double* xss, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        buffer_.push_back(xss[i]);
+        if (buffer_.size() >= BUFFER_SIZE) {
+            flush_buffer_();
+        }
+    }
+}
+
+void TDigest::merge(TDigest const& other) {
+    for (auto value: other.buffer_) {
+        add(value);
+    }
+    flush_buffer_();
+    if (other.centroids_.empty()) {
+        return;
+    }
+    count_ += other.count_;
+    merge_sorted_(other.centroids_);
+}
+
+void TDigest::flush_buffer_() {
+    if (buffer_.empty()) {
+        return;
+    }
+    std::sort(buffer_.begin(), buffer_.end());
+    std::vector<Centroid> input;
+    input.reserve(buffer_.size());
+    for (auto value: buffer_) {
+        input.push_back({ value, 1.0 });
+    }
+    count_ += static_cast<double>(buffer_.size());
+    buffer_.clear();
+    merge_sorted_(input);
+}
+
+void TDigest::merge_sorted_(std::vector<Centroid> const& input) {
+    // Two-way merge of the sorted lists
+    std::vector<Centroid> merged;
+    merged.reserve(centroids_.size() + input.size());
+    auto less = [](Centroid const& lhs, Centroid const& rhs) {
+        return lhs.mean < rhs.mean;
+    };
+    std::merge(centroids_.begin(), centroids_.end(), input.begin(), input.end(),
+               std::back_inserter(merged), less);
+    // Compress - grow the current cluster until the scale function caps
+    // its weight. The cap vanishes at q=0 and q=1 so the clusters at the
+    // tails stay small and extreme quantiles remain sharp.
+    std::vector<Centroid> out;
+    double cum = 0;
+    Centroid curr = merged.front();
+    for (auto it = merged.begin() + 1; it != merged.end(); it++) {
+        double q     = (cum + curr.weight + it->weight/2) / count_;
+        double limit = 4.0 * count_ * q * (1.0 - q) / compression_;
+        if (curr.weight + it->weight <= limit) {
+            curr.mean    = (curr.mean*curr.weight + it->mean*it->weight)
+                         / (curr.weight + it->weight);
+            curr.weight += it->weight;
+        } else {
+            cum += curr.weight;
+            out.push_back(curr);
+            curr = *it;
+        }
+    }
+    out.push_back(curr);
+    std::swap(centroids_, out);
+}
+
+double TDigest::quantile(double q) {
+    flush_buffer_();
+    if (centroids_.empty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (q <= 0.0) {
+        return centroids_.front().mean;
+    }
+    if (q >= 1.0) {
+        return centroids_.back().mean;
+    }
+    // Interpolate between the centroid midpoints
+    double target = q * count_;
+    if (target <= centroids_.front().weight/2) {
+        return centroids_.front().mean;
+    }
+    double cum = 0;
+    for (size_t i = 0; i + 1 < centroids_.size(); i++) {
+        double mid0 = cum + centroids_[i].weight/2;
+        double mid1 = cum + centroids_[i].weight + centroids_[i+1].weight/2;
+        if (target <= mid1) {
+            double t = (target - mid0) / (mid1 - mid0);
+            return centroids_[i].mean + t*(centroids_[i+1].mean - centroids_[i].mean);
+        }
+        cum += centroids_[i].weight;
+    }
+    return centroids_.back().mean;
+}
+
+size_t TDigest::get_used_memory() const {
+    return sizeof(TDigest)
+         + centroids_.capacity() * sizeof(Centroid)
+         + buffer_.capacity() * sizeof(double);
+}
+
+// ///////////// //
+// Quantile node //
+// ///////////// //
+
+Quantile::Quantile(std::vector<double> quantiles, std::shared_ptr<Node> next)
+    : quantiles_(std::move(quantiles))
+    , compression_(DEFAULT_COMPRESSION)
+    , next_(next)
+{
+}
+
+Quantile::Quantile(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
+    : compression_(DEFAULT_COMPRESSION)
+    , next_(next)
+{
+    auto quantiles = ptree.get_child_optional("quantiles");
+    if (quantiles) {
+        for (auto const& kv: *quantiles) {
+            quantiles_.push_back(kv.second.get_value<double>());
+        }
+    } else {
+        // Single value form
+        quantiles_.push_back(ptree.get<double>("quantile"));
+    }
+    if (quantiles_.empty()) {
+        QueryParserError err("at least one quantile expected");
+        BOOST_THROW_EXCEPTION(err);
+    }
+    for (auto q: quantiles_) {
+        if (q < 0.0 || q > 1.0) {
+            QueryParserError err("quantile should be in [0, 1] range");
+            BOOST_THROW_EXCEPTION(err);
+        }
+    }
+    compression_ = ptree.get<double>("compression", DEFAULT_COMPRESSION);
+}
+
+Quantile::SeriesState& Quantile::get_state_(aku_ParamId id) {
+    auto it = table_.find(id);
+    if (it == table_.end()) {
+        it = table_.emplace(id, SeriesState(compression_)).first;
+    }
+    return it->second;
+}
+
+void Quantile::complete() {
+    // One output sample per series per quantile, ids are sorted so the
+    // output order doesn't depend on the hash table layout
+    std::vector<aku_ParamId> ids;
+    for (auto const& kv: table_) {
+        ids.push_back(kv.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (auto id: ids) {
+        SeriesState& state = table_.at(id);
+        for (auto q: quantiles_) {
+            aku_Sample sample;
+            sample.paramid         = id;
+            sample.timestamp       = state.last;
+            sample.payload.type    = AKU_PAYLOAD_FLOAT;
+            sample.payload.size    = sizeof(aku_Sample);
+            sample.payload.float64 = state.digest.quantile(q);
+            if (!next_->put(sample)) {
+                next_->complete();
+                return;
+            }
+        }
+    }
+    next_->complete();
+}
+
+bool Quantile::put(const aku_Sample& sample) {
+    if (sample.payload.type > aku_PData::MARGIN || sample.payload.type == aku_PData::EMPTY) {
+        return next_->put(sample);
+    }
+    auto& state = get_state_(sample.paramid);
+    state.digest.add(sample.payload.float64);
+    state.last = sample.timestamp;
+    return true;
+}
+
+bool Quantile::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                         const double* xss) {
+    // Batches carry plain float samples only - feed runs of one series
+    // into the sketch without the hash table lookup per value
+    size_t begin = 0;
+    for (size_t i = 1; i <= n; i++) {
+        if (i == n || ids[i] != ids[begin]) {
+            auto& state = get_state_(ids[begin]);
+            state.digest.add(xss + begin, i - begin);
+            state.last = tss[i - 1];
+            begin = i;
+        }
+    }
+    return true;
+}
+
+void Quantile::set_error(aku_Status status) {
+    next_->set_error(status);
+}
+
+size_t Quantile::get_used_memory() const {
+    size_t total = 0;
+    for (auto const& kv: table_) {
+        total += kv.second.digest.get_used_memory() + 2 * sizeof(void*);
+    }
+    return total;
+}
+
+int Quantile::get_requirements() const {
+    return EMPTY;
+}
+
+static QueryParserToken<Quantile> quantile_token("quantile");
+
+}}  // namespace
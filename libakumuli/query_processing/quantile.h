@@ -0,0 +1,120 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../queryprocessor_framework.h"
+
+namespace Akumuli {
+namespace QP {
+
+/** Merging t-digest sketch.
+  * Values are clustered into centroids whose size is bounded by a scale
+  * function that keeps the clusters near the distribution tails small, so
+  * extreme quantiles (p95/p99) stay accurate while the sketch itself is a
+  * few kilobytes regardless of the input size. Input is buffered and folded
+  * into the centroid list in batches, two digests can be merged so the
+  * state composes with the parallel multi-series scan.
+  */
+struct TDigest {
+    enum {
+        //! Input buffer size (values are folded into centroids when it fills up)
+        BUFFER_SIZE = 512,
+    };
+
+    //! Cluster of nearby values
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+
+    //! Compression parameter (larger - more centroids, better accuracy)
+    double                compression_;
+    //! Centroid list, sorted by mean
+    std::vector<Centroid> centroids_;
+    //! Unmerged input values
+    std::vector<double>   buffer_;
+    //! Total weight of the centroid list
+    double                count_;
+
+    TDigest(double compression=100.0);
+
+    //! Add single value
+    void add(double value);
+
+    //! Add array of values (decoded chunk fast path)
+    void add(const double* xss, size_t n);
+
+    //! Fold another digest into this one
+    void merge(TDigest const& other);
+
+    /** Estimate the q-th quantile of the input (q in [0, 1]).
+      * Returns NaN if the digest is empty.
+      */
+    double quantile(double q);
+
+    //! Number of bytes used by the sketch
+    size_t get_used_memory() const;
+
+private:
+    //! Fold buffered values into the centroid list
+    void flush_buffer_();
+
+    //! Merge sorted centroid list into `centroids_` (count_ should be updated beforehand)
+    void merge_sorted_(std::vector<Centroid> const& input);
+};
+
+
+/** Streaming quantile node.
+  * Maintains a t-digest sketch per series and emits the requested
+  * quantiles (one sample per series per quantile) when the scan
+  * completes, so dashboards get p95/p99 directly instead of exporting
+  * raw values.
+  */
+struct Quantile : Node {
+
+    enum {
+        //! Default t-digest compression parameter
+        DEFAULT_COMPRESSION = 100,
+    };
+
+    //! Per-series sketch
+    struct SeriesState {
+        TDigest       digest;
+        aku_Timestamp last;  //! Timestamp of the last sample in scan order
+
+        SeriesState(double compression)
+            : digest(compression)
+            , last(0)
+        {}
+    };
+
+    std::vector<double>                          quantiles_;
+    double                                       compression_;
+    std::unordered_map<aku_ParamId, SeriesState> table_;
+    std::shared_ptr<Node>                        next_;
+
+    Quantile(std::vector<double> quantiles, std::shared_ptr<Node> next);
+
+    Quantile(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next);
+
+    virtual void complete();
+
+    virtual bool put(const aku_Sample& sample);
+
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
+    virtual void set_error(aku_Status status);
+
+    virtual size_t get_used_memory() const;
+
+    virtual int get_requirements() const;
+
+private:
+    //! Get (or create) sketch of the series
+    SeriesState& get_state_(aku_ParamId id);
+};
+}
+}  // namespace
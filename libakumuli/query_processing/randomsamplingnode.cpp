@@ -1,11 +1,14 @@
 #include "randomsamplingnode.h"
 #include <algorithm>
+#include <cmath>
 
 namespace Akumuli {
 namespace QP {
 
 RandomSamplingNode::RandomSamplingNode(u32 buffer_size, std::shared_ptr<Node> next)
     : buffer_size_(buffer_size)
+    , skip_(0)
+    , w_(0.0)
     , next_(next)
 {
     samples_.reserve(buffer_size);
@@ -13,9 +16,15 @@ RandomSamplingNode::RandomSamplingNode(u32 buffer_size, std::shared_ptr<Node> ne
 
 RandomSamplingNode::RandomSamplingNode(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
     : buffer_size_(0)
+    , skip_(0)
+    , w_(0.0)
     , next_(next)
 {
     u32 size = ptree.get<u32>("size");
+    if (size == 0) {
+        QueryParserError err("`size` can't be zero");
+        BOOST_THROW_EXCEPTION(err);
+    }
     auto pbs = const_cast<u32*>(&buffer_size_);
     *pbs = size;
     samples_.reserve(size);
@@ -25,6 +34,14 @@ int RandomSamplingNode::get_requirements() const {
     return EMPTY;
 }
 
+double RandomSamplingNode::uniform_() {
+    return (static_cast<double>(random_()) + 1.0) / 4294967297.0;
+}
+
+void RandomSamplingNode::next_skip_() {
+    skip_ = static_cast<u64>(std::floor(std::log(uniform_()) / std::log(1.0 - w_)));
+}
+
 bool RandomSamplingNode::flush() {
     auto predicate = [](aku_Sample const& lhs, aku_Sample const& rhs) {
         auto l = std::make_tuple(lhs.timestamp, lhs.paramid);
@@ -40,6 +57,7 @@ bool RandomSamplingNode::flush() {
         }
     }
     samples_.clear();
+    skip_ = 0;
     return true;
 }
 
@@ -51,16 +69,56 @@ void RandomSamplingNode::complete() {
 bool RandomSamplingNode::put(const aku_Sample& sample) {
     if (sample.payload.type > aku_PData::MARGIN) {
         return flush();
+    }
+    if (samples_.size() < buffer_size_) {
+        // Fill phase - just append new values
+        samples_.push_back(sample);
+        if (samples_.size() == buffer_size_) {
+            w_ = std::exp(std::log(uniform_()) / buffer_size_);
+            next_skip_();
+        }
+    } else if (skip_ != 0) {
+        // Sample is passed over, no RNG call needed
+        skip_--;
     } else {
+        samples_.at(random_() % buffer_size_) = sample;
+        w_ *= std::exp(std::log(uniform_()) / buffer_size_);
+        next_skip_();
+    }
+    return true;
+}
+
+bool RandomSamplingNode::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                                   const double* xss) {
+    auto make_sample = [&](size_t i) {
+        aku_Sample s;
+        s.timestamp       = tss[i];
+        s.paramid         = ids[i];
+        s.payload.float64 = xss[i];
+        s.payload.size    = sizeof(aku_Sample);
+        s.payload.type    = AKU_PAYLOAD_FLOAT;
+        return s;
+    };
+    size_t i = 0;
+    while (i < n) {
         if (samples_.size() < buffer_size_) {
-            // Just append new values
-            samples_.push_back(sample);
-        } else {
-            // Flip a coin
-            u32 ix = random_() % samples_.size();
-            if (ix < buffer_size_) {
-                samples_.at(ix) = sample;
+            samples_.push_back(make_sample(i));
+            i++;
+            if (samples_.size() == buffer_size_) {
+                w_ = std::exp(std::log(uniform_()) / buffer_size_);
+                next_skip_();
             }
+        } else if (skip_ >= n - i) {
+            // The rest of the run is passed over with one subtraction
+            skip_ -= n - i;
+            break;
+        } else {
+            i += static_cast<size_t>(skip_);
+            skip_ = 0;
+            samples_.at(random_() % buffer_size_) = make_sample(i);
+            w_ *= std::exp(std::log(uniform_()) / buffer_size_);
+            next_skip_();
+            i++;
         }
     }
     return true;
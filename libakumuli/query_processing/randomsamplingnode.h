@@ -9,10 +9,18 @@
 namespace Akumuli {
 namespace QP {
 
+/** Reservoir sampling node.
+  * Once the reservoir is full the node switches to Vitter-style skip-ahead
+  * (algorithm L): the number of samples to pass over is drawn up front so
+  * skipped values cost a counter decrement instead of an RNG call, and the
+  * batch path drops whole runs with a single subtraction.
+  */
 struct RandomSamplingNode : std::enable_shared_from_this<RandomSamplingNode>, Node {
     const u32               buffer_size_;
     std::vector<aku_Sample> samples_;
     Rand                    random_;
+    u64                     skip_;  //! Number of samples left to pass over
+    double                  w_;     //! Skip distribution state
     std::shared_ptr<Node>   next_;
 
     RandomSamplingNode(u32 buffer_size, std::shared_ptr<Node> next);
@@ -25,9 +33,19 @@ struct RandomSamplingNode : std::enable_shared_from_this<RandomSamplingNode>, No
 
     virtual bool put(const aku_Sample& sample);
 
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
+
+private:
+    //! Uniformly distributed value in (0, 1)
+    double uniform_();
+
+    //! Draw the length of the next skip
+    void next_skip_();
 };
 }
 }  // namespace
@@ -73,6 +73,13 @@ void SAXNode::set_error(aku_Status status) {
     next_->set_error(status);
 }
 
+size_t SAXNode::get_used_memory() const {
+    // Each encoder maintains a window of samples (approximation)
+    typedef std::unordered_map<aku_ParamId, SAX::SAXEncoder>::value_type EntryT;
+    return encoders_.size() * (sizeof(EntryT) + 2 * sizeof(void*)
+                               + static_cast<size_t>(window_width_) * sizeof(double));
+}
+
 int SAXNode::get_requirements() const {
     return GROUP_BY_REQUIRED;
 }
@@ -34,6 +34,8 @@ struct SAXNode : Node {
 
     virtual void set_error(aku_Status status);
 
+    virtual size_t get_used_memory() const;
+
     virtual int get_requirements() const;
 };
 }
@@ -0,0 +1,178 @@
+#include "slidingwindow.h"
+#include "../datetime.h"
+#include "../util.h"
+
+#include <cmath>
+#include <vector>
+
+namespace Akumuli {
+namespace QP {
+
+SlidingWindow::SlidingWindow(Function fn, aku_Timestamp width, size_t count,
+                             std::shared_ptr<Node> next)
+    : fn_(fn)
+    , width_(width)
+    , count_(count)
+    , next_(next)
+{
+    validate_();
+}
+
+SlidingWindow::SlidingWindow(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
+    : width_(0)
+    , next_(next)
+{
+    fn_    = parse_function(ptree.get<std::string>("function"));
+    count_ = ptree.get<size_t>("count", 0u);
+    auto width = ptree.get_optional<std::string>("width");
+    if (width) {
+        width_ = DateTimeUtil::parse_duration(width->c_str(), width->size());
+    }
+    validate_();
+}
+
+SlidingWindow::Function SlidingWindow::parse_function(std::string const& name) {
+    if (name == "sum") {
+        return SUM;
+    } else if (name == "min") {
+        return MIN;
+    } else if (name == "max") {
+        return MAX;
+    } else if (name == "mean") {
+        return MEAN;
+    } else if (name == "stddev") {
+        return STDDEV;
+    }
+    QueryParserError err("unknown window function (expected sum, min, max, mean or stddev)");
+    BOOST_THROW_EXCEPTION(err);
+}
+
+void SlidingWindow::validate_() const {
+    if ((width_ == 0) == (count_ == 0)) {
+        QueryParserError err("either `width` or `count` should be set");
+        BOOST_THROW_EXCEPTION(err);
+    }
+}
+
+double SlidingWindow::update(WindowState& state, aku_Timestamp ts, double value) {
+    auto seqno = state.seqno++;
+    state.samples.push_back(std::make_tuple(seqno, ts, value));
+    switch (fn_) {
+    case MIN:
+        while (!state.minq.empty() && state.minq.back().second >= value) {
+            state.minq.pop_back();
+        }
+        state.minq.push_back(std::make_pair(seqno, value));
+        break;
+    case MAX:
+        while (!state.maxq.empty() && state.maxq.back().second <= value) {
+            state.maxq.pop_back();
+        }
+        state.maxq.push_back(std::make_pair(seqno, value));
+        break;
+    default:
+        state.sum   += value;
+        state.sumsq += value * value;
+        break;
+    }
+    // Evict samples that fell out of the window. Timestamps are monotonic
+    // within one scan (in either direction) so the distance check works
+    // for forward and backward queries alike.
+    while (!state.samples.empty()) {
+        auto const& oldest = state.samples.front();
+        if (count_ != 0) {
+            if (state.samples.size() <= count_) {
+                break;
+            }
+        } else {
+            auto old = std::get<1>(oldest);
+            aku_Timestamp dist = ts > old ? ts - old : old - ts;
+            if (dist < width_) {
+                break;
+            }
+        }
+        auto oldseq = std::get<0>(oldest);
+        auto oldval = std::get<2>(oldest);
+        state.sum   -= oldval;
+        state.sumsq -= oldval * oldval;
+        if (!state.minq.empty() && state.minq.front().first == oldseq) {
+            state.minq.pop_front();
+        }
+        if (!state.maxq.empty() && state.maxq.front().first == oldseq) {
+            state.maxq.pop_front();
+        }
+        state.samples.pop_front();
+    }
+    switch (fn_) {
+    case SUM:
+        return state.sum;
+    case MIN:
+        return state.minq.front().second;
+    case MAX:
+        return state.maxq.front().second;
+    case MEAN:
+        return state.sum / state.samples.size();
+    case STDDEV: {
+        double n    = static_cast<double>(state.samples.size());
+        double mean = state.sum / n;
+        double var  = state.sumsq / n - mean * mean;
+        return var > 0.0 ? std::sqrt(var) : 0.0;
+    }
+    }
+    AKU_PANIC("invalid window function");
+}
+
+void SlidingWindow::complete() {
+    next_->complete();
+}
+
+bool SlidingWindow::put(const aku_Sample& sample) {
+    if (sample.payload.type > aku_PData::MARGIN || sample.payload.type == aku_PData::EMPTY) {
+        return next_->put(sample);
+    }
+    auto copy = sample;
+    copy.payload.float64 = update(windows_[sample.paramid], sample.timestamp,
+                                  sample.payload.float64);
+    return next_->put(copy);
+}
+
+bool SlidingWindow::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                              const double* xss) {
+    // Batches carry plain float samples only - aggregate in place and
+    // forward the whole run at once
+    std::vector<double> out(n);
+    size_t begin = 0;
+    for (size_t i = 1; i <= n; i++) {
+        if (i == n || ids[i] != ids[begin]) {
+            auto& state = windows_[ids[begin]];
+            for (size_t j = begin; j < i; j++) {
+                out[j] = update(state, tss[j], xss[j]);
+            }
+            begin = i;
+        }
+    }
+    return next_->put_batch(n, ids, tss, out.data());
+}
+
+void SlidingWindow::set_error(aku_Status status) {
+    next_->set_error(status);
+}
+
+size_t SlidingWindow::get_used_memory() const {
+    // Time-based windows can grow without bound if the data is dense
+    typedef std::unordered_map<aku_ParamId, WindowState>::value_type EntryT;
+    size_t total = windows_.size() * (sizeof(EntryT) + 2 * sizeof(void*));
+    for (auto const& kv: windows_) {
+        total += kv.second.samples.size() * sizeof(std::tuple<u64, aku_Timestamp, double>)
+               + (kv.second.minq.size() + kv.second.maxq.size()) * sizeof(std::pair<u64, double>);
+    }
+    return total;
+}
+
+int SlidingWindow::get_requirements() const {
+    return EMPTY;
+}
+
+static QueryParserToken<SlidingWindow> window_token("window");
+
+}}  // namespace
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+#include "../queryprocessor_framework.h"
+
+namespace Akumuli {
+namespace QP {
+
+/** Sliding window aggregation node.
+  * Computes sum/min/max/mean/stddev over a trailing time- or count-based
+  * window and emits one aggregated value per input sample. All aggregates
+  * are maintained incrementally: eviction updates the running sums and
+  * min/max are tracked with monotonic deques, so nothing is recomputed
+  * when the window slides.
+  */
+struct SlidingWindow : Node {
+
+    enum Function {
+        SUM,
+        MIN,
+        MAX,
+        MEAN,
+        STDDEV,
+    };
+
+    //! Per-series window state
+    struct WindowState {
+        //! Samples inside the window (seqno, timestamp, value)
+        std::deque<std::tuple<u64, aku_Timestamp, double>> samples;
+        //! Monotonic deques for min/max tracking (seqno, value)
+        std::deque<std::pair<u64, double>> minq;
+        std::deque<std::pair<u64, double>> maxq;
+        double sum    = 0.0;
+        double sumsq  = 0.0;
+        u64    seqno  = 0;
+    };
+
+    Function              fn_;
+    aku_Timestamp         width_;  //! Time-based window width (0 - count-based)
+    size_t                count_;  //! Count-based window size (0 - time-based)
+    std::unordered_map<aku_ParamId, WindowState> windows_;
+    std::shared_ptr<Node> next_;
+
+    SlidingWindow(Function fn, aku_Timestamp width, size_t count, std::shared_ptr<Node> next);
+
+    SlidingWindow(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next);
+
+    //! Fold value into the window and return the current aggregate
+    double update(WindowState& state, aku_Timestamp ts, double value);
+
+    virtual void complete();
+
+    virtual bool put(const aku_Sample& sample);
+
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
+    virtual void set_error(aku_Status status);
+
+    virtual size_t get_used_memory() const;
+
+    virtual int get_requirements() const;
+
+private:
+    static Function parse_function(std::string const& name);
+
+    void validate_() const;
+};
+}
+}  // namespace
@@ -1,26 +1,118 @@
 #pragma once
 
+#include <cmath>
 #include <memory>
-#include <unordered_map>
+#include <vector>
 
 #include "../queryprocessor_framework.h"
 
 namespace Akumuli {
 namespace QP {
 
-template <bool weighted>
-struct SpaceSaver : Node {
-    std::shared_ptr<Node> next_;
+/** Open-addressing table of per-series counters.
+  * Linear probing over a flat power-of-two sized array of buckets.
+  * Removal uses backward shift deletion so probe chains stay intact
+  * without tombstones. Flat layout keeps the min-scan on eviction
+  * cache friendly and the table never rehashes after construction.
+  */
+struct CounterTable {
 
-    struct Item {
-        double count;
-        double error;
+    struct Bucket {
+        aku_ParamId id;
+        double      count;
+        double      error;
+        bool        used;
     };
 
-    std::unordered_map<aku_ParamId, Item> counters_;
-    //! Capacity
+    std::vector<Bucket> buckets_;
+    u32                 mask_;
+    size_t              size_;
+    //! Max number of elements table can hold
+    size_t              nmax_;
+
+    CounterTable(size_t nmax)
+        : size_(0)
+        , nmax_(nmax)
+    {
+        // Load factor is kept below 0.5 so probe chains stay short
+        size_t cap = 8;
+        while (cap < 2*nmax) {
+            cap <<= 1;
+        }
+        buckets_.resize(cap);
+        mask_ = static_cast<u32>(cap - 1);
+    }
+
+    static u32 hash(aku_ParamId id) {
+        return static_cast<u32>((id * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    //! Returns pointer to the bucket of the element or nullptr
+    Bucket* find(aku_ParamId id) {
+        u32 ix = hash(id) & mask_;
+        while (buckets_[ix].used) {
+            if (buckets_[ix].id == id) {
+                return &buckets_[ix];
+            }
+            ix = (ix + 1) & mask_;
+        }
+        return nullptr;
+    }
+
+    //! Inserts new element (table shouldn't be full)
+    void insert(aku_ParamId id, double count, double error) {
+        u32 ix = hash(id) & mask_;
+        while (buckets_[ix].used) {
+            ix = (ix + 1) & mask_;
+        }
+        buckets_[ix] = { id, count, error, true };
+        size_++;
+    }
+
+    //! Returns bucket with the smallest count (table shouldn't be empty)
+    Bucket* min_element() {
+        Bucket* res = nullptr;
+        for (auto& bucket : buckets_) {
+            if (bucket.used && (res == nullptr || bucket.count < res->count)) {
+                res = &bucket;
+            }
+        }
+        return res;
+    }
+
+    //! Removes the bucket shifting displaced elements back into the hole
+    void erase(Bucket* bucket) {
+        u32 hole = static_cast<u32>(bucket - buckets_.data());
+        u32 ix   = hole;
+        while (true) {
+            ix = (ix + 1) & mask_;
+            if (!buckets_[ix].used) {
+                break;
+            }
+            u32 home = hash(buckets_[ix].id) & mask_;
+            if (((ix - home) & mask_) >= ((ix - hole) & mask_)) {
+                buckets_[hole] = buckets_[ix];
+                hole = ix;
+            }
+        }
+        buckets_[hole].used = false;
+        size_--;
+    }
+
+    void clear() {
+        std::fill(buckets_.begin(), buckets_.end(), Bucket{});
+        size_ = 0;
+    }
+
+    bool full() const { return size_ == nmax_; }
+};
+
+template <bool weighted>
+struct SpaceSaver : Node {
+    std::shared_ptr<Node> next_;
+    CounterTable counters_;
+    //! Number of elements (or total weight) seen so far
     double N;
-    size_t M;
     double P;
 
     /** C-tor.
@@ -31,8 +123,8 @@ struct SpaceSaver : Node {
       */
     SpaceSaver(double error, double portion, std::shared_ptr<Node> next)
         : next_(next)
+        , counters_(static_cast<size_t>(ceil(1.0 / error)))
         , N(0)
-        , M(ceil(1.0 / error))
         , P(portion)  // between 0 and 1
     {
         assert(P >= 0.0);
@@ -41,16 +133,10 @@ struct SpaceSaver : Node {
 
     SpaceSaver(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
         : next_(next)
+        , counters_(table_capacity(ptree))
         , N(0)
     {
-        double error   = ptree.get<double>("error");
-        double portion = ptree.get<double>("portion");
-        if (error == 0.0) {
-            QueryParserError error("`error` can't be 0.");
-            BOOST_THROW_EXCEPTION(error);
-        }
-        M = ceil(1.0 / error);
-        P = portion;
+        P = ptree.get<double>("portion");
         if (P < 0.0) {
             QueryParserError error("`portion` can't be negative");
             BOOST_THROW_EXCEPTION(error);
@@ -61,16 +147,28 @@ struct SpaceSaver : Node {
         }
     }
 
+    static size_t table_capacity(boost::property_tree::ptree const& ptree) {
+        double error = ptree.get<double>("error");
+        if (error == 0.0) {
+            QueryParserError err("`error` can't be 0.");
+            BOOST_THROW_EXCEPTION(err);
+        }
+        return static_cast<size_t>(ceil(1.0 / error));
+    }
+
     bool count() {
         std::vector<aku_Sample> samples;
         auto                    support = N * P;
-        for (auto it : counters_) {
-            auto estimate = it.second.count - it.second.error;
+        for (auto const& bucket : counters_.buckets_) {
+            if (!bucket.used) {
+                continue;
+            }
+            auto estimate = bucket.count - bucket.error;
             if (support < estimate) {
                 aku_Sample s;
-                s.paramid         = it.first;
+                s.paramid         = bucket.id;
                 s.payload.type    = aku_PData::PARAMID_BIT | aku_PData::FLOAT_BIT;
-                s.payload.float64 = it.second.count;
+                s.payload.float64 = bucket.count;
                 s.payload.size    = sizeof(aku_Sample);
                 samples.push_back(s);
             }
@@ -87,6 +185,27 @@ struct SpaceSaver : Node {
         return true;
     }
 
+    void add(aku_ParamId id, double weight) {
+        auto bucket = counters_.find(id);
+        if (bucket == nullptr) {
+            // new element
+            double count = weight;
+            double error = 0;
+            if (counters_.full()) {
+                // replace element with smallest count
+                auto min_bucket = counters_.min_element();
+                count += min_bucket->count;
+                error  = min_bucket->count;
+                counters_.erase(min_bucket);
+            }
+            counters_.insert(id, count, error);
+        } else {
+            // increment
+            bucket->count += weight;
+        }
+        N += weight;
+    }
+
     virtual void complete() {
         count();
         next_->complete();
@@ -101,38 +220,26 @@ struct SpaceSaver : Node {
                 return true;
             }
         }
-        auto id     = sample.paramid;
-        auto weight = weighted ? sample.payload.float64 : 1.0;
-        auto it     = counters_.find(id);
-        if (it == counters_.end()) {
-            // new element
-            double count = weight;
-            double error = 0;
-            if (counters_.size() == M) {
-                // remove element with smallest count
-                size_t min      = std::numeric_limits<size_t>::max();
-                auto   min_iter = it;
-                for (auto i = counters_.begin(); i != counters_.end(); i++) {
-                    if (i->second.count < min) {
-                        min_iter = i;
-                        min      = i->second.count;
-                    }
-                }
-                counters_.erase(min_iter);
-                count += min;
-                error = min;
-            }
-            counters_[id] = { count, error };
-        } else {
-            // increment
-            it->second.count += weight;
+        add(sample.paramid, weighted ? sample.payload.float64 : 1.0);
+        return true;
+    }
+
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss) {
+        // Margins never arrive in batches, every element is a plain float
+        for (size_t i = 0; i < n; i++) {
+            add(ids[i], weighted ? xss[i] : 1.0);
         }
-        N += weight;
         return true;
     }
 
     virtual void set_error(aku_Status status) { next_->set_error(status); }
 
+    virtual size_t get_used_memory() const {
+        // The table never rehashes so this is the peak usage
+        return counters_.buckets_.capacity() * sizeof(CounterTable::Bucket);
+    }
+
     virtual int get_requirements() const { return EMPTY | TERMINAL; }
 };
 }
@@ -18,6 +18,7 @@
 #include "util.h"
 #include "datetime.h"
 #include "anomalydetector.h"
+#include "rollup.h"
 #include "saxencoder.h"
 
 #include <random>
@@ -31,13 +32,16 @@
 #include <boost/exception/diagnostic_information.hpp>
 
 // Include query processors
+#include "query_processing/aggregate.h"
 #include "query_processing/anomaly.h"
 #include "query_processing/filterbyid.h"
 #include "query_processing/paa.h"
 #include "query_processing/randomsamplingnode.h"
 #include "query_processing/sax.h"
 #include "query_processing/spacesaver.h"
+#include "query_processing/fusion.h"
 #include "query_processing/limiter.h"
+#include "query_processing/slidingwindow.h"
 
 namespace Akumuli {
 namespace QP {
@@ -61,6 +65,22 @@ static std::shared_ptr<Node> make_sampler(boost::property_tree::ptree const& ptr
     }
 }
 
+static std::shared_ptr<Node> make_fused_sampler(boost::property_tree::ptree const& ptree,
+                                                u64 limit,
+                                                u64 offset,
+                                                std::shared_ptr<Node> next,
+                                                aku_logger_cb_t logger)
+{
+    try {
+        std::string name;
+        name = ptree.get<std::string>("name");
+        return QP::create_fused_node(name, limit, offset, next);
+    } catch (const boost::property_tree::ptree_error&) {
+        QueryParserError except("invalid sampler description");
+        BOOST_THROW_EXCEPTION(except);
+    }
+}
+
 
 
 struct RegexFilter : IQueryFilter {
@@ -169,6 +189,55 @@ bool GroupByTime::put(aku_Sample const& sample, Node& next) {
     return next.put(sample);
 }
 
+bool GroupByTime::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                            const double* xss, Node& next)
+{
+    if (!step_) {
+        return next.put_batch(n, ids, tss, xss);
+    }
+    size_t begin = 0;
+    for (size_t i = 0; i < n; i++) {
+        aku_Timestamp ts = tss[i];
+        if (AKU_UNLIKELY(first_hit_ == true)) {
+            first_hit_ = false;
+            aku_Timestamp aligned = ts / step_ * step_;
+            lowerbound_ = aligned;
+            upperbound_ = aligned + step_;
+        }
+        if (ts >= upperbound_) {
+            // Forward direction - flush the run accumulated so far
+            if (i != begin && !next.put_batch(i - begin, ids + begin, tss + begin, xss + begin)) {
+                return false;
+            }
+            begin = i;
+            aku_Sample empty = SAMPLING_HI_MARGIN;
+            empty.timestamp = upperbound_;
+            if (!next.put(empty)) {
+                return false;
+            }
+            lowerbound_ += step_;
+            upperbound_ += step_;
+        } else if (ts < lowerbound_) {
+            // Backward direction
+            if (i != begin && !next.put_batch(i - begin, ids + begin, tss + begin, xss + begin)) {
+                return false;
+            }
+            begin = i;
+            aku_Sample empty = SAMPLING_LO_MARGIN;
+            empty.timestamp = upperbound_;
+            if (!next.put(empty)) {
+                return false;
+            }
+            lowerbound_ -= step_;
+            upperbound_ -= step_;
+        }
+    }
+    if (n != begin && !next.put_batch(n - begin, ids + begin, tss + begin, xss + begin)) {
+        return false;
+    }
+    return true;
+}
+
 bool GroupByTime::empty() const {
     return step_ == 0;
 }
@@ -208,31 +277,45 @@ void GroupByTag::refresh_() {
         SeriesParser::StringT result;
         std::tie(status, result) = SeriesParser::filter_tags(item, filter, buffer);
         if (status == AKU_SUCCESS) {
+            aku_ParamId localid;
             if (snames_.count(result) == 0) {
                 // put result to local stringpool and ids list
-                auto localid = local_matcher_.add(result.first, result.first + result.second);
+                localid = local_matcher_.add(result.first, result.first + result.second);
                 auto str = local_matcher_.id2str(localid);
                 snames_.insert(str);
-                ids_[id] = localid;
             } else {
                 // local name already created
-                auto localid = local_matcher_.match(result.first, result.first + result.second);
+                localid = local_matcher_.match(result.first, result.first + result.second);
                 if (localid == 0ul) {
                     AKU_PANIC("inconsistent matcher state");
                 }
-                ids_[id] = localid;
             }
+            if (id >= table_.size()) {
+                table_.resize(id + 1, 0ul);
+            }
+            table_[id] = localid;
         }
     }
 }
 
-bool GroupByTag::apply(aku_Sample* sample) {
+aku_ParamId GroupByTag::get_group(aku_ParamId id) {
     if (spool_->size() != prev_size_) {
         refresh_();
     }
-    auto it = ids_.find(sample->paramid);
-    if (it != ids_.end()) {
-        sample->paramid = it->second;
+    return id < table_.size() ? table_[id] : 0ul;
+}
+
+size_t GroupByTag::get_used_memory() const {
+    // The local string pool grows in MAX_BIN_SIZE chunks
+    return local_matcher_.pool.nbins_.load() * static_cast<size_t>(StringPool::MAX_BIN_SIZE)
+         + table_.capacity() * sizeof(aku_ParamId)
+         + snames_.size() * (sizeof(StringTools::StringT) + 2 * sizeof(void*));
+}
+
+bool GroupByTag::apply(aku_Sample* sample) {
+    auto group = get_group(sample->paramid);
+    if (group != 0ul) {
+        sample->paramid = group;
         return true;
     }
     return false;
@@ -252,7 +335,8 @@ ScanQueryProcessor::ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
                                        QueryRange::QueryRangeType type,
                                        std::shared_ptr<IQueryFilter> filter,
                                        GroupByTime groupby,
-                                       std::unique_ptr<GroupByTag> groupbytag
+                                       std::unique_ptr<GroupByTag> groupbytag,
+                                       u64 memory_limit
                                        )
     : range_(make_range(begin, end, type))
     , metric_(metric)
@@ -260,6 +344,8 @@ ScanQueryProcessor::ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
     , groupby_(groupby)
     , filter_(filter)
     , groupby_tag_(std::move(groupbytag))
+    , memory_limit_(memory_limit)
+    , samples_until_check_(MEMORY_CHECK_INTERVAL)
 {
     if (nodes.empty()) {
         AKU_PANIC("`nodes` shouldn't be empty")
@@ -294,6 +380,28 @@ ScanQueryProcessor::ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
         NodeException err("invalid range field");
         BOOST_THROW_EXCEPTION(err);
     }
+
+    nodes_ = std::move(nodes);
+}
+
+bool ScanQueryProcessor::check_memory_budget_(size_t nsamples) {
+    if (memory_limit_ == 0) {
+        return true;
+    }
+    if (samples_until_check_ > nsamples) {
+        samples_until_check_ -= nsamples;
+        return true;
+    }
+    samples_until_check_ = MEMORY_CHECK_INTERVAL;
+    size_t used = groupby_tag_ ? groupby_tag_->get_used_memory() : 0u;
+    for (auto const& node: nodes_) {
+        used += node->get_used_memory();
+    }
+    if (used > memory_limit_) {
+        set_error(AKU_ENO_MEM);
+        return false;
+    }
+    return true;
 }
 
 IQueryFilter& ScanQueryProcessor::filter() {
@@ -308,6 +416,12 @@ SeriesMatcher* ScanQueryProcessor::matcher() {
 }
 
 bool ScanQueryProcessor::start() {
+    if (filter_->get_ids().empty()) {
+        // The where clause matches no series, storage scan can be skipped
+        // entirely (the contract is to complete the chain and return false)
+        root_node_->complete();
+        return false;
+    }
     return true;
 }
 
@@ -316,6 +430,9 @@ bool ScanQueryProcessor::put(const aku_Sample &sample) {
         // shourtcut for empty samples
         return last_node_->put(sample);
     }
+    if (AKU_UNLIKELY(!check_memory_budget_(1))) {
+        return false;
+    }
     // We're dealing with basic sample here (no extra payload)
     // that comes right from page or sequencer. Because of that
     // we can copy it without slicing.
@@ -326,6 +443,52 @@ bool ScanQueryProcessor::put(const aku_Sample &sample) {
     return groupby_.put(copy, *root_node_);
 }
 
+bool ScanQueryProcessor::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                                   const double* xss)
+{
+    if (AKU_UNLIKELY(!check_memory_budget_(n))) {
+        return false;
+    }
+    auto& flt = filter();
+    if (groupby_tag_) {
+        // Group lookup is an array index so the ids can be rewritten in bulk
+        std::vector<aku_ParamId> groups(n);
+        size_t begin = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (flt.apply(ids[i]) == IQueryFilter::PROCESS &&
+                (groups[i] = groupby_tag_->get_group(ids[i])) != 0ul) {
+                continue;
+            }
+            if (i != begin && !groupby_.put_batch(i - begin, groups.data() + begin,
+                                                  tss + begin, xss + begin, *root_node_)) {
+                return false;
+            }
+            begin = i + 1;
+        }
+        if (n != begin && !groupby_.put_batch(n - begin, groups.data() + begin,
+                                              tss + begin, xss + begin, *root_node_)) {
+            return false;
+        }
+        return true;
+    }
+    // Forward runs of unfiltered samples as batches
+    size_t begin = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (flt.apply(ids[i]) != IQueryFilter::PROCESS) {
+            if (i != begin && !groupby_.put_batch(i - begin, ids + begin, tss + begin,
+                                                  xss + begin, *root_node_)) {
+                return false;
+            }
+            begin = i + 1;
+        }
+    }
+    if (n != begin && !groupby_.put_batch(n - begin, ids + begin, tss + begin,
+                                          xss + begin, *root_node_)) {
+        return false;
+    }
+    return true;
+}
+
 void ScanQueryProcessor::stop() {
     root_node_->complete();
 }
@@ -384,6 +547,65 @@ void MetadataQueryProcessor::set_error(aku_Status error) {
     root_->set_error(error);
 }
 
+CardinalityQueryProcessor::CardinalityQueryProcessor(std::vector<std::pair<std::string, double>> estimates,
+                                                     std::shared_ptr<Node> node)
+    : estimates_(std::move(estimates))
+    , root_(node)
+{
+}
+
+SeriesMatcher* CardinalityQueryProcessor::matcher() {
+    return nullptr;
+}
+
+QueryRange CardinalityQueryProcessor::range() const {
+    return QueryRange{AKU_MAX_TIMESTAMP, AKU_MAX_TIMESTAMP, QueryRange::INSTANT};
+}
+
+IQueryFilter& CardinalityQueryProcessor::filter() {
+    return filter_;
+}
+
+bool CardinalityQueryProcessor::start() {
+    // One buffer is reused for every sample (alloca would grow the stack
+    // by one sample per tag key until the function returns)
+    size_t maxsize = sizeof(aku_Sample);
+    for (auto const& kv: estimates_) {
+        maxsize = std::max(maxsize, sizeof(aku_Sample) + kv.first.size());
+    }
+    std::vector<char> buffer(maxsize);
+    for (auto const& kv: estimates_) {
+        // Tag key travels in the extra payload (the same way SAX words
+        // do), the estimate goes into the value field
+        size_t ssize = sizeof(aku_Sample) + kv.first.size();
+        aku_Sample* s = new (buffer.data()) aku_Sample();
+        s->paramid = 0;
+        s->timestamp = 0;
+        s->payload.type = aku_PData::FLOAT_BIT | aku_PData::STRING_PAYLOAD;
+        s->payload.size = static_cast<u16>(ssize);
+        s->payload.float64 = kv.second;
+        memcpy(s->payload.data, kv.first.data(), kv.first.size());
+        if (!root_->put(*s)) {
+            root_->complete();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CardinalityQueryProcessor::put(const aku_Sample &sample) {
+    // no-op
+    return false;
+}
+
+void CardinalityQueryProcessor::stop() {
+    root_->complete();
+}
+
+void CardinalityQueryProcessor::set_error(aku_Status error) {
+    root_->set_error(error);
+}
+
 
 
 //                          //
@@ -397,8 +619,7 @@ static boost::optional<std::string> parse_select_stmt(boost::property_tree::ptre
     if (select && select->empty()) {
         // simple select query
         auto str = select->get_value<std::string>("");
-        if (str == "names") {
-            // the only supported select query for now
+        if (str == "names" || str == "cardinality") {
             return str;
         }
         (*logger)(AKU_LOG_ERROR, "Invalid `select` query");
@@ -408,6 +629,22 @@ static boost::optional<std::string> parse_select_stmt(boost::property_tree::ptre
     return boost::optional<std::string>();
 }
 
+static boost::optional<std::string> parse_aggregate_stmt(boost::property_tree::ptree const& ptree,
+                                                         aku_logger_cb_t logger) {
+    auto aggregate = ptree.get_child_optional("aggregate");
+    if (aggregate && aggregate->empty()) {
+        // function name, e.g. "aggregate": "sum"
+        auto str = aggregate->get_value<std::string>("");
+        if (!str.empty()) {
+            return str;
+        }
+        (*logger)(AKU_LOG_ERROR, "Invalid `aggregate` query");
+        auto rte = std::runtime_error("Invalid `aggregate` query");
+        BOOST_THROW_EXCEPTION(rte);
+    }
+    return boost::optional<std::string>();
+}
+
 static std::tuple<QP::GroupByTime, std::vector<std::string>> parse_groupby(boost::property_tree::ptree const& ptree,
                                                                            aku_logger_cb_t logger) {
     std::vector<std::string> tags;
@@ -441,7 +678,7 @@ static std::pair<u64, u64> parse_limit_offset(boost::property_tree::ptree const&
     }
     auto optoffset = ptree.get_child_optional("offset");
     if (optoffset) {
-        limit = optoffset->get_value<u64>();
+        offset = optoffset->get_value<u64>();
     }
     return std::make_pair(limit, offset);
 }
@@ -568,6 +805,21 @@ std::shared_ptr<QP::IQueryProcessor> Builder::build_query_processor(const char*
         std::vector<std::string> tags;
         GroupByTime groupbytime;
         std::tie(groupbytime, tags) = parse_groupby(ptree, logger);
+
+        // Prefer a materialized rollup when the query groups by a time step
+        // at least as coarse as one of the rollup resolutions
+        if (!metric.empty() && !groupbytime.empty()) {
+            auto suffix = RollupEngine::suffix_for_step(groupbytime.step_);
+            if (!suffix.empty()) {
+                std::stringstream series_regex;
+                series_regex << metric << suffix << "(?:\\s\\w+=\\w+)*";
+                if (!matcher.pool.regex_match(series_regex.str().c_str()).empty()) {
+                    metric += suffix;
+                    (*logger)(AKU_LOG_INFO, ("Using rollup metric " + metric).c_str());
+                }
+            }
+        }
+
         auto groupbytag = std::unique_ptr<GroupByTag>();
         if (!tags.empty()) {
             groupbytag.reset(new GroupByTag(&matcher.pool, metric, tags));
@@ -576,9 +828,15 @@ std::shared_ptr<QP::IQueryProcessor> Builder::build_query_processor(const char*
         // Read limit/offset
         auto limoff = parse_limit_offset(ptree, logger);
 
+        // Read per-query memory budget
+        u64 memlimit = ptree.get<u64>("memory-limit", 0ul);
+
         // Read select statment
         auto select = parse_select_stmt(ptree, logger);
 
+        // Read aggregate statement
+        auto aggregate = parse_aggregate_stmt(ptree, logger);
+
         // Read sampling method
         auto sampling_params = ptree.get_child_optional("sample");
 
@@ -591,20 +849,51 @@ std::shared_ptr<QP::IQueryProcessor> Builder::build_query_processor(const char*
             BOOST_THROW_EXCEPTION(rte);
         }
 
+        if (aggregate && (select || sampling_params)) {
+            (*logger)(AKU_LOG_ERROR, "Can't combine aggregate with select or sample statements");
+            auto rte = std::runtime_error("`aggregate` can't be used with `select` or `sample`");
+            BOOST_THROW_EXCEPTION(rte);
+        }
+
         // Build topology
         std::shared_ptr<Node> next = terminal;
         std::vector<std::shared_ptr<Node>> allnodes = { next };
+        bool sampler_fused = false;
         if (limoff.first != 0 || limoff.second != 0) {
-            // Limiter should work with both metadata and scan queryprocessors.
-            next = std::make_shared<QP::Limiter>(limoff.first, limoff.second, terminal);
-            allnodes.push_back(next);
+            if (!select && !aggregate && sampling_params && sampling_params->size() == 1) {
+                // The most common dashboard shape is a single sampler feeding
+                // a limiter. Collapse the pair into one fused node at plan
+                // time to cut the intermediate virtual dispatch per sample.
+                auto fused = make_fused_sampler(sampling_params->begin()->second,
+                                                limoff.first, limoff.second,
+                                                terminal, logger);
+                if (fused) {
+                    next = fused;
+                    allnodes.push_back(next);
+                    sampler_fused = true;
+                }
+            }
+            if (!sampler_fused) {
+                // Limiter should work with both metadata and scan queryprocessors.
+                next = std::make_shared<QP::Limiter>(limoff.first, limoff.second, terminal);
+                allnodes.push_back(next);
+            }
+        }
+        if (select && *select == "cardinality") {
+            // Served entirely from the matcher's sketches, the where
+            // clause doesn't apply here
+            return std::make_shared<CardinalityQueryProcessor>(matcher.get_cardinality(), next);
         }
         if (!select) {
             // Read timestamps
             auto ts_begin = parse_range_timestamp(ptree, "from", logger);
             auto ts_end = parse_range_timestamp(ptree, "to", logger);
 
-            if (sampling_params) {
+            if (aggregate) {
+                next = std::make_shared<QP::Aggregate>(Aggregate::parse_function(*aggregate), next);
+                allnodes.push_back(next);
+            }
+            if (sampling_params && !sampler_fused) {
                 for (auto i = sampling_params->rbegin(); i != sampling_params->rend(); i++) {
                     next = make_sampler(i->second, next, logger);
                     allnodes.push_back(next);
@@ -614,7 +903,8 @@ std::shared_ptr<QP::IQueryProcessor> Builder::build_query_processor(const char*
             // Build query processor
             return std::make_shared<ScanQueryProcessor>(allnodes, metric, ts_begin, ts_end,
                                                         QueryRange::INSTANT,  // TODO: parse from query
-                                                        filter, groupbytime, std::move(groupbytag));
+                                                        filter, groupbytime, std::move(groupbytag),
+                                                        memlimit);
         }
         return std::make_shared<MetadataQueryProcessor>(filter, next);
 
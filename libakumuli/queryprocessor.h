@@ -59,6 +59,13 @@ struct GroupByTime {
 
     bool put(aku_Sample const& sample, Node& next);
 
+    /** Process a run of plain float samples, forwarding sub-runs that
+      * fall into one bucket to `next` as batches and emitting margins
+      * on bucket boundaries.
+      */
+    bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                   const double* xss, Node& next);
+
     bool empty() const;
 };
 
@@ -66,8 +73,9 @@ struct GroupByTime {
 /** Group-by tag statement processor */
 struct GroupByTag {
     std::string regex_;
-    //! Mapping from global parameter ids to local parameter ids
-    std::unordered_map<aku_ParamId, aku_ParamId> ids_;
+    //! Flat mapping from global parameter ids to local group ids (0 - no
+    //! group). Ids are dense so the per-sample lookup is an array index.
+    std::vector<aku_ParamId> table_;
     //! Shared string pool
     StringPool const* spool_;
     //! Previous string pool offset
@@ -84,8 +92,15 @@ struct GroupByTag {
     //! Main c-tor
     GroupByTag(StringPool const* spool, std::string metric, std::vector<std::string> const& tags);
 
+    //! Approximate size of the group-by state in bytes
+    size_t get_used_memory() const;
+
     void refresh_();
 
+    //! Map global parameter id to group id (returns 0 if the series
+    //! doesn't belong to any group)
+    aku_ParamId get_group(aku_ParamId id);
+
     bool apply(aku_Sample* sample);
 };
 
@@ -114,6 +129,17 @@ struct ScanQueryProcessor : IQueryProcessor {
     std::shared_ptr<Node> last_node_;
     //! Group-by-tag
     std::unique_ptr<GroupByTag> groupby_tag_;
+    //! All nodes of the topology (used for memory accounting)
+    std::vector<std::shared_ptr<Node>> nodes_;
+    //! Per-query memory budget in bytes (0 - unlimited)
+    u64 memory_limit_;
+    //! Number of samples to process before the next budget check
+    u64 samples_until_check_;
+
+    enum {
+        //! How often (in samples) the memory budget is checked
+        MEMORY_CHECK_INTERVAL = 0x1000,
+    };
 
     /** Create new query processor.
       * @param root is a root of the processing topology
@@ -121,11 +147,19 @@ struct ScanQueryProcessor : IQueryProcessor {
       * @param begin is a timestamp to begin from
       * @param end is a timestamp to end with
       *        (depending on a scan direction can be greater or smaller then lo)
+      * @param memory_limit is a per-query memory budget in bytes (0 - unlimited)
       */
     ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes, std::string metric,
                        aku_Timestamp begin, aku_Timestamp end, QueryRange::QueryRangeType type,
                        std::shared_ptr<IQueryFilter> filter, GroupByTime groupby,
-                       std::unique_ptr<GroupByTag> groupbytag);
+                       std::unique_ptr<GroupByTag> groupbytag, u64 memory_limit = 0);
+
+    /** Check that the query fits into its memory budget (counts down
+      * `nsamples`, the node states are actually summed up once per
+      * `MEMORY_CHECK_INTERVAL` samples). Sets AKU_ENO_MEM and returns
+      * false if the budget is exceeded.
+      */
+    bool check_memory_budget_(size_t nsamples);
 
     QueryRange range() const;
 
@@ -138,6 +172,10 @@ struct ScanQueryProcessor : IQueryProcessor {
     //! Process value
     bool put(const aku_Sample& sample);
 
+    //! Process a run of decoded chunk values
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
     //! Should be called when processing completed
     void stop();
 
@@ -161,5 +199,29 @@ struct MetadataQueryProcessor : IQueryProcessor {
     void stop();
     void set_error(aku_Status error);
 };
+
+/** Query processor that returns per-tag-key series cardinality estimates.
+  * The estimates come from the matcher's sketches that are maintained
+  * incrementally on series creation, so the query doesn't scan the series
+  * names at all. Each output sample carries the estimate in the value
+  * field and the tag key in the extra string payload.
+  */
+struct CardinalityQueryProcessor : IQueryProcessor {
+
+    std::vector<std::pair<std::string, double>> estimates_;
+    std::shared_ptr<Node>                       root_;
+    BypassFilter                                filter_;
+
+    CardinalityQueryProcessor(std::vector<std::pair<std::string, double>> estimates,
+                              std::shared_ptr<Node> node);
+
+    QueryRange     range() const;
+    IQueryFilter&  filter();
+    SeriesMatcher* matcher();
+    bool           start();
+    bool put(const aku_Sample& sample);
+    void stop();
+    void set_error(aku_Status error);
+};
 }
 }  // namespaces
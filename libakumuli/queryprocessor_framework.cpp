@@ -12,6 +12,44 @@ struct QueryParserRegistry {
     }
 };
 
+bool Node::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                     const double* xss)
+{
+    for (size_t i = 0; i < n; i++) {
+        aku_Sample sample;
+        sample.timestamp       = tss[i];
+        sample.paramid         = ids[i];
+        sample.payload.type    = AKU_PAYLOAD_FLOAT;
+        sample.payload.size    = sizeof(aku_Sample);
+        sample.payload.float64 = xss[i];
+        if (!put(sample)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IQueryProcessor::put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                                const double* xss)
+{
+    auto& flt = filter();
+    for (size_t i = 0; i < n; i++) {
+        if (flt.apply(ids[i]) != IQueryFilter::PROCESS) {
+            continue;
+        }
+        aku_Sample sample;
+        sample.timestamp       = tss[i];
+        sample.paramid         = ids[i];
+        sample.payload.type    = AKU_PAYLOAD_FLOAT;
+        sample.payload.size    = sizeof(aku_Sample);
+        sample.payload.float64 = xss[i];
+        if (!put(sample)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void add_queryparsertoken_to_registry(const BaseQueryParserToken *ptr) {
     QueryParserRegistry::get().registry[ptr->get_tag()] = ptr;
 }
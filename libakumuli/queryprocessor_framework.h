@@ -37,8 +37,24 @@ struct Node {
       */
     virtual bool put(aku_Sample const& sample) = 0;
 
+    /** Process a run of values with plain float payload (margins and
+      * empty samples never arrive this way). Default implementation
+      * forwards samples one by one, nodes that can reduce whole arrays
+      * should override it.
+      */
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
     virtual void set_error(aku_Status status) = 0;
 
+    /** Approximate size of the node's internal state in bytes.
+      * Used to enforce the per-query memory budget (`memory-limit`
+      * statement). Nodes whose state grows with series cardinality or
+      * window size should override this, stateless nodes can rely on
+      * the default.
+      */
+    virtual size_t get_used_memory() const { return 0; }
+
     // Query validation
 
     enum QueryFlags {
@@ -143,6 +159,12 @@ struct IQueryProcessor {
     //! Get new value
     virtual bool put(const aku_Sample& sample) = 0;
 
+    /** Put a run of decoded chunk values at once. Default implementation
+      * applies the filter and forwards samples one by one.
+      */
+    virtual bool put_batch(size_t n, const aku_ParamId* ids, const aku_Timestamp* tss,
+                           const double* xss);
+
     //! Will be called when processing completed without errors
     virtual void stop() = 0;
 
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "reorder_buffer.h"
+#include "util.h"
+
+#include <cstring>
+
+namespace Akumuli {
+
+// Striped per thread so counting doesn't cost coherence traffic
+static StripedCounter g_late_samples;
+static StripedCounter g_dup_samples;
+
+ReorderBuffer::ReorderBuffer(aku_Duration lateness)
+    : lateness_(lateness)
+{
+}
+
+bool ReorderBuffer::put(aku_ParamId id, aku_Timestamp ts, double value, std::vector<OutSample>* outbuf) {
+    auto it = rings_.find(id);
+    if (it == rings_.end()) {
+        Ring ring = {};
+        it = rings_.insert(std::make_pair(id, ring)).first;
+    }
+    Ring& ring = it->second;
+    if (ts < ring.watermark) {
+        // Sample is older than the last released one - it can't be
+        // reordered anymore, let the caller decide its fate
+        g_late_samples.add(1);
+        outbuf->push_back(OutSample{id, ts, value});
+        return true;
+    }
+    // Find insertion position. Samples are mostly ordered so the scan
+    // starts from the tail and usually stops right away.
+    u32 pos = ring.size;
+    while (pos > 0 && ring.tss[pos - 1] > ts) {
+        pos--;
+    }
+    if (pos > 0 && ring.tss[pos - 1] == ts) {
+        // Duplicate of a pending sample
+        g_dup_samples.add(1);
+        return false;
+    }
+    if (ring.size == RING_SIZE) {
+        // Ring is full - release the oldest sample to make room
+        outbuf->push_back(OutSample{id, ring.tss[0], ring.xss[0]});
+        ring.watermark = ring.tss[0];
+        memmove(ring.tss.data(), ring.tss.data() + 1, (RING_SIZE - 1)*sizeof(aku_Timestamp));
+        memmove(ring.xss.data(), ring.xss.data() + 1, (RING_SIZE - 1)*sizeof(double));
+        ring.size--;
+        pos--;
+    }
+    memmove(ring.tss.data() + pos + 1, ring.tss.data() + pos, (ring.size - pos)*sizeof(aku_Timestamp));
+    memmove(ring.xss.data() + pos + 1, ring.xss.data() + pos, (ring.size - pos)*sizeof(double));
+    ring.tss[pos] = ts;
+    ring.xss[pos] = value;
+    ring.size++;
+    // Release samples that fell out of the lateness bound
+    auto newest = ring.tss[ring.size - 1];
+    u32 nready = 0;
+    while (nready < ring.size - 1 && newest - ring.tss[nready] > lateness_) {
+        outbuf->push_back(OutSample{id, ring.tss[nready], ring.xss[nready]});
+        nready++;
+    }
+    if (nready != 0) {
+        ring.watermark = ring.tss[nready - 1];
+        memmove(ring.tss.data(), ring.tss.data() + nready, (ring.size - nready)*sizeof(aku_Timestamp));
+        memmove(ring.xss.data(), ring.xss.data() + nready, (ring.size - nready)*sizeof(double));
+        ring.size -= nready;
+    }
+    return true;
+}
+
+void ReorderBuffer::flush(std::vector<OutSample>* outbuf) {
+    for (auto& kv: rings_) {
+        Ring& ring = kv.second;
+        for (u32 i = 0; i < ring.size; i++) {
+            outbuf->push_back(OutSample{kv.first, ring.tss[i], ring.xss[i]});
+        }
+        if (ring.size != 0) {
+            ring.watermark = ring.tss[ring.size - 1];
+            ring.size = 0;
+        }
+    }
+}
+
+u64 ReorderBuffer::late_count() {
+    return g_late_samples.sum();
+}
+
+u64 ReorderBuffer::duplicate_count() {
+    return g_dup_samples.sum();
+}
+
+void ReorderBuffer::count_late() {
+    g_late_samples.add(1);
+}
+
+
+}  // namespace Akumuli
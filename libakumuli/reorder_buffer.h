@@ -0,0 +1,91 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Per-series reorder buffer for bounded lateness.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#pragma once
+#include "akumuli.h"
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+using aku_Duration = aku_Timestamp;
+
+namespace Akumuli {
+
+/** Per-series reorder buffer for bounded lateness.
+  * Sits ahead of the storage and absorbs mildly out-of-order samples:
+  * each series keeps a small ring of pending samples ordered by timestamp
+  * and a sample is released once it falls out of the configured lateness
+  * bound relative to the newest pending sample (or when the ring is full).
+  * The ring is a pair of flat arrays so insertion is a short memmove
+  * instead of the generic sorted-run machinery. Duplicates (same timestamp
+  * as a pending sample) are dropped, samples older than the last released
+  * one can't be reordered anymore and are passed through; both cases are
+  * counted and reported through the stats endpoint.
+  */
+struct ReorderBuffer {
+    enum {
+        //! Number of pending samples per series
+        RING_SIZE = 32,
+    };
+
+    //! Pending samples of one series (ordered by timestamp)
+    struct Ring {
+        std::array<aku_Timestamp, RING_SIZE> tss;
+        std::array<double, RING_SIZE>        xss;
+        u32           size;       //< Number of pending samples
+        aku_Timestamp watermark;  //< Timestamp of the last released sample
+    };
+
+    //! Sample released by `put` or `flush`
+    struct OutSample {
+        aku_ParamId   id;
+        aku_Timestamp ts;
+        double        value;
+    };
+
+    std::unordered_map<aku_ParamId, Ring> rings_;
+    const aku_Duration lateness_;
+
+    ReorderBuffer(aku_Duration lateness);
+
+    /** Add sample to the buffer. Samples that fall out of the lateness
+      * bound are released into `outbuf` (a sample older than the series
+      * watermark is released right away).
+      * @return false if the sample is a duplicate and was dropped
+      */
+    bool put(aku_ParamId id, aku_Timestamp ts, double value, std::vector<OutSample>* outbuf);
+
+    //! Release all pending samples.
+    void flush(std::vector<OutSample>* outbuf);
+
+    //! Total number of samples that arrived too late to be reordered.
+    static u64 late_count();
+
+    //! Total number of dropped duplicates.
+    static u64 duplicate_count();
+
+    //! Bump the late samples counter (storage-level rejects are counted too).
+    static void count_late();
+};
+
+}  // namespace Akumuli
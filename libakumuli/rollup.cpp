@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rollup.h"
+
+namespace Akumuli {
+
+const u64 RollupEngine::RESOLUTIONS[RollupEngine::NRES] = {
+    60000000000ull,    // 1 minute
+    3600000000000ull,  // 1 hour
+};
+
+const char* const RollupEngine::SUFFIXES[RollupEngine::NRES] = {
+    ":1m",
+    ":1h",
+};
+
+RollupEngine::RollupEngine(SeriesMatcher& matcher, WriteCb write_cb)
+    : matcher_(matcher)
+    , write_cb_(write_cb)
+{
+}
+
+std::vector<std::pair<aku_ParamId, RollupEngine::Bucket>>* RollupEngine::get_series_state_(aku_ParamId id) {
+    auto it = series_.find(id);
+    if (it != series_.end()) {
+        return &it->second;
+    }
+    auto sname = matcher_.id2str(id);
+    if (sname.second == 0) {
+        // Unknown id, value wasn't written through the normal write path
+        return nullptr;
+    }
+    // Derived series name is the source name with a resolution suffix
+    // appended to the metric (the keys stay in place so the name is
+    // already in normal form)
+    std::string name(sname.first, sname.first + sname.second);
+    auto space  = name.find(' ');
+    auto metric = space == std::string::npos ? name : name.substr(0, space);
+    auto keys   = space == std::string::npos ? std::string() : name.substr(space);
+    for (int i = 0; i < NRES; i++) {
+        std::string suffix(SUFFIXES[i]);
+        if (metric.size() > suffix.size() &&
+            metric.compare(metric.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            // Rollup series restored from disk or WAL, shouldn't be rolled up further
+            derived_ids_.insert(id);
+            return nullptr;
+        }
+    }
+    std::vector<std::pair<aku_ParamId, Bucket>> state;
+    for (int i = 0; i < NRES; i++) {
+        std::string derived = metric + SUFFIXES[i] + keys;
+        auto begin = derived.data();
+        auto end = begin + derived.size();
+        auto derived_id = matcher_.match(begin, end);
+        if (derived_id == 0) {
+            derived_id = matcher_.add(begin, end);
+        }
+        derived_ids_.insert(derived_id);
+        state.push_back(std::make_pair(derived_id, Bucket{0u, 0.0, 0u}));
+    }
+    auto res = series_.insert(std::make_pair(id, std::move(state)));
+    return &res.first->second;
+}
+
+aku_Status RollupEngine::add(aku_ParamId id, aku_Timestamp ts, double value) {
+    // Completed buckets are collected under the lock but written outside
+    // of it because the write callback reenters the write path (and thus
+    // this function, through the derived series).
+    std::vector<std::tuple<aku_ParamId, aku_Timestamp, double>> outgoing;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (derived_ids_.count(id) != 0) {
+            return AKU_SUCCESS;
+        }
+        auto pstate = get_series_state_(id);
+        if (pstate == nullptr) {
+            // Series shouldn't be rolled up
+            return AKU_SUCCESS;
+        }
+        for (int i = 0; i < NRES; i++) {
+            aku_Timestamp aligned = ts / RESOLUTIONS[i] * RESOLUTIONS[i];
+            Bucket& bucket = pstate->at(i).second;
+            if (bucket.count != 0 && bucket.begin != aligned) {
+                outgoing.push_back(std::make_tuple(pstate->at(i).first, bucket.begin,
+                                                   bucket.sum / bucket.count));
+                bucket.count = 0;
+            }
+            if (bucket.count == 0) {
+                bucket.begin = aligned;
+                bucket.sum   = 0.0;
+            }
+            bucket.sum += value;
+            bucket.count++;
+        }
+    }
+    for (auto const& item: outgoing) {
+        auto status = write_cb_(std::get<0>(item), std::get<1>(item), std::get<2>(item));
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+std::string RollupEngine::suffix_for_step(aku_Timestamp step) {
+    for (int i = NRES; i-- > 0;) {
+        if (step >= RESOLUTIONS[i]) {
+            return SUFFIXES[i];
+        }
+    }
+    return std::string();
+}
+}
@@ -0,0 +1,91 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Continuous rollup engine.
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "akumuli_def.h"
+#include "seriesparser.h"
+
+namespace Akumuli {
+
+/** Materialized multi-resolution downsampling.
+  * Every raw write is folded into per-series buckets, one bucket per
+  * resolution. When a write crosses a bucket boundary the completed bucket
+  * is emitted (as the mean of its values) into a derived series that shares
+  * the tags of the source series and carries a resolution suffix in the
+  * metric name ("cpu user=1" rolls up into "cpu:1m user=1" and
+  * "cpu:1h user=1"). Derived series go through the normal write path so
+  * they are compressed, cached and queried like any other series.
+  * The last (incomplete) bucket of each series is lost on shutdown - the
+  * rollups are a query accelerator, not a system of record.
+  */
+struct RollupEngine {
+    //! Writes rolled up value into the storage
+    typedef std::function<aku_Status(aku_ParamId id, aku_Timestamp ts, double value)> WriteCb;
+
+    enum {
+        NRES = 2,  //! Number of resolutions
+    };
+
+    //! Bucket widths in nanoseconds, coarsest last
+    static const u64         RESOLUTIONS[NRES];
+    //! Metric name suffixes, one per resolution
+    static const char* const SUFFIXES[NRES];
+
+    //! Open aggregation window
+    struct Bucket {
+        aku_Timestamp begin;  //! Aligned bucket start (valid if count != 0)
+        double        sum;
+        u64           count;
+    };
+
+    SeriesMatcher&                 matcher_;      //! Series name registry
+    WriteCb                        write_cb_;     //! Sink for completed buckets
+    //! Per-series state - derived series id and open bucket for each resolution
+    std::unordered_map<aku_ParamId, std::vector<std::pair<aku_ParamId, Bucket>>> series_;
+    std::unordered_set<aku_ParamId> derived_ids_;  //! Ids of the rollup series (not rolled up further)
+    std::mutex                      mutex_;
+
+    RollupEngine(SeriesMatcher& matcher, WriteCb write_cb);
+
+    /** Fold value into the rollup buckets of the series.
+      * Completed buckets are flushed through the write callback.
+      * Values written to derived series are ignored.
+      */
+    aku_Status add(aku_ParamId id, aku_Timestamp ts, double value);
+
+    /** Return metric name suffix of the coarsest resolution not greater
+      * then `step` or empty string if even the finest resolution is too
+      * coarse.
+      */
+    static std::string suffix_for_step(aku_Timestamp step);
+
+private:
+    //! Get or create per-series state (caller should hold the mutex)
+    std::vector<std::pair<aku_ParamId, Bucket>>* get_series_state_(aku_ParamId id);
+};
+}
@@ -20,6 +20,10 @@
 #include <cmath>
 #include <vector>
 
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
 namespace Akumuli {
 namespace SAX {
 
@@ -141,6 +145,66 @@ static char to_char(double value, const std::vector<double>& cuts) {
     return ALPHABET[cuts.size()];
 }
 
+// //////////////////////// //
+// Vectorized  quantization //
+// //////////////////////// //
+
+static void quantize_scalar(const double* xs, size_t n, double mean, double denom,
+                            const std::vector<double>& cuts, char* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = to_char((xs[i] - mean) / denom, cuts);
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static void quantize_avx2(const double* xs, size_t n, double mean, double denom,
+                          const std::vector<double>& cuts, char* out) {
+    const __m256d vmean  = _mm256_set1_pd(mean);
+    const __m256d vdenom = _mm256_set1_pd(denom);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d lo = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(xs + i),     vmean), vdenom);
+        __m256d hi = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(xs + i + 4), vmean), vdenom);
+        __m256i ix_lo = _mm256_setzero_si256();
+        __m256i ix_hi = _mm256_setzero_si256();
+        for (auto cut : cuts) {
+            // symbol index is the number of cutpoints the value is not below,
+            // each compare mask is all-ones so subtraction counts it
+            const __m256d vcut = _mm256_set1_pd(cut);
+            ix_lo = _mm256_sub_epi64(ix_lo, _mm256_castpd_si256(_mm256_cmp_pd(lo, vcut, _CMP_NLT_UQ)));
+            ix_hi = _mm256_sub_epi64(ix_hi, _mm256_castpd_si256(_mm256_cmp_pd(hi, vcut, _CMP_NLT_UQ)));
+        }
+        long long ixs[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ixs),     ix_lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ixs + 4), ix_hi);
+        for (int j = 0; j < 8; j++) {
+            out[i + j] = ALPHABET[ixs[j]];
+        }
+    }
+    quantize_scalar(xs + i, n - i, mean, denom, cuts, out + i);
+}
+
+#endif
+
+/** Convert batch of z-normalized values to alphabet symbols.
+  * Both input and output arrays should have `n` elements.
+  */
+static void quantize(const double* xs, size_t n, double mean, double denom,
+                     const std::vector<double>& cuts, char* out) {
+    typedef void (*KernelT)(const double*, size_t, double, double, const std::vector<double>&, char*);
+    static const KernelT kernel = []() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return &quantize_avx2;
+        }
+#endif
+        return &quantize_scalar;
+    }();
+    kernel(xs, n, mean, denom, cuts, out);
+}
+
 //! Convert array of doubles to characters (both array modified in-place)
 static void saxify(const boost::circular_buffer<double>& input, std::string& output, double threshold, int alphabet_size) {
     auto it = CUTPOINTS.find(alphabet_size);
@@ -154,17 +218,12 @@ static void saxify(const boost::circular_buffer<double>& input, std::string& out
     std::tie(mean, stddev) = mean_and_stddev(input.begin(), input.end());
     auto size = input.size();
     output.resize(size);
-    if (stddev < threshold) {
-        for (size_t i = 0; i < size; i++) {
-            double val = input[i] - mean;
-            output[i] = to_char(val, cuts);
-        }
-    } else {
-        for (size_t i = 0; i < size; i++) {
-            double val = (input[i] - mean) / stddev;
-            output[i] = to_char(val, cuts);
-        }
-    }
+    double denom = stddev < threshold ? 1.0 : stddev;
+    // Window is stored in at most two contiguous segments
+    auto head = input.array_one();
+    auto tail = input.array_two();
+    quantize(head.first, head.second, mean, denom, cuts, &output[0]);
+    quantize(tail.first, tail.second, mean, denom, cuts, &output[head.second]);
 }
 
 int leading_zeroes(int value) {
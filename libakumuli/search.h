@@ -1,7 +1,12 @@
 #pragma once
+#include "bit_twiddling.h"
 #include "util.h"
 #include <mutex>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace Akumuli {
 
 struct SearchRange {
@@ -9,6 +14,62 @@ struct SearchRange {
     u32 end;    //< End index
 };
 
+/* Vectorized lower/upper-bound search over a sorted timestamp array.
+ * Range trimming of decoded chunks sits inside every query so the kernel
+ * is shared by both engines (NB+tree leaves and the legacy chunk scan).
+ * Branchless binary search narrows the range down to a small window (the
+ * probe index moves with a conditional move so the predictor isn't fed
+ * coin flips) which is then counted with 4-wide SIMD compares.
+ */
+
+enum {
+    //! Binary search switches to the linear scan below this window size
+    TS_SEARCH_LINEAR_WINDOW = 64,
+};
+
+//! Count elements of the sorted window that are less than `key`
+inline size_t ts_count_less_(const aku_Timestamp* data, size_t size, aku_Timestamp key) {
+    size_t cnt = 0;
+    size_t i   = 0;
+#ifdef __AVX2__
+    // Timestamps are unsigned but the AVX2 compare is signed - biasing
+    // both sides by 2^63 preserves the ordering
+    const __m256i bias = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    const __m256i vkey = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(key)), bias);
+    for (; i + 4 <= size; i += 4) {
+        __m256i v  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i lt = _mm256_cmpgt_epi64(vkey, _mm256_xor_si256(v, bias));
+        cnt += BitHacks::count_bits(static_cast<u32>(_mm256_movemask_pd(_mm256_castsi256_pd(lt))));
+    }
+#endif
+    for (; i < size; i++) {
+        cnt += data[i] < key;
+    }
+    return cnt;
+}
+
+//! Index of the first element that is not less than `key`
+inline size_t ts_lower_bound(const aku_Timestamp* data, size_t size, aku_Timestamp key) {
+    size_t pos = 0;
+    size_t len = size;
+    while (len > TS_SEARCH_LINEAR_WINDOW) {
+        size_t half = len / 2;
+        pos = data[pos + half - 1] < key ? pos + half : pos;
+        len -= half;
+    }
+    // The window is sorted so the number of elements below the key is
+    // exactly the offset of the partition point
+    return pos + ts_count_less_(data + pos, len, key);
+}
+
+//! Index of the first element that is greater than `key`
+inline size_t ts_upper_bound(const aku_Timestamp* data, size_t size, aku_Timestamp key) {
+    if (key == AKU_MAX_TIMESTAMP) {
+        return size;
+    }
+    return ts_lower_bound(data, size, key + 1);
+}
+
 /** This is a searcher base class. It is supposed to be used in
   * page search algorithm and inside chunk search algorithm.
   * It can calculate search statistics.
@@ -55,6 +116,7 @@ template <class Derived, int SEARCH_QUOTA = 4> struct InterpolationSearch {
         u64           exact_match   = 0u;
         aku_Timestamp prev_step_err = 0u;
         I10nState     state         = NONE;
+        int           bad_steps     = 0;
 
         while (steps_count++ < interpolation_search_quota) {
             // On small distances - fallback to binary search
@@ -90,22 +152,43 @@ template <class Derived, int SEARCH_QUOTA = 4> struct InterpolationSearch {
 
                 if (probe < key) {
                     undershoot++;
+                    aku_Timestamp err = key - probe;
+                    // Probe error should shrink with each step, if it
+                    // doesn't - timestamps are too irregular and binary
+                    // search will converge faster.
+                    if (state != NONE && (err >> 1) >= prev_step_err) {
+                        bad_steps++;
+                    } else {
+                        bad_steps = 0;
+                    }
                     state         = UNDERSHOOT;
-                    prev_step_err = key - probe;
+                    prev_step_err = err;
                     range.begin   = probe_index;
                     success       = cderived->read_at(&search_lower_bound, range.begin);
                     if (!success) {
                         return false;
                     }
+                    if (bad_steps == 2) {
+                        break;
+                    }
                 } else if (probe > key) {
                     overshoot++;
+                    aku_Timestamp err = probe - key;
+                    if (state != NONE && (err >> 1) >= prev_step_err) {
+                        bad_steps++;
+                    } else {
+                        bad_steps = 0;
+                    }
                     state         = OVERSHOOT;
-                    prev_step_err = probe - key;
+                    prev_step_err = err;
                     range.end     = probe_index;
                     success       = cderived->read_at(&search_upper_bound, range.end);
                     if (!success) {
                         return false;
                     }
+                    if (bad_steps == 2) {
+                        break;
+                    }
                 } else {
                     // probe == key
                     exact_match = 1;
@@ -117,18 +200,18 @@ template <class Derived, int SEARCH_QUOTA = 4> struct InterpolationSearch {
                 break;
             }
         }
-        auto&                       stats = derived->get_search_stats();
-        std::lock_guard<std::mutex> lock(stats.mutex);
-        stats.stats.istats.n_matches += exact_match;
-        stats.stats.istats.n_overshoots += overshoot;
-        stats.stats.istats.n_undershoots += undershoot;
-        stats.stats.istats.n_times += 1;
-        stats.stats.istats.n_steps += steps_count;
-        stats.stats.istats.n_reduced_to_one_page += small_range_finish;
-        stats.stats.istats.n_page_in_core_checks += page_scan_steps_num;
-        stats.stats.istats.n_page_in_core_errors += page_scan_errors;
-        stats.stats.istats.n_pages_in_core_found += page_scan_success;
-        stats.stats.istats.n_pages_in_core_miss += page_miss;
+        // Counters are striped per thread - no lock is needed here
+        auto& stats = derived->get_search_stats();
+        stats.istats.n_matches.add(exact_match);
+        stats.istats.n_overshoots.add(overshoot);
+        stats.istats.n_undershoots.add(undershoot);
+        stats.istats.n_times.add(1);
+        stats.istats.n_steps.add(steps_count);
+        stats.istats.n_reduced_to_one_page.add(small_range_finish);
+        stats.istats.n_page_in_core_checks.add(page_scan_steps_num);
+        stats.istats.n_page_in_core_errors.add(page_scan_errors);
+        stats.istats.n_pages_in_core_found.add(page_scan_success);
+        stats.istats.n_pages_in_core_miss.add(page_miss);
         return true;
     }
 };
@@ -16,11 +16,18 @@
  */
 
 #include "akumuli_def.h"
+#include "akumuli_tracepoints.h"
+#include "latency_histogram.h"
+#include "search.h"
 #include "sequencer.h"
+#include "stage_profiler.h"
+#include "timsort.hpp"
 #include "util.h"
 #include "storage_engine/compression.h"
 
+#include <cstring>
 #include <future>
+#include <thread>
 
 #include <boost/heap/skew_heap.hpp>
 #include <boost/range.hpp>
@@ -136,18 +143,154 @@ std::ostream& operator << (std::ostream& str, TimeSeriesValue const& val) {
     return str;
 }
 
+// WindowArena
+
+WindowArena& WindowArena::instance() {
+    static WindowArena arena;
+    return arena;
+}
+
+WindowArena::WindowArena()
+    : current_(nullptr)
+{
+}
+
+WindowArena::~WindowArena() {
+    if (current_ != nullptr && current_->refs.fetch_sub(1) == 1) {
+        free(current_);
+    }
+}
+
+void* WindowArena::allocate(size_t size) {
+    // Every allocation is prefixed with a pointer to its chunk
+    size_t payload = (size + sizeof(ChunkHeader*) + 7) & ~7ull;
+    std::lock_guard<std::mutex> guard(lock_);
+    if (current_ == nullptr || current_->used + payload > current_->size) {
+        // Retire the current chunk (it gets freed when its last run dies)
+        if (current_ != nullptr && current_->refs.fetch_sub(1) == 1) {
+            free(current_);
+        }
+        size_t chunk_size = std::max(payload + sizeof(ChunkHeader), static_cast<size_t>(CHUNK_SIZE));
+        current_ = static_cast<ChunkHeader*>(malloc(chunk_size));
+        if (current_ == nullptr) {
+            AKU_PANIC("Can't allocate arena chunk");
+        }
+        current_->refs.store(1);  // arena's own reference
+        current_->used = sizeof(ChunkHeader);
+        current_->size = chunk_size;
+    }
+    u8* base = reinterpret_cast<u8*>(current_) + current_->used;
+    *reinterpret_cast<ChunkHeader**>(base) = current_;
+    current_->used += payload;
+    current_->refs.fetch_add(1);
+    return base + sizeof(ChunkHeader*);
+}
+
+void WindowArena::deallocate(void* ptr) {
+    ChunkHeader* chunk = *(reinterpret_cast<ChunkHeader**>(ptr) - 1);
+    if (chunk->refs.fetch_sub(1) == 1) {
+        free(chunk);
+    }
+}
+
+// TailRing
+
+TailRing::TailRing()
+    : seqlock_{0}
+    , pos_(0)
+    , dropped_(false)
+    , dropped_max_(0)
+    , first_ts_(0)
+{
+}
+
+void TailRing::append(aku_Timestamp ts, double value) {
+    u32 seq = seqlock_.load(std::memory_order_relaxed);
+    while (true) {
+        if (seq % 2 != 0) {
+            // Another writer is publishing
+            seq = seqlock_.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (seqlock_.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+            break;
+        }
+    }
+    u32 ix = pos_ % RING_SIZE;
+    if (pos_ >= RING_SIZE) {
+        dropped_ = true;
+        dropped_max_ = std::max(dropped_max_, tss_[ix]);
+    }
+    if (pos_ == 0) {
+        first_ts_ = ts;
+    }
+    tss_[ix] = ts;
+    xss_[ix] = value;
+    pos_++;
+    seqlock_.store(seq + 2, std::memory_order_release);
+}
+
+bool TailRing::snapshot(Snapshot* dest) const {
+    for (int retry = 0; retry < SNAPSHOT_RETRY; retry++) {
+        u32 seq = seqlock_.load(std::memory_order_acquire);
+        if (seq % 2 != 0) {
+            continue;
+        }
+        u32 count = std::min(pos_, static_cast<u32>(RING_SIZE));
+        dest->count       = count;
+        dest->dropped     = dropped_;
+        dest->dropped_max = dropped_max_;
+        dest->first_ts    = first_ts_;
+        for (u32 i = 0; i < count; i++) {
+            u32 ix = (pos_ - count + i) % RING_SIZE;
+            dest->tss[i] = tss_[ix];
+            dest->xss[i] = xss_[ix];
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seqlock_.load(std::memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// TailBuffer
+
+TailRing* TailBuffer::get_ring(aku_ParamId id) {
+    auto& shard = shards_[id % NSHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto& ring = shard.rings[id];
+    if (!ring) {
+        ring.reset(new TailRing());
+    }
+    return ring.get();
+}
+
+TailRing* TailBuffer::find_ring(aku_ParamId id) const {
+    auto& shard = shards_[id % NSHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.rings.find(id);
+    if (it == shard.rings.end()) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
 // Sequencer
 
+Sequencer::Shard::Shard()
+    : top_timestamp()
+    , checkpoint(0u)
+    , sequence_number{0}
+    , runs_snapshot(new std::vector<PSortedRun>())
+{
+}
+
 Sequencer::Sequencer(const aku_FineTuneParams &config)
     : window_size_(config.window_size)
-    , top_timestamp_()
-    , checkpoint_(0u)
     , sequence_number_ {0}
-    , run_locks_(RUN_LOCK_FLAGS_SIZE)
     , c_threshold_(config.compression_threshold)
 {
-    key_.reset(new SortedRun());
-    key_->push_back(TimeSeriesValue());
 }
 
 //! Checkpoint id = ⌊timestamp/window_size⌋
@@ -160,63 +303,179 @@ aku_Timestamp Sequencer::get_timestamp_(aku_Timestamp cp) const {
     return cp*window_size_;
 }
 
-// move sorted runs to ready_ collection
-int Sequencer::make_checkpoint_(aku_Timestamp new_checkpoint) {
-    int flag = sequence_number_.fetch_add(1) + 1;
-    if (flag % 2 != 0) {
-        auto old_top = get_timestamp_(checkpoint_);
-        checkpoint_ = new_checkpoint;
-        vector<PSortedRun> new_runs;
-        for (auto& sorted_run: runs_) {
-            auto it = lower_bound(sorted_run->begin(), sorted_run->end(), TimeSeriesValue(old_top, AKU_LIMITS_MAX_ID, 0));
-            // Check that compression threshold is reached
-            if (it == sorted_run->begin()) {
-                // all timestamps are newer than old_top, do nothing
-                new_runs.push_back(move(sorted_run));
-                continue;
-            } else if (it == sorted_run->end()) {
-                // all timestamps are older than old_top, move them
-                ready_.push_back(move(sorted_run));
-            } else {
-                // it is in between of the sorted run - split
-                PSortedRun run(new SortedRun());
-                copy(sorted_run->begin(), it, back_inserter(*run));  // copy old
-                ready_.push_back(move(run));
-                run.reset(new SortedRun());
-                copy(it, sorted_run->end(), back_inserter(*run));  // copy new
-                new_runs.push_back(move(run));
-            }
+//! Get the shard owned by the calling writer thread
+Sequencer::Shard& Sequencer::writer_shard_() const {
+    auto ix = std::hash<std::thread::id>()(std::this_thread::get_id()) % NSHARDS;
+    return shards_.at(ix);
+}
+
+enum {
+    //! Below this size the comparison sort beats the radix passes
+    RADIX_SORT_MIN_SIZE = 0x200,
+};
+
+/** Sort the write buffer by (timestamp, id).
+  * Timestamps inside one window buffer span a small range, so the common
+  * case is an LSD radix sort on the low 32 bits of the timestamp delta
+  * (one or two stable counting passes over 16-bit digits). Buffers with a
+  * wider span and small buffers fall back to timsort - the arrival order
+  * is nearly sorted by time, which is its best case.
+  */
+static void sort_wbuf_(Sequencer::SortedRun& wbuf) {
+    size_t n = wbuf.size();
+    if (n < RADIX_SORT_MIN_SIZE) {
+        gfx::timsort(wbuf.begin(), wbuf.end());
+        return;
+    }
+    aku_Timestamp mints = wbuf.front().get_timestamp();
+    aku_Timestamp maxts = mints;
+    for (auto const& value: wbuf) {
+        mints = std::min(mints, value.get_timestamp());
+        maxts = std::max(maxts, value.get_timestamp());
+    }
+    if (maxts - mints > 0xFFFFFFFFul) {
+        gfx::timsort(wbuf.begin(), wbuf.end());
+        return;
+    }
+    const u32 NBUCKETS = 0x10000;
+    std::vector<TimeSeriesValue> scratch(n);
+    std::vector<u32> counts(NBUCKETS);
+    auto radix_pass = [&](TimeSeriesValue const* src, TimeSeriesValue* dst, int shift) {
+        std::fill(counts.begin(), counts.end(), 0u);
+        for (size_t i = 0; i < n; i++) {
+            u32 digit = static_cast<u32>((src[i].get_timestamp() - mints) >> shift) & 0xFFFF;
+            counts[digit]++;
+        }
+        u32 offset = 0;
+        for (u32 i = 0; i < NBUCKETS; i++) {
+            u32 cnt = counts[i];
+            counts[i] = offset;
+            offset += cnt;
+        }
+        for (size_t i = 0; i < n; i++) {
+            u32 digit = static_cast<u32>((src[i].get_timestamp() - mints) >> shift) & 0xFFFF;
+            dst[counts[digit]++] = src[i];
         }
+    };
+    if (maxts - mints > 0xFFFFul) {
+        radix_pass(wbuf.data(), scratch.data(), 0);
+        radix_pass(scratch.data(), wbuf.data(), 16);
+    } else {
+        // Single digit is enough
+        radix_pass(wbuf.data(), scratch.data(), 0);
+        std::copy(scratch.begin(), scratch.end(), wbuf.begin());
+    }
+    // Radix key ignores the ids - restore (timestamp, id) order inside
+    // equal-timestamp runs (almost always of length one)
+    auto it = wbuf.begin();
+    while (it != wbuf.end()) {
+        auto top = it + 1;
+        while (top != wbuf.end() && top->get_timestamp() == it->get_timestamp()) {
+            top++;
+        }
+        if (top - it > 1) {
+            std::sort(it, top);
+        }
+        it = top;
+    }
+}
+
+void Sequencer::publish_runs_(Shard& shard) const {
+    // Should be called under the shard's `runs_lock` so two writers don't
+    // publish each other's stale copies out of order
+    std::shared_ptr<const std::vector<PSortedRun>> snapshot(new std::vector<PSortedRun>(shard.runs));
+    std::atomic_store(&shard.runs_snapshot, std::move(snapshot));
+}
+
+void Sequencer::publish_wbuf_(Shard& shard, SortedRun&& wbuf) {
+    sort_wbuf_(wbuf);
+    PSortedRun run(new SortedRun(std::move(wbuf)));
+    Lock guard(shard.runs_lock);
+    shard.runs.push_back(std::move(run));
+    publish_runs_(shard);
+}
+
+void Sequencer::drain_wbuf_(Shard& shard) {
+    SortedRun wbuf;
+    {
+        Lock guard(shard.buffer_lock);
+        wbuf.swap(shard.buffer);
+    }
+    if (!wbuf.empty()) {
+        publish_wbuf_(shard, std::move(wbuf));
+    }
+}
 
-        Lock guard(runs_resize_lock_);
-        swap(runs_, new_runs);
-        size_t ready_size = 0u;
-        for (auto& sorted_run: ready_) {
-            ready_size += sorted_run->size();
+// move sorted runs of the shard to its ready collection
+int Sequencer::make_checkpoint_(Shard& shard, aku_Timestamp new_checkpoint) {
+    // Buffered values should become part of the runs before the split
+    drain_wbuf_(shard);
+    // The split runs under the shard's `runs_lock` - writers that hashed
+    // into the same shard and the merge serialize on it. The shard turns
+    // odd only when its ready runs are fully staged so a concurrent
+    // merge never sees a half-made checkpoint.
+    Lock guard(shard.runs_lock);
+    if (shard.sequence_number.load() % 2 != 0) {
+        // Previous checkpoint of the shard wasn't merged out yet, the
+        // next one will be made when the writer gets here again
+        return 0;
+    }
+    auto old_top = get_timestamp_(shard.checkpoint);
+    shard.checkpoint = new_checkpoint;
+    vector<PSortedRun> new_runs;
+    for (auto& sorted_run: shard.runs) {
+        auto it = lower_bound(sorted_run->begin(), sorted_run->end(), TimeSeriesValue(old_top, AKU_LIMITS_MAX_ID, 0));
+        // Check that compression threshold is reached
+        if (it == sorted_run->begin()) {
+            // all timestamps are newer than old_top, do nothing
+            new_runs.push_back(move(sorted_run));
+            continue;
+        } else if (it == sorted_run->end()) {
+            // all timestamps are older than old_top, move them
+            shard.ready.push_back(move(sorted_run));
+        } else {
+            // it is in between of the sorted run - split
+            PSortedRun run(new SortedRun());
+            copy(sorted_run->begin(), it, back_inserter(*run));  // copy old
+            shard.ready.push_back(move(run));
+            run.reset(new SortedRun());
+            copy(it, sorted_run->end(), back_inserter(*run));  // copy new
+            new_runs.push_back(move(run));
         }
-        if (ready_size < c_threshold_) {
-            // If ready doesn't contains enough data compression wouldn't be efficient,
-            //  we need to wait for more data to come
-            // We should make sorted runs in ready_ array searchable again
-            for (auto& sorted_run: ready_) {
-                runs_.push_back(sorted_run);
-            }
-            ready_.clear();
-            flag = sequence_number_.fetch_add(1) + 1;
+    }
+
+    swap(shard.runs, new_runs);
+    int flag = 0;
+    size_t ready_size = 0u;
+    for (auto& sorted_run: shard.ready) {
+        ready_size += sorted_run->size();
+    }
+    if (ready_size < c_threshold_) {
+        // If ready doesn't contains enough data compression wouldn't be efficient,
+        //  we need to wait for more data to come
+        // We should make sorted runs in ready array searchable again
+        for (auto& sorted_run: shard.ready) {
+            shard.runs.push_back(sorted_run);
         }
+        shard.ready.clear();
     } else {
-        AKU_PANIC("macke_checkpoint_ should be called from one thread");
+        flag = shard.sequence_number.fetch_add(1) + 1;
+        AKU_PROBE1(checkpoint_begin, flag);
     }
+    publish_runs_(shard);
+    guard.unlock();
+    // Readers that overlapped the split should retry
+    sequence_number_.fetch_add(1);
     return flag;
 }
 
 /** Check timestamp and make checkpoint if timestamp is large enough.
   * @returns error code and flag that indicates whether or not new checkpoint is created
   */
-std::tuple<aku_Status, int> Sequencer::check_timestamp_(aku_Timestamp ts) {
+std::tuple<aku_Status, int> Sequencer::check_timestamp_(Shard& shard, aku_Timestamp ts) {
     aku_Status error_code = AKU_SUCCESS;
-    if (ts < top_timestamp_) {
-        auto delta = top_timestamp_ - ts;
+    if (ts < shard.top_timestamp) {
+        auto delta = shard.top_timestamp - ts;
         if (delta > window_size_) {
             error_code = AKU_ELATE_WRITE;
         }
@@ -224,96 +483,139 @@ std::tuple<aku_Status, int> Sequencer::check_timestamp_(aku_Timestamp ts) {
     }
     auto point = get_checkpoint_(ts);
     int flag = 0;
-    if (point > checkpoint_) {
+    if (point > shard.checkpoint) {
         // Create new checkpoint
-        flag = make_checkpoint_(point);
+        flag = make_checkpoint_(shard, point);
     }
-    top_timestamp_ = ts;
+    shard.top_timestamp = ts;
     return make_tuple(error_code, flag);
 }
 
+static LatencyHistogram g_add_latency("sequencer_add");
+
 std::tuple<aku_Status, int> Sequencer::add(TimeSeriesValue const& value) {
+    LatencyTimer timer(g_add_latency);
+    StageProfiler::ScopedStage stage(StageProfiler::STAGE_SEQUENCER);
+    // The whole write path is confined to the writer's shard, the lock is
+    // virtually uncontended as long as the number of writers is less than
+    // the number of shards.
+    auto& shard = writer_shard_();
     aku_Status status = AKU_SUCCESS;
     int lock = 0;
-    tie(status, lock) = check_timestamp_(value.get_timestamp());
+    tie(status, lock) = check_timestamp_(shard, value.get_timestamp());
     if (status != AKU_SUCCESS) {
         return make_tuple(status, lock);
     }
 
-    key_->pop_back();
-    key_->push_back(value);
+    // Accepted samples are also published to the series' tail ring so
+    // tail queries can be answered without the sequencer locks
+    tail_.get_ring(value.get_paramid())->append(value.get_timestamp(), value.value);
 
-    Lock guard(runs_resize_lock_);
-    auto begin = runs_.begin();
-    auto end = runs_.end();
-    auto insert_it = lower_bound(begin, end, key_, top_element_more<PSortedRun>);
-    int run_ix = distance(begin, insert_it);
-    bool new_run_needed = insert_it == runs_.end();
-    SortedRun* run = nullptr;
-    if (!new_run_needed) {
-        run = insert_it->get();
+    SortedRun wbuf;
+    {
+        Lock guard(shard.buffer_lock);
+        shard.buffer.push_back(value);
+        if (shard.buffer.size() >= WBUF_FLUSH_SIZE) {
+            wbuf.swap(shard.buffer);
+        }
     }
-    guard.unlock();
-
-    if (!new_run_needed) {
-        auto ix = run_ix & RUN_LOCK_FLAGS_MASK;
-        auto& rwlock = run_locks_.at(ix);
-        rwlock.wrlock();
-        run->push_back(value);
-        rwlock.unlock();
-    } else {
-        guard.lock();
-        PSortedRun new_pile(new SortedRun());
-        new_pile->push_back(value);
-        runs_.push_back(move(new_pile));
-        guard.unlock();
+    if (!wbuf.empty()) {
+        // Slow path - buffer overflowed, publish its content as a sorted run
+        publish_wbuf_(shard, std::move(wbuf));
     }
     return make_tuple(AKU_SUCCESS, lock);
 }
 
-template<class Cont>
-void wrlock_all(Cont& cont) {
-    for (auto& rwlock: cont) {
-        rwlock.wrlock();
+std::tuple<aku_Status, int> Sequencer::add_batch(const aku_ParamId* ids, const aku_Timestamp* tss,
+                                                 const double* xss, u32 n, u32* consumed)
+{
+    StageProfiler::ScopedStage stage(StageProfiler::STAGE_SEQUENCER);
+    auto& shard = writer_shard_();
+    aku_Status status = AKU_SUCCESS;
+    bool late = false;
+    int flag = 0;
+    u32 i = 0;
+    SortedRun staging;
+    staging.reserve(n);
+    while (i < n) {
+        if (!staging.empty() && get_checkpoint_(tss[i]) > shard.checkpoint) {
+            // Next value will trigger a checkpoint - stop here so the
+            // staged values get into the shard before the drain.
+            break;
+        }
+        tie(status, flag) = check_timestamp_(shard, tss[i]);
+        if (status == AKU_ELATE_WRITE) {
+            // Late value is skipped but the rest of the batch can proceed
+            late = true;
+            status = AKU_SUCCESS;
+            i++;
+            continue;
+        }
+        if (status != AKU_SUCCESS) {
+            break;
+        }
+        staging.push_back(TimeSeriesValue(tss[i], ids[i], xss[i]));
+        tail_.get_ring(ids[i])->append(tss[i], xss[i]);
+        i++;
+        if (flag % 2 == 1) {
+            // Checkpoint created, caller should merge before the rest of
+            // the batch is consumed
+            break;
+        }
     }
-}
-
-template<class Cont>
-void unlock_all(Cont& cont) {
-    for (auto& rwlock: cont) {
-        rwlock.unlock();
+    if (!staging.empty()) {
+        // Single lock acquisition for the whole prefix
+        SortedRun wbuf;
+        {
+            Lock guard(shard.buffer_lock);
+            shard.buffer.insert(shard.buffer.end(), staging.begin(), staging.end());
+            if (shard.buffer.size() >= WBUF_FLUSH_SIZE) {
+                wbuf.swap(shard.buffer);
+            }
+        }
+        if (!wbuf.empty()) {
+            publish_wbuf_(shard, std::move(wbuf));
+        }
     }
+    *consumed = i;
+    if (status == AKU_SUCCESS && late) {
+        status = AKU_ELATE_WRITE;
+    }
+    return make_tuple(status, flag);
 }
 
 aku_Status Sequencer::close(PageHeader* target) {
-    wrlock_all(run_locks_);
-    for (auto& sorted_run: runs_) {
-        ready_.push_back(move(sorted_run));
+    bool empty = true;
+    for (auto& shard: shards_) {
+        drain_wbuf_(shard);
+        Lock guard(shard.runs_lock);
+        for (auto& sorted_run: shard.runs) {
+            shard.ready.push_back(move(sorted_run));
+        }
+        shard.runs.clear();
+        publish_runs_(shard);
+        shard.sequence_number.store(1);
+        empty = empty && shard.ready.empty();
     }
-    unlock_all(run_locks_);
-
-    runs_resize_lock_.lock();
-    runs_.clear();
-    runs_resize_lock_.unlock();
-
-    sequence_number_.store(1);
-    if (!ready_.empty()) {
+    sequence_number_.fetch_add(1);
+    if (!empty) {
         return merge_and_compress(target, true);
     }
     return AKU_SUCCESS;
 }
 
 int Sequencer::reset() {
-    wrlock_all(run_locks_);
-    for (auto& sorted_run: runs_) {
-        ready_.push_back(move(sorted_run));
+    for (auto& shard: shards_) {
+        drain_wbuf_(shard);
+        Lock guard(shard.runs_lock);
+        for (auto& sorted_run: shard.runs) {
+            shard.ready.push_back(move(sorted_run));
+        }
+        shard.runs.clear();
+        publish_runs_(shard);
+        shard.sequence_number.store(1);
     }
-    unlock_all(run_locks_);
-
-    runs_resize_lock_.lock();
-    runs_.clear();
-    runs_resize_lock_.unlock();
-    sequence_number_.store(1);
+    sequence_number_.fetch_add(1);
     return 1;
 }
 
@@ -431,46 +733,247 @@ void kway_merge(vector<Sequencer::PSortedRun>& runs, Consumer& cons) {
     }
 }
 
+/** Loser tree for the k-way merge inner loop.
+  * Extracting an element replays a single leaf-to-root path (log2(k)
+  * comparisons) instead of the pop+push pair of a binary heap.
+  * Exhausted ranges act as players with an infinitely large element.
+  */
+struct LoserTree {
+    typedef Sequencer::SortedRun::const_iterator Iter;
+
+    std::vector<Iter> pos_;
+    std::vector<Iter> end_;
+    std::vector<int>  tree_;    //< Losers of the internal nodes
+    int               winner_;
+    int               k_;
+    bool              init_;
+
+    LoserTree(std::vector<std::pair<Iter, Iter>> const& ranges)
+        : winner_(-1)
+        , k_(static_cast<int>(ranges.size()))
+        , init_(true)
+    {
+        for (auto const& range: ranges) {
+            pos_.push_back(range.first);
+            end_.push_back(range.second);
+        }
+        tree_.assign(k_, -1);
+        for (int player = 0; player < k_; player++) {
+            replay_(player);
+        }
+        init_ = false;
+    }
+
+    //! True if element of `lhs` is less than element of `rhs`
+    bool wins_(int lhs, int rhs) const {
+        if (lhs < 0) {
+            // Empty slot always wins during initialization so the real
+            // player gets recorded as the loser along the path.
+            return init_;
+        }
+        if (rhs < 0) {
+            return !init_;
+        }
+        if (pos_[lhs] == end_[lhs]) {
+            return false;
+        }
+        if (pos_[rhs] == end_[rhs]) {
+            return true;
+        }
+        return *pos_[lhs] < *pos_[rhs];
+    }
+
+    //! Replay matches along the path of the `player` leaf
+    void replay_(int player) {
+        int winner = player;
+        int node = (player + k_) / 2;
+        while (node > 0) {
+            if (wins_(tree_[node], winner)) {
+                std::swap(winner, tree_[node]);
+            }
+            node /= 2;
+        }
+        winner_ = winner;
+    }
+
+    //! True if all ranges are exhausted
+    bool empty() const {
+        return pos_[winner_] == end_[winner_];
+    }
+
+    //! Extract smallest element
+    TimeSeriesValue pop() {
+        TimeSeriesValue result = *pos_[winner_]++;
+        replay_(winner_);
+        return result;
+    }
+};
+
+//! Merge [begin, end) parts of the sorted runs with a loser tree
+static void merge_partition(std::vector<Sequencer::PSortedRun> const& runs,
+                            TimeSeriesValue const& begin,
+                            TimeSeriesValue const& end,
+                            bool has_end,
+                            Sequencer::SortedRun* out)
+{
+    std::vector<std::pair<LoserTree::Iter, LoserTree::Iter>> ranges;
+    size_t total = 0;
+    for (auto const& run: runs) {
+        auto from = std::lower_bound(run->begin(), run->end(), begin);
+        auto to = has_end ? std::lower_bound(run->begin(), run->end(), end) : run->end();
+        ranges.push_back(std::make_pair(from, to));
+        total += static_cast<size_t>(std::distance(from, to));
+    }
+    out->reserve(total);
+    LoserTree ltree(ranges);
+    while (!ltree.empty()) {
+        out->push_back(ltree.pop());
+    }
+}
+
+//! Don't spawn merge threads if there is less data to merge
+static const size_t PARALLEL_MERGE_MIN_SIZE = 0x1000;
+
+/** Merge sorted runs into a single run.
+  * Runs are partitioned by timestamp range and partitions are merged in
+  * parallel, the results are simply concatenated because every element of
+  * partition N is less than any element of partition N+1.
+  */
+static std::vector<Sequencer::PSortedRun> parallel_merge(std::vector<Sequencer::PSortedRun> const& runs) {
+    size_t total = 0;
+    aku_Timestamp begin = AKU_MAX_TIMESTAMP;
+    aku_Timestamp end = AKU_MIN_TIMESTAMP;
+    for (auto const& run: runs) {
+        if (run->empty()) {
+            continue;
+        }
+        total += run->size();
+        begin = std::min(begin, run->front().get_timestamp());
+        end = std::max(end, run->back().get_timestamp());
+    }
+    if (total == 0) {
+        return runs;
+    }
+    int nparts = static_cast<int>(std::min(std::thread::hardware_concurrency(), 8u));
+    Sequencer::PSortedRun merged(new Sequencer::SortedRun());
+    if (total < PARALLEL_MERGE_MIN_SIZE || nparts < 2 || begin == end) {
+        merge_partition(runs, TimeSeriesValue(0ull, 0ull, .0), TimeSeriesValue(), false, merged.get());
+        return { merged };
+    }
+    std::vector<Sequencer::PSortedRun> parts(nparts);
+    std::vector<std::future<void>> tasks;
+    for (int ix = 0; ix < nparts; ix++) {
+        parts[ix].reset(new Sequencer::SortedRun());
+        auto from = TimeSeriesValue(begin + (end - begin)/nparts*ix, 0ull, .0);
+        auto to = TimeSeriesValue(begin + (end - begin)/nparts*(ix + 1), 0ull, .0);
+        bool has_end = ix != nparts - 1;
+        tasks.push_back(std::async(std::launch::async, merge_partition,
+                                   std::cref(runs), from, to, has_end, parts[ix].get()));
+    }
+    for (auto& task: tasks) {
+        task.get();
+    }
+    for (auto const& part: parts) {
+        std::copy(part->begin(), part->end(), std::back_inserter(*merged));
+    }
+    return { merged };
+}
+
 void Sequencer::merge(Caller& caller, InternalCursor* cur) {
-    bool owns_lock = sequence_number_.load() % 2;  // progress_flag_ must be odd to start
-    if (!owns_lock) {
+    Lock guard(merge_lock_);
+    // Gather every shard with a pending checkpoint - the merged output
+    // should be in time order so the shards can't be merged one by one
+    std::vector<Shard*> participants;
+    std::vector<PSortedRun> ready;
+    for (auto& shard: shards_) {
+        if (shard.sequence_number.load() % 2 == 1) {
+            participants.push_back(&shard);
+            Lock runs_guard(shard.runs_lock);
+            for (auto& sorted_run: shard.ready) {
+                ready.push_back(move(sorted_run));
+            }
+            shard.ready.clear();
+        }
+    }
+    if (participants.empty()) {
         // Error! Merge called too early
         cur->set_error(caller, AKU_EBUSY);
         return;
     }
 
-    if (ready_.size() == 0) {
+    if (ready.size() == 0) {
         // Things go crazy
         cur->set_error(caller, AKU_ENO_DATA);
         return;
     }
 
-    auto consumer = [&caller, cur](TimeSeriesValue const& val) {
-        aku_Sample result = val.to_result();
-        return cur->put(caller, result);
+    // Batch output so the cursor yields once per batch instead of once
+    // per sample.
+    const size_t MERGE_BATCH_SIZE = 0x100;
+    std::vector<aku_Sample> batch;
+    batch.reserve(MERGE_BATCH_SIZE);
+    auto consumer = [&caller, cur, &batch](TimeSeriesValue const& val) {
+        batch.push_back(val.to_result());
+        if (batch.size() == MERGE_BATCH_SIZE) {
+            bool proceed = cur->put_batch(caller, batch.data(), batch.size());
+            batch.clear();
+            return proceed;
+        }
+        return true;
     };
 
-    kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(ready_, consumer);
+    if (ready.size() > 1) {
+        ready = parallel_merge(ready);
+    }
+    kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(ready, consumer);
 
-    ready_.clear();
+    if (!batch.empty()) {
+        cur->put_batch(caller, batch.data(), batch.size());
+    }
     cur->complete(caller);
 
-    sequence_number_.fetch_add(1);  // progress_flag_ is even again
+    for (auto shard: participants) {
+        int flag = shard->sequence_number.fetch_add(1) + 1;  // shard flag is even again
+        AKU_PROBE1(checkpoint_end, flag);
+    }
+    sequence_number_.fetch_add(1);
 }
 
 
 aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write) {
-    bool owns_lock = sequence_number_.load() % 2;  // progress_flag_ must be odd to start
-    if (!owns_lock) {
-        return AKU_EBUSY;
+    Lock guard(merge_lock_);
+    // Gather every shard with a pending checkpoint (time order inside the
+    // page requires a single merge across the shards)
+    std::vector<Shard*> participants;
+    std::vector<PSortedRun> ready;
+    for (auto& shard: shards_) {
+        if (shard.sequence_number.load() % 2 == 1) {
+            participants.push_back(&shard);
+            Lock runs_guard(shard.runs_lock);
+            for (auto& sorted_run: shard.ready) {
+                ready.push_back(move(sorted_run));
+            }
+            shard.ready.clear();
+        }
     }
-    if (ready_.size() == 0) {
+    if (participants.empty()) {
+        // Checkpoint of the caller's shard was merged out by a previous
+        // call that gathered several shards at once
+        return AKU_SUCCESS;
+    }
+    if (ready.size() == 0) {
         return AKU_ENO_DATA;
     }
 
     aku_Status status = AKU_SUCCESS;
 
-    while(!ready_.empty()) {
+    if (ready.size() > 1) {
+        // Merge the bulk of the data in parallel, the chunked consumer
+        // below will only have to scan the result.
+        ready = parallel_merge(ready);
+    }
+
+    while(!ready.empty()) {
         UncompressedChunk chunk_header;
         chunk_header.paramids.reserve(c_threshold_);
         chunk_header.timestamps.reserve(c_threshold_);
@@ -483,7 +986,7 @@ aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write)
             }
             return false;
         };
-        kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(ready_, push_to_header);
+        kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(ready, push_to_header);
         if (enforce_write || chunk_header.paramids.size() >= c_threshold_) {
             UncompressedChunk reindexed_header;
             if (!CompressionUtil::convert_from_time_order(chunk_header, &reindexed_header)) {
@@ -501,7 +1004,7 @@ aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write)
                                                chunk_header.paramids.at(i),
                                                chunk_header.values.at(i)));
             }
-            ready_.push_back(std::move(run));
+            ready.push_back(std::move(run));
             if (status == AKU_ENO_DATA) {
                 status = AKU_SUCCESS;
             }
@@ -509,22 +1012,48 @@ aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write)
         }
     }
 
-    if(!ready_.empty()) {
-        Lock guard(runs_resize_lock_);
-        for(auto sorted_run: ready_) {
-            runs_.push_back(sorted_run);
+    if(!ready.empty()) {
+        // Leftovers go back to one of the participating shards, its next
+        // checkpoint will move them to ready again
+        auto& shard = *participants.front();
+        Lock runs_guard(shard.runs_lock);
+        for(auto sorted_run: ready) {
+            shard.runs.push_back(sorted_run);
         }
-        ready_.clear();
+        publish_runs_(shard);
     }
 
-    sequence_number_.fetch_add(1);  // progress_flag_ is even again
+    for (auto shard: participants) {
+        int flag = shard->sequence_number.fetch_add(1) + 1;  // shard flag is even again
+        AKU_PROBE1(checkpoint_end, flag);
+    }
+    sequence_number_.fetch_add(1);
 
     return status;
 }
 
+aku_Timestamp Sequencer::get_checkpoint_timestamp() const {
+    // Conservative bound - every shard that ever saw data merged
+    // everything older than its own checkpoint
+    aku_Timestamp result = 0;
+    bool first = true;
+    for (auto const& shard: shards_) {
+        if (shard.top_timestamp == 0) {
+            continue;
+        }
+        auto cp = get_timestamp_(shard.checkpoint);
+        result = first ? cp : std::min(result, cp);
+        first = false;
+    }
+    return result;
+}
+
 std::tuple<aku_Timestamp, int> Sequencer::get_window() const {
-    return std::make_tuple(top_timestamp_ > window_size_ ? top_timestamp_ - window_size_
-                                                         : top_timestamp_,
+    aku_Timestamp top = 0;
+    for (auto const& shard: shards_) {
+        top = std::max(top, shard.top_timestamp);
+    }
+    return std::make_tuple(top > window_size_ ? top - window_size_ : top,
                            sequence_number_.load());
 }
 
@@ -544,23 +1073,35 @@ void Sequencer::filter(PSortedRun run, std::shared_ptr<QP::IQueryProcessor> q, s
 
 void Sequencer::search(std::shared_ptr<QP::IQueryProcessor> query, int sequence_number) const {
     int seq_id = sequence_number_.load();
-    if (seq_id % 2 != 0 || sequence_number != seq_id) {
+    if (sequence_number != seq_id) {
         query->set_error(AKU_EBUSY);
         return;
     }
     std::vector<PSortedRun> filtered;
-    std::vector<PSortedRun> pruns;
-    Lock runs_guard(runs_resize_lock_);
-    pruns = runs_;
-    runs_guard.unlock();
-    int run_ix = 0;
-    for (auto const& run: pruns) {
-        auto ix = run_ix & RUN_LOCK_FLAGS_MASK;
-        auto& rwlock = run_locks_.at(ix);
-        rwlock.rdlock();
-        filter(run, query, &filtered);
-        rwlock.unlock();
-        run_ix++;
+    for (auto& shard: shards_) {
+        if (shard.sequence_number.load() % 2 != 0) {
+            // Merge is in progress
+            query->set_error(AKU_EBUSY);
+            return;
+        }
+        // Published runs are immutable, the snapshot pins them for the
+        // duration of the scan so no sequencer lock is needed here
+        auto pruns = std::atomic_load(&shard.runs_snapshot);
+        for (auto const& run: *pruns) {
+            filter(run, query, &filtered);
+        }
+        // Values that are still in the append buffer (the only mutable
+        // part of the window) should be visible too
+        SortedRun snapshot;
+        {
+            Lock guard(shard.buffer_lock);
+            snapshot = shard.buffer;
+        }
+        if (!snapshot.empty()) {
+            std::sort(snapshot.begin(), snapshot.end());
+            PSortedRun run(new SortedRun(std::move(snapshot)));
+            filter(run, query, &filtered);
+        }
     }
 
     auto consumer = [query](TimeSeriesValue const& val) {
@@ -571,6 +1112,9 @@ void Sequencer::search(std::shared_ptr<QP::IQueryProcessor> query, int sequence_
         return true;
     };
 
+    if (filtered.size() > 1) {
+        filtered = parallel_merge(filtered);
+    }
     if (!query->range().is_backward()) {
         kway_merge<TimeOrderMergePredicate, AKU_CURSOR_DIR_FORWARD>(filtered, consumer);
     } else {
@@ -583,4 +1127,54 @@ void Sequencer::search(std::shared_ptr<QP::IQueryProcessor> query, int sequence_
     }
 }
 
+bool Sequencer::search_tail(std::shared_ptr<QP::IQueryProcessor> query) const {
+    auto range = query->range();
+    if (range.type != QP::QueryRange::INSTANT) {
+        return false;
+    }
+    auto ids = query->filter().get_ids();
+    if (ids.empty() || ids.size() > TAIL_SEARCH_MAX_SERIES) {
+        // Filter doesn't name the series (or names too many of them)
+        return false;
+    }
+    std::vector<TimeSeriesValue> results;
+    TailRing::Snapshot snapshot;
+    for (auto id: ids) {
+        auto ring = tail_.find_ring(id);
+        if (ring == nullptr) {
+            return false;
+        }
+        if (!ring->snapshot(&snapshot)) {
+            // Writers didn't let the ring settle
+            return false;
+        }
+        if (snapshot.count == 0 || snapshot.first_ts > range.lowerbound) {
+            // The ring doesn't span the whole queried range
+            return false;
+        }
+        if (snapshot.dropped && snapshot.dropped_max >= range.lowerbound) {
+            // A sample inside the range was overwritten
+            return false;
+        }
+        // Per-series timestamps are sorted so the in-range run is contiguous
+        auto lo = ts_lower_bound(snapshot.tss, snapshot.count, range.lowerbound);
+        auto hi = ts_upper_bound(snapshot.tss, snapshot.count, range.upperbound);
+        for (auto i = lo; i < hi; i++) {
+            results.push_back(TimeSeriesValue(snapshot.tss[i], id, snapshot.xss[i]));
+        }
+    }
+    if (!range.is_backward()) {
+        std::sort(results.begin(), results.end());
+    } else {
+        std::sort(results.begin(), results.end(),
+                  [](TimeSeriesValue const& lhs, TimeSeriesValue const& rhs) { return rhs < lhs; });
+    }
+    for (auto const& val: results) {
+        if (!query->put(val.to_result())) {
+            break;
+        }
+    }
+    return true;
+}
+
 }  // namespace Akumuli
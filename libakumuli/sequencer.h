@@ -23,12 +23,17 @@
 #pragma once
 #include "cursor.h"
 #include "page.h"
+#include "reorder_buffer.h"
 #include "queryprocessor_framework.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
 #include <memory>
 #include <mutex>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 namespace Akumuli {
@@ -84,39 +89,206 @@ struct TimeSeriesValue {
 std::ostream& operator<<(std::ostream& str, TimeSeriesValue const& val);
 
 
+/** Region allocator for window storage.
+  * Sorted runs live in large contiguous chunks, allocation is a bump of
+  * the chunk's `used` counter so the glibc allocator stays out of the
+  * ingestion path. Chunks are reference counted and reclaimed wholesale
+  * when all runs of the window are merged out, individual deallocations
+  * only drop the counter.
+  */
+struct WindowArena {
+    enum {
+        CHUNK_SIZE = 0x100000,  // 1MB
+    };
+
+    struct ChunkHeader {
+        std::atomic<int> refs;  //< Number of allocations alive (plus one for the arena)
+        size_t           used;  //< Bump pointer
+        size_t           size;  //< Chunk size (including the header)
+    };
+
+    std::mutex   lock_;
+    ChunkHeader* current_;
+
+    //! Process-wide arena instance.
+    static WindowArena& instance();
+
+    //! Allocate `size` bytes from the current chunk.
+    void* allocate(size_t size);
+
+    //! Release allocation (frees the chunk when the last allocation is gone).
+    void deallocate(void* ptr);
+
+private:
+    WindowArena();
+    ~WindowArena();
+};
+
+//! Std-compatible allocator backed by `WindowArena`.
+template<class T>
+struct WindowArenaAllocator {
+    typedef T value_type;
+
+    WindowArenaAllocator() = default;
+
+    template<class U>
+    WindowArenaAllocator(WindowArenaAllocator<U> const&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(WindowArena::instance().allocate(n*sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        WindowArena::instance().deallocate(ptr);
+    }
+};
+
+template<class T, class U>
+bool operator == (WindowArenaAllocator<T> const&, WindowArenaAllocator<U> const&) {
+    return true;
+}
+
+template<class T, class U>
+bool operator != (WindowArenaAllocator<T> const&, WindowArenaAllocator<U> const&) {
+    return false;
+}
+
+
+/** Per-series ring of recent samples published with a seqlock.
+  * Writers bump the sequence to an odd value, update the ring and bump it
+  * back to even, readers copy the ring and retry if the sequence moved -
+  * a snapshot never blocks ingestion. The ring remembers the largest
+  * timestamp it ever overwrote so a reader can tell whether a time range
+  * is fully covered by the samples still inside the ring.
+  */
+struct TailRing {
+    enum {
+        //! Number of retained samples per series
+        RING_SIZE      = 0x40,
+        //! Snapshot attempts before giving up
+        SNAPSHOT_RETRY = 0x10,
+    };
+
+    std::atomic<u32> seqlock_;
+    u32              pos_;          //< Number of samples ever appended
+    bool             dropped_;      //< At least one sample was overwritten
+    aku_Timestamp    dropped_max_;  //< Largest overwritten timestamp
+    aku_Timestamp    first_ts_;     //< Timestamp of the first sample ever appended
+    aku_Timestamp    tss_[RING_SIZE];
+    double           xss_[RING_SIZE];
+
+    //! Consistent copy of the ring content (oldest sample first)
+    struct Snapshot {
+        u32           count;
+        bool          dropped;
+        aku_Timestamp dropped_max;
+        aku_Timestamp first_ts;
+        aku_Timestamp tss[RING_SIZE];
+        double        xss[RING_SIZE];
+    };
+
+    TailRing();
+
+    //! Append sample (concurrent writers are serialized by the seqlock)
+    void append(aku_Timestamp ts, double value);
+
+    /** Copy a consistent snapshot of the ring.
+      * @return false if writers didn't let the ring settle
+      */
+    bool snapshot(Snapshot* dest) const;
+};
+
+
+/** Hot-sample tail buffer.
+  * Holds one `TailRing` per series, sharded by id so the lookup mutex
+  * (rings are found or created under it) isn't shared by all writers.
+  * Rings are never removed, a ring pointer stays valid for the lifetime
+  * of the buffer and can be used outside the shard lock.
+  */
+struct TailBuffer {
+    enum {
+        NSHARDS = 16,
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<aku_ParamId, std::unique_ptr<TailRing>> rings;
+    };
+
+    std::array<Shard, NSHARDS> shards_;
+
+    //! Get ring of the series (create if needed)
+    TailRing* get_ring(aku_ParamId id);
+
+    //! Find existing ring, returns null if the series is unknown
+    TailRing* find_ring(aku_ParamId id) const;
+};
+
+
 /** Time-series sequencer.
   * @brief Akumuli can accept unordered time-series (this is the case when
   * clocks of the different time-series sources are slightly out of sync).
   * This component accepts all of them, filter out late writes and reorder
   * all the remaining samples by timestamp and parameter id.
+  *
+  * The in-memory stage is shared-nothing - the sequencer is split into
+  * `NSHARDS` independent shards, each owned by a pipeline writer thread
+  * (the same thread-id routing the append dispatch uses) with its own
+  * append buffer, run list, window top and checkpoint cadence. Writers
+  * never touch each other's shard, the read side merges across the
+  * shards.
   */
 struct Sequencer {
-    typedef std::vector<TimeSeriesValue> SortedRun;
+    typedef std::vector<TimeSeriesValue, WindowArenaAllocator<TimeSeriesValue>> SortedRun;
     typedef std::shared_ptr<SortedRun>   PSortedRun;
     typedef std::mutex                   Mutex;
     typedef std::unique_lock<Mutex>      Lock;
 
-    static const int RUN_LOCK_MAX_BACKOFF = 0x100;
-    static const int RUN_LOCK_BUSY_COUNT  = 0xFFF;
-    static const int RUN_LOCK_FLAGS_MASK  = 0x0FF;
-    static const int RUN_LOCK_FLAGS_SIZE  = 0x100;
+    enum {
+        //! Number of sequencer shards
+        NSHARDS         = 8,
+        //! Append buffer flush threshold (in elements)
+        WBUF_FLUSH_SIZE = 0x1000,
+        //! Max number of series a query can touch and still use the tail rings
+        TAIL_SEARCH_MAX_SERIES = 0x100,
+    };
 
     // TODO: space usage should be limited
 
-    std::vector<PSortedRun> runs_;   //< Active sorted runs
-    std::vector<PSortedRun> ready_;  //< Ready to merge
-    PSortedRun              key_;
+    /** Sequencer shard.
+      * Full sequencer state owned by one writer thread. The buffer lock
+      * is virtually uncontended (it's only shared when thread ids hash to
+      * the same shard), the runs lock protects the run list resize - the
+      * published runs themselves are immutable and are read through the
+      * atomically republished snapshot.
+      */
+    struct Shard {
+        mutable Mutex           buffer_lock;     //< Protects `buffer`
+        SortedRun               buffer;          //< Append buffer
+        mutable Mutex           runs_lock;       //< Protects `runs` resize
+        std::vector<PSortedRun> runs;            //< Active sorted runs
+        std::vector<PSortedRun> ready;           //< Ready to merge
+        aku_Timestamp           top_timestamp;   //< Largest timestamp seen by the shard
+        aku_Timestamp           checkpoint;      //< Last checkpoint of the shard
+        //! Odd value - the shard has a checkpoint pending merge
+        std::atomic_int         sequence_number;
+        //! Immutable snapshot of `runs`, atomically republished on every
+        //! change so readers can traverse it without taking any lock
+        std::shared_ptr<const std::vector<PSortedRun>> runs_snapshot;
+
+        Shard();
+    };
+
+    mutable std::array<Shard, NSHARDS> shards_;  //< Sequencer shards
     const aku_Duration      window_size_;
-    aku_Timestamp           top_timestamp_;  //< Largest timestamp ever seen
-    aku_Timestamp           checkpoint_;     //< Last checkpoint timestamp
-    mutable std::atomic_int
-        sequence_number_;  //< Flag indicates that merge operation is in progress and
-                           //< search will return inaccurate results.
-                           //< If progress_flag_ is odd - merge is in progress if it is
-                           //< even - there is no merge and search will work correctly.
-    mutable Mutex               runs_resize_lock_;
-    mutable std::vector<RWLock> run_locks_;
-    const size_t                c_threshold_;  //< Compression threshold
+    //! Reader generation - bumped by every checkpoint and merge so a
+    //! search that overlaps one can be detected and retried
+    mutable std::atomic_int sequence_number_;
+    //! Serializes merge operations (writers of different shards can
+    //! trigger checkpoints concurrently)
+    mutable Mutex           merge_lock_;
+    const size_t            c_threshold_;  //< Compression threshold
+    TailBuffer              tail_;         //< Hot-sample tail rings
 
     Sequencer(aku_FineTuneParams const& config);
 
@@ -126,6 +298,22 @@ struct Sequencer {
       */
     std::tuple<aku_Status, int> add(TimeSeriesValue const& value);
 
+    /** Add batch of samples to sequence (columnar layout).
+      * Samples are staged and appended to the writer's shard with a single
+      * lock acquisition instead of one per sample. Late writes are skipped
+      * and reported with AKU_ELATE_WRITE, the rest of the batch is stored.
+      * The batch is consumed only up to the first checkpoint - caller
+      * should merge (the flag is odd in this case) and retry the rest.
+      * @param ids Series ids.
+      * @param tss Timestamps.
+      * @param xss Values.
+      * @param n Number of samples.
+      * @param consumed Receives number of samples consumed (includes skipped late writes).
+      * @returns error code and checkpoint flag (same as `add`)
+      */
+    std::tuple<aku_Status, int> add_batch(const aku_ParamId* ids, const aku_Timestamp* tss,
+                                          const double* xss, u32 n, u32* consumed);
+
     //! Simple merge and sync without compression. (depricated)
     void merge(Caller& caller, InternalCursor* cur);
 
@@ -153,25 +341,57 @@ struct Sequencer {
       * search method. If seq-number is changed between calls to get_window and search - search
       * will be aborted and AKU_EBUSY.error code will be returned If merge occures during search -
       * search will be aborted and AKU_EBUSY error code will be returned.
+      * @note published sorted runs are immutable - the search traverses an
+      * atomically published snapshot of the run list lock-free and only
+      * takes the shard locks to copy the mutable append buffers.
       */
     void search(std::shared_ptr<QP::IQueryProcessor> query, int sequence_number) const;
 
+    /** Try to answer the query from the hot-sample tail rings.
+      * Instant queries over a bounded set of series whose time range is
+      * fully covered by the rings are served from seqlock snapshots
+      * without touching the sequencer locks, so tail queries (e.g. `last
+      * 1 minute`) don't contend with ingestion. On success the results
+      * are already pushed to the query processor.
+      * @returns true if the query was answered, false - caller should
+      * fall back to the regular `search` path
+      */
+    bool search_tail(std::shared_ptr<QP::IQueryProcessor> query) const;
+
     std::tuple<aku_Timestamp, int> get_window() const;
 
+    /** Get timestamp of the last checkpoint.
+      * After the merge completes all values with smaller timestamps are
+      * written to the page.
+      */
+    aku_Timestamp get_checkpoint_timestamp() const;
+
 private:
+    //! Get the shard owned by the calling writer thread
+    Shard& writer_shard_() const;
+
     //! Checkpoint id = ⌊timestamp/window_size⌋
     aku_Timestamp get_checkpoint_(aku_Timestamp ts) const;
 
     //! Convert checkpoint id to timestamp
     aku_Timestamp get_timestamp_(aku_Timestamp cp) const;
 
-    // move sorted runs to ready_ collection
-    int make_checkpoint_(aku_Timestamp new_checkpoint);
+    //! Republish the shard's `runs_snapshot` (caller should hold `runs_lock`)
+    void publish_runs_(Shard& shard) const;
+
+    //! Sort buffered values and publish them as a sorted run of the shard
+    void publish_wbuf_(Shard& shard, SortedRun&& wbuf);
+
+    //! Flush the shard's append buffer into its run list
+    void drain_wbuf_(Shard& shard);
+
+    // move sorted runs of the shard to its ready collection
+    int make_checkpoint_(Shard& shard, aku_Timestamp new_checkpoint);
 
     /** Check timestamp and make checkpoint if timestamp is large enough.
       * @returns error code and flag that indicates whether or not new checkpoint is created
       */
-    std::tuple<aku_Status, int> check_timestamp_(aku_Timestamp ts);
+    std::tuple<aku_Status, int> check_timestamp_(Shard& shard, aku_Timestamp ts);
 
     void filter(PSortedRun run, std::shared_ptr<QP::IQueryProcessor> query,
                 std::vector<PSortedRun>* results) const;
@@ -22,6 +22,7 @@
 #include <string>
 #include <map>
 #include <algorithm>
+#include <cstring>
 #include <regex>
 
 #include <boost/property_tree/ptree.hpp>
@@ -35,33 +36,142 @@ namespace Akumuli {
 
 static const SeriesMatcher::StringT EMPTY = std::make_pair(nullptr, 0);
 
+SeriesMatcher::Table::Table(size_t nslots)
+    : slots(nslots)
+    , used(0)
+{
+    for (auto& slot: slots) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+//! Put pooled name into the table (table size should be a power of two)
+static void table_put(SeriesMatcher::Table* table, const char* pname, int len) {
+    size_t mask = table->slots.size() - 1;
+    size_t ix = StringTools::hash(std::make_pair(pname, len)) & mask;
+    while (table->slots[ix].load(std::memory_order_relaxed) != nullptr) {
+        ix = (ix + 1) & mask;
+    }
+    // Name bytes are already in the pool, the store makes the slot visible
+    table->slots[ix].store(pname, std::memory_order_release);
+}
+
 SeriesMatcher::SeriesMatcher(u64 starting_id)
-    : table(StringTools::create_table(0x1000))
-    , series_id(starting_id)
+    : series_id(starting_id)
 {
     if (starting_id == 0u) {
         AKU_PANIC("Bad series ID");
     }
+    tables_.emplace_back(new Table(0x1000));
+    active_table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+void SeriesMatcher::insert_(StringT pstr) {
+    Table* table = active_table_.load(std::memory_order_relaxed);
+    if ((table->used + 1) * 2 > table->slots.size()) {
+        // Table is half full - build bigger copy and publish it, readers
+        // keep using the old one until the store completes.
+        std::unique_ptr<Table> bigger(new Table(table->slots.size() * 2));
+        for (auto& slot: table->slots) {
+            const char* pname = slot.load(std::memory_order_relaxed);
+            if (pname != nullptr) {
+                table_put(bigger.get(), pname, static_cast<int>(strlen(pname)));
+            }
+        }
+        bigger->used = table->used;
+        tables_.push_back(std::move(bigger));
+        table = tables_.back().get();
+        active_table_.store(table, std::memory_order_release);
+    }
+    table_put(table, pstr.first, pstr.second);
+    table->used++;
+    update_sketches_(pstr);
+}
+
+void SeriesMatcher::update_sketches_(StringT pstr) {
+    // Name is in normal form - the metric is followed by `key=value`
+    // pairs separated by single spaces
+    const char* p = pstr.first;
+    const char* end = p + pstr.second;
+    const char* begin = p;
+    while (p < end && *p != ' ') {
+        p++;
+    }
+    if (p == begin) {
+        return;
+    }
+    tag_sketches_["metric"].add(HyperLogLog::hash(begin, static_cast<u32>(p - begin)));
+    while (p < end) {
+        p++;  // skip the space
+        const char* key = p;
+        while (p < end && *p != '=') {
+            p++;
+        }
+        if (p == end || p == key) {
+            break;
+        }
+        std::string tag(key, p);
+        p++;  // skip '='
+        const char* value = p;
+        while (p < end && *p != ' ') {
+            p++;
+        }
+        tag_sketches_[tag].add(HyperLogLog::hash(value, static_cast<u32>(p - value)));
+    }
+}
+
+std::vector<std::pair<std::string, double>> SeriesMatcher::get_cardinality() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::vector<std::pair<std::string, double>> result;
+    for (auto const& kv: tag_sketches_) {
+        result.push_back(std::make_pair(kv.first, kv.second.estimate()));
+    }
+    return result;
 }
 
 u64 SeriesMatcher::add(const char* begin, const char* end) {
-    auto id = series_id++;
+    std::lock_guard<std::mutex> guard(mutex);
+    // Retry under the lock - the series could've been added by concurrent
+    // writer after the caller's `match` returned zero.
+    u64 id = match(begin, end);
+    if (id != 0ul) {
+        return id;
+    }
+    id = series_id++;
     StringT pstr = pool.add(begin, end, id);
     auto tup = std::make_tuple(std::get<0>(pstr), std::get<1>(pstr), id);
-    table[pstr] = id;
+    insert_(pstr);
     inv_table[id] = pstr;
     names.push_back(tup);
     return id;
 }
 
+void SeriesMatcher::add_batch(std::vector<StringT> const& strings, std::vector<u64>* ids) {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto const& str: strings) {
+        // Same retry as in `add` - the series could've been added by
+        // concurrent writer before the lock was acquired
+        u64 id = match(str.first, str.first + str.second);
+        if (id == 0ul) {
+            id = series_id++;
+            StringT pstr = pool.add(str.first, str.first + str.second, id);
+            insert_(pstr);
+            inv_table[id] = pstr;
+            names.push_back(std::make_tuple(std::get<0>(pstr), std::get<1>(pstr), id));
+        }
+        ids->push_back(id);
+    }
+}
+
 void SeriesMatcher::_add(std::string series, u64 id) {
     if (series.empty()) {
         return;
     }
+    std::lock_guard<std::mutex> guard(mutex);
     const char* begin = &series[0];
     const char* end = begin + series.size();
     StringT pstr = pool.add(begin, end, id);
-    table[pstr] = id;
+    insert_(pstr);
     inv_table[id] = pstr;
 }
 
@@ -70,14 +180,25 @@ u64 SeriesMatcher::match(const char* begin, const char* end) {
     int len = end - begin;
     StringT str = std::make_pair(begin, len);
 
-    auto it = table.find(str);
-    if (it == table.end()) {
-        return 0ul;
+    Table* table = active_table_.load(std::memory_order_acquire);
+    size_t mask = table->slots.size() - 1;
+    size_t ix = StringTools::hash(str) & mask;
+    for (size_t probe = 0; probe < table->slots.size(); probe++) {
+        const char* pname = table->slots[ix].load(std::memory_order_acquire);
+        if (pname == nullptr) {
+            return 0ul;
+        }
+        StringT pooled = std::make_pair(pname, static_cast<int>(strlen(pname)));
+        if (StringTools::equal(str, pooled)) {
+            return StringTools::extract_id_from_pool(pooled);
+        }
+        ix = (ix + 1) & mask;
     }
-    return it->second;
+    return 0ul;
 }
 
 SeriesMatcher::StringT SeriesMatcher::id2str(u64 tokenid) const {
+    std::lock_guard<std::mutex> guard(mutex);
     auto it = inv_table.find(tokenid);
     if (it == inv_table.end()) {
         return EMPTY;
@@ -86,10 +207,12 @@ SeriesMatcher::StringT SeriesMatcher::id2str(u64 tokenid) const {
 }
 
 void SeriesMatcher::pull_new_names(std::vector<SeriesMatcher::SeriesNameT> *buffer) {
+    std::lock_guard<std::mutex> guard(mutex);
     std::swap(names, *buffer);
 }
 
 std::vector<u64> SeriesMatcher::get_all_ids() const {
+    std::lock_guard<std::mutex> guard(mutex);
     std::vector<u64> result;
     for (auto const &tup: inv_table) {
         result.push_back(tup.first);
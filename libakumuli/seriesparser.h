@@ -16,9 +16,11 @@
 
 #pragma once
 #include "akumuli_def.h"
+#include "hll.h"
 //#include "queryprocessor_framework.h"
 #include "stringpool.h"
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
@@ -36,6 +38,9 @@ static const u64 AKU_STARTING_SERIES_ID = 1024;
 
 /** Series matcher. Table that maps series names to series
   * ids. Should be initialized on startup from sqlite table.
+  * The match path is lock-free - name lookups go through an open-addressing
+  * hash table published with an atomic pointer, only modifications take the
+  * mutex.
   */
 struct SeriesMatcher {
     // TODO: add LRU cache
@@ -44,23 +49,49 @@ struct SeriesMatcher {
     //! Series name descriptor - pointer to string, length, series id.
     typedef std::tuple<const char*, int, u64> SeriesNameT;
 
-    typedef StringTools::TableT TableT;
-    typedef StringTools::InvT   InvT;
+    typedef StringTools::InvT InvT;
+
+    /** Open-addressing hash table with atomic slots.
+      * Each slot stores pointer to the pooled series name (the id follows
+      * the name in the pool, see `StringTools::extract_id_from_pool`).
+      * Tables don't grow in place - when one gets crowded the writer builds
+      * a bigger copy and publishes it through `active_table_` (RCU-style).
+      * Old tables are retired to `tables_` and reclaimed by the d-tor so a
+      * reader can never observe a dangling table pointer.
+      */
+    struct Table {
+        std::vector<std::atomic<const char*>> slots;
+        size_t used;
+
+        Table(size_t nslots);
+    };
 
     // Variables
     StringPool               pool;       //! String pool that stores time-series
-    TableT                   table;      //! Series table (name to id mapping)
+    std::atomic<Table*>      active_table_;  //! Current name to id mapping
+    std::deque<std::unique_ptr<Table>> tables_;  //! All tables, newest is active
     InvT                     inv_table;  //! Ids table (id to name mapping)
     u64                      series_id;  //! Series ID counter
     std::vector<SeriesNameT> names;      //! List of recently added names
-    std::mutex               mutex;      //! Mutex for shared data
+    //! Per-tag-key distinct value sketches, "metric" counts the metric
+    //! names (guarded by `mutex`)
+    std::map<std::string, HyperLogLog> tag_sketches_;
+    mutable std::mutex       mutex;      //! Writer mutex (match doesn't take it)
 
     SeriesMatcher(u64 starting_id=AKU_STARTING_SERIES_ID);
 
-    /** Add new string to matcher.
+    /** Add new string to matcher. Returns the existing id if the series
+      * was added concurrently after the caller's `match` returned zero.
       */
     u64 add(const char* begin, const char* end);
 
+    /** Add batch of strings to matcher with a single lock acquisition.
+      * Caller should deduplicate the names - every name is inserted (or
+      * matched, if it was added concurrently) and its id is appended to
+      * `ids` in input order.
+      */
+    void add_batch(std::vector<StringT> const& strings, std::vector<u64>* ids);
+
     /** Add value from DB to matcher. This function should be
       * used only to load data from database to matcher. Internal
       * `series_id` counter shouldn't be affected by this call.
@@ -68,6 +99,7 @@ struct SeriesMatcher {
     void _add(std::string series, u64 id);
 
     /** Match string and return it's id. If string is new return 0.
+      * Wait-free, can be called concurrently with `add`.
       */
     u64 match(const char* begin, const char* end);
 
@@ -80,6 +112,23 @@ struct SeriesMatcher {
     void pull_new_names(std::vector<SeriesNameT>* buffer);
 
     std::vector<u64> get_all_ids() const;
+
+    /** Get distinct value count estimate for every tag key.
+      * The sketches are maintained incrementally on series creation so
+      * the call doesn't touch the series names at all - cardinality
+      * queries are answered in O(number of tag keys) regardless of the
+      * number of series. The "metric" pseudo-key estimates the number of
+      * distinct metric names.
+      */
+    std::vector<std::pair<std::string, double>> get_cardinality() const;
+
+private:
+    //! Insert pooled name into the active table (caller should hold the mutex)
+    void insert_(StringT pstr);
+
+    //! Count the name's metric and tag values in the cardinality sketches
+    //! (caller should hold the mutex)
+    void update_sketches_(StringT pstr);
 };
 
 /** Namespace class to store all parsing related things.
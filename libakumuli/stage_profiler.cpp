@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stage_profiler.h"
+
+#include <chrono>
+
+namespace Akumuli {
+
+StageProfiler::StageProfiler()
+    : enabled_(false)
+    , shutdown_(false)
+{
+    for (auto& slot: slots_) {
+        slot.stage.store(STAGE_IDLE, std::memory_order_relaxed);
+        slot.used.store(false, std::memory_order_relaxed);
+    }
+    for (auto& count: counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+StageProfiler::~StageProfiler() {
+    stop();
+}
+
+StageProfiler& StageProfiler::instance() {
+    static StageProfiler profiler;
+    return profiler;
+}
+
+StageProfiler::Slot* StageProfiler::get_slot_() {
+    // Claims a slot on first use and releases it when the thread exits
+    struct Registration {
+        Slot* slot;
+
+        Registration()
+            : slot(nullptr)
+        {
+            auto& self = instance();
+            for (auto& candidate: self.slots_) {
+                bool expected = false;
+                if (candidate.used.compare_exchange_strong(expected, true)) {
+                    candidate.stage.store(STAGE_IDLE, std::memory_order_relaxed);
+                    slot = &candidate;
+                    break;
+                }
+            }
+            // If all slots are taken the thread goes unprofiled
+        }
+
+        ~Registration() {
+            if (slot) {
+                slot->stage.store(STAGE_IDLE, std::memory_order_relaxed);
+                slot->used.store(false, std::memory_order_release);
+            }
+        }
+    };
+    static thread_local Registration registration;
+    return registration.slot;
+}
+
+int StageProfiler::enter(Stage stage) {
+    auto slot = get_slot_();
+    if (slot == nullptr) {
+        return STAGE_IDLE;
+    }
+    auto prev = slot->stage.load(std::memory_order_relaxed);
+    slot->stage.store(stage, std::memory_order_relaxed);
+    return prev;
+}
+
+void StageProfiler::leave(int prev) {
+    auto slot = get_slot_();
+    if (slot) {
+        slot->stage.store(prev, std::memory_order_relaxed);
+    }
+}
+
+int StageProfiler::current_stage() {
+    auto slot = get_slot_();
+    if (slot == nullptr) {
+        return STAGE_IDLE;
+    }
+    return slot->stage.load(std::memory_order_relaxed);
+}
+
+void StageProfiler::start(u32 interval_us) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (sampler_thread_.joinable()) {
+        return;
+    }
+    shutdown_ = false;
+    enabled_.store(true, std::memory_order_release);
+    sampler_thread_ = std::thread(&StageProfiler::sampler_loop_, this, interval_us);
+}
+
+void StageProfiler::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (!sampler_thread_.joinable()) {
+            return;
+        }
+        shutdown_ = true;
+    }
+    cvar_.notify_one();
+    sampler_thread_.join();
+    enabled_.store(false, std::memory_order_release);
+}
+
+bool StageProfiler::is_enabled() const {
+    return enabled_.load(std::memory_order_acquire);
+}
+
+void StageProfiler::sampler_loop_(u32 interval_us) {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!shutdown_) {
+        cvar_.wait_for(lock, std::chrono::microseconds(interval_us),
+                       [this]() { return shutdown_; });
+        if (shutdown_) {
+            break;
+        }
+        for (auto& slot: slots_) {
+            if (!slot.used.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            auto stage = slot.stage.load(std::memory_order_relaxed);
+            if (stage >= 0 && stage < NUM_STAGES) {
+                counts_[stage].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+std::array<u64, StageProfiler::NUM_STAGES> StageProfiler::get_counts() const {
+    std::array<u64, NUM_STAGES> result;
+    for (int i = 0; i < NUM_STAGES; i++) {
+        result[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+const char* StageProfiler::stage_name(int stage) {
+    switch (stage) {
+    case STAGE_IDLE:
+        return "idle";
+    case STAGE_PARSER:
+        return "parser";
+    case STAGE_PIPELINE:
+        return "pipeline";
+    case STAGE_SEQUENCER:
+        return "sequencer";
+    case STAGE_NBTREE:
+        return "nbtree";
+    case STAGE_VOLUME:
+        return "volume";
+    default:
+        return "unknown";
+    }
+}
+
+}  // namespace Akumuli
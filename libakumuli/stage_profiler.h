@@ -0,0 +1,122 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Built-in sampling profiler with per-stage CPU attribution.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#pragma once
+#include "akumuli.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Akumuli {
+
+/** Sampling profiler for the ingestion/query pipeline.
+  * Worker threads tag the pipeline stage they're currently in with a
+  * thread-local marker (one relaxed store per stage change), a background
+  * sampler periodically reads all markers and accumulates per-stage sample
+  * counts. The breakdown is exposed through the stats endpoint, so CPU
+  * attribution can be read in production without attaching an external
+  * profiler. Stage values match the public `aku_ProfilerStage` enum.
+  */
+struct StageProfiler {
+    //! Pipeline stage a worker thread can be tagged with
+    enum Stage {
+        STAGE_IDLE = 0,   //< Registered but not inside a tagged stage
+        STAGE_PARSER,     //< Protocol parsing
+        STAGE_PIPELINE,   //< Ingestion pipeline spout
+        STAGE_SEQUENCER,  //< In-memory sequencer
+        STAGE_NBTREE,     //< NB-tree leaf encoding
+        STAGE_VOLUME,     //< Volume I/O
+        NUM_STAGES,
+    };
+
+    enum {
+        //! Default sampling interval (100Hz)
+        DEFAULT_INTERVAL_US = 10000,
+        //! Max number of threads that can be tracked
+        MAX_THREADS = 0x100,
+    };
+
+    //! Per-thread marker slot
+    struct Slot {
+        std::atomic<int>  stage;  //< Current stage of the owning thread
+        std::atomic<bool> used;   //< Slot is claimed by a live thread
+    };
+
+    std::array<Slot, MAX_THREADS> slots_;
+    std::array<std::atomic<u64>, NUM_STAGES> counts_;  //< Samples per stage
+    std::atomic<bool>       enabled_;
+    std::thread             sampler_thread_;
+    std::mutex              lock_;
+    std::condition_variable cvar_;
+    bool                    shutdown_;
+
+    //! Process-wide profiler instance
+    static StageProfiler& instance();
+
+    /** Tag the calling thread with the stage (the thread is registered
+      * with the profiler on first use).
+      * @return previous stage (pass it to `leave`)
+      */
+    static int enter(Stage stage);
+
+    //! Restore the previous stage returned by `enter`
+    static void leave(int prev);
+
+    //! Current stage tag of the calling thread
+    static int current_stage();
+
+    //! RAII stage marker
+    struct ScopedStage {
+        int prev_;
+        ScopedStage(Stage stage) : prev_(enter(stage)) {}
+        ~ScopedStage() { leave(prev_); }
+    };
+
+    //! Start the sampler thread
+    void start(u32 interval_us = DEFAULT_INTERVAL_US);
+
+    //! Stop the sampler thread (collected counts are kept)
+    void stop();
+
+    bool is_enabled() const;
+
+    //! Snapshot of per-stage sample counts
+    std::array<u64, NUM_STAGES> get_counts() const;
+
+    //! Human readable stage name (stats endpoint key)
+    static const char* stage_name(int stage);
+
+private:
+    StageProfiler();
+    ~StageProfiler();
+
+    //! Sampler thread body
+    void sampler_loop_(u32 interval_us);
+
+    //! Get (or claim) the slot of the calling thread
+    static Slot* get_slot_();
+};
+
+}  // namespace Akumuli
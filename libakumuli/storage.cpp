@@ -29,9 +29,11 @@
 #include <atomic>
 #include <sstream>
 #include <cassert>
+#include <chrono>
 #include <functional>
 #include <sstream>
 
+#include <boost/crc.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/bind.hpp>
@@ -190,9 +192,24 @@ static void zero_deleter(SeriesMatcher*) {}
 
 Storage::Storage(const char* path, aku_FineTuneParams const& params)
     : config_(params)
+    , tail_horizon_(0)
     , open_error_code_(AKU_SUCCESS)
     , logger_(params.logger)
     , local_matcher_(&zero_deleter)
+    , prep_request_(-1)
+    , prepared_index_(-1)
+    , prep_shutdown_(false)
+    , gc_requested_(0)
+    , gc_completed_(0)
+    , gc_shutdown_(false)
+    , wseq_{0}
+    , wseq_snapshot_{0}
+    , wseq_durable_{0}
+    , ckpt_pending_(false)
+    , ckpt_merge_lock_(0)
+    , ckpt_local_rev_(0)
+    , ckpt_error_(AKU_SUCCESS)
+    , ckpt_shutdown_(false)
 {
     // 0. Check that file exists
     auto filedesc = std::fopen(const_cast<char*>(path), "r");
@@ -206,7 +223,7 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
 
     // 1. Open db
     try {
-        metadata_ = std::make_shared<MetadataStorage>(path, logger_);
+        metadata_ = std::make_shared<MetadataStorage>(path, logger_, params.metadata_sync);
     } catch(std::exception const& err) {
         (*logger_)(AKU_LOG_ERROR, err.what());
         open_error_code_ = AKU_ENOT_FOUND;
@@ -223,22 +240,324 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
     ttl_ = config_.window_size;
 
     // init cache
-    cache_.reset(new ChunkCache(config_.max_cache_size));
+    if (config_.shared_cache_size != 0) {
+        // Several databases in one process share the budget, each is
+        // guaranteed its `max_cache_size` quota
+        cache_.reset(new ChunkCache(config_.max_cache_size,
+                                    CacheBudget::process_budget(config_.shared_cache_size)));
+    } else {
+        cache_.reset(new ChunkCache(config_.max_cache_size));
+    }
 
     // create volumes list
-    for(auto path: v_iter.volume_names) {
-        PVolume vol;
-        vol.reset(new Volume(path.c_str(), config_, logger_));
-        vol->make_readonly();
-        volumes_.push_back(vol);
+    // Opening a volume is mostly syscall latency (open, lock, mmap -
+    // nothing is read from the file until `select_active_page`) so the
+    // volumes are opened in parallel, otherwise a storage with many
+    // volumes takes too long to become writable after restart
+    volumes_.resize(v_iter.volume_names.size());
+    int nthreads = static_cast<int>(std::min(static_cast<size_t>(std::thread::hardware_concurrency()),
+                                             volumes_.size()));
+    nthreads = std::max(nthreads, 1);
+    std::atomic<size_t> next_volume {0};
+    std::vector<std::exception_ptr> open_errors(static_cast<size_t>(nthreads));
+    std::vector<std::thread> openers;
+    for (int tid = 0; tid < nthreads; tid++) {
+        openers.emplace_back([&, tid]() {
+            try {
+                while (true) {
+                    auto ix = next_volume.fetch_add(1);
+                    if (ix >= v_iter.volume_names.size()) {
+                        break;
+                    }
+                    PVolume vol;
+                    vol.reset(new Volume(v_iter.volume_names.at(ix).c_str(), config_, logger_));
+                    vol->make_readonly();
+                    volumes_.at(ix) = vol;
+                }
+            } catch (...) {
+                open_errors.at(tid) = std::current_exception();
+            }
+        });
+    }
+    for (auto& opener: openers) {
+        opener.join();
+    }
+    for (auto& err: open_errors) {
+        if (err) {
+            // Same effect as the panic of a serial open
+            std::rethrow_exception(err);
+        }
     }
 
     select_active_page();
 
     prepopulate_cache(config_.max_cache_size);
+
+    // The tail rings only see samples written by this process - remember
+    // the newest timestamp already on disk so tail queries that reach
+    // below it go through the regular search path
+    for (PVolume const& vol: volumes_) {
+        auto page = vol->get_page();
+        auto count = page->get_entries_count();
+        if (count != 0) {
+            tail_horizon_ = std::max(tail_horizon_, page->read_timestamp_at(count - 1));
+        }
+    }
+
+    // Start the volume preparer. The next volume is recycled up front only
+    // when it holds no data - recycling a non-empty one ahead of need would
+    // enforce retention earlier than the rollover itself, so in that case
+    // the first rollover after restart pays the cost inline and every
+    // subsequent one is prepared in the background.
+    prep_thread_ = std::thread(&Storage::volume_preparer_loop_, this);
+    auto next_ix = static_cast<size_t>(active_volume_index_.load() + 1) % volumes_.size();
+    if (volumes_.at(next_ix)->get_page()->get_entries_count() == 0) {
+        prepare_next_volume_(static_cast<int>(next_ix));
+    }
+
+    if (config_.fsync_interval != 0) {
+        gc_thread_ = std::thread(&Storage::group_commit_loop_, this);
+    }
+
+    if (config_.pipeline_checkpoints != 0) {
+        ckpt_thread_ = std::thread(&Storage::checkpoint_merge_loop_, this);
+    }
+
+    if (config_.enable_rollups) {
+        // Note: rollups should be created before WAL replay so the replayed
+        // values are folded back into the aggregation windows
+        rollups_.reset(new RollupEngine(*matcher_,
+                                        [this](aku_ParamId id, aku_Timestamp ts, double value) {
+                                            return write_double(id, ts, value);
+                                        }));
+    }
+
+    if (config_.enable_wal) {
+        std::unique_ptr<Wal> wal(new Wal((std::string(path) + ".wal").c_str()));
+        std::vector<Wal::Record> records;
+        if (wal->replay(&records) != AKU_SUCCESS || wal->open() != AKU_SUCCESS) {
+            open_error_code_ = AKU_EGENERAL;
+            return;
+        }
+        if (!records.empty()) {
+            log_message("WAL replay started, num records", records.size());
+            // Note: wal_ is not set yet so replayed records wouldn't be
+            // logged twice.
+            for (auto const& rec: records) {
+                auto status = write_double(rec.id, rec.ts, rec.value);
+                if (status != AKU_SUCCESS && status != AKU_ELATE_WRITE) {
+                    log_error(aku_error_message(status));
+                    open_error_code_ = status;
+                    return;
+                }
+            }
+        }
+        wal_ = std::move(wal);
+    }
+
+    if (config_.reorder_lateness != 0) {
+        reorder_.reset(new ReorderBuffer(config_.reorder_lateness));
+    }
+}
+
+Storage::~Storage() {
+    if (prep_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(prep_mutex_);
+            prep_shutdown_ = true;
+        }
+        prep_cv_.notify_one();
+        prep_thread_.join();
+    }
+    if (gc_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(gc_mutex_);
+            gc_shutdown_ = true;
+        }
+        gc_cv_.notify_all();
+        gc_thread_.join();
+    }
+    if (ckpt_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(ckpt_mutex_);
+            ckpt_shutdown_ = true;
+        }
+        ckpt_cv_.notify_all();
+        ckpt_thread_.join();
+    }
+}
+
+void Storage::group_commit_loop_() {
+    std::unique_lock<std::mutex> lock(gc_mutex_);
+    while (true) {
+        gc_cv_.wait(lock, [this]() { return gc_shutdown_ || gc_requested_ > gc_completed_; });
+        if (gc_shutdown_) {
+            break;
+        }
+        // Wait out the batching interval unless enough checkpoints are
+        // pending already, more requests can pile up meanwhile
+        if (gc_requested_ - gc_completed_ < GROUP_COMMIT_MAX_PENDING) {
+            gc_cv_.wait_for(lock, std::chrono::nanoseconds(config_.fsync_interval), [this]() {
+                return gc_shutdown_ || gc_requested_ - gc_completed_ >= GROUP_COMMIT_MAX_PENDING;
+            });
+            if (gc_shutdown_) {
+                break;
+            }
+        }
+        u64 seqno = gc_requested_;
+        PVolume volume = gc_volume_;
+        lock.unlock();
+        // One fsync acknowledges every request up to `seqno`. Requests
+        // can target different volumes across a rollover but the old
+        // volume is flushed by `advance_volume_` when it is closed, so
+        // flushing the most recently requested one is enough.
+        volume->flush();
+        lock.lock();
+        gc_completed_ = seqno;
+        gc_cv_.notify_all();
+    }
+    // Release the waiters so shutdown doesn't hang (the data is flushed
+    // by `close` anyway)
+    gc_completed_ = gc_requested_;
+    gc_cv_.notify_all();
+}
+
+void Storage::flush_active_volume_() {
+    if (config_.fsync_interval == 0) {
+        active_volume_->flush();
+        return;
+    }
+    std::unique_lock<std::mutex> lock(gc_mutex_);
+    u64 seqno = ++gc_requested_;
+    gc_volume_ = active_volume_;
+    gc_cv_.notify_all();
+    gc_cv_.wait(lock, [this, seqno]() { return gc_shutdown_ || gc_completed_ >= seqno; });
+}
+
+u64 Storage::get_write_sequence() const {
+    return wseq_.load(std::memory_order_acquire);
+}
+
+u64 Storage::get_durability_watermark() const {
+    return wseq_durable_.load(std::memory_order_acquire);
+}
+
+void Storage::publish_durability_watermark_(u64 seq) {
+    // The snapshot taken before this merge can cover writes that are
+    // still in the open window so it is staged and published by the next
+    // flush, the snapshot staged by the previous flush is published now -
+    // everything below it was merged before this flush started. Flushes
+    // can finish out of order so both values only move forward.
+    u64 prev = wseq_snapshot_.load(std::memory_order_acquire);
+    while (prev < seq && !wseq_snapshot_.compare_exchange_weak(prev, seq)) {
+    }
+    u64 cur = wseq_durable_.load(std::memory_order_acquire);
+    while (cur < prev && !wseq_durable_.compare_exchange_weak(cur, prev)) {
+    }
+}
+
+void Storage::checkpoint_merge_loop_() {
+    std::unique_lock<std::mutex> lock(ckpt_mutex_);
+    while (true) {
+        ckpt_cv_.wait(lock, [this]() { return ckpt_shutdown_ || ckpt_pending_; });
+        if (ckpt_shutdown_) {
+            break;
+        }
+        int merge_lock = ckpt_merge_lock_;
+        int local_rev = ckpt_local_rev_;
+        lock.unlock();
+        // Slow part - the closed window is sorted, compressed and
+        // committed while ingestion proceeds into the new one
+        auto status = _merge_to_disk_(merge_lock, local_rev);
+        lock.lock();
+        if (status != AKU_SUCCESS) {
+            ckpt_error_ = status;
+        }
+        ckpt_pending_ = false;
+        ckpt_cv_.notify_all();
+    }
+    // Release the waiters so shutdown doesn't hang
+    ckpt_pending_ = false;
+    ckpt_cv_.notify_all();
+}
+
+aku_Status Storage::schedule_merge_(int merge_lock, int local_rev) {
+    if (config_.pipeline_checkpoints == 0) {
+        return _merge_to_disk_(merge_lock, local_rev);
+    }
+    std::unique_lock<std::mutex> lock(ckpt_mutex_);
+    // At most one checkpoint in flight - the previous merge should land
+    // before the next window is closed on top of it
+    ckpt_cv_.wait(lock, [this]() { return ckpt_shutdown_ || !ckpt_pending_; });
+    if (ckpt_shutdown_) {
+        return AKU_SUCCESS;
+    }
+    aku_Status status = ckpt_error_;
+    ckpt_error_ = AKU_SUCCESS;
+    if (status != AKU_SUCCESS) {
+        // Surface the error of the previous background merge to a writer
+        return status;
+    }
+    ckpt_pending_ = true;
+    ckpt_merge_lock_ = merge_lock;
+    ckpt_local_rev_ = local_rev;
+    ckpt_cv_.notify_all();
+    return AKU_SUCCESS;
+}
+
+void Storage::drain_checkpoint_() {
+    if (!ckpt_thread_.joinable()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(ckpt_mutex_);
+    ckpt_cv_.wait(lock, [this]() { return ckpt_shutdown_ || !ckpt_pending_; });
+}
+
+void Storage::volume_preparer_loop_() {
+    std::unique_lock<std::mutex> lock(prep_mutex_);
+    while (true) {
+        prep_cv_.wait(lock, [this]() { return prep_shutdown_ || prep_request_ >= 0; });
+        if (prep_shutdown_) {
+            break;
+        }
+        int ix = prep_request_;
+        prep_request_ = -1;
+        // Slow part - the old file is renamed away (readers keep it alive
+        // through their shared_ptr), a fresh pre-truncated file with a
+        // reset index takes its place
+        volumes_.at(static_cast<size_t>(ix)) = volumes_.at(static_cast<size_t>(ix))->safe_realloc();
+        prepared_index_ = ix;
+    }
+}
+
+void Storage::prepare_next_volume_(int ix) {
+    {
+        std::lock_guard<std::mutex> lock(prep_mutex_);
+        prep_request_ = ix;
+    }
+    prep_cv_.notify_one();
 }
 
 void Storage::close() {
+    if (reorder_) {
+        // Release all pending samples before merging the cache
+        std::vector<ReorderBuffer::OutSample> released;
+        {
+            std::lock_guard<LockType> reorder_guard(reorder_lock_);
+            reorder_->flush(&released);
+        }
+        for (auto const& out: released) {
+            TimeSeriesValue ts_value(out.ts, out.id, out.value);
+            aku_MemRange m = {};
+            auto status = _write_impl(ts_value, m);
+            if (status != AKU_SUCCESS && status != AKU_ELATE_WRITE) {
+                log_error("Can't write buffered sample on close");
+            }
+        }
+    }
+    // The in-flight checkpoint merge (if any) should land before the
+    // final merge of the cache
+    drain_checkpoint_();
     auto status = active_volume_->cache_->close(active_page_);
     if (status != AKU_SUCCESS) {
         std::stringstream fmt;
@@ -247,12 +566,21 @@ void Storage::close() {
         return;
     }
     active_volume_->flush();
+    // Everything is merged and flushed - every acknowledged write is durable
+    wseq_durable_.store(wseq_.load(std::memory_order_acquire), std::memory_order_release);
+    if (wal_) {
+        // Everything is merged to disk so the log can be emptied
+        wal_->rotate(AKU_MAX_TIMESTAMP);
+        wal_->close();
+    }
     // Update metadata store
     std::vector<SeriesMatcher::SeriesNameT> names;
     matcher_->pull_new_names(&names);
     if (!names.empty()) {
         metadata_->insert_new_names(names);
     }
+    // Wait until the names hit the disk
+    metadata_->force_sync();
 }
 
 void Storage::select_active_page() {
@@ -321,9 +649,15 @@ void Storage::advance_volume_(int local_rev) {
         // select next page in round robin order
         active_volume_index_++;
         auto next_volume_index = active_volume_index_ % volumes_.size();
-        auto next_volume = volumes_[next_volume_index];
-        // swap next and prev volumes caches
-        volumes_[next_volume_index] = next_volume->safe_realloc();
+        {
+            std::lock_guard<std::mutex> lock(prep_mutex_);
+            if (prepared_index_ != static_cast<int>(next_volume_index)) {
+                // The preparer didn't get ahead of the writers (or this is
+                // the first rollover after restart) - recycle inline
+                volumes_[next_volume_index] = volumes_[next_volume_index]->safe_realloc();
+            }
+            prepared_index_ = -1;
+        }
 
         active_volume_ = volumes_[next_volume_index];
         std::swap(active_volume_->cache_, prev_volume->cache_);
@@ -340,6 +674,9 @@ void Storage::advance_volume_(int local_rev) {
         log_message("....page ID", active_volume_->page_->get_page_id());
         log_message("....close count", active_volume_->page_->get_close_count());
         log_message("....open count", active_volume_->page_->get_open_count());
+
+        // Get the volume after this one ready ahead of the next rollover
+        prepare_next_volume_(static_cast<int>((next_volume_index + 1) % volumes_.size()));
     }
     // Or other thread already done all the switching
     // just redo all the things
@@ -425,6 +762,17 @@ void Storage::search(Caller &caller, InternalCursor* cur, const char* query) con
 
         if (query_processor->start()) {
 
+            // Instant queries over the hot range (e.g. `last 1 minute`) can
+            // often be answered from the tail rings of the active sequencer
+            // without touching the page index or contending with writers
+            if (query_processor->range().type == QP::QueryRange::INSTANT &&
+                query_processor->range().lowerbound > tail_horizon_ &&
+                active_volume_->cache_->search_tail(query_processor))
+            {
+                query_processor->stop();
+                return;
+            }
+
             if (!query_processor->range().is_backward()) {
                 u32 starting_ix = active_volume_->get_page()->get_page_id() + 1;  // Start from oldest volume
                 for (u32 ix = starting_ix; ix < (starting_ix + volumes_.size()); ix++) {
@@ -490,54 +838,85 @@ void Storage::get_stats(aku_StorageStats* rcv_stats) {
 
 // Writing
 
+aku_Status Storage::_merge_to_disk_(int merge_lock, int local_rev) {
+    // Writes at or below this sequence are either in the closed window
+    // that is merged now or in a window that was merged earlier, so after
+    // the *next* flush all of them are on disk
+    u64 wseq_snap = wseq_.load(std::memory_order_acquire);
+    // Update metadata store
+    std::vector<SeriesMatcher::SeriesNameT> names;
+    matcher_->pull_new_names(&names);
+    if (!names.empty()) {
+        metadata_->insert_new_names(names);
+    }
+
+    // Move data from cache to disk
+    aku_Status status = active_volume_->cache_->merge_and_compress(active_volume_->get_page());
+    switch (status) {
+    case AKU_SUCCESS:
+        switch(config_.durability) {
+        case AKU_MAX_DURABILITY:
+            // Max durability
+            flush_active_volume_();
+            publish_durability_watermark_(wseq_snap);
+            break;
+        case AKU_DURABILITY_SPEED_TRADEOFF:
+            // Compromice some durability for speed
+            if ((merge_lock % 8) == 1) {
+                flush_active_volume_();
+                publish_durability_watermark_(wseq_snap);
+            }
+            break;
+        case AKU_MAX_WRITE_SPEED:
+            break;
+        };
+        if (wal_) {
+            // Merged values can be removed from the log
+            wal_->rotate(active_volume_->cache_->get_checkpoint_timestamp());
+        }
+        break;
+    case AKU_EOVERFLOW:
+        // Page overflow
+        advance_volume_(local_rev);
+        status = AKU_SUCCESS;  // Value is stored by cache so it wouldn't be lost
+        break;
+    default:
+        log_error(aku_error_message(status));
+        AKU_PANIC("Fatal error in write path");
+        break;
+    };
+    return status;
+}
+
 aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
     int local_rev = active_volume_index_.load();
     aku_Status status = AKU_SUCCESS;
+    if (wal_) {
+        // Value should hit the log before the write is acknowledged
+        status = wal_->append(ts_value.get_paramid(), ts_value.get_timestamp(), ts_value.value);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
     int merge_lock = 0;
     std::tie(status, merge_lock) = active_volume_->cache_->add(ts_value);
     switch (status) {
         case AKU_SUCCESS: {
+            // Tag the write with a sequence number once it is in the cache
+            // (the watermark acknowledges it when it reaches the disk)
+            wseq_.fetch_add(1, std::memory_order_acq_rel);
             if (merge_lock % 2 == 1) {
                 // Slow path //
-
-                // Update metadata store
-                std::vector<SeriesMatcher::SeriesNameT> names;
-                matcher_->pull_new_names(&names);
-                if (!names.empty()) {
-                    metadata_->insert_new_names(names);
-                }
-
-                // Move data from cache to disk
-                status = active_volume_->cache_->merge_and_compress(active_volume_->get_page());
-                switch (status) {
-                case AKU_SUCCESS:
-                    switch(config_.durability) {
-                    case AKU_MAX_DURABILITY:
-                        // Max durability
-                        active_volume_->flush();
-                        break;
-                    case AKU_DURABILITY_SPEED_TRADEOFF:
-                        // Compromice some durability for speed
-                        if ((merge_lock % 8) == 1) {
-                            active_volume_->flush();
-                        }
-                        break;
-                    case AKU_MAX_WRITE_SPEED:
-                        break;
-                    };
-                    break;
-                case AKU_EOVERFLOW:
-                    // Page overflow
-                    advance_volume_(local_rev);
-                    status = AKU_SUCCESS;  // Value is stored by cache so it wouldn't be lost
-                    break;
-                default:
-                    log_error(aku_error_message(status));
-                    AKU_PANIC("Fatal error in write path");
-                    break;
-                };
+                status = schedule_merge_(merge_lock, local_rev);
             }
+            break;
         }
+        case AKU_ELATE_WRITE:
+            if (!reorder_) {
+                // Reordered samples are counted when they leave the buffer
+                ReorderBuffer::count_late();
+            }
+            break;
         default:
             break;
     }
@@ -546,12 +925,112 @@ aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
 
 //! write binary data
 aku_Status Storage::write_double(aku_ParamId param, aku_Timestamp ts, double value) {
-    aku_MemRange m = {};
-    TimeSeriesValue ts_value(ts, param, value);
-    return _write_impl(ts_value, m);
+    aku_Status status = AKU_SUCCESS;
+    if (reorder_) {
+        // Route the sample through the reorder buffer, write out everything
+        // that fell out of the lateness bound
+        std::vector<ReorderBuffer::OutSample> released;
+        {
+            std::lock_guard<LockType> guard(reorder_lock_);
+            reorder_->put(param, ts, value, &released);
+        }
+        for (auto const& s: released) {
+            aku_MemRange m = {};
+            TimeSeriesValue ts_value(s.ts, s.id, s.value);
+            auto st = _write_impl(ts_value, m);
+            if (st != AKU_SUCCESS && st != AKU_ELATE_WRITE) {
+                return st;
+            }
+        }
+    } else {
+        aku_MemRange m = {};
+        TimeSeriesValue ts_value(ts, param, value);
+        status = _write_impl(ts_value, m);
+    }
+    if (status == AKU_SUCCESS && rollups_) {
+        status = rollups_->add(param, ts, value);
+    }
+    return status;
+}
+
+aku_Status Storage::write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 n) {
+    if (reorder_) {
+        // Reordered path - samples go through the per-series buffer one by
+        // one (WAL and rollups are handled by `write_double`)
+        for (u32 i = 0; i < n; i++) {
+            auto status = write_double(ids[i], tss[i], xss[i]);
+            if (status != AKU_SUCCESS && status != AKU_ELATE_WRITE) {
+                return status;
+            }
+        }
+        return AKU_SUCCESS;
+    }
+    bool late_write = false;
+    u32 offset = 0;
+    if (wal_) {
+        // Batch should hit the log before the write is acknowledged
+        for (u32 i = 0; i < n; i++) {
+            auto status = wal_->append(ids[i], tss[i], xss[i]);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+        }
+    }
+    while (offset < n) {
+        int local_rev = active_volume_index_.load();
+        aku_Status status = AKU_SUCCESS;
+        int merge_lock = 0;
+        u32 consumed = 0;
+        std::tie(status, merge_lock) = active_volume_->cache_->add_batch(ids + offset, tss + offset,
+                                                                         xss + offset, n - offset,
+                                                                         &consumed);
+        offset += consumed;
+        if (consumed) {
+            // Tag the accepted samples with sequence numbers (the watermark
+            // acknowledges them when they reach the disk)
+            wseq_.fetch_add(consumed, std::memory_order_acq_rel);
+        }
+        switch (status) {
+        case AKU_SUCCESS:
+            break;
+        case AKU_ELATE_WRITE:
+            // Late samples are skipped, the rest of the batch is stored
+            late_write = true;
+            ReorderBuffer::count_late();
+            break;
+        default:
+            return status;
+        }
+        if (merge_lock % 2 == 1) {
+            // Slow path //
+            status = schedule_merge_(merge_lock, local_rev);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+        }
+    }
+    if (rollups_) {
+        // Rollups are best-effort aggregates so the samples discarded as
+        // late writes are folded in anyway
+        for (u32 i = 0; i < n; i++) {
+            auto status = rollups_->add(ids[i], tss[i], xss[i]);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+        }
+    }
+    return late_write ? AKU_ELATE_WRITE : AKU_SUCCESS;
 }
 
 aku_Status Storage::series_to_param_id(const char* begin, const char* end, u64 *value) {
+    // Fast path - writers tend to send byte-identical series strings, so the
+    // raw bytes usually map to an already known id and the normalization
+    // pass can be skipped entirely.
+    auto cached = raw_cache_.match(begin, end);
+    if (cached != 0ul) {
+        *value = cached;
+        return AKU_SUCCESS;
+    }
     char buffer[AKU_LIMITS_MAX_SNAME];
     const char* keystr_begin = nullptr;
     const char* keystr_end = nullptr;
@@ -565,10 +1044,80 @@ aku_Status Storage::series_to_param_id(const char* begin, const char* end, u64 *
         } else {
             *value = id;
         }
+        raw_cache_._add(std::string(begin, end), *value);
     }
     return status;
 }
 
+aku_Status Storage::series_to_param_id_batch(const char* const* begins, const char* const* ends,
+                                             u64* out_ids, u32 n)
+{
+    // Resolve raw-cache hits and normalize the rest
+    std::vector<u32> pending;
+    std::vector<std::string> normal(n);
+    for (u32 i = 0; i < n; i++) {
+        auto cached = raw_cache_.match(begins[i], ends[i]);
+        if (cached != 0ul) {
+            out_ids[i] = cached;
+            continue;
+        }
+        char buffer[AKU_LIMITS_MAX_SNAME];
+        const char* keystr_begin = nullptr;
+        const char* keystr_end = nullptr;
+        auto status = SeriesParser::to_normal_form(begins[i], ends[i],
+                                                   buffer, buffer+AKU_LIMITS_MAX_SNAME,
+                                                   &keystr_begin, &keystr_end);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        normal[i].assign(buffer, keystr_end - buffer);
+        pending.push_back(i);
+    }
+    if (pending.empty()) {
+        return AKU_SUCCESS;
+    }
+    // Sort by normalized name so duplicates become adjacent and each
+    // unique series is resolved once
+    std::sort(pending.begin(), pending.end(), [&](u32 lhs, u32 rhs) {
+        return normal[lhs] < normal[rhs];
+    });
+    std::vector<SeriesMatcher::StringT>   unknown;         // unique names missing from the matcher
+    std::vector<std::pair<size_t, size_t>> unknown_ranges;  // their ranges in `pending`
+    size_t begin_ix = 0;
+    while (begin_ix < pending.size()) {
+        auto const& name = normal[pending[begin_ix]];
+        size_t end_ix = begin_ix + 1;
+        while (end_ix < pending.size() && normal[pending[end_ix]] == name) {
+            end_ix++;
+        }
+        // Lock-free lookup first, only new series go through `add_batch`
+        auto id = matcher_->match(name.data(), name.data() + name.size());
+        if (id != 0ul) {
+            for (size_t i = begin_ix; i < end_ix; i++) {
+                out_ids[pending[i]] = id;
+            }
+        } else {
+            unknown.push_back(std::make_pair(name.data(), static_cast<int>(name.size())));
+            unknown_ranges.push_back(std::make_pair(begin_ix, end_ix));
+        }
+        begin_ix = end_ix;
+    }
+    if (!unknown.empty()) {
+        // Single lock acquisition for all the new series
+        std::vector<u64> ids;
+        matcher_->add_batch(unknown, &ids);
+        for (size_t i = 0; i < unknown.size(); i++) {
+            for (size_t j = unknown_ranges[i].first; j < unknown_ranges[i].second; j++) {
+                out_ids[pending[j]] = ids[i];
+            }
+        }
+    }
+    for (auto ix: pending) {
+        raw_cache_._add(std::string(begins[ix], ends[ix]), out_ids[ix]);
+    }
+    return AKU_SUCCESS;
+}
+
 void Storage::set_thread_local_matcher(SeriesMatcher *matcher) const {
     local_matcher_.reset(matcher);
 }
@@ -664,8 +1213,13 @@ static apr_status_t create_page_file(const char* file_name, u32 page_index, u32
     using namespace std;
     apr_status_t status;
     i64 size = page_size == 0 ? AKU_MAX_PAGE_SIZE : page_size;
+    // Round the file up to the huge page boundary so a MADV_HUGEPAGE hinted
+    // mapping can cover the tail of the page (the page keeps the requested
+    // length, only the file gets the alignment padding).
+    i64 hpage = static_cast<i64>(get_huge_page_size());
+    i64 file_size = (size + hpage - 1) / hpage * hpage;
 
-    status = create_file(file_name, size, logger);
+    status = create_file(file_name, file_size, logger);
     if (status != APR_SUCCESS) {
         stringstream err;
         err << "Can't create page file " << file_name;
@@ -897,4 +1451,83 @@ apr_status_t Storage::remove_storage(const char* file_name, aku_logger_cb_t logg
     return status;
 }
 
+//! Verify one volume, return (num chunks, num damaged chunks)
+static std::tuple<u64, u64> fsck_volume(const char* path, aku_logger_cb_t logger) {
+    MemoryMappedFile mmap(path, false);
+    if (mmap.is_bad()) {
+        std::stringstream fmt;
+        fmt << "can't mmap volume " << path;
+        (*logger)(AKU_LOG_ERROR, fmt.str().c_str());
+        return std::make_tuple(0ull, 1ull);
+    }
+    auto page = reinterpret_cast<const PageHeader*>(mmap.get_pointer());
+    auto length = page->get_page_length();
+    u64 count = page->get_entries_count();
+    u64 nbad = 0;
+    for (u32 i = 0; i < count; i++) {
+        auto pentry = page->read_entry(page->page_index(static_cast<int>(i))->offset);
+        if (pentry == nullptr) {
+            nbad++;
+            continue;
+        }
+        auto pdesc  = reinterpret_cast<CompressedChunkDesc const*>(&pentry->value[0]);
+        // Offsets have to be sane before the data is touched - the index
+        // can be garbage after an unclean shutdown
+        if (pdesc->begin_offset > length || pdesc->end_offset > length ||
+            pdesc->end_offset < pdesc->begin_offset)
+        {
+            nbad++;
+            continue;
+        }
+        auto pbegin = (const unsigned char*)page->read_entry_data(pdesc->begin_offset);
+        auto pend   = (const unsigned char*)page->read_entry_data(pdesc->end_offset);
+        boost::crc_32_type checksum;
+        checksum.process_block(pbegin, pend);
+        if (checksum.checksum() != pdesc->checksum) {
+            nbad++;
+        }
+    }
+    return std::make_tuple(count, nbad);
+}
+
+aku_Status Storage::fsck(const char* file_name, aku_logger_cb_t logger) {
+    std::shared_ptr<MetadataStorage> db;
+    try {
+        db = std::make_shared<MetadataStorage>(file_name, logger);
+    } catch (std::exception const& err) {
+        (*logger)(AKU_LOG_ERROR, err.what());
+        return AKU_ENOT_FOUND;
+    }
+
+    VolumeIterator v_iter(db, logger);
+    if (v_iter.is_bad()) {
+        return v_iter.error_code;
+    }
+
+    // Volumes are independent so each one is scanned by its own thread
+    size_t nvolumes = v_iter.volume_names.size();
+    std::vector<u64> nchunks(nvolumes, 0);
+    std::vector<u64> nbad(nvolumes, 0);
+    std::vector<std::thread> checkers;
+    for (size_t ix = 0; ix < nvolumes; ix++) {
+        checkers.emplace_back([&, ix]() {
+            std::tie(nchunks.at(ix), nbad.at(ix)) =
+                fsck_volume(v_iter.volume_names.at(ix).c_str(), logger);
+        });
+    }
+    for (auto& checker: checkers) {
+        checker.join();
+    }
+
+    u64 total_bad = 0;
+    for (size_t ix = 0; ix < nvolumes; ix++) {
+        std::stringstream fmt;
+        fmt << "volume " << ix << " (" << v_iter.volume_names.at(ix) << "): "
+            << nchunks.at(ix) << " chunks, " << nbad.at(ix) << " damaged";
+        (*logger)(nbad.at(ix) ? AKU_LOG_ERROR : AKU_LOG_INFO, fmt.str().c_str());
+        total_bad += nbad.at(ix);
+    }
+    return total_bad ? AKU_EBAD_DATA : AKU_SUCCESS;
+}
+
 }
@@ -22,6 +22,7 @@
 
 #pragma once
 #include <atomic>
+#include <condition_variable>
 #include <cstddef>
 #include <list>
 #include <map>
@@ -39,9 +40,11 @@
 #include "cursor.h"
 #include "metadatastorage.h"
 #include "page.h"
+#include "rollup.h"
 #include "sequencer.h"
 #include "seriesparser.h"
 #include "util.h"
+#include "wal.h"
 
 #include <boost/thread.hpp>
 
@@ -105,10 +108,12 @@ struct Storage {
     PageHeader*          active_page_;
     std::atomic<int>     active_volume_index_;
     aku_Duration         ttl_;              //< Late write limit
+    aku_Timestamp        tail_horizon_;     //< Newest on-disk timestamp at open
     aku_Status           open_error_code_;  //< Open op-n error code
     std::vector<PVolume> volumes_;          //< List of all volumes
     PMetadataStorage     metadata_;         //< Metadata storage
     PSeriesMatcher       matcher_;          //< Series matcher
+    SeriesMatcher        raw_cache_;        //< Raw (un-normalized) series name to id cache
 
     LockType mutex_;  //< Storage lock (used by worker thread)
 
@@ -116,15 +121,71 @@ struct Storage {
     aku_logger_cb_t logger_;
     Rand            rand_;
     PCache          cache_;
+    std::unique_ptr<Wal> wal_;  //< Write-ahead log (null if disabled)
+    std::unique_ptr<RollupEngine> rollups_;  //< Continuous rollups (null if disabled)
+    std::unique_ptr<ReorderBuffer> reorder_;  //< Bounded lateness reorder buffer (null if disabled)
+    LockType reorder_lock_;  //< Guards `reorder_`
 
     //! Local (per query) string pool
     mutable boost::thread_specific_ptr<SeriesMatcher> local_matcher_;
 
+    // Background volume preparer state. The preparer recycles the volume
+    // that follows the active one ahead of rollover so `advance_volume_`
+    // doesn't have to recreate a multi-gigabyte file inline.
+    std::thread             prep_thread_;    //< Volume preparer thread
+    std::mutex              prep_mutex_;     //< Guards the fields below and the recycling itself
+    std::condition_variable prep_cv_;
+    int                     prep_request_;   //< Index of the volume to prepare (-1 - nothing)
+    int                     prepared_index_; //< Index of the volume that is ready (-1 - nothing)
+    bool                    prep_shutdown_;
+
+    enum {
+        //! Pending checkpoints that trigger an early group commit fsync
+        GROUP_COMMIT_MAX_PENDING = 8,
+    };
+
+    // Group commit state. When `fsync_interval` is set, checkpoint
+    // flushes are queued here and a background thread performs one fsync
+    // for the whole batch, releasing all waiting writers together.
+    std::thread             gc_thread_;      //< Group commit thread
+    std::mutex              gc_mutex_;       //< Guards the fields below
+    std::condition_variable gc_cv_;
+    u64                     gc_requested_;   //< Seq-number of the last flush request
+    u64                     gc_completed_;   //< Seq-number covered by the last fsync
+    PVolume                 gc_volume_;      //< Volume of the last flush request
+    bool                    gc_shutdown_;
+
+    // Durability watermark state. Every acknowledged write is tagged with
+    // a sequence number and a completed volume flush publishes a watermark
+    // - all writes with sequence numbers at or below the watermark are on
+    // disk. The watermark published by a flush is the sequence snapshot of
+    // the previous flush: writes acknowledged after that snapshot can
+    // belong to the window that is still open and aren't covered yet.
+    std::atomic<u64>        wseq_;           //< Sequence of the last acknowledged write
+    std::atomic<u64>        wseq_snapshot_;  //< Sequence snapshot of the last flush
+    std::atomic<u64>        wseq_durable_;   //< Published durability watermark
+
+    // Checkpoint pipeline state. When `pipeline_checkpoints` is set the
+    // writer that triggers a checkpoint hands the merge of the closed
+    // window to this thread and returns to ingestion immediately, the new
+    // window accepts samples while the old one is compressed and
+    // committed. At most one checkpoint is in flight.
+    std::thread             ckpt_thread_;     //< Checkpoint merge thread
+    std::mutex              ckpt_mutex_;      //< Guards the fields below
+    std::condition_variable ckpt_cv_;
+    bool                    ckpt_pending_;    //< A merge request is in flight
+    int                     ckpt_merge_lock_; //< Sequence number of the pending merge
+    int                     ckpt_local_rev_;  //< Volume index of the pending merge
+    aku_Status              ckpt_error_;      //< Sticky error of the background merge
+    bool                    ckpt_shutdown_;
+
     /** Storage c-tor.
       * @param file_name path to metadata file
       */
     Storage(const char* path, aku_FineTuneParams const& conf);
 
+    ~Storage();
+
     /** Override local series matcher.
       * This method is const because it doesn't affect any storage data except
       * thread local variable.
@@ -153,11 +214,63 @@ struct Storage {
       */
     void advance_volume_(int ix);
 
+    //! Volume preparer thread body
+    void volume_preparer_loop_();
+
+    //! Ask the preparer to recycle volume `ix` in the background
+    void prepare_next_volume_(int ix);
+
+    //! Group commit thread body
+    void group_commit_loop_();
+
+    /** Flush the active volume honoring the group commit policy.
+      * With `fsync_interval` set the call blocks until the batched fsync
+      * that covers this request completes, otherwise fsyncs inline.
+      */
+    void flush_active_volume_();
+
+    //! Get the sequence number assigned to the last acknowledged write
+    u64 get_write_sequence() const;
+
+    /** Get the durability watermark. All writes with sequence numbers at
+      * or below the watermark are flushed to disk.
+      */
+    u64 get_durability_watermark() const;
+
+    /** Advance the durability watermark after a completed flush.
+      * @param seq write sequence snapshot taken before the merge started
+      */
+    void publish_durability_watermark_(u64 seq);
+
     //! Write double.
     aku_Status write_double(aku_ParamId param, aku_Timestamp ts, double value);
 
+    /** Write batch of doubles (columnar layout).
+      * Cache dispatch and locking is performed once per batch.
+      * @returns AKU_SUCCESS if all values are stored, AKU_ELATE_WRITE if
+      *          some of the values were discarded as late writes
+      */
+    aku_Status write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 n);
+
     aku_Status _write_impl(TimeSeriesValue value, aku_MemRange data);
 
+    //! Merge cache to disk (slow path of the write, called when cache makes a checkpoint)
+    aku_Status _merge_to_disk_(int merge_lock, int local_rev);
+
+    //! Checkpoint merge thread body
+    void checkpoint_merge_loop_();
+
+    /** Merge cache to disk honoring the checkpoint pipeline policy.
+      * Hands the merge to the background worker when the pipeline is
+      * enabled (waiting out the previous in-flight checkpoint first),
+      * merges inline otherwise. Errors of a background merge are sticky
+      * and surface to the writer that schedules the next one.
+      */
+    aku_Status schedule_merge_(int merge_lock, int local_rev);
+
+    //! Wait until the in-flight checkpoint merge (if any) completes
+    void drain_checkpoint_();
+
     /** Convert series name to parameter id
       * @param begin should point to series name
       * @param end should point to series name end
@@ -166,6 +279,14 @@ struct Storage {
       */
     aku_Status series_to_param_id(const char* begin, const char* end, u64* value);
 
+    /** Resolve batch of series names to ids.
+      * Names are normalized, sorted and deduplicated so every unique
+      * series is resolved once and new series are inserted into the
+      * matcher under a single lock acquisition.
+      */
+    aku_Status series_to_param_id_batch(const char* const* begins, const char* const* ends,
+                                        u64* out_ids, u32 n);
+
     /** Convert parameter id to series name.
       */
     int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) const;
@@ -194,6 +315,15 @@ struct Storage {
       */
     static apr_status_t remove_storage(const char* file_name, aku_logger_cb_t logger);
 
+    /** Verify checksums of all chunks of all volumes (one thread per
+      * volume) and log a per-volume damage summary. Doesn't modify
+      * anything and can be run on a closed storage only.
+      * @param file_name path to metadata file
+      * @param logger logger to report progress and damage
+      * @returns AKU_SUCCESS if no damage was found, AKU_EBAD_DATA otherwise
+      */
+    static aku_Status fsck(const char* file_name, aku_logger_cb_t logger);
+
     // Stats
     void get_stats(aku_StorageStats* rcv_stats);
 
@@ -16,108 +16,531 @@
  */
 
 #include "blockstore.h"
+#include "tiering.h"
+#include "latency_histogram.h"
 #include "log_iface.h"
 #include "util.h"
 #include "status_util.h"
 #include "crc32c.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <thread>
+
+#include <aio.h>
+#include <sys/mman.h>
 
 namespace Akumuli {
 namespace StorageEngine {
 
-static u64 hash32(u32 value, u32 bits, u64 seed) {
-    // hashes x strongly universally into N bits
-    // using the random seed.
-    static const u64 a = (1ul << 32) - 1;
-    return (a * value + seed) >> (64-bits);
+static u32 crc32c(const u8* data, size_t size) {
+    static crc32c_impl_t impl = chose_crc32c_implementation();
+    return impl(0, data, size);
+}
+
+static void log_apr_error(apr_status_t status, const char* msg) {
+    if (status != APR_SUCCESS) {
+        char error_message[0x100];
+        apr_strerror(status, error_message, 0x100);
+        Logger::msg(AKU_LOG_ERROR, std::string(msg) + " " + error_message);
+    }
 }
 
 static u64 hash(u64 value, u32 bits) {
-    auto a = hash32(value & 0xFFFFFFFF, bits, 277);
-    auto b = hash32(value >> 32, bits, 337);
-    return a ^ b;
+    // Fibonacci hashing, spreads sequential addresses evenly.
+    return (value * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+}
+
+BlockCache::Shard::Shard(u32 probation_cap, u32 prot_cap)
+    : probation_cap_(probation_cap)
+    , prot_cap_(prot_cap)
+{
+}
+
+void BlockCache::Shard::insert(PBlock block, ReadHint hint) {
+    auto addr = block->get_addr();
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    if (entries_.count(addr) != 0) {
+        // No need to insert, addr already sits in the cache.
+        return;
+    }
+    if (hint == ReadHint::SCAN) {
+        // Scan touches the block once - park it at the cold end of the
+        // probationary segment so it's the first thing to go and can't
+        // displace blocks of the hot working set.
+        if (probation_.size() >= probation_cap_) {
+            entries_.erase(probation_.back());
+            probation_.pop_back();
+        }
+        probation_.push_back(addr);
+        entries_[addr] = { std::move(block), std::prev(probation_.end()), false };
+        return;
+    }
+    probation_.push_front(addr);
+    entries_[addr] = { std::move(block), probation_.begin(), false };
+    if (probation_.size() > probation_cap_) {
+        entries_.erase(probation_.back());
+        probation_.pop_back();
+    }
+}
+
+BlockCache::PBlock BlockCache::Shard::lookup(LogicAddr addr) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    auto it = entries_.find(addr);
+    if (it == entries_.end()) {
+        return PBlock();
+    }
+    Entry& entry = it->second;
+    if (entry.is_protected) {
+        // Move to the MRU position.
+        prot_.splice(prot_.begin(), prot_, entry.pos);
+    } else {
+        // Second hit - promote to the protected segment.
+        probation_.erase(entry.pos);
+        prot_.push_front(addr);
+        entry.pos = prot_.begin();
+        entry.is_protected = true;
+        if (prot_.size() > prot_cap_) {
+            // Demote LRU element of the protected segment instead of
+            // evicting it, it still gets a second chance.
+            auto demoted = prot_.back();
+            prot_.pop_back();
+            probation_.push_front(demoted);
+            Entry& dentry = entries_[demoted];
+            dentry.pos = probation_.begin();
+            dentry.is_protected = false;
+            if (probation_.size() > probation_cap_) {
+                entries_.erase(probation_.back());
+                probation_.pop_back();
+            }
+        }
+    }
+    return entry.block;
 }
 
 BlockCache::BlockCache(u32 Nbits)
-    : block_cache_(1 << Nbits, PBlock())
-    , bits_(Nbits)
-    , gen_(dev_())
-    , dist_(0, 1 << Nbits)
 {
+    u32 capacity = std::max(1u << Nbits, static_cast<u32>(NSHARDS)) / NSHARDS;
+    // Probationary segment is kept small so one-shot blocks of the
+    // sequential scan are recycled quickly.
+    u32 probation_cap = std::max(capacity / 4, 1u);
+    u32 prot_cap = std::max(capacity - probation_cap, 1u);
+    for (int i = 0; i < NSHARDS; i++) {
+        shards_.emplace_back(new Shard(probation_cap, prot_cap));
+    }
+}
+
+void BlockCache::insert(PBlock block, ReadHint hint) {
+    auto shard = hash(block->get_addr(), NSHARD_BITS);
+    shards_.at(shard)->insert(std::move(block), hint);
+}
+
+BlockCache::PBlock BlockCache::lookup(LogicAddr addr) {
+    auto shard = hash(addr, NSHARD_BITS);
+    return shards_.at(shard)->lookup(addr);
 }
 
-int BlockCache::probe(LogicAddr addr) {
-    auto h = hash(addr, bits_);
-    auto b = block_cache_.at(h);
-    if (b) {
-        return b->get_addr() == addr ? 2 : 1;
+void BlockCache::Shard::get_addresses(std::vector<LogicAddr>* dest) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    // Coldest first - probationary LRU to MRU, then protected LRU to MRU.
+    for (auto it = probation_.rbegin(); it != probation_.rend(); it++) {
+        dest->push_back(*it);
+    }
+    for (auto it = prot_.rbegin(); it != prot_.rend(); it++) {
+        dest->push_back(*it);
     }
-    return 0;
 }
 
-void BlockCache::insert(PBlock block) {
-    auto addr = block->get_addr();
-    auto pr = probe(addr);
-    if (pr == 2) {
-        // No need to insert, addr already sits in the cache.
-        return;
+std::vector<LogicAddr> BlockCache::get_addresses() {
+    std::vector<LogicAddr> result;
+    for (auto& shard: shards_) {
+        shard->get_addresses(&result);
     }
-    if (pr == 0) {
-        // Eviction. Generate two random hashes. Evict least accessed.
-        auto h1 = dist_(gen_);
-        auto h2 = dist_(gen_);
-        auto p1 = block_cache_.at(h1);
-        auto p2 = block_cache_.at(h2);
-        if (p1 && p2) {
-            if (p1.use_count() > p2.use_count()) {
-                block_cache_.at(h2).reset();
-            } else if (p1.use_count() < p2.use_count()) {
-                block_cache_.at(h1).reset();
-            } else {
-                if (p1->get_addr() < p2->get_addr()) {
-                    block_cache_.at(h1).reset();
-                } else {
-                    block_cache_.at(h2).reset();
+    return result;
+}
+
+void BlockCache::Shard::clear() {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    entries_.clear();
+    probation_.clear();
+    prot_.clear();
+}
+
+void BlockCache::clear() {
+    for (auto& shard: shards_) {
+        shard->clear();
+    }
+}
+
+
+aku_Status BlockStore::verify_checksum(std::shared_ptr<Block> block, u32 expected, u32 offset, u32 size) {
+    u32 crc = checksum(block->get_data() + offset, size);
+    return crc == expected ? AKU_SUCCESS : AKU_EBAD_DATA;
+}
+
+aku_Status BlockStore::verification_status() const {
+    return AKU_SUCCESS;
+}
+
+void BlockStore::prefetch_block(LogicAddr) {
+    // no-op
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> BlockStore::read_block(LogicAddr addr, ReadHint hint) {
+    AKU_UNUSED(hint);
+    return read_block(addr);
+}
+
+void BlockStore::set_commit_callback(CommitCallback) {
+    // no-op
+}
+
+std::tuple<aku_Status, LogicAddr> BlockStore::append_extent(std::shared_ptr<Block> data) {
+    size_t size = data->get_size();
+    if (size <= AKU_BLOCK_SIZE) {
+        return append_block(data);
+    }
+    // Generic implementation - append blocks one by one. Addresses come out
+    // consecutive on the memory resident store, file backed stores override
+    // this call to reserve the whole run in one volume.
+    aku_Status status;
+    LogicAddr first = EMPTY_ADDR;
+    LogicAddr prev  = EMPTY_ADDR;
+    for (size_t off = 0; off < size; off += AKU_BLOCK_SIZE) {
+        std::vector<u8> chunk(data->get_data() + off, data->get_data() + off + AKU_BLOCK_SIZE);
+        auto slice = std::make_shared<Block>(EMPTY_ADDR, std::move(chunk));
+        LogicAddr addr;
+        std::tie(status, addr) = append_block(slice);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, 0ull);
+        }
+        if (first == EMPTY_ADDR) {
+            first = addr;
+        } else if (addr != prev + 1) {
+            // Extent was split and can't be read back with `read_extent`
+            return std::make_tuple(AKU_EBAD_DATA, 0ull);
+        }
+        prev = addr;
+    }
+    data->set_addr(first);
+    return std::make_tuple(AKU_SUCCESS, first);
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> BlockStore::read_extent(LogicAddr addr, u32 nblocks) {
+    std::shared_ptr<Block> result;
+    if (nblocks == 1) {
+        return read_block(addr);
+    }
+    std::vector<u8> data(static_cast<size_t>(nblocks) * AKU_BLOCK_SIZE);
+    for (u32 i = 0; i < nblocks; i++) {
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = read_block(addr + i);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, result);
+        }
+        memcpy(data.data() + static_cast<size_t>(i) * AKU_BLOCK_SIZE, block->get_data(), AKU_BLOCK_SIZE);
+    }
+    result.reset(new Block(addr, std::move(data)));
+    return std::make_tuple(AKU_SUCCESS, result);
+}
+
+
+/** Background CRC verifier pool. Blocks are handed to the reader immediately
+  * while checksums are computed by the worker threads. Mismatch is logged and
+  * reported through `status` with a small delay, trading detection latency
+  * for lower read latency on cold scans.
+  */
+struct ChecksumVerifier {
+    struct Item {
+        std::shared_ptr<Block> block;
+        u32 expected;
+        u32 offset;
+        u32 size;
+    };
+
+    std::deque<Item>         queue_;
+    std::mutex               mutex_;
+    std::condition_variable  cvar_;
+    std::atomic<int>         nerrors_;
+    bool                     stop_;
+    std::vector<std::thread> workers_;
+
+    ChecksumVerifier(u32 nthreads)
+        : nerrors_{0}
+        , stop_(false)
+    {
+        for (u32 i = 0; i < nthreads; i++) {
+            workers_.emplace_back(std::thread([this]() { worker(); }));
+        }
+    }
+
+    ~ChecksumVerifier() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cvar_.notify_all();
+        for (auto& thread: workers_) {
+            thread.join();
+        }
+    }
+
+    void submit(std::shared_ptr<Block> block, u32 expected, u32 offset, u32 size) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back({ std::move(block), expected, offset, size });
+        }
+        cvar_.notify_one();
+    }
+
+    aku_Status status() const {
+        return nerrors_.load() == 0 ? AKU_SUCCESS : AKU_EBAD_DATA;
+    }
+
+    void worker() {
+        while (true) {
+            Item item;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cvar_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if (queue_.empty()) {
+                    // Stop was requested and there is nothing left to check.
+                    return;
+                }
+                item = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            u32 crc = crc32c(item.block->get_data() + item.offset, item.size);
+            if (crc != item.expected) {
+                nerrors_++;
+                Logger::msg(AKU_LOG_ERROR, "Checksum mismatch (addr: " +
+                                           std::to_string(item.block->get_addr()) + ")");
+            }
+        }
+    }
+};
+
+
+/** Readahead prefetcher. Leaf nodes are linked backward so the scan knows
+  * the address of the next block before it needs it. Iterators feed upcoming
+  * addresses here and the worker issues the reads ahead of the decode loop,
+  * disk latency overlaps with decompression instead of serializing with it.
+  * Prefetched blocks are kept in a small FIFO buffer until they're claimed.
+  */
+struct Prefetcher {
+    enum {
+        BUFFER_SIZE = 32,
+        //! Max number of reads submitted to the device at once.
+        QUEUE_DEPTH = 32,
+    };
+
+    typedef std::function<std::vector<std::tuple<aku_Status, std::shared_ptr<Block>>>(std::vector<LogicAddr> const&)> ReadFn;
+
+    ReadFn                                      read_fn_;
+    std::deque<LogicAddr>                       requests_;
+    std::map<LogicAddr, std::shared_ptr<Block>> ready_;
+    std::deque<LogicAddr>                       fifo_;
+    std::mutex                                  mutex_;
+    std::condition_variable                     cvar_;
+    //! Incremented by `clear`, used to discard stale in-flight reads.
+    u64                                         epoch_;
+    bool                                        stop_;
+    std::thread                                 worker_;
+
+    Prefetcher(ReadFn read_fn)
+        : read_fn_(read_fn)
+        , epoch_(0)
+        , stop_(false)
+        , worker_(std::thread([this]() { worker(); }))
+    {
+    }
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cvar_.notify_all();
+        worker_.join();
+    }
+
+    //! Schedule asynchronous read of the block at `addr`.
+    void submit(LogicAddr addr) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (ready_.count(addr) != 0 ||
+                std::find(requests_.begin(), requests_.end(), addr) != requests_.end()) {
+                // Already prefetched or in flight.
+                return;
+            }
+            requests_.push_back(addr);
+        }
+        cvar_.notify_one();
+    }
+
+    //! Drop all pending requests and prefetched blocks.
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests_.clear();
+        ready_.clear();
+        fifo_.clear();
+        epoch_++;
+    }
+
+    //! Return prefetched block or null if block wasn't prefetched (yet).
+    std::shared_ptr<Block> fetch(LogicAddr addr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::shared_ptr<Block> block;
+        auto it = ready_.find(addr);
+        if (it != ready_.end()) {
+            block = std::move(it->second);
+            // NOTE: stale entry in `fifo_` is harmless, erase will be a no-op.
+            ready_.erase(it);
+        }
+        return block;
+    }
+
+    void worker() {
+        while (true) {
+            std::vector<LogicAddr> batch;
+            u64 epoch;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cvar_.wait(lock, [this]() { return stop_ || !requests_.empty(); });
+                if (requests_.empty()) {
+                    // Stop was requested and there is nothing left to read.
+                    return;
+                }
+                while (!requests_.empty() && batch.size() < QUEUE_DEPTH) {
+                    batch.push_back(requests_.front());
+                    requests_.pop_front();
                 }
+                epoch = epoch_;
+            }
+            auto results = read_fn_(batch);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (epoch != epoch_) {
+                // Cache was invalidated while the reads were in flight.
+                continue;
+            }
+            for (size_t i = 0; i < batch.size(); i++) {
+                aku_Status status;
+                std::shared_ptr<Block> block;
+                std::tie(status, block) = results.at(i);
+                if (status != AKU_SUCCESS) {
+                    // Reader will rediscover the error through the normal path.
+                    continue;
+                }
+                ready_[batch.at(i)] = std::move(block);
+                fifo_.push_back(batch.at(i));
+            }
+            while (fifo_.size() > BUFFER_SIZE) {
+                ready_.erase(fifo_.front());
+                fifo_.pop_front();
             }
         }
     }
-    auto h = hash(addr, bits_);
-    block_cache_.at(h) = block;
+};
+
+
+BlockPool::~BlockPool() {
+    for (auto slab: slabs_) {
+        free(slab);
+    }
 }
 
-BlockCache::PBlock BlockCache::loockup(LogicAddr addr) {
-    auto it = hash(addr, bits_);
-    auto p = block_cache_.at(it);
-    if (p->get_addr() != addr) {
-        p.reset();
+u8* BlockPool::allocate() {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    if (free_list_.empty()) {
+        // Carve new slab into block-sized buffers
+        void* mem = nullptr;
+        if (posix_memalign(&mem, AKU_BLOCK_SIZE, SLAB_NBLOCKS*AKU_BLOCK_SIZE) != 0) {
+            AKU_PANIC("Can't allocate block slab");
+        }
+        memset(mem, 0, SLAB_NBLOCKS*AKU_BLOCK_SIZE);
+        auto slab = static_cast<u8*>(mem);
+        slabs_.push_back(slab);
+        for (int i = 0; i < SLAB_NBLOCKS; i++) {
+            free_list_.push_back(slab + i*AKU_BLOCK_SIZE);
+        }
     }
-    return p;
+    u8* buf = free_list_.back();
+    free_list_.pop_back();
+    return buf;
+}
+
+void BlockPool::release(u8* buf) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    free_list_.push_back(buf);
 }
 
+std::shared_ptr<Block> BlockPool::make_block(LogicAddr addr) {
+    return std::make_shared<Block>(shared_from_this(), allocate(), addr);
+}
 
 Block::Block(LogicAddr addr, std::vector<u8>&& data)
     : data_(std::move(data))
+    , aligned_data_(nullptr)
+    , mmap_ptr_(nullptr)
+    , addr_(addr)
+{
+}
+
+Block::Block(std::shared_ptr<BlockPool> pool, u8* buf, LogicAddr addr)
+    : pool_(std::move(pool))
+    , aligned_data_(buf)
+    , mmap_ptr_(nullptr)
+    , addr_(addr)
+{
+}
+
+Block::Block(u8* ptr, LogicAddr addr)
+    : aligned_data_(nullptr)
+    , mmap_ptr_(ptr)
     , addr_(addr)
 {
 }
 
 Block::Block()
     : data_(static_cast<size_t>(AKU_BLOCK_SIZE), 0)
+    , aligned_data_(nullptr)
+    , mmap_ptr_(nullptr)
     , addr_(EMPTY_ADDR)
 {
 }
 
+Block::~Block() {
+    if (pool_) {
+        pool_->release(aligned_data_);
+    }
+}
+
 const u8* Block::get_data() const {
-    return data_.data();
+    if (mmap_ptr_) {
+        return mmap_ptr_;
+    }
+    return aligned_data_ ? aligned_data_ : data_.data();
 }
 
 u8* Block::get_data() {
-    return data_.data();
+    if (mmap_ptr_) {
+        return mmap_ptr_;
+    }
+    return aligned_data_ ? aligned_data_ : data_.data();
 }
 
 size_t Block::get_size() const {
+    if (mmap_ptr_ || aligned_data_) {
+        return static_cast<size_t>(AKU_BLOCK_SIZE);
+    }
     return data_.size();
 }
 
@@ -129,12 +552,31 @@ void Block::set_addr(LogicAddr addr) {
     addr_ = addr;
 }
 
-FixedSizeFileStorage::FixedSizeFileStorage(std::string metapath, std::vector<std::string> volpaths)
+FixedSizeFileStorage::FixedSizeFileStorage(std::string metapath, std::vector<std::string> volpaths,
+                                           u32 verifier_threads, bool direct_io, u32 stripe_width,
+                                           bool dedup)
     : meta_(MetaVolume::open_existing(metapath.c_str()))
     , current_volume_(0)
     , current_gen_(0)
+    , stripe_width_(std::max(1u, std::min(stripe_width, static_cast<u32>(volpaths.size()))))
+    , stripe_counter_(0)
     , total_size_(0)
+    , warmup_stop_(false)
+    , scrub_stop_(false)
+    , scrub_scanned_(0)
+    , scrub_errors_(0)
+    , scrub_passes_(0)
+    , dedup_enabled_(dedup)
+    , dedup_hits_(0)
 {
+    if (verifier_threads) {
+        verifier_.reset(new ChecksumVerifier(verifier_threads));
+    }
+    pool_ = std::make_shared<BlockPool>();
+    prefetcher_.reset(new Prefetcher([this](std::vector<LogicAddr> const& addrs) {
+        return do_read_blocks(addrs);
+    }));
+    cache_.reset(new BlockCache(10));  // 2^10 blocks, 4MB
     for (u32 ix = 0ul; ix < volpaths.size(); ix++) {
         auto volpath = volpaths.at(ix);
         u32 nblocks = 0;
@@ -146,9 +588,10 @@ FixedSizeFileStorage::FixedSizeFileStorage(std::string metapath, std::vector<std
                                                    StatusUtil::str(status)));
             AKU_PANIC("Can't open blockstore - " + StatusUtil::str(status));
         }
-        auto uptr = Volume::open_existing(volpath.c_str(), nblocks);
+        auto uptr = Volume::open_existing(volpath.c_str(), nblocks, direct_io);
         volumes_.push_back(std::move(uptr));
         dirty_.push_back(0);
+        demoted_.push_back(0);
     }
 
     for (const auto& vol: volumes_) {
@@ -176,8 +619,18 @@ FixedSizeFileStorage::FixedSizeFileStorage(std::string metapath, std::vector<std
     }
 }
 
-std::shared_ptr<FixedSizeFileStorage> FixedSizeFileStorage::open(std::string metapath, std::vector<std::string> volpaths) {
-    auto bs = new FixedSizeFileStorage(metapath, volpaths);
+FixedSizeFileStorage::~FixedSizeFileStorage() {
+    // Stop background readers before volumes are closed.
+    warmup_stop_ = true;
+    if (warmup_thread_.joinable()) {
+        warmup_thread_.join();
+    }
+    stop_scrub();
+    prefetcher_.reset();
+}
+
+std::shared_ptr<FixedSizeFileStorage> FixedSizeFileStorage::open(std::string metapath, std::vector<std::string> volpaths, u32 verifier_threads, bool direct_io, u32 stripe_width, bool dedup) {
+    auto bs = new FixedSizeFileStorage(metapath, volpaths, verifier_threads, direct_io, stripe_width, dedup);
     return std::shared_ptr<FixedSizeFileStorage>(bs);
 }
 
@@ -225,7 +678,445 @@ bool FixedSizeFileStorage::exists(LogicAddr addr) const {
     return actual_gen == gen && vol < nblocks;
 }
 
+//! Measures cache hits and misses alike - the distribution shows both
+static LatencyHistogram g_read_latency("blockstore_read_block");
+
 std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(LogicAddr addr) {
+    return read_block(addr, ReadHint::LOOKUP);
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(LogicAddr addr, ReadHint hint) {
+    LatencyTimer timer(g_read_latency);
+    // NOTE: generation is part of the logic address so cache entries of the
+    // recycled volumes can't be returned, they're simply never requested.
+    auto block = cache_->lookup(addr);
+    if (block) {
+        return std::make_tuple(AKU_SUCCESS, std::move(block));
+    }
+    if (hint == ReadHint::SCAN) {
+        // Backward scan over a leaf chain - the preceding blocks are the
+        // likely next reads, queue them for the prefetcher so the disk
+        // access overlaps with decompression of this block.
+        auto gen = extract_gen(addr);
+        auto vol = extract_vol(addr);
+        for (u32 i = 1; i <= SCAN_READAHEAD_DEPTH && i <= vol; i++) {
+            prefetcher_->submit(make_logic(gen, vol - i));
+        }
+    }
+    block = prefetcher_->fetch(addr);
+    if (!block) {
+        aku_Status status;
+        std::tie(status, block) = do_read_block(addr);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, std::move(block));
+        }
+    }
+    cache_->insert(block, hint);
+    return std::make_tuple(AKU_SUCCESS, std::move(block));
+}
+
+void FixedSizeFileStorage::prefetch_block(LogicAddr addr) {
+    prefetcher_->submit(addr);
+}
+
+std::vector<VolumeSnapshot> FixedSizeFileStorage::create_snapshot() {
+    std::lock_guard<std::mutex> guard(lock_);
+    std::vector<VolumeSnapshot> result;
+    for (u32 id = 0; id < static_cast<u32>(volumes_.size()); id++) {
+        aku_Status status;
+        u32 gen, nblocks;
+        std::tie(status, gen) = meta_->get_generation(id);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Metadata corrupted, " + StatusUtil::str(status));
+        }
+        std::tie(status, nblocks) = meta_->get_nblocks(id);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Metadata corrupted, " + StatusUtil::str(status));
+        }
+        if (nblocks == 0) {
+            continue;
+        }
+        result.push_back({ id, gen, nblocks });
+    }
+    return result;
+}
+
+aku_Status FixedSizeFileStorage::read_snapshot(VolumeSnapshot const& snap, u32 offset, u32 nblocks, u8* dest) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (snap.id >= volumes_.size()) {
+        return AKU_EBAD_ARG;
+    }
+    aku_Status status;
+    u32 actual_gen;
+    std::tie(status, actual_gen) = meta_->get_generation(snap.id);
+    if (status != AKU_SUCCESS || actual_gen != snap.generation) {
+        // Volume was recycled, snapshot range is gone.
+        return AKU_EBAD_ARG;
+    }
+    if (offset + nblocks > snap.nblocks || offset + nblocks < offset) {
+        return AKU_EBAD_ARG;
+    }
+    if (demoted_.at(snap.id)) {
+        return cold_->read_range(snap.id, snap.generation,
+                                 static_cast<u64>(offset) * AKU_BLOCK_SIZE,
+                                 static_cast<u64>(nblocks) * AKU_BLOCK_SIZE, dest);
+    }
+    return volumes_[snap.id]->read_blocks(offset, nblocks, dest);
+}
+
+void FixedSizeFileStorage::set_cold_storage(std::shared_ptr<ColdStorage> cold) {
+    std::lock_guard<std::mutex> guard(lock_);
+    cold_ = cold;
+}
+
+aku_Status FixedSizeFileStorage::demote_volume(u32 id) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!cold_ || id >= volumes_.size()) {
+        return AKU_EBAD_ARG;
+    }
+    if (id == current_volume_ || demoted_.at(id)) {
+        // Only sealed volumes can be demoted
+        return AKU_EBAD_ARG;
+    }
+    aku_Status status;
+    u32 gen, nblocks;
+    std::tie(status, gen) = meta_->get_generation(id);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    std::tie(status, nblocks) = meta_->get_nblocks(id);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    if (nblocks == 0) {
+        return AKU_ENO_DATA;
+    }
+    // Upload in fixed size parts so a multi-GB volume is never buffered
+    // whole. NOTE: reads are blocked for the duration of the upload, the
+    // caller is expected to demote during off-peak hours.
+    std::vector<u8> part(DEMOTE_CHUNK_NBLOCKS * AKU_BLOCK_SIZE);
+    for (u32 ix = 0; ix < nblocks; ix += DEMOTE_CHUNK_NBLOCKS) {
+        u32 count = std::min(static_cast<u32>(DEMOTE_CHUNK_NBLOCKS), nblocks - ix);
+        status = volumes_[id]->read_blocks(ix, count, part.data());
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        status = cold_->write_part(id, gen, static_cast<u64>(ix) * AKU_BLOCK_SIZE,
+                                   part.data(), static_cast<u64>(count) * AKU_BLOCK_SIZE);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    status = cold_->seal(id, gen);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    // Reads go through the cold tier from now on, the local space can be
+    // returned to the file system.
+    demoted_.at(id) = 1;
+    volumes_[id]->evict();
+    Logger::msg(AKU_LOG_INFO, "Volume " + std::to_string(id) + " gen " +
+                std::to_string(gen) + " demoted to cold storage");
+    return AKU_SUCCESS;
+}
+
+//! Magic at the start of the cache state file.
+static const u32 CACHE_STATE_MAGIC = 0x43554B41;
+
+aku_Status FixedSizeFileStorage::save_cache_state(const char* path) {
+    auto addrs = cache_->get_addresses();
+    apr_pool_t* pool;
+    apr_status_t status = apr_pool_create(&pool, nullptr);
+    if (status != APR_SUCCESS) {
+        AKU_PANIC("Can't create APR pool");
+    }
+    apr_file_t* file;
+    status = apr_file_open(&file, path, APR_WRITE|APR_CREATE|APR_TRUNCATE|APR_BINARY,
+                           APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't open cache state file");
+        apr_pool_destroy(pool);
+        return AKU_EGENERAL;
+    }
+    u32 header[2] = { CACHE_STATE_MAGIC, static_cast<u32>(addrs.size()) };
+    status = apr_file_write_full(file, header, sizeof(header), NULL);
+    if (status == APR_SUCCESS && !addrs.empty()) {
+        status = apr_file_write_full(file, addrs.data(), addrs.size()*sizeof(LogicAddr), NULL);
+    }
+    apr_file_close(file);
+    apr_pool_destroy(pool);
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't write cache state file");
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status FixedSizeFileStorage::warmup_cache(const char* path) {
+    apr_pool_t* pool;
+    apr_status_t status = apr_pool_create(&pool, nullptr);
+    if (status != APR_SUCCESS) {
+        AKU_PANIC("Can't create APR pool");
+    }
+    apr_file_t* file;
+    status = apr_file_open(&file, path, APR_READ|APR_BINARY, APR_OS_DEFAULT, pool);
+    if (APR_STATUS_IS_ENOENT(status)) {
+        // Cold start - nothing to warm up.
+        apr_pool_destroy(pool);
+        return AKU_SUCCESS;
+    }
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't open cache state file");
+        apr_pool_destroy(pool);
+        return AKU_EGENERAL;
+    }
+    u32 header[2];
+    status = apr_file_read_full(file, header, sizeof(header), NULL);
+    if (status != APR_SUCCESS || header[0] != CACHE_STATE_MAGIC || header[1] > total_size_) {
+        Logger::msg(AKU_LOG_ERROR, "Cache state file corrupted, skipping warmup");
+        apr_file_close(file);
+        apr_pool_destroy(pool);
+        return AKU_EBAD_DATA;
+    }
+    std::vector<LogicAddr> addrs(header[1]);
+    if (!addrs.empty()) {
+        status = apr_file_read_full(file, addrs.data(), addrs.size()*sizeof(LogicAddr), NULL);
+    }
+    apr_file_close(file);
+    apr_pool_destroy(pool);
+    if (status != APR_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Cache state file truncated, skipping warmup");
+        return AKU_EBAD_DATA;
+    }
+    // Addresses of the volumes recycled since the state was saved are
+    // dropped here, the rest is loaded by the background thread.
+    std::vector<LogicAddr> todo;
+    for (auto addr: addrs) {
+        if (exists(addr)) {
+            todo.push_back(addr);
+        }
+    }
+    if (todo.empty()) {
+        return AKU_SUCCESS;
+    }
+    if (warmup_thread_.joinable()) {
+        // Warmup is already running.
+        return AKU_EBAD_ARG;
+    }
+    warmup_thread_ = std::thread([this, todo]() { warmup_worker_(todo); });
+    return AKU_SUCCESS;
+}
+
+void FixedSizeFileStorage::warmup_worker_(std::vector<LogicAddr> addrs) {
+    size_t loaded = 0;
+    for (size_t i = 0; i < addrs.size() && !warmup_stop_.load(); i += WARMUP_BATCH_NBLOCKS) {
+        auto end = std::min(addrs.size(), i + WARMUP_BATCH_NBLOCKS);
+        std::vector<LogicAddr> batch(addrs.begin() + static_cast<ssize_t>(i),
+                                     addrs.begin() + static_cast<ssize_t>(end));
+        auto results = do_read_blocks(batch);
+        for (auto& res: results) {
+            aku_Status status;
+            std::shared_ptr<Block> block;
+            std::tie(status, block) = res;
+            if (status == AKU_SUCCESS) {
+                cache_->insert(std::move(block));
+                loaded++;
+            }
+        }
+        // Small batches with pauses in between keep the device queue
+        // short so foreground reads don't wait behind the warmup i/o.
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    Logger::msg(AKU_LOG_INFO, "Cache warmup done, " + std::to_string(loaded) + " blocks loaded");
+}
+
+/** Tail of the common block header written by the NB+tree (field for field
+  * the end of `SubtreeRef`, see nbtree.h). Every committed block carries its
+  * own payload size and checksum there, which is all the scrubber needs to
+  * verify a block standalone - the aggregates at the front are skipped so
+  * the blockstore doesn't grow a dependency on the tree layer.
+  */
+struct ScrubHeader {
+    u8  aggregates[64];  //< count .. sum (see SubtreeRef)
+    u16 version;
+    u16 level;
+    u16 payload_size;
+    u16 fanout_index;
+    u32 checksum;
+} __attribute__((packed));
+
+aku_Status FixedSizeFileStorage::start_scrub(u32 mb_per_sec) {
+    if (scrub_thread_.joinable()) {
+        return AKU_EBUSY;
+    }
+    scrub_stop_ = false;
+    scrub_thread_ = std::thread([this, mb_per_sec]() { scrub_worker_(mb_per_sec); });
+    return AKU_SUCCESS;
+}
+
+void FixedSizeFileStorage::stop_scrub() {
+    scrub_stop_ = true;
+    if (scrub_thread_.joinable()) {
+        scrub_thread_.join();
+    }
+}
+
+std::tuple<aku_Status, u32> FixedSizeFileStorage::drop_partition(aku_Timestamp boundary) {
+    std::lock_guard<std::mutex> guard(lock_);
+    u32 dropped = 0;
+    for (u32 volix = 0; volix < volumes_.size(); volix++) {
+        // Volumes of the active stripe are still being written
+        bool active = false;
+        for (u32 i = 0; i < stripe_width_; i++) {
+            if ((current_volume_ + i) % volumes_.size() == volix) {
+                active = true;
+            }
+        }
+        if (active) {
+            continue;
+        }
+        aku_Status status;
+        u32 nblocks;
+        std::tie(status, nblocks) = meta_->get_nblocks(volix);
+        if (status != AKU_SUCCESS || nblocks == 0) {
+            continue;
+        }
+        aku_Timestamp begin, end;
+        std::tie(status, begin, end) = meta_->get_time_span(volix);
+        if (status != AKU_SUCCESS || end >= boundary) {
+            // A volume with an unknown span is never dropped
+            continue;
+        }
+        u32 gen;
+        std::tie(status, gen) = meta_->get_generation(volix);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, dropped);
+        }
+        // Recycle the volume in place, same sequence `advance_volume` runs
+        // on wraparound - the generation bump kills all addresses inside
+        if (demoted_.at(volix)) {
+            cold_->remove(volix, gen);
+            demoted_.at(volix) = 0;
+        }
+        gen += static_cast<u32>(volumes_.size());
+        status = meta_->set_generation(volix, gen);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Invalid BlockStore state, can't reset volume's generation, " + StatusUtil::str(status));
+        }
+        status = meta_->set_nblocks(volix, 0);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Invalid BlockStore state, can't reset volume's nblocks, " + StatusUtil::str(status));
+        }
+        meta_->clear_time_span(volix);
+        volumes_[volix]->reset();
+        dirty_[volix]++;
+        if (dedup_enabled_) {
+            // Index entries of the dropped volume are dead
+            for (auto it = dedup_index_.begin(); it != dedup_index_.end();) {
+                if (extract_gen(it->second) % volumes_.size() == volix) {
+                    dedup_refs_.erase(it->second);
+                    it = dedup_index_.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+        Logger::msg(AKU_LOG_INFO, "Retention dropped volume " + std::to_string(volix) +
+                                  ", span [" + std::to_string(begin) + ", " + std::to_string(end) + "]");
+        dropped++;
+    }
+    if (dropped != 0) {
+        // Dropped blocks shouldn't be readable anymore
+        cache_->clear();
+        prefetcher_->clear();
+        meta_->flush();
+    }
+    return std::make_tuple(AKU_SUCCESS, dropped);
+}
+
+FixedSizeFileStorage::ScrubStats FixedSizeFileStorage::get_scrub_stats() const {
+    ScrubStats stats;
+    stats.blocks_scanned  = scrub_scanned_.load(std::memory_order_relaxed);
+    stats.errors_found    = scrub_errors_.load(std::memory_order_relaxed);
+    stats.passes_complete = scrub_passes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FixedSizeFileStorage::scrub_worker_(u32 mb_per_sec) {
+    const u64 budget_bps = static_cast<u64>(mb_per_sec) * 1024 * 1024;
+    while (!scrub_stop_.load()) {
+        // Frozen ranges only - blocks past the snapshot are still being
+        // written and the reads below fail cleanly if a volume is recycled.
+        auto snapshot = create_snapshot();
+        auto pass_begin = std::chrono::steady_clock::now();
+        u64 bytes_read = 0;
+        for (auto const& snap: snapshot) {
+            std::vector<u8> buf(AKU_BLOCK_SIZE);
+            u32 offset = 0;
+            while (offset < snap.nblocks && !scrub_stop_.load()) {
+                buf.resize(AKU_BLOCK_SIZE);
+                if (read_snapshot(snap, offset, 1, buf.data()) != AKU_SUCCESS) {
+                    // Volume was recycled since the snapshot, move on.
+                    break;
+                }
+                auto hdr = reinterpret_cast<ScrubHeader const*>(buf.data());
+                u32 span = 1;
+                size_t nbytes = sizeof(ScrubHeader) + hdr->payload_size;
+                if (nbytes > AKU_BLOCK_SIZE) {
+                    // Multi-block payload (large leaf), verified as a whole.
+                    span = static_cast<u32>((nbytes + AKU_BLOCK_SIZE - 1) / AKU_BLOCK_SIZE);
+                    if (offset + span > snap.nblocks) {
+                        // Damaged header sends the payload out of bounds.
+                        scrub_errors_.fetch_add(1, std::memory_order_relaxed);
+                        Logger::msg(AKU_LOG_ERROR, "Scrub: bad payload size at addr " +
+                                    std::to_string(make_logic(snap.generation, offset)));
+                        scrub_scanned_.fetch_add(1, std::memory_order_relaxed);
+                        offset++;
+                        continue;
+                    }
+                    buf.resize(static_cast<size_t>(span) * AKU_BLOCK_SIZE);
+                    if (read_snapshot(snap, offset, span, buf.data()) != AKU_SUCCESS) {
+                        break;
+                    }
+                    hdr = reinterpret_cast<ScrubHeader const*>(buf.data());
+                }
+                u32 crc = checksum(buf.data() + sizeof(ScrubHeader), hdr->payload_size);
+                if (crc != hdr->checksum) {
+                    scrub_errors_.fetch_add(1, std::memory_order_relaxed);
+                    Logger::msg(AKU_LOG_ERROR, "Scrub: checksum mismatch at addr " +
+                                std::to_string(make_logic(snap.generation, offset)));
+                }
+                scrub_scanned_.fetch_add(span, std::memory_order_relaxed);
+                offset     += span;
+                bytes_read += static_cast<u64>(span) * AKU_BLOCK_SIZE;
+                if (budget_bps != 0) {
+                    // Pace the pass to the byte budget so scrub reads never
+                    // queue in front of foreground i/o (same throttling idea
+                    // as the compaction batches).
+                    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::steady_clock::now() - pass_begin).count();
+                    auto target_us  = static_cast<i64>(bytes_read * 1000000 / budget_bps);
+                    if (target_us > elapsed_us) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(target_us - elapsed_us));
+                    }
+                }
+            }
+        }
+        if (scrub_stop_.load()) {
+            break;
+        }
+        scrub_passes_.fetch_add(1, std::memory_order_relaxed);
+        Logger::msg(AKU_LOG_INFO, "Scrub pass done, " +
+                    std::to_string(scrub_scanned_.load()) + " blocks scanned, " +
+                    std::to_string(scrub_errors_.load()) + " errors found");
+        for (int i = 0; i < SCRUB_PASS_PAUSE_SEC * 10 && !scrub_stop_.load(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::do_read_block(LogicAddr addr) {
+    std::lock_guard<std::mutex> guard(lock_);
     aku_Status status;
     auto gen = extract_gen(addr);
     auto vol = extract_vol(addr);
@@ -243,16 +1134,91 @@ std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(
     if (actual_gen != gen || vol >= nblocks) {
         return std::make_tuple(AKU_EBAD_ARG, std::unique_ptr<Block>());
     }
-    std::vector<u8> dest(AKU_BLOCK_SIZE, 0);
-    status = volumes_[volix]->read_block(vol, dest.data());
+    // All read buffers come from the aligned slab pool (required for
+    // O_DIRECT, avoids an allocation per read otherwise).
+    std::shared_ptr<Block> block = pool_->make_block(addr);
+    if (demoted_.at(volix)) {
+        // Volume content lives in the cold tier, fetch just this block
+        status = cold_->read_range(volix, gen, static_cast<u64>(vol) * AKU_BLOCK_SIZE,
+                                   AKU_BLOCK_SIZE, block->get_data());
+    } else {
+        status = volumes_[volix]->read_block(vol, block->get_data());
+    }
     if (status != AKU_SUCCESS) {
         return std::make_tuple(status, std::unique_ptr<Block>());
     }
-    auto self = shared_from_this();
-    auto block = std::make_shared<Block>(addr, std::move(dest));
     return std::make_tuple(status, std::move(block));
 }
 
+std::vector<std::tuple<aku_Status, std::shared_ptr<Block>>> FixedSizeFileStorage::do_read_blocks(std::vector<LogicAddr> const& addrs) {
+    typedef std::tuple<aku_Status, std::shared_ptr<Block>> ResultT;
+    std::vector<ResultT> results(addrs.size(), std::make_tuple(AKU_EBAD_ARG, std::shared_ptr<Block>()));
+    std::vector<std::shared_ptr<Block>> dests(addrs.size());
+    std::vector<aiocb> cbs(addrs.size());
+    std::vector<aiocb*> iolist;
+    std::vector<size_t> ixlist;
+    {
+        // Translate addresses under the lock, submit reads without it
+        // (positioned reads don't touch the file offset).
+        std::lock_guard<std::mutex> guard(lock_);
+        for (size_t i = 0; i < addrs.size(); i++) {
+            aku_Status status;
+            auto addr = addrs.at(i);
+            auto gen = extract_gen(addr);
+            auto vol = extract_vol(addr);
+            auto volix = gen % static_cast<u32>(volumes_.size());
+            u32 actual_gen;
+            u32 nblocks;
+            std::tie(status, actual_gen) = meta_->get_generation(volix);
+            if (status != AKU_SUCCESS) {
+                continue;
+            }
+            std::tie(status, nblocks) = meta_->get_nblocks(volix);
+            if (status != AKU_SUCCESS) {
+                continue;
+            }
+            // Compare with `get_flushed_pos` - blocks that are still in the
+            // write-behind buffer can't be read asynchronously (sync path
+            // serves them from memory). Demoted volumes are served by the
+            // sync path too (cold tier fetch instead of local aio).
+            if (actual_gen != gen || vol >= nblocks || vol >= volumes_[volix]->get_flushed_pos() ||
+                demoted_.at(volix)) {
+                continue;
+            }
+            dests.at(i) = pool_->make_block(addr);
+            aiocb& cb = cbs.at(i);
+            memset(&cb, 0, sizeof(cb));
+            cb.aio_fildes     = volumes_[volix]->get_fd();
+            cb.aio_offset     = static_cast<off_t>(vol) * AKU_BLOCK_SIZE;
+            cb.aio_buf        = dests.at(i)->get_data();
+            cb.aio_nbytes     = AKU_BLOCK_SIZE;
+            cb.aio_lio_opcode = LIO_READ;
+            iolist.push_back(&cb);
+            ixlist.push_back(i);
+        }
+    }
+    if (iolist.empty()) {
+        return results;
+    }
+    int retcode = lio_listio(LIO_WAIT, iolist.data(), static_cast<int>(iolist.size()), nullptr);
+    if (retcode != 0 && errno != EIO && errno != EAGAIN && errno != EINTR) {
+        Logger::msg(AKU_LOG_ERROR, "Async read failed: " + std::to_string(errno));
+        for (auto i: ixlist) {
+            results.at(i) = std::make_tuple(AKU_EGENERAL, std::shared_ptr<Block>());
+        }
+        return results;
+    }
+    for (auto i: ixlist) {
+        auto nbytes = aio_return(&cbs.at(i));
+        if (nbytes != AKU_BLOCK_SIZE) {
+            results.at(i) = std::make_tuple(AKU_EGENERAL, std::shared_ptr<Block>());
+            continue;
+        }
+        results.at(i) = std::make_tuple(AKU_SUCCESS, std::move(dests.at(i)));
+    }
+    return results;
+}
+
 void FixedSizeFileStorage::advance_volume() {
     Logger::msg(AKU_LOG_INFO, "Advance volume called, current gen:" + std::to_string(current_gen_));
     current_volume_ = (current_volume_ + 1) % volumes_.size();
@@ -270,6 +1236,11 @@ void FixedSizeFileStorage::advance_volume() {
         AKU_PANIC("Can't read nblocks of the next volume, " + StatusUtil::str(status));
     }
     if (nblocks != 0) {
+        if (demoted_.at(current_volume_)) {
+            // The address range is dead, the cold object goes with it
+            cold_->remove(current_volume_, current_gen_);
+            demoted_.at(current_volume_) = 0;
+        }
         current_gen_ += volumes_.size();
         auto status = meta_->set_generation(current_volume_, current_gen_);
         if (status != AKU_SUCCESS) {
@@ -282,49 +1253,509 @@ void FixedSizeFileStorage::advance_volume() {
             Logger::msg(AKU_LOG_ERROR, "Can't reset nblocks on volume, " + StatusUtil::str(status));
             AKU_PANIC("Invalid BlockStore state, can't reset volume's nblocks, " + StatusUtil::str(status));
         }
+        meta_->clear_time_span(current_volume_);
         volumes_[current_volume_]->reset();
         dirty_[current_volume_]++;
+        // Recycled blocks shouldn't be readable anymore.
+        cache_->clear();
+        prefetcher_->clear();
+        if (dedup_enabled_) {
+            // Index entries of the recycled volume are dead
+            for (auto it = dedup_index_.begin(); it != dedup_index_.end();) {
+                if (extract_gen(it->second) % volumes_.size() == current_volume_) {
+                    dedup_refs_.erase(it->second);
+                    it = dedup_index_.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+    }
+}
+
+void FixedSizeFileStorage::note_block_span_(u32 volix, const u8* data) {
+    // Committed blocks start with a SubtreeRef so the timestamp range of
+    // the payload sits at a fixed offset of the header (the same layout
+    // contract the scrubber relies on, see ScrubHeader). The span makes
+    // the volume a retention partition - see `drop_partition`.
+    u64 begin;
+    u64 end;
+    memcpy(&begin, data + 16, sizeof(begin));
+    memcpy(&end,   data + 24, sizeof(end));
+    if (begin > end) {
+        // Not a subtree header (foreign payload), the span stays unknown
+        // and the volume is never dropped by retention
+        return;
     }
+    meta_->extend_time_span(volix, begin, end);
+}
+
+std::tuple<aku_Status, LogicAddr> FixedSizeFileStorage::append_block_striped_(std::shared_ptr<Block> data) {
+    // The stripe is the window of `stripe_width_` volumes starting at
+    // `current_volume_`. Appends rotate through the window so the devices
+    // receive the blocks in parallel, when the whole window is full it
+    // moves to the next group of volumes.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool overflow = false;
+        for (u32 i = 0; i < stripe_width_; i++) {
+            u32 volix = (current_volume_ + (stripe_counter_ + i) % stripe_width_)
+                      % static_cast<u32>(volumes_.size());
+            aku_Status status;
+            BlockAddr block_addr;
+            std::tie(status, block_addr) = volumes_[volix]->append_block(data->get_data());
+            if (status == AKU_EOVERFLOW) {
+                overflow = true;
+                continue;
+            } else if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0ull);
+            }
+            stripe_counter_ += i + 1;
+            u32 gen;
+            std::tie(status, gen) = meta_->get_generation(volix);
+            if (status != AKU_SUCCESS) {
+                AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+            }
+            data->set_addr(block_addr);
+            status = meta_->set_nblocks(volix, block_addr + 1);
+            if (status != AKU_SUCCESS) {
+                AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+            }
+            note_block_span_(volix, data->get_data());
+            dirty_[volix]++;
+            if (commit_cb_) {
+                commit_cb_(make_logic(gen, block_addr), data);
+            }
+            return std::make_tuple(AKU_SUCCESS, make_logic(gen, block_addr));
+        }
+        if (overflow) {
+            // Whole stripe is full - recycle the next group of volumes
+            for (u32 i = 0; i < stripe_width_; i++) {
+                advance_volume();
+            }
+        }
+    }
+    return std::make_tuple(AKU_EOVERFLOW, 0ull);
+}
+
+std::tuple<bool, LogicAddr> FixedSizeFileStorage::dedup_find_(std::shared_ptr<Block> data, u32* hash) {
+    *hash = crc32c(data->get_data(), data->get_size());
+    auto it = dedup_index_.find(*hash);
+    if (it == dedup_index_.end()) {
+        return std::make_tuple(false, 0ull);
+    }
+    LogicAddr candidate = it->second;
+    auto gen = extract_gen(candidate);
+    auto vol = extract_vol(candidate);
+    auto volix = gen % static_cast<u32>(volumes_.size());
+    if (!exists(candidate)) {
+        // The volume was recycled, the entry is stale
+        dedup_refs_.erase(candidate);
+        dedup_index_.erase(it);
+        return std::make_tuple(false, 0ull);
+    }
+    if (demoted_.at(volix)) {
+        // Candidate lives in the cold tier, verification would stall the
+        // write path - treat it as a miss
+        return std::make_tuple(false, 0ull);
+    }
+    std::shared_ptr<Block> block = pool_->make_block(candidate);
+    aku_Status status = volumes_[volix]->read_block(vol, block->get_data());
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(false, 0ull);
+    }
+    if (block->get_size() != data->get_size() ||
+        memcmp(block->get_data(), data->get_data(), data->get_size()) != 0)
+    {
+        // Hash collision, the new content takes over the index slot on commit
+        return std::make_tuple(false, 0ull);
+    }
+    return std::make_tuple(true, candidate);
 }
 
 std::tuple<aku_Status, LogicAddr> FixedSizeFileStorage::append_block(std::shared_ptr<Block> data) {
-    BlockAddr block_addr;
+    std::lock_guard<std::mutex> guard(lock_);
+    u32 hash = 0;
+    if (dedup_enabled_) {
+        bool found;
+        LogicAddr duplicate;
+        std::tie(found, duplicate) = dedup_find_(data, &hash);
+        if (found) {
+            dedup_refs_[duplicate]++;
+            dedup_hits_++;
+            data->set_addr(extract_vol(duplicate));
+            // Nothing new was committed so the subscribers aren't notified
+            return std::make_tuple(AKU_SUCCESS, duplicate);
+        }
+    }
+    aku_Status status;
+    LogicAddr result;
+    if (stripe_width_ > 1) {
+        std::tie(status, result) = append_block_striped_(data);
+    } else {
+        BlockAddr block_addr;
+        std::tie(status, block_addr) = volumes_[current_volume_]->append_block(data->get_data());
+        if (status == AKU_EOVERFLOW) {
+            // Move to next generation
+            advance_volume();
+            std::tie(status, block_addr) = volumes_.at(current_volume_)->append_block(data->get_data());
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0ull);
+            }
+        }
+        data->set_addr(block_addr);
+        status = meta_->set_nblocks(current_volume_, block_addr + 1);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+        }
+        note_block_span_(current_volume_, data->get_data());
+        dirty_[current_volume_]++;
+        if (commit_cb_) {
+            commit_cb_(make_logic(current_gen_, block_addr), data);
+        }
+        result = make_logic(current_gen_, block_addr);
+    }
+    if (dedup_enabled_ && status == AKU_SUCCESS) {
+        dedup_index_[hash] = result;
+        dedup_refs_[result] = 1;
+    }
+    return std::make_tuple(status, result);
+}
+
+std::tuple<aku_Status, LogicAddr> FixedSizeFileStorage::append_extent(std::shared_ptr<Block> data) {
+    size_t size = data->get_size();
+    if (size <= AKU_BLOCK_SIZE) {
+        return append_block(data);
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    u32 nblocks = static_cast<u32>(size / AKU_BLOCK_SIZE);
+    // Two attempts: if the extent doesn't fit into the tail of the current
+    // volume we restart from the beginning of the next one (an empty volume
+    // is assumed to be large enough). Blocks written before the overflow are
+    // left orphaned - nothing points to them.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        aku_Status status = AKU_SUCCESS;
+        BlockAddr first = 0;
+        bool overflow = false;
+        for (u32 i = 0; i < nblocks; i++) {
+            BlockAddr block_addr;
+            u8 const* source = data->get_data() + static_cast<size_t>(i) * AKU_BLOCK_SIZE;
+            std::tie(status, block_addr) = volumes_[current_volume_]->append_block(source);
+            if (status == AKU_EOVERFLOW) {
+                advance_volume();
+                overflow = true;
+                break;
+            } else if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0ull);
+            }
+            if (i == 0) {
+                first = block_addr;
+            }
+        }
+        if (overflow) {
+            continue;
+        }
+        data->set_addr(first);
+        status = meta_->set_nblocks(current_volume_, first + nblocks);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+        }
+        note_block_span_(current_volume_, data->get_data());
+        dirty_[current_volume_]++;
+        if (commit_cb_) {
+            // Whole extent is reported as one entry (payload spans `nblocks` blocks)
+            commit_cb_(make_logic(current_gen_, first), data);
+        }
+        return std::make_tuple(AKU_SUCCESS, make_logic(current_gen_, first));
+    }
+    return std::make_tuple(AKU_EOVERFLOW, 0ull);
+}
+
+void FixedSizeFileStorage::flush() {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (stripe_width_ > 1) {
+        // Striped volumes live on distinct devices - sync them from
+        // separate threads so the fsyncs overlap instead of queueing up
+        std::vector<std::thread> flushers;
+        for (size_t ix = 0; ix < dirty_.size(); ix++) {
+            if (dirty_[ix]) {
+                dirty_[ix] = 0;
+                flushers.emplace_back([this, ix]() {
+                    volumes_[ix]->flush();
+                });
+            }
+        }
+        for (auto& flusher: flushers) {
+            flusher.join();
+        }
+    } else {
+        for (size_t ix = 0; ix < dirty_.size(); ix++) {
+            if (dirty_[ix]) {
+                dirty_[ix] = 0;
+                volumes_[ix]->flush();
+            }
+        }
+    }
+    meta_->flush();
+}
+
+void FixedSizeFileStorage::set_commit_callback(CommitCallback cb) {
+    std::lock_guard<std::mutex> guard(lock_);
+    commit_cb_ = cb;
+}
+
+u64 FixedSizeFileStorage::get_dedup_hits() const {
+    return dedup_hits_;
+}
+
+u32 FixedSizeFileStorage::checksum(u8 const* data, size_t size) const {
+    return crc32c(data, size);
+}
+
+aku_Status FixedSizeFileStorage::verify_checksum(std::shared_ptr<Block> block, u32 expected, u32 offset, u32 size) {
+    if (verifier_) {
+        verifier_->submit(std::move(block), expected, offset, size);
+        return AKU_SUCCESS;
+    }
+    return BlockStore::verify_checksum(std::move(block), expected, offset, size);
+}
+
+aku_Status FixedSizeFileStorage::verification_status() const {
+    if (verifier_) {
+        return verifier_->status();
+    }
+    return AKU_SUCCESS;
+}
+
+
+// MemoryMappedStorage
+
+MemoryMappedStorage::MemoryMappedStorage(std::string metapath, std::vector<std::string> volpaths)
+    : meta_(MetaVolume::open_existing(metapath.c_str()))
+    , current_volume_(0)
+    , current_gen_(0)
+    , total_size_(0)
+    , prefetch_pos_(EMPTY_ADDR)
+{
+    for (u32 ix = 0u; ix < volpaths.size(); ix++) {
+        std::unique_ptr<MemoryMappedFile> mfile(new MemoryMappedFile(volpaths.at(ix).c_str(), false));
+        mfile->panic_if_bad();
+        u32 capacity = static_cast<u32>(mfile->get_size() / AKU_BLOCK_SIZE);
+        capacities_.push_back(capacity);
+        total_size_ += capacity;
+        mmaps_.push_back(std::move(mfile));
+        dirty_.push_back(0);
+    }
+
+    // set current volume, current volume is a first volume with free space available
+    for (u32 i = 0u; i < mmaps_.size(); i++) {
+        u32 curr_gen, nblocks;
+        aku_Status status;
+        std::tie(status, curr_gen) = meta_->get_generation(i);
+        if (status == AKU_SUCCESS) {
+            std::tie(status, nblocks) = meta_->get_nblocks(i);
+        } else {
+            Logger::msg(AKU_LOG_ERROR, "Can't find current volume, meta-volume corrupted, error: "
+                        + StatusUtil::str(status));
+            AKU_PANIC("Meta-volume corrupted, " + StatusUtil::str(status));
+        }
+        if (capacities_[i] > nblocks) {
+            // Free space available
+            current_volume_ = i;
+            current_gen_ = curr_gen;
+            break;
+        }
+    }
+}
+
+std::shared_ptr<MemoryMappedStorage> MemoryMappedStorage::open(std::string metapath, std::vector<std::string> volpaths) {
+    auto bs = new MemoryMappedStorage(metapath, volpaths);
+    return std::shared_ptr<MemoryMappedStorage>(bs);
+}
+
+bool MemoryMappedStorage::exists(LogicAddr addr) const {
+    auto gen = extract_gen(addr);
+    auto vol = extract_vol(addr);
+    auto volix = gen % static_cast<u32>(mmaps_.size());
+    aku_Status status;
+    u32 actual_gen;
+    std::tie(status, actual_gen) = meta_->get_generation(volix);
+    if (status != AKU_SUCCESS) {
+        return false;
+    }
+    u32 nblocks;
+    std::tie(status, nblocks) = meta_->get_nblocks(volix);
+    if (status != AKU_SUCCESS) {
+        return false;
+    }
+    return actual_gen == gen && vol < nblocks;
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> MemoryMappedStorage::read_block(LogicAddr addr) {
+    LatencyTimer timer(g_read_latency);
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    aku_Status status;
+    auto gen = extract_gen(addr);
+    auto vol = extract_vol(addr);
+    auto volix = gen % static_cast<u32>(mmaps_.size());
+    u32 actual_gen;
+    u32 nblocks;
+    std::tie(status, actual_gen) = meta_->get_generation(volix);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(AKU_EBAD_ARG, std::shared_ptr<Block>());
+    }
+    std::tie(status, nblocks) = meta_->get_nblocks(volix);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(AKU_EBAD_ARG, std::shared_ptr<Block>());
+    }
+    if (actual_gen != gen || vol >= nblocks) {
+        return std::make_tuple(AKU_EBAD_ARG, std::shared_ptr<Block>());
+    }
+    // No copy - block references the mapping, OS page cache does the caching.
+    u8* ptr = static_cast<u8*>(mmaps_[volix]->get_pointer()) + static_cast<size_t>(vol) * AKU_BLOCK_SIZE;
+    auto block = std::make_shared<Block>(ptr, addr);
+    return std::make_tuple(AKU_SUCCESS, std::move(block));
+}
+
+void MemoryMappedStorage::advance_volume() {
+    Logger::msg(AKU_LOG_INFO, "Advance volume called, current gen:" + std::to_string(current_gen_));
+    current_volume_ = (current_volume_ + 1) % mmaps_.size();
+    aku_Status status;
+    std::tie(status, current_gen_) = meta_->get_generation(current_volume_);
+    if (status != AKU_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't read generation of next volume, " + StatusUtil::str(status));
+        AKU_PANIC("Can't read generation of the next volume, " + StatusUtil::str(status));
+    }
+    // If volume is not empty - reset it and change generation
+    u32 nblocks;
+    std::tie(status, nblocks) = meta_->get_nblocks(current_volume_);
+    if (status != AKU_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't read nblocks of next volume, " + StatusUtil::str(status));
+        AKU_PANIC("Can't read nblocks of the next volume, " + StatusUtil::str(status));
+    }
+    if (nblocks != 0) {
+        current_gen_ += mmaps_.size();
+        auto status = meta_->set_generation(current_volume_, current_gen_);
+        if (status != AKU_SUCCESS) {
+            Logger::msg(AKU_LOG_ERROR, "Can't set generation on volume, " + StatusUtil::str(status));
+            AKU_PANIC("Invalid BlockStore state, can't reset volume's generation, " + StatusUtil::str(status));
+        }
+        // Rest selected volume
+        status = meta_->set_nblocks(current_volume_, 0);
+        if (status != AKU_SUCCESS) {
+            Logger::msg(AKU_LOG_ERROR, "Can't reset nblocks on volume, " + StatusUtil::str(status));
+            AKU_PANIC("Invalid BlockStore state, can't reset volume's nblocks, " + StatusUtil::str(status));
+        }
+        dirty_[current_volume_]++;
+    }
+}
+
+std::tuple<aku_Status, LogicAddr> MemoryMappedStorage::append_block(std::shared_ptr<Block> data) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
     aku_Status status;
-    std::tie(status, block_addr) = volumes_[current_volume_]->append_block(data->get_data());
-    if (status == AKU_EOVERFLOW) {
+    u32 nblocks;
+    std::tie(status, nblocks) = meta_->get_nblocks(current_volume_);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+    }
+    if (nblocks == capacities_[current_volume_]) {
         // Move to next generation
         advance_volume();
-        std::tie(status, block_addr) = volumes_.at(current_volume_)->append_block(data->get_data());
+        std::tie(status, nblocks) = meta_->get_nblocks(current_volume_);
         if (status != AKU_SUCCESS) {
-            return std::make_tuple(status, 0ull);
+            AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
         }
     }
-    data->set_addr(block_addr);
-    status = meta_->set_nblocks(current_volume_, block_addr + 1);
+    u8* dest = static_cast<u8*>(mmaps_[current_volume_]->get_pointer()) +
+               static_cast<size_t>(nblocks) * AKU_BLOCK_SIZE;
+    memcpy(dest, data->get_data(), AKU_BLOCK_SIZE);
+    data->set_addr(nblocks);
+    status = meta_->set_nblocks(current_volume_, nblocks + 1);
     if (status != AKU_SUCCESS) {
         AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
     }
     dirty_[current_volume_]++;
-    return std::make_tuple(status, make_logic(current_gen_, block_addr));
+    return std::make_tuple(status, make_logic(current_gen_, nblocks));
 }
 
-void FixedSizeFileStorage::flush() {
+std::tuple<aku_Status, LogicAddr> MemoryMappedStorage::append_extent(std::shared_ptr<Block> data) {
+    size_t size = data->get_size();
+    if (size <= AKU_BLOCK_SIZE) {
+        return append_block(data);
+    }
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    u32 count = static_cast<u32>(size / AKU_BLOCK_SIZE);
+    aku_Status status;
+    u32 nblocks;
+    std::tie(status, nblocks) = meta_->get_nblocks(current_volume_);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+    }
+    if (nblocks + count > capacities_[current_volume_]) {
+        // Extent doesn't fit into the tail of the current volume -
+        // write it to the beginning of the next one.
+        advance_volume();
+        std::tie(status, nblocks) = meta_->get_nblocks(current_volume_);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+        }
+        if (nblocks + count > capacities_[current_volume_]) {
+            return std::make_tuple(AKU_EOVERFLOW, 0ull);
+        }
+    }
+    u8* dest = static_cast<u8*>(mmaps_[current_volume_]->get_pointer()) +
+               static_cast<size_t>(nblocks) * AKU_BLOCK_SIZE;
+    memcpy(dest, data->get_data(), size);
+    data->set_addr(nblocks);
+    status = meta_->set_nblocks(current_volume_, nblocks + count);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+    }
+    dirty_[current_volume_]++;
+    return std::make_tuple(status, make_logic(current_gen_, nblocks));
+}
+
+void MemoryMappedStorage::flush() {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
     for (size_t ix = 0; ix < dirty_.size(); ix++) {
         if (dirty_[ix]) {
             dirty_[ix] = 0;
-            volumes_[ix]->flush();
+            mmaps_[ix]->flush();
         }
     }
     meta_->flush();
 }
 
-static u32 crc32c(const u8* data, size_t size) {
-    static crc32c_impl_t impl = chose_crc32c_implementation();
-    return impl(0, data, size);
+u32 MemoryMappedStorage::checksum(u8 const* data, size_t size) const {
+    return crc32c(data, size);
 }
 
-u32 FixedSizeFileStorage::checksum(u8 const* data, size_t size) const {
-    return crc32c(data, size);
+void MemoryMappedStorage::prefetch_block(LogicAddr addr) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    auto gen = extract_gen(addr);
+    auto vol = extract_vol(addr);
+    auto volix = gen % static_cast<u32>(mmaps_.size());
+    aku_Status status;
+    u32 actual_gen;
+    u32 nblocks;
+    std::tie(status, actual_gen) = meta_->get_generation(volix);
+    if (status != AKU_SUCCESS) {
+        return;
+    }
+    std::tie(status, nblocks) = meta_->get_nblocks(volix);
+    if (status != AKU_SUCCESS || actual_gen != gen || vol >= nblocks) {
+        return;
+    }
+    u8* ptr = static_cast<u8*>(mmaps_[volix]->get_pointer()) + static_cast<size_t>(vol) * AKU_BLOCK_SIZE;
+    if (prefetch_pos_ != EMPTY_ADDR && addr == prefetch_pos_ + 1) {
+        // Consecutive hints - scan detected, advise a window ahead so kernel
+        // readahead stays in front of the iterator.
+        size_t count = std::min(static_cast<size_t>(PREFETCH_WINDOW), static_cast<size_t>(nblocks - vol));
+        posix_madvise(ptr, count * AKU_BLOCK_SIZE, POSIX_MADV_SEQUENTIAL);
+        posix_madvise(ptr, count * AKU_BLOCK_SIZE, POSIX_MADV_WILLNEED);
+    } else {
+        posix_madvise(ptr, AKU_BLOCK_SIZE, POSIX_MADV_WILLNEED);
+    }
+    prefetch_pos_ = addr;
 }
 
 
@@ -332,6 +1763,7 @@ u32 FixedSizeFileStorage::checksum(u8 const* data, size_t size) const {
 struct MemStore : BlockStore, std::enable_shared_from_this<MemStore> {
     std::vector<u8> buffer_;
     std::function<void(LogicAddr)> append_callback_;
+    CommitCallback commit_cb_;
     u32 write_pos_;
     u32 pad_;
 
@@ -351,6 +1783,7 @@ struct MemStore : BlockStore, std::enable_shared_from_this<MemStore> {
     virtual void flush();
     virtual bool exists(LogicAddr addr) const;
     virtual u32 checksum(u8 const* data, size_t size) const;
+    virtual void set_commit_callback(CommitCallback cb);
 };
 
 u32 MemStore::checksum(u8 const* data, size_t size) const {
@@ -380,6 +1813,9 @@ std::tuple<aku_Status, LogicAddr> MemStore::append_block(std::shared_ptr<Block>
     }
     auto addr = write_pos_++;
     data->set_addr(addr);
+    if (commit_cb_) {
+        commit_cb_(addr, data);
+    }
     return std::make_tuple(AKU_SUCCESS, addr);
 }
 
@@ -391,6 +1827,10 @@ bool MemStore::exists(LogicAddr addr) const {
     return addr < write_pos_;
 }
 
+void MemStore::set_commit_callback(CommitCallback cb) {
+    commit_cb_ = cb;
+}
+
 std::shared_ptr<BlockStore> BlockStoreBuilder::create_memstore() {
     return std::make_shared<MemStore>();
 }
@@ -17,7 +17,12 @@
 
 #pragma once
 #include "volume.h"
-#include <random>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace Akumuli {
 namespace StorageEngine {
@@ -29,28 +34,84 @@ typedef u64 LogicAddr;
 static const LogicAddr EMPTY_ADDR = std::numeric_limits<LogicAddr>::max();
 
 class Block;
+struct BlockPool;
 
+/** Access intent of the read. Scans and point lookups have opposite
+  * ideal cache behavior so the reader can tell the block layer what
+  * the block will be used for - the hint drives readahead depth and
+  * the cache insertion policy of the request.
+  */
+enum class ReadHint {
+    //! Point read (tree descent) - no readahead, cache normally.
+    LOOKUP,
+    /** Part of a scan over a leaf chain - readahead the adjacent
+      * blocks, insert at the cold end of the cache so a long scan
+      * can't flush the hot working set.
+      */
+    SCAN,
+};
+
+/** Sharded block cache with scan-resistant eviction.
+  * Cache is split into shards by address hash, each shard is protected by
+  * its own lock so concurrent queries don't serialize on a single mutex.
+  * Eviction is segmented LRU: a block enters the probationary segment
+  * first and gets promoted to the protected segment on the second hit.
+  * Sequential scans touch every block only once so they recycle the
+  * probationary segment without flushing the hot working set.
+  */
 struct BlockCache {
     typedef std::shared_ptr<Block> PBlock;
-    std::vector<PBlock> block_cache_;
-    const u32 bits_;
-    // RNG
-    std::random_device dev_;
-    std::mt19937 gen_;
-    std::uniform_int_distribution<u32> dist_;
 
-    /** Check status of the cache cell.
-      * Return 0 if there is no such addr in the cache and slot is free.
-      * Return 1 if addr is not present in the cache but slot is occupied by the other block.
-      * Return 2 if addr is already present in the cache.
-      */
-    int probe(LogicAddr addr);
+    struct Shard {
+        struct Entry {
+            PBlock block;
+            std::list<LogicAddr>::iterator pos;
+            bool is_protected;
+        };
+
+        std::mutex lock_;
+        //! Blocks seen once (MRU at front).
+        std::list<LogicAddr> probation_;
+        //! Blocks seen more than once (MRU at front).
+        std::list<LogicAddr> prot_;
+        std::unordered_map<LogicAddr, Entry> entries_;
+        const u32 probation_cap_;
+        const u32 prot_cap_;
+
+        Shard(u32 probation_cap, u32 prot_cap);
 
+        void insert(PBlock block, ReadHint hint);
+
+        PBlock lookup(LogicAddr addr);
+
+        //! Append addresses of cached blocks to `dest`, coldest first.
+        void get_addresses(std::vector<LogicAddr>* dest);
+
+        void clear();
+    };
+
+    enum {
+        NSHARD_BITS = 4,
+        NSHARDS     = 1 << NSHARD_BITS,
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    //! C-tor. Cache capacity is 2^Nbits blocks.
     BlockCache(u32 Nbits);
 
-    void insert(PBlock block);
+    void insert(PBlock block, ReadHint hint = ReadHint::LOOKUP);
+
+    PBlock lookup(LogicAddr addr);
 
-    PBlock loockup(LogicAddr addr);
+    /** List addresses of all cached blocks ordered coldest to hottest.
+      * Used by warm restart - reinserting the blocks in this order
+      * recreates the relative recency of the old cache.
+      */
+    std::vector<LogicAddr> get_addresses();
+
+    //! Drop all cached blocks (called when volume is recycled).
+    void clear();
 };
 
 struct BlockStore {
@@ -61,6 +122,12 @@ struct BlockStore {
       */
     virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr) = 0;
 
+    /** Read block with an access intent hint. The hint controls readahead
+      * and the cache insertion policy of this request. Default
+      * implementation ignores the hint and forwards to `read_block`.
+      */
+    virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr, ReadHint hint);
+
     /** Add block to blockstore.
       * @param data Pointer to buffer.
       * @return Status and block's logic address.
@@ -75,8 +142,79 @@ struct BlockStore {
 
     //! Compute checksum of the input data.
     virtual u32 checksum(u8 const* begin, size_t size) const = 0;
+
+    /** Verify block's payload against the expected checksum.
+      * By default the checksum is computed synchronously on the caller's thread
+      * and mismatch is reported through the return value. Implementation can
+      * offload verification to a background thread pool, in this case the call
+      * returns AKU_SUCCESS immediately and mismatch is reported with a small
+      * delay through `verification_status`.
+      * @param block Block to verify (shared ownership is extended until verification completes).
+      * @param expected Expected checksum value.
+      * @param offset Payload offset inside the block.
+      * @param size Payload size.
+      */
+    virtual aku_Status verify_checksum(std::shared_ptr<Block> block, u32 expected, u32 offset, u32 size);
+
+    //! Return AKU_EBAD_DATA if one of the previously submitted blocks failed verification.
+    virtual aku_Status verification_status() const;
+
+    /** Hint that block at `addr` will be read soon. Implementation can issue
+      * asynchronous read so the disk access overlaps with decompression of
+      * the current block. Default implementation does nothing.
+      */
+    virtual void prefetch_block(LogicAddr addr);
+
+    /** Add multi-block payload to blockstore (large leaf nodes).
+      * `data->get_size()` should be a multiple of AKU_BLOCK_SIZE. All the
+      * blocks land back-to-back in one volume so the payload can be read
+      * back with `read_extent` given the address of the first block.
+      * Single-block payload is routed to `append_block`.
+      * @return Status and logic address of the first block.
+      */
+    virtual std::tuple<aku_Status, LogicAddr> append_extent(std::shared_ptr<Block> data);
+
+    /** Read run of `nblocks` consecutive blocks into single buffer.
+      * Default implementation reads the run block by block through
+      * `read_block`.
+      */
+    virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_extent(LogicAddr addr, u32 nblocks);
+
+    //! Block commit callback (address and payload of the committed block)
+    typedef std::function<void(LogicAddr, std::shared_ptr<Block>)> CommitCallback;
+
+    /** Subscribe to block commits (replication hook, see `ReplicationStream`).
+      * The callback is invoked after the block is appended to the store.
+      * Empty callback cancels the subscription. Default implementation
+      * ignores the subscription.
+      */
+    virtual void set_commit_callback(CommitCallback cb);
 };
 
+/** Snapshot of one volume - frozen range of immutable blocks.
+  * Generation is recorded when the snapshot is taken; if the volume gets
+  * recycled by the ingestion path the generation changes and reads through
+  * the stale snapshot fail with AKU_EBAD_ARG, so a backup reader can
+  * detect the overwrite and restart this part.
+  */
+struct VolumeSnapshot {
+    //! Volume index.
+    u32 id;
+    //! Frozen generation.
+    u32 generation;
+    //! Number of immutable blocks (range [0, nblocks) can be streamed).
+    u32 nblocks;
+};
+
+//! Cold tier for demoted volumes (see tiering.h).
+struct ColdStorage;
+
+//! Background CRC verifier pool (implementation detail of FixedSizeFileStorage).
+struct ChecksumVerifier;
+
+//! Readahead prefetcher (implementation detail of FixedSizeFileStorage).
+struct Prefetcher;
+
 /** Blockstore. Contains collection of volumes.
   * Translates logic adresses into physical ones.
   */
@@ -92,19 +230,128 @@ class FixedSizeFileStorage : public BlockStore,
     u32 current_volume_;
     //! Current generation.
     u32 current_gen_;
+    //! Number of volumes written simultaneously (1 - striping disabled).
+    u32 stripe_width_;
+    //! Round-robin position of the striped append.
+    u32 stripe_counter_;
     //! Size of the blockstore in blocks.
     size_t total_size_;
+    //! Background CRC verifier (null if verification is synchronous).
+    std::unique_ptr<ChecksumVerifier> verifier_;
+    //! Readahead prefetcher.
+    std::unique_ptr<Prefetcher> prefetcher_;
+    //! Cache warmup loader (see `warmup_cache`).
+    std::thread warmup_thread_;
+    //! Tells the warmup loader to stop early on shutdown.
+    std::atomic<bool> warmup_stop_;
+    //! Background scrubber (see `start_scrub`).
+    std::thread scrub_thread_;
+    //! Tells the scrubber to stop on shutdown.
+    std::atomic<bool> scrub_stop_;
+    //! Blocks verified by the scrubber so far.
+    std::atomic<u64> scrub_scanned_;
+    //! Checksum mismatches found by the scrubber.
+    std::atomic<u64> scrub_errors_;
+    //! Completed scrub passes over the whole store.
+    std::atomic<u64> scrub_passes_;
+    //! Block cache.
+    std::unique_ptr<BlockCache> cache_;
+    //! Pool of aligned block buffers (backs all reads).
+    std::shared_ptr<BlockPool> pool_;
+    //! Protects volume file handles (APR reads are seek+read, not atomic).
+    std::mutex lock_;
+    //! Block commit subscriber (replication stream), can be empty.
+    CommitCallback commit_cb_;
+    //! Cold tier for demoted volumes (null if tiering is disabled).
+    std::shared_ptr<ColdStorage> cold_;
+    //! "Demoted" flags (the volume content lives in the cold tier).
+    std::vector<int> demoted_;
+    //! Content hash of committed blocks -> address (empty if dedup is disabled).
+    std::unordered_map<u32, LogicAddr> dedup_index_;
+    //! Number of logical references to each deduplicated block.
+    std::unordered_map<LogicAddr, u32> dedup_refs_;
+    //! Deduplicate byte-identical blocks on append.
+    const bool dedup_enabled_;
+    //! Number of appends resolved to an already committed block.
+    u64 dedup_hits_;
+
+    enum {
+        //! Number of blocks uploaded to the cold tier in one part (1MB).
+        DEMOTE_CHUNK_NBLOCKS = 0x100,
+        //! Number of preceding blocks prefetched by a scan-hinted read.
+        SCAN_READAHEAD_DEPTH = 8,
+        //! Number of blocks read by the warmup loader in one batch.
+        WARMUP_BATCH_NBLOCKS = 8,
+        //! Pause between scrub passes (seconds).
+        SCRUB_PASS_PAUSE_SEC = 60,
+    };
 
     //! Secret c-tor.
-    FixedSizeFileStorage(std::string metapath, std::vector<std::string> volpaths);
+    FixedSizeFileStorage(std::string metapath, std::vector<std::string> volpaths, u32 verifier_threads,
+                         bool direct_io, u32 stripe_width, bool dedup);
 
     void advance_volume();
 
+    //! Append block to one of the active volumes round-robin (lock should be held).
+    std::tuple<aku_Status, LogicAddr> append_block_striped_(std::shared_ptr<Block> data);
+
+    /** Find committed block with the same content (lock should be held).
+      * The candidate from the hash index is read back and compared byte
+      * by byte so hash collisions can't map distinct blocks to one address.
+      * Computed content hash is returned through `hash` in any case.
+      */
+    std::tuple<bool, LogicAddr> dedup_find_(std::shared_ptr<Block> data, u32* hash);
+
+    //! Translate address and read block from the volume (bypass the prefetch buffer).
+    std::tuple<aku_Status, std::shared_ptr<Block>> do_read_block(LogicAddr addr);
+
+    /** Read batch of blocks through POSIX AIO. All reads are submitted at
+      * once so the device sees the whole queue instead of one request at a
+      * time (used by the prefetcher).
+      */
+    std::vector<std::tuple<aku_Status, std::shared_ptr<Block>>> do_read_blocks(std::vector<LogicAddr> const& addrs);
+
+    //! Body of the warmup loader thread (see `warmup_cache`).
+    void warmup_worker_(std::vector<LogicAddr> addrs);
+
+    //! Body of the scrubber thread (see `start_scrub`).
+    void scrub_worker_(u32 mb_per_sec);
+
+    /** Extend the timestamp span of the volume with the range recorded in
+      * the header of the appended block (lock should be held).
+      */
+    void note_block_span_(u32 volix, const u8* data);
+
 public:
+    virtual ~FixedSizeFileStorage();
+
     /** Create BlockStore instance (can be created only on heap).
+      * @param metapath Path to meta-volume.
+      * @param volpaths Paths to data volumes.
+      * @param verifier_threads Number of background CRC verifier threads
+      *        (0 means that checksums are verified synchronously).
+      * @param direct_io Open volumes with O_DIRECT so the page cache is
+      *        bypassed and cache residency is controlled by the block cache
+      *        alone (block buffers always come from the aligned pool so the
+      *        flag only changes how the volumes are opened).
+      * @param stripe_width Number of volumes written simultaneously. Blocks
+      *        are routed round-robin between the active volumes so the write
+      *        bandwidth of several devices adds up (volumes should be placed
+      *        on distinct devices) and `flush` syncs the devices in parallel.
+      *        1 disables striping.
+      * @param dedup Deduplicate byte-identical blocks on append - committed
+      *        content is tracked in a hash index and an append of an already
+      *        stored payload returns the existing address (with one more
+      *        reference) instead of writing a new block. Blocks are immutable
+      *        so the extra link is safe, the index is rebuilt from scratch on
+      *        restart (blocks committed before the last open aren't candidates).
       */
     static std::shared_ptr<FixedSizeFileStorage> open(std::string              metapath,
-                                                      std::vector<std::string> volpaths);
+                                                      std::vector<std::string> volpaths,
+                                                      u32 verifier_threads = 0,
+                                                      bool direct_io = false,
+                                                      u32 stripe_width = 1,
+                                                      bool dedup = false);
 
     static void create(std::string metapath, std::vector<std::tuple<u32, std::string>> vols);
 
@@ -112,29 +359,265 @@ public:
       */
     virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr);
 
+    /** Read block with an access intent hint. Scan-hinted reads issue
+      * backward readahead (backward scans over leaf chains visit the
+      * preceding blocks next) and are inserted at the cold end of the
+      * block cache.
+      */
+    virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr, ReadHint hint);
+
     /** Add block to blockstore.
       * @param data Pointer to buffer.
       * @return Status and block's logic address.
       */
     virtual std::tuple<aku_Status, LogicAddr> append_block(std::shared_ptr<Block> data);
 
+    virtual std::tuple<aku_Status, LogicAddr> append_extent(std::shared_ptr<Block> data);
+
     virtual void flush();
 
     virtual bool exists(LogicAddr addr) const;
 
     virtual u32 checksum(u8 const* data, size_t size) const;
+
+    virtual aku_Status verify_checksum(std::shared_ptr<Block> block, u32 expected, u32 offset, u32 size);
+
+    virtual aku_Status verification_status() const;
+
+    virtual void prefetch_block(LogicAddr addr);
+
+    virtual void set_commit_callback(CommitCallback cb);
+
+    //! Number of appends that were resolved to an already committed block.
+    u64 get_dedup_hits() const;
+
+    /** Freeze current state for backup. Returns list of immutable block
+      * ranges (one entry per non-empty volume). Ingestion can proceed
+      * while the snapshot is streamed - new blocks are only appended past
+      * the frozen ranges.
+      */
+    std::vector<VolumeSnapshot> create_snapshot();
+
+    /** Stream run of blocks from the snapshot without going through the
+      * block cache (backup reads shouldn't evict the working set).
+      * @param snap Snapshot entry returned by `create_snapshot`.
+      * @param offset Index of the first block to read.
+      * @param nblocks Number of blocks to read.
+      * @param dest Destination buffer (nblocks*AKU_BLOCK_SIZE bytes).
+      * @return AKU_EBAD_ARG if the volume was recycled since the snapshot
+      *         was taken or the range is out of bounds.
+      */
+    aku_Status read_snapshot(VolumeSnapshot const& snap, u32 offset, u32 nblocks, u8* dest);
+
+    /** Attach cold tier (enables `demote_volume`). Blocks of demoted
+      * volumes are fetched from the cold tier on demand and go through
+      * the block cache the same way local reads do.
+      */
+    void set_cold_storage(std::shared_ptr<ColdStorage> cold);
+
+    /** Demote sealed volume to the cold tier: upload its content and
+      * truncate the local file so the space is returned to the file
+      * system. The volume stays addressable - `read_block` fetches the
+      * needed blocks from the cold tier transparently. When the
+      * ingestion path recycles a demoted volume the cold object is
+      * deleted and the local file grows back with the new generation.
+      * @param id Volume index (the volume being written can't be demoted).
+      * @return AKU_EBAD_ARG if tiering is disabled, the volume is
+      *         active or already demoted; AKU_ENO_DATA if it's empty.
+      */
+    aku_Status demote_volume(u32 id);
+
+    /** Persist addresses of the cached blocks (not their content) so the
+      * cache can be warmed up after restart. Should be called on shutdown,
+      * the file at `path` is overwritten.
+      */
+    aku_Status save_cache_state(const char* path);
+
+    //! Progress and damage counters of the background scrubber.
+    struct ScrubStats {
+        u64 blocks_scanned;   //< Blocks verified since `start_scrub`
+        u64 errors_found;     //< Checksum mismatches found
+        u64 passes_complete;  //< Full passes over the store
+    };
+
+    /** Start background scrubbing. The scrubber walks the committed
+      * blocks of every volume, verifies each block against the checksum
+      * recorded in its header and moves on to the next pass after a
+      * pause, so bit rot in rarely-read volumes is found on our schedule
+      * instead of at query time. Reads bypass the block cache and are
+      * paced to the byte budget the same way compaction batches are
+      * throttled, so foreground i/o keeps its latency. Damage is logged
+      * and counted (see `get_scrub_stats`), never repaired in place.
+      * @param mb_per_sec Read budget in MB/s (0 - unpaced).
+      * @return AKU_EBUSY if the scrubber is already running.
+      */
+    aku_Status start_scrub(u32 mb_per_sec);
+
+    //! Stop the scrubber thread (also called by the d-tor).
+    void stop_scrub();
+
+    //! Current scrub progress and damage counters.
+    ScrubStats get_scrub_stats() const;
+
+    /** Drop every sealed volume whose data lies entirely before the
+      * boundary. Volumes are the retention partitions of the store - every
+      * committed block carries the timestamp range of its subtree in the
+      * header, so the store tracks the overall span per volume as blocks
+      * are appended (persisted in the meta-volume). Expiring a retention
+      * window is therefore a metadata-only operation: the matching volumes
+      * are recycled in place exactly like the ring-buffer wraparound does
+      * it (generation bump, block count reset), no data is read or
+      * rewritten. Addresses inside the dropped volumes become dead and
+      * readers observe that the same way they observe normal recycling.
+      * The volumes of the active stripe are never dropped.
+      * @param boundary Timestamp of the retention horizon (exclusive).
+      * @return Status and number of volumes dropped.
+      */
+    std::tuple<aku_Status, u32> drop_partition(aku_Timestamp boundary);
+
+    /** Start background cache warmup from the state file written by
+      * `save_cache_state`. Blocks are prefetched in small batches through
+      * the async i/o path with pauses in between so the warmup doesn't
+      * queue in front of foreground reads. Addresses of recycled volumes
+      * are skipped, a missing state file is a cold start and not an error.
+      */
+    aku_Status warmup_cache(const char* path);
+};
+
+/** Memory-mapped blockstore. Same on-disk layout as `FixedSizeFileStorage`
+  * (use `FixedSizeFileStorage::create` to initialize the volumes) but data
+  * volumes are accessed through mmap instead of read/write syscalls.
+  * `read_block` returns a block that points directly into the mapping so a
+  * warm read costs no syscall and no memcpy, cache residency is managed by
+  * the OS page cache. `prefetch_block` is translated into `posix_madvise`
+  * hints - WILLNEED for a single block, SEQUENTIAL+WILLNEED for a window
+  * ahead when the hinted addresses are consecutive.
+  * Note: a zero-copy block observes volume recycling - reader should check
+  * the generation (part of the logic address) before trusting stale blocks,
+  * same way backup readers validate `VolumeSnapshot`.
+  */
+class MemoryMappedStorage : public BlockStore,
+                            public std::enable_shared_from_this<MemoryMappedStorage> {
+    //! Metadata volume.
+    std::unique_ptr<MetaVolume> meta_;
+    //! Mapped data volumes.
+    std::vector<std::unique_ptr<MemoryMappedFile>> mmaps_;
+    //! Volume capacities (in blocks).
+    std::vector<u32> capacities_;
+    //! "Dirty" flags.
+    std::vector<int> dirty_;
+    //! Current volume.
+    u32 current_volume_;
+    //! Current generation.
+    u32 current_gen_;
+    //! Size of the blockstore in blocks.
+    size_t total_size_;
+    //! Previously hinted address (used to detect sequential scans).
+    LogicAddr prefetch_pos_;
+    //! Protects meta-volume bookkeeping and the append position.
+    std::mutex lock_;
+
+    enum {
+        //! Number of blocks covered by one sequential madvise hint.
+        PREFETCH_WINDOW = 0x20,
+    };
+
+    //! Secret c-tor.
+    MemoryMappedStorage(std::string metapath, std::vector<std::string> volpaths);
+
+    void advance_volume();
+
+public:
+    /** Create BlockStore instance (can be created only on heap).
+      * @param metapath Path to meta-volume.
+      * @param volpaths Paths to data volumes.
+      */
+    static std::shared_ptr<MemoryMappedStorage> open(std::string              metapath,
+                                                     std::vector<std::string> volpaths);
+
+    /** Read block from blockstore.
+      * Returned block references the mapping directly (zero-copy).
+      */
+    virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr);
+
+    /** Add block to blockstore.
+      * @param data Pointer to buffer.
+      * @return Status and block's logic address.
+      */
+    virtual std::tuple<aku_Status, LogicAddr> append_block(std::shared_ptr<Block> data);
+
+    virtual std::tuple<aku_Status, LogicAddr> append_extent(std::shared_ptr<Block> data);
+
+    virtual void flush();
+
+    virtual bool exists(LogicAddr addr) const;
+
+    virtual u32 checksum(u8 const* data, size_t size) const;
+
+    virtual void prefetch_block(LogicAddr addr);
+};
+
+/** Slab pool of 4KB-aligned block buffers.
+  * Backs every block read so cold scans don't churn the allocator at block
+  * rate: buffers are carved out of fixed-size slabs and recycled through a
+  * free-list, so steady-state reads cost no allocation and long uptimes
+  * don't fragment the heap. The alignment also satisfies O_DIRECT, which
+  * requires i/o buffers aligned to the logical sector size.
+  * A buffer returns to the free-list when the last owner of its block
+  * (cache, prefetcher or reader) drops the reference.
+  */
+struct BlockPool : std::enable_shared_from_this<BlockPool> {
+    enum {
+        //! Number of block buffers carved out of one slab.
+        SLAB_NBLOCKS = 64,
+    };
+
+    std::mutex lock_;
+    std::vector<u8*> free_list_;
+    //! Slab allocations (buffers in `free_list_` point into these).
+    std::vector<u8*> slabs_;
+
+    ~BlockPool();
+
+    //! Return 4KB-aligned zeroed buffer (AKU_BLOCK_SIZE bytes).
+    u8* allocate();
+
+    //! Return buffer to the pool.
+    void release(u8* buf);
+
+    //! Create new block backed by a pool-allocated buffer.
+    std::shared_ptr<Block> make_block(LogicAddr addr);
 };
 
 //! Represents memory block
 class Block {
     std::vector<u8>           data_;
+    //! Pool the aligned buffer should be returned to (null for heap-backed blocks).
+    std::shared_ptr<BlockPool> pool_;
+    //! 4KB-aligned buffer (used instead of `data_` in direct i/o mode).
+    u8*                       aligned_data_;
+    //! Non-owning pointer into a mapped volume (zero-copy reads).
+    u8*                       mmap_ptr_;
     LogicAddr                 addr_;
 
 public:
     Block(LogicAddr addr, std::vector<u8>&& data);
 
+    //! Create block backed by a 4KB-aligned pool-allocated buffer.
+    Block(std::shared_ptr<BlockPool> pool, u8* buf, LogicAddr addr);
+
+    /** Create block that references memory of a mapped volume directly.
+      * Block doesn't own the memory, mapping should outlive the block.
+      */
+    Block(u8* ptr, LogicAddr addr);
+
     Block();
 
+    Block(Block const&) = delete;
+    Block& operator = (Block const&) = delete;
+
+    ~Block();
+
     const u8* get_data() const;
 
     u8* get_data();
@@ -5,8 +5,153 @@
 #include <unordered_map>
 #include <algorithm>
 
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
 namespace Akumuli {
 
+// /////////////////////////////// //
+// Vectorized delta-delta decoding //
+// /////////////////////////////// //
+
+static void delta_delta_prefix_sum_scalar(u64* xs, size_t n, u64 prev, u64 min) {
+    delta_delta_prefix_sum<u64>(xs, n, prev, min);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.1")))
+static void delta_delta_prefix_sum_sse(u64* xs, size_t n, u64 prev, u64 min) {
+    const __m128i vmin = _mm_set1_epi64x(static_cast<long long>(min));
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i*>(xs + i));
+        x = _mm_add_epi64(x, vmin);
+        // in-register scan: x1 += x0
+        x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi64(x, _mm_set1_epi64x(static_cast<long long>(prev)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(xs + i), x);
+        prev = xs[i + 1];
+    }
+    delta_delta_prefix_sum_scalar(xs + i, n - i, prev, min);
+}
+
+__attribute__((target("avx2")))
+static void delta_delta_prefix_sum_avx2(u64* xs, size_t n, u64 prev, u64 min) {
+    const __m256i vmin  = _mm256_set1_epi64x(static_cast<long long>(min));
+    const __m256i vzero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i*>(xs + i));
+        x = _mm256_add_epi64(x, vmin);
+        // in-lane scan: x1 += x0, x3 += x2
+        x = _mm256_add_epi64(x, _mm256_slli_si256(x, 8));
+        // carry sum of the lower lane into the upper lane
+        __m256i carry = _mm256_permute4x64_epi64(x, 0x50);
+        x = _mm256_add_epi64(x, _mm256_blend_epi32(vzero, carry, 0xF0));
+        x = _mm256_add_epi64(x, _mm256_set1_epi64x(static_cast<long long>(prev)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(xs + i), x);
+        prev = xs[i + 3];
+    }
+    delta_delta_prefix_sum_scalar(xs + i, n - i, prev, min);
+}
+
+#endif
+
+void delta_delta_prefix_sum(u64* xs, size_t n, u64 prev, u64 min) {
+    typedef void (*KernelT)(u64*, size_t, u64, u64);
+    static const KernelT kernel = []() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return &delta_delta_prefix_sum_avx2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return &delta_delta_prefix_sum_sse;
+        }
+#endif
+        return &delta_delta_prefix_sum_scalar;
+    }();
+    kernel(xs, n, prev, min);
+}
+
+// //////////////////////////// //
+// Vectorized zigzag transforms //
+// //////////////////////////// //
+
+static void zigzag_encode_scalar(i64* xs, size_t n) {
+    zigzag_encode<i64>(xs, n);
+}
+
+static void zigzag_decode_scalar(i64* xs, size_t n) {
+    zigzag_decode<i64>(xs, n);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static void zigzag_encode_avx2(i64* xs, size_t n) {
+    const __m256i vzero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i*>(xs + i));
+        // `x >> 63` is all-ones for negative values - same thing the
+        // comparison computes (AVX2 has no 64-bit arithmetic shift).
+        __m256i sign = _mm256_cmpgt_epi64(vzero, x);
+        x = _mm256_xor_si256(_mm256_slli_epi64(x, 1), sign);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(xs + i), x);
+    }
+    zigzag_encode_scalar(xs + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void zigzag_decode_avx2(i64* xs, size_t n) {
+    const __m256i vzero = _mm256_setzero_si256();
+    const __m256i vone  = _mm256_set1_epi64x(1);
+    const __m256i vtop  = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i*>(xs + i));
+        // Arithmetic `x >> 1` emulated with a logical shift plus sign fill
+        // (keeps the result bit-compatible with the scalar reader).
+        __m256i sign    = _mm256_cmpgt_epi64(vzero, x);
+        __m256i shifted = _mm256_or_si256(_mm256_srli_epi64(x, 1),
+                                          _mm256_and_si256(sign, vtop));
+        __m256i neg     = _mm256_sub_epi64(vzero, _mm256_and_si256(x, vone));
+        x = _mm256_xor_si256(shifted, neg);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(xs + i), x);
+    }
+    zigzag_decode_scalar(xs + i, n - i);
+}
+
+#endif
+
+void zigzag_encode(i64* xs, size_t n) {
+    typedef void (*KernelT)(i64*, size_t);
+    static const KernelT kernel = []() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return &zigzag_encode_avx2;
+        }
+#endif
+        return &zigzag_encode_scalar;
+    }();
+    kernel(xs, n);
+}
+
+void zigzag_decode(i64* xs, size_t n) {
+    typedef void (*KernelT)(i64*, size_t);
+    static const KernelT kernel = []() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return &zigzag_decode_avx2;
+        }
+#endif
+        return &zigzag_decode_scalar;
+    }();
+    kernel(xs, n);
+}
+
 FcmPredictor::FcmPredictor(size_t table_size)
     : last_hash(0ull)
     , MASK_(table_size - 1)
@@ -95,6 +240,35 @@ static inline bool encode_value(Base128StreamWriter& wstream, u64 diff, unsigned
     return true;
 }
 
+//! Choose flag byte (length + leading/trailing indicator) for the XOR-ed diff
+static inline unsigned char choose_flag(u64 diff) {
+    int leading_zeros  = 64;
+    int trailing_zeros = 64;
+    if (diff != 0) {
+        trailing_zeros = __builtin_ctzl(diff);
+        leading_zeros  = __builtin_clzl(diff);
+    }
+    int           nbytes;
+    unsigned char flag;
+    if (trailing_zeros > leading_zeros) {
+        // this would be the case with low precision values
+        nbytes = 8 - trailing_zeros / 8;
+        if (nbytes > 0) {
+            nbytes--;
+        }
+        // 4th bit indicates that only leading bytes are stored
+        flag = 8 | (nbytes & 7);
+    } else {
+        nbytes = 8 - leading_zeros / 8;
+        if (nbytes > 0) {
+            nbytes--;
+        }
+        // zeroed 4th bit indicates that only trailing bytes are stored
+        flag = nbytes & 7;
+    }
+    return flag;
+}
+
 static inline u64 decode_value(Base128StreamReader& rstream, unsigned char flag) {
     u64 diff = 0ul;
     int nbytes = (flag & 7) + 1;
@@ -136,35 +310,76 @@ bool FcmStreamWriter::put(double value) {
     predictor_.update(curr.bits);
     u64 diff = curr.bits ^ predicted;
 
-    int leading_zeros = 64;
-    int trailing_zeros = 64;
+    unsigned char flag = choose_flag(diff);
 
-    if (diff != 0) {
-        trailing_zeros = __builtin_ctzl(diff);
-    }
-    if (diff != 0) {
-        leading_zeros = __builtin_clzl(diff);
+    if (nelements_ % 2 == 0) {
+        prev_diff_ = diff;
+        prev_flag_ = flag;
+    } else {
+        // we're storing values by pairs to save space
+        unsigned char flags = (prev_flag_ << 4) | flag;
+        if (!stream_.put_raw(flags)) {
+            return false;
+        }
+        if (!encode_value(stream_, prev_diff_, prev_flag_)) {
+            return false;
+        }
+        if (!encode_value(stream_, diff, flag)) {
+            return false;
+        }
     }
+    nelements_++;
+    return true;
+}
 
-    int nbytes;
-    unsigned char flag;
+size_t FcmStreamWriter::size() const { return stream_.size(); }
 
-    if (trailing_zeros > leading_zeros) {
-        // this would be the case with low precision values
-        nbytes = 8 - trailing_zeros / 8;
-        if (nbytes > 0) {
-            nbytes--;
+bool FcmStreamWriter::commit() {
+    if (nelements_ % 2 != 0) {
+        // `input` contains odd number of values so we should use
+        // empty second value that will take one byte in output
+        unsigned char flags = prev_flag_ << 4;
+        if (!stream_.put_raw(flags)) {
+            return false;
         }
-        // 4th bit indicates that only leading bytes are stored
-        flag = 8 | (nbytes&7);
-    } else {
-        nbytes = 8 - leading_zeros / 8;
-        if (nbytes > 0) {
-            nbytes--;
+        if (!encode_value(stream_, prev_diff_, prev_flag_)) {
+            return false;
+        }
+        if (!encode_value(stream_, 0ull, 0)) {
+            return false;
         }
-        // zeroed 4th bit indicates that only trailing bytes are stored
-        flag = nbytes&7;
     }
+    return stream_.commit();
+}
+
+GorillaStreamWriter::GorillaStreamWriter(Base128StreamWriter& stream)
+    : stream_(stream)
+    , prev_bits_(0)
+    , prev_diff_(0)
+    , prev_flag_(0)
+    , nelements_(0)
+{
+}
+
+bool GorillaStreamWriter::tput(double const* values, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!put(values[i])) {
+            return false;
+        }
+    }
+    return commit();
+}
+
+bool GorillaStreamWriter::put(double value) {
+    union {
+        double real;
+        u64 bits;
+    } curr = {};
+    curr.real = value;
+    u64 diff = curr.bits ^ prev_bits_;
+    prev_bits_ = curr.bits;
+
+    unsigned char flag = choose_flag(diff);
 
     if (nelements_ % 2 == 0) {
         prev_diff_ = diff;
@@ -186,9 +401,9 @@ bool FcmStreamWriter::put(double value) {
     return true;
 }
 
-size_t FcmStreamWriter::size() const { return stream_.size(); }
+size_t GorillaStreamWriter::size() const { return stream_.size(); }
 
-bool FcmStreamWriter::commit() {
+bool GorillaStreamWriter::commit() {
     if (nelements_ % 2 != 0) {
         // `input` contains odd number of values so we should use
         // empty second value that will take one byte in output
@@ -206,6 +421,34 @@ bool FcmStreamWriter::commit() {
     return stream_.commit();
 }
 
+GorillaStreamReader::GorillaStreamReader(Base128StreamReader& stream)
+    : stream_(stream)
+    , prev_bits_(0)
+    , flags_(0)
+    , iter_(0)
+{
+}
+
+double GorillaStreamReader::next() {
+    unsigned char flag = 0;
+    if (iter_++ % 2 == 0) {
+        flags_ = static_cast<u32>(stream_.read_raw<u8>());
+        flag = static_cast<unsigned char>(flags_ >> 4);
+    } else {
+        flag = static_cast<unsigned char>(flags_ & 0xF);
+    }
+    u64 diff = decode_value(stream_, flag);
+    union {
+        u64 bits;
+        double real;
+    } curr = {};
+    curr.bits = prev_bits_ ^ diff;
+    prev_bits_ = curr.bits;
+    return curr.real;
+}
+
+const u8 *GorillaStreamReader::pos() const { return stream_.pos(); }
+
 size_t CompressionUtil::compress_doubles(std::vector<double> const& input,
                                          Base128StreamWriter&       wstream)
 {
@@ -468,6 +711,59 @@ aku_Status CompressionUtil::decode_chunk( UncompressedChunk   *header
     return AKU_SUCCESS;
 }
 
+aku_Status CompressionUtil::decode_chunk_timestamps( UncompressedChunk   *header
+                                                   , const unsigned char *pbegin
+                                                   , const unsigned char *pend
+                                                   , u32             nelements)
+{
+    try {
+        Base128StreamReader rstream(pbegin, pend);
+        // Skip paramids using the stream size prefix
+        u32 paramid_size = rstream.read_raw<u32>();
+        if (rstream.space_left() < paramid_size) {
+            return AKU_EBAD_DATA;
+        }
+        rstream.pos_ += paramid_size;
+
+        // Timestamps
+        read_from_stream<DeltaRLEReader>(rstream, [&](DeltaRLEReader& reader, u32 size) {
+            header->timestamps.reserve(nelements);
+            for (auto i = nelements; i--> 0;) {
+                auto timestamp = reader.next();
+                header->timestamps.push_back(timestamp);
+            }
+        });
+
+        // Values are not decoded at all
+    } catch (...) {
+        return AKU_EBAD_DATA;
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status CompressionUtil::decode_chunk_paramids( UncompressedChunk   *header
+                                                 , const unsigned char *pbegin
+                                                 , const unsigned char *pend
+                                                 , u32             nelements)
+{
+    try {
+        Base128StreamReader rstream(pbegin, pend);
+        // Paramids go first in the chunk
+        read_from_stream<DeltaRLEReader>(rstream, [&](DeltaRLEReader& reader, u32 size) {
+            header->paramids.reserve(nelements);
+            for (auto i = nelements; i --> 0;) {
+                auto paramid = reader.next();
+                header->paramids.push_back(paramid);
+            }
+        });
+
+        // Timestamps and values are not decoded at all
+    } catch (...) {
+        return AKU_EBAD_DATA;
+    }
+    return AKU_SUCCESS;
+}
+
 template<class Fn>
 bool reorder_chunk_header(UncompressedChunk const& header, UncompressedChunk* out, Fn const& f) {
     auto len = header.timestamps.size();
@@ -511,24 +807,116 @@ bool CompressionUtil::convert_from_time_order(UncompressedChunk const& header, U
 
 namespace StorageEngine {
 
+/** Compile-time specialized encode pipelines. Each codec combination is
+  * fully instantiated so the template-composed stack inlines end-to-end
+  * and the inner loop carries no per-value or per-chunk dispatch - the
+  * specialization is picked once per block when the writer is created.
+  */
+template<int TsCodec> struct TsChunkPipeline;
+
+template<> struct TsChunkPipeline<TS_CODEC_DELTA_RLE> {
+    static bool tput(DataBlockWriter* w) {
+        return w->ts_stream_.tput(w->ts_writebuf_, DataBlockWriter::CHUNK_SIZE);
+    }
+};
+
+template<> struct TsChunkPipeline<TS_CODEC_DELTA_GV> {
+    static bool tput(DataBlockWriter* w) {
+        return w->ts_gv_stream_.tput(w->ts_writebuf_, DataBlockWriter::CHUNK_SIZE);
+    }
+};
+
+template<int ValCodec> struct ValChunkPipeline;
+
+template<> struct ValChunkPipeline<VAL_CODEC_FCM> {
+    static bool tput(DataBlockWriter* w) {
+        return w->val_stream_.tput(w->val_writebuf_, DataBlockWriter::CHUNK_SIZE);
+    }
+};
+
+template<> struct ValChunkPipeline<VAL_CODEC_GORILLA> {
+    static bool tput(DataBlockWriter* w) {
+        return w->val_gor_stream_.tput(w->val_writebuf_, DataBlockWriter::CHUNK_SIZE);
+    }
+};
+
+template<> struct ValChunkPipeline<VAL_CODEC_RLE> {
+    static bool tput(DataBlockWriter* w) {
+        // store raw double bits, constant runs collapse to (count, value)
+        u64 bits[DataBlockWriter::CHUNK_SIZE];
+        memcpy(bits, w->val_writebuf_, sizeof(bits));
+        return w->val_rle_stream_.tput(bits, DataBlockWriter::CHUNK_SIZE);
+    }
+};
+
+template<> struct ValChunkPipeline<VAL_CODEC_FIXED> {
+    static bool tput(DataBlockWriter* w) {
+        // Integer view of integral doubles (codec is only selected when
+        // every value of the series round-trips through i64 exactly).
+        i64 ints[DataBlockWriter::CHUNK_SIZE];
+        for (int i = 0; i < DataBlockWriter::CHUNK_SIZE; i++) {
+            ints[i] = static_cast<i64>(w->val_writebuf_[i]);
+        }
+        return w->val_fixed_stream_.tput(ints, DataBlockWriter::CHUNK_SIZE);
+    }
+};
+
+template<int TsCodec, int ValCodec>
+static bool encode_chunk_pipeline(DataBlockWriter* w) {
+    return TsChunkPipeline<TsCodec>::tput(w) && ValChunkPipeline<ValCodec>::tput(w);
+}
+
+//! Select the pipeline specialization for the codec pair (called once per block).
+static bool (*select_chunk_pipeline(int ts_codec, int val_codec))(DataBlockWriter*) {
+    if (ts_codec == TS_CODEC_DELTA_GV) {
+        switch (val_codec) {
+        case VAL_CODEC_GORILLA: return &encode_chunk_pipeline<TS_CODEC_DELTA_GV, VAL_CODEC_GORILLA>;
+        case VAL_CODEC_RLE:     return &encode_chunk_pipeline<TS_CODEC_DELTA_GV, VAL_CODEC_RLE>;
+        case VAL_CODEC_FIXED:   return &encode_chunk_pipeline<TS_CODEC_DELTA_GV, VAL_CODEC_FIXED>;
+        default:                return &encode_chunk_pipeline<TS_CODEC_DELTA_GV, VAL_CODEC_FCM>;
+        }
+    }
+    switch (val_codec) {
+    case VAL_CODEC_GORILLA: return &encode_chunk_pipeline<TS_CODEC_DELTA_RLE, VAL_CODEC_GORILLA>;
+    case VAL_CODEC_RLE:     return &encode_chunk_pipeline<TS_CODEC_DELTA_RLE, VAL_CODEC_RLE>;
+    case VAL_CODEC_FIXED:   return &encode_chunk_pipeline<TS_CODEC_DELTA_RLE, VAL_CODEC_FIXED>;
+    default:                return &encode_chunk_pipeline<TS_CODEC_DELTA_RLE, VAL_CODEC_FCM>;
+    }
+}
+
 DataBlockWriter::DataBlockWriter()
     : stream_(nullptr, nullptr)
     , ts_stream_(stream_)
+    , ts_gv_stream_(stream_)
     , val_stream_(stream_)
+    , val_gor_stream_(stream_)
+    , val_rle_stream_(stream_)
+    , val_fixed_stream_(stream_)
+    , ts_codec_(TS_CODEC_DELTA_RLE)
+    , val_codec_(VAL_CODEC_FCM)
+    , chunk_pipeline_(select_chunk_pipeline(TS_CODEC_DELTA_RLE, VAL_CODEC_FCM))
     , write_index_(0)
     , nchunks_(nullptr)
     , ntail_(nullptr)
 {
 }
 
-DataBlockWriter::DataBlockWriter(aku_ParamId id, u8 *buf, int size)
+DataBlockWriter::DataBlockWriter(aku_ParamId id, u8 *buf, int size, int ts_codec, int val_codec)
     : stream_(buf, buf + size)
     , ts_stream_(stream_)
+    , ts_gv_stream_(stream_)
     , val_stream_(stream_)
+    , val_gor_stream_(stream_)
+    , val_rle_stream_(stream_)
+    , val_fixed_stream_(stream_)
+    , ts_codec_(ts_codec)
+    , val_codec_(val_codec)
+    , chunk_pipeline_(select_chunk_pipeline(ts_codec, val_codec))
     , write_index_(0)
 {
     // offset 0
-    auto success = stream_.put_raw<u16>(AKUMULI_VERSION);
+    auto success = stream_.put_raw<u16>(AKUMULI_VERSION | static_cast<u16>(ts_codec << 8) |
+                                        static_cast<u16>(val_codec << 12));
     // offset 2
     nchunks_ = stream_.allocate<u16>();
     // offset 4
@@ -550,12 +938,11 @@ aku_Status DataBlockWriter::put(aku_Timestamp ts, double value) {
         val_writebuf_[write_index_ & CHUNK_MASK] = value;
         write_index_++;
         if ((write_index_ & CHUNK_MASK) == 0) {
-            // put timestamps
-            if (ts_stream_.tput(ts_writebuf_, CHUNK_SIZE)) {
-                if (val_stream_.tput(val_writebuf_, CHUNK_SIZE)) {
-                    *nchunks_ += 1;
-                    return AKU_SUCCESS;
-                }
+            // Timestamps and values go through the pipeline instantiated
+            // for the codec pair of this block.
+            if (chunk_pipeline_(this)) {
+                *nchunks_ += 1;
+                return AKU_SUCCESS;
             }
             // Content of the write buffer was lost, this can happen only if `room_for_chunk`
             // function estimates required space incorrectly.
@@ -609,10 +996,43 @@ size_t DataBlockWriter::commit() {
     return stream_.size();
 }
 
+int DataBlockWriter::select_val_codec(const double* sample, size_t n) {
+    u8 scratch[2048];
+    Base128StreamWriter fcm_stream(scratch, scratch + sizeof(scratch));
+    FcmStreamWriter fcm_writer(fcm_stream);
+    if (!fcm_writer.tput(sample, n)) {
+        // sample is too large, fall back to default
+        return VAL_CODEC_FCM;
+    }
+    Base128StreamWriter gor_stream(scratch, scratch + sizeof(scratch));
+    GorillaStreamWriter gor_writer(gor_stream);
+    size_t fcm_size = fcm_stream.size();
+    if (!gor_writer.tput(sample, n)) {
+        return VAL_CODEC_FCM;
+    }
+    Base128StreamWriter rle_stream(scratch, scratch + sizeof(scratch));
+    RLEStreamWriter<u64> rle_writer(rle_stream);
+    size_t gor_size = gor_stream.size();
+    std::vector<u64> bits(n);
+    memcpy(bits.data(), sample, n*sizeof(u64));
+    if (!rle_writer.tput(bits.data(), n)) {
+        return VAL_CODEC_FCM;
+    }
+    size_t rle_size = rle_stream.size();
+    if (rle_size < fcm_size && rle_size < gor_size) {
+        return VAL_CODEC_RLE;
+    }
+    return gor_size < fcm_size ? VAL_CODEC_GORILLA : VAL_CODEC_FCM;
+}
+
 bool DataBlockWriter::room_for_chunk() const {
-    static const size_t MARGIN = 10*16 + 9*16;  // worst case
+    static const size_t TS_MARGIN = 10*16;  // worst case
+    // RLE over raw double bits can take up to 11 bytes per distinct value,
+    // zigzagged i64 deltas take up to 10+1 bytes when the values jump around
+    const size_t val_margin =
+        (val_codec_ == VAL_CODEC_RLE || val_codec_ == VAL_CODEC_FIXED) ? 11*16 : 9*16;
     auto free_space = stream_.space_left();
-    if (free_space < MARGIN) {
+    if (free_space < TS_MARGIN + val_margin) {
         return false;
     }
     return true;
@@ -648,7 +1068,13 @@ DataBlockReader::DataBlockReader(u8 const* buf, size_t bufsize)
     : begin_(buf)
     , stream_(buf + DataBlockWriter::HEADER_SIZE, buf + bufsize)
     , ts_stream_(stream_)
+    , ts_gv_stream_(stream_)
     , val_stream_(stream_)
+    , val_gor_stream_(stream_)
+    , val_rle_stream_(stream_)
+    , val_fixed_stream_(stream_)
+    , ts_codec_((*reinterpret_cast<const u16*>(buf) >> 8) & 0xF)
+    , val_codec_(*reinterpret_cast<const u16*>(buf) >> 12)
     , read_buffer_{}
     , read_index_(0)
 {
@@ -656,7 +1082,7 @@ DataBlockReader::DataBlockReader(u8 const* buf, size_t bufsize)
 }
 
 static u16 get_block_version(const u8* pdata) {
-    u16 version = *reinterpret_cast<const u16*>(pdata);
+    u16 version = *reinterpret_cast<const u16*>(pdata) & 0xFF;
     return version;
 }
 
@@ -682,10 +1108,26 @@ std::tuple<aku_Status, aku_Timestamp, double> DataBlockReader::next() {
         if (chunk_index == 0) {
             // read all timestamps
             for (int i = 0; i < CHUNK_SIZE; i++) {
-                read_buffer_[i] = ts_stream_.next();
+                read_buffer_[i] = ts_codec_ == TS_CODEC_DELTA_GV ? ts_gv_stream_.next()
+                                                                 : ts_stream_.next();
             }
         }
-        double value = val_stream_.next();
+        double value;
+        switch (val_codec_) {
+        case VAL_CODEC_GORILLA:
+            value = val_gor_stream_.next();
+            break;
+        case VAL_CODEC_RLE: {
+            u64 bits = val_rle_stream_.next();
+            memcpy(&value, &bits, sizeof(value));
+            break;
+        }
+        case VAL_CODEC_FIXED:
+            value = static_cast<double>(val_fixed_stream_.next());
+            break;
+        default:
+            value = val_stream_.next();
+        }
         return std::make_tuple(AKU_SUCCESS, read_buffer_[chunk_index], value);
     } else {
         // handle tail values
@@ -711,6 +1153,14 @@ u16 DataBlockReader::version() const {
     return get_block_version(begin_);
 }
 
+int DataBlockReader::ts_codec() const {
+    return ts_codec_;
+}
+
+int DataBlockReader::val_codec() const {
+    return val_codec_;
+}
+
 }
 
 }
@@ -25,6 +25,7 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <stdexcept>
 #include <vector>
@@ -149,8 +150,31 @@ struct Base128StreamWriter {
     bool empty() const { return begin_ == end_; }
 
     /** Put value into stream (transactional).
+      * If the worst-case encoded size of the whole batch fits into the
+      * stream the values are encoded with unchecked writes, otherwise the
+      * checked per-value path is taken.
       */
     template <class TVal> bool tput(TVal const* iter, size_t n) {
+        const size_t WORST_CASE = (sizeof(TVal) * 8 + 6) / 7;
+        if (space_left() >= n * WORST_CASE) {
+            // fast path - no per-value bounds checks needed
+            unsigned char* p = pos_;
+            for (size_t i = 0; i < n; i++) {
+                TVal value = iter[i];
+                while (true) {
+                    *p = value & 0x7F;
+                    value >>= 7;
+                    if (value != 0) {
+                        *p++ |= 0x80;
+                    } else {
+                        p++;
+                        break;
+                    }
+                }
+            }
+            pos_ = p;
+            return commit();  // no-op
+        }
         auto oldpos = pos_;
         for (size_t i = 0; i < n; i++) {
             if (!put(iter[i])) {
@@ -224,6 +248,35 @@ struct Base128StreamReader {
         return static_cast<TVal>(value);
     }
 
+    /** Read `n` values from the stream (bulk counterpart of `next`).
+      * Per-byte bounds checks are skipped when the worst-case encoded size
+      * of the whole batch is available in the stream.
+      */
+    template <class TVal> void next_n(TVal* output, size_t n) {
+        const size_t WORST_CASE = (sizeof(TVal) * 8 + 6) / 7;
+        if (space_left() >= n * WORST_CASE) {
+            const unsigned char* p = pos_;
+            for (size_t i = 0; i < n; i++) {
+                auto acc = TVal();
+                int  cnt = 0;
+                while (true) {
+                    auto x = static_cast<unsigned char>(*p & 0x7F);
+                    acc |= TVal(x) << cnt;
+                    if ((*p++ & 0x80) == 0) {
+                        break;
+                    }
+                    cnt += 7;
+                }
+                output[i] = acc;
+            }
+            pos_ = p;
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            output[i] = next<TVal>();
+        }
+    }
+
     //! Read uncompressed value from stream
     template <class TVal> TVal read_raw() {
         size_t sz = sizeof(TVal);
@@ -240,6 +293,30 @@ struct Base128StreamReader {
     const unsigned char* pos() const { return pos_; }
 };
 
+/** In-place zigzag transform of the whole array (maps signed values to
+  * unsigned ones before the varint stage). Generic version is scalar.
+  */
+template <typename TVal> void zigzag_encode(TVal* xs, size_t n) {
+    const int shift_width = sizeof(TVal) * 8 - 1;
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = static_cast<TVal>((xs[i] << 1) ^ (xs[i] >> shift_width));
+    }
+}
+
+//! Inverse of `zigzag_encode` (same expression the scalar reader uses).
+template <typename TVal> void zigzag_decode(TVal* xs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = static_cast<TVal>((xs[i] >> 1) ^ (-(xs[i] & 1)));
+    }
+}
+
+/** Vectorized zigzag transforms (the shift/xor runs over four lanes with
+  * AVX2). Dispatches to the vector kernel at runtime if CPU supports it,
+  * falls back to scalar code otherwise.
+  */
+void zigzag_encode(i64* xs, size_t n);
+void zigzag_decode(i64* xs, size_t n);
+
 template <class Stream, class TVal> struct ZigZagStreamWriter {
     Stream stream_;
 
@@ -249,13 +326,8 @@ template <class Stream, class TVal> struct ZigZagStreamWriter {
     bool tput(TVal const* iter, size_t n) {
         assert(n < 1000);  // 1000 is too high for most uses but it woun't cause stack overflow
         TVal outbuf[n];
-        memset(outbuf, 0, n);
-        for (size_t i = 0; i < n; i++) {
-            auto      value       = iter[i];
-            const int shift_width = sizeof(TVal) * 8 - 1;
-            auto      res         = (value << 1) ^ (value >> shift_width);
-            outbuf[i]             = res;
-        }
+        memcpy(outbuf, iter, n * sizeof(TVal));
+        zigzag_encode(outbuf, n);
         return stream_.tput(outbuf, n);
     }
 
@@ -340,15 +412,18 @@ template <class Stream, typename TVal> struct DeltaStreamReader {
 template <size_t Step, typename TVal> struct DeltaDeltaStreamWriter {
     Base128StreamWriter& stream_;
     TVal                 prev_;
-    int                  put_calls_;
+    //! Values staged by `put`, flushed through `tput` on the frame boundary.
+    TVal                 staged_[Step];
+    u32                  nstaged_;
 
     DeltaDeltaStreamWriter(Base128StreamWriter& stream)
         : stream_(stream)
         , prev_()
-        , put_calls_(0) {}
+        , nstaged_(0) {}
 
     bool tput(TVal const* iter, size_t n) {
         assert(n == Step);
+        assert(nstaged_ == 0);  // `put` and `tput` can't be mixed mid-frame
         TVal outbuf[n];
         memset(outbuf, 0, n);
         for (size_t i = 0; i < n; i++) {
@@ -371,25 +446,59 @@ template <size_t Step, typename TVal> struct DeltaDeltaStreamWriter {
         return stream_.tput(outbuf, n);
     }
 
+    /** Stage one value. A completed frame is flushed through `tput` so
+      * single-value writers get the same array-at-a-time encode path
+      * (and the same on-stream format) as the bulk one.
+      * @note staged values are not reflected by `size` until the frame
+      *       is complete or `commit` is called.
+      */
     bool put(TVal value) {
-        bool success = false;
-        if (put_calls_ == 0) {
-            success = stream_.put(0);
-            if (!success) {
-                return false;
-            }
+        staged_[nstaged_++] = value;
+        if (nstaged_ == Step) {
+            nstaged_ = 0;
+            return tput(staged_, Step);
         }
-        put_calls_++;
-        success = stream_.put(value - prev_);
-        prev_   = value;
-        return success;
+        return true;
     }
 
     size_t size() const { return stream_.size(); }
 
-    bool commit() { return stream_.commit(); }
+    bool commit() {
+        // Incomplete trailing frame is stored with zero min so the reader
+        // doesn't have to distinguish it from a full one.
+        if (nstaged_ != 0) {
+            if (!stream_.put(static_cast<TVal>(0))) {
+                return false;
+            }
+            for (u32 i = 0; i < nstaged_; i++) {
+                if (!stream_.put(staged_[i] - prev_)) {
+                    return false;
+                }
+                prev_ = staged_[i];
+            }
+            nstaged_ = 0;
+        }
+        return stream_.commit();
+    }
 };
 
+/** Compute running sum of `(xs[i] + min)` values in place, seeded with `prev`.
+  * This is the inverse of the delta-delta transform applied by
+  * `DeltaDeltaStreamWriter::tput` to a whole frame of values.
+  */
+template <typename TVal> void delta_delta_prefix_sum(TVal* xs, size_t n, TVal prev, TVal min) {
+    for (size_t i = 0; i < n; i++) {
+        prev += xs[i] + min;
+        xs[i] = prev;
+    }
+}
+
+/** Vectorized version of the prefix sum (the hot path of timestamp decoding).
+  * Dispatches to SSE4/AVX2 kernel at runtime if CPU supports it,
+  * falls back to scalar code otherwise.
+  */
+void delta_delta_prefix_sum(u64* xs, size_t n, u64 prev, u64 min);
+
 template <size_t Step, typename TVal> struct DeltaDeltaStreamReader {
     Base128StreamReader& stream_;
     TVal                 prev_;
@@ -414,6 +523,22 @@ template <size_t Step, typename TVal> struct DeltaDeltaStreamReader {
         return value;
     }
 
+    /** Decode whole `Step` sized frame at once.
+      * Method can be called only on a frame boundary (after construction
+      * or after the whole number of frames was read through `next`).
+      * @param output Output buffer, should be large enough to store `Step` values.
+      */
+    void read_frame(TVal* output) {
+        assert(counter_ % Step == 0);
+        min_ = stream_.next<TVal>();
+        for (size_t i = 0; i < Step; i++) {
+            output[i] = stream_.next<TVal>();
+        }
+        delta_delta_prefix_sum(output, Step, prev_, min_);
+        prev_ = output[Step - 1];
+        counter_ += Step;
+    }
+
     const unsigned char* pos() const { return stream_.pos(); }
 };
 
@@ -503,6 +628,141 @@ template <typename TVal> struct RLEStreamReader {
     const unsigned char* pos() const { return stream_.pos(); }
 };
 
+/** Group-varint encoder.
+  * Values are stored in groups of four. Each group is prefixed with two
+  * control bytes that hold four 4-bit length nibbles (length-1, in bytes),
+  * so the decoder reads lengths without per-byte branching.
+  */
+struct GroupVarintStreamWriter {
+    enum { GROUP_SIZE = 4 };
+    Base128StreamWriter& stream_;
+    u64                  buffer_[GROUP_SIZE];
+    int                  count_;
+
+    GroupVarintStreamWriter(Base128StreamWriter& stream)
+        : stream_(stream)
+        , buffer_{}
+        , count_(0) {}
+
+    /** Transactional chunk write. Chunk is flushed to the stream completely
+      * so interleaved writers can share the stream (`n` should be a multiple
+      * of `GROUP_SIZE`, otherwise the last group gets zero-padded).
+      */
+    bool tput(u64 const* iter, size_t n) {
+        // unwind both the stream and the write buffer on failure
+        auto oldpos = stream_.pos_;
+        auto oldcnt = count_;
+        u64  oldbuf[GROUP_SIZE];
+        std::copy(buffer_, buffer_ + GROUP_SIZE, oldbuf);
+        for (size_t i = 0; i < n; i++) {
+            if (!put(iter[i])) {
+                stream_.pos_ = oldpos;
+                count_       = oldcnt;
+                std::copy(oldbuf, oldbuf + GROUP_SIZE, buffer_);
+                return false;
+            }
+        }
+        if (!flush()) {
+            stream_.pos_ = oldpos;
+            count_       = oldcnt;
+            std::copy(oldbuf, oldbuf + GROUP_SIZE, buffer_);
+            return false;
+        }
+        return true;
+    }
+
+    bool put(u64 value) {
+        if (count_ == GROUP_SIZE) {
+            if (!flush()) {
+                return false;
+            }
+        }
+        buffer_[count_++] = value;
+        return true;
+    }
+
+    size_t size() const { return stream_.size(); }
+
+    //! Flush leftover values (incomplete group is zero-padded)
+    bool commit() { return flush() && stream_.commit(); }
+
+private:
+    static int nbytes(u64 value) { return value == 0 ? 1 : 8 - __builtin_clzl(value) / 8; }
+
+    bool flush() {
+        if (count_ == 0) {
+            return true;
+        }
+        auto oldpos = stream_.pos_;
+        u16  ctrl   = 0;
+        for (int i = 0; i < GROUP_SIZE; i++) {
+            u64 value = i < count_ ? buffer_[i] : 0ull;
+            ctrl |= static_cast<u16>(nbytes(value) - 1) << (4 * i);
+        }
+        if (!stream_.put_raw(ctrl)) {
+            return false;
+        }
+        for (int i = 0; i < GROUP_SIZE; i++) {
+            u64 value = i < count_ ? buffer_[i] : 0ull;
+            int len   = nbytes(value);
+            if (stream_.space_left() < static_cast<size_t>(len)) {
+                stream_.pos_ = oldpos;
+                return false;
+            }
+            memcpy(stream_.pos_, &value, static_cast<size_t>(len));
+            stream_.pos_ += len;
+        }
+        count_ = 0;
+        return true;
+    }
+};
+
+//! Group-varint decoder
+struct GroupVarintStreamReader {
+    enum { GROUP_SIZE = 4 };
+    Base128StreamReader& stream_;
+    u64                  buffer_[GROUP_SIZE];
+    int                  pos_;
+
+    GroupVarintStreamReader(Base128StreamReader& stream)
+        : stream_(stream)
+        , buffer_{}
+        , pos_(GROUP_SIZE) {}
+
+    u64 next() {
+        if (pos_ == GROUP_SIZE) {
+            refill();
+        }
+        return buffer_[pos_++];
+    }
+
+    const unsigned char* pos() const { return stream_.pos(); }
+
+private:
+    void refill() {
+        u16 ctrl = stream_.read_raw<u16>();
+        for (int i = 0; i < GROUP_SIZE; i++) {
+            size_t len = ((ctrl >> (4 * i)) & 0xF) + 1u;
+            if (stream_.space_left() < len) {
+                AKU_PANIC("can't read group-varint, out of bounds");
+            }
+            u64 value = 0;
+            if (stream_.space_left() >= 8) {
+                // fast path - unaligned 8-byte load masked by length
+                memcpy(&value, stream_.pos_, 8);
+                if (len != 8) {
+                    value &= (1ull << (len * 8)) - 1;
+                }
+            } else {
+                memcpy(&value, stream_.pos_, len);
+            }
+            stream_.pos_ += len;
+            buffer_[i] = value;
+        }
+        pos_ = 0;
+    }
+};
+
 struct FcmPredictor {
     std::vector<u64> table;
     u64              last_hash;
@@ -562,6 +822,97 @@ struct FcmStreamReader {
     const u8* pos() const;
 };
 
+/** Gorilla-style double encoder (XOR with previous value).
+  * Uses the same byte-aligned diff encoding as `FcmStreamWriter` but predicts
+  * each value with the previous one instead of an FCM table, so the decoder
+  * state is a single u64 (FCM tables blow the L1 cache when many series are
+  * decoded interleaved).
+  */
+struct GorillaStreamWriter {
+    Base128StreamWriter& stream_;
+    u64                  prev_bits_;
+    u64                  prev_diff_;
+    unsigned char        prev_flag_;
+    int                  nelements_;
+
+    GorillaStreamWriter(Base128StreamWriter& stream);
+
+    bool tput(double const* values, size_t n);
+
+    bool put(double value);
+
+    size_t size() const;
+
+    bool commit();
+};
+
+struct GorillaStreamReader {
+    Base128StreamReader& stream_;
+    u64                  prev_bits_;
+    u32                  flags_;
+    u32                  iter_;
+
+    GorillaStreamReader(Base128StreamReader& stream);
+
+    double next();
+
+    const u8* pos() const;
+};
+
+
+/** Structure-of-arrays view over decoded data.
+  * Batch doesn't own the columns - the decoded chunk (or leaf read buffer)
+  * stays the only copy of the data. Cursors can hand the batch to the query
+  * pipeline as is, and vectorized operators (PAA, aggregations) can run
+  * directly over the columns without re-assembling aku_Sample records.
+  */
+struct SampleBatch {
+    const aku_Timestamp* timestamps;
+    //! Per-row series ids, can be null if all rows belong to `shared_paramid`
+    const aku_ParamId*   paramids;
+    const double*        values;
+    //! Series id used when `paramids` is null
+    aku_ParamId          shared_paramid;
+    //! Number of rows
+    size_t               size;
+
+    SampleBatch()
+        : timestamps(nullptr)
+        , paramids(nullptr)
+        , values(nullptr)
+        , shared_paramid(0)
+        , size(0) {}
+
+    //! Create view over decoded chunk columns
+    SampleBatch(const UncompressedChunk& chunk)
+        : timestamps(chunk.timestamps.data())
+        , paramids(chunk.paramids.data())
+        , values(chunk.values.data())
+        , shared_paramid(0)
+        , size(chunk.timestamps.size()) {}
+
+    //! Create view over single-series timestamp/value columns
+    SampleBatch(aku_ParamId id, const aku_Timestamp* ts, const double* xs, size_t n)
+        : timestamps(ts)
+        , paramids(nullptr)
+        , values(xs)
+        , shared_paramid(id)
+        , size(n) {}
+
+    //! Return series id of the i-th row
+    aku_ParamId paramid_at(size_t i) const { return paramids ? paramids[i] : shared_paramid; }
+
+    //! Materialize single row as aku_Sample (for non-vectorized consumers)
+    aku_Sample sample_at(size_t i) const {
+        aku_Sample result = {};
+        result.timestamp         = timestamps[i];
+        result.paramid           = paramid_at(i);
+        result.payload.type      = AKU_PAYLOAD_FLOAT;
+        result.payload.float64   = values[i];
+        result.payload.size      = sizeof(aku_Sample);
+        return result;
+    }
+};
 
 //! SeriesSlice represents consiquent data points from one series
 struct SeriesSlice {
@@ -603,6 +954,33 @@ struct CompressionUtil {
     static aku_Status decode_chunk(UncompressedChunk* header, const unsigned char* pbegin,
                                    const unsigned char* pend, u32 nelements);
 
+    /** Decode only the timestamp stream of the chunk.
+      * Paramids are skipped using the stream size prefix and value decoding
+      * is not performed at all, so count/exists style queries that only need
+      * cardinality and time bounds don't pay for FCM decompression.
+      * @param header out header (only `timestamps` is filled)
+      * @param pbegin begining of the data
+      * @param pend end of the data
+      * @param nelements number of elements in the chunk
+      */
+    static aku_Status decode_chunk_timestamps(UncompressedChunk* header,
+                                              const unsigned char* pbegin,
+                                              const unsigned char* pend, u32 nelements);
+
+    /** Decode only the paramid stream of the chunk.
+      * The id stream goes first so nothing has to be skipped, timestamps
+      * and values are not touched. Used to probe whether a chunk contains
+      * any of the series a query is interested in before paying for the
+      * full decode.
+      * @param header out header (only `paramids` is filled)
+      * @param pbegin begining of the data
+      * @param pend end of the data
+      * @param nelements number of elements in the chunk
+      */
+    static aku_Status decode_chunk_paramids(UncompressedChunk* header,
+                                            const unsigned char* pbegin,
+                                            const unsigned char* pend, u32 nelements);
+
     /** Compress list of doubles.
       * @param input array of doubles
       * @param params array of parameter ids
@@ -654,9 +1032,39 @@ typedef DeltaStreamWriter<RLEStreamWriter<u64>, u64> DeltaRLEWriter;
 // Base128 -> RLE -> Delta -> u64
 typedef DeltaStreamReader<RLEStreamReader<u64>, u64> DeltaRLEReader;
 
+// u64 -> Delta -> GroupVarint
+typedef DeltaStreamWriter<GroupVarintStreamWriter, u64> DeltaGVWriter;
+// GroupVarint -> Delta -> u64
+typedef DeltaStreamReader<GroupVarintStreamReader, u64> DeltaGVReader;
+
 
 namespace StorageEngine {
 
+/** Timestamp codec used by the data block.
+  * The value is stored in the high byte of the version field
+  * so old blocks (high byte is zero) read as TS_CODEC_DELTA_RLE.
+  */
+enum DataBlockTsCodec {
+    TS_CODEC_DELTA_RLE = 0,  //< Delta + RLE + LEB128 (default)
+    TS_CODEC_DELTA_GV  = 1,  //< Delta + group-varint
+};
+
+/** Value codec used by the data block.
+  * The value is stored in the top four bits of the version field
+  * so old blocks read as VAL_CODEC_FCM.
+  */
+enum DataBlockValCodec {
+    VAL_CODEC_FCM     = 0,  //< FCM predictor (default)
+    VAL_CODEC_GORILLA = 1,  //< XOR with previous value
+    VAL_CODEC_RLE     = 2,  //< Run-length encoded (value, count) pairs
+    /** Delta + zigzag + RLE + LEB128 over the integer view of the values.
+      * For integral series (latency counters in microseconds etc) this
+      * beats the double pipelines by a wide margin - should only be used
+      * when every value of the block round-trips through i64 exactly.
+      */
+    VAL_CODEC_FIXED   = 3,
+};
+
 struct DataBlockWriter {
     enum {
         CHUNK_SIZE  = 16,
@@ -665,7 +1073,19 @@ struct DataBlockWriter {
     };
     Base128StreamWriter stream_;
     DeltaRLEWriter      ts_stream_;
+    DeltaGVWriter       ts_gv_stream_;
     FcmStreamWriter     val_stream_;
+    GorillaStreamWriter val_gor_stream_;
+    RLEStreamWriter<u64> val_rle_stream_;
+    ZDeltaRLEWriter     val_fixed_stream_;
+    int                 ts_codec_;
+    int                 val_codec_;
+    /** Chunk encoder instantiated for the selected codec pair. The
+      * combination is resolved once per block in the c-tor so the
+      * steady-state encode loop runs a fully inlined pipeline without
+      * per-chunk codec branches.
+      */
+    bool                (*chunk_pipeline_)(DataBlockWriter*);
     int                 write_index_;
     aku_Timestamp       ts_writebuf_[CHUNK_SIZE];   //! Write buffer for timestamps
     double              val_writebuf_[CHUNK_SIZE];  //! Write buffer for values
@@ -679,8 +1099,19 @@ struct DataBlockWriter {
       * @param id Series id.
       * @param size Block size.
       * @param buf Pointer to buffer.
+      * @param ts_codec Timestamp codec (one of `DataBlockTsCodec` values).
+      * @param val_codec Value codec (one of `DataBlockValCodec` values).
+      */
+    DataBlockWriter(aku_ParamId id, u8* buf, int size, int ts_codec = TS_CODEC_DELTA_RLE,
+                    int val_codec = VAL_CODEC_FCM);
+
+    /** Choose value codec by compressing a sampled prefix of the data
+      * with each codec and picking the one that produces smaller output.
+      * @param sample Pointer to the array of values.
+      * @param n Sample size (should be small, e.g. one chunk).
+      * @return one of `DataBlockValCodec` values
       */
-    DataBlockWriter(aku_ParamId id, u8* buf, int size);
+    static int select_val_codec(const double* sample, size_t n);
 
     /** Append value to block.
       * @param ts Timestamp.
@@ -710,7 +1141,13 @@ struct DataBlockReader {
     const u8*           begin_;
     Base128StreamReader stream_;
     DeltaRLEReader      ts_stream_;
+    DeltaGVReader       ts_gv_stream_;
     FcmStreamReader     val_stream_;
+    GorillaStreamReader val_gor_stream_;
+    RLEStreamReader<u64> val_rle_stream_;
+    ZDeltaRLEReader     val_fixed_stream_;
+    int                 ts_codec_;
+    int                 val_codec_;
     aku_Timestamp       read_buffer_[CHUNK_SIZE];
     u32                 read_index_;
 
@@ -723,6 +1160,12 @@ struct DataBlockReader {
     aku_ParamId get_id() const;
 
     u16 version() const;
+
+    //! Return timestamp codec used by the block (one of `DataBlockTsCodec` values)
+    int ts_codec() const;
+
+    //! Return value codec used by the block (one of `DataBlockValCodec` values)
+    int val_codec() const;
 };
 
 }  // namespace V2
@@ -18,6 +18,12 @@
 // C++
 #include <iostream>  // For debug print fn.
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 #include <vector>
 #include <sstream>
 
@@ -26,9 +32,12 @@
 
 // App
 #include "nbtree.h"
+#include "akumuli_tracepoints.h"
 #include "akumuli_version.h"
 #include "status_util.h"
 #include "log_iface.h"
+#include "search.h"
+#include "stage_profiler.h"
 
 
 namespace Akumuli {
@@ -42,39 +51,82 @@ static SubtreeRef const* subtree_cast(u8 const* p) {
     return reinterpret_cast<SubtreeRef const*>(p);
 }
 
-static std::tuple<aku_Status, std::shared_ptr<Block>> read_and_check(std::shared_ptr<BlockStore> bstore, LogicAddr curr) {
+/** SoA index of the superblock's children. Stored in the block right after
+  * the full-sized refs (header ref + AKU_NBTREE_FANOUT child refs) and
+  * mirrors their hot fields. The descent probes `begin`/`end`/`addr` of
+  * every child, so keeping them in dense arrays turns the probe into a
+  * couple of adjacent cache line reads instead of a walk over the whole
+  * payload.
+  */
+struct SubtreeRefIndex {
+    aku_Timestamp begin[AKU_NBTREE_FANOUT];
+    aku_Timestamp end[AKU_NBTREE_FANOUT];
+    LogicAddr     addr[AKU_NBTREE_FANOUT];
+} __attribute__((packed));
+
+static_assert(sizeof(SubtreeRef) * (AKU_NBTREE_FANOUT + 1) + sizeof(SubtreeRefIndex) <= AKU_BLOCK_SIZE,
+              "SoA index doesn't fit into the superblock");
+
+static SubtreeRefIndex* subtree_index_cast(u8* p) {
+    return reinterpret_cast<SubtreeRefIndex*>(p + sizeof(SubtreeRef) * (AKU_NBTREE_FANOUT + 1));
+}
+
+static SubtreeRefIndex const* subtree_index_cast(u8 const* p) {
+    return reinterpret_cast<SubtreeRefIndex const*>(p + sizeof(SubtreeRef) * (AKU_NBTREE_FANOUT + 1));
+}
+
+static std::tuple<aku_Status, std::shared_ptr<Block>> read_and_check(std::shared_ptr<BlockStore> bstore, LogicAddr curr,
+                                                                     ReadHint hint = ReadHint::LOOKUP) {
     aku_Status status;
     std::shared_ptr<Block> block;
-    std::tie(status, block) = bstore->read_block(curr);
+    std::tie(status, block) = bstore->read_block(curr, hint);
     if (status != AKU_SUCCESS) {
         return std::tie(status, block);
     }
     // Check consistency (works with both inner and leaf nodes).
-    u8 const* data = block->get_data();
-    SubtreeRef const* subtree = subtree_cast(data);
-    u32 crc = bstore->checksum(data + sizeof(SubtreeRef), subtree->payload_size);
-    if (crc != subtree->checksum) {
+    // In async verification mode the block is returned right away and mismatch
+    // is reported by the blockstore with a small delay.
+    SubtreeRef const* subtree = subtree_cast(block->get_data());
+    if (sizeof(SubtreeRef) + subtree->payload_size > AKU_BLOCK_SIZE) {
+        // Large leaf - payload continues in the consecutive blocks
+        u32 nblocks = static_cast<u32>((sizeof(SubtreeRef) + subtree->payload_size + AKU_BLOCK_SIZE - 1) / AKU_BLOCK_SIZE);
+        std::tie(status, block) = bstore->read_extent(curr, nblocks);
+        if (status != AKU_SUCCESS) {
+            return std::tie(status, block);
+        }
+        subtree = subtree_cast(block->get_data());
+    }
+    status = bstore->verify_checksum(block, subtree->checksum, sizeof(SubtreeRef), subtree->payload_size);
+    if (status != AKU_SUCCESS) {
         std::stringstream fmt;
         fmt << "Invalid checksum (addr: " << curr << ", level: " << subtree->level << ")";
         Logger::msg(AKU_LOG_ERROR, fmt.str());
-        status = AKU_EBAD_DATA;
     }
     return std::tie(status, block);
 }
 
 //! Read block from blockstoroe with all the checks. Panic on error!
-static std::shared_ptr<Block> read_block_from_bstore(std::shared_ptr<BlockStore> bstore, LogicAddr curr) {
+static std::shared_ptr<Block> read_block_from_bstore(std::shared_ptr<BlockStore> bstore, LogicAddr curr,
+                                                     ReadHint hint = ReadHint::LOOKUP) {
     aku_Status status;
     std::shared_ptr<Block> block;
-    std::tie(status, block) = bstore->read_block(curr);
+    std::tie(status, block) = bstore->read_block(curr, hint);
     if (status != AKU_SUCCESS) {
         AKU_PANIC("Can't read block - " + StatusUtil::str(status));
     }
     // Check consistency (works with both inner and leaf nodes).
-    u8 const* data = block->get_data();
-    SubtreeRef const* subtree = subtree_cast(data);
-    u32 crc = bstore->checksum(data + sizeof(SubtreeRef), subtree->payload_size);
-    if (crc != subtree->checksum) {
+    SubtreeRef const* subtree = subtree_cast(block->get_data());
+    if (sizeof(SubtreeRef) + subtree->payload_size > AKU_BLOCK_SIZE) {
+        // Large leaf - payload continues in the consecutive blocks
+        u32 nblocks = static_cast<u32>((sizeof(SubtreeRef) + subtree->payload_size + AKU_BLOCK_SIZE - 1) / AKU_BLOCK_SIZE);
+        std::tie(status, block) = bstore->read_extent(curr, nblocks);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Can't read extent - " + StatusUtil::str(status));
+        }
+        subtree = subtree_cast(block->get_data());
+    }
+    status = bstore->verify_checksum(block, subtree->checksum, sizeof(SubtreeRef), subtree->payload_size);
+    if (status != AKU_SUCCESS) {
         std::stringstream fmt;
         fmt << "Invalid checksum (addr: " << curr << ", level: " << subtree->level << ")";
         AKU_PANIC(fmt.str());
@@ -95,7 +147,7 @@ static aku_Status init_subtree_from_leaf(const NBTreeLeaf& leaf, SubtreeRef& out
         return AKU_EBAD_ARG;
     }
     double min = std::numeric_limits<double>::max();
-    double max = std::numeric_limits<double>::min();
+    double max = std::numeric_limits<double>::lowest();
     double sum = 0;
     for (auto x: xs) {
         min = std::min(min, x);
@@ -129,7 +181,7 @@ static aku_Status init_subtree_from_subtree(const NBTreeSuperblock& node, Subtre
     backref.sum = 0;
 
     double min = std::numeric_limits<double>::max();
-    double max = std::numeric_limits<double>::min();
+    double max = std::numeric_limits<double>::lowest();
     for (const SubtreeRef& sref: refs) {
         backref.count += sref.count;
         backref.sum   += sref.sum;
@@ -195,26 +247,19 @@ struct NBTreeLeafIterator : NBTreeIterator {
             status_ = AKU_ENO_DATA;
             return;
         }
-        status_ = node.read_all(&tsbuf_, &xsbuf_);
+        // Only the requested range is materialized, the decode stops at
+        // the first sample past it (see `read_range`)
+        status_ = node.read_range(begin, end, &tsbuf_, &xsbuf_);
         if (status_ == AKU_SUCCESS) {
-            if (begin < end) {
-                // FWD direction
-                auto it_begin = std::lower_bound(tsbuf_.begin(), tsbuf_.end(), begin_);
-                if (it_begin != tsbuf_.end()) {
-                    from_ = std::distance(tsbuf_.begin(), it_begin);
-                } else {
-                    from_ = 0;
-                    assert(tsbuf_.front() > begin);
-                }
-                auto it_end = std::lower_bound(tsbuf_.begin(), tsbuf_.end(), end_);
-                to_ = std::distance(tsbuf_.begin(), it_end);
-            } else {
+            if (tsbuf_.empty()) {
+                // Empty leaf or empty range
+                status_ = AKU_ENO_DATA;
+                return;
+            }
+            from_ = 0;
+            to_   = static_cast<ssize_t>(tsbuf_.size());
+            if (begin >= end) {
                 // BWD direction
-                auto it_begin = std::upper_bound(tsbuf_.begin(), tsbuf_.end(), begin_);
-                from_ = std::distance(it_begin, tsbuf_.end());
-
-                auto it_end = std::upper_bound(tsbuf_.begin(), tsbuf_.end(), end_);
-                to_ = std::distance(it_end, tsbuf_.end());
                 std::reverse(tsbuf_.begin(), tsbuf_.end());
                 std::reverse(xsbuf_.begin(), xsbuf_.end());
             }
@@ -253,6 +298,96 @@ NBTreeIterator::Direction NBTreeLeafIterator::get_direction() {
     return Direction::BACKWARD;
 }
 
+// ////////////////////////////// //
+//    Aggregation pushdown        //
+// ////////////////////////////// //
+
+static NBTreeAggregationResult empty_aggregation_result() {
+    NBTreeAggregationResult res;
+    res.count = 0;
+    res.sum   = 0;
+    res.min   = std::numeric_limits<double>::max();
+    res.max   = std::numeric_limits<double>::lowest();
+    return res;
+}
+
+static void combine_aggregates(NBTreeAggregationResult* out, NBTreeAggregationResult const& other) {
+    out->count += other.count;
+    out->sum   += other.sum;
+    out->min    = std::min(out->min, other.min);
+    out->max    = std::max(out->max, other.max);
+}
+
+//! Merge precomputed subtree aggregates into the result.
+static void combine_aggregates(NBTreeAggregationResult* out, SubtreeRef const& ref) {
+    out->count += ref.count;
+    out->sum   += ref.sum;
+    out->min    = std::min(out->min, ref.min);
+    out->max    = std::max(out->max, ref.max);
+}
+
+static void aggregate_values(std::vector<aku_Timestamp> const& ts, std::vector<double> const& xs,
+                             aku_Timestamp begin, aku_Timestamp end, NBTreeAggregationResult* out)
+{
+    // Timestamps are sorted so the in-range run is contiguous
+    size_t lo = ts_lower_bound(ts.data(), ts.size(), begin);
+    size_t hi = ts_lower_bound(ts.data(), ts.size(), end);  // `end` is exclusive
+    for (size_t i = lo; i < hi; i++) {
+        out->count += 1;
+        out->sum   += xs[i];
+        out->min    = std::min(out->min, xs[i]);
+        out->max    = std::max(out->max, xs[i]);
+    }
+}
+
+/** Aggregate entire subtree referenced by addr.
+  * Descends only to the nodes that cross the range boundary, subtrees that
+  * are fully covered by [begin, end) are answered from the refs alone.
+  */
+static aku_Status aggregate_node(std::shared_ptr<BlockStore> bstore, LogicAddr addr, u16 level,
+                                 aku_Timestamp begin, aku_Timestamp end, NBTreeAggregationResult* out)
+{
+    aku_Status status;
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = read_and_check(bstore, addr);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    if (level == 0) {
+        NBTreeLeaf leaf(block);
+        std::vector<aku_Timestamp> ts;
+        std::vector<double> xs;
+        status = leaf.read_range(begin, end, &ts, &xs);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        aggregate_values(ts, xs, begin, end, out);
+        return AKU_SUCCESS;
+    }
+    NBTreeSuperblock sblock(block);
+    std::vector<SubtreeRef> refs;
+    status = sblock.read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    for (SubtreeRef const& ref: refs) {
+        if (ref.begin >= end || ref.end < begin) {
+            // Subtree is outside of the range.
+            continue;
+        }
+        if (ref.begin >= begin && ref.end < end) {
+            // Subtree is fully covered, use precomputed aggregates.
+            combine_aggregates(out, ref);
+            continue;
+        }
+        status = aggregate_node(bstore, ref.addr, ref.level, begin, end, out);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    return AKU_SUCCESS;
+}
+
 // ////////////////////////////// //
 //  NBTreeIterator concatenation  //
 // ////////////////////////////// //
@@ -316,6 +451,156 @@ NBTreeIterator::Direction IteratorConcat::get_direction() {
     return dir_;
 }
 
+// ////////////////////////////// //
+//    NBTreeIterator fan-in       //
+// ////////////////////////////// //
+
+/** Parallel version of `IteratorConcat`. Source iterators are created and
+  * drained by the worker threads (disjoint subtrees can be read and decoded
+  * independently), results are buffered and consumed strictly in order.
+  * Memory usage is bounded by the prefetch window.
+  */
+struct IteratorFanIn : NBTreeIterator {
+    //! Iterator factory (invoked on the worker thread to defer block reads).
+    typedef std::function<std::unique_ptr<NBTreeIterator>()> IterFactory;
+
+    enum {
+        READ_CHUNK_SIZE = 0x1000,
+    };
+
+    struct Buffer {
+        std::vector<aku_Timestamp> tss;
+        std::vector<double>        xss;
+        aku_Status                 status;
+        bool                       ready;
+
+        Buffer() : status(AKU_ENO_DATA), ready(false) {}
+    };
+
+    std::vector<IterFactory> factories_;
+    std::vector<Buffer>      buffers_;
+    Direction                dir_;
+    std::mutex               mutex_;
+    std::condition_variable  cvar_;
+    size_t                   produce_pos_;  //< next factory to claim (guarded by mutex_)
+    size_t                   consume_pos_;  //< next buffer to consume (guarded by mutex_)
+    size_t                   window_;       //< max number of buffers ahead of the consumer
+    size_t                   read_pos_;     //< read offset inside the current buffer
+    bool                     stop_;
+    std::vector<std::thread> workers_;
+
+    IteratorFanIn(std::vector<IterFactory>&& factories, Direction dir, u32 nworkers)
+        : factories_(std::move(factories))
+        , buffers_(factories_.size())
+        , dir_(dir)
+        , produce_pos_(0)
+        , consume_pos_(0)
+        , window_(static_cast<size_t>(nworkers) * 2)
+        , read_pos_(0)
+        , stop_(false)
+    {
+        auto nthreads = std::min(static_cast<size_t>(nworkers), factories_.size());
+        for (size_t i = 0; i < nthreads; i++) {
+            workers_.emplace_back(std::thread([this]() { worker(); }));
+        }
+    }
+
+    virtual ~IteratorFanIn() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cvar_.notify_all();
+        for (auto& thread: workers_) {
+            thread.join();
+        }
+    }
+
+    void worker() {
+        while (true) {
+            size_t ix;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cvar_.wait(lock, [this]() {
+                    return stop_ || (produce_pos_ < factories_.size() &&
+                                     produce_pos_ < consume_pos_ + window_);
+                });
+                if (stop_) {
+                    return;
+                }
+                ix = produce_pos_++;
+            }
+            // Read and decode subtree without holding the lock.
+            Buffer buf;
+            auto iter = factories_[ix]();
+            while (true) {
+                size_t oldsize = buf.tss.size();
+                buf.tss.resize(oldsize + READ_CHUNK_SIZE);
+                buf.xss.resize(oldsize + READ_CHUNK_SIZE);
+                aku_Status status;
+                size_t outsz;
+                std::tie(status, outsz) = iter->read(buf.tss.data() + oldsize,
+                                                     buf.xss.data() + oldsize,
+                                                     READ_CHUNK_SIZE);
+                buf.tss.resize(oldsize + outsz);
+                buf.xss.resize(oldsize + outsz);
+                if (status != AKU_SUCCESS) {
+                    buf.status = status;
+                    break;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                buffers_[ix] = std::move(buf);
+                buffers_[ix].ready = true;
+            }
+            cvar_.notify_all();
+        }
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, double *destval, size_t size);
+    virtual Direction get_direction();
+};
+
+std::tuple<aku_Status, size_t> IteratorFanIn::read(aku_Timestamp *destts, double *destval, size_t size) {
+    aku_Status status = AKU_ENO_DATA;
+    size_t out_size = 0;
+    while (out_size < size) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (consume_pos_ == buffers_.size()) {
+            // We're out of buffers and should stop.
+            status = AKU_ENO_DATA;
+            break;
+        }
+        cvar_.wait(lock, [this]() { return buffers_[consume_pos_].ready; });
+        Buffer& buf = buffers_[consume_pos_];
+        if (buf.status != AKU_ENO_DATA && buf.status != AKU_SUCCESS) {
+            // Worker observed an error, can't proceed.
+            return std::make_tuple(buf.status, out_size);
+        }
+        size_t toread = std::min(buf.tss.size() - read_pos_, size - out_size);
+        std::copy(buf.tss.begin() + read_pos_, buf.tss.begin() + read_pos_ + toread, destts + out_size);
+        std::copy(buf.xss.begin() + read_pos_, buf.xss.begin() + read_pos_ + toread, destval + out_size);
+        read_pos_ += toread;
+        out_size  += toread;
+        status     = AKU_SUCCESS;
+        if (read_pos_ == buf.tss.size()) {
+            // Buffer is consumed, release the memory and open the window.
+            buf.tss = std::vector<aku_Timestamp>();
+            buf.xss = std::vector<double>();
+            consume_pos_++;
+            read_pos_ = 0;
+            lock.unlock();
+            cvar_.notify_all();
+        }
+    }
+    return std::make_tuple(status, out_size);
+}
+
+NBTreeIterator::Direction IteratorFanIn::get_direction() {
+    return dir_;
+}
+
 // ///////////////////////// //
 //    Superblock Iterator    //
 // ///////////////////////// //
@@ -329,6 +614,13 @@ static bool subtree_in_range(SubtreeRef const& ref, aku_Timestamp begin, aku_Tim
     return true;
 }
 
+static bool subtree_in_range(SubtreeRefSlim const& ref, aku_Timestamp begin, aku_Timestamp end) {
+    if (ref.end < begin || end < ref.begin) {
+        return false;
+    }
+    return true;
+}
+
 struct NBTreeSBlockIterator : NBTreeIterator {
     //! Starting timestamp
     aku_Timestamp              begin_;
@@ -340,7 +632,7 @@ struct NBTreeSBlockIterator : NBTreeIterator {
     std::shared_ptr<BlockStore> bstore_;
 
     // FSM
-    std::vector<SubtreeRef> refs_;
+    std::vector<SubtreeRefSlim> refs_;
     std::unique_ptr<NBTreeIterator> iter_;
     u32 fsm_pos_;
     i32 refs_pos_;
@@ -363,7 +655,7 @@ struct NBTreeSBlockIterator : NBTreeIterator {
         , fsm_pos_(1)  // FSM will bypass `init` step.
         , refs_pos_(0)
     {
-        aku_Status status = sblock.read_all(&refs_);
+        aku_Status status = sblock.read_index(&refs_);
         if (status != AKU_SUCCESS) {
             // `read` call should fail with AKU_ENO_DATA error.
             refs_pos_ = begin_ < end_ ? static_cast<i32>(refs_.size()) : -1;
@@ -380,7 +672,7 @@ struct NBTreeSBlockIterator : NBTreeIterator {
             return status;
         }
         NBTreeSuperblock current(block);
-        status = current.read_all(&refs_);
+        status = current.read_index(&refs_);
         refs_pos_ = begin_ < end_ ? 0 : static_cast<i32>(refs_.size()) - 1;
         return status;
     }
@@ -392,7 +684,7 @@ struct NBTreeSBlockIterator : NBTreeIterator {
         // create iterator for next node
         auto get_next_iter = [=] () {
             std::unique_ptr<NBTreeIterator> empty;
-            SubtreeRef ref;
+            SubtreeRefSlim ref;
             if (get_direction() == NBTreeIterator::Direction::FORWARD) {
                 if (refs_pos_ == static_cast<i32>(refs_.size())) {
                     // Done
@@ -408,6 +700,13 @@ struct NBTreeSBlockIterator : NBTreeIterator {
                 ref = refs_.at(static_cast<size_t>(refs_pos_));
                 refs_pos_--;
             }
+            if (refs_pos_ >= 0 && refs_pos_ < static_cast<i32>(refs_.size())) {
+                // Address of the next child is known ahead of time.
+                auto const& next = refs_.at(static_cast<size_t>(refs_pos_));
+                if (subtree_in_range(next, min, max)) {
+                    bstore_->prefetch_block(next.addr);
+                }
+            }
             std::unique_ptr<NBTreeIterator> result;
             if (!subtree_in_range(ref, min, max)) {
                 // Subtree not in [begin_, end_) range. Proceed to next.
@@ -416,7 +715,7 @@ struct NBTreeSBlockIterator : NBTreeIterator {
             if (ref.level == 0) {
                 aku_Status status;
                 std::shared_ptr<Block> block;
-                std::tie(status, block) = read_and_check(bstore_, ref.addr);
+                std::tie(status, block) = read_and_check(bstore_, ref.addr, ReadHint::SCAN);
                 if (status != AKU_SUCCESS) {
                     return std::make_tuple(status, std::move(empty));
                 }
@@ -481,14 +780,260 @@ NBTreeSBlockIterator::Direction NBTreeSBlockIterator::get_direction() {
     return NBTreeIterator::Direction::BACKWARD;
 }
 
+// /////////////////////////// //
+//    Chunk-level iterators    //
+// /////////////////////////// //
+
+/** Chunk-granular iterator for leaf node. Entire trimmed content of
+  * the leaf is returned by the single `read_chunk` call.
+  */
+struct NBTreeLeafChunkIterator : NBTreeChunkIterator {
+    NBTreeLeafIterator iter_;
+
+    NBTreeLeafChunkIterator(aku_Status status)
+        : iter_(status)
+    {
+    }
+
+    NBTreeLeafChunkIterator(aku_Timestamp begin, aku_Timestamp end, NBTreeLeaf const& node)
+        : iter_(begin, end, node)
+    {
+    }
+
+    virtual std::tuple<aku_Status, NBTreeDecodedChunk> read_chunk();
+    virtual NBTreeIterator::Direction get_direction();
+};
+
+std::tuple<aku_Status, NBTreeDecodedChunk> NBTreeLeafChunkIterator::read_chunk() {
+    NBTreeDecodedChunk chunk = { nullptr, nullptr, 0 };
+    if (iter_.status_ != AKU_SUCCESS) {
+        return std::make_tuple(iter_.status_, chunk);
+    }
+    ssize_t toread = iter_.to_ - iter_.from_;
+    if (toread <= 0) {
+        return std::make_tuple(AKU_ENO_DATA, chunk);
+    }
+    chunk.tss  = iter_.tsbuf_.data() + iter_.from_;
+    chunk.xss  = iter_.xsbuf_.data() + iter_.from_;
+    chunk.size = static_cast<size_t>(toread);
+    iter_.from_ = iter_.to_;
+    return std::make_tuple(AKU_SUCCESS, chunk);
+}
+
+NBTreeIterator::Direction NBTreeLeafChunkIterator::get_direction() {
+    return iter_.get_direction();
+}
+
+/** Chunk-granular counterpart of `NBTreeSBlockIterator`. Traverses the
+  * subtree in the same order but hands out whole decoded leafs. Current
+  * child iterator is kept alive until the next `read_chunk` call so the
+  * returned spans stay valid.
+  */
+struct NBTreeSBlockChunkIterator : NBTreeChunkIterator {
+    //! Starting timestamp
+    aku_Timestamp              begin_;
+    //! Final timestamp
+    aku_Timestamp              end_;
+    //! Address of the current superblock
+    LogicAddr addr_;
+    //! Blockstore
+    std::shared_ptr<BlockStore> bstore_;
+
+    // FSM
+    std::vector<SubtreeRefSlim> refs_;
+    std::unique_ptr<NBTreeChunkIterator> iter_;
+    u32 fsm_pos_;
+    i32 refs_pos_;
+
+    NBTreeSBlockChunkIterator(std::shared_ptr<BlockStore> bstore, LogicAddr addr, aku_Timestamp begin, aku_Timestamp end)
+        : begin_(begin)
+        , end_(end)
+        , addr_(addr)
+        , bstore_(bstore)
+        , fsm_pos_(0)
+        , refs_pos_(0)
+    {
+    }
+
+    NBTreeSBlockChunkIterator(std::shared_ptr<BlockStore> bstore, NBTreeSuperblock const& sblock, aku_Timestamp begin, aku_Timestamp end)
+        : begin_(begin)
+        , end_(end)
+        , addr_(EMPTY_ADDR)
+        , bstore_(bstore)
+        , fsm_pos_(1)  // FSM will bypass `init` step.
+        , refs_pos_(0)
+    {
+        aku_Status status = sblock.read_index(&refs_);
+        if (status != AKU_SUCCESS) {
+            // `read_chunk` call should fail with AKU_ENO_DATA error.
+            refs_pos_ = begin_ < end_ ? static_cast<i32>(refs_.size()) : -1;
+        } else {
+            refs_pos_ = begin_ < end_ ? 0 : static_cast<i32>(refs_.size()) - 1;
+        }
+    }
+
+    aku_Status init() {
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = read_and_check(bstore_, addr_);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        NBTreeSuperblock current(block);
+        status = current.read_index(&refs_);
+        refs_pos_ = begin_ < end_ ? 0 : static_cast<i32>(refs_.size()) - 1;
+        return status;
+    }
+
+    //! Create iterator for the next child node.
+    std::tuple<aku_Status, std::unique_ptr<NBTreeChunkIterator>> get_next_iter() {
+        auto min = std::min(begin_, end_);
+        auto max = std::max(begin_, end_);
+        std::unique_ptr<NBTreeChunkIterator> empty;
+        SubtreeRefSlim ref;
+        if (get_direction() == NBTreeIterator::Direction::FORWARD) {
+            if (refs_pos_ == static_cast<i32>(refs_.size())) {
+                // Done
+                return std::make_tuple(AKU_ENO_DATA, std::move(empty));
+            }
+            ref = refs_.at(static_cast<size_t>(refs_pos_));
+            refs_pos_++;
+        } else {
+            if (refs_pos_ < 0) {
+                // Done
+                return std::make_tuple(AKU_ENO_DATA, std::move(empty));
+            }
+            ref = refs_.at(static_cast<size_t>(refs_pos_));
+            refs_pos_--;
+        }
+        if (refs_pos_ >= 0 && refs_pos_ < static_cast<i32>(refs_.size())) {
+            // Address of the next child is known ahead of time.
+            auto const& next = refs_.at(static_cast<size_t>(refs_pos_));
+            if (subtree_in_range(next, min, max)) {
+                bstore_->prefetch_block(next.addr);
+            }
+        }
+        std::unique_ptr<NBTreeChunkIterator> result;
+        if (!subtree_in_range(ref, min, max)) {
+            // Subtree not in [begin_, end_) range. Proceed to next.
+            return std::make_tuple(AKU_ENOT_FOUND, std::move(empty));
+        }
+        if (ref.level == 0) {
+            aku_Status status;
+            std::shared_ptr<Block> block;
+            std::tie(status, block) = read_and_check(bstore_, ref.addr, ReadHint::SCAN);
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, std::move(empty));
+            }
+            NBTreeLeaf leaf(block);
+            // NOTE: iterator can outlive the stack object.
+            result.reset(new NBTreeLeafChunkIterator(begin_, end_, leaf));
+        } else {
+            result.reset(new NBTreeSBlockChunkIterator(bstore_, ref.addr, begin_, end_));
+        }
+        return std::make_tuple(AKU_SUCCESS, std::move(result));
+    }
+
+    virtual std::tuple<aku_Status, NBTreeDecodedChunk> read_chunk();
+    virtual NBTreeIterator::Direction get_direction();
+};
+
+std::tuple<aku_Status, NBTreeDecodedChunk> NBTreeSBlockChunkIterator::read_chunk() {
+    NBTreeDecodedChunk chunk = { nullptr, nullptr, 0 };
+    if (!fsm_pos_) {
+        aku_Status status = init();
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, chunk);
+        }
+        fsm_pos_++;
+    }
+    while (true) {
+        if (!iter_) {
+            aku_Status status;
+            std::tie(status, iter_) = get_next_iter();
+            if (status == AKU_ENOT_FOUND) {
+                // Subtree exists but doesn't contains values from begin-end timerange.
+                continue;
+            } else if (status != AKU_SUCCESS) {
+                // We're out of iterators and should stop.
+                return std::make_tuple(status, chunk);
+            }
+        }
+        aku_Status status;
+        std::tie(status, chunk) = iter_->read_chunk();
+        if (status == AKU_ENO_DATA) {
+            // Move to next iterator.
+            iter_.reset();
+            continue;
+        }
+        return std::make_tuple(status, chunk);
+    }
+}
+
+NBTreeIterator::Direction NBTreeSBlockChunkIterator::get_direction() {
+    if (begin_ < end_) {
+        return NBTreeIterator::Direction::FORWARD;
+    }
+    return NBTreeIterator::Direction::BACKWARD;
+}
+
+//! Chunk-granular counterpart of `IteratorConcat`.
+struct ChunkIteratorConcat : NBTreeChunkIterator {
+    typedef std::vector<std::unique_ptr<NBTreeChunkIterator>> IterVec;
+    IterVec iter_;
+    NBTreeIterator::Direction dir_;
+    u32 iter_index_;
+
+    //! C-tor. Create iterator from list of iterators.
+    template<class TVec>
+    ChunkIteratorConcat(TVec&& iter)
+        : iter_(std::forward<TVec>(iter))
+        , iter_index_(0)
+    {
+        if (iter_.empty()) {
+            dir_ = NBTreeIterator::Direction::FORWARD;
+        } else {
+            dir_ = iter_.front()->get_direction();
+        }
+    }
+
+    virtual std::tuple<aku_Status, NBTreeDecodedChunk> read_chunk();
+    virtual NBTreeIterator::Direction get_direction();
+};
+
+std::tuple<aku_Status, NBTreeDecodedChunk> ChunkIteratorConcat::read_chunk() {
+    NBTreeDecodedChunk chunk = { nullptr, nullptr, 0 };
+    aku_Status status = AKU_ENO_DATA;
+    while (iter_index_ < iter_.size()) {
+        std::tie(status, chunk) = iter_[iter_index_]->read_chunk();
+        if (status == AKU_ENO_DATA) {
+            // this iterator is empty, continue with next
+            iter_index_++;
+            continue;
+        }
+        // Chunk was produced or error occured.
+        break;
+    }
+    return std::make_tuple(status, chunk);
+}
+
+NBTreeIterator::Direction ChunkIteratorConcat::get_direction() {
+    return dir_;
+}
+
 // //////////////// //
 //    NBTreeLeaf    //
 // //////////////// //
 
-NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index)
+NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index, u16 nblocks, int val_codec)
     : prev_(prev)
-    , block_(std::make_shared<Block>())
-    , writer_(id, block_->get_data() + sizeof(SubtreeRef), AKU_BLOCK_SIZE - sizeof(SubtreeRef))
+    , block_(nblocks <= 1
+             ? std::make_shared<Block>()
+             : std::make_shared<Block>(EMPTY_ADDR,
+                                       std::vector<u8>(static_cast<size_t>(nblocks) * AKU_BLOCK_SIZE, 0)))
+    , writer_(id, block_->get_data() + sizeof(SubtreeRef),
+              static_cast<int>(block_->get_size() - sizeof(SubtreeRef)),
+              TS_CODEC_DELTA_RLE, val_codec)
     , fanout_index_(fanout_index)
 {
     SubtreeRef* subtree = subtree_cast(block_->get_data());
@@ -508,8 +1053,8 @@ NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index)
 }
 
 
-NBTreeLeaf::NBTreeLeaf(std::shared_ptr<BlockStore> bstore, LogicAddr curr)
-    : NBTreeLeaf(read_block_from_bstore(bstore, curr))
+NBTreeLeaf::NBTreeLeaf(std::shared_ptr<BlockStore> bstore, LogicAddr curr, ReadHint hint)
+    : NBTreeLeaf(read_block_from_bstore(bstore, curr, hint))
 {
 }
 
@@ -573,7 +1118,64 @@ aku_Status NBTreeLeaf::read_all(std::vector<aku_Timestamp>* timestamps,
     return AKU_SUCCESS;
 }
 
+aku_Status NBTreeLeaf::read_range(aku_Timestamp begin, aku_Timestamp end,
+                                  std::vector<aku_Timestamp>* timestamps,
+                                  std::vector<double>* values) const
+{
+    if (begin == end) {
+        return AKU_SUCCESS;
+    }
+    // Inclusive bounds of the scan in ascending time order. Range
+    // semantics match `range()` - [begin, end) for the forward direction,
+    // (end, begin] for the backward one (output is ascending either way).
+    aku_Timestamp lo, hi;
+    if (begin < end) {
+        lo = begin;
+        hi = end - 1;
+    } else {
+        lo = end + 1;
+        hi = begin;
+    }
+    int windex = writer_.get_write_index();
+    DataBlockReader reader(block_->get_data() + sizeof(SubtreeRef), block_->get_size());
+    size_t sz = reader.nelements();
+    for (size_t ix = 0; ix < sz; ix++) {
+        aku_Status status;
+        aku_Timestamp ts;
+        double value;
+        std::tie(status, ts, value) = reader.next();
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        if (ts < lo) {
+            // Pre-range sample. The codecs are stateful so it has to be
+            // decoded, but it doesn't have to be materialized.
+            continue;
+        }
+        if (ts > hi) {
+            // Past the range - the rest of the block stays undecoded.
+            return AKU_SUCCESS;
+        }
+        timestamps->push_back(ts);
+        values->push_back(value);
+    }
+    // Read tail elements from `writer_`
+    if (windex != 0) {
+        std::vector<aku_Timestamp> tail_ts;
+        std::vector<double> tail_xs;
+        writer_.read_tail_elements(&tail_ts, &tail_xs);
+        for (size_t i = 0; i < tail_ts.size(); i++) {
+            if (tail_ts.at(i) >= lo && tail_ts.at(i) <= hi) {
+                timestamps->push_back(tail_ts.at(i));
+                values->push_back(tail_xs.at(i));
+            }
+        }
+    }
+    return AKU_SUCCESS;
+}
+
 aku_Status NBTreeLeaf::append(aku_Timestamp ts, double value) {
+    StageProfiler::ScopedStage stage(StageProfiler::STAGE_NBTREE);
     aku_Status status = writer_.put(ts, value);
     if (status == AKU_SUCCESS) {
         SubtreeRef* subtree = subtree_cast(block_->get_data());
@@ -589,8 +1191,75 @@ aku_Status NBTreeLeaf::append(aku_Timestamp ts, double value) {
     return status;
 }
 
+size_t NBTreeLeaf::adapt_codecs(std::vector<aku_Timestamp> const& timestamps,
+                                std::vector<double> const& values, size_t size)
+{
+    if (timestamps.size() < DataBlockWriter::CHUNK_SIZE) {
+        // Nothing to win on tiny leaves
+        return size;
+    }
+    const size_t capacity = block_->get_size() - sizeof(SubtreeRef);
+    int val_codec = DataBlockWriter::select_val_codec(values.data(),
+                                                      std::min(values.size(),
+                                                               (size_t)DataBlockWriter::CHUNK_SIZE));
+    // The fixed-point codec can only represent values that round-trip
+    // through i64, so it's a candidate only for fully integral leaves
+    // (`select_val_codec` samples a prefix and can't guarantee that).
+    bool integral = true;
+    for (auto x: values) {
+        if (static_cast<double>(static_cast<i64>(x)) != x) {
+            integral = false;
+            break;
+        }
+    }
+    if (val_codec == VAL_CODEC_FIXED && !integral) {
+        val_codec = VAL_CODEC_FCM;
+    }
+    // Candidate configurations (default one is already encoded in `block_`)
+    std::vector<std::tuple<int, int>> candidates = {
+        std::make_tuple((int)TS_CODEC_DELTA_RLE, val_codec),
+        std::make_tuple((int)TS_CODEC_DELTA_GV,  val_codec),
+        std::make_tuple((int)TS_CODEC_DELTA_GV,  (int)VAL_CODEC_FCM),
+    };
+    if (integral) {
+        candidates.push_back(std::make_tuple((int)TS_CODEC_DELTA_RLE, (int)VAL_CODEC_FIXED));
+    }
+    std::vector<u8> scratch(capacity);
+    for (auto const& cand: candidates) {
+        int ts_codec;
+        std::tie(ts_codec, val_codec) = cand;
+        if (ts_codec == TS_CODEC_DELTA_RLE && val_codec == VAL_CODEC_FCM) {
+            continue;  // this is the default configuration
+        }
+        DataBlockWriter writer(get_id(), scratch.data(), static_cast<int>(capacity),
+                               ts_codec, val_codec);
+        bool overflow = false;
+        for (size_t i = 0; i < timestamps.size(); i++) {
+            if (writer.put(timestamps.at(i), values.at(i)) != AKU_SUCCESS) {
+                overflow = true;
+                break;
+            }
+        }
+        if (overflow) {
+            continue;
+        }
+        size_t out_size = writer.commit();
+        if (out_size < size) {
+            memcpy(block_->get_data() + sizeof(SubtreeRef), scratch.data(), out_size);
+            size = out_size;
+        }
+    }
+    return size;
+}
+
 std::tuple<aku_Status, LogicAddr> NBTreeLeaf::commit(std::shared_ptr<BlockStore> bstore) {
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<double> values;
+    aku_Status rdstatus = read_all(&timestamps, &values);
     size_t size = writer_.commit();
+    if (rdstatus == AKU_SUCCESS) {
+        size = adapt_codecs(timestamps, values, size);
+    }
     SubtreeRef* subtree = subtree_cast(block_->get_data());
     subtree->payload_size = static_cast<u16>(size);
     if (prev_ != EMPTY_ADDR) {
@@ -607,16 +1276,46 @@ std::tuple<aku_Status, LogicAddr> NBTreeLeaf::commit(std::shared_ptr<BlockStore>
     subtree->fanout_index = fanout_index_;
     // Compute checksum
     subtree->checksum = bstore->checksum(block_->get_data() + sizeof(SubtreeRef), size);
-    return bstore->append_block(block_);
+    AKU_PROBE3(leaf_commit, subtree->id, subtree->count, size);
+    return bstore->append_extent(block_);
 }
 
 
+std::tuple<aku_Status, NBTreeAggregationResult> NBTreeLeaf::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
+    NBTreeAggregationResult res = empty_aggregation_result();
+    if (begin > end) {
+        return std::make_tuple(AKU_EBAD_ARG, res);
+    }
+    SubtreeRef const* subtree = subtree_cast(block_->get_data());
+    if (subtree->count != 0 && begin <= subtree->begin && subtree->end < end) {
+        // Range covers the whole leaf - the running aggregates maintained
+        // by `append` answer the query without decoding anything. Tail
+        // aggregate queries hit this path on every open leaf.
+        combine_aggregates(&res, *subtree);
+        return std::make_tuple(AKU_SUCCESS, res);
+    }
+    std::vector<aku_Timestamp> ts;
+    std::vector<double> xs;
+    aku_Status status = read_range(begin, end, &ts, &xs);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(status, res);
+    }
+    aggregate_values(ts, xs, begin, end, &res);
+    return std::make_tuple(AKU_SUCCESS, res);
+}
+
 std::unique_ptr<NBTreeIterator> NBTreeLeaf::range(aku_Timestamp begin, aku_Timestamp end) const {
     std::unique_ptr<NBTreeIterator> it;
     it.reset(new NBTreeLeafIterator(begin, end, *this));
     return std::move(it);
 }
 
+std::unique_ptr<NBTreeChunkIterator> NBTreeLeaf::chunks(aku_Timestamp begin, aku_Timestamp end) const {
+    std::unique_ptr<NBTreeChunkIterator> it;
+    it.reset(new NBTreeLeafChunkIterator(begin, end, *this));
+    return std::move(it);
+}
+
 std::unique_ptr<NBTreeIterator> NBTreeLeaf::search(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const {
     // Traverse tree from largest timestamp to smallest
     aku_Timestamp min = std::min(begin, end);
@@ -634,7 +1333,10 @@ std::unique_ptr<NBTreeIterator> NBTreeLeaf::search(aku_Timestamp begin, aku_Time
     }
     while (bstore->exists(addr)) {
         std::unique_ptr<NBTreeLeaf> leaf;
-        leaf.reset(new NBTreeLeaf(bstore, addr));
+        leaf.reset(new NBTreeLeaf(bstore, addr, ReadHint::SCAN));
+        // Next leaf address is known ahead of time, overlap the read
+        // with decoding of the current node.
+        bstore->prefetch_block(leaf->get_prev_addr());
         std::tie(b, e) = leaf->get_timestamps();
         if (max < b) {
             break;
@@ -750,6 +1452,11 @@ aku_Status NBTreeSuperblock::append(const SubtreeRef &p) {
     SubtreeRef* pref = subtree_cast(block_->get_data());
     auto it = pref + 1 + write_pos_;
     *it = p;
+    // Mirror hot fields in the SoA index
+    SubtreeRefIndex* pindex = subtree_index_cast(block_->get_data());
+    pindex->begin[write_pos_] = p.begin;
+    pindex->end[write_pos_]   = p.end;
+    pindex->addr[write_pos_]  = p.addr;
     if (write_pos_ == 0) {
         pref->begin = p.begin;
     }
@@ -810,6 +1517,20 @@ aku_Status NBTreeSuperblock::read_all(std::vector<SubtreeRef>* refs) const {
     return AKU_SUCCESS;
 }
 
+aku_Status NBTreeSuperblock::read_index(std::vector<SubtreeRefSlim>* refs) const {
+    SubtreeRefIndex const* pindex = subtree_index_cast(block_->get_data());
+    u16 childlvl = static_cast<u16>(level_ - 1);  // children of one node share the level
+    for (u32 ix = 0u; ix < write_pos_; ix++) {
+        SubtreeRefSlim slim;
+        slim.begin = pindex->begin[ix];
+        slim.end   = pindex->end[ix];
+        slim.addr  = pindex->addr[ix];
+        slim.level = childlvl;
+        refs->push_back(slim);
+    }
+    return AKU_SUCCESS;
+}
+
 std::tuple<aku_Timestamp, aku_Timestamp> NBTreeSuperblock::get_timestamps() const {
     SubtreeRef const* pref = subtree_cast(block_->get_data());
     return std::tie(pref->begin, pref->end);
@@ -824,6 +1545,92 @@ std::unique_ptr<NBTreeIterator> NBTreeSuperblock::search(aku_Timestamp begin,
     return std::move(result);
 }
 
+std::tuple<aku_Status, NBTreeAggregationResult> NBTreeSuperblock::aggregate(aku_Timestamp begin,
+                                                                            aku_Timestamp end,
+                                                                            std::shared_ptr<BlockStore> bstore) const
+{
+    NBTreeAggregationResult res = empty_aggregation_result();
+    if (begin > end) {
+        return std::make_tuple(AKU_EBAD_ARG, res);
+    }
+    std::vector<SubtreeRef> refs;
+    aku_Status status = read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(status, res);
+    }
+    for (SubtreeRef const& ref: refs) {
+        if (ref.begin >= end || ref.end < begin) {
+            continue;
+        }
+        if (ref.begin >= begin && ref.end < end) {
+            combine_aggregates(&res, ref);
+            continue;
+        }
+        status = aggregate_node(bstore, ref.addr, ref.level, begin, end, &res);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, res);
+        }
+    }
+    return std::make_tuple(AKU_SUCCESS, res);
+}
+
+std::unique_ptr<NBTreeIterator> NBTreeSuperblock::psearch(aku_Timestamp begin,
+                                                          aku_Timestamp end,
+                                                          std::shared_ptr<BlockStore> bstore) const
+{
+    std::unique_ptr<NBTreeIterator> result;
+    std::vector<SubtreeRef> refs;
+    aku_Status status = read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        result.reset(new NBTreeLeafIterator(status));
+        return std::move(result);
+    }
+    auto min = std::min(begin, end);
+    auto max = std::max(begin, end);
+    if (begin > end) {
+        std::reverse(refs.begin(), refs.end());
+    }
+    // Child subtrees are disjoint so they can be read and decoded by the
+    // worker pool independently, results are merged in order.
+    std::vector<IteratorFanIn::IterFactory> factories;
+    for (auto ref: refs) {
+        if (!subtree_in_range(ref, min, max)) {
+            continue;
+        }
+        factories.push_back([bstore, ref, begin, end]() {
+            std::unique_ptr<NBTreeIterator> iter;
+            if (ref.level == 0) {
+                aku_Status status;
+                std::shared_ptr<Block> block;
+                std::tie(status, block) = read_and_check(bstore, ref.addr);
+                if (status != AKU_SUCCESS) {
+                    iter.reset(new NBTreeLeafIterator(status));
+                } else {
+                    NBTreeLeaf leaf(block);
+                    iter.reset(new NBTreeLeafIterator(begin, end, leaf));
+                }
+            } else {
+                iter.reset(new NBTreeSBlockIterator(bstore, ref.addr, begin, end));
+            }
+            return iter;
+        });
+    }
+    auto dir = begin < end ? NBTreeIterator::Direction::FORWARD
+                           : NBTreeIterator::Direction::BACKWARD;
+    auto nworkers = std::max(std::thread::hardware_concurrency(), 2u);
+    result.reset(new IteratorFanIn(std::move(factories), dir, nworkers));
+    return std::move(result);
+}
+
+std::unique_ptr<NBTreeChunkIterator> NBTreeSuperblock::csearch(aku_Timestamp begin,
+                                                               aku_Timestamp end,
+                                                               std::shared_ptr<BlockStore> bstore) const
+{
+    std::unique_ptr<NBTreeChunkIterator> result;
+    result.reset(new NBTreeSBlockChunkIterator(bstore, *this, begin, end));
+    return std::move(result);
+}
+
 
 // //////////////////////// //
 //        NBTreeExtent      //
@@ -838,9 +1645,10 @@ struct NBTreeLeafExtent : NBTreeExtent {
     LogicAddr last_;
     std::shared_ptr<NBTreeLeaf> leaf_;
     u16 fanout_index_;
-    // padding
-    u16 pad0_;
-    u32 pad1_;
+    //! Leaf size in 4KB blocks (applied on the next `reset_leaf` call)
+    u16 leaf_nblocks_;
+    //! Value codec of new leaves (applied on the next `reset_leaf` call)
+    int val_codec_;
 
     NBTreeLeafExtent(std::shared_ptr<BlockStore> bstore,
                      std::shared_ptr<NBTreeExtentsList> roots,
@@ -851,8 +1659,8 @@ struct NBTreeLeafExtent : NBTreeExtent {
         , id_(id)
         , last_(last)
         , fanout_index_(0)
-        , pad0_{}
-        , pad1_{}
+        , leaf_nblocks_(1)
+        , val_codec_(VAL_CODEC_FCM)
     {
         if (last_ != EMPTY_ADDR) {
             // Load previous node and calculate fanout.
@@ -895,14 +1703,26 @@ struct NBTreeLeafExtent : NBTreeExtent {
     }
 
     void reset_leaf() {
-        leaf_.reset(new NBTreeLeaf(id_, last_, fanout_index_));
+        leaf_.reset(new NBTreeLeaf(id_, last_, fanout_index_, leaf_nblocks_, val_codec_));
+    }
+
+    virtual void set_leaf_nblocks(u16 nblocks) {
+        leaf_nblocks_ = nblocks;
+    }
+
+    virtual void set_val_codec(int codec) {
+        val_codec_ = codec;
     }
 
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value);
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl);
     virtual std::tuple<bool, LogicAddr> commit(bool final);
     virtual std::unique_ptr<NBTreeIterator> search(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::unique_ptr<NBTreeIterator> psearch(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::tuple<aku_Status, NBTreeAggregationResult> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::unique_ptr<NBTreeChunkIterator> csearch(aku_Timestamp begin, aku_Timestamp end) const;
     virtual bool is_dirty() const;
+    virtual std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const;
 };
 
 std::tuple<bool, LogicAddr> NBTreeLeafExtent::append(SubtreeRef const&) {
@@ -980,6 +1800,19 @@ std::unique_ptr<NBTreeIterator> NBTreeLeafExtent::search(aku_Timestamp begin, ak
     return std::move(leaf_->range(begin, end));
 }
 
+std::unique_ptr<NBTreeIterator> NBTreeLeafExtent::psearch(aku_Timestamp begin, aku_Timestamp end) const {
+    // Single memory resident leaf, nothing to fan out.
+    return search(begin, end);
+}
+
+std::unique_ptr<NBTreeChunkIterator> NBTreeLeafExtent::csearch(aku_Timestamp begin, aku_Timestamp end) const {
+    return std::move(leaf_->chunks(begin, end));
+}
+
+std::tuple<aku_Status, NBTreeAggregationResult> NBTreeLeafExtent::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
+    return leaf_->aggregate(begin, end);
+}
+
 bool NBTreeLeafExtent::is_dirty() const {
     if (leaf_) {
         return leaf_->nelements() != 0;
@@ -987,6 +1820,10 @@ bool NBTreeLeafExtent::is_dirty() const {
     return false;
 }
 
+std::tuple<aku_Timestamp, aku_Timestamp> NBTreeLeafExtent::get_timestamps() const {
+    return leaf_->get_timestamps();
+}
+
 // ////////////////////// //
 //   NBTreeSBlockExtent   //
 // ////////////////////// //
@@ -1064,7 +1901,11 @@ struct NBTreeSBlockExtent : NBTreeExtent {
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl);
     virtual std::tuple<bool, LogicAddr> commit(bool final);
     virtual std::unique_ptr<NBTreeIterator> search(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::unique_ptr<NBTreeIterator> psearch(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::tuple<aku_Status, NBTreeAggregationResult> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::unique_ptr<NBTreeChunkIterator> csearch(aku_Timestamp begin, aku_Timestamp end) const;
     virtual bool is_dirty() const;
+    virtual std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const;
 };
 
 std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(aku_Timestamp, double) {
@@ -1132,6 +1973,18 @@ std::unique_ptr<NBTreeIterator> NBTreeSBlockExtent::search(aku_Timestamp begin,
     return std::move(curr_->search(begin, end, bstore_));
 }
 
+std::unique_ptr<NBTreeIterator> NBTreeSBlockExtent::psearch(aku_Timestamp begin, aku_Timestamp end) const {
+    return std::move(curr_->psearch(begin, end, bstore_));
+}
+
+std::unique_ptr<NBTreeChunkIterator> NBTreeSBlockExtent::csearch(aku_Timestamp begin, aku_Timestamp end) const {
+    return std::move(curr_->csearch(begin, end, bstore_));
+}
+
+std::tuple<aku_Status, NBTreeAggregationResult> NBTreeSBlockExtent::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
+    return curr_->aggregate(begin, end, bstore_);
+}
+
 bool NBTreeSBlockExtent::is_dirty() const {
     if (curr_) {
         return curr_->nelements() != 0;
@@ -1139,6 +1992,10 @@ bool NBTreeSBlockExtent::is_dirty() const {
     return false;
 }
 
+std::tuple<aku_Timestamp, aku_Timestamp> NBTreeSBlockExtent::get_timestamps() const {
+    return curr_->get_timestamps();
+}
+
 
 static void check_superblock_consistency(std::shared_ptr<BlockStore> bstore, NBTreeSuperblock const* sblock, u16 required_level) {
     // For each child.
@@ -1264,6 +2121,141 @@ void NBTreeExtent::check_extent(NBTreeExtent const* extent, std::shared_ptr<Bloc
     }
 }
 
+// ///////////////////// //
+//     Scan sharing      //
+// ///////////////////// //
+
+/** State shared by concurrent scans over the same time range.
+  * The reader at the head of the stream pulls the next chunk from the
+  * source iterator on behalf of everyone, laggards are served from the
+  * buffer. Entries consumed by every attached reader are discarded from
+  * the front of the buffer. New readers can attach only while nothing
+  * was discarded yet (otherwise they would miss the beginning).
+  */
+struct SharedScanState {
+
+    enum {
+        CHUNK_SIZE = 0x1000,  //< Number of elements read from the source at once
+    };
+
+    std::unique_ptr<NBTreeIterator> source_;
+    std::mutex                 mutex_;
+    std::vector<aku_Timestamp> tss_;      //< Buffered timestamps (stream position `base_` and up)
+    std::vector<double>        xss_;      //< Buffered values
+    size_t                     base_;     //< Stream position of the first buffered element
+    bool                       done_;     //< Source iterator is exhausted
+    aku_Status                 status_;   //< Source iterator completion status
+    std::map<int, size_t>      readers_;  //< Stream positions of the attached readers
+    int                        next_id_;  //< Id of the next reader
+
+    SharedScanState(std::unique_ptr<NBTreeIterator> source)
+        : source_(std::move(source))
+        , base_(0)
+        , done_(false)
+        , status_(AKU_ENO_DATA)
+        , next_id_(0)
+    {
+    }
+
+    //! Attach new reader, returns negative value if the stream was partially discarded
+    int attach() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (base_ != 0) {
+            return -1;
+        }
+        int id = next_id_++;
+        readers_[id] = 0;
+        return id;
+    }
+
+    void detach(int id) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        readers_.erase(id);
+        discard_consumed_();
+    }
+
+    std::tuple<aku_Status, size_t> read(int id, aku_Timestamp* destts, double* destval, size_t size) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        size_t pos = readers_.at(id);
+        if (pos == base_ + tss_.size() && !done_) {
+            // This reader is at the head of the stream, pull the next chunk
+            // from the source (laggards wait, they would be waiting for the
+            // same blocks to be read and decoded anyway)
+            size_t oldsize = tss_.size();
+            tss_.resize(oldsize + CHUNK_SIZE);
+            xss_.resize(oldsize + CHUNK_SIZE);
+            aku_Status status;
+            size_t outsize;
+            std::tie(status, outsize) = source_->read(tss_.data() + oldsize, xss_.data() + oldsize, CHUNK_SIZE);
+            tss_.resize(oldsize + outsize);
+            xss_.resize(oldsize + outsize);
+            if (status != AKU_SUCCESS || outsize == 0) {
+                done_ = true;
+                status_ = status == AKU_SUCCESS ? AKU_ENO_DATA : status;
+            }
+        }
+        size_t avail = base_ + tss_.size() - pos;
+        size_t toread = std::min(avail, size);
+        if (toread == 0) {
+            // `done_` is set - the loop above pulls until data or the end of
+            // the stream is reached
+            return std::make_tuple(status_, 0);
+        }
+        size_t offset = pos - base_;
+        std::copy(tss_.begin() + offset, tss_.begin() + offset + toread, destts);
+        std::copy(xss_.begin() + offset, xss_.begin() + offset + toread, destval);
+        readers_.at(id) = pos + toread;
+        discard_consumed_();
+        return std::make_tuple(AKU_SUCCESS, toread);
+    }
+
+private:
+    //! Drop buffer entries consumed by every attached reader (caller should hold the lock)
+    void discard_consumed_() {
+        if (readers_.empty()) {
+            return;
+        }
+        size_t minpos = std::numeric_limits<size_t>::max();
+        for (auto const& kv: readers_) {
+            minpos = std::min(minpos, kv.second);
+        }
+        if (minpos > base_) {
+            size_t offset = minpos - base_;
+            tss_.erase(tss_.begin(), tss_.begin() + offset);
+            xss_.erase(xss_.begin(), xss_.begin() + offset);
+            base_ = minpos;
+        }
+    }
+};
+
+
+//! Reader attached to a `SharedScanState`
+struct SharedScanIterator : NBTreeIterator {
+    std::shared_ptr<SharedScanState> state_;
+    int                              id_;
+    Direction                        dir_;
+
+    SharedScanIterator(std::shared_ptr<SharedScanState> state, int id, Direction dir)
+        : state_(state)
+        , id_(id)
+        , dir_(dir)
+    {
+    }
+
+    virtual ~SharedScanIterator() {
+        state_->detach(id_);
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp* destts, double* destval, size_t size) {
+        return state_->read(id_, destts, destval, size);
+    }
+
+    virtual Direction get_direction() {
+        return dir_;
+    }
+};
+
+
 // ///////////////////// //
 //   NBTreeExtentsList   //
 // ///////////////////// //
@@ -1274,6 +2266,9 @@ NBTreeExtentsList::NBTreeExtentsList(aku_ParamId id, std::vector<LogicAddr> addr
     , id_(id)
     , rescue_points_(std::move(addresses))
     , initialized_(false)
+    , rate_begin_(0)
+    , rate_count_(0)
+    , val_codec_hint_(VAL_CODEC_FCM)
 {
     if (rescue_points_.size() >= std::numeric_limits<u16>::max()) {
         AKU_PANIC("Tree depth is too large");
@@ -1286,6 +2281,44 @@ void NBTreeExtentsList::force_init() {
     }
 }
 
+void NBTreeExtentsList::force_init_all(std::vector<std::shared_ptr<NBTreeExtentsList>> const& trees) {
+    auto nworkers = std::min(static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 2u)),
+                             trees.size());
+    if (nworkers < 2) {
+        for (auto const& tree: trees) {
+            tree->force_init();
+        }
+        return;
+    }
+    // Trees are disjoint so they can be opened independently. Work is
+    // claimed through the shared counter to keep the workers busy even
+    // if recovery time varies from series to series.
+    std::atomic<size_t> ixtree{0};
+    auto worker = [&]() {
+        while (true) {
+            auto ix = ixtree.fetch_add(1);
+            if (ix >= trees.size()) {
+                break;
+            }
+            trees.at(ix)->force_init();
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < nworkers; i++) {
+        pool.emplace_back(worker);
+    }
+    for (auto& thread: pool) {
+        thread.join();
+    }
+}
+
+void NBTreeExtentsList::set_val_codec(int codec) {
+    val_codec_hint_ = codec;
+    if (!extents_.empty()) {
+        extents_.front()->set_val_codec(codec);
+    }
+}
+
 std::vector<NBTreeExtent const*> NBTreeExtentsList::get_extents() const {
     std::vector<NBTreeExtent const*> result;
     for (auto const& ptr: extents_) {
@@ -1302,9 +2335,26 @@ bool NBTreeExtentsList::append(aku_Timestamp ts, double value) {
         // create first leaf node
         std::unique_ptr<NBTreeExtent> leaf;
         leaf.reset(new NBTreeLeafExtent(bstore_, shared_from_this(), id_, EMPTY_ADDR));
+        leaf->set_val_codec(val_codec_hint_);
         extents_.push_back(std::move(leaf));
         rescue_points_.push_back(EMPTY_ADDR);
     }
+    // Observe the ingest rate and pick the leaf size accordingly: leaves of
+    // a high-rate series roll over every few seconds, larger leaves cut the
+    // commit (and superblock churn) rate proportionally.
+    if (rate_count_ == 0) {
+        rate_begin_ = ts;
+    }
+    rate_count_++;
+    if (rate_count_ == RATE_OBS_INTERVAL) {
+        // Mean sampling interval under 0.1s counts as high-rate
+        static const aku_Timestamp HIGH_RATE_MEAN_INTERVAL = 100000000;  // 0.1s
+        aku_Timestamp span = ts > rate_begin_ ? ts - rate_begin_ : 0u;
+        u16 nblocks = span / RATE_OBS_INTERVAL < HIGH_RATE_MEAN_INTERVAL
+                    ? AKU_NBTREE_MAX_LEAF_NBLOCKS : 1;
+        extents_.front()->set_leaf_nblocks(nblocks);
+        rate_count_ = 0;
+    }
     bool parent_saved = false;
     LogicAddr addr = EMPTY_ADDR;
     std::tie(parent_saved, addr) = extents_.front()->append(ts, value);
@@ -1404,12 +2454,17 @@ void NBTreeExtentsList::open() {
                         " error: " + StatusUtil::str(status));
             AKU_PANIC("Can't open tree");
         }
+        sref.addr = addr;
         root_extent->append(sref);  // this always should return `false` and `EMPTY_ADDR`, no need to check this.
 
         // Create new empty leaf
         std::unique_ptr<NBTreeExtent> leaf_extent(new NBTreeLeafExtent(bstore_, shared_from_this(), id_, addr));
         extents_.push_back(std::move(leaf_extent));
         extents_.push_back(std::move(root_extent));
+        // Account for the new root so `rescue_points_` matches the tree
+        // height (otherwise `close` of a short session emits a root-only
+        // list that the next open would treat as a leaf address)
+        rescue_points_.push_back(EMPTY_ADDR);
     } else {
         // Initialize root node.
         auto root_level = rescue_points_.size() - 1;
@@ -1573,6 +2628,109 @@ std::unique_ptr<NBTreeIterator> NBTreeExtentsList::search(aku_Timestamp begin, a
     return std::move(concat);
 }
 
+std::unique_ptr<NBTreeIterator> NBTreeExtentsList::psearch(aku_Timestamp begin, aku_Timestamp end) const {
+    if (!initialized_) {
+        // FIXME: so ugly!
+        const_cast<NBTreeExtentsList*>(this)->init();
+    }
+    std::vector<std::unique_ptr<NBTreeIterator>> iterators;
+    if (begin < end) {
+        for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
+            iterators.push_back(std::move((*it)->psearch(begin, end)));
+        }
+    } else {
+        for (auto const& root: extents_) {
+            iterators.push_back(std::move(root->psearch(begin, end)));
+        }
+    }
+    if (iterators.size() == 1) {
+        return std::move(iterators.front());
+    }
+    std::unique_ptr<NBTreeIterator> concat;
+    concat.reset(new IteratorConcat(std::move(iterators)));
+    return std::move(concat);
+}
+
+std::unique_ptr<NBTreeIterator> NBTreeExtentsList::search_shared(aku_Timestamp begin, aku_Timestamp end) const {
+    auto key = std::make_pair(begin, end);
+    std::lock_guard<std::mutex> guard(share_mutex_);
+    std::shared_ptr<SharedScanState> state;
+    auto it = live_scans_.find(key);
+    if (it != live_scans_.end()) {
+        state = it->second.lock();
+    }
+    int id = -1;
+    if (state) {
+        id = state->attach();
+    }
+    if (id < 0) {
+        // No active scan over this range (or its stream is partially
+        // discarded already) - start a new decode stream
+        state = std::make_shared<SharedScanState>(search(begin, end));
+        id = state->attach();
+        live_scans_[key] = state;
+    }
+    if (live_scans_.size() > 0x20) {
+        // Sweep completed scans so the map doesn't accumulate dead entries
+        for (auto i = live_scans_.begin(); i != live_scans_.end();) {
+            if (i->second.expired()) {
+                i = live_scans_.erase(i);
+            } else {
+                i++;
+            }
+        }
+    }
+    auto dir = begin < end ? NBTreeIterator::Direction::FORWARD : NBTreeIterator::Direction::BACKWARD;
+    std::unique_ptr<NBTreeIterator> res;
+    res.reset(new SharedScanIterator(state, id, dir));
+    return res;
+}
+
+std::unique_ptr<NBTreeChunkIterator> NBTreeExtentsList::csearch(aku_Timestamp begin, aku_Timestamp end) const {
+    if (!initialized_) {
+        // FIXME: so ugly!
+        const_cast<NBTreeExtentsList*>(this)->init();
+    }
+    std::vector<std::unique_ptr<NBTreeChunkIterator>> iterators;
+    if (begin < end) {
+        for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
+            iterators.push_back(std::move((*it)->csearch(begin, end)));
+        }
+    } else {
+        for (auto const& root: extents_) {
+            iterators.push_back(std::move(root->csearch(begin, end)));
+        }
+    }
+    if (iterators.size() == 1) {
+        return std::move(iterators.front());
+    }
+    std::unique_ptr<NBTreeChunkIterator> concat;
+    concat.reset(new ChunkIteratorConcat(std::move(iterators)));
+    return std::move(concat);
+}
+
+std::tuple<aku_Status, NBTreeAggregationResult> NBTreeExtentsList::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
+    if (!initialized_) {
+        // FIXME: so ugly!
+        const_cast<NBTreeExtentsList*>(this)->init();
+    }
+    NBTreeAggregationResult res = empty_aggregation_result();
+    if (begin > end) {
+        return std::make_tuple(AKU_EBAD_ARG, res);
+    }
+    // Extents cover disjoint time ranges so results can be simply combined.
+    for (auto const& extent: extents_) {
+        aku_Status status;
+        NBTreeAggregationResult tmp;
+        std::tie(status, tmp) = extent->aggregate(begin, end);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, res);
+        }
+        combine_aggregates(&res, tmp);
+    }
+    return std::make_tuple(AKU_SUCCESS, res);
+}
+
 
 std::vector<LogicAddr> NBTreeExtentsList::close() {
     if (initialized_) {
@@ -1608,6 +2766,240 @@ std::vector<LogicAddr> NBTreeExtentsList::get_roots() const {
     return rescue_points_;
 }
 
+std::tuple<aku_Timestamp, aku_Timestamp> NBTreeExtentsList::get_timestamps() const {
+    if (!initialized_) {
+        // FIXME: so ugly!
+        const_cast<NBTreeExtentsList*>(this)->init();
+    }
+    aku_Timestamp begin = AKU_MAX_TIMESTAMP;
+    aku_Timestamp end   = 0;
+    // Every committed node is referenced by the current node of some extent
+    // so the union of the extent roots covers the entire tree.
+    for (auto const& extent: extents_) {
+        if (!extent->is_dirty()) {
+            continue;
+        }
+        aku_Timestamp b, e;
+        std::tie(b, e) = extent->get_timestamps();
+        begin = std::min(begin, b);
+        end   = std::max(end, e);
+    }
+    return std::make_tuple(begin, end);
+}
+
+aku_ParamId NBTreeExtentsList::get_id() const {
+    return id_;
+}
+
+static void count_fragmented_leaves(std::shared_ptr<BlockStore> bstore, LogicAddr addr,
+                                    NBTreeExtentsList::FragmentationStats* stats)
+{
+    NBTreeSuperblock sblock(addr, bstore);
+    std::vector<SubtreeRef> refs;
+    auto status = sblock.read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        return;
+    }
+    for (SubtreeRef const& ref: refs) {
+        if (ref.level == 0) {
+            stats->nleaves++;
+            if (ref.payload_size * 2 < AKU_BLOCK_SIZE - sizeof(SubtreeRef)) {
+                stats->nfragmented++;
+            }
+        } else {
+            count_fragmented_leaves(bstore, ref.addr, stats);
+        }
+    }
+}
+
+NBTreeExtentsList::FragmentationStats NBTreeExtentsList::get_fragmentation() const {
+    FragmentationStats stats = {};
+    if (rescue_points_.empty() || rescue_points_.back() == EMPTY_ADDR ||
+        repair_status(rescue_points_) != RepairStatus::OK)
+    {
+        return stats;
+    }
+    if (rescue_points_.size() < 2) {
+        // Single leaf tree
+        stats.nleaves = 1;
+        return stats;
+    }
+    count_fragmented_leaves(bstore_, rescue_points_.back(), &stats);
+    return stats;
+}
+
+std::tuple<aku_Status, std::vector<LogicAddr>> NBTreeExtentsList::compact(std::shared_ptr<BlockStore> bstore,
+                                                                          aku_ParamId id,
+                                                                          std::vector<LogicAddr> const& roots,
+                                                                          u32 throttle_us)
+{
+    std::vector<LogicAddr> empty;
+    if (repair_status(roots) != RepairStatus::OK) {
+        // Unrepaired tree shouldn't be compacted, data can be lost
+        return std::make_tuple(AKU_EBAD_ARG, std::move(empty));
+    }
+    auto src = std::make_shared<NBTreeExtentsList>(id, roots, bstore);
+    auto dst = std::make_shared<NBTreeExtentsList>(id, empty, bstore);
+    dst->force_init();
+    auto it = src->search(0, AKU_MAX_TIMESTAMP);
+    const size_t BATCH_SIZE = 0x1000;
+    std::vector<aku_Timestamp> tss(BATCH_SIZE);
+    std::vector<double> xss(BATCH_SIZE);
+    while (true) {
+        aku_Status status;
+        size_t outsz;
+        std::tie(status, outsz) = it->read(tss.data(), xss.data(), BATCH_SIZE);
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return std::make_tuple(status, std::move(empty));
+        }
+        for (size_t i = 0; i < outsz; i++) {
+            dst->append(tss.at(i), xss.at(i));
+        }
+        if (status == AKU_ENO_DATA || outsz == 0) {
+            break;
+        }
+        if (throttle_us != 0) {
+            // Leave a gap for the foreground I/O
+            std::this_thread::sleep_for(std::chrono::microseconds(throttle_us));
+        }
+    }
+    auto new_roots = dst->close();
+    return std::make_tuple(AKU_SUCCESS, std::move(new_roots));
+}
+
+std::tuple<aku_Status, std::vector<LogicAddr>> NBTreeExtentsList::bulk_load(std::shared_ptr<BlockStore> bstore,
+                                                                            aku_ParamId id,
+                                                                            const aku_Timestamp* tss,
+                                                                            const double* xss,
+                                                                            size_t size)
+{
+    std::vector<LogicAddr> empty;
+    if (size == 0) {
+        return std::make_tuple(AKU_ENO_DATA, std::move(empty));
+    }
+    for (size_t i = 1; i < size; i++) {
+        if (tss[i] < tss[i-1]) {
+            // Input should be presorted
+            return std::make_tuple(AKU_EBAD_ARG, std::move(empty));
+        }
+    }
+    // One open superblock per level (index is the level of the children).
+    // Node at level N is created lazily when the first level N-1 child
+    // gets committed.
+    std::vector<std::unique_ptr<NBTreeSuperblock>> stack;
+    std::vector<LogicAddr> prevs;
+    std::vector<u16> fanouts;
+    // Send committed node's summary to the upper level node (committing
+    // the upper level node first if it's full, the same way extents do).
+    std::function<aku_Status(SubtreeRef const&)> push_ref = [&](SubtreeRef const& ref) {
+        size_t ix = ref.level;
+        if (stack.size() <= ix) {
+            stack.emplace_back(new NBTreeSuperblock(id, EMPTY_ADDR, 0, static_cast<u16>(ix + 1)));
+            prevs.push_back(EMPTY_ADDR);
+            fanouts.push_back(0);
+        }
+        aku_Status status = stack.at(ix)->append(ref);
+        if (status == AKU_EOVERFLOW) {
+            LogicAddr addr;
+            std::tie(status, addr) = stack.at(ix)->commit(bstore);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            SubtreeRef payload = {};
+            status = init_subtree_from_subtree(*stack.at(ix), payload);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            payload.addr = addr;
+            fanouts.at(ix)++;
+            if (fanouts.at(ix) == AKU_NBTREE_FANOUT) {
+                fanouts.at(ix) = 0;
+            }
+            prevs.at(ix) = addr;
+            stack.at(ix).reset(new NBTreeSuperblock(id, prevs.at(ix), fanouts.at(ix),
+                                                    static_cast<u16>(ix + 1)));
+            status = push_ref(payload);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            status = stack.at(ix)->append(ref);
+        }
+        return status;
+    };
+    // Fill the leaves straight from the input, each leaf is written
+    // exactly once, when it's full.
+    LogicAddr leaf_prev = EMPTY_ADDR;
+    u16 leaf_fanout = 0;
+    LogicAddr leaf_addr = EMPTY_ADDR;
+    size_t pos = 0;
+    while (pos < size) {
+        NBTreeLeaf leaf(id, leaf_prev, leaf_fanout);
+        while (pos < size) {
+            aku_Status status = leaf.append(tss[pos], xss[pos]);
+            if (status == AKU_EOVERFLOW) {
+                break;
+            } else if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, std::move(empty));
+            }
+            pos++;
+        }
+        aku_Status status;
+        std::tie(status, leaf_addr) = leaf.commit(bstore);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, std::move(empty));
+        }
+        if (pos < size || !stack.empty()) {
+            SubtreeRef payload = {};
+            status = init_subtree_from_leaf(leaf, payload);
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, std::move(empty));
+            }
+            payload.addr = leaf_addr;
+            status = push_ref(payload);
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, std::move(empty));
+            }
+        }
+        leaf_fanout++;
+        if (leaf_fanout == AKU_NBTREE_FANOUT) {
+            leaf_fanout = 0;
+        }
+        leaf_prev = leaf_addr;
+    }
+    if (stack.empty()) {
+        // Single leaf tree
+        std::vector<LogicAddr> rescue_points = { leaf_addr };
+        return std::make_tuple(AKU_SUCCESS, std::move(rescue_points));
+    }
+    // Commit the remaining nodes bottom-up, each commit can grow
+    // the stack by one level.
+    LogicAddr root_addr = EMPTY_ADDR;
+    for (size_t ix = 0; ix < stack.size(); ix++) {
+        aku_Status status;
+        std::tie(status, root_addr) = stack.at(ix)->commit(bstore);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, std::move(empty));
+        }
+        if (ix + 1 < stack.size()) {
+            SubtreeRef payload = {};
+            status = init_subtree_from_subtree(*stack.at(ix), payload);
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, std::move(empty));
+            }
+            payload.addr = root_addr;
+            status = push_ref(payload);
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, std::move(empty));
+            }
+        }
+    }
+    // Same shape as `close` output - the root node is the only
+    // rescue point of the finished tree.
+    std::vector<LogicAddr> rescue_points(stack.size() + 1, EMPTY_ADDR);
+    rescue_points.back() = root_addr;
+    return std::make_tuple(AKU_SUCCESS, std::move(rescue_points));
+}
+
 NBTreeExtentsList::RepairStatus NBTreeExtentsList::repair_status(std::vector<LogicAddr> rescue_points) {
     ssize_t count = static_cast<ssize_t>(rescue_points.size()) -
                     std::count(rescue_points.begin(), rescue_points.end(), EMPTY_ADDR);
@@ -74,6 +74,8 @@
 #pragma once
 // C++ headers
 #include <deque>
+#include <map>
+#include <mutex>
 
 // App headers
 #include "blockstore.h"
@@ -92,6 +94,13 @@ enum {
     AKU_NBTREE_FANOUT = 32,
 };
 
+enum {
+    //! Number of consecutive 4KB blocks in a leaf created for high-rate
+    //! series (64KB leaves roll over ~16x less often). Limited by the u16
+    //! `payload_size` field of `SubtreeRef`.
+    AKU_NBTREE_MAX_LEAF_NBLOCKS = 16,
+};
+
 /** Reference to tree node.
   * Ref contains some metadata: version, level, payload_size, id.
   * This metadata corresponds to the current node.
@@ -132,6 +141,34 @@ struct SubtreeRef {
 } __attribute__((packed));
 
 
+/** Hot subset of `SubtreeRef` needed to drive the superblock descent.
+  * Stored in the block in SoA form (see `SubtreeRefIndex` in nbtree.cpp)
+  * so a range probe reads a couple of adjacent cache lines instead of
+  * touching all the full-sized refs.
+  */
+struct SubtreeRefSlim {
+    //! First element's timestamp
+    aku_Timestamp begin;
+    //! Last element's timestamp
+    aku_Timestamp end;
+    //! Object addr in blockstore
+    LogicAddr addr;
+    //! Node level in the tree
+    u16 level;
+};
+
+
+/** Aggregates computed over a time range.
+  * If `count` is zero the range is empty and the other fields are meaningless.
+  */
+struct NBTreeAggregationResult {
+    u64    count;  //!< Number of elements in the range
+    double sum;    //!< Sum of the elements
+    double min;    //!< Smallest value
+    double max;    //!< Largest value
+};
+
+
 /** NBTree iterator.
   * @note all ranges is semi-open. This means that if we're
   *       reading data from A to B, iterator should return
@@ -161,6 +198,36 @@ struct NBTreeIterator {
 };
 
 
+/** Chunk of decoded data (timestamps + values spans).
+  * Spans stay valid until the next `read_chunk` call.
+  */
+struct NBTreeDecodedChunk {
+    const aku_Timestamp* tss;
+    const double*        xss;
+    size_t               size;
+};
+
+
+/** Chunk-granular NBTree iterator.
+  * Hands out entire decoded leaf blocks with begin/end trimming done once per
+  * block, so the consumer pays one virtual call per thousands of samples
+  * instead of copying through per-sample interfaces. Range semantic is the
+  * same as in `NBTreeIterator`.
+  */
+struct NBTreeChunkIterator {
+
+    //! D-tor
+    virtual ~NBTreeChunkIterator() = default;
+
+    /** Read next decoded chunk.
+      * @return status and chunk (zero-length chunk and AKU_ENO_DATA at the end).
+      */
+    virtual std::tuple<aku_Status, NBTreeDecodedChunk> read_chunk() = 0;
+
+    virtual NBTreeIterator::Direction get_direction() = 0;
+};
+
+
 /** NBTree leaf node. Supports append operation.
   * Can be commited to block store when full.
   */
@@ -174,6 +241,17 @@ class NBTreeLeaf {
     //! Fanout index
     u16 fanout_index_;
 
+    /** Try to re-encode node's payload with alternative codec configurations
+      * and keep the smallest one (the choice is recorded in the data block
+      * header so reads stay self-describing).
+      * @param timestamps Leaf's timestamps (captured before commit).
+      * @param values Leaf's values.
+      * @param size Payload size produced by the default codec.
+      * @return actual payload size (can be less then `size`)
+      */
+    size_t adapt_codecs(std::vector<aku_Timestamp> const& timestamps,
+                        std::vector<double> const& values, size_t size);
+
 public:
     enum class LeafLoadMethod {
         FULL_PAGE_LOAD,
@@ -185,8 +263,13 @@ public:
       * @param link to block store.
       * @param prev Prev element of the tree.
       * @param fanout_index Index inside current fanout
+      * @param nblocks Number of consecutive 4KB blocks the leaf occupies
+      *        (high-rate series use AKU_NBTREE_MAX_LEAF_NBLOCKS).
+      * @param val_codec Value codec of the leaf (one of `DataBlockValCodec`
+      *        values, integral series use VAL_CODEC_FIXED).
       */
-    NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index);
+    NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index, u16 nblocks = 1,
+               int val_codec = VAL_CODEC_FCM);
 
     /** Load from block store.
       * @param block Leaf's serialized data.
@@ -198,9 +281,10 @@ public:
     /** Load from block store.
       * @param bstore Block store.
       * @param curr Address of the current leaf-node.
-      * @param load Load method.
+      * @param hint Access intent of the read (leaf-chain scans use
+      *        ReadHint::SCAN so the read doesn't pollute the block cache).
       */
-    NBTreeLeaf(std::shared_ptr<BlockStore> bstore, LogicAddr curr);
+    NBTreeLeaf(std::shared_ptr<BlockStore> bstore, LogicAddr curr, ReadHint hint = ReadHint::LOOKUP);
 
     //! Returns number of elements.
     size_t nelements() const;
@@ -218,6 +302,22 @@ public:
       */
     aku_Status read_all(std::vector<aku_Timestamp>* timestamps, std::vector<double>* values) const;
 
+    /** Read elements that fall into the time range - [begin, end) if
+      * begin < end, (end, begin] otherwise (output is in ascending time
+      * order either way). The block codecs are stateful so samples that
+      * precede the range still have to be decoded, but they're not
+      * materialized and the decode stops at the first sample past the
+      * range - narrow queries over dense leaves skip most of the work.
+      * @param begin Begining of the range.
+      * @param end End of the range.
+      * @param timestamps Destination for timestamps.
+      * @param values Destination for values.
+      * @return status.
+      */
+    aku_Status read_range(aku_Timestamp begin, aku_Timestamp end,
+                          std::vector<aku_Timestamp>* timestamps,
+                          std::vector<double>* values) const;
+
     //! Append values to NBTree
     aku_Status append(aku_Timestamp ts, double value);
 
@@ -235,6 +335,12 @@ public:
     //! Return iterator that outputs all values in time range that is stored in this leaf.
     std::unique_ptr<NBTreeIterator> range(aku_Timestamp begin, aku_Timestamp end) const;
 
+    //! Compute aggregates of the values in the [begin, end) range (begin should not exceed end).
+    std::tuple<aku_Status, NBTreeAggregationResult> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+
+    //! Return chunk-granular iterator over the time range stored in this leaf.
+    std::unique_ptr<NBTreeChunkIterator> chunks(aku_Timestamp begin, aku_Timestamp end) const;
+
     //! Search for values in a range (in this and connected leaf nodes).
     std::unique_ptr<NBTreeIterator> search(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const;
 };
@@ -275,6 +381,12 @@ public:
 
     aku_Status read_all(std::vector<SubtreeRef>* refs) const;
 
+    /** Read hot child metadata (timestamps and address) from the SoA index
+      * section of the block. Cheaper than `read_all` - the index is packed
+      * into a couple of cache lines while the full refs span the whole block.
+      */
+    aku_Status read_index(std::vector<SubtreeRefSlim>* refs) const;
+
     //! Get node's level
     u16 get_level() const;
 
@@ -293,6 +405,24 @@ public:
     std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const;
 
     std::unique_ptr<NBTreeIterator> search(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const;
+
+    /** Parallel version of `search`. Child subtrees are read and decoded by a
+      * worker pool, results are merged in order. Designed for cold historical
+      * scans that are otherwise single-core-bound.
+      */
+    std::unique_ptr<NBTreeIterator> psearch(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const;
+
+    /** Compute aggregates of the values in the [begin, end) range.
+      * Subtrees fully covered by the range are answered from the precomputed
+      * SubtreeRef aggregates alone, leaves are decompressed only at the range
+      * boundaries (O(log) blocks are touched instead of the entire range).
+      * `begin` should not exceed `end`.
+      */
+    std::tuple<aku_Status, NBTreeAggregationResult> aggregate(aku_Timestamp begin, aku_Timestamp end,
+                                                              std::shared_ptr<BlockStore> bstore) const;
+
+    //! Chunk-granular version of `search` (one decoded leaf per call).
+    std::unique_ptr<NBTreeChunkIterator> csearch(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const;
 };
 
 
@@ -311,6 +441,16 @@ struct NBTreeExtent {
       */
     virtual std::tuple<bool, LogicAddr> append(SubtreeRef const& pl) = 0;
 
+    /** Set number of 4KB blocks used by newly created leaf nodes (no-op for
+      * inner nodes). Takes effect on the next rollover.
+      */
+    virtual void set_leaf_nblocks(u16) {}
+
+    /** Set value codec used by newly created leaf nodes (no-op for inner
+      * nodes). Takes effect on the next rollover.
+      */
+    virtual void set_val_codec(int) {}
+
     /** Write all changes to the block-store, even if node is not full.
       * @param final Should be set to false during normal operation and set to true during commit.
       * @return boolean value that is set to true when higher level node was saved as a
@@ -321,14 +461,30 @@ struct NBTreeExtent {
     //! Return iterator
     virtual std::unique_ptr<NBTreeIterator> search(aku_Timestamp begin, aku_Timestamp end) const = 0;
 
+    //! Return parallel scan iterator (subtrees are decoded by a worker pool)
+    virtual std::unique_ptr<NBTreeIterator> psearch(aku_Timestamp begin, aku_Timestamp end) const = 0;
+
+    //! Compute aggregates of the [begin, end) range using precomputed subtree refs
+    virtual std::tuple<aku_Status, NBTreeAggregationResult> aggregate(aku_Timestamp begin, aku_Timestamp end) const = 0;
+
+    //! Return chunk-granular iterator (one decoded leaf block per call)
+    virtual std::unique_ptr<NBTreeChunkIterator> csearch(aku_Timestamp begin, aku_Timestamp end) const = 0;
+
     //! Returns true if extent was modified after last commit and has some unsaved data.
     virtual bool is_dirty() const = 0;
 
+    //! Get timestamps of the first and the last elements covered by the extent
+    virtual std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const = 0;
+
     //! Check extent's internal consitency
     static void check_extent(const NBTreeExtent *extent, std::shared_ptr<BlockStore> bstore, size_t level);
 };
 
 
+//! State shared by concurrent scans over the same time range (see `search_shared`)
+struct SharedScanState;
+
+
 /** @brief This class represents set of roots of the NBTree.
   * It serves two purposes:
   * @li store all roots of the NBTree
@@ -340,6 +496,22 @@ class NBTreeExtentsList : public std::enable_shared_from_this<NBTreeExtentsList>
     aku_ParamId id_;
     std::vector<LogicAddr> rescue_points_;
     bool initialized_;
+    //! First timestamp of the current ingest rate observation window
+    aku_Timestamp rate_begin_;
+    //! Number of samples ingested since `rate_begin_`
+    u64 rate_count_;
+    //! Value codec of new leaf nodes (per-series hint, see `set_val_codec`)
+    int val_codec_hint_;
+
+    enum {
+        //! Number of samples between ingest rate observations
+        RATE_OBS_INTERVAL = 0x1000,
+    };
+
+    // In-flight shared scans, keyed by the time range
+    mutable std::mutex share_mutex_;
+    mutable std::map<std::pair<aku_Timestamp, aku_Timestamp>,
+                     std::weak_ptr<SharedScanState>> live_scans_;
 
     void init();
     void open();
@@ -356,20 +528,69 @@ public:
 
     bool append(aku_Timestamp ts, double value);
 
+    /** Set value codec used by newly created leaf nodes (one of
+      * `DataBlockValCodec` values). The hint comes from the series
+      * metadata - latency series that store microsecond integers should
+      * use VAL_CODEC_FIXED. Takes effect on the next leaf rollover.
+      */
+    void set_val_codec(int codec);
+
     std::unique_ptr<NBTreeIterator> search(aku_Timestamp begin, aku_Timestamp end) const;
 
+    //! Parallel scan mode - same output as `search` but subtree reads/decodes
+    //! are fanned out to a worker pool (pays off on large cold scans).
+    std::unique_ptr<NBTreeIterator> psearch(aku_Timestamp begin, aku_Timestamp end) const;
+
+    /** Scan sharing version of `search`. Concurrent iterators over the same
+      * time range attach to one decode stream: each block is read and decoded
+      * once and the results are fanned out to all attached iterators (committed
+      * NB-tree blocks are immutable so the streams can't diverge). Iterators
+      * can be used from different threads. An iterator that arrives when part
+      * of the stream was already discarded gets its own stream.
+      */
+    std::unique_ptr<NBTreeIterator> search_shared(aku_Timestamp begin, aku_Timestamp end) const;
+
+    /** Compute aggregates (count/sum/min/max) of the [begin, end) range.
+      * Answered from the precomputed SubtreeRef aggregates, only the blocks at
+      * the range boundaries are decompressed. `begin` should not exceed `end`.
+      */
+    std::tuple<aku_Status, NBTreeAggregationResult> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+
+    /** Chunk-granular scan - same output as `search` but data is handed out
+      * as decoded leaf blocks (timestamps + values spans), trimming is done
+      * once per block instead of once per sample.
+      */
+    std::unique_ptr<NBTreeChunkIterator> csearch(aku_Timestamp begin, aku_Timestamp end) const;
+
     //! Commit changes to btree and close (do not call blockstore.flush), return list of addresses.
     std::vector<LogicAddr> close();
 
     //! Get roots of the tree
     std::vector<LogicAddr> get_roots() const;
 
+    /** Get timestamps of the first and the last elements in the tree.
+      * Answered from the in-memory extent roots, no block I/O is performed.
+      * Returned `begin` exceeds `end` if the tree is empty.
+      */
+    std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const;
+
+    //! Get series id
+    aku_ParamId get_id() const;
+
     //! Get pointers to extents (for tests).
     std::vector<NBTreeExtent const*> get_extents() const;
 
     //! Force lazy initialization process.
     void force_init();
 
+    /** Initialize many trees in parallel (startup path). Open and repair
+      * are dominated by `read_block` calls so initializing one series at
+      * a time leaves the disk idle. Each worker opens one tree at a time
+      * thus the number of outstanding `read_block` requests is bounded by
+      * the pool size.
+      */
+    static void force_init_all(std::vector<std::shared_ptr<NBTreeExtentsList>> const& trees);
+
     enum class RepairStatus {
         OK,
         SKIP,
@@ -379,6 +600,56 @@ public:
     //! Calculate repair status for each rescue point.
     static RepairStatus repair_status(std::vector<LogicAddr> rescue_points);
 
+    //! Leaf fragmentation summary (see `get_fragmentation`)
+    struct FragmentationStats {
+        u32 nleaves;      //< Number of committed leaf nodes
+        u32 nfragmented;  //< Number of leaf nodes filled below half capacity
+    };
+
+    /** Count committed leaf nodes that are filled below half of the block
+      * capacity. Every restart closes partially filled leaves so long
+      * running series accumulate runs of tiny leaves that inflate read
+      * amplification. Only the inner nodes are read, leaves are not.
+      */
+    FragmentationStats get_fragmentation() const;
+
+    /** Rewrite the tree merging under-filled adjacent leaves into full
+      * ones. The data is read through an iterator and re-appended into a
+      * fresh tree so the result consists of new blocks with updated
+      * superblock refs; the old blocks are reclaimed when their
+      * generation is recycled. The source tree should be committed
+      * (`close` the tree and pass the returned addresses).
+      * @param bstore Block-store.
+      * @param id Series id.
+      * @param roots Rescue points of the committed source tree.
+      * @param throttle_us Pause between batches in microseconds (foreground I/O throttling).
+      * @return status and list of rescue points of the compacted tree
+      */
+    static std::tuple<aku_Status, std::vector<LogicAddr>> compact(std::shared_ptr<BlockStore> bstore,
+                                                                  aku_ParamId id,
+                                                                  std::vector<LogicAddr> const& roots,
+                                                                  u32 throttle_us);
+
+    /** Build a new tree from sorted columnar data (backfill fast path).
+      * Leaves are filled straight from the input arrays and superblocks are
+      * assembled bottom-up, every node is written through
+      * `BlockStore::append_block` exactly once when it's full. The input is
+      * already sorted so the write path of the ingestion engine (and its
+      * reorder machinery) is bypassed entirely.
+      * @param bstore Block-store.
+      * @param id Series id.
+      * @param tss Timestamps, sorted in ascending order.
+      * @param xss Values (one per timestamp).
+      * @param size Number of elements in both arrays.
+      * @return status and list of rescue points of the new tree
+      *         (AKU_EBAD_ARG if the input is not sorted).
+      */
+    static std::tuple<aku_Status, std::vector<LogicAddr>> bulk_load(std::shared_ptr<BlockStore> bstore,
+                                                                    aku_ParamId id,
+                                                                    const aku_Timestamp* tss,
+                                                                    const double* xss,
+                                                                    size_t size);
+
     // Debug
 
     //! Walk the tree from the root and print it to the stdout
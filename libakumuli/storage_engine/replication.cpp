@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "replication.h"
+
+namespace Akumuli {
+namespace StorageEngine {
+
+ReplicationStream::ReplicationStream(std::shared_ptr<BlockStore> bstore)
+    : bstore_(bstore)
+    , last_acked_(EMPTY_ADDR)
+    , lagging_(false)
+    , nshipped_(0)
+    , ndropped_(0)
+{
+}
+
+void ReplicationStream::start() {
+    auto self = shared_from_this();
+    bstore_->set_commit_callback([self](LogicAddr addr, std::shared_ptr<Block> block) {
+        self->on_commit(addr, block);
+    });
+}
+
+void ReplicationStream::stop() {
+    bstore_->set_commit_callback(BlockStore::CommitCallback());
+}
+
+void ReplicationStream::on_commit(LogicAddr addr, std::shared_ptr<Block> block) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (lagging_) {
+        // Follower should be re-seeded, buffering is pointless
+        ndropped_++;
+        return;
+    }
+    if (pending_.size() + in_flight_.size() >= MAX_PENDING_BLOCKS) {
+        // Follower fell out of the window - drop the buffer, the blocks
+        // are immutable and will be delivered by the snapshot re-seed
+        ndropped_ += pending_.size() + 1;
+        pending_.clear();
+        lagging_ = true;
+        return;
+    }
+    pending_.push_back({ addr, block });
+}
+
+std::vector<ReplicationStream::Entry> ReplicationStream::pull() {
+    std::lock_guard<std::mutex> guard(lock_);
+    std::vector<Entry> batch;
+    while (!pending_.empty() && batch.size() < BATCH_SIZE) {
+        batch.push_back(pending_.front());
+        in_flight_.push_back(pending_.front());
+        pending_.pop_front();
+        nshipped_++;
+    }
+    return batch;
+}
+
+void ReplicationStream::ack(LogicAddr addr) {
+    std::lock_guard<std::mutex> guard(lock_);
+    while (!in_flight_.empty() && in_flight_.front().addr <= addr) {
+        last_acked_ = in_flight_.front().addr;
+        in_flight_.pop_front();
+    }
+}
+
+bool ReplicationStream::is_lagging() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return lagging_;
+}
+
+LogicAddr ReplicationStream::get_last_acked() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return last_acked_;
+}
+
+u64 ReplicationStream::get_shipped_count() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return nshipped_;
+}
+
+}}  // namespace
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include "blockstore.h"
+
+#include <deque>
+#include <mutex>
+
+namespace Akumuli {
+namespace StorageEngine {
+
+/** Replication stream - log shipping of committed blocks to a standby.
+  * Committed blocks are immutable and addressed by `LogicAddr` so the
+  * stream is a simple tail of the commit sequence. The stream subscribes
+  * to the block-store commit callback, buffers committed blocks and hands
+  * them out in batches through `pull`; the transport acknowledges shipped
+  * batches with `ack` which releases the buffered payloads. Flow control
+  * is window based: when the follower falls more than `MAX_PENDING_BLOCKS`
+  * behind, the buffer is dropped and the stream switches to the `lagging`
+  * state - the follower should be re-seeded from a snapshot (see
+  * `FixedSizeFileStorage::open_snapshot`) and the stream restarted.
+  * The object is thread-safe (commits and pulls come from different
+  * threads).
+  */
+class ReplicationStream : public std::enable_shared_from_this<ReplicationStream> {
+public:
+    enum {
+        //! Max number of unacknowledged blocks (flow control window)
+        MAX_PENDING_BLOCKS = 0x400,
+        //! Max number of blocks in one batch
+        BATCH_SIZE = 0x20,
+    };
+
+    //! Committed block with its address
+    struct Entry {
+        LogicAddr              addr;
+        std::shared_ptr<Block> payload;
+    };
+
+private:
+    std::shared_ptr<BlockStore> bstore_;
+    mutable std::mutex lock_;
+    std::deque<Entry>  pending_;     //< Committed but not yet pulled
+    std::deque<Entry>  in_flight_;   //< Pulled but not yet acknowledged
+    LogicAddr          last_acked_;  //< Address of the last acknowledged block
+    bool               lagging_;     //< Follower fell out of the window
+    u64                nshipped_;    //< Total number of blocks shipped
+    u64                ndropped_;    //< Total number of blocks dropped (lagging follower)
+
+public:
+    /** C-tor. The stream should be attached with `start` before any
+      * commits happen, blocks committed earlier should be delivered to
+      * the follower through the snapshot mechanism.
+      */
+    ReplicationStream(std::shared_ptr<BlockStore> bstore);
+
+    //! Subscribe to the block-store commit callback.
+    void start();
+
+    //! Unsubscribe (the stream object can outlive the subscription).
+    void stop();
+
+    /** Get next batch of committed blocks (up to `BATCH_SIZE` entries).
+      * Empty result means the follower is in sync. The entries stay
+      * buffered until acknowledged.
+      */
+    std::vector<Entry> pull();
+
+    /** Acknowledge every shipped block up to `addr` (inclusive) and
+      * release the buffered payloads.
+      */
+    void ack(LogicAddr addr);
+
+    /** Returns true if the follower fell out of the flow control window
+      * and should be re-seeded from a snapshot.
+      */
+    bool is_lagging() const;
+
+    //! Address of the last acknowledged block (EMPTY_ADDR if nothing was acked).
+    LogicAddr get_last_acked() const;
+
+    //! Total number of blocks shipped through the stream.
+    u64 get_shipped_count() const;
+
+    //! Block commit callback (invoked by the block-store).
+    void on_commit(LogicAddr addr, std::shared_ptr<Block> block);
+};
+
+}}  // namespace
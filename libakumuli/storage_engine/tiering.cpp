@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "tiering.h"
+
+#include <apr.h>
+#include <apr_general.h>
+#include <apr_file_io.h>
+
+#include "log_iface.h"
+#include "util.h"
+
+namespace Akumuli {
+namespace StorageEngine {
+
+static void _close_apr_file(apr_file_t* file) {
+    apr_file_close(file);
+}
+
+static AprPoolPtr _make_apr_pool() {
+    apr_pool_t* mem_pool = NULL;
+    apr_status_t status = apr_pool_create(&mem_pool, NULL);
+    if (status != APR_SUCCESS) {
+        AKU_PANIC("Can't create APR pool");
+    }
+    AprPoolPtr pool(mem_pool, &apr_pool_destroy);
+    return std::move(pool);
+}
+
+FileColdStorage::FileColdStorage(std::string prefix)
+    : prefix_(prefix)
+{
+}
+
+std::string FileColdStorage::object_path(u32 id, u32 gen) const {
+    return prefix_ + "vol" + std::to_string(id) + "_gen" + std::to_string(gen);
+}
+
+aku_Status FileColdStorage::write_part(u32 id, u32 gen, u64 offset, const u8* data, u64 size) {
+    AprPoolPtr pool = _make_apr_pool();
+    auto path = object_path(id, gen) + ".part";
+    apr_file_t* pfile = nullptr;
+    apr_status_t status = apr_file_open(&pfile, path.c_str(), APR_CREATE|APR_WRITE, APR_OS_DEFAULT, pool.get());
+    if (status != APR_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't open cold storage object " + path);
+        return AKU_EGENERAL;
+    }
+    AprFilePtr file(pfile, &_close_apr_file);
+    apr_off_t seek_off = static_cast<apr_off_t>(offset);
+    status = apr_file_seek(file.get(), APR_SET, &seek_off);
+    if (status != APR_SUCCESS) {
+        return AKU_EGENERAL;
+    }
+    apr_size_t bytes_written = 0;
+    status = apr_file_write_full(file.get(), data, static_cast<apr_size_t>(size), &bytes_written);
+    if (status != APR_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't write cold storage object " + path);
+        return AKU_EGENERAL;
+    }
+    return apr_file_flush(file.get()) == APR_SUCCESS ? AKU_SUCCESS : AKU_EGENERAL;
+}
+
+aku_Status FileColdStorage::seal(u32 id, u32 gen) {
+    AprPoolPtr pool = _make_apr_pool();
+    auto path = object_path(id, gen);
+    apr_status_t status = apr_file_rename((path + ".part").c_str(), path.c_str(), pool.get());
+    if (status != APR_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't seal cold storage object " + path);
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status FileColdStorage::read_range(u32 id, u32 gen, u64 offset, u64 size, u8* dest) {
+    AprPoolPtr pool = _make_apr_pool();
+    auto path = object_path(id, gen);
+    apr_file_t* pfile = nullptr;
+    apr_status_t status = apr_file_open(&pfile, path.c_str(), APR_READ, APR_OS_DEFAULT, pool.get());
+    if (status != APR_SUCCESS) {
+        // Sealed object should exist, `.part` leftovers are not readable
+        return AKU_ENOT_FOUND;
+    }
+    AprFilePtr file(pfile, &_close_apr_file);
+    apr_off_t seek_off = static_cast<apr_off_t>(offset);
+    status = apr_file_seek(file.get(), APR_SET, &seek_off);
+    if (status != APR_SUCCESS) {
+        return AKU_EGENERAL;
+    }
+    apr_size_t outsize = 0;
+    status = apr_file_read_full(file.get(), dest, static_cast<apr_size_t>(size), &outsize);
+    if (status != APR_SUCCESS || outsize != size) {
+        Logger::msg(AKU_LOG_ERROR, "Can't read cold storage object " + path);
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+void FileColdStorage::remove(u32 id, u32 gen) {
+    AprPoolPtr pool = _make_apr_pool();
+    auto path = object_path(id, gen);
+    // Both spellings can exist if the crash happened between rename and
+    // the meta-volume update, remove is a cleanup so errors are ignored.
+    apr_file_remove((path + ".part").c_str(), pool.get());
+    apr_file_remove(path.c_str(), pool.get());
+}
+
+}}  // namespace
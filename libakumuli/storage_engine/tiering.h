@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <memory>
+#include <string>
+
+#include "akumuli.h"
+#include "volume.h"
+
+namespace Akumuli {
+namespace StorageEngine {
+
+/** Cold tier for sealed volumes. Objects are addressed by volume id and
+  * generation (same pair that makes reads through a recycled volume fail,
+  * so a stale object can never serve a live address). Uploads are split
+  * into parts so a multi-GB volume doesn't have to be buffered in memory -
+  * parts can arrive in any order and the object becomes readable only
+  * after `seal`. Reads are byte ranges, the caller fetches only the blocks
+  * it needs.
+  */
+struct ColdStorage {
+    virtual ~ColdStorage() = default;
+
+    /** Upload part of the object.
+      * @param id Volume index.
+      * @param gen Volume generation at demotion time.
+      * @param offset Byte offset of the part inside the object.
+      * @param data Part payload.
+      * @param size Part size in bytes.
+      */
+    virtual aku_Status write_part(u32 id, u32 gen, u64 offset, const u8* data, u64 size) = 0;
+
+    //! Make the uploaded object visible for reads (parts can't be added afterwards).
+    virtual aku_Status seal(u32 id, u32 gen) = 0;
+
+    /** Fetch byte range of the sealed object.
+      * @return AKU_ENOT_FOUND if the object doesn't exist or wasn't sealed.
+      */
+    virtual aku_Status read_range(u32 id, u32 gen, u64 offset, u64 size, u8* dest) = 0;
+
+    //! Delete the object (the volume was recycled, the range is dead).
+    virtual void remove(u32 id, u32 gen) = 0;
+};
+
+/** File backed cold tier. Objects are plain files under a path prefix -
+  * point it at an S3 gateway mount (s3fs, goofys) to get object storage
+  * without a client library in the critical path, or at a cheap HDD array
+  * for a local cold tier. An SDK backed client (multipart upload maps
+  * 1:1 to `write_part`/`seal`, GET with a Range header to `read_range`)
+  * plugs in behind the same interface.
+  * In-progress uploads carry a `.part` suffix and are renamed on `seal`,
+  * so a crash mid-upload never leaves a readable half-object.
+  */
+class FileColdStorage : public ColdStorage {
+    std::string prefix_;
+
+    std::string object_path(u32 id, u32 gen) const;
+
+public:
+    //! C-tor. `prefix` is prepended to every object name (existing directory or file prefix).
+    FileColdStorage(std::string prefix);
+
+    virtual aku_Status write_part(u32 id, u32 gen, u64 offset, const u8* data, u64 size);
+
+    virtual aku_Status seal(u32 id, u32 gen);
+
+    virtual aku_Status read_range(u32 id, u32 gen, u64 offset, u64 size, u8* dest);
+
+    virtual void remove(u32 id, u32 gen);
+};
+
+}  // namespace V2
+}  // namespace Akumuli
@@ -16,13 +16,21 @@
  */
 
 #include "volume.h"
+#include <cstdlib>
+#include <cstring>
 #include <apr.h>
 #include <apr_general.h>
 #include <apr_file_io.h>
+#include <apr_portable.h>
+#include <fcntl.h>
 
 #include <boost/exception/all.hpp>
 
+#include "crc32c.h"
 #include "log_iface.h"
+#include "latency_histogram.h"
+#include "stage_profiler.h"
+#include "akumuli_tracepoints.h"
 #include "akumuli_version.h"
 
 namespace Akumuli {
@@ -85,15 +93,64 @@ struct VolumeRef {
     u32 nblocks;
     u32 capacity;
     u32 generation;
+    u32 checksum;  //< CRC32C of the fields above
 };
 
+//! Compute checksum of the descriptor (the checksum field itself is excluded)
+static u32 volref_checksum(VolumeRef const* vol) {
+    static crc32c_impl_t crc32c = chose_crc32c_implementation();
+    return crc32c(0, vol, offsetof(VolumeRef, checksum));
+}
+
+/** Timestamp span of the data written to the volume (retention partition
+  * boundary). Stored in the volume's metadata page right after `VolumeRef`
+  * with its own checksum so files created before spans were tracked stay
+  * readable - their span reads as "not recorded".
+  */
+struct VolumeSpan {
+    u64 ts_begin;
+    u64 ts_end;
+    u32 checksum;  //< CRC32C of the fields above, 0 - span is not recorded
+};
+
+static u32 volspan_checksum(VolumeSpan const* span) {
+    static crc32c_impl_t crc32c = chose_crc32c_implementation();
+    return crc32c(0, span, offsetof(VolumeSpan, checksum));
+}
+
+//! Helper function
+static VolumeRef* get_volref(u8* p, u32 id) {
+    u8* it = p + id * AKU_BLOCK_SIZE;
+    VolumeRef* vol = reinterpret_cast<VolumeRef*>(it);
+    return vol;
+}
+
+//! Helper function
+static VolumeSpan* get_volspan(u8* p, u32 id) {
+    u8* it = p + id * AKU_BLOCK_SIZE + sizeof(VolumeRef);
+    VolumeSpan* span = reinterpret_cast<VolumeSpan*>(it);
+    return span;
+}
+
 MetaVolume::MetaVolume(const char *path)
     : mmap_(path, false)
     , file_size_(mmap_.get_size())
     , mmap_ptr_(static_cast<u8*>(mmap_.get_pointer()))
     , double_write_buffer_(mmap_.get_size(), 0)
+    , dirty_(mmap_.get_size()/AKU_BLOCK_SIZE, 0)
 {
     memcpy(double_write_buffer_.data(), mmap_ptr_, mmap_.get_size());
+    // Validate all descriptors up front - later reads are served from the
+    // in-memory copy and never revisit the file-backed pages
+    for (u32 id = 0; id < file_size_/AKU_BLOCK_SIZE; id++) {
+        auto pvol = get_volref(double_write_buffer_.data(), id);
+        if (pvol->checksum != 0 && pvol->checksum != volref_checksum(pvol)) {
+            Logger::msg(AKU_LOG_ERROR, "Volume " + std::to_string(id) + " metadata checksum mismatch");
+            AKU_PANIC("Metadata corrupted");
+        }
+        // Zero checksum means the file was created before the descriptors
+        // became CRC-protected, the checksum is set on the first update
+    }
 }
 
 size_t MetaVolume::get_nvolumes() const {
@@ -115,6 +172,7 @@ void MetaVolume::create_new(const char* path, size_t capacity, const u32 *vol_ca
         pvolume->id = id;
         pvolume->nblocks = 0;
         pvolume->version = AKUMULI_VERSION;
+        pvolume->checksum = volref_checksum(pvolume);
         it += AKU_BLOCK_SIZE;
         id++;
     }
@@ -128,13 +186,6 @@ std::unique_ptr<MetaVolume> MetaVolume::open_existing(const char* path) {
     return std::move(result);
 }
 
-//! Helper function
-static VolumeRef* get_volref(u8* p, u32 id) {
-    u8* it = p + id * AKU_BLOCK_SIZE;
-    VolumeRef* vol = reinterpret_cast<VolumeRef*>(it);
-    return vol;
-}
-
 std::tuple<aku_Status, u32> MetaVolume::get_nblocks(u32 id) const {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
@@ -153,6 +204,19 @@ std::tuple<aku_Status, u32> MetaVolume::get_capacity(u32 id) const {
     return std::make_tuple(AKU_EBAD_ARG, 0u);
 }
 
+std::tuple<aku_Status, aku_Timestamp, aku_Timestamp> MetaVolume::get_time_span(u32 id) const {
+    if (id < file_size_/AKU_BLOCK_SIZE) {
+        auto pspan = get_volspan(double_write_buffer_.data(), id);
+        if (pspan->checksum == 0 || pspan->checksum != volspan_checksum(pspan)) {
+            // Span was never recorded (fresh volume or a file created
+            // before spans were tracked)
+            return std::make_tuple(AKU_ENO_DATA, 0ull, 0ull);
+        }
+        return std::make_tuple(AKU_SUCCESS, pspan->ts_begin, pspan->ts_end);
+    }
+    return std::make_tuple(AKU_EBAD_ARG, 0ull, 0ull);
+}
+
 std::tuple<aku_Status, u32> MetaVolume::get_generation(u32 id) const {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
@@ -168,6 +232,8 @@ aku_Status MetaVolume::update(u32 id, u32 nblocks, u32 capacity, u32 gen) {
         pvol->nblocks = nblocks;
         pvol->capacity = capacity;
         pvol->generation = gen;
+        pvol->checksum = volref_checksum(pvol);
+        dirty_[id] = 1;
         return AKU_SUCCESS;
     }
     return AKU_EBAD_ARG;  // id out of range
@@ -177,6 +243,8 @@ aku_Status MetaVolume::set_nblocks(u32 id, u32 nblocks) {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
         pvol->nblocks = nblocks;
+        pvol->checksum = volref_checksum(pvol);
+        dirty_[id] = 1;
         return AKU_SUCCESS;
     }
     return AKU_EBAD_ARG;  // id out of range
@@ -186,6 +254,8 @@ aku_Status MetaVolume::set_capacity(u32 id, u32 cap) {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
         pvol->capacity = cap;
+        pvol->checksum = volref_checksum(pvol);
+        dirty_[id] = 1;
         return AKU_SUCCESS;
     }
     return AKU_EBAD_ARG;  // id out of range
@@ -195,22 +265,74 @@ aku_Status MetaVolume::set_generation(u32 id, u32 gen) {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
         pvol->generation = gen;
+        pvol->checksum = volref_checksum(pvol);
+        dirty_[id] = 1;
+        return AKU_SUCCESS;
+    }
+    return AKU_EBAD_ARG;  // id out of range
+}
+
+aku_Status MetaVolume::extend_time_span(u32 id, aku_Timestamp begin, aku_Timestamp end) {
+    if (id < file_size_/AKU_BLOCK_SIZE) {
+        auto pspan = get_volspan(double_write_buffer_.data(), id);
+        if (pspan->checksum == 0 || pspan->checksum != volspan_checksum(pspan)) {
+            pspan->ts_begin = begin;
+            pspan->ts_end   = end;
+        } else {
+            pspan->ts_begin = std::min(pspan->ts_begin, begin);
+            pspan->ts_end   = std::max(pspan->ts_end, end);
+        }
+        pspan->checksum = volspan_checksum(pspan);
+        dirty_[id] = 1;
+        return AKU_SUCCESS;
+    }
+    return AKU_EBAD_ARG;  // id out of range
+}
+
+aku_Status MetaVolume::clear_time_span(u32 id) {
+    if (id < file_size_/AKU_BLOCK_SIZE) {
+        auto pspan = get_volspan(double_write_buffer_.data(), id);
+        pspan->ts_begin = 0;
+        pspan->ts_end   = 0;
+        pspan->checksum = 0;
+        dirty_[id] = 1;
         return AKU_SUCCESS;
     }
     return AKU_EBAD_ARG;  // id out of range
 }
 
 void MetaVolume::flush() {
-    memcpy(mmap_ptr_, double_write_buffer_.data(), mmap_.get_size());
-    auto status = mmap_.flush();
-    panic_on_error(status, "Flush error");
+    size_t npages = file_size_/AKU_BLOCK_SIZE;
+    size_t ix = 0;
+    while (ix < npages) {
+        if (!dirty_[ix]) {
+            ix++;
+            continue;
+        }
+        // Coalesce run of dirty pages into one write-back
+        size_t begin = ix;
+        while (ix < npages && dirty_[ix]) {
+            dirty_[ix] = 0;
+            ix++;
+        }
+        size_t from = begin * AKU_BLOCK_SIZE;
+        size_t to = ix * AKU_BLOCK_SIZE;
+        memcpy(mmap_ptr_ + from, double_write_buffer_.data() + from, to - from);
+        auto status = mmap_.flush(from, to);
+        panic_on_error(status, "Flush error");
+    }
 }
 
 aku_Status MetaVolume::flush(u32 id) {
     if (id < file_size_/AKU_BLOCK_SIZE) {
-        memcpy(mmap_ptr_, double_write_buffer_.data(), mmap_.get_size());
+        if (!dirty_[id]) {
+            // Page wasn't updated since the last flush
+            return AKU_SUCCESS;
+        }
+        dirty_[id] = 0;
         size_t from = id * AKU_BLOCK_SIZE;
         size_t to = from + AKU_BLOCK_SIZE;
+        memcpy(mmap_ptr_ + from, double_write_buffer_.data() + from, AKU_BLOCK_SIZE);
         auto status = mmap_.flush(from, to);
         panic_on_error(status, "Flush (range) error");
         return AKU_SUCCESS;
@@ -220,16 +342,48 @@ aku_Status MetaVolume::flush(u32 id) {
 
 //--------------------------- Volume -----------------------------------//
 
-Volume::Volume(const char* path, size_t write_pos)
+//! Size of the write-behind buffer in blocks (256KB).
+static const u32 WBUF_NBLOCKS = 64;
+
+//! Allocate 4KB-aligned buffer (O_DIRECT requires aligned memory).
+static std::unique_ptr<u8, void (*)(void*)> _allocate_wbuf() {
+    void* mem = nullptr;
+    if (posix_memalign(&mem, AKU_BLOCK_SIZE, WBUF_NBLOCKS * AKU_BLOCK_SIZE) != 0) {
+        AKU_PANIC("Can't allocate write-behind buffer");
+    }
+    return std::unique_ptr<u8, void (*)(void*)>(static_cast<u8*>(mem), &free);
+}
+
+Volume::Volume(const char* path, size_t write_pos, bool direct_io)
     : apr_pool_(_make_apr_pool())
     , apr_file_handle_(_open_file(path, apr_pool_.get()))
     , file_size_(static_cast<u32>(_get_file_size(apr_file_handle_.get())/AKU_BLOCK_SIZE))
     , write_pos_(static_cast<u32>(write_pos))
+    , wbuf_start_(static_cast<u32>(write_pos))
+    , wbuf_len_(0)
+    , wbuf_(_allocate_wbuf())
+    , direct_io_(direct_io)
 {
+    if (direct_io_) {
+        int fd = get_fd();
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags|O_DIRECT) != 0) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't enable O_DIRECT on ") + path +
+                        ", falling back to buffered i/o");
+            direct_io_ = false;
+        }
+    }
 }
 
 void Volume::reset() {
     write_pos_ = 0;
+    wbuf_start_ = 0;
+    wbuf_len_ = 0;
+}
+
+void Volume::evict() {
+    apr_status_t status = apr_file_trunc(apr_file_handle_.get(), 0);
+    panic_on_error(status, "Can't evict volume");
 }
 
 void Volume::create_new(const char* path, size_t capacity) {
@@ -237,32 +391,55 @@ void Volume::create_new(const char* path, size_t capacity) {
     _create_file(path, size);
 }
 
-std::unique_ptr<Volume> Volume::open_existing(const char* path, size_t pos) {
+std::unique_ptr<Volume> Volume::open_existing(const char* path, size_t pos, bool direct_io) {
     std::unique_ptr<Volume> result;
-    result.reset(new Volume(path, pos));
+    result.reset(new Volume(path, pos, direct_io));
     return std::move(result);
 }
 
-//! Append block to file (source size should be 4 at least BLOCK_SIZE)
-std::tuple<aku_Status, BlockAddr> Volume::append_block(const u8* source) {
-    if (write_pos_ >= file_size_) {
-        return std::make_tuple(AKU_EOVERFLOW, 0u);
+void Volume::flush_wbuf() {
+    if (wbuf_len_ == 0) {
+        return;
     }
-    apr_off_t seek_off = write_pos_ * AKU_BLOCK_SIZE;
+    apr_off_t seek_off = wbuf_start_ * AKU_BLOCK_SIZE;
     apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &seek_off);
     panic_on_error(status, "Volume seek error");
     apr_size_t bytes_written = 0;
-    status = apr_file_write_full(apr_file_handle_.get(), source, AKU_BLOCK_SIZE, &bytes_written);
+    status = apr_file_write_full(apr_file_handle_.get(), wbuf_.get(), wbuf_len_ * AKU_BLOCK_SIZE, &bytes_written);
     panic_on_error(status, "Volume write error");
+    wbuf_start_ = write_pos_;
+    wbuf_len_ = 0;
+}
+
+static LatencyHistogram g_append_latency("volume_append_block");
+
+//! Append block to file (source size should be 4 at least BLOCK_SIZE)
+std::tuple<aku_Status, BlockAddr> Volume::append_block(const u8* source) {
+    LatencyTimer timer(g_append_latency);
+    StageProfiler::ScopedStage stage(StageProfiler::STAGE_VOLUME);
+    if (write_pos_ >= file_size_) {
+        return std::make_tuple(AKU_EOVERFLOW, 0u);
+    }
+    memcpy(wbuf_.get() + wbuf_len_ * AKU_BLOCK_SIZE, source, AKU_BLOCK_SIZE);
+    wbuf_len_++;
     auto result = write_pos_++;
+    if (wbuf_len_ == WBUF_NBLOCKS) {
+        flush_wbuf();
+    }
     return std::make_tuple(AKU_SUCCESS, result);
 }
 
 //! Read filxed size block from file
 aku_Status Volume::read_block(u32 ix, u8* dest) const {
+    StageProfiler::ScopedStage stage(StageProfiler::STAGE_VOLUME);
     if (ix >= write_pos_) {
         return AKU_EBAD_ARG;
     }
+    if (ix >= wbuf_start_) {
+        // Serve the read from the write-behind buffer.
+        memcpy(dest, wbuf_.get() + (ix - wbuf_start_) * AKU_BLOCK_SIZE, AKU_BLOCK_SIZE);
+        return AKU_SUCCESS;
+    }
     apr_off_t offset = ix * AKU_BLOCK_SIZE;
     apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &offset);
     panic_on_error(status, "Volume seek error");
@@ -272,13 +449,56 @@ aku_Status Volume::read_block(u32 ix, u8* dest) const {
     return AKU_SUCCESS;
 }
 
+aku_Status Volume::read_blocks(u32 ix, u32 count, u8* dest) const {
+    StageProfiler::ScopedStage stage(StageProfiler::STAGE_VOLUME);
+    if (ix + count > write_pos_ || ix + count < ix) {
+        return AKU_EBAD_ARG;
+    }
+    // Read flushed part of the run from the file
+    u32 nflushed = ix < wbuf_start_ ? std::min(wbuf_start_ - ix, count) : 0;
+    if (nflushed) {
+        apr_off_t offset = ix * AKU_BLOCK_SIZE;
+        apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &offset);
+        panic_on_error(status, "Volume seek error");
+        apr_size_t outsize = 0;
+        status = apr_file_read_full(apr_file_handle_.get(), dest, nflushed * AKU_BLOCK_SIZE, &outsize);
+        panic_on_error(status, "Volume read error");
+    }
+    // The rest is served from the write-behind buffer
+    if (nflushed < count) {
+        u32 bufix = ix + nflushed - wbuf_start_;
+        memcpy(dest + nflushed * AKU_BLOCK_SIZE,
+               wbuf_.get() + bufix * AKU_BLOCK_SIZE,
+               (count - nflushed) * AKU_BLOCK_SIZE);
+    }
+    return AKU_SUCCESS;
+}
+
 void Volume::flush() {
+    flush_wbuf();
+    AKU_PROBE1(volume_fsync_begin, write_pos_);
     apr_status_t status = apr_file_flush(apr_file_handle_.get());
     panic_on_error(status, "Volume flush error");
+    AKU_PROBE1(volume_fsync_end, write_pos_);
 }
 
 u32 Volume::get_size() const {
     return file_size_;
 }
 
+u32 Volume::get_write_pos() const {
+    return write_pos_;
+}
+
+u32 Volume::get_flushed_pos() const {
+    return wbuf_start_;
+}
+
+int Volume::get_fd() const {
+    apr_os_file_t fd;
+    apr_status_t status = apr_os_file_get(&fd, apr_file_handle_.get());
+    panic_on_error(status, "Can't extract file descriptor");
+    return fd;
+}
+
 }}  // namespace
@@ -55,6 +55,12 @@ class MetaVolume {
     size_t                  file_size_;
     u8*                     mmap_ptr_;
     mutable std::vector<u8> double_write_buffer_;
+    /** Dirty flags (one per page). Mutators only touch the double-write
+      * buffer and mark the page dirty, `flush` copies and syncs the dirty
+      * pages only. Without the tracking every flush writes the whole file
+      * back even if a single `nblocks` counter was bumped.
+      */
+    std::vector<int>        dirty_;
 
     MetaVolume(const char* path);
 
@@ -85,6 +91,12 @@ public:
     //! Get volume's generation.
     std::tuple<aku_Status, u32> get_generation(u32 id) const;
 
+    /** Get the timestamp span of the data written to the volume.
+      * @return AKU_ENO_DATA if no span was recorded (empty volume or
+      *         file created before spans were tracked)
+      */
+    std::tuple<aku_Status, aku_Timestamp, aku_Timestamp> get_time_span(u32 id) const;
+
     size_t get_nvolumes() const;
 
     // Mutators
@@ -100,6 +112,12 @@ public:
     //! Set generation
     aku_Status set_generation(u32 id, u32 nblocks);
 
+    //! Extend the timestamp span of the volume (write path)
+    aku_Status extend_time_span(u32 id, aku_Timestamp begin, aku_Timestamp end);
+
+    //! Clear the timestamp span (the volume was recycled)
+    aku_Status clear_time_span(u32 id);
+
     //! Flush entire file
     void flush();
 
@@ -113,8 +131,24 @@ class Volume {
     AprFilePtr apr_file_handle_;
     u32        file_size_;
     u32        write_pos_;
+    //! Index of the first block in the write-behind buffer.
+    u32        wbuf_start_;
+    //! Number of blocks in the write-behind buffer.
+    u32        wbuf_len_;
+    /** Write-behind buffer. Blocks of the commit burst are physically
+      * adjacent so they're coalesced into one large sequential write
+      * instead of a series of 4KB syscalls. Buffer is written out when
+      * it's full or on `flush`. Memory is 4KB-aligned so the buffer can
+      * be used with O_DIRECT.
+      */
+    std::unique_ptr<u8, void (*)(void*)> wbuf_;
+    //! Set if file is opened with O_DIRECT.
+    bool       direct_io_;
+
+    Volume(const char* path, size_t write_pos, bool direct_io);
 
-    Volume(const char* path, size_t write_pos);
+    //! Write buffered blocks to the file.
+    void flush_wbuf();
 
 public:
     /** Create new volume.
@@ -128,14 +162,23 @@ public:
       * @throw std::runtime_error on error.
       * @param path Path to volume file.
       * @param pos Write position inside volume (in blocks).
+      * @param direct_io Bypass the page cache (all i/o goes through O_DIRECT,
+      *        caller should read into 4KB-aligned buffers). If the file system
+      *        doesn't support O_DIRECT the volume falls back to buffered i/o.
       * @return New instance of V2::Volume.
       */
-    static std::unique_ptr<Volume> open_existing(const char* path, size_t pos);
+    static std::unique_ptr<Volume> open_existing(const char* path, size_t pos, bool direct_io = false);
 
     // Mutators
 
     void reset();
 
+    /** Truncate the file to zero so the space is returned to the file
+      * system (content should be demoted to the cold tier beforehand).
+      * The file grows back when the volume is recycled and written again.
+      */
+    void evict();
+
     //! Append block to file (source size should be 4 at least BLOCK_SIZE)
     std::tuple<aku_Status, BlockAddr> append_block(const u8* source);
 
@@ -147,8 +190,24 @@ public:
     //! Read filxed size block from file
     aku_Status read_block(u32 ix, u8* dest) const;
 
+    /** Read run of consecutive blocks with a single syscall.
+      * @param ix Index of the first block.
+      * @param count Number of blocks to read.
+      * @param dest Destination buffer (count*AKU_BLOCK_SIZE bytes).
+      */
+    aku_Status read_blocks(u32 ix, u32 count, u8* dest) const;
+
     //! Return size in blocks
     u32 get_size() const;
+
+    //! Return write position (number of readable blocks)
+    u32 get_write_pos() const;
+
+    //! Return number of blocks already written to the file (excludes the write-behind buffer)
+    u32 get_flushed_pos() const;
+
+    //! Return file descriptor of the underlying file (for asynchronous i/o)
+    int get_fd() const;
 };
 
 }  // namespace V2
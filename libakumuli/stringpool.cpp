@@ -15,7 +15,10 @@
  */
 
 #include "stringpool.h"
+#include "util.h"
 #include <boost/regex.hpp>
+#include <cstring>
+#include <thread>
 
 namespace Akumuli {
 
@@ -23,44 +26,94 @@ namespace Akumuli {
 //      String Pool      //
 //                       //
 
+StringPool::Bin::Bin()
+    : reserved{0}
+    , committed{0}
+    , data(static_cast<size_t>(MAX_BIN_SIZE))
+{
+}
+
 StringPool::StringPool()
-    : counter{0}
+    : nbins_{0}
+    , counter{0}
 {
+    for (auto& bin: bins_) {
+        bin.store(nullptr, std::memory_order_relaxed);
+    }
 }
 
-StringPool::StringT StringPool::add(const char* begin, const char* end, u64 payload) {
-    std::lock_guard<std::mutex> guard(pool_mutex);  // Maybe I'll need to optimize this
-    if (pool.empty()) {
-        pool.emplace_back();
-        pool.back().reserve(MAX_BIN_SIZE);
+StringPool::~StringPool() {
+    u32 nbins = nbins_.load(std::memory_order_acquire);
+    for (u32 i = 0; i < nbins; i++) {
+        delete bins_[i].load(std::memory_order_relaxed);
     }
-    int size = end - begin;
-    if (size == 0) {
-        return std::make_pair("", 0);
+}
+
+void StringPool::grow(u32 expected) {
+    std::lock_guard<std::mutex> guard(grow_mutex_); AKU_UNUSED(guard);
+    if (nbins_.load(std::memory_order_acquire) != expected) {
+        // Lost the race - another writer already published a new chunk
+        return;
+    }
+    if (expected == MAX_BINS) {
+        AKU_PANIC("String pool overflow");
     }
-    size += 2 + sizeof(u64);  // 2 is for two \0 characters
-    std::vector<char>* bin = &pool.back();
-    if (static_cast<int>(bin->size()) + size > MAX_BIN_SIZE) {
-        // New bin
-        pool.emplace_back();
-        bin = &pool.back();
-        bin->reserve(MAX_BIN_SIZE);
+    if (expected != 0) {
+        // Seal the old chunk so no writer can reserve space in it after the
+        // new one is published (incremental readers would never revisit it).
+        Bin* prev = bins_[expected - 1].load(std::memory_order_relaxed);
+        u32 sealed = prev->reserved.exchange(MAX_BIN_SIZE, std::memory_order_acq_rel);
+        // Wait out the writers that reserved space before the seal - they
+        // commit in order so `committed` catches up with the pre-seal
+        // `reserved`. Publishing the new chunk earlier would let a commit
+        // land after the chunk is no longer last and incremental readers
+        // (which only revisit the last chunk) would never see that string.
+        while (prev->committed.load(std::memory_order_acquire) != sealed) {
+            std::this_thread::yield();
+        }
     }
-    for(auto i = begin; i < end; i++) {
-        bin->push_back(*i);
+    bins_[expected].store(new Bin(), std::memory_order_release);
+    nbins_.store(expected + 1, std::memory_order_release);
+}
+
+StringPool::StringT StringPool::add(const char* begin, const char* end, u64 payload) {
+    int token_size = static_cast<int>(end - begin);
+    if (token_size == 0) {
+        return std::make_pair("", 0);
     }
-    bin->push_back('\0');
-    char* payload_ptr = bin->data() + bin->size();
-    for(int i = 0; i < 8; i++) {
-        bin->push_back(0);
+    u32 size = static_cast<u32>(token_size) + 2 + sizeof(u64);  // 2 is for two \0 characters
+    while (true) {
+        u32 nbins = nbins_.load(std::memory_order_acquire);
+        if (nbins == 0) {
+            grow(0);
+            continue;
+        }
+        Bin* bin = bins_[nbins - 1].load(std::memory_order_acquire);
+        u32 offset = bin->reserved.load(std::memory_order_relaxed);
+        if (offset + size > MAX_BIN_SIZE) {
+            // New bin
+            grow(nbins);
+            continue;
+        }
+        if (!bin->reserved.compare_exchange_weak(offset, offset + size)) {
+            continue;
+        }
+        char* dest = bin->data.data() + offset;
+        memcpy(dest, begin, static_cast<size_t>(token_size));
+        dest[token_size] = '\0';
+        memcpy(dest + token_size + 1, &payload, sizeof(u64));
+        dest[size - 1] = '\0';
+        // Commit in order so the committed offset always forms contiguous
+        // prefix of fully written strings that readers can scan.
+        u32 prev = offset;
+        while (!bin->committed.compare_exchange_weak(prev, offset + size,
+                                                     std::memory_order_release)) {
+            // Wait until the preceding writer finishes its copy
+            prev = offset;
+        }
+        std::atomic_fetch_add(&counter, 1ul);
+        return std::make_pair(dest, token_size);
     }
-    *reinterpret_cast<u64*>(payload_ptr) = payload;
-    bin->push_back('\0');
-    const char* p = &bin->back();
-    p -= size - 1;
-    int token_size = end - begin;
-    std::atomic_fetch_add(&counter, 1ul);
-    return std::make_pair(p, token_size);
 }
 
 size_t StringPool::size() const {
@@ -70,16 +123,9 @@ size_t StringPool::size() const {
 std::vector<StringPool::StringT> StringPool::regex_match(const char *regex, StringPoolOffset *offset, size_t* psize) const {
     std::vector<StringPool::StringT> results;
     boost::regex series_regex(regex, boost::regex_constants::optimize);
-    typedef std::vector<char> const* PBuffer;
-    std::vector<PBuffer> buffers;
-    {
-        std::lock_guard<std::mutex> guard(pool_mutex);
-        if (psize) {
-            *psize = size();
-        }
-        for(auto& buf: pool) {
-            buffers.push_back(&buf);
-        }
+    u32 nbins = nbins_.load(std::memory_order_acquire);
+    if (psize) {
+        *psize = size();
     }
     size_t buffers_skip = 0;
     if (offset != nullptr && offset->buffer_offset != 0) {
@@ -89,36 +135,47 @@ std::vector<StringPool::StringT> StringPool::regex_match(const char *regex, Stri
     if (offset != nullptr && offset->offset != 0) {
         first_row_skip = offset->offset;
     }
-    for(auto pbuf: buffers) {
-        if (buffers_skip == 0) {
-            // buffer space to search
-            auto bufbegin = pbuf->data() + first_row_skip;
-            auto bufend = pbuf->data() + pbuf->size();
-            // should be used to skip data only in a first row
-            first_row_skip = 0;
-            // regex search
-            auto begin = boost::cregex_iterator(bufbegin, bufend, series_regex);
-            auto end = boost::cregex_iterator();
-            for(boost::cregex_iterator i = begin; i != end; i++) {
-                boost::cmatch match = *i;
-                if (match[0].matched) {
-                    const char* b = match[0].first;
-                    const char* e = match[0].second;
-                    size_t sz = e - b;
-                    results.push_back(std::make_pair(b, sz));
-                }
-            }
-        } else {
+    size_t last_committed = 0;
+    bool   scanned_last   = false;
+    for (u32 i = 0; i < nbins; i++) {
+        if (buffers_skip != 0) {
             buffers_skip--;
+            continue;
+        }
+        Bin* bin = bins_[i].load(std::memory_order_acquire);
+        // Only the committed prefix of the chunk is fully written
+        u32 committed = bin->committed.load(std::memory_order_acquire);
+        if (i == nbins - 1) {
+            last_committed = committed;
+            scanned_last   = true;
+        }
+        // buffer space to search
+        auto bufbegin = bin->data.data() + first_row_skip;
+        auto bufend = bin->data.data() + committed;
+        // should be used to skip data only in a first row
+        first_row_skip = 0;
+        // regex search
+        auto begin = boost::cregex_iterator(bufbegin, bufend, series_regex);
+        auto end = boost::cregex_iterator();
+        for(boost::cregex_iterator it = begin; it != end; it++) {
+            boost::cmatch match = *it;
+            if (match[0].matched) {
+                const char* b = match[0].first;
+                const char* e = match[0].second;
+                size_t sz = e - b;
+                results.push_back(std::make_pair(b, sz));
+            }
         }
     }
     if (offset != nullptr) {
-        if (buffers.empty()) {
+        if (nbins == 0) {
             offset->buffer_offset = 0;
             offset->offset = 0;
-        } else {
-            offset->buffer_offset = buffers.size() - 1;
-            offset->offset = buffers.back()->size();
+        } else if (scanned_last) {
+            // Record only what was actually scanned, the tail that was
+            // committed mid-scan will be visited by the next call.
+            offset->buffer_offset = nbins - 1;
+            offset->offset = last_committed;
         }
     }
     return results;
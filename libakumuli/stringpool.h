@@ -16,8 +16,8 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
-#include <deque>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
@@ -36,16 +36,46 @@ struct StringPoolOffset {
     size_t offset;
 };
 
+/** Append-only pool of series names.
+  * Names are stored in a list of fixed size chunks that are published
+  * atomically so readers are wait-free - `regex_match` scans the committed
+  * prefix of the pool without taking any locks. Writers reserve space in
+  * the current chunk with a CAS and only take the mutex to allocate a new
+  * chunk when the current one is full.
+  */
 struct StringPool {
 
     typedef std::pair<const char*, int> StringT;
-    const int MAX_BIN_SIZE = AKU_LIMITS_MAX_SNAME * 0x1000;
 
-    std::deque<std::vector<char>> pool;
-    mutable std::mutex            pool_mutex;
-    std::atomic<size_t>           counter;
+    enum {
+        //! Chunk size in bytes
+        MAX_BIN_SIZE = AKU_LIMITS_MAX_SNAME * 0x1000,
+        //! Max number of chunks (limits the pool to MAX_BINS*MAX_BIN_SIZE bytes of names)
+        MAX_BINS     = 0x1000,
+    };
+
+    //! Append-only chunk of the pool
+    struct Bin {
+        //! Reservation position (space below is claimed by writers)
+        std::atomic<u32> reserved;
+        //! Commit position (everything below this offset is fully written)
+        std::atomic<u32> committed;
+        //! Payload (capacity is fixed so published pointers stay valid)
+        std::vector<char> data;
+
+        Bin();
+    };
+
+    //! Published chunks (only first `nbins_` entries are set)
+    std::array<std::atomic<Bin*>, MAX_BINS> bins_;
+    //! Number of published chunks
+    std::atomic<u32>    nbins_;
+    std::atomic<size_t> counter;
+    //! Taken only to allocate and publish a new chunk
+    std::mutex grow_mutex_;
 
     StringPool();
+    ~StringPool();
     StringPool(StringPool const&) = delete;
     StringPool& operator=(StringPool const&) = delete;
 
@@ -61,6 +91,13 @@ struct StringPool {
       */
     std::vector<StringT> regex_match(const char* regex, StringPoolOffset* outoffset = nullptr,
                                      size_t* psize = nullptr) const;
+
+private:
+    /** Allocate and publish new chunk.
+      * @param expected number of chunks seen by the writer (call is a no-op
+      *        if another writer published a chunk concurrently)
+      */
+    void grow(u32 expected);
 };
 
 struct StringTools {
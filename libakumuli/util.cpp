@@ -126,14 +126,15 @@ apr_status_t MemoryMappedFile::map_file() {
                 if (status_ == APR_SUCCESS) {
                     success_count++;
                     apr_int32_t flags = APR_MMAP_WRITE | APR_MMAP_READ;
-                    if (enable_huge_tlb_) {
-#if defined MAP_HUGETLB
-						flags |= MAP_HUGETLB;
-#endif
-                    }
                     status_ = apr_mmap_create(&mmap_, fp_, 0, finfo_.size, flags, mem_pool_);
-                    if (status_ == APR_SUCCESS)
-                        success_count++; }}}}
+                    if (status_ == APR_SUCCESS) {
+                        success_count++;
+                        if (enable_huge_tlb_) {
+                            // MAP_HUGETLB can't be used here (it requires hugetlbfs-backed
+                            // files) so huge pages are requested through madvise instead.
+                            hint_huge_pages();
+                        }
+                    }}}}}
 
     if (status_ != APR_SUCCESS) {
         free_resources(success_count);
@@ -240,6 +241,27 @@ MemoryMappedFile::~MemoryMappedFile() {
         free_resources(4);
 }
 
+void MemoryMappedFile::hint_huge_pages() {
+#if defined MADV_HUGEPAGE
+    // Only the huge-page-aligned interior of the mapping can be backed by
+    // huge pages, head and tail are left to the default page size.
+    auto page  = get_huge_page_size();
+    auto begin = reinterpret_cast<uintptr_t>(mmap_->mm);
+    auto end   = begin + mmap_->size;
+    begin      = (begin + page - 1) & ~(page - 1);
+    end        = end & ~(page - 1);
+    if (begin < end) {
+        int err = madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+        if (err == -1) {
+            // Not an error - THP can be disabled system-wide or the kernel may
+            // not support huge pages for file mappings, in this case the
+            // mapping silently falls back to regular pages.
+            Logger::msg(AKU_LOG_INFO, "MADV_HUGEPAGE rejected for " + path_ + ", using 4KB pages");
+        }
+    }
+#endif
+}
+
 void* MemoryMappedFile::get_pointer() const {
     return mmap_->mm;
 }
@@ -355,6 +377,12 @@ size_t get_page_size() {
     return static_cast<size_t>(page_size);
 }
 
+size_t get_huge_page_size() {
+    // Default huge page size on x86-64 and aarch64. There is no portable way
+    // to query it, and overestimating only costs a bit of alignment padding.
+    return 0x200000;
+}
+
 Rand::Rand()
     : rand_()
 {
@@ -429,6 +457,129 @@ void RWLock::unlock() {
     }
 }
 
+StripedCounter::StripedCounter() {
+    for (auto& cell: cells_) {
+        cell.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+//! Calling thread's cell index (computed once per thread)
+static size_t get_stripe_ix() {
+    static thread_local size_t ix =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % StripedCounter::NSTRIPES;
+    return ix;
+}
+
+void StripedCounter::add(u64 delta) {
+    cells_[get_stripe_ix()].value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+u64 StripedCounter::sum() const {
+    u64 total = 0;
+    for (auto const& cell: cells_) {
+        total += cell.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void StripedCounter::reset() {
+    for (auto& cell: cells_) {
+        cell.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+EpochGC::EpochGC()
+    : global_epoch_(1)  // zero is reserved for free slots
+{
+    for (auto& slot: slots_) {
+        slot.epoch.store(0, std::memory_order_relaxed);
+    }
+}
+
+EpochGC::~EpochGC() {
+    for (auto& retired: limbo_) {
+        retired.deleter();
+    }
+}
+
+//! Calling thread's preferred slot (unique for the first NSLOTS threads)
+static size_t get_preferred_slot() {
+    static std::atomic<size_t> next_slot(0);
+    static thread_local size_t ix = next_slot.fetch_add(1) % EpochGC::NSLOTS;
+    return ix;
+}
+
+EpochGC::Guard::Guard(EpochGC& gc)
+    : gc_(gc)
+    , slot_(0)
+{
+    // Pin the epoch with a seq_cst store so loads from the protected
+    // structure can't be reordered before it. Slots are claimed with a
+    // CAS - the preferred slot is free unless more than NSLOTS threads
+    // read concurrently, in which case we probe the neighbours.
+    u64 epoch = gc_.global_epoch_.load(std::memory_order_seq_cst);
+    size_t ix = get_preferred_slot();
+    while (true) {
+        u64 free = 0;
+        if (gc_.slots_[ix].epoch.compare_exchange_strong(free, epoch, std::memory_order_seq_cst)) {
+            slot_ = ix;
+            return;
+        }
+        ix = (ix + 1) % NSLOTS;
+    }
+}
+
+EpochGC::Guard::~Guard() {
+    gc_.slots_[slot_].epoch.store(0, std::memory_order_release);
+}
+
+u64 EpochGC::min_active_epoch_() const {
+    u64 result = global_epoch_.load(std::memory_order_seq_cst);
+    for (auto const& slot: slots_) {
+        u64 pinned = slot.epoch.load(std::memory_order_seq_cst);
+        if (pinned != 0 && pinned < result) {
+            result = pinned;
+        }
+    }
+    return result;
+}
+
+void EpochGC::retire(std::function<void()> deleter) {
+    u64 epoch = global_epoch_.load(std::memory_order_seq_cst);
+    bool full;
+    {
+        std::lock_guard<std::mutex> guard(limbo_lock_); AKU_UNUSED(guard);
+        limbo_.push_back({ epoch, std::move(deleter) });
+        full = limbo_.size() >= COLLECT_THRESHOLD;
+    }
+    if (full) {
+        collect();
+    }
+}
+
+void EpochGC::collect() {
+    global_epoch_.fetch_add(1, std::memory_order_seq_cst);
+    // A node retired at epoch E could have been seen by any reader pinned
+    // at E (the reader may have loaded the pointer right before the
+    // unlink). Two epochs of grace also cover the reader that loaded the
+    // epoch value but got preempted before publishing it in its slot.
+    u64 barrier = min_active_epoch_();
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> guard(limbo_lock_); AKU_UNUSED(guard);
+        auto it = limbo_.begin();
+        while (it != limbo_.end() && it->epoch + 2 <= barrier) {
+            it++;
+        }
+        ready.assign(std::make_move_iterator(limbo_.begin()), std::make_move_iterator(it));
+        limbo_.erase(limbo_.begin(), it);
+    }
+    // Deleters run outside the lock, they're free to call retire again
+    for (auto& retired: ready) {
+        retired.deleter();
+    }
+}
+
 bool same_value(double a, double b) {
     union Bits {
         double d;
@@ -27,6 +27,8 @@
 #include <apr_mmap.h>
 #include <atomic>
 #include <boost/throw_exception.hpp>
+#include <functional>
+#include <mutex>
 #include <ostream>
 #include <random>
 #include <stdexcept>
@@ -108,6 +110,8 @@ public:
 private:
     //! Map file into virtual address space
     apr_status_t map_file();
+    //! Ask the kernel to back the mapping with transparent huge pages
+    void hint_huge_pages();
     //! Free OS resources associated with object
     void free_resources(int cnt);
 };
@@ -117,6 +121,9 @@ i64 log2(i64 value);
 
 size_t get_page_size();
 
+//! Huge page size (mappings hinted with MADV_HUGEPAGE are aligned to this)
+size_t get_huge_page_size();
+
 const void* align_to_page(const void* ptr, size_t get_page_size);
 
 void* align_to_page(void* ptr, size_t get_page_size);
@@ -154,6 +161,101 @@ public:
     void unlock();
 };
 
+/** Wait-free counter for hot-path statistics.
+  * The value is striped across cache-line sized cells and every writer
+  * thread updates its own cell with a relaxed atomic add, so bookkeeping
+  * doesn't bounce a shared cache line between threads. Readers sum the
+  * cells - the result is as accurate as reading a shared atomic would be
+  * (increments that race with the read may or may not be included).
+  */
+class StripedCounter {
+public:
+    enum {
+        NSTRIPES   = 32,
+        CACHE_LINE = 64,
+    };
+
+private:
+    struct alignas(CACHE_LINE) Cell {
+        std::atomic<u64> value;
+    };
+    Cell cells_[NSTRIPES];
+
+public:
+    StripedCounter();
+
+    //! Add value to the calling thread's cell
+    void add(u64 delta);
+
+    //! Sum of all the cells
+    u64 sum() const;
+
+    //! Reset all the cells to zero
+    void reset();
+};
+
+/** Epoch-based reclamation for read-mostly lock-free structures.
+  * Readers pin the current epoch with a `Guard` for the duration of the
+  * critical section - one atomic store on entry and one on exit, no
+  * shared reference counts. A writer unlinks a node from the structure
+  * and passes its deleter to `retire()`, the deleter runs once every
+  * reader that could have seen the node is gone. Intended to be shared
+  * by the string pool, series matcher and tree registry.
+  */
+class EpochGC {
+public:
+    enum {
+        NSLOTS            = 64,  //< Max number of concurrent readers
+        CACHE_LINE        = 64,
+        COLLECT_THRESHOLD = 32,  //< Limbo size that triggers collection on retire
+    };
+
+    /** Reader-side critical section (non-reentrant).
+      * Pointers loaded from the protected structure stay valid until the
+      * guard is destroyed.
+      */
+    class Guard {
+        EpochGC& gc_;
+        size_t   slot_;
+
+    public:
+        Guard(EpochGC& gc);
+        ~Guard();
+        Guard(Guard const&) = delete;
+        Guard& operator=(Guard const&) = delete;
+    };
+
+    EpochGC();
+
+    //! D-tor, runs all pending deleters (readers must be gone by now).
+    ~EpochGC();
+
+    /** Schedule deleter to run after all the readers that could have seen
+      * the retired node are gone. Can be called from any thread.
+      */
+    void retire(std::function<void()> deleter);
+
+    //! Advance the epoch and run the deleters that became safe to run.
+    void collect();
+
+private:
+    struct alignas(CACHE_LINE) Slot {
+        std::atomic<u64> epoch;  //< Pinned epoch, 0 if the slot is free
+    };
+    struct Retired {
+        u64                   epoch;
+        std::function<void()> deleter;
+    };
+
+    std::atomic<u64>     global_epoch_;
+    Slot                 slots_[NSLOTS];
+    std::mutex           limbo_lock_;  //! Protects the limbo list
+    std::vector<Retired> limbo_;      //! Retired nodes, ordered by epoch
+
+    //! Smallest epoch pinned by an active reader (current epoch if none)
+    u64 min_active_epoch_() const;
+};
+
 //! Compare two double values and return true if they are equal at bit-level (needed to supress CLang analyzer warnings).
 bool same_value(double a, double b);
 }
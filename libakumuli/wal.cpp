@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wal.h"
+#include "crc32c.h"
+#include "log_iface.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Akumuli {
+
+//! Frame header, precedes every group of records on disk
+struct FrameHeader {
+    u32 crc;    //< CRC32C of the payload
+    u32 count;  //< Number of records in the frame
+} __attribute__((packed));
+
+static void log_apr_error(apr_status_t status, const char* msg) {
+    if (status != APR_SUCCESS) {
+        char error_message[0x100];
+        apr_strerror(status, error_message, 0x100);
+        Logger::msg(AKU_LOG_ERROR, std::string(msg) + " " + error_message);
+    }
+}
+
+Wal::Wal(const char* path)
+    : path_(path)
+    , pool_(nullptr)
+    , file_(nullptr)
+{
+    apr_status_t status = apr_pool_create(&pool_, NULL);
+    if (status != APR_SUCCESS) {
+        AKU_PANIC("Can't create APR pool");
+    }
+    buffer_.reserve(GROUP_COMMIT_SIZE);
+}
+
+Wal::~Wal() {
+    close();
+    apr_pool_destroy(pool_);
+}
+
+aku_Status Wal::open() {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    apr_status_t status = apr_file_open(&file_, path_.c_str(),
+                                        APR_WRITE|APR_CREATE|APR_APPEND|APR_BINARY,
+                                        APR_OS_DEFAULT, pool_);
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't open WAL");
+        file_ = nullptr;
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status Wal::write_frame_() {
+    if (buffer_.empty()) {
+        return AKU_SUCCESS;
+    }
+    static crc32c_impl_t crc32c = chose_crc32c_implementation();
+    FrameHeader header;
+    header.count = static_cast<u32>(buffer_.size());
+    header.crc   = crc32c(0, buffer_.data(), buffer_.size()*sizeof(Record));
+    apr_status_t status = apr_file_write_full(file_, &header, sizeof(header), NULL);
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file_, buffer_.data(), buffer_.size()*sizeof(Record), NULL);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_flush(file_);
+    }
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't write WAL frame");
+        return AKU_EGENERAL;
+    }
+    buffer_.clear();
+    return AKU_SUCCESS;
+}
+
+aku_Status Wal::append(aku_ParamId id, aku_Timestamp ts, double value) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    if (file_ == nullptr) {
+        return AKU_EGENERAL;
+    }
+    Record rec;
+    rec.id    = id;
+    rec.ts    = ts;
+    rec.value = value;
+    buffer_.push_back(rec);
+    pending_.push_back(rec);
+    if (buffer_.size() >= GROUP_COMMIT_SIZE) {
+        return write_frame_();
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status Wal::flush() {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    if (file_ == nullptr) {
+        return AKU_EGENERAL;
+    }
+    return write_frame_();
+}
+
+aku_Status Wal::rotate(aku_Timestamp horizon) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    if (file_ == nullptr) {
+        return AKU_EGENERAL;
+    }
+    // Records below horizon are merged to disk, the rest should survive
+    // the rotation.
+    buffer_.clear();
+    auto it = std::remove_if(pending_.begin(), pending_.end(),
+                             [horizon](Record const& rec) { return rec.ts < horizon; });
+    pending_.erase(it, pending_.end());
+    apr_status_t status = apr_file_trunc(file_, 0);
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't truncate WAL");
+        return AKU_EGENERAL;
+    }
+    if (!pending_.empty()) {
+        buffer_ = pending_;
+        return write_frame_();
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status Wal::replay(std::vector<Record>* dest) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    static crc32c_impl_t crc32c = chose_crc32c_implementation();
+    apr_file_t* file = nullptr;
+    apr_status_t status = apr_file_open(&file, path_.c_str(),
+                                        APR_READ|APR_BINARY, APR_OS_DEFAULT, pool_);
+    if (APR_STATUS_IS_ENOENT(status)) {
+        // Nothing to replay
+        return AKU_SUCCESS;
+    }
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't open WAL for replay");
+        return AKU_EGENERAL;
+    }
+    // The file length bounds the record count of every frame - a torn or
+    // corrupt header can carry a garbage count and shouldn't turn into a
+    // multi-gigabyte allocation, it is just a damaged tail
+    apr_off_t fsize = 0;
+    status = apr_file_seek(file, APR_END, &fsize);
+    if (status == APR_SUCCESS) {
+        apr_off_t begin = 0;
+        status = apr_file_seek(file, APR_SET, &begin);
+    }
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't read WAL size");
+        apr_file_close(file);
+        return AKU_EGENERAL;
+    }
+    apr_off_t fpos = 0;
+    std::vector<Record> frame;
+    while (true) {
+        FrameHeader header;
+        apr_size_t nbytes = 0;
+        status = apr_file_read_full(file, &header, sizeof(header), &nbytes);
+        if (status != APR_SUCCESS || nbytes != sizeof(header)) {
+            // End of the log (or torn frame header)
+            break;
+        }
+        fpos += sizeof(header);
+        if (static_cast<u64>(header.count) * sizeof(Record) > static_cast<u64>(fsize - fpos)) {
+            Logger::msg(AKU_LOG_ERROR, "WAL frame header is damaged, tail is ignored");
+            break;
+        }
+        frame.resize(header.count);
+        status = apr_file_read_full(file, frame.data(), header.count*sizeof(Record), &nbytes);
+        if (status != APR_SUCCESS || nbytes != header.count*sizeof(Record)) {
+            Logger::msg(AKU_LOG_ERROR, "WAL ends with torn frame, tail is ignored");
+            break;
+        }
+        u32 crc = crc32c(0, frame.data(), frame.size()*sizeof(Record));
+        if (crc != header.crc) {
+            Logger::msg(AKU_LOG_ERROR, "WAL frame checksum mismatch, tail is ignored");
+            break;
+        }
+        std::copy(frame.begin(), frame.end(), std::back_inserter(*dest));
+        std::copy(frame.begin(), frame.end(), std::back_inserter(pending_));
+        fpos += static_cast<apr_off_t>(header.count * sizeof(Record));
+    }
+    apr_file_close(file);
+    return AKU_SUCCESS;
+}
+
+void Wal::close() {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    if (file_ != nullptr) {
+        write_frame_();
+        apr_file_close(file_);
+        file_ = nullptr;
+    }
+}
+
+}  // namespace
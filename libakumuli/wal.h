@@ -0,0 +1,111 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Write-ahead log for the in-memory window.
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <apr.h>
+#include <apr_file_io.h>
+
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+/** Append-only write-ahead log.
+  * Samples buffered by the sequencer are lost on crash, WAL makes them
+  * durable. Records are written in CRC32C framed groups (group commit) so
+  * a torn tail can be detected during replay. The log is truncated when
+  * the window is merged to disk so it never grows past the window size.
+  */
+struct Wal {
+
+    //! Log record
+    struct Record {
+        aku_ParamId   id;
+        aku_Timestamp ts;
+        double        value;
+    } __attribute__((packed));
+
+    enum {
+        //! Number of records per frame (group commit size)
+        GROUP_COMMIT_SIZE = 0x100,
+    };
+
+    /** C-tor.
+      * @param path path to log file
+      */
+    Wal(const char* path);
+
+    ~Wal();
+
+    /** Open log file for appending (file is created if needed).
+      * @returns AKU_SUCCESS on success, AKU_EGENERAL otherwise
+      */
+    aku_Status open();
+
+    /** Append record to the log.
+      * Record is buffered, full groups are framed and written to disk.
+      * @returns AKU_SUCCESS on success, AKU_EGENERAL on write error
+      */
+    aku_Status append(aku_ParamId id, aku_Timestamp ts, double value);
+
+    /** Write buffered records to disk (incomplete group commit).
+      * @returns AKU_SUCCESS on success, AKU_EGENERAL on write error
+      */
+    aku_Status flush();
+
+    /** Rotate the log.
+      * Should be called when the window is merged to disk. Records with
+      * timestamps below `horizon` are merged and get dropped, the rest of
+      * the records (current window) are rewritten to the truncated log so
+      * they stay protected.
+      * @param horizon timestamp of the last checkpoint
+      * @returns AKU_SUCCESS on success, AKU_EGENERAL otherwise
+      */
+    aku_Status rotate(aku_Timestamp horizon);
+
+    /** Read all records from the log.
+      * Replay stops at the first damaged frame (torn write). Replayed
+      * records are retained by the log until the next rotation.
+      * @param dest receives the records in write order
+      * @returns AKU_SUCCESS on success, AKU_EGENERAL on read error
+      */
+    aku_Status replay(std::vector<Record>* dest);
+
+    //! Flush buffered records and close the log file.
+    void close();
+
+private:
+    //! Write framed group of records to disk (buffer should be locked)
+    aku_Status write_frame_();
+
+    std::string          path_;
+    apr_pool_t*          pool_;
+    apr_file_t*          file_;
+    std::vector<Record>  buffer_;   //< Current group commit buffer
+    std::vector<Record>  pending_;  //< Records that aren't merged to disk yet
+    std::mutex           lock_;
+};
+
+}  // namespace
@@ -0,0 +1,229 @@
+#include "microbench.h"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Akumuli {
+namespace Microbench {
+
+//                       //
+//     Perf counters     //
+//                       //
+
+#if defined __linux__
+
+static int perf_event_open_(u32 type, u64 config, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = type;
+    attr.size           = sizeof(attr);
+    attr.config         = config;
+    attr.disabled       = group_fd == -1 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+PerfCounters::PerfCounters()
+    : available_(false)
+{
+    for (int i = 0; i < NCOUNTERS; i++) {
+        fds_[i] = -1;
+    }
+    // Group leader first - the other counters are scheduled with it so
+    // all three readouts cover the same instruction window.
+    fds_[0] = perf_event_open_(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fds_[0] == -1) {
+        // No permission (perf_event_paranoid) or no PMU - report "n/a".
+        return;
+    }
+    fds_[1] = perf_event_open_(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds_[0]);
+    fds_[2] = perf_event_open_(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, fds_[0]);
+    available_ = true;
+}
+
+PerfCounters::~PerfCounters() {
+    for (int i = 0; i < NCOUNTERS; i++) {
+        if (fds_[i] != -1) {
+            close(fds_[i]);
+        }
+    }
+}
+
+void PerfCounters::start() {
+    if (!available_) {
+        return;
+    }
+    ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+CounterValues PerfCounters::stop() {
+    CounterValues values = {};
+    if (!available_) {
+        return values;
+    }
+    ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    u64* dest[NCOUNTERS] = { &values.cycles, &values.cache_misses, &values.branch_misses };
+    for (int i = 0; i < NCOUNTERS; i++) {
+        if (fds_[i] == -1 || read(fds_[i], dest[i], sizeof(u64)) != sizeof(u64)) {
+            return values;
+        }
+    }
+    values.valid = true;
+    return values;
+}
+
+static bool pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+PerfCounters::PerfCounters() : available_(false) {
+    for (int i = 0; i < NCOUNTERS; i++) {
+        fds_[i] = -1;
+    }
+}
+PerfCounters::~PerfCounters() {}
+void PerfCounters::start() {}
+CounterValues PerfCounters::stop() { return CounterValues(); }
+
+static bool pin_to_cpu(int) { return false; }
+
+#endif
+
+//                  //
+//     Registry     //
+//                  //
+
+struct Benchmark {
+    std::string name;
+    BenchFn     fn;
+};
+
+static std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+int register_benchmark(const char* name, BenchFn fn) {
+    registry().push_back({ name, std::move(fn) });
+    return 0;
+}
+
+//                //
+//     Runner     //
+//                //
+
+typedef std::chrono::steady_clock ClockT;
+
+static double run_once(BenchFn const& fn, u64 iters) {
+    State state(iters);
+    auto begin = ClockT::now();
+    fn(state);
+    auto end = ClockT::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+//! Double the iteration count until one run takes at least `min_sec`.
+static u64 calibrate(BenchFn const& fn, double min_sec) {
+    u64 iters = 1;
+    while (true) {
+        double elapsed = run_once(fn, iters);
+        if (elapsed >= min_sec || iters >= (1ull << 40)) {
+            return iters;
+        }
+        // Aim past the target in one step when the rate is known.
+        if (elapsed < min_sec / 16) {
+            iters *= 16;
+        } else {
+            iters *= 2;
+        }
+    }
+}
+
+static void print_value(double value) {
+    std::cout << std::setw(14) << std::fixed << std::setprecision(1) << value;
+}
+
+int run_all(int argc, const char** argv) {
+    int         cpu         = 0;
+    double      min_time    = 0.5;
+    double      warmup_time = 0.1;
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 6, "--cpu=") == 0) {
+            cpu = std::stoi(arg.substr(6));
+        } else if (arg.compare(0, 14, "--min-time-ms=") == 0) {
+            min_time = std::stoi(arg.substr(14)) / 1000.0;
+        } else if (arg.compare(0, 12, "--warmup-ms=") == 0) {
+            warmup_time = std::stoi(arg.substr(12)) / 1000.0;
+        } else if (arg.compare(0, 9, "--filter=") == 0) {
+            filter = arg.substr(9);
+        } else {
+            std::cerr << "Unknown flag " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (!pin_to_cpu(cpu)) {
+        std::cerr << "Can't pin to cpu " << cpu << ", results will be noisy" << std::endl;
+    }
+
+    std::cout << std::setw(32) << std::left << "benchmark" << std::right
+              << std::setw(12) << "iters"
+              << std::setw(14) << "ns/iter"
+              << std::setw(14) << "cycles/iter"
+              << std::setw(14) << "cache-miss"
+              << std::setw(14) << "branch-miss"
+              << std::endl;
+
+    PerfCounters counters;
+    for (auto const& bench: registry()) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        // Warmup run - pulls code and data into the caches and lets the
+        // cpu leave the idle frequency before anything is recorded.
+        if (warmup_time > 0) {
+            run_once(bench.fn, calibrate(bench.fn, warmup_time));
+        }
+        u64 iters = calibrate(bench.fn, min_time);
+        counters.start();
+        double elapsed = run_once(bench.fn, iters);
+        auto values = counters.stop();
+
+        std::cout << std::setw(32) << std::left << bench.name << std::right
+                  << std::setw(12) << iters;
+        print_value(elapsed * 1e9 / static_cast<double>(iters));
+        if (values.valid) {
+            print_value(static_cast<double>(values.cycles) / static_cast<double>(iters));
+            print_value(static_cast<double>(values.cache_misses) / static_cast<double>(iters));
+            print_value(static_cast<double>(values.branch_misses) / static_cast<double>(iters));
+        } else {
+            std::cout << std::setw(14) << "n/a" << std::setw(14) << "n/a" << std::setw(14) << "n/a";
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+}  // namespace Microbench
+}  // namespace Akumuli
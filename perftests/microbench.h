@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "akumuli.h"
+
+namespace Akumuli {
+namespace Microbench {
+
+/** Microbenchmark harness.
+  * Benchmarks are plain functions registered with the `MICROBENCH` macro
+  * and driven by `run_all` from `main`:
+  *
+  *     MICROBENCH(encode_chunk) {
+  *         // setup (not measured once the loop is calibrated to dominate)
+  *         while (state.keep_running()) {
+  *             // one unit of work
+  *         }
+  *     }
+  *
+  *     int main(int argc, const char** argv) {
+  *         return Akumuli::Microbench::run_all(argc, argv);
+  *     }
+  *
+  * The harness pins the process to one core, warms the benchmark up,
+  * calibrates the iteration count until the run is long enough to
+  * measure, and reports wall time plus hardware counters (cycles, cache
+  * misses, branch misses via perf_event_open) per iteration. Counters
+  * degrade to "n/a" when perf events aren't permitted (containers,
+  * perf_event_paranoid).
+  *
+  * Flags: --cpu=N (pin target, default 0), --min-time-ms=N (measured run
+  * length, default 500), --warmup-ms=N (default 100), --filter=SUBSTR
+  * (run only matching benchmarks).
+  */
+
+//! Hardware counter readout of one measured run.
+struct CounterValues {
+    u64  cycles;
+    u64  cache_misses;
+    u64  branch_misses;
+    bool valid;  //< False if perf events are unavailable
+};
+
+/** Group of perf_event_open counters (cycles, cache misses, branch
+  * misses). Counters are opened per-process and read as one group so
+  * the three values cover the same instruction window.
+  */
+class PerfCounters {
+    enum { NCOUNTERS = 3 };
+    int  fds_[NCOUNTERS];
+    bool available_;
+
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(PerfCounters const&) = delete;
+    PerfCounters& operator=(PerfCounters const&) = delete;
+
+    //! Reset and enable the counters.
+    void start();
+
+    //! Disable the counters and read them out.
+    CounterValues stop();
+};
+
+//! Iteration driver passed to every benchmark function.
+class State {
+    u64 limit_;
+    u64 count_;
+
+public:
+    explicit State(u64 limit)
+        : limit_(limit)
+        , count_(0)
+    {
+    }
+
+    //! Loop condition of the benchmark body.
+    bool keep_running() { return count_++ < limit_; }
+
+    //! Number of iterations of this run.
+    u64 iterations() const { return limit_; }
+};
+
+typedef std::function<void(State&)> BenchFn;
+
+//! Register benchmark (used by the `MICROBENCH` macro).
+int register_benchmark(const char* name, BenchFn fn);
+
+//! Run all registered benchmarks, returns process exit code.
+int run_all(int argc, const char** argv);
+
+}  // namespace Microbench
+}  // namespace Akumuli
+
+#define MICROBENCH(fname)                                                                          \
+    static void fname(Akumuli::Microbench::State& state);                                          \
+    static int fname##_registration =                                                              \
+        Akumuli::Microbench::register_benchmark(#fname, fname);                                    \
+    static void fname(Akumuli::Microbench::State& state)
@@ -0,0 +1,174 @@
+#include "storage_engine/compression.h"
+#include "perftest_tools.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace Akumuli;
+using namespace Akumuli::StorageEngine;
+
+/** Benchmark matrix: codec x data-shape x block-size.
+  * For every cell the benchmark reports bytes/sample and decode throughput,
+  * so codec regressions can be caught before an upgrade instead of in
+  * production.
+  */
+
+struct DataShape {
+    const char* name;
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<double> values;
+};
+
+static std::vector<DataShape> make_shapes(size_t n) {
+    std::mt19937 gen(0);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::vector<DataShape> shapes;
+
+    // Monotonic counter sampled at a fixed rate
+    DataShape counter;
+    counter.name = "counter";
+    double cval = 0;
+    for (size_t i = 0; i < n; i++) {
+        counter.timestamps.push_back(i * 1000000);
+        cval += std::abs(noise(gen)) * 10.0;
+        counter.values.push_back(cval);
+    }
+    shapes.push_back(std::move(counter));
+
+    // Noisy gauge
+    DataShape gauge;
+    gauge.name = "gauge";
+    double gval = 100.0;
+    for (size_t i = 0; i < n; i++) {
+        gauge.timestamps.push_back(i * 1000000 + (gen() % 1000));
+        gval += noise(gen);
+        gauge.values.push_back(gval);
+    }
+    shapes.push_back(std::move(gauge));
+
+    // Integer-valued doubles (e.g. event counts)
+    DataShape intdouble;
+    intdouble.name = "int-double";
+    for (size_t i = 0; i < n; i++) {
+        intdouble.timestamps.push_back(i * 1000000);
+        intdouble.values.push_back(static_cast<double>(gen() % 100));
+    }
+    shapes.push_back(std::move(intdouble));
+
+    // Constant value (liveness flag)
+    DataShape constant;
+    constant.name = "constant";
+    for (size_t i = 0; i < n; i++) {
+        constant.timestamps.push_back(i * 1000000);
+        constant.values.push_back(1.0);
+    }
+    shapes.push_back(std::move(constant));
+
+    // Bursty timestamps (sub-second event stream)
+    DataShape bursty;
+    bursty.name = "bursty";
+    aku_Timestamp ts = 0;
+    double bval = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        if (gen() % 100 == 0) {
+            ts += 1000000000ull;  // 1s gap between bursts
+        } else {
+            ts += gen() % 1000;   // sub-microsecond steps inside a burst
+        }
+        bursty.timestamps.push_back(ts);
+        bval += noise(gen);
+        bursty.values.push_back(bval);
+    }
+    shapes.push_back(std::move(bursty));
+
+    return shapes;
+}
+
+static const char* ts_codec_name(int codec) {
+    return codec == TS_CODEC_DELTA_GV ? "delta-gv " : "delta-rle";
+}
+
+static const char* val_codec_name(int codec) {
+    return codec == VAL_CODEC_GORILLA ? "gorilla" : "fcm    ";
+}
+
+int main() {
+    const size_t N = 100000;
+    const int NDECODE_RUNS = 10;
+    auto shapes = make_shapes(N);
+    std::vector<size_t> block_sizes = { 4096, 8192, 16384 };
+    std::vector<int> ts_codecs = { TS_CODEC_DELTA_RLE, TS_CODEC_DELTA_GV };
+    std::vector<int> val_codecs = { VAL_CODEC_FCM, VAL_CODEC_GORILLA };
+
+    std::cout << "shape      | block | ts codec  | val codec | bytes/sample | decode GB/s" << std::endl;
+    std::cout << "-----------+-------+-----------+-----------+--------------+------------" << std::endl;
+
+    for (auto const& shape: shapes) {
+        for (auto block_size: block_sizes) {
+            for (auto ts_codec: ts_codecs) {
+                for (auto val_codec: val_codecs) {
+                    // Encode the whole shape block by block
+                    std::vector<std::vector<u8>> blocks;
+                    std::vector<size_t> block_used;
+                    size_t ix = 0;
+                    size_t total_bytes = 0;
+                    while (ix < N) {
+                        blocks.emplace_back(block_size);
+                        DataBlockWriter writer(42, blocks.back().data(),
+                                               static_cast<int>(block_size),
+                                               ts_codec, val_codec);
+                        while (ix < N) {
+                            aku_Status status = writer.put(shape.timestamps[ix], shape.values[ix]);
+                            if (status == AKU_EOVERFLOW) {
+                                break;
+                            }
+                            ix++;
+                        }
+                        size_t used = writer.commit();
+                        block_used.push_back(used);
+                        total_bytes += used;
+                    }
+
+                    // Decode all blocks several times and measure throughput
+                    PerfTimer tm;
+                    volatile double sink = 0;
+                    for (int run = 0; run < NDECODE_RUNS; run++) {
+                        for (size_t i = 0; i < blocks.size(); i++) {
+                            DataBlockReader reader(blocks[i].data(), block_used[i]);
+                            size_t nelem = reader.nelements();
+                            for (size_t j = 0; j < nelem; j++) {
+                                aku_Status status;
+                                aku_Timestamp ts;
+                                double value;
+                                std::tie(status, ts, value) = reader.next();
+                                if (status != AKU_SUCCESS) {
+                                    std::cout << "Decode error in " << shape.name << std::endl;
+                                    return 1;
+                                }
+                                sink = value;
+                            }
+                        }
+                    }
+                    double elapsed = tm.elapsed();
+                    (void)sink;
+
+                    double bytes_per_sample = double(total_bytes) / double(N);
+                    double raw_bytes = double(N) * 16.0 * NDECODE_RUNS;  // ts + value
+                    double gbps = raw_bytes / elapsed / 1e9;
+
+                    std::cout << std::setw(10) << std::left << shape.name << " | "
+                              << std::setw(5) << block_size << " | "
+                              << ts_codec_name(ts_codec) << " | "
+                              << val_codec_name(val_codec) << "   | "
+                              << std::setw(12) << bytes_per_sample << " | "
+                              << gbps << std::endl;
+                }
+            }
+        }
+    }
+    return 0;
+}
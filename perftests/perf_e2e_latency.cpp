@@ -0,0 +1,148 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tcp_server.h"
+#include "signal_handler.h"
+#include "perftest_tools.h"
+#include "latency_histogram.h"
+
+using namespace Akumuli;
+
+/* End-to-end ingestion latency benchmark. Drives the full TCP path
+ * (acceptor, session, protocol parser, pipeline) at a fixed arrival rate
+ * and reports per-sample ack latency percentiles. The client stamps every
+ * sample with its _scheduled_ send time and never drops a slot from the
+ * schedule, so samples that queue up behind a stall are accounted from
+ * the moment they should have been sent - the usual coordinated omission
+ * of closed-loop load generators doesn't hide the backlog.
+ */
+
+const int PORT = 4111;
+
+static u64 now_ns() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+//! Measures the time from the scheduled send to the database write call
+struct DbLatencyMock : DbConnection {
+    LatencyHistogram hist_;
+    std::atomic<u64> nrec_;
+
+    DbLatencyMock()
+        : hist_("e2e_ack")
+        , nrec_{0}
+    {
+    }
+
+    void close() {}
+
+    aku_Status write(aku_Sample const& sample) {
+        auto now = now_ns();
+        if (now > sample.timestamp) {
+            hist_.add(now - sample.timestamp);
+        }
+        nrec_++;
+        return AKU_SUCCESS;
+    }
+
+    std::shared_ptr<DbCursor> search(std::string) {
+        throw "not implemented";
+    }
+    int param_id_to_series(aku_ParamId, char*, size_t) {
+        throw "not implemented";
+    }
+    aku_Status series_to_param_id(const char*, size_t, aku_Sample*) {
+        throw "not implemented";
+    }
+    std::string get_all_stats() {
+        return "{}";
+    }
+};
+
+//! Send samples at a fixed rate, stamping each with its scheduled time
+static void client_thread(int id, u64 rate, u64 duration_sec) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        std::perror("socket");
+        std::exit(1);
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        std::perror("connect");
+        std::exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    const u64 interval = 1000000000ull / rate;
+    u64 deadline = now_ns();
+    const u64 end = deadline + duration_sec*1000000000ull;
+    char buf[0x100];
+    while (deadline < end) {
+        // Busy-wait keeps the schedule precise, a late sample is sent
+        // right away but still carries the deadline it missed
+        while (now_ns() < deadline) {
+            std::this_thread::yield();
+        }
+        int len = snprintf(buf, sizeof(buf), ":%d\r\n:%llu\r\n+3.14\r\n",
+                           id + 1, static_cast<unsigned long long>(deadline));
+        if (::write(fd, buf, len) != len) {
+            std::cerr << "client " << id << " disconnected" << std::endl;
+            break;
+        }
+        deadline += interval;
+    }
+    ::close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    u64 rate     = argc > 1 ? static_cast<u64>(atoll(argv[1])) : 100000ull;
+    u64 duration = argc > 2 ? static_cast<u64>(atoll(argv[2])) : 10ull;
+    int nclients = argc > 3 ? atoi(argv[3]) : 1;
+
+    std::cout << "End-to-end ingestion latency test" << std::endl;
+    std::cout << "rate: " << rate << " samples/sec per client, duration: "
+              << duration << " sec, clients: " << nclients << std::endl;
+
+    auto con    = std::make_shared<DbLatencyMock>();
+    auto ppl    = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF);
+    auto server = std::make_shared<TcpServer>(ppl, 4, PORT);
+    SignalHandler sig;
+    server->start(&sig, 0);
+
+    std::vector<std::thread> clients;
+    for (int i = 0; i < nclients; i++) {
+        clients.emplace_back(client_thread, i, rate, duration);
+    }
+    for (auto& thread: clients) {
+        thread.join();
+    }
+    // Let the pipeline drain before reading the histogram
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    auto counts = con->hist_.merge();
+    auto nrec   = con->nrec_.load();
+    std::cout << "samples written: " << nrec << std::endl;
+    std::cout << "throughput: " << nrec/duration << " samples/sec" << std::endl;
+    std::cout << "ack latency p50: " << LatencyHistogram::percentile(counts, 0.5)/1000.0   << " usec" << std::endl;
+    std::cout << "ack latency p99: " << LatencyHistogram::percentile(counts, 0.99)/1000.0  << " usec" << std::endl;
+    std::cout << "ack latency p999: " << LatencyHistogram::percentile(counts, 0.999)/1000.0 << " usec" << std::endl;
+
+    server->stop();
+    return 0;
+}
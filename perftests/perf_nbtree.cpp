@@ -1,126 +1,117 @@
 // C++ headers
-#include <iostream>
+#include <memory>
 #include <vector>
 
 // Lib headers
 #include <apr.h>
-#include <sys/time.h>
 
 // App headers
 #include "storage_engine/blockstore.h"
 #include "storage_engine/volume.h"
 #include "storage_engine/nbtree.h"
+#include "microbench.h"
 
-
+using namespace Akumuli;
 using namespace Akumuli::StorageEngine;
+using namespace Akumuli::Microbench;
+
+/** Shared on-disk fixture. The volumes are created once in /tmp and the
+  * benchmarks append to their own trees, so a run doesn't depend on the
+  * benchmarks before it.
+  */
+struct Fixture {
+    std::shared_ptr<FixedSizeFileStorage>           bstore;
+    std::vector<std::shared_ptr<NBTreeExtentsList>> trees;
 
-class Timer
-{
-public:
-    Timer() { gettimeofday(&_start_time, nullptr); }
-    void   restart() { gettimeofday(&_start_time, nullptr); }
-    double elapsed() const {
-        timeval curr;
-        gettimeofday(&curr, nullptr);
-        return double(curr.tv_sec - _start_time.tv_sec) +
-               double(curr.tv_usec - _start_time.tv_usec)/1000000.0;
-    }
-private:
-    timeval _start_time;
-};
-
-int main() {
-    apr_initialize();
-
-    // Create volumes
-    std::string metapath = "/tmp/metavol.db";
-    std::vector<std::string> paths = {
-        "/tmp/volume0.db",
-        "/tmp/volume1.db",
-    };
-    std::vector<std::tuple<u32, std::string>> volumes {
-        std::make_tuple(1024*1024, paths[0]),
-        std::make_tuple(1024*1024, paths[1])
+    enum {
+        NUMIDS = 1000,
     };
 
-    FixedSizeFileStorage::create(metapath, volumes);
-
-    auto bstore = FixedSizeFileStorage::open(metapath, paths);
-
-    std::vector<std::shared_ptr<NBTreeExtentsList>> trees;
-    const int numids = 10000;
-    for (int i = 0; i < numids; i++) {
-        auto id = static_cast<aku_ParamId>(i);
-        std::vector<LogicAddr> empty;
-        auto ext = std::make_shared<NBTreeExtentsList>(id, empty, bstore);
-        trees.push_back(std::move(ext));
+    Fixture() {
+        std::string metapath = "/tmp/metavol.db";
+        std::vector<std::string> paths = {
+            "/tmp/volume0.db",
+            "/tmp/volume1.db",
+        };
+        std::vector<std::tuple<u32, std::string>> volumes {
+            std::make_tuple(1024*1024, paths[0]),
+            std::make_tuple(1024*1024, paths[1])
+        };
+        FixedSizeFileStorage::create(metapath, volumes);
+        bstore = FixedSizeFileStorage::open(metapath, paths);
+        for (int i = 0; i < NUMIDS; i++) {
+            auto id = static_cast<aku_ParamId>(i);
+            std::vector<LogicAddr> empty;
+            auto ext = std::make_shared<NBTreeExtentsList>(id, empty, bstore);
+            trees.push_back(std::move(ext));
+        }
     }
 
-    const int N = 500000000;
+    static Fixture& instance() {
+        static Fixture fixture;
+        return fixture;
+    }
+};
 
-    Timer tm;
-    Timer total;
+//! Append one sample to a round-robin tree per iteration
+MICROBENCH(nbtree_append) {
+    auto& fix = Fixture::instance();
+    static aku_Timestamp ts = 0;
     size_t rr = 0;
-    size_t flush = 0;
-    size_t nsamples = 0;
-    std::vector<aku_ParamId> ids;
-    for (int i = 1; i < (N+1); i++) {
-        aku_Timestamp ts = static_cast<aku_Timestamp>(i);
-        double value = i;
+    while (state.keep_running()) {
+        ts++;
         if (rr % 10000 == 0) {
             rr = static_cast<size_t>(rand());
         }
-        aku_ParamId id = rr++ % trees.size();
-        if (trees[id]->append(ts, value)) {
-            flush++;
-            if (flush % trees.size() == 0) {
-                //std::cout << "About to call flush" << std::endl;
-                //bstore->flush();
-            }
-        }
-        if (nsamples < 10) {
-            ids.push_back(id);
-        } else {
-            int rix = rand() % nsamples;
-            if (rix < 10) {
-                ids[rix] = id;
-            }
-        }
-        nsamples++;
-        if (i % 1000000 == 0) {
-            std::cout << i << "\t" << tm.elapsed() << " sec" << std::endl;
-            tm.restart();
-        }
+        auto id = rr++ % fix.trees.size();
+        fix.trees[id]->append(ts, static_cast<double>(ts));
     }
+}
 
-    std::cout << "Write time: " << total.elapsed() << "s" << std::endl;
-
-    for (auto id: ids) {
-        total.restart();
-        auto it = trees[id]->search(N+1, 0);
-        double sum = 0;
-        size_t total_sum = 0;
+//! Scan one pre-filled tree per iteration
+MICROBENCH(nbtree_scan) {
+    auto& fix = Fixture::instance();
+    const aku_ParamId SCAN_ID = 0;
+    static aku_Timestamp filled = 0;
+    if (filled == 0) {
+        // Fill the scanned tree once (several leaf nodes worth of data)
+        for (filled = 1; filled <= 100000; filled++) {
+            fix.trees[SCAN_ID]->append(filled, static_cast<double>(filled));
+        }
+    }
+    std::vector<aku_Timestamp> ts(0x1000, 0);
+    std::vector<double> xs(0x1000, 0.0);
+    while (state.keep_running()) {
+        auto it = fix.trees[SCAN_ID]->search(filled, 0);
         aku_Status status = AKU_SUCCESS;
-        std::vector<aku_Timestamp> ts(0x1000, 0);
-        std::vector<double> xs(0x1000, 0.0);
-        while(status == AKU_SUCCESS) {
+        size_t total = 0;
+        while (status == AKU_SUCCESS) {
             size_t sz;
             std::tie(status, sz) = it->read(ts.data(), xs.data(), 0x1000);
-            total_sum += sz;
-            for (size_t i = 0; i < sz; i++) {
-                sum += xs[i];
-            }
+            total += sz;
+        }
+        if (total == 0) {
+            std::terminate();
         }
-        std::cout << "From id: " << id << " n: " << total_sum << " sum: "
-                  << sum << " calculated in " << total.elapsed() << "s" << std::endl;
     }
+}
 
-    total.restart();
-    for (size_t i = 0; i < trees.size(); i++) {
-        trees[i]->close();
+//! Build and commit a small tree per iteration (close path)
+MICROBENCH(nbtree_close_reopen) {
+    auto& fix = Fixture::instance();
+    static aku_Timestamp ts = 0;
+    while (state.keep_running()) {
+        std::vector<LogicAddr> empty;
+        auto tree = std::make_shared<NBTreeExtentsList>(Fixture::NUMIDS + 1, empty, fix.bstore);
+        for (int i = 0; i < 100; i++) {
+            ts++;
+            tree->append(ts, static_cast<double>(ts));
+        }
+        tree->close();
     }
+}
 
-    std::cout << "Commit time: " << total.elapsed() << "s" << std::endl;
-
-    return 0;
+int main(int argc, const char** argv) {
+    apr_initialize();
+    return run_all(argc, argv);
 }
@@ -1,28 +1,17 @@
-#include <iostream>
-#include <cassert>
-#include <random>
+#include <memory>
 #include <tuple>
-#include <map>
 #include <vector>
-#include <algorithm>
-#include <memory>
 
-#include <boost/timer.hpp>
-#include <boost/filesystem.hpp>
-#include <boost/lexical_cast.hpp>
-#include <apr_mmap.h>
 #include <apr_general.h>
 
 #include "akumuli.h"
 #include "page.h"
 #include "storage.h"
 #include "sequencer.h"
+#include "microbench.h"
 
 using namespace Akumuli;
-using namespace std;
-
-const u32 NUM_ITERATIONS = 100*1000*1000;
-
+using namespace Akumuli::Microbench;
 
 //! Simple static buffer cursor
 struct BufferedCursor : InternalCursor {
@@ -59,85 +48,55 @@ struct BufferedCursor : InternalCursor {
     }
 };
 
+//! Feed one sample into the sequencer, merge when the window closes
+static void add_one(Sequencer& seq, u64 ix) {
+    TimeSeriesValue value({ix}, ix & 0xFF, static_cast<double>(ix));
+    int status = 0;
+    int lock = 0;
+    std::tie(status, lock) = seq.add(value);
+    if (lock % 2 == 1) {
+        static aku_Sample results[0x10000];
+        BufferedCursor cursor(results, 0x10000);
+        Caller caller;
+        seq.merge(caller, &cursor);
+    }
+}
 
-int main(int cnt, const char** args)
-{
-    aku_initialize(nullptr);
-    {
-        std::cout << "Sequencer perf-test, ordered timestamps" << std::endl;
-        // Patience sort perf-test
-        boost::timer timer;
-        size_t ix_merged = 0;
-        aku_FineTuneParams params = {};
-        params.window_size = 10000;
-        Sequencer seq(nullptr, params);
-        for (u32 ix = 0u; ix < NUM_ITERATIONS; ix++) {
-            TimeSeriesValue value({(u64)ix}, ix & 0xFF, (double)ix);
-            int status = 0;
-            int lock = 0;
-            tie(status, lock) = seq.add(value);
-            if (lock % 2 == 1) {
-                aku_Sample results[0x10000];
-                BufferedCursor cursor(results, 0x10000);
-                Caller caller;
-                seq.merge(caller, &cursor);
-                for (size_t i = 0; i < cursor.count; i++) {
-                    size_t actual = static_cast<size_t>(cursor.results_buffer[i].timestamp);
-                    if (actual != ix_merged) {
-                        // report error
-                        std::cout << "Error at: " << i << " " << actual << " != " << ix_merged << std::endl;
-                        return -1;
-                    }
-                    ix_merged++;
-                }
-            }
-            if (ix % 1000000 == 0) {
-                std::cout << ix << " " << timer.elapsed() << "s" << std::endl;
-                timer.restart();
-            }
-        }
+static aku_FineTuneParams make_params() {
+    aku_FineTuneParams params = {};
+    params.window_size = 10000;
+    return params;
+}
+
+//! Patience sort, ordered timestamps (one add per iteration)
+MICROBENCH(sequencer_add_ordered) {
+    static Sequencer seq(make_params());
+    static u64 ix = 0;
+    while (state.keep_running()) {
+        add_one(seq, ix++);
     }
-    {
-        std::cout << "Sequencer perf-test, unordered timestamps" << std::endl;
-        // Patience sort perf-test
-        boost::timer timer;
-        size_t ix_merged = 0;
-        const int buffer_size = 10000;
-        u32 buffer[buffer_size];
-        int buffer_ix = buffer_size;
-        Sequencer seq(nullptr, {10000});
-        for (u32 ix = 0u; ix < NUM_ITERATIONS; ix++) {
-            buffer_ix--;
-            buffer[buffer_ix] = ix;
-            if (buffer_ix == 0) {
-                buffer_ix = buffer_size;
-                for(auto ixx: buffer) {
-                    TimeSeriesValue value({(u64)ixx}, ixx & 0xFF, (double)ixx);
-                    int status = 0;
-                    int lock = 0;
-                    tie(status, lock) = seq.add(value);
-                    if (lock % 2 == 1) {
-                        aku_Sample results[0x10000];
-                        BufferedCursor cursor(results, 0x10000);
-                        Caller caller;
-                        seq.merge(caller, &cursor);
-                        for (size_t i = 0; i < cursor.count; i++) {
-                            auto offset = static_cast<size_t>(cursor.results_buffer[i].timestamp);
-                            if (offset != ix_merged) {
-                                // report error
-                                std::cout << "Error at: " << i << " " << offset << " != " << ix_merged << std::endl;
-                                return -1;
-                            }
-                            ix_merged++;
-                        }
-                    }
-                }
-            }
-            if (ix % 1000000 == 0) {
-                std::cout << ix << " " << timer.elapsed() << "s" << std::endl;
-                timer.restart();
+}
+
+//! Patience sort, locally unordered timestamps (one add per iteration)
+MICROBENCH(sequencer_add_unordered) {
+    static Sequencer seq(make_params());
+    static u64 ix = 0;
+    enum { BUFFER_SIZE = 10000 };
+    static std::vector<u64> buffer;
+    while (state.keep_running()) {
+        // Timestamps arrive in reversed batches - every sample is out of
+        // order locally but the stream stays inside the window
+        buffer.push_back(ix++);
+        if (buffer.size() == BUFFER_SIZE) {
+            for (auto it = buffer.rbegin(); it != buffer.rend(); it++) {
+                add_one(seq, *it);
             }
+            buffer.clear();
         }
     }
-    return 0;
+}
+
+int main(int argc, const char** argv) {
+    aku_initialize(nullptr, nullptr);
+    return run_all(argc, argv);
 }
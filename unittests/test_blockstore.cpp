@@ -7,6 +7,9 @@
 #include <apr.h>
 #include "akumuli.h"
 #include "storage_engine/blockstore.h"
+#include "storage_engine/nbtree.h"
+#include "storage_engine/replication.h"
+#include "storage_engine/tiering.h"
 #include "storage_engine/volume.h"
 #include "log_iface.h"
 
@@ -126,3 +129,661 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_1) {
     delete_blockstore();
 }
 
+BOOST_AUTO_TEST_CASE(Test_blockstore_striped_append) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = FixedSizeFileStorage::open(METAPATH, VOLPATH, 0, false, 2);
+
+    aku_Status status;
+    LogicAddr addr;
+    std::vector<LogicAddr> addrs;
+    auto buffer = std::make_shared<Block>();
+    for (int i = 0; i < 16; i++) {
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        addrs.push_back(addr);
+    }
+
+    // Blocks are routed round-robin between the two volumes
+    for (u32 i = 0; i < 16; i++) {
+        BOOST_REQUIRE_EQUAL(addrs[i] >> 32, i % 2);
+        BOOST_REQUIRE_EQUAL(addrs[i] & 0xFFFFFFFF, i / 2);
+    }
+
+    bstore->flush();
+
+    // Everything should be readable
+    std::shared_ptr<Block> block;
+    for (int i = 0; i < 16; i++) {
+        std::tie(status, block) = bstore->read_block(addrs[i]);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_data()[0], static_cast<u8>(i));
+    }
+
+    // Both volumes are full, the stripe should move on and recycle them
+    buffer->get_data()[0] = 16;
+    std::tie(status, addr) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(addr >> 32, 2);
+
+    // Recycled addresses are dead
+    std::tie(status, block) = bstore->read_block(addrs[0]);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_ARG);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_dedup) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = FixedSizeFileStorage::open(METAPATH, VOLPATH, 0, false, 1, true);
+
+    aku_Status status;
+    LogicAddr first, second, third;
+    auto buffer = std::make_shared<Block>();
+    buffer->get_data()[0] = 24;
+    std::tie(status, first) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    // Identical content maps to the address of the first copy
+    std::tie(status, second) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(second, first);
+    BOOST_REQUIRE_EQUAL(bstore->get_dedup_hits(), 1);
+
+    // Different content still gets its own block
+    buffer->get_data()[0] = 42;
+    std::tie(status, third) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE(third != first);
+
+    bstore->flush();
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = bstore->read_block(first);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_data()[0], 24);
+    std::tie(status, block) = bstore->read_block(third);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_data()[0], 42);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_prefetch) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+
+    auto buffer = std::make_shared<Block>();
+
+    LogicAddr addr;
+    aku_Status status;
+
+    for (int i = 0; i < 8; i++) {
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+
+    // Prefetched blocks should be readable and carry the same content.
+    for (int i = 0; i < 8; i++) {
+        bstore->prefetch_block(static_cast<LogicAddr>(i));
+    }
+    for (int i = 0; i < 8; i++) {
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = bstore->read_block(static_cast<LogicAddr>(i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_data()[0], i);
+    }
+
+    // Prefetch of the bad address shouldn't make it readable.
+    bstore->prefetch_block(100);
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = bstore->read_block(100);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_ARG);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_cache_warmup) {
+    delete_blockstore();
+    create_blockstore();
+    const char* statepath = "cache_state";
+    std::vector<LogicAddr> addrs;
+    {
+        auto bstore = open_blockstore();
+        aku_Status status;
+        LogicAddr addr;
+        auto buffer = std::make_shared<Block>();
+        for (int i = 0; i < 8; i++) {
+            buffer->get_data()[0] = static_cast<u8>(i);
+            std::tie(status, addr) = bstore->append_block(buffer);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            addrs.push_back(addr);
+        }
+        bstore->flush();
+        // Populate the cache
+        std::shared_ptr<Block> block;
+        for (auto a: addrs) {
+            std::tie(status, block) = bstore->read_block(a);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+        BOOST_REQUIRE_EQUAL(bstore->save_cache_state(statepath), AKU_SUCCESS);
+    }
+    {
+        auto bstore = open_blockstore();
+        BOOST_REQUIRE_EQUAL(bstore->warmup_cache(statepath), AKU_SUCCESS);
+        // Warmed up blocks should be readable and carry the same content.
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        for (int i = 0; i < 8; i++) {
+            std::tie(status, block) = bstore->read_block(addrs.at(static_cast<size_t>(i)));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            BOOST_REQUIRE_EQUAL(block->get_data()[0], i);
+        }
+    }
+    {
+        // Missing state file is a cold start, not an error.
+        auto bstore = open_blockstore();
+        BOOST_REQUIRE_EQUAL(bstore->warmup_cache("no_such_state"), AKU_SUCCESS);
+    }
+    apr_pool_t* pool;
+    apr_pool_create(&pool, nullptr);
+    apr_file_remove(statepath, pool);
+    apr_pool_destroy(pool);
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_volume_write_coalescing) {
+    delete_blockstore();
+    create_blockstore();
+    auto volume = Volume::open_existing(VOLPATH[0].c_str(), 0);
+
+    std::vector<u8> source(AKU_BLOCK_SIZE);
+    aku_Status status;
+    BlockAddr addr;
+
+    for (int i = 0; i < 8; i++) {
+        source[0] = static_cast<u8>(i);
+        std::tie(status, addr) = volume->append_block(source.data());
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(addr, i);
+    }
+
+    // Blocks still sit in the write-behind buffer but should be readable.
+    BOOST_REQUIRE_EQUAL(volume->get_flushed_pos(), 0);
+    std::vector<u8> dest(AKU_BLOCK_SIZE);
+    for (u32 i = 0; i < 8; i++) {
+        status = volume->read_block(i, dest.data());
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(dest[0], i);
+    }
+
+    // Flush should write the buffer out in one go.
+    volume->flush();
+    BOOST_REQUIRE_EQUAL(volume->get_flushed_pos(), 8);
+    volume.reset();
+
+    // Reopen and check that everything reached the disk.
+    volume = Volume::open_existing(VOLPATH[0].c_str(), 8);
+    for (u32 i = 0; i < 8; i++) {
+        status = volume->read_block(i, dest.data());
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(dest[0], i);
+    }
+
+    volume.reset();
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_snapshot) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+
+    auto buffer = std::make_shared<Block>();
+    LogicAddr addr;
+    aku_Status status;
+
+    // Fill the first volume
+    for (int i = 0; i < 8; i++) {
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+
+    auto snapshot = bstore->create_snapshot();
+    BOOST_REQUIRE_EQUAL(snapshot.size(), 1);
+    BOOST_REQUIRE_EQUAL(snapshot.at(0).nblocks, 8);
+
+    // Stream the frozen range and check the content
+    std::vector<u8> dest(8*4096);
+    status = bstore->read_snapshot(snapshot.at(0), 0, 8, dest.data());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    for (u32 i = 0; i < 8; i++) {
+        BOOST_REQUIRE_EQUAL(dest.at(i*4096), i);
+    }
+
+    // Out of range read should fail
+    status = bstore->read_snapshot(snapshot.at(0), 4, 5, dest.data());
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_ARG);
+
+    // Recycle the first volume while the snapshot is alive
+    for (int i = 8; i < 17; i++) {
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+
+    // Stale snapshot entry should be rejected
+    status = bstore->read_snapshot(snapshot.at(0), 0, 8, dest.data());
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_ARG);
+
+    // New snapshot should cover both volumes
+    snapshot = bstore->create_snapshot();
+    BOOST_REQUIRE_EQUAL(snapshot.size(), 2);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_scrub) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+
+    aku_Status status;
+    LogicAddr addr;
+    const u16 payload_size = 100;
+
+    // Append self-describing blocks the way the NB+tree does - payload
+    // size and checksum live in the `SubtreeRef` header
+    for (int i = 0; i < 5; i++) {
+        auto block = std::make_shared<Block>();
+        auto ref = reinterpret_cast<SubtreeRef*>(block->get_data());
+        ref->payload_size = payload_size;
+        for (u16 j = 0; j < payload_size; j++) {
+            block->get_data()[sizeof(SubtreeRef) + j] = static_cast<u8>(i + j);
+        }
+        ref->checksum = bstore->checksum(block->get_data() + sizeof(SubtreeRef), payload_size);
+        if (i == 3) {
+            // Simulate bit rot in the payload of one block
+            ref->checksum ^= 0xDEADBEEF;
+        }
+        std::tie(status, addr) = bstore->append_block(block);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+
+    status = bstore->start_scrub(0);  // unpaced
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    // Second start should fail
+    BOOST_REQUIRE_EQUAL(bstore->start_scrub(0), AKU_EBUSY);
+
+    // Wait for the first pass to complete
+    for (int i = 0; i < 500; i++) {
+        if (bstore->get_scrub_stats().passes_complete != 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    bstore->stop_scrub();
+
+    auto stats = bstore->get_scrub_stats();
+    BOOST_REQUIRE_EQUAL(stats.passes_complete, 1);
+    BOOST_REQUIRE_EQUAL(stats.blocks_scanned, 5);
+    BOOST_REQUIRE_EQUAL(stats.errors_found, 1);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_drop_partition) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+
+    aku_Status status;
+    LogicAddr addr;
+
+    auto append = [&](aku_Timestamp begin, aku_Timestamp end) {
+        auto block = std::make_shared<Block>();
+        auto ref = reinterpret_cast<SubtreeRef*>(block->get_data());
+        ref->begin = begin;
+        ref->end   = end;
+        std::tie(status, addr) = bstore->append_block(block);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        return addr;
+    };
+
+    // Fill volume 0 with old data, timestamps in [0, 75]
+    std::vector<LogicAddr> old_addrs;
+    for (int i = 0; i < 8; i++) {
+        old_addrs.push_back(append(static_cast<u64>(i)*10, static_cast<u64>(i)*10 + 5));
+    }
+    // Volume 1 gets recent data
+    auto recent = append(1000, 1005);
+
+    u32 dropped;
+    // Boundary inside volume 0 span - nothing can be dropped
+    std::tie(status, dropped) = bstore->drop_partition(10);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(dropped, 0);
+
+    // Volume 0 lies entirely before the boundary
+    std::tie(status, dropped) = bstore->drop_partition(100);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(dropped, 1);
+
+    // Old addresses are dead, recent data is intact
+    for (auto a: old_addrs) {
+        BOOST_REQUIRE(!bstore->exists(a));
+    }
+    BOOST_REQUIRE(bstore->exists(recent));
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = bstore->read_block(recent);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    // Second pass is a no-op - the span was cleared
+    std::tie(status, dropped) = bstore->drop_partition(100);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(dropped, 0);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_metavolume_dirty_tracking) {
+    delete_blockstore();
+    create_blockstore();
+    {
+        auto meta = MetaVolume::open_existing(METAPATH.c_str());
+        aku_Status status = meta->set_nblocks(0, 4);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        status = meta->set_nblocks(1, 7);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        // Only the first page is flushed, the second one should stay dirty.
+        status = meta->flush(0);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        meta->flush();
+    }
+    // Reopen and check that both updates were written back.
+    auto meta = MetaVolume::open_existing(METAPATH.c_str());
+    aku_Status status;
+    u32 nblocks;
+    std::tie(status, nblocks) = meta->get_nblocks(0);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(nblocks, 4);
+    std::tie(status, nblocks) = meta->get_nblocks(1);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(nblocks, 7);
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_direct_io) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = FixedSizeFileStorage::open(METAPATH, VOLPATH, 0, true);
+
+    auto buffer = std::make_shared<Block>();
+
+    LogicAddr addr;
+    aku_Status status;
+
+    for (int i = 0; i < 8; i++) {
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    bstore->flush();
+
+    for (int i = 0; i < 8; i++) {
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = bstore->read_block(static_cast<LogicAddr>(i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_data()[0], i);
+        // Blocks should be backed by aligned pool buffers.
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(block->get_data()) % AKU_BLOCK_SIZE, 0);
+    }
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_mmap) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = MemoryMappedStorage::open(METAPATH, VOLPATH);
+
+    auto buffer = std::make_shared<Block>();
+
+    LogicAddr addr;
+    aku_Status status;
+
+    // Should trigger rotation (17 blocks, two 8 block volumes)
+    for (int i = 0; i < 17; i++) {
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    BOOST_REQUIRE_EQUAL(addr, (2ull << 32));
+
+    std::shared_ptr<Block> block;
+
+    // First volume was recycled
+    std::tie(status, block) = bstore->read_block(0);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_ARG);
+
+    std::tie(status, block) = bstore->read_block(2ull << 32);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_size(), 4096);
+    BOOST_REQUIRE_EQUAL(block->get_data()[0], 16);
+
+    // Sequential prefetch hints shouldn't affect correctness
+    for (int i = 0; i < 8; i++) {
+        auto hinted = (1ull << 32) | static_cast<LogicAddr>(i);
+        bstore->prefetch_block(hinted);
+        std::tie(status, block) = bstore->read_block(hinted);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_data()[0], 8 + i);
+    }
+    bstore->flush();
+
+    // On-disk layout is shared with FixedSizeFileStorage
+    auto fstore = open_blockstore();
+    std::tie(status, block) = fstore->read_block(2ull << 32);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_data()[0], 16);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_pool_recycling) {
+    auto pool = std::make_shared<BlockPool>();
+    u8* buf;
+    {
+        auto block = pool->make_block(0);
+        buf = block->get_data();
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(buf) % AKU_BLOCK_SIZE, 0);
+    }
+    // Buffer should be returned to the free-list and reused.
+    auto block = pool->make_block(1);
+    BOOST_REQUIRE_EQUAL(block->get_data(), buf);
+    // The whole slab should be carved into buffers up front.
+    BOOST_REQUIRE_EQUAL(pool->free_list_.size() + 1, BlockPool::SLAB_NBLOCKS);
+}
+
+static std::shared_ptr<Block> make_cached_block(LogicAddr addr) {
+    auto block = std::make_shared<Block>();
+    block->set_addr(addr);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_lookup) {
+    BlockCache cache(7);
+    for (LogicAddr addr = 0; addr < 10; addr++) {
+        cache.insert(make_cached_block(addr));
+        // First hit promotes the block to the protected segment.
+        BOOST_REQUIRE(cache.lookup(addr));
+    }
+    for (LogicAddr addr = 0; addr < 10; addr++) {
+        auto block = cache.lookup(addr);
+        BOOST_REQUIRE(block);
+        BOOST_REQUIRE_EQUAL(block->get_addr(), addr);
+    }
+    BOOST_REQUIRE(!cache.lookup(42));
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_scan_resistance) {
+    BlockCache cache(7);
+    // Hot block is accessed twice so it should be promoted
+    // to the protected segment.
+    const LogicAddr hot = 10000;
+    cache.insert(make_cached_block(hot));
+    BOOST_REQUIRE(cache.lookup(hot));
+    // Large sequential scan, each block is touched only once.
+    for (LogicAddr addr = 0; addr < 1000; addr++) {
+        cache.insert(make_cached_block(addr));
+    }
+    // Hot block should survive the scan.
+    auto block = cache.lookup(hot);
+    BOOST_REQUIRE(block);
+    BOOST_REQUIRE_EQUAL(block->get_addr(), hot);
+}
+
+
+BOOST_AUTO_TEST_CASE(Test_replication_stream) {
+    auto bstore = BlockStoreBuilder::create_memstore();
+    auto stream = std::make_shared<ReplicationStream>(bstore);
+    stream->start();
+
+    auto make_block = [](u8 fill) {
+        auto block = std::make_shared<Block>();
+        memset(block->get_data(), fill, block->get_size());
+        return block;
+    };
+
+    // Committed blocks should show up in the stream in commit order
+    std::vector<LogicAddr> addrs;
+    for (int i = 0; i < 50; i++) {
+        aku_Status status;
+        LogicAddr addr;
+        std::tie(status, addr) = bstore->append_block(make_block(static_cast<u8>(i)));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        addrs.push_back(addr);
+    }
+    size_t shipped = 0;
+    while (true) {
+        auto batch = stream->pull();
+        if (batch.empty()) {
+            break;
+        }
+        BOOST_REQUIRE(batch.size() <= ReplicationStream::BATCH_SIZE);
+        for (auto const& entry: batch) {
+            BOOST_REQUIRE_EQUAL(entry.addr, addrs.at(shipped));
+            BOOST_REQUIRE_EQUAL(entry.payload->get_data()[0], static_cast<u8>(shipped));
+            shipped++;
+        }
+        stream->ack(batch.back().addr);
+    }
+    BOOST_REQUIRE_EQUAL(shipped, addrs.size());
+    BOOST_REQUIRE_EQUAL(stream->get_last_acked(), addrs.back());
+    BOOST_REQUIRE(!stream->is_lagging());
+
+    // Follower that stops pulling should fall out of the window
+    for (u32 i = 0; i < ReplicationStream::MAX_PENDING_BLOCKS + 1; i++) {
+        bstore->append_block(make_block(0));
+    }
+    BOOST_REQUIRE(stream->is_lagging());
+    stream->stop();
+}
+
+BOOST_AUTO_TEST_CASE(Test_tiering_demote) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+
+    auto make_block = [](u8 fill) {
+        auto block = std::make_shared<Block>();
+        memset(block->get_data(), fill, block->get_size());
+        return block;
+    };
+
+    // Fill volume 0 and roll over to volume 1
+    std::vector<LogicAddr> addrs;
+    for (u32 i = 0; i < CAPACITIES[0] + 1; i++) {
+        aku_Status status;
+        LogicAddr addr;
+        std::tie(status, addr) = bstore->append_block(make_block(static_cast<u8>(i)));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        addrs.push_back(addr);
+    }
+    bstore->flush();
+
+    // Tiering is disabled until the cold storage is attached
+    BOOST_REQUIRE_EQUAL(bstore->demote_volume(0), AKU_EBAD_ARG);
+
+    auto cold = std::make_shared<FileColdStorage>("coldtier_");
+    bstore->set_cold_storage(cold);
+
+    // Active volume can't be demoted
+    BOOST_REQUIRE_EQUAL(bstore->demote_volume(1), AKU_EBAD_ARG);
+
+    BOOST_REQUIRE_EQUAL(bstore->demote_volume(0), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(bstore->demote_volume(0), AKU_EBAD_ARG);
+
+    // Local file is truncated, reads should be served by the cold tier
+    for (u32 i = 0; i < CAPACITIES[0]; i++) {
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = bstore->read_block(addrs.at(i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_data()[0], static_cast<u8>(i));
+        // Second read comes from the block cache
+        std::tie(status, block) = bstore->read_block(addrs.at(i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_data()[0], static_cast<u8>(i));
+    }
+
+    // Recycling the demoted volume drops the cold object and reuses the file
+    for (u32 i = 0; i < CAPACITIES[1] + 1; i++) {
+        aku_Status status;
+        LogicAddr addr;
+        std::tie(status, addr) = bstore->append_block(make_block(0xFF));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        addrs.push_back(addr);
+    }
+    bstore->flush();
+    // Old addresses are dead, the new one is readable from the local file
+    aku_Status status;
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = bstore->read_block(addrs.at(0));
+    BOOST_REQUIRE_NE(status, AKU_SUCCESS);
+    std::tie(status, block) = bstore->read_block(addrs.back());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_data()[0], 0xFF);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_scan_hint) {
+    BlockCache cache(7);
+    // Hot working set, promoted to the protected segment.
+    for (LogicAddr addr = 0; addr < 50; addr++) {
+        cache.insert(make_cached_block(addr));
+        BOOST_REQUIRE(cache.lookup(addr));
+    }
+    // Scan-hinted blocks enter at the cold end of the probationary
+    // segment so consecutive scan reads recycle each other instead of
+    // churning through the segment.
+    for (LogicAddr addr = 10000; addr < 11000; addr++) {
+        cache.insert(make_cached_block(addr), ReadHint::SCAN);
+    }
+    // The whole working set should survive the scan.
+    for (LogicAddr addr = 0; addr < 50; addr++) {
+        BOOST_REQUIRE(cache.lookup(addr));
+    }
+    // Almost all scan blocks should be gone already - only the
+    // probationary capacity worth of them can linger.
+    size_t lingering = 0;
+    for (LogicAddr addr = 10000; addr < 11000; addr++) {
+        if (cache.lookup(addr)) {
+            lingering++;
+        }
+    }
+    BOOST_REQUIRE(lingering <= 2 * BlockCache::NSHARDS);
+}
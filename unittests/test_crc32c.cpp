@@ -0,0 +1,49 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <cstdlib>
+#include <vector>
+
+#include "crc32c.h"
+
+using namespace Akumuli;
+
+/** The hardware (SSE4.2 crc32q, three-way interleaved) and the table-driven
+  * software implementations should produce identical checksums for any
+  * buffer length, alignment and seed.
+  */
+
+BOOST_AUTO_TEST_CASE(Test_crc32c_hw_sw_parity) {
+    auto hw = chose_crc32c_implementation(CRC32C_hint::FORCE_HW);
+    auto sw = chose_crc32c_implementation(CRC32C_hint::FORCE_SW);
+
+    std::vector<uint8_t> buffer(64*1024 + 17);
+    for (auto& b: buffer) {
+        b = static_cast<uint8_t>(rand());
+    }
+
+    // sweep lengths (including the three-way interleave thresholds) and alignments
+    std::vector<size_t> lengths = { 0, 1, 7, 8, 63, 255, 256, 767, 768,
+                                    4096, 8192, 24575, 24576, 65536 };
+    for (auto len: lengths) {
+        for (size_t align = 0; align < 9; align++) {
+            uint32_t crc_hw = hw(0, buffer.data() + align, len);
+            uint32_t crc_sw = sw(0, buffer.data() + align, len);
+            BOOST_REQUIRE_EQUAL(crc_hw, crc_sw);
+        }
+    }
+
+    // non-zero seed (checksums are chained in the block store)
+    uint32_t seed = 0xDEADBEEF;
+    BOOST_REQUIRE_EQUAL(hw(seed, buffer.data(), 4096), sw(seed, buffer.data(), 4096));
+}
+
+BOOST_AUTO_TEST_CASE(Test_crc32c_detect) {
+    // DETECT should return a working implementation on any host
+    auto impl = chose_crc32c_implementation();
+    const char* payload = "123456789";
+    // well-known CRC-32C check value for "123456789"
+    BOOST_REQUIRE_EQUAL(impl(0, payload, 9), 0xE3069283);
+}
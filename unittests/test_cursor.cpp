@@ -85,6 +85,49 @@ void test_cursor_error(int n_iter, int buf_size) {
     }
 }
 
+void test_cursor_batch(int n_iter, int batch_size, int buf_size) {
+    CoroCursor cursor;
+    std::vector<aku_Sample> expected;
+    auto generator = [n_iter, batch_size, &expected, &cursor](Caller& caller) {
+        std::vector<aku_Sample> batch;
+        for (u32 i = 0u; i < (u32)n_iter; i++) {
+            aku_Sample r = {};
+            r.payload.float64 = i;
+            r.payload.type = AKU_PAYLOAD_FLOAT;
+            r.payload.size = sizeof(aku_Sample);
+            batch.push_back(r);
+            expected.push_back(r);
+            if ((int)batch.size() == batch_size) {
+                cursor.put_batch(caller, batch.data(), batch.size());
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            cursor.put_batch(caller, batch.data(), batch.size());
+        }
+        cursor.complete(caller);
+    };
+    std::vector<aku_Sample> actual;
+    cursor.start(generator);
+    while(!cursor.is_done()) {
+        char results[buf_size*sizeof(aku_Sample)];
+        int n_read = cursor.read_ex(results, buf_size*sizeof(aku_Sample));
+        int offset = 0;
+        while(offset < n_read) {
+            const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(results + offset);
+            actual.push_back(*sample);
+            offset += std::max(sample->payload.size, (u16)sizeof(aku_Sample));
+        }
+    }
+    cursor.close();
+
+    BOOST_REQUIRE_EQUAL(expected.size(), actual.size());
+
+    for(size_t i = 0; i < actual.size(); i++) {
+        BOOST_REQUIRE_EQUAL(expected.at(i).payload.float64, actual.at(i).payload.float64);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_cursor_0_10)
 {
     test_cursor(0, 10);
@@ -110,6 +153,102 @@ BOOST_AUTO_TEST_CASE(Test_cursor_100_7)
     test_cursor(100, 7);
 }
 
+BOOST_AUTO_TEST_CASE(Test_cursor_batch_100_16_10)
+{
+    // batch is larger than the read buffer
+    test_cursor_batch(100, 16, 10);
+}
+
+BOOST_AUTO_TEST_CASE(Test_cursor_batch_100_16_100)
+{
+    // batch fits into the read buffer
+    test_cursor_batch(100, 16, 100);
+}
+
+BOOST_AUTO_TEST_CASE(Test_cursor_batch_100_7_7)
+{
+    test_cursor_batch(100, 7, 7);
+}
+
+namespace {
+
+//! Iterator that generates `nvalues` samples with sequential timestamps
+struct FakeIterator : StorageEngine::NBTreeIterator {
+    aku_Timestamp pos_;
+    aku_Timestamp end_;
+
+    FakeIterator(aku_Timestamp nvalues) : pos_(0), end_(nvalues) {}
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp* destts, double* destval, size_t size) {
+        size_t n = std::min(static_cast<size_t>(end_ - pos_), size);
+        for (size_t i = 0; i < n; i++) {
+            destts[i] = pos_;
+            destval[i] = static_cast<double>(pos_);
+            pos_++;
+        }
+        if (pos_ == end_) {
+            return std::make_tuple(AKU_ENO_DATA, n);
+        }
+        return std::make_tuple(AKU_SUCCESS, n);
+    }
+
+    virtual Direction get_direction() {
+        return Direction::FORWARD;
+    }
+};
+
+}  // namespace
+
+void test_iterator_cursor(size_t nvalues, size_t buf_size) {
+    std::vector<aku_ParamId> ids = { 1, 2 };
+    std::vector<IteratorCursor::PIterator> iters;
+    iters.push_back(IteratorCursor::PIterator(new FakeIterator(nvalues)));
+    iters.push_back(IteratorCursor::PIterator(new FakeIterator(nvalues/2)));
+    IteratorCursor cursor(std::move(ids), std::move(iters));
+
+    std::vector<aku_Sample> actual;
+    while (!cursor.is_done()) {
+        std::vector<char> results(buf_size*sizeof(aku_Sample));
+        size_t n_read = cursor.read_ex(results.data(), results.size());
+        if (n_read == 0 && cursor.is_done()) {
+            break;
+        }
+        size_t offset = 0;
+        while (offset < n_read) {
+            const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(results.data() + offset);
+            actual.push_back(*sample);
+            offset += sample->payload.size;
+        }
+    }
+    BOOST_REQUIRE(!cursor.is_error());
+    cursor.close();
+
+    BOOST_REQUIRE_EQUAL(actual.size(), nvalues + nvalues/2);
+    for (size_t i = 0; i < nvalues; i++) {
+        BOOST_REQUIRE_EQUAL(actual.at(i).paramid, 1);
+        BOOST_REQUIRE_EQUAL(actual.at(i).timestamp, i);
+    }
+    for (size_t i = 0; i < nvalues/2; i++) {
+        BOOST_REQUIRE_EQUAL(actual.at(nvalues + i).paramid, 2);
+        BOOST_REQUIRE_EQUAL(actual.at(nvalues + i).timestamp, i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_iterator_cursor_100_10)
+{
+    test_iterator_cursor(100, 10);
+}
+
+BOOST_AUTO_TEST_CASE(Test_iterator_cursor_100_1000)
+{
+    test_iterator_cursor(100, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(Test_iterator_cursor_0_10)
+{
+    test_iterator_cursor(0, 10);
+}
+
 BOOST_AUTO_TEST_CASE(Test_cursor_error_0_10)
 {
     test_cursor_error(0, 10);
@@ -135,3 +274,94 @@ BOOST_AUTO_TEST_CASE(Test_cursor_error_100_7)
     test_cursor_error(100, 7);
 }
 
+
+void test_concurrent_cursor(int n_iter, int buf_size) {
+    auto inner = new CoroCursor();
+    std::vector<double> expected;
+    auto generator = [n_iter, &expected, inner](Caller& caller) {
+        for (u32 i = 0u; i < (u32)n_iter; i++) {
+            aku_Sample r = {};
+            r.paramid = 42;
+            r.timestamp = i;
+            r.payload.float64 = i;
+            r.payload.type = AKU_PAYLOAD_FLOAT;
+            r.payload.size = sizeof(aku_Sample);
+            inner->put(caller, r);
+            expected.push_back(static_cast<double>(i));
+        }
+        inner->complete(caller);
+    };
+    inner->start(generator);
+    // Pipeline runs on the worker from this point on
+    std::unique_ptr<ExternalCursor> pinner(inner);
+    ConcurrentCursor cursor(std::move(pinner));
+
+    std::vector<double> actual;
+    while (!cursor.is_done()) {
+        std::vector<char> results(buf_size*sizeof(aku_Sample));
+        size_t n_read = cursor.read_ex(results.data(), results.size());
+        size_t offset = 0;
+        while (offset < n_read) {
+            const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(results.data() + offset);
+            actual.push_back(sample->payload.float64);
+            offset += std::max(sample->payload.size, (u16)sizeof(aku_Sample));
+        }
+    }
+    BOOST_REQUIRE(!cursor.is_error());
+    cursor.close();
+
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(expected.begin(), expected.end(),
+                                    actual.begin(), actual.end());
+}
+
+void test_concurrent_cursor_error(int n_iter, int buf_size) {
+    auto inner = new CoroCursor();
+    auto generator = [n_iter, inner](Caller& caller) {
+        for (u32 i = 0u; i < (u32)n_iter; i++) {
+            aku_Sample r = {};
+            r.payload.float64 = i;
+            r.payload.type = AKU_PAYLOAD_FLOAT;
+            r.payload.size = sizeof(aku_Sample);
+            inner->put(caller, r);
+        }
+        inner->set_error(caller, AKU_EGENERAL);
+    };
+    inner->start(generator);
+    std::unique_ptr<ExternalCursor> pinner(inner);
+    ConcurrentCursor cursor(std::move(pinner));
+
+    size_t total = 0;
+    while (!cursor.is_done()) {
+        std::vector<char> results(buf_size*sizeof(aku_Sample));
+        size_t n_read = cursor.read_ex(results.data(), results.size());
+        total += n_read / sizeof(aku_Sample);
+    }
+    aku_Status status = AKU_SUCCESS;
+    BOOST_REQUIRE(cursor.is_error(&status));
+    BOOST_REQUIRE_EQUAL(status, AKU_EGENERAL);
+    cursor.close();
+
+    // Samples produced before the error should reach the consumer
+    BOOST_REQUIRE_EQUAL(total, (size_t)n_iter);
+}
+
+BOOST_AUTO_TEST_CASE(Test_concurrent_cursor_0_10)
+{
+    test_concurrent_cursor(0, 10);
+}
+
+BOOST_AUTO_TEST_CASE(Test_concurrent_cursor_100_7)
+{
+    test_concurrent_cursor(100, 7);
+}
+
+BOOST_AUTO_TEST_CASE(Test_concurrent_cursor_10000_100)
+{
+    // more data than the ring can hold at once
+    test_concurrent_cursor(10000, 100);
+}
+
+BOOST_AUTO_TEST_CASE(Test_concurrent_cursor_error_100_10)
+{
+    test_concurrent_cursor_error(100, 10);
+}
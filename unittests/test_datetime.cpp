@@ -29,6 +29,16 @@ BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_conversion) {
 
 }
 
+BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_same_second) {
+
+    // Consecutive timestamps inside one second hit the prefix cache
+    auto t0 = DateTimeUtil::from_iso_string("20060102T150405.000000001");
+    auto t1 = DateTimeUtil::from_iso_string("20060102T150405.999999999");
+    BOOST_REQUIRE_EQUAL(t1 - t0, 999999998ul);
+    auto t2 = DateTimeUtil::from_iso_string("20060102T150406.000000001");
+    BOOST_REQUIRE_EQUAL(t2 - t0, 1000000000ul);
+}
+
 BOOST_AUTO_TEST_CASE(Test_string_to_duration_seconds) {
 
     const char* test_case = "10s";
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <cstring>
+#include <random>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "fastdtoa.h"
+
+using namespace Akumuli;
+
+/** Every finite double should read back to the exact same value
+  * (that's what makes it a drop-in replacement for "%.17g").
+  */
+static void require_roundtrip(double value) {
+    char buffer[64];
+    int len = format_double(value, buffer, sizeof(buffer));
+    BOOST_REQUIRE_GT(len, 0);
+    BOOST_REQUIRE_EQUAL(len, (int)strlen(buffer));
+    double readback = strtod(buffer, nullptr);
+    BOOST_REQUIRE_MESSAGE(readback == value || (value != value && readback != readback),
+                          std::string("bad round-trip: ") + buffer);
+}
+
+BOOST_AUTO_TEST_CASE(Test_fastdtoa_simple_values) {
+    std::vector<std::pair<double, const char*>> expected = {
+        { 0.0,        "0" },
+        { 1.0,        "1" },
+        { -1.0,       "-1" },
+        { 3.1415,     "3.1415" },
+        { 0.001,      "0.001" },
+        { 100000.0,   "100000" },
+        { 1e22,       "1e+22" },
+        { 1.5e-25,    "1.5e-25" },
+    };
+    char buffer[64];
+    for (auto p: expected) {
+        int len = format_double(p.first, buffer, sizeof(buffer));
+        BOOST_REQUIRE_GT(len, 0);
+        BOOST_REQUIRE_EQUAL(std::string(buffer), std::string(p.second));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_fastdtoa_edge_cases) {
+    require_roundtrip(0.0);
+    require_roundtrip(-0.0);
+    require_roundtrip(std::numeric_limits<double>::max());
+    require_roundtrip(std::numeric_limits<double>::min());
+    require_roundtrip(std::numeric_limits<double>::denorm_min());
+    require_roundtrip(std::numeric_limits<double>::epsilon());
+    require_roundtrip(1.0/3.0);
+    require_roundtrip(5e-324);
+
+    // -0 sign should survive
+    char buffer[64];
+    format_double(-0.0, buffer, sizeof(buffer));
+    BOOST_REQUIRE_EQUAL(std::string(buffer), "-0");
+
+    // NaN and infinity are delegated to snprintf
+    int len = format_double(std::numeric_limits<double>::infinity(), buffer, sizeof(buffer));
+    BOOST_REQUIRE_GT(len, 0);
+    BOOST_REQUIRE_EQUAL(std::string(buffer), "inf");
+    len = format_double(std::numeric_limits<double>::quiet_NaN(), buffer, sizeof(buffer));
+    BOOST_REQUIRE_GT(len, 0);
+    BOOST_REQUIRE_EQUAL(std::string(buffer), "nan");
+
+    // Buffer too small
+    len = format_double(3.1415, buffer, 4);
+    BOOST_REQUIRE_EQUAL(len, -1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_fastdtoa_random_roundtrip) {
+    std::mt19937_64 gen(0x5A5A5A5A);
+    int n = 1000000;
+    while (n --> 0) {
+        uint64_t bits = gen();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value == std::numeric_limits<double>::infinity() ||
+            value == -std::numeric_limits<double>::infinity()) {
+            continue;
+        }
+        require_roundtrip(value);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_simple_values) {
+    auto check = [](const char* str, double expected) {
+        double value = 0;
+        int n = parse_double(str, &value);
+        BOOST_REQUIRE_EQUAL(n, (int)strlen(str));
+        BOOST_REQUIRE_MESSAGE(value == expected, std::string("bad value for ") + str);
+    };
+    check("0", 0.0);
+    check("24.3", 24.3);
+    check("-1.5", -1.5);
+    check("+100", 100.0);
+    check("0.00012207", 0.00012207);
+    check("1e10", 1e10);
+    check("2.5E-3", 2.5e-3);
+    // Mantissa doesn't fit 53 bits, goes through the strtod fallback
+    check("9007199254740993", 9007199254740993.0);
+    check("0.1234567890123456789012345", 0.1234567890123456789012345);
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_edge_cases) {
+    double value = 0;
+    BOOST_REQUIRE_EQUAL(parse_double("abc", &value), -1);
+    BOOST_REQUIRE_EQUAL(parse_double("12.5xyz", &value), 4);
+    BOOST_REQUIRE_EQUAL(value, 12.5);
+    // Dangling exponent is not part of the number
+    BOOST_REQUIRE_EQUAL(parse_double("10e", &value), 2);
+    BOOST_REQUIRE_EQUAL(value, 10.0);
+    BOOST_REQUIRE_EQUAL(parse_double("inf", &value), 3);
+    BOOST_REQUIRE(value == std::numeric_limits<double>::infinity());
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_random_roundtrip) {
+    std::mt19937_64 gen(0xA5A5A5A5);
+    char buffer[64];
+    int n = 1000000;
+    while (n --> 0) {
+        uint64_t bits = gen();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value == std::numeric_limits<double>::infinity() ||
+            value == -std::numeric_limits<double>::infinity()) {
+            continue;
+        }
+        int len = format_double(value, buffer, sizeof(buffer));
+        BOOST_REQUIRE_GT(len, 0);
+        double readback = 0;
+        BOOST_REQUIRE_EQUAL(parse_double(buffer, &readback), len);
+        BOOST_REQUIRE_MESSAGE(readback == value, std::string("bad round-trip: ") + buffer);
+    }
+}
@@ -57,3 +57,83 @@ BOOST_AUTO_TEST_CASE(Test_ingress_create) {
     std::shared_ptr<TreeRegistry> registry = std::make_shared<TreeRegistry>(std::move(meta));
     auto dispatcher = registry->create_dispatcher();
 }
+
+BOOST_AUTO_TEST_CASE(Test_ingress_write_order) {
+    auto meta = create_metadatastorage();
+    auto bstore = BlockStoreBuilder::create_memstore();
+    std::shared_ptr<TreeRegistry> registry = std::make_shared<TreeRegistry>(std::move(meta));
+    const char* sname = "cpu key=0";
+    aku_Sample sample;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    auto status = registry->init_series_id(sname, sname + strlen(sname), &sample);
+    BOOST_REQUIRE(status == AKU_SUCCESS);
+    auto id = sample.paramid;
+    std::unordered_map<aku_ParamId, std::vector<LogicAddr>> mapping;
+    mapping[id] = std::vector<LogicAddr>();
+    registry->open_trees(bstore, mapping);
+    {
+        auto dispatcher = registry->create_dispatcher();
+        // In-order samples go straight to the tree
+        for (aku_Timestamp ts: { 1000ul, 2000ul, 3000ul }) {
+            sample.timestamp = ts;
+            sample.payload.float64 = static_cast<double>(ts);
+            BOOST_REQUIRE(dispatcher->write(&sample) == AKU_SUCCESS);
+        }
+        // First out-of-order sample switches the series to the reorder
+        // buffer, later disorder within the lateness bound is absorbed
+        for (aku_Timestamp ts: { 2500ul, 3100ul, 3050ul, 3200ul }) {
+            sample.timestamp = ts;
+            sample.payload.float64 = static_cast<double>(ts);
+            dispatcher->write(&sample);
+        }
+        // Dispatcher flushes the reorder buffer on close
+    }
+    auto tree = registry->try_acquire(id);
+    BOOST_REQUIRE(tree);
+    auto it = tree->search(0ul, AKU_MAX_TIMESTAMP);
+    aku_Timestamp tss[0x10];
+    double xss[0x10];
+    size_t outsz;
+    std::tie(status, outsz) = it->read(tss, xss, 0x10);
+    std::vector<aku_Timestamp> expected = { 1000ul, 2000ul, 3000ul, 3050ul, 3100ul, 3200ul };
+    BOOST_REQUIRE_EQUAL(outsz, expected.size());
+    for (u32 i = 0; i < expected.size(); i++) {
+        BOOST_REQUIRE_EQUAL(tss[i], expected.at(i));
+        BOOST_REQUIRE_EQUAL(xss[i], static_cast<double>(expected.at(i)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_ingress_presence) {
+    auto meta = create_metadatastorage();
+    auto bstore = BlockStoreBuilder::create_memstore();
+    std::shared_ptr<TreeRegistry> registry = std::make_shared<TreeRegistry>(std::move(meta));
+    const char* sname = "cpu key=1";
+    aku_Sample sample;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    auto status = registry->init_series_id(sname, sname + strlen(sname), &sample);
+    BOOST_REQUIRE(status == AKU_SUCCESS);
+    auto id = sample.paramid;
+    std::unordered_map<aku_ParamId, std::vector<LogicAddr>> mapping;
+    mapping[id] = std::vector<LogicAddr>();
+    registry->open_trees(bstore, mapping);
+    const aku_Timestamp EPOCH = 1ull << SparsePresence::EPOCH_BITS;
+    const aku_Timestamp BASE  = 20*EPOCH;
+    {
+        auto dispatcher = registry->create_dispatcher();
+        // Two populated epochs with a gap in between
+        for (aku_Timestamp ts: { BASE, BASE + 1000, BASE + 10*EPOCH }) {
+            sample.timestamp = ts;
+            sample.payload.float64 = static_cast<double>(ts);
+            BOOST_REQUIRE(dispatcher->write(&sample) == AKU_SUCCESS);
+        }
+    }
+    BOOST_REQUIRE(registry->maybe_has_data(id, BASE, BASE + 1000));
+    BOOST_REQUIRE(registry->maybe_has_data(id, BASE + 10*EPOCH, BASE + 11*EPOCH));
+    BOOST_REQUIRE(registry->maybe_has_data(id, 0, AKU_MAX_TIMESTAMP));
+    // Gap between the populated epochs
+    BOOST_REQUIRE(!registry->maybe_has_data(id, BASE + 2*EPOCH, BASE + 8*EPOCH));
+    // Before the first write
+    BOOST_REQUIRE(!registry->maybe_has_data(id, 0, BASE - EPOCH));
+    // Unknown series
+    BOOST_REQUIRE(!registry->maybe_has_data(4242ul, 0, AKU_MAX_TIMESTAMP));
+}
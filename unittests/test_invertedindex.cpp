@@ -9,6 +9,7 @@
 #include <algorithm>
 
 #include "invertedindex.h"
+#include "hashfnfamily.h"
 
 using namespace Akumuli;
 
@@ -31,3 +32,181 @@ BOOST_AUTO_TEST_CASE(Test_inverted_index_0) {
         BOOST_REQUIRE_EQUAL(results.at(0).second, 1);
     }
 }
+
+BOOST_AUTO_TEST_CASE(Test_id_bitmap_0) {
+    IdBitmap bitmap;
+
+    // Out of order, with duplicates, spanning several containers
+    std::vector<aku_ParamId> ids = { 42, 1, 0x10001, 1, 0xFFFF, 0x20000, 42 };
+    for (auto id: ids) {
+        bitmap.add(id);
+    }
+
+    BOOST_REQUIRE_EQUAL(bitmap.cardinality(), 5u);
+    auto vec = bitmap.to_vector();
+    std::vector<aku_ParamId> expected = { 1, 42, 0xFFFF, 0x10001, 0x20000 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(vec.begin(), vec.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(Test_id_bitmap_intersect) {
+    IdBitmap even, third;
+
+    // Large enough to trigger array to bitset conversion
+    for (aku_ParamId id = 0; id < 100000; id++) {
+        if (id % 2 == 0) {
+            even.add(id);
+        }
+        if (id % 3 == 0) {
+            third.add(id);
+        }
+    }
+
+    auto merged = IdBitmap::intersect(even, third);
+    auto vec = merged.to_vector();
+    BOOST_REQUIRE_EQUAL(vec.size(), merged.cardinality());
+    aku_ParamId expected = 0;
+    for (auto id: vec) {
+        BOOST_REQUIRE_EQUAL(id, expected);
+        expected += 6;
+    }
+    BOOST_REQUIRE_EQUAL(vec.size(), 100000u/6 + 1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_id_bitmap_unite) {
+    IdBitmap lhs, rhs;
+
+    for (aku_ParamId id = 0; id < 1000; id++) {
+        lhs.add(id*2);      // even ids
+        rhs.add(id*2 + 1);  // odd ids
+    }
+
+    auto merged = IdBitmap::unite(lhs, rhs);
+    BOOST_REQUIRE_EQUAL(merged.cardinality(), 2000u);
+    auto vec = merged.to_vector();
+    for (aku_ParamId id = 0; id < 2000; id++) {
+        BOOST_REQUIRE_EQUAL(vec.at(id), id);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_index_0) {
+    TagValueIndex index;
+
+    auto add = [&index](aku_ParamId id, const char* name) {
+        index.append(id, name, name + strlen(name));
+    };
+    add(1, "cpu host=1 region=A");
+    add(2, "cpu host=2 region=A");
+    add(3, "cpu host=3 region=B");
+    add(4, "mem host=1 region=A");
+
+    // Single predicate
+    auto res = index.query({ "host=1" });
+    BOOST_REQUIRE_EQUAL(res.size(), 2u);
+    BOOST_REQUIRE_EQUAL(res.at(0), 1u);
+    BOOST_REQUIRE_EQUAL(res.at(1), 4u);
+
+    // Conjunction of predicates
+    res = index.query({ "region=A", "host=1" });
+    BOOST_REQUIRE_EQUAL(res.size(), 2u);
+    res = index.query({ "region=B", "host=3" });
+    BOOST_REQUIRE_EQUAL(res.size(), 1u);
+    BOOST_REQUIRE_EQUAL(res.at(0), 3u);
+    res = index.query({ "region=B", "host=1" });
+    BOOST_REQUIRE_EQUAL(res.size(), 0u);
+
+    // Unknown predicate
+    res = index.query({ "host=5" });
+    BOOST_REQUIRE_EQUAL(res.size(), 0u);
+
+    // Metric name is not indexed
+    res = index.query({ "cpu" });
+    BOOST_REQUIRE_EQUAL(res.size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_multiply_shift_hash_family) {
+    const u32 N = 4;
+    const u32 K = 1024;
+    MultiplyShiftHashFnFamily family(N, K);
+
+    std::vector<u64> keys;
+    std::mt19937_64 generator(0xF00D);
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(generator());
+    }
+    std::vector<u32> batch(keys.size());
+    for (u32 ix = 0; ix < N; ix++) {
+        // Batch version should agree with the scalar one
+        family.hash(static_cast<int>(ix), keys.data(), batch.data(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            BOOST_REQUIRE(batch.at(i) < K);
+            BOOST_REQUIRE_EQUAL(batch.at(i), family.hash(static_cast<int>(ix), keys.at(i)));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_two_univ_hash_family_batch) {
+    TwoUnivHashFnFamily family(3, 1024);
+
+    std::vector<u64> keys;
+    std::mt19937_64 generator(0xBEEF);
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(generator());
+    }
+    std::vector<u64> batch(keys.size());
+    for (int ix = 0; ix < 3; ix++) {
+        family.hash(ix, keys.data(), batch.data(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            BOOST_REQUIRE_EQUAL(batch.at(i), family.hash(ix, keys.at(i)));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_index_segment) {
+    const char* path = "/tmp/akumuli_test_tagix";
+
+    TagValueIndex index;
+    auto add = [&](aku_ParamId id, const char* name) {
+        index.append(id, name, name + strlen(name));
+    };
+    add(1, "cpu host=1 region=A");
+    add(2, "cpu host=2 region=A");
+    add(3, "cpu host=3 region=B");
+
+    // Round trip through the on-disk format
+    auto status = TagIndexSegment::write(path, index, nullptr);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    std::shared_ptr<TagIndexSegment> segment;
+    std::tie(status, segment) = TagIndexSegment::open(path);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(segment->header_->max_id, 3u);
+
+    auto res = segment->query({ "region=A" });
+    std::vector<aku_ParamId> expected = { 1, 2 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), expected.begin(), expected.end());
+    res = segment->query({ "region=A", "host=2" });
+    BOOST_REQUIRE_EQUAL(res.size(), 1u);
+    BOOST_REQUIRE_EQUAL(res.at(0), 2u);
+    res = segment->query({ "host=5" });
+    BOOST_REQUIRE_EQUAL(res.size(), 0u);
+
+    // LSM-style merge - the new segment folds in the previous one
+    TagValueIndex delta;
+    auto add2 = [&](aku_ParamId id, const char* name) {
+        delta.append(id, name, name + strlen(name));
+    };
+    add2(4, "cpu host=4 region=B");
+    status = TagIndexSegment::write(path, delta, segment);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    segment.reset();
+    std::tie(status, segment) = TagIndexSegment::open(path);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(segment->header_->max_id, 4u);
+    res = segment->query({ "region=B" });
+    expected = { 3, 4 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), expected.begin(), expected.end());
+    res = segment->query({ "region=A" });
+    expected = { 1, 2 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), expected.begin(), expected.end());
+
+    std::remove(path);
+}
@@ -115,6 +115,83 @@ BOOST_AUTO_TEST_CASE(Test_nbtree_rc_append_rand_read) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(Test_nbtree_large_leaf) {
+    // 64KB leaf should hold an order of magnitude more values than the 4KB
+    // one and should round-trip through the blockstore unchanged.
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    NBTreeLeaf small(42, EMPTY_ADDR, 0);
+    NBTreeLeaf large(42, EMPTY_ADDR, 0, AKU_NBTREE_MAX_LEAF_NBLOCKS);
+    u32 nsmall = 0, nlarge = 0;
+    while (small.append(nsmall, nsmall) == AKU_SUCCESS) {
+        nsmall++;
+    }
+    while (large.append(nlarge, nlarge) == AKU_SUCCESS) {
+        nlarge++;
+    }
+    BOOST_REQUIRE(nlarge > nsmall * 8);
+    aku_Status status;
+    LogicAddr addr;
+    std::tie(status, addr) = large.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    NBTreeLeaf clone(bstore, addr);
+    std::vector<aku_Timestamp> tss;
+    std::vector<double> xss;
+    status = clone.read_all(&tss, &xss);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(tss.size(), nlarge);
+    for (u32 i = 0; i < nlarge; i++) {
+        if (tss[i] != i) {
+            BOOST_FAIL("Invalid timestamp at " << i << ", expected: " << i << ", actual: " << tss[i]);
+        }
+        if (!same_value(xss[i], i)) {
+            BOOST_FAIL("Invalid value at " << i << ", expected: " << i << ", actual: " << xss[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_leaf_read_range) {
+    // Range read should return the same data as a full read trimmed to
+    // the range, for both directions.
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    NBTreeLeaf leaf(42, EMPTY_ADDR, 0);
+    u32 nleaf = 0;
+    while (leaf.append(10 + nleaf, nleaf) == AKU_SUCCESS) {
+        nleaf++;
+    }
+    aku_Status status;
+    LogicAddr addr;
+    std::tie(status, addr) = leaf.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    NBTreeLeaf clone(bstore, addr);
+    auto check = [&](aku_Timestamp begin, aku_Timestamp end, u32 first, u32 size) {
+        std::vector<aku_Timestamp> tss;
+        std::vector<double> xss;
+        status = clone.read_range(begin, end, &tss, &xss);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(tss.size(), size);
+        for (u32 i = 0; i < size; i++) {
+            if (tss[i] != first + i) {
+                BOOST_FAIL("Invalid timestamp at " << i << ", expected: " << (first + i)
+                           << ", actual: " << tss[i]);
+            }
+            if (!same_value(xss[i], first + i - 10)) {
+                BOOST_FAIL("Invalid value at " << i << ", expected: " << (first + i - 10)
+                           << ", actual: " << xss[i]);
+            }
+        }
+    };
+    // FWD - [begin, end)
+    check(100, 200, 100, 100);
+    // FWD range clipped by the leaf boundaries
+    check(0, 10 + nleaf + 100, 10, nleaf);
+    // BWD - (end, begin], ascending output
+    check(199, 99, 100, 100);
+    // Empty range
+    check(100, 100, 0, 0);
+    // Range that doesn't intersect the leaf
+    check(10 + nleaf, 10 + nleaf + 100, 0, 0);
+}
+
 void test_nbtree_chunked_read(u32 N, u32 begin, u32 end, u32 chunk_size) {
     ScanDir dir = begin < end ? ScanDir::FWD : ScanDir::BWD;
     std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
@@ -191,6 +268,226 @@ BOOST_AUTO_TEST_CASE(Test_nbtree_chunked_read) {
     }
 }
 
+//! Parallel scan should produce exactly the same output as the sequential one.
+void test_nbtree_parallel_scan(u32 N, u32 begin, u32 end) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;  // should be empty at first
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+
+    for (u32 i = 0; i < N; i++) {
+        collection->append(i, i);
+    }
+
+    std::unique_ptr<NBTreeIterator> seq = collection->search(begin, end);
+    std::unique_ptr<NBTreeIterator> par = collection->psearch(begin, end);
+
+    BOOST_REQUIRE(seq->get_direction() == par->get_direction());
+
+    size_t outsz = begin < end ? end - begin : begin - end;
+    std::vector<aku_Timestamp> seq_ts(outsz, 0), par_ts(outsz, 0);
+    std::vector<double> seq_xs(outsz, 0), par_xs(outsz, 0);
+    aku_Status seq_status, par_status;
+    size_t seq_sz, par_sz;
+    std::tie(seq_status, seq_sz) = seq->read(seq_ts.data(), seq_xs.data(), outsz);
+    std::tie(par_status, par_sz) = par->read(par_ts.data(), par_xs.data(), outsz);
+
+    BOOST_REQUIRE_EQUAL(seq_status, par_status);
+    BOOST_REQUIRE_EQUAL(seq_sz, par_sz);
+    for (u32 i = 0; i < seq_sz; i++) {
+        if (seq_ts[i] != par_ts[i]) {
+            BOOST_FAIL("Invalid timestamp at " << i << ", expected: " << seq_ts[i] << ", actual: " << par_ts[i]);
+        }
+        if (!same_value(seq_xs[i], par_xs[i])) {
+            BOOST_FAIL("Invalid value at " << i << ", expected: " << seq_xs[i] << ", actual: " << par_xs[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_parallel_scan) {
+    test_nbtree_parallel_scan(100, 0, 100);
+    test_nbtree_parallel_scan(200000, 0, 200000);
+    test_nbtree_parallel_scan(200000, 199999, 0);
+    test_nbtree_parallel_scan(200000, 1000, 150000);
+    test_nbtree_parallel_scan(200000, 150000, 1000);
+}
+
+//! Shared scans should produce the same results as independent scans.
+void test_nbtree_shared_scan(u32 N, u32 begin, u32 end) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;  // should be empty at first
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+
+    for (u32 i = 0; i < N; i++) {
+        collection->append(i, i);
+    }
+
+    std::unique_ptr<NBTreeIterator> seq = collection->search(begin, end);
+    // Both iterators should attach to the same decode stream
+    std::unique_ptr<NBTreeIterator> fst = collection->search_shared(begin, end);
+    std::unique_ptr<NBTreeIterator> snd = collection->search_shared(begin, end);
+
+    BOOST_REQUIRE(seq->get_direction() == fst->get_direction());
+    BOOST_REQUIRE(seq->get_direction() == snd->get_direction());
+
+    size_t outsz = begin < end ? end - begin : begin - end;
+    std::vector<aku_Timestamp> seq_ts(outsz, 0);
+    std::vector<double> seq_xs(outsz, 0);
+    aku_Status seq_status;
+    size_t seq_sz;
+    std::tie(seq_status, seq_sz) = seq->read(seq_ts.data(), seq_xs.data(), outsz);
+
+    // Read the shared iterators interleaved with different request sizes so
+    // one of them is always lagging behind the head of the stream
+    std::vector<aku_Timestamp> fst_ts, snd_ts;
+    std::vector<double> fst_xs, snd_xs;
+    auto read_some = [](NBTreeIterator* it, size_t chunk,
+                        std::vector<aku_Timestamp>* tss, std::vector<double>* xss) {
+        std::vector<aku_Timestamp> ts(chunk, 0);
+        std::vector<double> xs(chunk, 0);
+        aku_Status status;
+        size_t sz;
+        std::tie(status, sz) = it->read(ts.data(), xs.data(), chunk);
+        std::copy(ts.begin(), ts.begin() + sz, std::back_inserter(*tss));
+        std::copy(xs.begin(), xs.begin() + sz, std::back_inserter(*xss));
+        return status;
+    };
+    aku_Status fst_status = AKU_SUCCESS, snd_status = AKU_SUCCESS;
+    while (fst_status == AKU_SUCCESS || snd_status == AKU_SUCCESS) {
+        if (fst_status == AKU_SUCCESS) {
+            fst_status = read_some(fst.get(), 1000, &fst_ts, &fst_xs);
+        }
+        if (snd_status == AKU_SUCCESS) {
+            snd_status = read_some(snd.get(), 3333, &snd_ts, &snd_xs);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(fst_status, AKU_ENO_DATA);
+    BOOST_REQUIRE_EQUAL(snd_status, AKU_ENO_DATA);
+
+    BOOST_REQUIRE_EQUAL(seq_sz, fst_ts.size());
+    BOOST_REQUIRE_EQUAL(seq_sz, snd_ts.size());
+    for (u32 i = 0; i < seq_sz; i++) {
+        if (seq_ts[i] != fst_ts[i] || seq_ts[i] != snd_ts[i]) {
+            BOOST_FAIL("Invalid timestamp at " << i << ", expected: " << seq_ts[i]
+                       << ", actual: " << fst_ts[i] << "/" << snd_ts[i]);
+        }
+        if (!same_value(seq_xs[i], fst_xs[i]) || !same_value(seq_xs[i], snd_xs[i])) {
+            BOOST_FAIL("Invalid value at " << i << ", expected: " << seq_xs[i]
+                       << ", actual: " << fst_xs[i] << "/" << snd_xs[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_shared_scan) {
+    test_nbtree_shared_scan(100, 0, 100);
+    test_nbtree_shared_scan(200000, 0, 200000);
+    test_nbtree_shared_scan(200000, 199999, 0);
+    test_nbtree_shared_scan(200000, 1000, 150000);
+    test_nbtree_shared_scan(200000, 150000, 1000);
+}
+
+void test_nbtree_chunk_scan(u32 N, u32 begin, u32 end) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;  // should be empty at first
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+
+    for (u32 i = 0; i < N; i++) {
+        collection->append(i, i);
+    }
+
+    std::unique_ptr<NBTreeIterator> seq = collection->search(begin, end);
+    std::unique_ptr<NBTreeChunkIterator> chu = collection->csearch(begin, end);
+
+    BOOST_REQUIRE(seq->get_direction() == chu->get_direction());
+
+    size_t outsz = begin < end ? end - begin : begin - end;
+    std::vector<aku_Timestamp> seq_ts(outsz, 0), chu_ts;
+    std::vector<double> seq_xs(outsz, 0), chu_xs;
+    aku_Status seq_status, chu_status;
+    size_t seq_sz;
+    std::tie(seq_status, seq_sz) = seq->read(seq_ts.data(), seq_xs.data(), outsz);
+
+    while (true) {
+        NBTreeDecodedChunk chunk;
+        std::tie(chu_status, chunk) = chu->read_chunk();
+        if (chu_status != AKU_SUCCESS) {
+            break;
+        }
+        BOOST_REQUIRE(chunk.size != 0);
+        std::copy(chunk.tss, chunk.tss + chunk.size, std::back_inserter(chu_ts));
+        std::copy(chunk.xss, chunk.xss + chunk.size, std::back_inserter(chu_xs));
+    }
+    BOOST_REQUIRE_EQUAL(chu_status, AKU_ENO_DATA);
+    BOOST_REQUIRE_EQUAL(seq_sz, chu_ts.size());
+    for (u32 i = 0; i < seq_sz; i++) {
+        if (seq_ts[i] != chu_ts[i]) {
+            BOOST_FAIL("Invalid timestamp at " << i << ", expected: " << seq_ts[i] << ", actual: " << chu_ts[i]);
+        }
+        if (!same_value(seq_xs[i], chu_xs[i])) {
+            BOOST_FAIL("Invalid value at " << i << ", expected: " << seq_xs[i] << ", actual: " << chu_xs[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_chunk_scan) {
+    test_nbtree_chunk_scan(100, 0, 100);
+    test_nbtree_chunk_scan(200000, 0, 200000);
+    test_nbtree_chunk_scan(200000, 199999, 0);
+    test_nbtree_chunk_scan(200000, 1000, 150000);
+    test_nbtree_chunk_scan(200000, 150000, 1000);
+}
+
+//! Aggregation pushdown should produce the same results as full scan + fold.
+void test_nbtree_aggregation(u32 N, u32 begin, u32 end) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;  // should be empty at first
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+
+    for (u32 i = 0; i < N; i++) {
+        // Negative values to catch bad min/max initialization
+        collection->append(i, static_cast<double>(i) - static_cast<double>(N) / 2.0);
+    }
+
+    // Reference - full scan
+    std::unique_ptr<NBTreeIterator> it = collection->search(begin, end);
+    std::vector<aku_Timestamp> ts(N, 0);
+    std::vector<double> xs(N, 0);
+    aku_Status status;
+    size_t sz;
+    std::tie(status, sz) = it->read(ts.data(), xs.data(), N);
+    BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+
+    NBTreeAggregationResult actual;
+    std::tie(status, actual) = collection->aggregate(begin, end);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    BOOST_REQUIRE_EQUAL(actual.count, sz);
+    if (sz != 0) {
+        double expected_sum = 0, expected_min = xs.front(), expected_max = xs.front();
+        for (size_t i = 0; i < sz; i++) {
+            expected_sum += xs[i];
+            expected_min = std::min(expected_min, xs[i]);
+            expected_max = std::max(expected_max, xs[i]);
+        }
+        BOOST_REQUIRE_CLOSE(actual.sum, expected_sum, 1e-9);
+        BOOST_REQUIRE_EQUAL(actual.min, expected_min);
+        BOOST_REQUIRE_EQUAL(actual.max, expected_max);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_aggregation) {
+    test_nbtree_aggregation(100, 0, 100);
+    test_nbtree_aggregation(200000, 0, 200000);
+    test_nbtree_aggregation(200000, 1000, 150000);
+    test_nbtree_aggregation(200000, 199999, 200000);
+    test_nbtree_aggregation(200000, 100000, 100000);  // empty range
+    for (int i = 0; i < 10; i++) {
+        auto N = 200000u;
+        auto from = static_cast<u32>(rand()) % N;
+        auto to = from + static_cast<u32>(rand()) % (N - from);
+        test_nbtree_aggregation(N, from, to);
+    }
+}
+
 void check_tree_consistency(std::shared_ptr<BlockStore> bstore, size_t level, NBTreeExtent const* extent) {
     NBTreeExtent::check_extent(extent, bstore, level);
 }
@@ -281,6 +578,49 @@ BOOST_AUTO_TEST_CASE(Test_nbtree_reopen_6) {
     test_reopen_storage(32*32, -1);
 }
 
+void test_reopen_storage_parallel(u32 Ntrees, u32 Nitems) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<std::vector<LogicAddr>> addrlists;
+    for (u32 id = 0; id < Ntrees; id++) {
+        std::vector<LogicAddr> addrlist;
+        auto collection = std::make_shared<NBTreeExtentsList>(id, addrlist, bstore);
+        for (u32 i = 0; i < Nitems; i++) {
+            collection->append(i, i + id);
+        }
+        addrlists.push_back(collection->close());
+    }
+
+    std::vector<std::shared_ptr<NBTreeExtentsList>> trees;
+    for (u32 id = 0; id < Ntrees; id++) {
+        trees.push_back(std::make_shared<NBTreeExtentsList>(id, addrlists.at(id), bstore));
+    }
+
+    NBTreeExtentsList::force_init_all(trees);
+
+    for (u32 id = 0; id < Ntrees; id++) {
+        std::unique_ptr<NBTreeIterator> it = trees.at(id)->search(0, Nitems);
+        std::vector<aku_Timestamp> ts(Nitems, 0);
+        std::vector<double> xs(Nitems, 0);
+        aku_Status status = AKU_SUCCESS;
+        size_t sz = 0;
+        std::tie(status, sz) = it->read(ts.data(), xs.data(), Nitems);
+        BOOST_REQUIRE(sz == Nitems);
+        BOOST_REQUIRE(status == AKU_SUCCESS);
+        for (u32 i = 0; i < Nitems; i++) {
+            if (ts[i] != i) {
+                BOOST_FAIL("Invalid timestamp at " << i << " in tree " << id);
+            }
+            if (!same_value(xs[i], static_cast<double>(i + id))) {
+                BOOST_FAIL("Invalid value at " << i << " in tree " << id);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reopen_parallel) {
+    test_reopen_storage_parallel(32, 10000);
+}
+
 //! Reopen storage that has been closed without final commit.
 void test_storage_recovery_status(u32 N, u32 N_values) {
     LogicAddr last_block = EMPTY_ADDR;
@@ -442,3 +782,108 @@ BOOST_AUTO_TEST_CASE(Test_nbtree_recovery_5) {
 BOOST_AUTO_TEST_CASE(Test_nbtree_recovery_6) {
     test_storage_recovery(33*33, ~0u);
 }
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_compact) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;
+    aku_Timestamp ts = 0;
+    // Reopen the tree many times leaving a trail of under-filled leaves
+    for (int i = 0; i < 100; i++) {
+        auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+        collection->force_init();
+        for (int j = 0; j < 10; j++) {
+            collection->append(ts, ts);
+            ts++;
+        }
+        addrlist = collection->close();
+    }
+    auto source = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    auto before = source->get_fragmentation();
+    BOOST_REQUIRE(before.nleaves >= 100);
+    BOOST_REQUIRE(before.nfragmented * 2 > before.nleaves);
+
+    aku_Status status;
+    std::vector<LogicAddr> newlist;
+    std::tie(status, newlist) = NBTreeExtentsList::compact(bstore, 42, addrlist, 0);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    auto compacted = std::make_shared<NBTreeExtentsList>(42, newlist, bstore);
+    auto after = compacted->get_fragmentation();
+    BOOST_REQUIRE(after.nleaves * 10 < before.nleaves);
+
+    // All the data should survive the rewrite
+    auto it = compacted->search(0, AKU_MAX_TIMESTAMP);
+    std::vector<aku_Timestamp> tss(0x2000, 0);
+    std::vector<double> xss(0x2000, 0);
+    size_t sz;
+    aku_Timestamp expected = 0;
+    while (true) {
+        std::tie(status, sz) = it->read(tss.data(), xss.data(), tss.size());
+        BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+        for (size_t i = 0; i < sz; i++) {
+            if (tss.at(i) != expected) {
+                BOOST_FAIL("Invalid timestamp, expected: " << expected << ", actual: " << tss.at(i));
+            }
+            if (!same_value(xss.at(i), static_cast<double>(expected))) {
+                BOOST_FAIL("Invalid value at " << expected << ", actual: " << xss.at(i));
+            }
+            expected++;
+        }
+        if (status == AKU_ENO_DATA || sz == 0) {
+            break;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(expected, ts);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_bulk_load) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    const size_t N = 100000;
+    std::vector<aku_Timestamp> tss(N);
+    std::vector<double> xss(N);
+    for (size_t i = 0; i < N; i++) {
+        tss.at(i) = i;
+        xss.at(i) = i*0.1;
+    }
+    aku_Status status;
+    std::vector<LogicAddr> addrlist;
+    std::tie(status, addrlist) = NBTreeExtentsList::bulk_load(bstore, 42, tss.data(), xss.data(), N);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    // The tree should be complete, no repair needed on open
+    BOOST_REQUIRE(NBTreeExtentsList::repair_status(addrlist) == NBTreeExtentsList::RepairStatus::OK);
+
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    auto it = collection->search(0, AKU_MAX_TIMESTAMP);
+    std::vector<aku_Timestamp> actts(0x2000, 0);
+    std::vector<double> actxs(0x2000, 0);
+    size_t sz;
+    size_t expected = 0;
+    while (true) {
+        std::tie(status, sz) = it->read(actts.data(), actxs.data(), actts.size());
+        BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+        for (size_t i = 0; i < sz; i++) {
+            if (actts.at(i) != expected) {
+                BOOST_FAIL("Invalid timestamp, expected: " << expected << ", actual: " << actts.at(i));
+            }
+            if (!same_value(actxs.at(i), expected*0.1)) {
+                BOOST_FAIL("Invalid value at " << expected << ", actual: " << actxs.at(i));
+            }
+            expected++;
+        }
+        if (status == AKU_ENO_DATA || sz == 0) {
+            break;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(expected, N);
+
+    // Aggregates in the inner nodes should be consistent with the data
+    NBTreeAggregationResult aggres;
+    std::tie(status, aggres) = collection->aggregate(0, AKU_MAX_TIMESTAMP);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(aggres.count, N);
+
+    // Unsorted input should be rejected
+    std::swap(tss.at(0), tss.at(1));
+    std::tie(status, addrlist) = NBTreeExtentsList::bulk_load(bstore, 43, tss.data(), xss.data(), N);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_ARG);
+}
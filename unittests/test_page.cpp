@@ -9,6 +9,7 @@
 #include <iostream>
 
 #include "akumuli_def.h"
+#include "blob_compression.h"
 #include "cursor.h"
 #include "page.h"
 
@@ -163,6 +164,10 @@ BOOST_AUTO_TEST_CASE(TestPaging2) {
     auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
     auto free_space_before = page->get_free_space();
     char buffer[128];
+    // Incompressible payload (no repeated substrings) is stored as is
+    for (int i = 0; i < 128; i++) {
+        buffer[i] = static_cast<char>(i*7);
+    }
     aku_MemRange range = {buffer, 128};
     auto result = page->add_entry(1, 2, range);
     BOOST_CHECK_EQUAL(result, AKU_SUCCESS);
@@ -223,6 +228,49 @@ BOOST_AUTO_TEST_CASE(TestPaging6)
     BOOST_CHECK_EQUAL(entry->param_id, 3333);
 }
 
+BOOST_AUTO_TEST_CASE(Test_page_blob_dict_compression)
+{
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x10000);
+    // Use unique page id - the dictionary is cached per page id
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 113, 1);
+    std::vector<std::string> payloads;
+    for (int i = 0; i < 10; i++) {
+        payloads.push_back("deploy marker: service=frontend version=1.2." +
+                           std::to_string(i) + " host=web-" + std::to_string(i));
+    }
+    auto free_space_before = page->get_free_space();
+    size_t raw_usage = 0;
+    for (u32 i = 0; i < payloads.size(); i++) {
+        aku_MemRange range = {(void*)payloads.at(i).data(), (u32)payloads.at(i).size()};
+        auto status = page->add_entry(24, i + 1, range);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        raw_usage += sizeof(aku_Entry) + payloads.at(i).size() + sizeof(aku_EntryIndexRecord);
+    }
+    // Repetitive payloads should pack against the page dictionary
+    auto used = free_space_before - page->get_free_space();
+    BOOST_REQUIRE(used < raw_usage);
+
+    auto check_round_trip = [&]() {
+        char out_buffer[0x1000];
+        for (u32 i = 0; i < payloads.size(); i++) {
+            BOOST_REQUIRE_EQUAL(page->get_entry_length_at(i), payloads.at(i).size());
+            aku_Entry* entry = reinterpret_cast<aku_Entry*>(out_buffer);
+            entry->length = 0x1000 - sizeof(aku_Entry);
+            int len = page->copy_entry_at(i, entry);
+            BOOST_REQUIRE_EQUAL(len, payloads.at(i).size());
+            BOOST_REQUIRE_EQUAL(entry->param_id, 24);
+            BOOST_REQUIRE(memcmp(entry->value, payloads.at(i).data(), payloads.at(i).size()) == 0);
+        }
+    };
+    check_round_trip();
+
+    // Drop the cached dictionary - the next read has to rebuild it from
+    // the page content (the page-mapped-from-disk case)
+    BlobDictCache::instance().remove(page->get_page_id());
+    check_round_trip();
+}
+
 BOOST_AUTO_TEST_CASE(TestPaging7)
 {
     std::vector<char> page_mem;
@@ -355,3 +403,60 @@ BOOST_AUTO_TEST_CASE(Test_Compression_backward_0) {
 BOOST_AUTO_TEST_CASE(Test_Compression_backward_1) {
     generic_compression_test(1u, 0ul, AKU_CURSOR_DIR_BACKWARD, 100);
 }
+
+BOOST_AUTO_TEST_CASE(Test_adaptive_search_profile) {
+    // Reset global stats and search profiles
+    aku_SearchStats sstats;
+    PageHeader::get_search_stats(&sstats, true);
+
+    std::vector<char> page_mem;
+    page_mem.resize(sizeof(PageHeader) + 0x10000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+
+    // Highly irregular timestamps - long flat runs with huge jumps
+    // in-between defeat interpolation search
+    const aku_ParamId PARAM_ID = 1u;
+    UncompressedChunk header;
+    std::vector<aku_Timestamp> timestamps;
+    aku_Timestamp ts = 0ul;
+    for (int i = 1; true; i++) {
+        ts += (i % 37 == 0) ? 1000000ul : 1ul;
+        header.values.push_back(static_cast<double>(i));
+        header.paramids.push_back(PARAM_ID);
+        header.timestamps.push_back(ts);
+        char buffer[50];
+        aku_MemRange range = {buffer, sizeof(buffer)};
+        u32 offset = 0u;
+        auto status = page->add_chunk(range, header.paramids.size() * 33, &offset);
+        if (status != AKU_SUCCESS) {
+            break;
+        }
+        if (i % 10 == 0) {
+            status = page->complete_chunk(header);
+            if (status != AKU_SUCCESS) {
+                break;
+            }
+            std::copy(header.timestamps.begin(), header.timestamps.end(),
+                      std::back_inserter(timestamps));
+            header = UncompressedChunk();
+        }
+    }
+    BOOST_REQUIRE_NE(timestamps.size(), 0ul);
+
+    for (int i = 0; i < 100; i++) {
+        auto ix = std::rand() % (timestamps.size() - 2);
+        auto recorder = std::make_shared<Recorder>(PARAM_ID);
+        auto qproc = make_proc(recorder, timestamps.at(ix), timestamps.at(ix + 1),
+                               AKU_CURSOR_DIR_FORWARD);
+        page->search(qproc);
+        BOOST_REQUIRE_EQUAL(recorder->cursor.error_code, (int)RecordingCursor::NO_ERROR);
+        BOOST_REQUIRE_NE(recorder->cursor.results.size(), 0ul);
+    }
+
+    PageHeader::get_search_stats(&sstats, false);
+    BOOST_REQUIRE_GE(sstats.adaptive.n_pages_tracked, 1ull);
+    // Interpolation should be degraded on this page by now and most of
+    // the searches should have skipped it
+    BOOST_REQUIRE_GE(sstats.adaptive.n_pages_degraded, 1ull);
+    BOOST_REQUIRE_GE(sstats.adaptive.n_interpolation_skips, 1ull);
+}
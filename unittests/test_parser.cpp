@@ -7,6 +7,7 @@
 #include "seriesparser.h"
 #include "queryprocessor_framework.h"
 #include "datetime.h"
+#include <thread>
 #include <tuple>
 
 using namespace Akumuli;
@@ -61,6 +62,31 @@ BOOST_AUTO_TEST_CASE(Test_stringpool_0) {
     BOOST_REQUIRE_EQUAL(std::string(result_bar.first, result_bar.first + result_bar.second), bar);
 }
 
+BOOST_AUTO_TEST_CASE(Test_stringpool_concurrent_add) {
+
+    StringPool pool;
+    const int NTHREADS = 4;
+    const int NITERS = 1000;
+    auto writer = [&pool](int tix) {
+        for (int i = 0; i < NITERS; i++) {
+            std::string name = "thread" + std::to_string(tix) + "_series" + std::to_string(i);
+            auto result = pool.add(name.data(), name.data() + name.size(), 0ul);
+            BOOST_REQUIRE_EQUAL(result.second, (int)name.size());
+            BOOST_REQUIRE_EQUAL(std::string(result.first, result.first + result.second), name);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int tix = 0; tix < NTHREADS; tix++) {
+        threads.emplace_back(writer, tix);
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    BOOST_REQUIRE_EQUAL(pool.size(), NTHREADS*NITERS);
+    auto results = pool.regex_match("thread\\d_series\\d+");
+    BOOST_REQUIRE_EQUAL(results.size(), NTHREADS*NITERS);
+}
+
 BOOST_AUTO_TEST_CASE(Test_seriesmatcher_0) {
 
     SeriesMatcher matcher(1ul);
@@ -80,6 +106,128 @@ BOOST_AUTO_TEST_CASE(Test_seriesmatcher_0) {
     BOOST_REQUIRE_EQUAL(buz_id, 0ul);
 }
 
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_growth) {
+
+    // Should trigger hash-table growth (initial table has 0x1000 slots)
+    SeriesMatcher matcher(1ul);
+    const int NSERIES = 5000;
+    for (int i = 0; i < NSERIES; i++) {
+        std::string name = "cpu host=" + std::to_string(i);
+        auto id = matcher.add(name.data(), name.data() + name.size());
+        BOOST_REQUIRE_EQUAL(id, (u64)(i + 1));
+    }
+    for (int i = 0; i < NSERIES; i++) {
+        std::string name = "cpu host=" + std::to_string(i);
+        auto id = matcher.match(name.data(), name.data() + name.size());
+        BOOST_REQUIRE_EQUAL(id, (u64)(i + 1));
+        auto str = matcher.id2str(id);
+        BOOST_REQUIRE_EQUAL(std::string(str.first, str.first + str.second), name);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_cardinality) {
+
+    SeriesMatcher matcher(1ul);
+    const int NSERIES = 5000;
+    for (int i = 0; i < NSERIES; i++) {
+        std::string name = "cpu host=" + std::to_string(i) + " region=" + std::to_string(i % 3);
+        matcher.add(name.data(), name.data() + name.size());
+    }
+
+    auto estimates = matcher.get_cardinality();
+    std::map<std::string, double> counts(estimates.begin(), estimates.end());
+    BOOST_REQUIRE_EQUAL(counts.size(), 3);
+    // Low counts are exact (linear counting), the large one is an estimate
+    BOOST_REQUIRE_CLOSE(counts.at("metric"), 1.0, 1.0);
+    BOOST_REQUIRE_CLOSE(counts.at("region"), 3.0, 1.0);
+    BOOST_REQUIRE_CLOSE(counts.at("host"), (double)NSERIES, 5.0);
+
+    // Re-adding existing series shouldn't change the estimates
+    std::string name = "cpu host=0 region=0";
+    matcher.add(name.data(), name.data() + name.size());
+    auto again = matcher.get_cardinality();
+    BOOST_REQUIRE(again == estimates);
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_concurrent_add) {
+
+    SeriesMatcher matcher(1ul);
+    const int NTHREADS = 4;
+    const int NSERIES = 4000;
+    std::vector<std::string> series;
+    for (int i = 0; i < NSERIES; i++) {
+        series.push_back("mem host=" + std::to_string(i));
+    }
+    // All threads add the same series, `add` should be idempotent
+    std::vector<std::vector<u64>> ids(NTHREADS);
+    std::vector<std::thread> threads;
+    for (int tix = 0; tix < NTHREADS; tix++) {
+        threads.emplace_back([&series, &ids, &matcher, tix]() {
+            for (auto const& name: series) {
+                u64 id = matcher.match(name.data(), name.data() + name.size());
+                if (id == 0) {
+                    id = matcher.add(name.data(), name.data() + name.size());
+                }
+                ids[tix].push_back(id);
+            }
+        });
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    for (int i = 0; i < NSERIES; i++) {
+        auto id = matcher.match(series[i].data(), series[i].data() + series[i].size());
+        BOOST_REQUIRE(id != 0);
+        for (int tix = 0; tix < NTHREADS; tix++) {
+            BOOST_REQUIRE_EQUAL(ids[tix][i], id);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_add_batch) {
+
+    SeriesMatcher matcher(1ul);
+    const char* foo = "foobar";
+    matcher.add(foo, foo+6);
+
+    // Mix of known and new series
+    std::vector<std::string> series = { "barfoobar", "foobar", "buz" };
+    std::vector<SeriesMatcher::StringT> batch;
+    for (auto const& name: series) {
+        batch.push_back(std::make_pair(name.data(), static_cast<int>(name.size())));
+    }
+    std::vector<u64> ids;
+    matcher.add_batch(batch, &ids);
+
+    BOOST_REQUIRE_EQUAL(ids.size(), series.size());
+    BOOST_REQUIRE_EQUAL(ids[0], 2ul);  // new
+    BOOST_REQUIRE_EQUAL(ids[1], 1ul);  // already known
+    BOOST_REQUIRE_EQUAL(ids[2], 3ul);  // new
+
+    // Batch results should be visible through the regular lookup
+    for (auto i = 0u; i < series.size(); i++) {
+        auto id = matcher.match(series[i].data(), series[i].data() + series[i].size());
+        BOOST_REQUIRE_EQUAL(id, ids[i]);
+        auto str = matcher.id2str(id);
+        BOOST_REQUIRE_EQUAL(std::string(str.first, str.first + str.second), series[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_raw_cache) {
+
+    // Matcher can be used as a cache from raw (un-normalized) series
+    // names to ids - keys are matched byte for byte.
+    SeriesMatcher cache(1ul);
+    const char* raw = "  cpu  host=1  region=A ";
+    cache._add(raw, 42ul);
+    auto id = cache.match(raw, raw + strlen(raw));
+    BOOST_REQUIRE_EQUAL(id, 42ul);
+    // Different formatting of the same series is a cache miss
+    const char* other = "cpu host=1 region=A";
+    id = cache.match(other, other + strlen(other));
+    BOOST_REQUIRE_EQUAL(id, 0ul);
+}
+
 BOOST_AUTO_TEST_CASE(Test_seriesmatcher_1) {
 
     StringPool spool;
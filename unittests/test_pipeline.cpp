@@ -11,8 +11,9 @@
 using namespace Akumuli;
 
 struct ConnectionMock : DbConnection {
-    int cntp;
-    int cntt;
+    // Writes come from several writer threads
+    std::atomic<int> cntp;
+    std::atomic<int> cntt;
     aku_Status write(const aku_Sample &sample) {
         if (sample.timestamp == 1) {
             cntt += 1;
@@ -23,6 +24,15 @@ struct ConnectionMock : DbConnection {
         return AKU_SUCCESS;
     }
 
+    u64 get_write_sequence() {
+        return cntt;
+    }
+
+    u64 get_durability_watermark() {
+        // Everything is durable right away
+        return cntt;
+    }
+
     void close() {
     }
 
@@ -60,6 +70,89 @@ BOOST_AUTO_TEST_CASE(Test_spout_in_single_thread) {
             spout->write(sample);
         }
         pipeline->stop();
-        BOOST_REQUIRE_EQUAL(con->cntt, sumt);
-        BOOST_REQUIRE_EQUAL(con->cntp, sump);
+        BOOST_REQUIRE_EQUAL(con->cntt.load(), sumt);
+        BOOST_REQUIRE_EQUAL(con->cntp.load(), sump);
+}
+
+struct SlowConnectionMock : DbConnection {
+    // Simulates a storage that can't keep up with the producers
+    std::atomic<int> cnt;
+    aku_Status write(const aku_Sample &sample) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        cnt += 1;
+        return AKU_SUCCESS;
+    }
+
+    u64 get_write_sequence() {
+        return cnt;
+    }
+
+    u64 get_durability_watermark() {
+        return cnt;
+    }
+
+    void close() {
+    }
+
+    std::string get_all_stats() {
+        throw "not impelemnted";
+    }
+
+    std::shared_ptr<DbCursor> search(std::string query) {
+        throw "not implemented";
+    }
+
+    int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
+        throw "not implemented";
+    }
+
+    aku_Status series_to_param_id(const char *name, size_t size, aku_Sample *sample) {
+        throw "not implemented";
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_spout_low_priority_sheds_on_overload) {
+
+        // Low priority spout should drop samples instead of stalling when
+        // the writers can't keep up
+        std::shared_ptr<SlowConnectionMock> con = std::make_shared<SlowConnectionMock>();
+        con->cnt = 0;
+        auto pipeline = std::make_shared<IngestionPipeline>(con, AKU_THROTTLE);
+        pipeline->start();
+        auto spout = pipeline->make_spout(AKU_PRIORITY_LOW);
+        const int NSAMPLES = PipelineSpout::POOL_SIZE * 4;
+        for (int i = 0; i < NSAMPLES; i++) {
+            aku_Sample sample = { 1ul, (aku_ParamId)i };
+            spout->write(sample);
+        }
+        u64 shed = spout->get_shed_count();
+        pipeline->stop();
+        BOOST_REQUIRE(shed > 0);
+        // Every sample is either written or accounted as shed
+        BOOST_REQUIRE_EQUAL(con->cnt.load() + shed, NSAMPLES);
+        BOOST_REQUIRE(spout->is_empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_spout_throttle_doesnt_drop) {
+
+        // AKU_THROTTLE policy shouldn't lose samples when the pool is exhausted
+        std::shared_ptr<ConnectionMock> con = std::make_shared<ConnectionMock>();
+        con->cntp = 0;
+        con->cntt = 0;
+        auto pipeline = std::make_shared<IngestionPipeline>(con, AKU_THROTTLE);
+        pipeline->start();
+        auto spout = pipeline->make_spout();
+        int sump = 0;
+        int sumt = 0;
+        for (int i = 0; i < 100000; i++) {
+            sump += i;
+            sumt += 1;
+            aku_Sample sample = { 1ul, (aku_ParamId)i };
+            spout->write(sample);
+        }
+        pipeline->stop();
+        BOOST_REQUIRE_EQUAL(con->cntt.load(), sumt);
+        BOOST_REQUIRE_EQUAL(con->cntp.load(), sump);
+        BOOST_REQUIRE(spout->is_empty());
+        BOOST_REQUIRE(!spout->is_congested());
 }
@@ -130,3 +130,177 @@ BOOST_AUTO_TEST_CASE(Test_protocol_parse_error_format) {
     parser.start();
     BOOST_REQUIRE_EXCEPTION(parser.parse_next(pdu), RESPError, check_resp_error);
 }
+
+BOOST_AUTO_TEST_CASE(Test_protocol_parse_alias) {
+
+    struct AliasConsumerMock : ConsumerMock {
+        std::vector<std::string> names_;
+
+        aku_Status series_to_param_id(const char* str, size_t strlen, aku_Sample* sample) {
+            names_.push_back(std::string(str, str + strlen));
+            sample->paramid = 100 + names_.size();
+            return AKU_SUCCESS;
+        }
+    };
+
+    // Register "cpu host=1" as alias 1, send one sample through the alias
+    // and one with a raw parameter id (legacy format)
+    const char *messages = "*2\r\n:1\r\n+cpu host=1\r\n:1\r\n:2\r\n+3.5\r\n:42\r\n:4\r\n+5.5\r\n";
+    auto buffer = buffer_from_static_string(messages);
+    PDU pdu = {
+        buffer,
+        strlen(messages),
+        0u
+    };
+    auto cons = std::make_shared<AliasConsumerMock>();
+    ProtocolParser parser(cons);
+    parser.start();
+    parser.parse_next(pdu);
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(cons->names_.size(), 1);
+    BOOST_REQUIRE_EQUAL(cons->names_[0], "cpu host=1");
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[0], 101);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 42);
+    BOOST_REQUIRE_EQUAL(cons->ts_[0], 2);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 4);
+    BOOST_REQUIRE_EQUAL(cons->data_[0], 3.5);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 5.5);
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parse_1) {
+
+    struct BinConsumerMock : ConsumerMock {
+        std::vector<std::string> names_;
+
+        aku_Status series_to_param_id(const char* str, size_t strlen, aku_Sample* sample) {
+            names_.push_back(std::string(str, str + strlen));
+            sample->paramid = 100 + names_.size();
+            return AKU_SUCCESS;
+        }
+    };
+
+    auto append_varint = [](std::string& buf, u64 value) {
+        do {
+            char c = value & 0x7F;
+            value >>= 7;
+            buf.push_back(value ? (c | 0x80) : c);
+        } while (value);
+    };
+    auto append_double = [](std::string& buf, double value) {
+        char tmp[sizeof(value)];
+        memcpy(tmp, &value, sizeof(value));
+        buf.append(tmp, sizeof(value));
+    };
+    auto zigzag = [](i64 value) {
+        return (static_cast<u64>(value) << 1) ^ static_cast<u64>(value >> 63);
+    };
+
+    std::string buf;
+    // Define series "cpu host=1" as stream 1
+    const char* name = "cpu host=1";
+    append_varint(buf, 0);
+    append_varint(buf, 1);
+    append_varint(buf, strlen(name));
+    buf += name;
+    // Three samples with forward and backward deltas
+    append_varint(buf, 1);
+    append_varint(buf, zigzag(1000));
+    append_double(buf, 3.5);
+    append_varint(buf, 1);
+    append_varint(buf, zigzag(10));
+    append_double(buf, -1.5);
+    append_varint(buf, 1);
+    append_varint(buf, zigzag(-5));
+    append_double(buf, 8.25);
+
+    auto cons = std::make_shared<BinConsumerMock>();
+    BinaryProtocolParser parser(cons);
+    // Feed tiny chunks to exercise frame reassembly
+    for (size_t i = 0; i < buf.size(); i += 7) {
+        size_t n = std::min(buf.size() - i, (size_t)7);
+        auto chunk = std::shared_ptr<Byte>(new Byte[n], std::default_delete<Byte[]>());
+        memcpy(chunk.get(), buf.data() + i, n);
+        PDU pdu = {
+            chunk,
+            n,
+            0u
+        };
+        parser.parse_next(pdu);
+    }
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(cons->names_.size(), 1);
+    BOOST_REQUIRE_EQUAL(cons->names_[0], name);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 3);
+    BOOST_REQUIRE_EQUAL(cons->param_[0], 101);
+    BOOST_REQUIRE_EQUAL(cons->param_[2], 101);
+    BOOST_REQUIRE_EQUAL(cons->ts_[0], 1000);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 1010);
+    BOOST_REQUIRE_EQUAL(cons->ts_[2], 1005);
+    BOOST_REQUIRE_EQUAL(cons->data_[0], 3.5);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], -1.5);
+    BOOST_REQUIRE_EQUAL(cons->data_[2], 8.25);
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_unknown_stream) {
+
+    std::string buf;
+    buf.push_back(5);  // stream 5 was never defined
+    buf.push_back(0);
+    buf.append(8, '\0');
+    auto chunk = std::shared_ptr<Byte>(new Byte[buf.size()], std::default_delete<Byte[]>());
+    memcpy(chunk.get(), buf.data(), buf.size());
+    PDU pdu = {
+        chunk,
+        buf.size(),
+        0u
+    };
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+    BinaryProtocolParser parser(cons);
+    BOOST_REQUIRE_THROW(parser.parse_next(pdu), ProtocolParserError);
+}
+
+BOOST_AUTO_TEST_CASE(Test_protocol_parse_query_frame) {
+
+    // Query frame split between reads, interleaved with write frames
+    const char *first  = ":1\r\n:2\r\n+3.14\r\n$10\r\ntest-";
+    const char *second = "query\r\n:5\r\n:6\r\n+7.8\r\n";
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    ProtocolParser parser(cons);
+    std::vector<std::string> queries;
+    parser.set_query_cb([&](std::string text) {
+        queries.push_back(std::move(text));
+    });
+    parser.start();
+
+    auto buffer = buffer_from_static_string(first);
+    PDU pdu = { buffer, strlen(first), 0u };
+    parser.parse_next(pdu);
+
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 1);
+    BOOST_REQUIRE_EQUAL(queries.size(), 0);
+
+    buffer = buffer_from_static_string(second);
+    PDU tail = { buffer, strlen(second), 0u };
+    parser.parse_next(tail);
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(queries.size(), 1);
+    BOOST_REQUIRE_EQUAL(queries.at(0), "test-query");
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 5);
+}
+
+BOOST_AUTO_TEST_CASE(Test_protocol_parse_query_frame_disabled) {
+
+    // Query frames are rejected when no callback is registered
+    const char *message = "$4\r\ntest\r\n";
+    auto buffer = buffer_from_static_string(message);
+    PDU pdu = { buffer, strlen(message), 0u };
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    ProtocolParser parser(cons);
+    parser.start();
+    BOOST_REQUIRE_THROW(parser.parse_next(pdu), ProtocolParserError);
+}
@@ -96,7 +96,7 @@ using namespace Akumuli;
 
 BOOST_AUTO_TEST_CASE(Test_query_cursor) {
 
-    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415000000000002\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415000000000002\r\n";
+    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415\r\n";
     std::shared_ptr<DbConnection> con;
     con.reset(new ConnectionMock());
     char buffer[0x1000];
@@ -111,3 +111,158 @@ BOOST_AUTO_TEST_CASE(Test_query_cursor) {
     auto actual = std::string(buffer, buffer + len);
     BOOST_REQUIRE_EQUAL(expected, actual);
 }
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_small_reads) {
+
+    // Formatted chunks should be drained correctly when the transport
+    // buffer is smaller than the output
+    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415\r\n";
+    std::shared_ptr<DbConnection> con;
+    con.reset(new ConnectionMock());
+    char buffer[0x10];
+    QueryResultsPooler cursor(con, 1000);
+    cursor.append("{}", 2);
+    cursor.start();
+    std::string actual;
+    while (true) {
+        size_t len;
+        bool done;
+        std::tie(len, done) = cursor.read_some(buffer, sizeof(buffer));
+        actual += std::string(buffer, buffer + len);
+        if (done) {
+            break;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(expected, actual);
+}
+
+struct RepeatingCursorMock : DbCursor {
+
+    bool isdone_ = false;
+
+    size_t read(void *dest, size_t dest_size) {
+        if (isdone_) {
+            return 0;
+        }
+        if (dest_size < 3*sizeof(aku_Sample)) {
+            BOOST_FAIL("invalid mock usage");
+        }
+        aku_Sample* samples = (aku_Sample*)dest;
+        const aku_ParamId ids[] = { 33, 44, 33 };
+        for (int i = 0; i < 3; i++) {
+            samples[i].paramid = ids[i];
+            aku_parse_timestamp("20141210T074243.111999", &samples[i]);
+            samples[i].payload.size = sizeof(aku_Sample);
+            samples[i].payload.type = AKU_PAYLOAD_FLOAT;
+            samples[i].payload.float64 = CursorMock::floatval;
+        }
+        isdone_ = true;
+        return 3*sizeof(aku_Sample);
+    }
+
+    int is_done() {
+        return isdone_;
+    }
+
+    bool is_error(aku_Status *out_error_code_or_null) {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = AKU_SUCCESS;
+        }
+        return false;
+    }
+
+    void close() {}
+};
+
+struct RepeatingConnectionMock : ConnectionMock {
+    std::shared_ptr<DbCursor> search(std::string query) {
+        return std::make_shared<RepeatingCursorMock>();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_dictionary) {
+
+    // Each name is sent once as a "*2 :<index> +<name>" dictionary entry,
+    // rows reference the index
+    std::string expected = "*2\r\n:0\r\n+33\r\n:0\r\n+20141210T074243.111999000\r\n+3.1415\r\n"
+                           "*2\r\n:1\r\n+44\r\n:1\r\n+20141210T074243.111999000\r\n+3.1415\r\n"
+                           ":0\r\n+20141210T074243.111999000\r\n+3.1415\r\n";
+    auto con = std::make_shared<RepeatingConnectionMock>();
+    const char* query = R"({"output": {"dictionary": "true"}})";
+    char buffer[0x1000];
+    QueryResultsPooler cursor(con, 1000);
+    cursor.append(query, strlen(query));
+    cursor.start();
+    size_t len;
+    bool done;
+    std::tie(len, done) = cursor.read_some(buffer, 0x1000);
+    BOOST_REQUIRE(len > 0);
+    auto actual = std::string(buffer, buffer + len);
+    BOOST_REQUIRE_EQUAL(expected, actual);
+}
+
+struct EmptyCursorMock : DbCursor {
+    size_t read(void *dest, size_t dest_size) {
+        return 0;
+    }
+
+    int is_done() {
+        return 1;
+    }
+
+    bool is_error(aku_Status *out_error_code_or_null) {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = AKU_SUCCESS;
+        }
+        return false;
+    }
+
+    void close() {}
+};
+
+struct RecordingConnectionMock : ConnectionMock {
+    std::vector<std::string> queries_;
+
+    std::shared_ptr<DbCursor> search(std::string query) {
+        queries_.push_back(query);
+        if (queries_.size() == 1) {
+            return std::make_shared<CursorMock>();
+        }
+        // Subsequent queries should scan only the mutable tail
+        return std::make_shared<EmptyCursorMock>();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_results_cache) {
+
+    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415\r\n";
+    auto con = std::make_shared<RecordingConnectionMock>();
+    auto cache = std::make_shared<QueryResultsCache>();
+    const char* query = R"({"range": {"from": "20141210T000000", "to": "20141211T000000"}})";
+    u64 window = 10000000000ul;  // 10s, the whole range is in the past so it's immutable
+
+    auto run_query = [&]() {
+        char buffer[0x1000];
+        QueryResultsPooler cursor(con, 1000, cache, window);
+        cursor.append(query, strlen(query));
+        cursor.start();
+        std::string result;
+        while (true) {
+            size_t len;
+            bool done;
+            std::tie(len, done) = cursor.read_some(buffer, 0x1000);
+            result += std::string(buffer, buffer + len);
+            if (done) {
+                break;
+            }
+        }
+        cursor.close();
+        return result;
+    };
+
+    // First run materializes the results, second run replays them from the cache
+    BOOST_REQUIRE_EQUAL(expected, run_query());
+    BOOST_REQUIRE_EQUAL(expected, run_query());
+    BOOST_REQUIRE_EQUAL(con->queries_.size(), 2u);
+    BOOST_REQUIRE(con->queries_.at(1).find("20141211T000000") != std::string::npos);
+}
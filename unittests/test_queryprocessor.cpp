@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <random>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -7,9 +9,15 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include "anomalydetector.h"
 #include "queryprocessor.h"
 #include "query_processing/randomsamplingnode.h"
 #include "query_processing/paa.h"
+#include "query_processing/spacesaver.h"
+#include "query_processing/limiter.h"
+#include "query_processing/slidingwindow.h"
+#include "query_processing/aggregate.h"
+#include "query_processing/quantile.h"
 #include "datetime.h"
 
 using namespace Akumuli;
@@ -153,6 +161,71 @@ BOOST_AUTO_TEST_CASE(Test_moving_average_fwd) {
     BOOST_REQUIRE_EQUAL(ts_sum, 99000);
 }
 
+BOOST_AUTO_TEST_CASE(Test_moving_average_batch) {
+    // Batched input should produce the same aggregates as per-sample input
+    aku_Sample margin = {};
+    margin.payload.type = aku_PData::HI_MARGIN;
+    margin.payload.size = sizeof(aku_Sample);
+    auto mock = std::make_shared<NodeMock>();
+    auto ma = std::make_shared<MeanPAA>(mock);
+
+    const int END = 1000;
+    std::vector<aku_ParamId>   ids;
+    std::vector<aku_Timestamp> tss;
+    std::vector<double>        xss;
+    for (int i = 0; i < END; i++) {
+        if (i && i % 10 == 0) {
+            BOOST_REQUIRE(ma->put_batch(ids.size(), ids.data(), tss.data(), xss.data()));
+            ids.clear();
+            tss.clear();
+            xss.clear();
+            margin.timestamp = static_cast<aku_Timestamp>(i);
+            ma->put(margin);
+        }
+        ids.push_back(0);
+        tss.push_back(static_cast<aku_Timestamp>(i));
+        xss.push_back(1.0);
+        ids.push_back(1);
+        tss.push_back(static_cast<aku_Timestamp>(i));
+        xss.push_back(2.0);
+    }
+    BOOST_REQUIRE(ma->put_batch(ids.size(), ids.data(), tss.data(), xss.data()));
+    margin.timestamp = END;
+    ma->put(margin);
+    ma->complete();
+    const size_t EXPECTED_SIZE = 200;
+    BOOST_REQUIRE_EQUAL(mock->timestamps.size(), EXPECTED_SIZE);
+    double values_sum = std::accumulate(mock->values.begin(), mock->values.end(), 0.0,
+                                        [](double a, double b) { return a + b; });
+    BOOST_REQUIRE_CLOSE(values_sum, 300.0, 0.00001);
+}
+
+BOOST_AUTO_TEST_CASE(Test_spacesaver_frequent_items) {
+    auto mock = std::make_shared<NodeMock>();
+    // error = 0.1 so the sketch tracks at most ten series at once
+    auto ss = std::make_shared<SpaceSaver<false>>(0.1, 0.2, mock);
+
+    aku_Timestamp ts = 0;
+    for (int i = 0; i < 100; i++) {
+        BOOST_REQUIRE(ss->put(make(ts++, 1, 1.0)));
+    }
+    for (int i = 0; i < 50; i++) {
+        BOOST_REQUIRE(ss->put(make(ts++, 2, 1.0)));
+    }
+    // Long tail of singletons, keeps the table churning
+    for (u64 id = 3; id < 31; id++) {
+        BOOST_REQUIRE(ss->put(make(ts++, id, 1.0)));
+    }
+    ss->complete();
+
+    // Support is N*P = 178*0.2, singleton estimates never exceed it
+    BOOST_REQUIRE_EQUAL(mock->ids.size(), 2);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(0), 1);
+    BOOST_REQUIRE_EQUAL(mock->values.at(0), 100.0);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(1), 2);
+    BOOST_REQUIRE_EQUAL(mock->values.at(1), 50.0);
+}
+
 BOOST_AUTO_TEST_CASE(Test_moving_average_bwd) {
     aku_Sample margin = {};
     margin.payload.type = aku_PData::LO_MARGIN;
@@ -194,6 +267,198 @@ BOOST_AUTO_TEST_CASE(Test_moving_average_bwd) {
     BOOST_REQUIRE_EQUAL(ts_sum, 99000);
 }
 
+BOOST_AUTO_TEST_CASE(Test_limiter_offset_and_limit) {
+    auto mock = std::make_shared<NodeMock>();
+    auto limiter = std::make_shared<Limiter>(5ul, 3ul, mock);
+
+    std::vector<aku_ParamId>   ids(10, 42);
+    std::vector<aku_Timestamp> tss;
+    std::vector<double>        xss;
+    for (int i = 0; i < 10; i++) {
+        tss.push_back(static_cast<aku_Timestamp>(i));
+        xss.push_back(static_cast<double>(i));
+    }
+
+    // First three should be skipped, next five forwarded, then the scan
+    // should be interrupted
+    BOOST_REQUIRE(!limiter->put_batch(ids.size(), ids.data(), tss.data(), xss.data()));
+    BOOST_REQUIRE_EQUAL(mock->timestamps.size(), 5);
+    BOOST_REQUIRE_EQUAL(mock->timestamps.front(), 3);
+    BOOST_REQUIRE_EQUAL(mock->timestamps.back(), 7);
+
+    // Same cut through the per-sample interface
+    auto mock2 = std::make_shared<NodeMock>();
+    auto limiter2 = std::make_shared<Limiter>(5ul, 3ul, mock2);
+    int npassed = 0;
+    for (int i = 0; i < 10; i++) {
+        if (!limiter2->put(make(static_cast<aku_Timestamp>(i), 42, 1.0))) {
+            break;
+        }
+        npassed++;
+    }
+    BOOST_REQUIRE_EQUAL(mock2->timestamps.size(), 5);
+    BOOST_REQUIRE_EQUAL(mock2->timestamps.front(), 3);
+    BOOST_REQUIRE_EQUAL(mock2->timestamps.back(), 7);
+}
+
+BOOST_AUTO_TEST_CASE(Test_reservoir_skip_ahead) {
+    auto mock = std::make_shared<NodeMock>();
+    const u32 RSIZE = 10;
+    auto reservoir = std::make_shared<RandomSamplingNode>(RSIZE, mock);
+
+    const size_t N = 100000;
+    std::vector<aku_ParamId>   ids(N, 42);
+    std::vector<aku_Timestamp> tss;
+    std::vector<double>        xss;
+    for (size_t i = 0; i < N; i++) {
+        tss.push_back(static_cast<aku_Timestamp>(i));
+        xss.push_back(static_cast<double>(i));
+    }
+    // Feed the run in uneven batches to exercise the skip-ahead counter
+    size_t offset = 0;
+    size_t batch = 1;
+    while (offset < N) {
+        auto size = std::min(batch, N - offset);
+        BOOST_REQUIRE(reservoir->put_batch(size, ids.data() + offset, tss.data() + offset,
+                                           xss.data() + offset));
+        offset += size;
+        batch = batch * 2 + 1;
+    }
+    reservoir->complete();
+
+    BOOST_REQUIRE_EQUAL(mock->values.size(), RSIZE);
+    for (u32 i = 0; i < RSIZE; i++) {
+        // Output is a sorted subset of the input
+        BOOST_REQUIRE_EQUAL(mock->values.at(i), static_cast<double>(mock->timestamps.at(i)));
+        if (i > 0) {
+            BOOST_REQUIRE(mock->timestamps.at(i) > mock->timestamps.at(i - 1));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sliding_window_count_based) {
+    auto mock = std::make_shared<NodeMock>();
+    auto window = std::make_shared<SlidingWindow>(SlidingWindow::MIN, 0ull, 3u, mock);
+
+    double input[] = { 5.0, 3.0, 4.0, 1.0, 2.0 };
+    for (int i = 0; i < 5; i++) {
+        BOOST_REQUIRE(window->put(make(static_cast<aku_Timestamp>(i), 42, input[i])));
+    }
+    window->complete();
+
+    // Trailing min over the last three values
+    double expected[] = { 5.0, 3.0, 3.0, 1.0, 1.0 };
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 5);
+    for (int i = 0; i < 5; i++) {
+        BOOST_REQUIRE_EQUAL(mock->values.at(i), expected[i]);
+        BOOST_REQUIRE_EQUAL(mock->timestamps.at(i), static_cast<aku_Timestamp>(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sliding_window_time_based) {
+    auto mock = std::make_shared<NodeMock>();
+    auto window = std::make_shared<SlidingWindow>(SlidingWindow::SUM, 10ull, 0u, mock);
+
+    std::vector<aku_ParamId>   ids(4, 42);
+    std::vector<aku_Timestamp> tss = { 0, 5, 10, 14 };
+    std::vector<double>        xss = { 1.0, 2.0, 3.0, 4.0 };
+    BOOST_REQUIRE(window->put_batch(ids.size(), ids.data(), tss.data(), xss.data()));
+    window->complete();
+
+    // Sample at t=0 leaves the window at t=10, the one at t=5 - at t=15
+    std::vector<double> expected = { 1.0, 3.0, 5.0, 9.0 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(mock->values.begin(), mock->values.end(),
+                                    expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_mean) {
+    auto mock = std::make_shared<NodeMock>();
+    auto agg = std::make_shared<Aggregate>(Aggregate::MEAN, mock);
+
+    double input[] = { 1.0, 2.0, 3.0, 4.0 };
+    for (int i = 0; i < 4; i++) {
+        BOOST_REQUIRE(agg->put(make(static_cast<aku_Timestamp>(i), 42, input[i])));
+    }
+    agg->complete();
+
+    // Single output sample carrying the last timestamp of the range
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 1);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(0), 42);
+    BOOST_REQUIRE_EQUAL(mock->timestamps.at(0), 3);
+    BOOST_REQUIRE_EQUAL(mock->values.at(0), 2.5);
+}
+
+BOOST_AUTO_TEST_CASE(Test_aggregate_min_two_series) {
+    auto mock = std::make_shared<NodeMock>();
+    auto agg = std::make_shared<Aggregate>(Aggregate::MIN, mock);
+
+    std::vector<aku_ParamId>   ids = { 2, 2, 1, 1 };
+    std::vector<aku_Timestamp> tss = { 0, 1, 2, 3 };
+    std::vector<double>        xss = { -5.0, 7.0, 4.0, -1.0 };
+    BOOST_REQUIRE(agg->put_batch(ids.size(), ids.data(), tss.data(), xss.data()));
+    agg->complete();
+
+    // One value per series, output ordered by series id
+    std::vector<aku_ParamId> eids = { 1, 2 };
+    std::vector<double>      exss = { -1.0, -5.0 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(mock->ids.begin(), mock->ids.end(), eids.begin(), eids.end());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(mock->values.begin(), mock->values.end(), exss.begin(), exss.end());
+}
+
+BOOST_AUTO_TEST_CASE(Test_quantile_two_series) {
+    auto mock = std::make_shared<NodeMock>();
+    std::vector<double> qs = { 0.5, 0.95 };
+    auto node = std::make_shared<Quantile>(qs, mock);
+
+    // Uniform 0..9999 in shuffled order
+    const int N = 10000;
+    std::vector<double> input;
+    for (int i = 0; i < N; i++) {
+        input.push_back(static_cast<double>(i));
+    }
+    std::mt19937 generator(0xBEE5);
+    std::shuffle(input.begin(), input.end(), generator);
+    std::vector<aku_ParamId>   ids;
+    std::vector<aku_Timestamp> tss;
+    for (int i = 0; i < N; i++) {
+        ids.push_back(i % 2);
+        tss.push_back(static_cast<aku_Timestamp>(i));
+    }
+    BOOST_REQUIRE(node->put_batch(ids.size(), ids.data(), tss.data(), input.data()));
+    node->complete();
+
+    // One sample per series per quantile, ordered by series id
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 4);
+    std::vector<aku_ParamId> eids = { 0, 0, 1, 1 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(mock->ids.begin(), mock->ids.end(), eids.begin(), eids.end());
+    // Both series got a uniform sample of the input so the estimates
+    // should land near the population quantiles
+    for (int i = 0; i < 4; i++) {
+        double expected = (i % 2 == 0) ? 0.5*N : 0.95*N;
+        BOOST_REQUIRE_CLOSE(mock->values.at(i), expected, 2.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_quantile_digest_merge) {
+    // Merged digest should agree with the digest built from all the data
+    std::normal_distribution<double> dist(100.0, 15.0);
+    std::mt19937 generator(0xF00D);
+    TDigest full, lhs, rhs;
+    for (int i = 0; i < 10000; i++) {
+        double value = dist(generator);
+        full.add(value);
+        if (i % 2 == 0) {
+            lhs.add(value);
+        } else {
+            rhs.add(value);
+        }
+    }
+    lhs.merge(rhs);
+    for (double q: { 0.5, 0.9, 0.99 }) {
+        BOOST_REQUIRE_CLOSE(lhs.quantile(q), full.quantile(q), 2.0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_1) {
 
     SeriesMatcher matcher(1ul);
@@ -251,3 +516,93 @@ BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_1) {
     BOOST_REQUIRE_EQUAL(terminal->ids.at(1), 2);
     BOOST_REQUIRE_EQUAL(terminal->values.at(1), 0.234);
 }
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_empty_filter_skips_scan) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series1[] = {
+        "cpu key1=1 key3=1",
+        "cpu key2=2 key3=2",
+    };
+    for(int i = 0; i < 2; i++) {
+        const char* sname = series1[i];
+        int slen = strlen(sname);
+        matcher.add(sname, sname+slen);
+    }
+    const char* json = R"(
+            {
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                },
+                "where": {
+                    "key3": [99]
+                }
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = QP::Builder::build_query_processor(json, terminal, matcher, &logger_stub);
+
+    // Nothing matches the where clause so the scan should be skipped
+    BOOST_REQUIRE(!iproc->start());
+    BOOST_REQUIRE(terminal->ids.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_queryprocessor_select_cardinality) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series1[] = {
+        "cpu host=a region=1",
+        "cpu host=b region=1",
+        "mem host=a region=2",
+        "mem host=b region=2",
+    };
+    for(int i = 0; i < 4; i++) {
+        const char* sname = series1[i];
+        int slen = strlen(sname);
+        matcher.add(sname, sname+slen);
+    }
+    const char* json = R"(
+            {
+                "select": "cardinality"
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto iproc = QP::Builder::build_query_processor(json, terminal, matcher, &logger_stub);
+    auto qproc = std::dynamic_pointer_cast<QP::CardinalityQueryProcessor>(iproc);
+    BOOST_REQUIRE(qproc);
+
+    BOOST_REQUIRE(qproc->start());
+    qproc->stop();
+
+    // One row per tag key plus the "metric" pseudo-key, counts are exact
+    // in the linear counting range
+    BOOST_REQUIRE_EQUAL(terminal->values.size(), 3);
+    std::map<std::string, double> counts;
+    for (size_t i = 0; i < qproc->estimates_.size(); i++) {
+        counts[qproc->estimates_[i].first] = terminal->values[i];
+    }
+    BOOST_REQUIRE_CLOSE(counts.at("metric"), 2.0, 1.0);
+    BOOST_REQUIRE_CLOSE(counts.at("host"), 2.0, 1.0);
+    BOOST_REQUIRE_CLOSE(counts.at("region"), 2.0, 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_anomaly_detector_approx_sma) {
+
+    // Sketch is large enough to take the parallel epoch rotation path
+    auto detector = AnomalyDetectorUtil::create_approx_sma(7, 0x4000, 3.0, 4);
+    for (int epoch = 0; epoch < 4; epoch++) {
+        for (u64 id = 0; id < 100; id++) {
+            detector->add(id, 50.0);
+        }
+        detector->move_sliding_window();
+    }
+    // One series spikes while the rest stay on the forecast
+    for (u64 id = 0; id < 100; id++) {
+        detector->add(id, id == 42 ? 5000.0 : 50.0);
+    }
+    detector->move_sliding_window();
+    BOOST_REQUIRE(detector->is_anomaly_candidate(42));
+    BOOST_REQUIRE(!detector->is_anomaly_candidate(24));
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <tuple>
+#include <vector>
+
+#include "rollup.h"
+
+using namespace Akumuli;
+
+static const u64 MINUTE = 60000000000ull;
+static const u64 HOUR   = 3600000000000ull;
+
+BOOST_AUTO_TEST_CASE(Test_rollup_suffix_for_step) {
+    BOOST_REQUIRE_EQUAL(RollupEngine::suffix_for_step(MINUTE/2), "");
+    BOOST_REQUIRE_EQUAL(RollupEngine::suffix_for_step(MINUTE), ":1m");
+    BOOST_REQUIRE_EQUAL(RollupEngine::suffix_for_step(HOUR - 1), ":1m");
+    BOOST_REQUIRE_EQUAL(RollupEngine::suffix_for_step(HOUR), ":1h");
+    BOOST_REQUIRE_EQUAL(RollupEngine::suffix_for_step(24*HOUR), ":1h");
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_bucket_flush) {
+    SeriesMatcher matcher;
+    const char* sname = "cpu key=1";
+    auto id = matcher.add(sname, sname + strlen(sname));
+
+    std::vector<std::tuple<aku_ParamId, aku_Timestamp, double>> written;
+    RollupEngine engine(matcher, [&](aku_ParamId id, aku_Timestamp ts, double value) {
+        written.push_back(std::make_tuple(id, ts, value));
+        return AKU_SUCCESS;
+    });
+
+    // Two values in the first minute, nothing should be flushed yet
+    BOOST_REQUIRE_EQUAL(engine.add(id, 0ull, 1.0), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(engine.add(id, MINUTE/2, 2.0), AKU_SUCCESS);
+    BOOST_REQUIRE(written.empty());
+
+    // Derived series should be registered up front
+    const char* sname1m = "cpu:1m key=1";
+    const char* sname1h = "cpu:1h key=1";
+    auto id1m = matcher.match(sname1m, sname1m + strlen(sname1m));
+    auto id1h = matcher.match(sname1h, sname1h + strlen(sname1h));
+    BOOST_REQUIRE(id1m != 0);
+    BOOST_REQUIRE(id1h != 0);
+
+    // Crossing the minute boundary flushes the mean of the first bucket
+    BOOST_REQUIRE_EQUAL(engine.add(id, 2*MINUTE, 5.0), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(written.size(), 1u);
+    BOOST_REQUIRE_EQUAL(std::get<0>(written.at(0)), id1m);
+    BOOST_REQUIRE_EQUAL(std::get<1>(written.at(0)), 0ull);
+    BOOST_REQUIRE_EQUAL(std::get<2>(written.at(0)), 1.5);
+
+    // Crossing the hour boundary flushes both resolutions
+    written.clear();
+    BOOST_REQUIRE_EQUAL(engine.add(id, HOUR, 7.0), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(written.size(), 2u);
+    BOOST_REQUIRE_EQUAL(std::get<0>(written.at(0)), id1m);
+    BOOST_REQUIRE_EQUAL(std::get<1>(written.at(0)), 2*MINUTE);
+    BOOST_REQUIRE_EQUAL(std::get<2>(written.at(0)), 5.0);
+    BOOST_REQUIRE_EQUAL(std::get<0>(written.at(1)), id1h);
+    BOOST_REQUIRE_EQUAL(std::get<1>(written.at(1)), 0ull);
+    BOOST_REQUIRE_EQUAL(std::get<2>(written.at(1)), (1.0 + 2.0 + 5.0)/3.0);
+
+    // Values written into the derived series are not rolled up further
+    written.clear();
+    BOOST_REQUIRE_EQUAL(engine.add(id1m, 2*HOUR, 9.0), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(engine.add(id1m, 3*HOUR, 9.0), AKU_SUCCESS);
+    BOOST_REQUIRE(written.empty());
+    const char* bad = "cpu:1m:1m key=1";
+    BOOST_REQUIRE_EQUAL(matcher.match(bad, bad + strlen(bad)), 0ull);
+}
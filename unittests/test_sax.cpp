@@ -57,3 +57,19 @@ BOOST_AUTO_TEST_CASE(Test_encoding) {
     BOOST_REQUIRE_EQUAL_COLLECTIONS(words.begin(), words.end(), expected.begin(), expected.end());
 }
 
+BOOST_AUTO_TEST_CASE(Test_encoding_wide_window) {
+
+    // Window is wide enough to hit the vectorized quantization path
+    SAXEncoder encoder(4, 16);
+
+    std::string word;
+    word.resize(16);
+    bool complete = false;
+    for (int i = 0; i < 16; i++) {
+        complete = encoder.encode(static_cast<double>(i), &word[0], word.size());
+    }
+
+    BOOST_REQUIRE(complete);
+    BOOST_REQUIRE_EQUAL(word, "aaaaabbbcccddddd");
+}
+
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <random>
+#include <thread>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -304,6 +305,146 @@ void test_sequencer_searching(int dir) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(Test_sequencer_add_batch) {
+
+    const int LARGE_LOOP = 1000;
+    const int SMALL_LOOP = 10;
+    const u32 BATCH_SIZE = 100;
+
+    aku_FineTuneParams params = {};
+    params.window_size = SMALL_LOOP;
+    Sequencer seq(params);
+
+    std::vector<aku_ParamId>   ids(LARGE_LOOP, 42u);
+    std::vector<aku_Timestamp> tss;
+    std::vector<double>        xss;
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        tss.push_back(static_cast<aku_Timestamp>(i));
+        xss.push_back(static_cast<double>(i));
+    }
+
+    int num_checkpoints = 0;
+    size_t num_results = 0;
+
+    for (u32 offset = 0; offset < LARGE_LOOP;) {
+        u32 batch = std::min(BATCH_SIZE, LARGE_LOOP - offset);
+        int status;
+        int lock = 0;
+        u32 consumed = 0;
+        tie(status, lock) = seq.add_batch(ids.data() + offset, tss.data() + offset,
+                                          xss.data() + offset, batch, &consumed);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE(consumed > 0);
+        offset += consumed;
+        if (lock % 2 != 0) {
+            RecordingCursor rec;
+            Caller caller;
+            seq.merge(caller, &rec);
+            num_checkpoints++;
+            num_results += rec.results.size();
+        }
+    }
+
+    seq.reset();
+    RecordingCursor rec;
+    Caller caller;
+    seq.merge(caller, &rec);
+    num_checkpoints++;
+    num_results += rec.results.size();
+
+    BOOST_REQUIRE_EQUAL(num_checkpoints, LARGE_LOOP/SMALL_LOOP);
+    BOOST_REQUIRE_EQUAL(num_results, LARGE_LOOP);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_concurrent_writers) {
+    const int NWRITERS = 4;
+    const int NITEMS   = 10000;
+
+    aku_FineTuneParams params = {};
+    params.window_size = 2*NITEMS;  // all writes stay in one window
+    Sequencer seq(params);
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < NWRITERS; t++) {
+        writers.push_back(std::thread([&seq, t]() {
+            for (int i = 0; i < NITEMS; i++) {
+                int status;
+                int lock;
+                tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i),
+                                                            static_cast<aku_ParamId>(t),
+                                                            static_cast<double>(i)));
+                BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            }
+        }));
+    }
+    for (auto& thread: writers) {
+        thread.join();
+    }
+
+    seq.reset();
+    RecordingCursor rec;
+    Caller caller;
+    seq.merge(caller, &rec);
+
+    // All values should be merged in timestamp order
+    BOOST_REQUIRE_EQUAL(rec.results.size(), NWRITERS*NITEMS);
+    for (auto i = 1u; i < rec.results.size(); i++) {
+        BOOST_REQUIRE(rec.results[i-1].timestamp <= rec.results[i].timestamp);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_sharded_checkpoints) {
+    const int NWRITERS = 4;
+    const int NITEMS   = 10000;
+
+    aku_FineTuneParams params = {};
+    params.window_size = 100;  // each writer closes many windows
+    Sequencer seq(params);
+
+    // Each writer advances the window of its own shard and merges its own
+    // checkpoints. Writers that hash into the same shard can see each
+    // other as late - only accepted samples are accounted for.
+    std::atomic<size_t> naccepted(0);
+    std::atomic<size_t> nmerged(0);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < NWRITERS; t++) {
+        writers.push_back(std::thread([&seq, &naccepted, &nmerged, t]() {
+            for (int i = 0; i < NITEMS; i++) {
+                int status;
+                int lock;
+                tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i),
+                                                            static_cast<aku_ParamId>(t),
+                                                            static_cast<double>(i)));
+                BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ELATE_WRITE);
+                if (status == AKU_SUCCESS) {
+                    naccepted++;
+                }
+                if (lock % 2 == 1) {
+                    RecordingCursor rec;
+                    Caller caller;
+                    seq.merge(caller, &rec);
+                    for (auto k = 1u; k < rec.results.size(); k++) {
+                        BOOST_REQUIRE(rec.results[k-1].timestamp <= rec.results[k].timestamp);
+                    }
+                    nmerged += rec.results.size();
+                }
+            }
+        }));
+    }
+    for (auto& thread: writers) {
+        thread.join();
+    }
+
+    seq.reset();
+    RecordingCursor rec;
+    Caller caller;
+    seq.merge(caller, &rec);
+    nmerged += rec.results.size();
+
+    // Nothing should be lost or duplicated by the per-shard checkpoints
+    BOOST_REQUIRE_EQUAL(nmerged.load(), naccepted.load());
+}
+
 BOOST_AUTO_TEST_CASE(Test_sequencer_search_backward) {
     test_sequencer_searching(AKU_CURSOR_DIR_BACKWARD);
 }
@@ -311,3 +452,195 @@ BOOST_AUTO_TEST_CASE(Test_sequencer_search_backward) {
 BOOST_AUTO_TEST_CASE(Test_sequencer_search_forward) {
     test_sequencer_searching(AKU_CURSOR_DIR_FORWARD);
 }
+
+BOOST_AUTO_TEST_CASE(Test_reorder_buffer) {
+    const aku_Duration LATENESS = 100;
+    ReorderBuffer buffer(LATENESS);
+    std::vector<ReorderBuffer::OutSample> out;
+
+    // Mildly out-of-order samples should be reordered
+    std::vector<aku_Timestamp> tss = { 10, 30, 20, 50, 40, 60, 70, 90, 80, 100 };
+    for (auto ts: tss) {
+        bool stored = buffer.put(42, ts, static_cast<double>(ts), &out);
+        BOOST_REQUIRE(stored);
+    }
+    // Nothing falls out of the lateness bound yet
+    BOOST_REQUIRE(out.empty());
+
+    // Duplicate of a pending sample should be dropped
+    auto ndups = ReorderBuffer::duplicate_count();
+    bool stored = buffer.put(42, 50, 0.0, &out);
+    BOOST_REQUIRE(!stored);
+    BOOST_REQUIRE_EQUAL(ReorderBuffer::duplicate_count(), ndups + 1);
+
+    // New sample pushes old ones out of the lateness bound
+    buffer.put(42, 200, 200.0, &out);
+    BOOST_REQUIRE(!out.empty());
+    for (auto const& sample: out) {
+        BOOST_REQUIRE(200 - sample.ts > LATENESS);
+    }
+
+    // Sample older than the watermark is passed through right away
+    auto nlate = ReorderBuffer::late_count();
+    auto nout = out.size();
+    buffer.put(42, 1, 1.0, &out);
+    BOOST_REQUIRE_EQUAL(out.size(), nout + 1);
+    BOOST_REQUIRE_EQUAL(out.back().ts, 1);
+    BOOST_REQUIRE_EQUAL(ReorderBuffer::late_count(), nlate + 1);
+
+    // Flush releases everything, all samples should be accounted for
+    buffer.flush(&out);
+    BOOST_REQUIRE_EQUAL(out.size(), tss.size() + 2);
+
+    // Released samples should be sorted (except the late pass-through)
+    std::vector<aku_Timestamp> sorted;
+    for (auto const& sample: out) {
+        if (sample.ts != 1) {
+            sorted.push_back(sample.ts);
+        }
+    }
+    BOOST_REQUIRE(std::is_sorted(sorted.begin(), sorted.end()));
+}
+
+namespace {
+
+//! Query processor with a filter that names the queried series
+struct FilteredQueryProcessor : TestQueryProcessor {
+    QP::BypassFilter flt;
+
+    FilteredQueryProcessor(std::vector<u64> ids, std::shared_ptr<QP::Node> r,
+                           aku_Timestamp b, aku_Timestamp e, int dir)
+        : TestQueryProcessor(r, b, e, dir)
+        , flt(ids)
+    {
+    }
+
+    virtual QP::IQueryFilter& filter() { return flt; }
+};
+
+}  // namespace
+
+void test_sequencer_tail_search(int dir) {
+    const int SZLOOP = 100;
+
+    aku_FineTuneParams params = {};
+    params.window_size = 10000;
+    Sequencer seq(params);
+
+    for (int i = 1; i <= SZLOOP; i++) {
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i), 42u, (double)i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+
+    // Range covered by the ring (older samples were overwritten but they
+    // are all below the lowerbound)
+    aku_Timestamp begin = 50, end = 200;
+    Caller caller;
+    RecordingCursor cursor;
+    auto node = std::make_shared<Node>(caller, cursor);
+    auto qproc = std::make_shared<FilteredQueryProcessor>(std::vector<u64>{42u}, node, begin, end, dir);
+    BOOST_REQUIRE(seq.search_tail(qproc));
+
+    BOOST_REQUIRE_EQUAL(cursor.results.size(), SZLOOP - 50 + 1);
+    for (auto i = 0u; i < cursor.results.size(); i++) {
+        aku_Timestamp expected = dir == AKU_CURSOR_DIR_BACKWARD ? SZLOOP - i : 50 + i;
+        BOOST_REQUIRE_EQUAL(cursor.results[i].timestamp, expected);
+        BOOST_REQUIRE_EQUAL(cursor.results[i].payload.float64, (double)expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_tail_search_forward) {
+    test_sequencer_tail_search(AKU_CURSOR_DIR_FORWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_tail_search_backward) {
+    test_sequencer_tail_search(AKU_CURSOR_DIR_BACKWARD);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_tail_search_fallback) {
+    const int SZLOOP = 100;
+
+    aku_FineTuneParams params = {};
+    params.window_size = 10000;
+    Sequencer seq(params);
+
+    for (int i = 1; i <= SZLOOP; i++) {
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i), 42u, (double)i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+
+    Caller caller;
+    RecordingCursor cursor;
+    auto node = std::make_shared<Node>(caller, cursor);
+
+    // Range reaches below the samples that were overwritten in the ring
+    auto deep = std::make_shared<FilteredQueryProcessor>(std::vector<u64>{42u}, node, 1, 200,
+                                                         AKU_CURSOR_DIR_FORWARD);
+    BOOST_REQUIRE(!seq.search_tail(deep));
+
+    // Unknown series
+    auto unknown = std::make_shared<FilteredQueryProcessor>(std::vector<u64>{42u, 43u}, node, 50, 200,
+                                                            AKU_CURSOR_DIR_FORWARD);
+    BOOST_REQUIRE(!seq.search_tail(unknown));
+
+    // Filter doesn't name the series
+    auto unbounded = std::make_shared<TestQueryProcessor>(node, 50, 200, AKU_CURSOR_DIR_FORWARD);
+    BOOST_REQUIRE(!seq.search_tail(unbounded));
+
+    // Nothing should be emitted by the rejected queries
+    BOOST_REQUIRE(cursor.results.empty());
+
+    // The regular path should still see everything
+    aku_Timestamp window;
+    int seq_id;
+    std::tie(window, seq_id) = seq.get_window();
+    auto qproc = std::make_shared<FilteredQueryProcessor>(std::vector<u64>{42u}, node, 1, 200,
+                                                          AKU_CURSOR_DIR_FORWARD);
+    seq.search(qproc, seq_id);
+    BOOST_REQUIRE_EQUAL(cursor.results.size(), SZLOOP);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_unordered_input_sort) {
+
+    // Large enough to take the radix path, with duplicate timestamps
+    // across different ids to check the tie-break
+    const int LARGE_LOOP = 5000;
+
+    aku_FineTuneParams params = {};
+    params.window_size = 40*LARGE_LOOP;
+    Sequencer seq(params);
+
+    std::vector<std::pair<aku_Timestamp, aku_ParamId>> keys;
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        // Spacing makes the timestamp span wider than one radix digit
+        keys.push_back(std::make_pair(static_cast<aku_Timestamp>(1 + (i/2)*40), 42u + i % 2));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::minstd_rand(0x12345));
+
+    for (int i = 0; i < LARGE_LOOP; i++) {
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(keys[i].first, keys[i].second, (double)keys[i].first));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE(lock % 2 == 0);
+    }
+
+    int lock = seq.reset();
+    BOOST_REQUIRE(lock % 2 == 1);
+    RecordingCursor rec;
+    Caller caller;
+    seq.merge(caller, &rec);
+
+    BOOST_REQUIRE_EQUAL(rec.results.size(), LARGE_LOOP);
+    for (auto i = 1u; i < rec.results.size(); i++) {
+        auto const& prev = rec.results[i - 1];
+        auto const& curr = rec.results[i];
+        BOOST_REQUIRE(std::make_tuple(prev.timestamp, prev.paramid) <
+                      std::make_tuple(curr.timestamp, curr.paramid));
+        BOOST_REQUIRE_EQUAL(curr.payload.float64, (double)curr.timestamp);
+    }
+}
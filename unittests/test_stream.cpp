@@ -39,3 +39,33 @@ BOOST_AUTO_TEST_CASE(Test_stream_3) {
     BOOST_REQUIRE_EQUAL(stream_reader.pick(), 'd');
     BOOST_REQUIRE_EQUAL(stream_reader.get(),  'd');
 }
+
+BOOST_AUTO_TEST_CASE(Test_stream_4) {
+
+    std::string expected = "abcde";
+    MemStreamReader stream_reader(expected.data(), expected.size());
+    size_t size = 0;
+    auto buf = stream_reader.pick_buffer(&size);
+    BOOST_REQUIRE(buf != nullptr);
+    BOOST_REQUIRE_EQUAL(size, expected.size());
+    BOOST_REQUIRE_EQUAL(std::string(buf, buf + size), expected);
+    stream_reader.discard(3);
+    BOOST_REQUIRE_EQUAL(stream_reader.get(), 'd');
+    stream_reader.discard(1);
+    BOOST_REQUIRE(stream_reader.pick_buffer(&size) == nullptr);
+    BOOST_REQUIRE(stream_reader.is_eof());
+}
+
+BOOST_AUTO_TEST_CASE(Test_stream_find_line_end) {
+
+    // Line break in the vectorized part, in the tail and missing
+    std::string buffer = "0123456789012345678\r\nabc";
+    auto eol = find_line_end(buffer.data(), buffer.data() + buffer.size());
+    BOOST_REQUIRE_EQUAL(eol - buffer.data(), 19);
+    buffer = "0123\nabc";
+    eol = find_line_end(buffer.data(), buffer.data() + buffer.size());
+    BOOST_REQUIRE_EQUAL(eol - buffer.data(), 4);
+    buffer = "0123456789abcdef0123";
+    eol = find_line_end(buffer.data(), buffer.data() + buffer.size());
+    BOOST_REQUIRE(eol == buffer.data() + buffer.size());
+}
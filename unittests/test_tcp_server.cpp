@@ -19,6 +19,8 @@ static Logger logger_ = Logger("tcp-server-test", 10);
 struct DbMock : DbConnection {
     typedef std::tuple<aku_ParamId, aku_Timestamp, double> ValueT;
     std::vector<ValueT> results;
+    std::atomic<u64> wseq{0};     //< Sequence of the last write
+    std::atomic<u64> durable{0};  //< Simulated durability watermark
 
     void close() {
     }
@@ -26,8 +28,17 @@ struct DbMock : DbConnection {
     aku_Status write(const aku_Sample &sample) {
         logger_.trace() << "write_double(" << sample.paramid << ", " << sample.timestamp << ", " << sample.payload.float64 << ")";
         results.push_back(std::make_tuple(sample.paramid, sample.timestamp, sample.payload.float64));
+        wseq++;
         return AKU_SUCCESS;
     }
+
+    u64 get_write_sequence() {
+        return wseq;
+    }
+
+    u64 get_durability_watermark() {
+        return durable;
+    }
     std::shared_ptr<DbCursor> search(std::string query) {
         throw "not implemented";
     }
@@ -51,6 +62,14 @@ struct DbErrMock : DbConnection {
     aku_Status write(const aku_Sample &sample) {
         return err;
     }
+
+    u64 get_write_sequence() {
+        return 0;
+    }
+
+    u64 get_durability_watermark() {
+        return 0;
+    }
     std::shared_ptr<DbCursor> search(std::string query) {
         throw "not implemented";
     }
@@ -65,6 +84,53 @@ struct DbErrMock : DbConnection {
 
 const int PORT = 14096;
 
+struct QueryProcMock;
+
+//! Canned query operation, returns one chunk of preformatted results.
+//! State is reported back to the builder - the session owns and deletes
+//! the operation.
+struct QueryOpMock : ReadOperation {
+    QueryProcMock* parent;
+    std::string    results;
+    size_t         offset = 0;
+
+    QueryOpMock(QueryProcMock* parent, std::string results)
+        : parent(parent)
+        , results(std::move(results))
+    {
+    }
+
+    virtual void start() {}
+    virtual void append(const char* data, size_t data_size);
+    virtual aku_Status get_error() { return AKU_SUCCESS; }
+    virtual std::tuple<size_t, bool> read_some(char* buf, size_t buf_size) {
+        auto sz = std::min(buf_size, results.size() - offset);
+        memcpy(buf, results.data() + offset, sz);
+        offset += sz;
+        return std::make_tuple(sz, offset == results.size());
+    }
+    virtual void close();
+};
+
+struct QueryProcMock : ReadOperationBuilder {
+    std::string results;
+    std::string last_query;
+    int         closed_count = 0;
+
+    virtual ReadOperation* create() {
+        return new QueryOpMock(this, results);
+    }
+    virtual std::string get_all_stats() { return "{}"; }
+};
+
+void QueryOpMock::append(const char* data, size_t data_size) {
+    parent->last_query.append(data, data_size);
+}
+
+void QueryOpMock::close() {
+    parent->closed_count++;
+}
+
 template<class Mock>
 struct TCPServerTestSuite {
     std::shared_ptr<Mock>               dbcon;
@@ -72,7 +138,8 @@ struct TCPServerTestSuite {
     IOServiceT                          io;
     std::shared_ptr<TcpAcceptor>        serv;
 
-    TCPServerTestSuite() {
+    TCPServerTestSuite(std::shared_ptr<ReadOperationBuilder> qproc = nullptr,
+                       bool durable_acks = false) {
         // Create mock pipeline
         dbcon = std::make_shared<Mock>();
         pline = std::make_shared<IngestionPipeline>(dbcon, AKU_LINEAR_BACKOFF);
@@ -80,7 +147,8 @@ struct TCPServerTestSuite {
 
         // Run server
         std::vector<IOServiceT*> iovec = { &io };
-        serv = std::make_shared<TcpAcceptor>(iovec, PORT, pline);
+        serv = std::make_shared<TcpAcceptor>(iovec, PORT, pline, false, 0, AKU_PRIORITY_HIGH, qproc,
+                                             durable_acks);
 
         // Start reading but don't start iorun thread
         serv->_start();
@@ -289,3 +357,119 @@ BOOST_AUTO_TEST_CASE(Test_tcp_server_backend_error_handling) {
         BOOST_REQUIRE_EQUAL(std::string(buffer, buffer + 3), "-DB");
     });
 }
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_durable_acks) {
+
+    TCPServerTestSuite<DbMock> suite(nullptr, true);
+
+    suite.run([&](SocketT& socket) {
+        boost::asio::streambuf stream;
+        std::ostream os(&stream);
+        os << ":1\r\n:2\r\n+3.14\r\n";
+        boost::asio::write(socket, stream);
+
+        // TCPSession.handle_read (no ack yet - the sample is in flight)
+        suite.io.run_one();
+
+        // Drain the pipeline and let the "fsync" happen
+        suite.pline->stop();
+        BOOST_REQUIRE_EQUAL(suite.dbcon->results.size(), 1);
+        suite.dbcon->durable = suite.dbcon->wseq.load();
+
+        boost::asio::streambuf instream;
+        std::istream is(&instream);
+        bool handler_called = false;
+        auto cb = [&](boost::system::error_code err) {
+            BOOST_REQUIRE(!err);
+            handler_called = true;
+        };
+        boost::asio::async_read_until(socket, instream, '\n',
+                                      boost::bind<void>(cb, boost::asio::placeholders::error));
+
+        // Run the watermark recheck timer and the ack write
+        while(!handler_called) {
+            suite.io.run_one();
+        }
+
+        // Check - one ack covers the write
+        char buffer[0x1000];
+        is.getline(buffer, 0x1000);
+        BOOST_REQUIRE_EQUAL(std::string(buffer, buffer + 6), "+DUR 1");
+    });
+}
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_query_multiplexing) {
+
+    auto qproc = std::make_shared<QueryProcMock>();
+    qproc->results = "RESULT";
+    TCPServerTestSuite<DbMock> suite(qproc);
+
+    suite.run([&](SocketT& socket) {
+        boost::asio::streambuf stream;
+        std::ostream os(&stream);
+        // Write frame, query frame and another write frame on one session
+        os << ":1\r\n" << ":2\r\n" << "+3.14\r\n"
+           << "$10\r\ntest-query\r\n"
+           << ":3\r\n" << ":4\r\n" << "+1.61\r\n";
+
+        boost::asio::write(socket, stream);
+
+        // Results: one bulk string chunk terminated by RESP nil
+        const std::string expected = "$6\r\nRESULT\r\n$-1\r\n";
+        boost::asio::streambuf instream;
+        std::istream is(&instream);
+        bool handler_called = false;
+        auto cb = [&](boost::system::error_code err, size_t) {
+            BOOST_REQUIRE(!err);
+            handler_called = true;
+        };
+        boost::asio::async_read(socket, instream,
+                                boost::asio::transfer_at_least(expected.size()),
+                                boost::bind<void>(cb, boost::asio::placeholders::error,
+                                                  boost::asio::placeholders::bytes_transferred));
+
+        suite.io.run_one();  // TcpSession::handle_read
+        while (!handler_called) {
+            suite.io.run_one();  // query chunk writes and the client read
+        }
+        suite.pline->stop();
+
+        // The query went through the builder and the cursor was closed
+        BOOST_REQUIRE_EQUAL(qproc->last_query, "test-query");
+        BOOST_REQUIRE_EQUAL(qproc->closed_count, 1);
+
+        std::string response(expected.size(), '\0');
+        is.read(&response[0], response.size());
+        BOOST_REQUIRE_EQUAL(response, expected);
+
+        // Writes on both sides of the query frame were ingested
+        BOOST_REQUIRE_EQUAL(suite.dbcon->results.size(), 2);
+        aku_ParamId id;
+        aku_Timestamp ts;
+        double value;
+        std::tie(id, ts, value) = suite.dbcon->results.at(0);
+        BOOST_REQUIRE_EQUAL(id, 1);
+        BOOST_REQUIRE_EQUAL(ts, 2);
+        std::tie(id, ts, value) = suite.dbcon->results.at(1);
+        BOOST_REQUIRE_EQUAL(id, 3);
+        BOOST_REQUIRE_EQUAL(ts, 4);
+    });
+}
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_peer_stats) {
+    auto& registry = PeerStats::instance();
+    auto peer = registry.get_peer("127.0.0.1");
+    // The same address maps to the same entry
+    BOOST_REQUIRE_EQUAL(peer, registry.get_peer("127.0.0.1"));
+    BOOST_REQUIRE(peer != registry.get_peer("10.0.0.1"));
+
+    PeerStats::Counters::add(peer->samples, 10);
+    PeerStats::Counters::add(peer->bytes, 100);
+    PeerStats::Counters::add(peer->parse_errors, 1);
+
+    auto json = registry.to_json();
+    BOOST_REQUIRE(json.find("\"127.0.0.1\"") != std::string::npos);
+    BOOST_REQUIRE(json.find("\"samples\":10") != std::string::npos);
+    BOOST_REQUIRE(json.find("\"bytes\":100") != std::string::npos);
+    BOOST_REQUIRE(json.find("\"parse_errors\":1") != std::string::npos);
+}
@@ -9,6 +9,14 @@
 #include "util.h"
 #include "crc32c.h"
 #include "log_iface.h"
+#include "stage_profiler.h"
+#include "bit_twiddling.h"
+#include "search.h"
+
+#include <algorithm>
+#include <random>
+
+#include <thread>
 
 using namespace Akumuli;
 
@@ -155,3 +163,161 @@ BOOST_AUTO_TEST_CASE(test_crc32c_0) {
 
     BOOST_REQUIRE_EQUAL(hw, sw);
 }
+
+BOOST_AUTO_TEST_CASE(test_striped_counter) {
+    StripedCounter counter;
+    BOOST_REQUIRE_EQUAL(counter.sum(), 0ull);
+
+    const int NTHREADS = 4;
+    const u64 NITERS   = 10000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NTHREADS; t++) {
+        threads.emplace_back([&counter]() {
+            for (u64 i = 0; i < NITERS; i++) {
+                counter.add(1);
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    BOOST_REQUIRE_EQUAL(counter.sum(), NTHREADS*NITERS);
+
+    counter.reset();
+    BOOST_REQUIRE_EQUAL(counter.sum(), 0ull);
+}
+
+BOOST_AUTO_TEST_CASE(test_epoch_gc) {
+    EpochGC gc;
+    int ndeleted = 0;
+
+    // Without readers two collect calls should reclaim the node
+    gc.retire([&ndeleted]() { ndeleted++; });
+    gc.collect();
+    gc.collect();
+    BOOST_REQUIRE_EQUAL(ndeleted, 1);
+
+    // An active reader pins the node in the limbo list
+    {
+        EpochGC::Guard guard(gc);
+        gc.retire([&ndeleted]() { ndeleted++; });
+        for (int i = 0; i < 10; i++) {
+            gc.collect();
+        }
+        BOOST_REQUIRE_EQUAL(ndeleted, 1);
+    }
+    gc.collect();
+    gc.collect();
+    BOOST_REQUIRE_EQUAL(ndeleted, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_epoch_gc_concurrent) {
+    EpochGC gc;
+    std::atomic<int> shared_value(0);
+    std::atomic<bool> stop(false);
+    std::atomic<int> nretired(0), ndeleted(0);
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&]() {
+            while (!stop.load()) {
+                EpochGC::Guard guard(gc);
+                BOOST_REQUIRE_GE(shared_value.load(), 0);
+            }
+        });
+    }
+    for (int i = 0; i < 1000; i++) {
+        nretired++;
+        gc.retire([&ndeleted]() { ndeleted++; });
+    }
+    stop = true;
+    for (auto& reader: readers) {
+        reader.join();
+    }
+    gc.collect();
+    gc.collect();
+    BOOST_REQUIRE_EQUAL(nretired.load(), ndeleted.load());
+}
+
+BOOST_AUTO_TEST_CASE(test_stage_profiler) {
+    auto& profiler = StageProfiler::instance();
+    // Tagging is valid before the sampler is started
+    auto prev = StageProfiler::enter(StageProfiler::STAGE_SEQUENCER);
+    BOOST_REQUIRE_EQUAL(prev, StageProfiler::STAGE_IDLE);
+    StageProfiler::leave(prev);
+
+    profiler.start(1000);
+    BOOST_REQUIRE(profiler.is_enabled());
+    {
+        StageProfiler::ScopedStage stage(StageProfiler::STAGE_VOLUME);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    profiler.stop();
+    BOOST_REQUIRE(!profiler.is_enabled());
+
+    auto counts = profiler.get_counts();
+    BOOST_REQUIRE(counts[StageProfiler::STAGE_VOLUME] > 0);
+    BOOST_REQUIRE_EQUAL(counts[StageProfiler::STAGE_PARSER], 0ull);
+}
+
+BOOST_AUTO_TEST_CASE(test_bithacks_block_helpers) {
+    // Sizes around the SIMD width plus a large block, values with
+    // zeros, saturated words and everything in between
+    std::vector<size_t> sizes = { 0, 1, 3, 4, 5, 8, 100 };
+    for (auto n: sizes) {
+        std::vector<u64> input;
+        for (size_t i = 0; i < n; i++) {
+            switch (i % 4) {
+            case 0:
+                input.push_back(0);
+                break;
+            case 1:
+                input.push_back(~0ull);
+                break;
+            case 2:
+                input.push_back(1ull << (i % 64));
+                break;
+            default:
+                input.push_back(0xDEADBEEFCAFEBABEull >> (i % 64));
+                break;
+            }
+        }
+
+        std::vector<u8> clz(n, 0xFF), pop(n, 0xFF);
+        BitHacks::block_clz(input.data(), clz.data(), n);
+        BitHacks::block_popcount(input.data(), pop.data(), n);
+        u64 maxval = 0;
+        for (size_t i = 0; i < n; i++) {
+            BOOST_REQUIRE_EQUAL((int)clz[i], BitHacks::leading_zeroes(input[i]));
+            BOOST_REQUIRE_EQUAL((int)pop[i], BitHacks::count_bits64(input[i]));
+            maxval = std::max(maxval, input[i]);
+        }
+
+        int expected_width = 64 - BitHacks::leading_zeroes(maxval);
+        BOOST_REQUIRE_EQUAL(BitHacks::block_bit_width(input.data(), n), expected_width);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_ts_bounds_search) {
+    // Sizes below and above the linear window, duplicates included
+    std::vector<size_t> sizes = { 0, 1, 5, 64, 65, 1000 };
+    std::mt19937 gen(42);
+    for (auto n: sizes) {
+        std::vector<aku_Timestamp> data;
+        aku_Timestamp ts = 1000;
+        for (size_t i = 0; i < n; i++) {
+            ts += gen() % 3;  // stalls produce duplicates
+            data.push_back(ts);
+        }
+        std::vector<aku_Timestamp> keys = { 0, 999, 1000, 1001, ts, ts + 1, AKU_MAX_TIMESTAMP };
+        for (size_t i = 0; i < n; i += std::max(n/13, (size_t)1)) {
+            keys.push_back(data.at(i));
+        }
+        for (auto key: keys) {
+            size_t explo = std::lower_bound(data.begin(), data.end(), key) - data.begin();
+            size_t exphi = std::upper_bound(data.begin(), data.end(), key) - data.begin();
+            BOOST_REQUIRE_EQUAL(ts_lower_bound(data.data(), n, key), explo);
+            BOOST_REQUIRE_EQUAL(ts_upper_bound(data.data(), n, key), exphi);
+        }
+    }
+}
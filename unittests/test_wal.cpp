@@ -0,0 +1,164 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <boost/test/unit_test.hpp>
+#include <apr.h>
+#include <vector>
+
+#include "wal.h"
+
+using namespace Akumuli;
+
+struct AkumuliInitializer {
+    AkumuliInitializer() {
+        apr_initialize();
+    }
+};
+
+static AkumuliInitializer initializer;
+
+static const char* WALPATH = "testwal.wal";
+
+static void delete_wal() {
+    apr_pool_t* pool;
+    apr_pool_create(&pool, NULL);
+    apr_file_remove(WALPATH, pool);
+    apr_pool_destroy(pool);
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_append_replay) {
+    delete_wal();
+    const int NRECORDS = 1000;  // more than one full frame
+    {
+        Wal wal(WALPATH);
+        BOOST_REQUIRE_EQUAL(wal.open(), AKU_SUCCESS);
+        for (int i = 0; i < NRECORDS; i++) {
+            auto status = wal.append(42u, static_cast<aku_Timestamp>(i), static_cast<double>(i));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+        wal.close();
+    }
+    {
+        Wal wal(WALPATH);
+        std::vector<Wal::Record> records;
+        BOOST_REQUIRE_EQUAL(wal.replay(&records), AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(records.size(), NRECORDS);
+        for (int i = 0; i < NRECORDS; i++) {
+            BOOST_REQUIRE_EQUAL(records.at(i).id, 42u);
+            BOOST_REQUIRE_EQUAL(records.at(i).ts, static_cast<aku_Timestamp>(i));
+            BOOST_REQUIRE_EQUAL(records.at(i).value, static_cast<double>(i));
+        }
+    }
+    delete_wal();
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_rotation) {
+    delete_wal();
+    const int NRECORDS = 100;
+    const aku_Timestamp HORIZON = 50;
+    {
+        Wal wal(WALPATH);
+        BOOST_REQUIRE_EQUAL(wal.open(), AKU_SUCCESS);
+        for (int i = 0; i < NRECORDS; i++) {
+            auto status = wal.append(42u, static_cast<aku_Timestamp>(i), static_cast<double>(i));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+        // Records below the horizon are merged and should be dropped
+        BOOST_REQUIRE_EQUAL(wal.rotate(HORIZON), AKU_SUCCESS);
+        wal.close();
+    }
+    {
+        Wal wal(WALPATH);
+        std::vector<Wal::Record> records;
+        BOOST_REQUIRE_EQUAL(wal.replay(&records), AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(records.size(), NRECORDS - HORIZON);
+        for (auto const& rec: records) {
+            BOOST_REQUIRE(rec.ts >= HORIZON);
+        }
+    }
+    delete_wal();
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_torn_frame) {
+    delete_wal();
+    const int NRECORDS = 0x300;  // three full frames
+    {
+        Wal wal(WALPATH);
+        BOOST_REQUIRE_EQUAL(wal.open(), AKU_SUCCESS);
+        for (int i = 0; i < NRECORDS; i++) {
+            auto status = wal.append(42u, static_cast<aku_Timestamp>(i), static_cast<double>(i));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+        wal.close();
+    }
+    {
+        // Cut the log mid-frame to model a torn write
+        apr_pool_t* pool;
+        apr_pool_create(&pool, NULL);
+        apr_file_t* file;
+        auto status = apr_file_open(&file, WALPATH, APR_WRITE|APR_BINARY, APR_OS_DEFAULT, pool);
+        BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+        apr_finfo_t info;
+        apr_file_info_get(&info, APR_FINFO_SIZE, file);
+        apr_file_trunc(file, info.size - 8);
+        apr_file_close(file);
+        apr_pool_destroy(pool);
+    }
+    {
+        Wal wal(WALPATH);
+        std::vector<Wal::Record> records;
+        BOOST_REQUIRE_EQUAL(wal.replay(&records), AKU_SUCCESS);
+        // Only the two undamaged frames should be replayed
+        BOOST_REQUIRE_EQUAL(records.size(), 0x200);
+    }
+    delete_wal();
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_damaged_frame_header) {
+    delete_wal();
+    const int NRECORDS = 0x200;  // two full frames
+    {
+        Wal wal(WALPATH);
+        BOOST_REQUIRE_EQUAL(wal.open(), AKU_SUCCESS);
+        for (int i = 0; i < NRECORDS; i++) {
+            auto status = wal.append(42u, static_cast<aku_Timestamp>(i), static_cast<double>(i));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+        wal.close();
+    }
+    {
+        // Overwrite the record count of the second frame header with
+        // garbage to model a corrupt header
+        apr_pool_t* pool;
+        apr_pool_create(&pool, NULL);
+        apr_file_t* file;
+        auto status = apr_file_open(&file, WALPATH, APR_WRITE|APR_BINARY, APR_OS_DEFAULT, pool);
+        BOOST_REQUIRE_EQUAL(status, APR_SUCCESS);
+        // Frame header is 8 bytes (crc, count), count is the second field
+        apr_off_t off = static_cast<apr_off_t>(8 + 0x100*sizeof(Wal::Record) + 4);
+        apr_file_seek(file, APR_SET, &off);
+        u32 garbage = 0xFFFFFFFFu;
+        apr_file_write_full(file, &garbage, sizeof(garbage), NULL);
+        apr_file_close(file);
+        apr_pool_destroy(pool);
+    }
+    {
+        Wal wal(WALPATH);
+        std::vector<Wal::Record> records;
+        // The damaged tail is ignored instead of being turned into a
+        // multi-gigabyte allocation
+        BOOST_REQUIRE_EQUAL(wal.replay(&records), AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(records.size(), 0x100);
+    }
+    delete_wal();
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_empty_replay) {
+    delete_wal();
+    Wal wal(WALPATH);
+    std::vector<Wal::Record> records;
+    BOOST_REQUIRE_EQUAL(wal.replay(&records), AKU_SUCCESS);
+    BOOST_REQUIRE(records.empty());
+}